@@ -0,0 +1,263 @@
+/*
+ * expire.c - snat session expiry
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Each thread owning sessions keeps a timing wheel with one timer per
+ * session. Packets only update the session's last heard time and TCP
+ * state, the wheel is not touched in the forwarding path. When a timer
+ * fires the session's deadline is computed from last heard and the
+ * current timeout of its protocol and state: sessions still active are
+ * re-armed for their deadline, idle ones are deleted.
+ *
+ * A session has one live timer, due at s->expire. Timers of sessions
+ * re-armed earlier, or of deleted sessions whose pool index got reused,
+ * are stale and ignored when they fire, so timing_wheel_delete and its
+ * full wheel scan on re-insert are never needed.
+ *
+ * The wheel runs on a clock of 1024 ticks per second rather than on cpu
+ * clock ticks, so that the longest timeouts fit the wheel's 32 bit element
+ * times and stay off its overflow pool, and so that its bins are exactly
+ * one second: a timer due at second s->expire fires as soon as the time
+ * reaches it, never earlier.
+ */
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <snat/snat.h>
+
+/* Timers are advanced every tick, seconds */
+#define SNAT_EXPIRE_TICK 10e-3
+
+/* Expired timers processed per node call */
+#define SNAT_EXPIRE_BATCH 256
+
+vlib_node_registration_t snat_expire_node;
+
+#define foreach_snat_expire_error                       \
+_(EXPIRED, "Sessions expired")                          \
+_(REARMED, "Session timers re-armed")
+
+typedef enum {
+#define _(sym,str) SNAT_EXPIRE_ERROR_##sym,
+  foreach_snat_expire_error
+#undef _
+  SNAT_EXPIRE_N_ERROR,
+} snat_expire_error_t;
+
+static char * snat_expire_error_strings[] = {
+#define _(sym,string) string,
+  foreach_snat_expire_error
+#undef _
+};
+
+#define SNAT_EXPIRE_CLOCKS_PER_SECOND 1024
+
+static inline u64
+snat_expire_clocks (f64 now)
+{
+  return (u64) (now * SNAT_EXPIRE_CLOCKS_PER_SECOND);
+}
+
+static void
+snat_session_timers_init (snat_main_t * sm, timing_wheel_t * w, f64 now)
+{
+  u32 max_timeout;
+
+  max_timeout = clib_max (sm->udp_timeout, sm->icmp_timeout);
+  max_timeout = clib_max (max_timeout, sm->tcp_established_timeout);
+  max_timeout = clib_max (max_timeout, sm->tcp_transitory_timeout);
+
+  /* All timers on the first level of the wheel, in bins of 1s */
+  w->min_sched_time = 1.0;
+  w->max_sched_time = max_timeout + 2;
+  timing_wheel_init (w, snat_expire_clocks (now),
+                     SNAT_EXPIRE_CLOCKS_PER_SECOND);
+}
+
+/**
+ * @brief Arm the expiry timer of a session.
+ *
+ * Called for new sessions, and for recycled ones whose timeout may have
+ * become shorter. A session with an earlier timer keeps it, the timer
+ * re-arms itself when it fires.
+ *
+ * @param sm        SNAT main.
+ * @param cpu_index Thread owning the session.
+ * @param s         SNAT session.
+ * @param now       Current time.
+ */
+void
+snat_session_timer_start (snat_main_t * sm, u32 cpu_index,
+                          snat_session_t * s, f64 now)
+{
+  snat_main_per_thread_data_t *tsm =
+    vec_elt_at_index (sm->per_thread_data, cpu_index);
+  timing_wheel_t *w = &tsm->session_timers;
+  u32 expire;
+
+  expire = (u32) now + snat_session_timeout (sm, s) + 1;
+
+  if (s->expire && s->expire <= expire)
+    return;
+
+  if (PREDICT_FALSE (w->cpu_clocks_per_second == 0))
+    snat_session_timers_init (sm, w, now);
+
+  s->expire = expire;
+  timing_wheel_insert (w, (u64) expire * SNAT_EXPIRE_CLOCKS_PER_SECOND,
+                       s - tsm->sessions);
+}
+
+static void
+snat_session_delete (snat_main_t * sm, snat_main_per_thread_data_t * tsm,
+                     snat_session_t * s)
+{
+  clib_bihash_kv_8_8_t kv, value;
+  snat_user_key_t user_key;
+  snat_user_t *u = 0;
+
+  kv.key = s->in2out.as_u64;
+  if (clib_bihash_add_del_8_8 (&sm->in2out, &kv, 0 /* is_add */))
+    clib_warning ("in2out key delete failed");
+  kv.key = s->out2in.as_u64;
+  if (clib_bihash_add_del_8_8 (&sm->out2in, &kv, 0 /* is_add */))
+    clib_warning ("out2in key delete failed");
+
+  if (!snat_is_session_static (s))
+    snat_free_outside_address_and_port (sm, &s->out2in,
+                                        s->outside_address_index);
+
+  user_key.addr = s->in2out.addr;
+  user_key.fib_index = s->in2out.fib_index;
+  kv.key = user_key.as_u64;
+  if (!clib_bihash_search_8_8 (&sm->user_hash, &kv, &value))
+    {
+      u = pool_elt_at_index (tsm->users, value.value);
+      if (snat_is_session_static (s))
+        u->nstaticsessions--;
+      else
+        u->nsessions--;
+    }
+
+  clib_dlist_remove (tsm->list_pool, s->per_user_index);
+  pool_put_index (tsm->list_pool, s->per_user_index);
+  pool_put (tsm->sessions, s);
+
+  /* Last session of the user gone, delete the user */
+  if (u && u->nsessions == 0 && u->nstaticsessions == 0)
+    {
+      clib_bihash_add_del_8_8 (&sm->user_hash, &kv, 0 /* is_add */);
+      pool_put_index (tsm->list_pool, u->sessions_per_user_list_head_index);
+      vec_free (u->port_blocks);
+      pool_put (tsm->users, u);
+    }
+}
+
+/**
+ * @brief Session expiry.
+ *
+ * Polls on every thread owning sessions. The timers are advanced every
+ * SNAT_EXPIRE_TICK, and at most SNAT_EXPIRE_BATCH expired timers are
+ * processed per call so that a burst of expiring sessions is spread over
+ * several dispatch cycles instead of stalling packet processing.
+ */
+static uword
+snat_expire_node_fn (vlib_main_t * vm,
+                     vlib_node_runtime_t * node,
+                     vlib_frame_t * frame)
+{
+  snat_main_t *sm = &snat_main;
+  snat_main_per_thread_data_t *tsm;
+  snat_session_t *s;
+  f64 now = vlib_time_now (vm);
+  u32 session_index, n_left, n_expired = 0, n_rearmed = 0;
+  f64 deadline;
+
+  tsm = vec_elt_at_index (sm->per_thread_data, vm->cpu_index);
+
+  if (PREDICT_FALSE (now >= tsm->timers_next_advance))
+    {
+      tsm->timers_next_advance = now + SNAT_EXPIRE_TICK;
+
+      if (now >= tsm->expired_rate_time + 1.0)
+        {
+          tsm->expired_per_second =
+            (tsm->expired_sessions - tsm->expired_sessions_last) /
+            (now - tsm->expired_rate_time);
+          tsm->expired_sessions_last = tsm->expired_sessions;
+          tsm->expired_rate_time = now;
+        }
+
+      if (tsm->session_timers.cpu_clocks_per_second != 0)
+        tsm->expired_timers =
+          timing_wheel_advance (&tsm->session_timers,
+                                snat_expire_clocks (now),
+                                tsm->expired_timers, 0);
+    }
+
+  if (PREDICT_TRUE (vec_len (tsm->expired_timers) == 0))
+    return 0;
+
+  n_left = clib_min (vec_len (tsm->expired_timers), SNAT_EXPIRE_BATCH);
+
+  while (n_left > 0)
+    {
+      session_index = vec_pop (tsm->expired_timers);
+      n_left--;
+
+      if (pool_is_free_index (tsm->sessions, session_index))
+        continue;
+
+      s = pool_elt_at_index (tsm->sessions, session_index);
+
+      /* Stale timer, the session's live timer is due later */
+      if (s->expire > (u32) now)
+        continue;
+
+      deadline = s->last_heard + snat_session_timeout (sm, s);
+      if (deadline > now)
+        {
+          s->expire = (u32) deadline + 1;
+          timing_wheel_insert (&tsm->session_timers,
+                               (u64) s->expire *
+                               SNAT_EXPIRE_CLOCKS_PER_SECOND, session_index);
+          n_rearmed++;
+          continue;
+        }
+
+      snat_session_delete (sm, tsm, s);
+      n_expired++;
+    }
+
+  tsm->expired_sessions += n_expired;
+
+  vlib_node_increment_counter (vm, snat_expire_node.index,
+                               SNAT_EXPIRE_ERROR_EXPIRED, n_expired);
+  vlib_node_increment_counter (vm, snat_expire_node.index,
+                               SNAT_EXPIRE_ERROR_REARMED, n_rearmed);
+  return n_expired;
+}
+
+/* Enabled by snat_config when sessions are kept */
+VLIB_REGISTER_NODE (snat_expire_node) = {
+  .function = snat_expire_node_fn,
+  .name = "snat-expire",
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_DISABLED,
+
+  .n_errors = ARRAY_LEN(snat_expire_error_strings),
+  .error_strings = snat_expire_error_strings,
+};
@@ -20,7 +20,9 @@
 #include <vnet/ip/ip.h>
 #include <vnet/ethernet/ethernet.h>
 #include <vnet/fib/ip4_fib.h>
+#include <vnet/handoff.h>
 #include <snat/snat.h>
+#include <snat/snat_det.h>
 
 #include <vppinfra/hash.h>
 #include <vppinfra/error.h>
@@ -49,6 +51,18 @@ static u8 * format_snat_in2out_trace (u8 * s, va_list * args)
   return s;
 }
 
+static u8 * format_snat_det_in2out_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  snat_in2out_trace_t * t = va_arg (*args, snat_in2out_trace_t *);
+
+  s = format (s, "SNAT_DET_IN2OUT: sw_if_index %d, next index %d, session %d",
+              t->sw_if_index, t->next_index, t->session_index);
+
+  return s;
+}
+
 static u8 * format_snat_in2out_fast_trace (u8 * s, va_list * args)
 {
   CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
@@ -64,6 +78,7 @@ static u8 * format_snat_in2out_fast_trace (u8 * s, va_list * args)
 vlib_node_registration_t snat_in2out_node;
 vlib_node_registration_t snat_in2out_slowpath_node;
 vlib_node_registration_t snat_in2out_fast_node;
+vlib_node_registration_t snat_det_in2out_node;
 
 #define foreach_snat_in2out_error                       \
 _(UNSUPPORTED_PROTOCOL, "Unsupported protocol")         \
@@ -93,6 +108,20 @@ typedef enum {
   SNAT_IN2OUT_N_NEXT,
 } snat_in2out_next_t;
 
+static inline int
+snat_alloc_outside_port_for_user (snat_main_t * sm, u32 cpu_index,
+                                  u32 user_index, snat_session_key_t * k,
+                                  u32 * address_indexp)
+{
+  if (sm->port_block_size)
+    return snat_alloc_outside_address_and_port_in_block (sm, cpu_index,
+                                                         user_index, k,
+                                                         address_indexp);
+
+  return snat_alloc_outside_address_and_port (sm, cpu_index, k,
+                                              address_indexp);
+}
+
 
 static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
                       ip4_header_t * ip0,
@@ -100,8 +129,11 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
                       snat_session_key_t * key0,
                       snat_session_t ** sessionp,
                       vlib_node_runtime_t * node,
-                      u32 next0)
+                      u32 next0,
+                      f64 now,
+                      u32 cpu_index)
 {
+  snat_main_per_thread_data_t *tsm = &sm->per_thread_data[cpu_index];
   snat_user_t *u;
   snat_user_key_t user_key;
   snat_session_t *s;
@@ -132,25 +164,25 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
   if (clib_bihash_search_8_8 (&sm->user_hash, &kv0, &value0))
     {
       /* no, make a new one */
-      pool_get (sm->users, u);
+      pool_get (tsm->users, u);
       memset (u, 0, sizeof (*u));
       u->addr = ip0->src_address;
 
-      pool_get (sm->list_pool, per_user_list_head_elt);
+      pool_get (tsm->list_pool, per_user_list_head_elt);
 
       u->sessions_per_user_list_head_index = per_user_list_head_elt -
-        sm->list_pool;
+        tsm->list_pool;
 
-      clib_dlist_init (sm->list_pool, u->sessions_per_user_list_head_index);
+      clib_dlist_init (tsm->list_pool, u->sessions_per_user_list_head_index);
 
-      kv0.value = u - sm->users;
+      kv0.value = u - tsm->users;
 
       /* add user */
       clib_bihash_add_del_8_8 (&sm->user_hash, &kv0, 1 /* is_add */);
     }
   else
     {
-      u = pool_elt_at_index (sm->users, value0.value);
+      u = pool_elt_at_index (tsm->users, value0.value);
     }
 
   /* Over quota? Recycle the least recently used dynamic translation */
@@ -160,25 +192,25 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
       do {
           oldest_per_user_translation_list_index =
             clib_dlist_remove_head
-            (sm->list_pool, u->sessions_per_user_list_head_index);
+            (tsm->list_pool, u->sessions_per_user_list_head_index);
 
           ASSERT (oldest_per_user_translation_list_index != ~0);
 
           /* add it back to the end of the LRU list */
-          clib_dlist_addtail (sm->list_pool,
+          clib_dlist_addtail (tsm->list_pool,
                               u->sessions_per_user_list_head_index,
                               oldest_per_user_translation_list_index);
           /* Get the list element */
           oldest_per_user_translation_list_elt =
-            pool_elt_at_index (sm->list_pool,
+            pool_elt_at_index (tsm->list_pool,
                                oldest_per_user_translation_list_index);
 
           /* Get the session index from the list element */
           session_index = oldest_per_user_translation_list_elt->value;
 
           /* Get the session */
-          s = pool_elt_at_index (sm->sessions, session_index);
-      } while (!snat_is_session_static (s));
+          s = pool_elt_at_index (tsm->sessions, session_index);
+      } while (snat_is_session_static (s));
 
       /* Remove in2out, out2in keys */
       kv0.key = s->in2out.as_u64;
@@ -192,7 +224,8 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
         (sm, &s->out2in, s->outside_address_index);
       s->outside_address_index = ~0;
 
-      if (snat_alloc_outside_address_and_port (sm, &key1, &address_index))
+      if (snat_alloc_outside_port_for_user (sm, cpu_index, u - tsm->users,
+                                            &key1, &address_index))
         {
           ASSERT(0);
 
@@ -200,6 +233,8 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
           return SNAT_IN2OUT_NEXT_DROP;
         }
       s->outside_address_index = address_index;
+      s->flags &= ~(SNAT_SESSION_FLAG_TCP_ESTABLISHED |
+                    SNAT_SESSION_FLAG_TCP_CLOSING);
     }
   else
     {
@@ -210,7 +245,9 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
         {
           static_mapping = 0;
           /* Try to create dynamic translation */
-          if (snat_alloc_outside_address_and_port (sm, &key1, &address_index))
+          if (snat_alloc_outside_port_for_user (sm, cpu_index,
+                                                u - tsm->users, &key1,
+                                                &address_index))
             {
               b0->error = node->errors[SNAT_IN2OUT_ERROR_OUT_OF_PORTS];
               return SNAT_IN2OUT_NEXT_DROP;
@@ -218,7 +255,7 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
         }
 
       /* Create a new session */
-      pool_get (sm->sessions, s);
+      pool_get (tsm->sessions, s);
       memset (s, 0, sizeof (*s));
       
       s->outside_address_index = address_index;
@@ -234,16 +271,16 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
         }
 
       /* Create list elts */
-      pool_get (sm->list_pool, per_user_translation_list_elt);
-      clib_dlist_init (sm->list_pool, per_user_translation_list_elt -
-                       sm->list_pool);
+      pool_get (tsm->list_pool, per_user_translation_list_elt);
+      clib_dlist_init (tsm->list_pool, per_user_translation_list_elt -
+                       tsm->list_pool);
 
-      per_user_translation_list_elt->value = s - sm->sessions;
-      s->per_user_index = per_user_translation_list_elt - sm->list_pool;
+      per_user_translation_list_elt->value = s - tsm->sessions;
+      s->per_user_index = per_user_translation_list_elt - tsm->list_pool;
       s->per_user_list_head_index = u->sessions_per_user_list_head_index;
 
-      clib_dlist_addtail (sm->list_pool, s->per_user_list_head_index,
-                          per_user_translation_list_elt - sm->list_pool);
+      clib_dlist_addtail (tsm->list_pool, s->per_user_list_head_index,
+                          per_user_translation_list_elt - tsm->list_pool);
    }
   
   s->in2out = *key0;
@@ -252,14 +289,16 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
   s->out2in.fib_index = outside_fib_index;
   *sessionp = s;
 
+  snat_session_timer_start (sm, cpu_index, s, now);
+
   /* Add to translation hashes */
   kv0.key = s->in2out.as_u64;
-  kv0.value = s - sm->sessions;
+  kv0.value = s - tsm->sessions;
   if (clib_bihash_add_del_8_8 (&sm->in2out, &kv0, 1 /* is_add */))
       clib_warning ("in2out key add failed");
   
   kv0.key = s->out2in.as_u64;
-  kv0.value = s - sm->sessions;
+  kv0.value = s - tsm->sessions;
   
   if (clib_bihash_add_del_8_8 (&sm->out2in, &kv0, 1 /* is_add */))
       clib_warning ("out2in key add failed");
@@ -275,8 +314,10 @@ static inline u32 icmp_in2out_slow_path (snat_main_t *sm,
                                          u32 rx_fib_index0,
                                          vlib_node_runtime_t * node,
                                          u32 next0,
-                                         f64 now)
+                                         f64 now,
+                                         u32 cpu_index)
 {
+  snat_main_per_thread_data_t *tsm = &sm->per_thread_data[cpu_index];
   snat_session_key_t key0;
   icmp_echo_header_t *echo0;
   clib_bihash_kv_8_8_t kv0, value0;
@@ -320,13 +361,13 @@ static inline u32 icmp_in2out_slow_path (snat_main_t *sm,
         return next0;
       
       next0 = slow_path (sm, b0, ip0, rx_fib_index0, &key0,
-                         &s0, node, next0);
+                         &s0, node, next0, now, cpu_index);
       
       if (PREDICT_FALSE (next0 == SNAT_IN2OUT_NEXT_DROP))
         return next0;
     }
   else
-    s0 = pool_elt_at_index (sm->sessions, value0.value);
+    s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
   old_addr0 = ip0->src_address.as_u32;
   ip0->src_address = s0->out2in.addr;
@@ -355,8 +396,8 @@ static inline u32 icmp_in2out_slow_path (snat_main_t *sm,
   /* Per-user LRU list maintenance for dynamic translations */
   if (!snat_is_session_static (s0))
     {
-      clib_dlist_remove (sm->list_pool, s0->per_user_index);
-      clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+      clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+      clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                           s0->per_user_index);
     }
 
@@ -375,6 +416,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
   snat_runtime_t * rt = (snat_runtime_t *)node->runtime_data;
   f64 now = vlib_time_now (vm);
   u32 stats_node_index;
+  u32 cpu_index = os_get_cpu_number ();
+  snat_main_per_thread_data_t *tsm = &sm->per_thread_data[cpu_index];
 
   stats_node_index = is_slow_path ? snat_in2out_slowpath_node.index :
     snat_in2out_node.index;
@@ -471,7 +514,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 {
                   next0 = icmp_in2out_slow_path 
                     (sm, b0, ip0, icmp0, sw_if_index0, rx_fib_index0, 
-                     node, next0, now);
+                     node, next0, now, cpu_index);
                   goto trace00;
                 }
             }
@@ -512,7 +555,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                     goto trace00;
                   
                   next0 = slow_path (sm, b0, ip0, rx_fib_index0, &key0,
-                                     &s0, node, next0);
+                                     &s0, node, next0, now, cpu_index);
                   if (PREDICT_FALSE (next0 == SNAT_IN2OUT_NEXT_DROP))
                     goto trace00;
                 }
@@ -523,7 +566,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 }
             }
           else
-            s0 = pool_elt_at_index (sm->sessions, value0.value);
+            s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
           old_addr0 = ip0->src_address.as_u32;
           ip0->src_address = s0->out2in.addr;
@@ -541,6 +584,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
               old_port0 = tcp0->ports.src;
               tcp0->ports.src = s0->out2in.port;
               new_port0 = tcp0->ports.src;
+              snat_session_tcp_state_update (s0, tcp0, 0);
 
               sum0 = tcp0->checksum;
               sum0 = ip_csum_update (sum0, old_addr0, new_addr0,
@@ -565,8 +609,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
           /* Per-user LRU list maintenance for dynamic translation */
           if (!snat_is_session_static (s0))
             {
-              clib_dlist_remove (sm->list_pool, s0->per_user_index);
-              clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+              clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+              clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                                   s0->per_user_index);
             }
         trace00:
@@ -581,7 +625,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
               t->next_index = next0;
                   t->session_index = ~0;
               if (s0)
-                  t->session_index = s0 - sm->sessions;
+                  t->session_index = s0 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_IN2OUT_NEXT_DROP;
@@ -620,7 +664,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 {
                   next1 = icmp_in2out_slow_path 
                     (sm, b1, ip1, icmp1, sw_if_index1, rx_fib_index1, node, next1,
-                     now);
+                     now, cpu_index);
                   goto trace01;
                 }
             }
@@ -661,7 +705,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                     goto trace01;
                   
                   next1 = slow_path (sm, b1, ip1, rx_fib_index1, &key1,
-                                     &s1, node, next1);
+                                     &s1, node, next1, now, cpu_index);
                   if (PREDICT_FALSE (next1 == SNAT_IN2OUT_NEXT_DROP))
                     goto trace01;
                 }
@@ -672,7 +716,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 }
             }
           else
-            s1 = pool_elt_at_index (sm->sessions, value1.value);
+            s1 = pool_elt_at_index (tsm->sessions, value1.value);
 
           old_addr1 = ip1->src_address.as_u32;
           ip1->src_address = s1->out2in.addr;
@@ -690,6 +734,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
               old_port1 = tcp1->ports.src;
               tcp1->ports.src = s1->out2in.port;
               new_port1 = tcp1->ports.src;
+              snat_session_tcp_state_update (s1, tcp1, 0);
 
               sum1 = tcp1->checksum;
               sum1 = ip_csum_update (sum1, old_addr1, new_addr1,
@@ -714,8 +759,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
           /* Per-user LRU list maintenance for dynamic translation */
           if (!snat_is_session_static (s1))
             {
-              clib_dlist_remove (sm->list_pool, s1->per_user_index);
-              clib_dlist_addtail (sm->list_pool, s1->per_user_list_head_index,
+              clib_dlist_remove (tsm->list_pool, s1->per_user_index);
+              clib_dlist_addtail (tsm->list_pool, s1->per_user_list_head_index,
                                   s1->per_user_index);
             }
         trace01:
@@ -729,7 +774,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
               t->next_index = next1;
               t->session_index = ~0;
               if (s1)
-                t->session_index = s1 - sm->sessions;
+                t->session_index = s1 - tsm->sessions;
             }
 
           pkts_processed += next1 != SNAT_IN2OUT_NEXT_DROP;
@@ -805,7 +850,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 {
                   next0 = icmp_in2out_slow_path 
                     (sm, b0, ip0, icmp0, sw_if_index0, rx_fib_index0, node, next0,
-                     now);
+                     now, cpu_index);
                   goto trace0;
                 }
             }
@@ -846,7 +891,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                     goto trace0;
                   
                   next0 = slow_path (sm, b0, ip0, rx_fib_index0, &key0,
-                                     &s0, node, next0);
+                                     &s0, node, next0, now, cpu_index);
                   if (PREDICT_FALSE (next0 == SNAT_IN2OUT_NEXT_DROP))
                     goto trace0;
                 }
@@ -857,7 +902,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 }
             }
           else
-            s0 = pool_elt_at_index (sm->sessions, value0.value);
+            s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
           old_addr0 = ip0->src_address.as_u32;
           ip0->src_address = s0->out2in.addr;
@@ -875,6 +920,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
               old_port0 = tcp0->ports.src;
               tcp0->ports.src = s0->out2in.port;
               new_port0 = tcp0->ports.src;
+              snat_session_tcp_state_update (s0, tcp0, 0);
 
               sum0 = tcp0->checksum;
               sum0 = ip_csum_update (sum0, old_addr0, new_addr0,
@@ -899,8 +945,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
           /* Per-user LRU list maintenance for dynamic translation */
           if (!snat_is_session_static (s0))
             {
-              clib_dlist_remove (sm->list_pool, s0->per_user_index);
-              clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+              clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+              clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                                   s0->per_user_index);
             }
 
@@ -915,7 +961,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
               t->next_index = next0;
                   t->session_index = ~0;
               if (s0)
-                  t->session_index = s0 - sm->sessions;
+                  t->session_index = s0 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_IN2OUT_NEXT_DROP;
@@ -1273,3 +1319,438 @@ VLIB_REGISTER_NODE (snat_in2out_fast_node) = {
 };
 
 VLIB_NODE_FUNCTION_MULTIARCH (snat_in2out_fast_node, snat_in2out_fast_static_map_fn);
+
+typedef struct {
+  u32 next_worker_index;
+  u8 do_handoff;
+} snat_in2out_worker_handoff_trace_t;
+
+static u8 *
+format_snat_in2out_worker_handoff_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  snat_in2out_worker_handoff_trace_t * t =
+    va_arg (*args, snat_in2out_worker_handoff_trace_t *);
+  char * m;
+
+  m = t->do_handoff ? "next worker" : "same worker";
+  s = format (s, "SNAT_IN2OUT_WORKER_HANDOFF: %s %d", m, t->next_worker_index);
+
+  return s;
+}
+
+vlib_node_registration_t snat_in2out_worker_handoff_node;
+
+#define foreach_snat_worker_handoff_error                       \
+_(SAME_WORKER, "Packets processed on the receiving worker")     \
+_(DO_HANDOFF, "Packets handed off to the session owner")
+
+typedef enum {
+#define _(sym,str) SNAT_WORKER_HANDOFF_ERROR_##sym,
+  foreach_snat_worker_handoff_error
+#undef _
+  SNAT_WORKER_HANDOFF_N_ERROR,
+} snat_worker_handoff_error_t;
+
+static char * snat_worker_handoff_error_strings[] = {
+#define _(sym,string) string,
+  foreach_snat_worker_handoff_error
+#undef _
+};
+
+/*
+ * Sessions of an inside host are owned by one worker, selected by a hash
+ * of the source address. Packets received by that worker go straight to
+ * snat-in2out (snat-det-in2out in deterministic mode), others are handed
+ * off through the frame queues.
+ */
+static uword
+snat_in2out_worker_handoff_fn (vlib_main_t * vm,
+                               vlib_node_runtime_t * node,
+                               vlib_frame_t * frame)
+{
+  snat_main_t *sm = &snat_main;
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  u32 n_left_from, *from, *to_next = 0;
+  static __thread vlib_frame_queue_elt_t **handoff_queue_elt_by_worker_index;
+  vlib_frame_queue_elt_t *hf = 0;
+  vlib_frame_t *f = 0;
+  int i;
+  u32 n_left_to_next_worker = 0, *to_next_worker = 0;
+  u32 next_worker_index = 0;
+  u32 current_worker_index = ~0;
+  u32 cpu_index = os_get_cpu_number ();
+  u32 n_same_worker = 0;
+  ip_lookup_main_t * lm = sm->ip4_lookup_main;
+  vnet_feature_config_main_t * cm =
+    &lm->feature_config_mains[VNET_IP_RX_UNICAST_FEAT];
+
+  if (PREDICT_FALSE (handoff_queue_elt_by_worker_index == 0))
+    vec_validate (handoff_queue_elt_by_worker_index, tm->n_vlib_mains - 1);
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+
+  while (n_left_from > 0)
+    {
+      u32 bi0;
+      vlib_buffer_t *b0;
+      ip4_header_t *ip0;
+      u32 next0;
+      u8 do_handoff;
+
+      bi0 = from[0];
+      from += 1;
+      n_left_from -= 1;
+
+      b0 = vlib_get_buffer (vm, bi0);
+
+      /* Step over this feature, the owner continues with snat-in2out */
+      vnet_get_config_data (&cm->config_main,
+                            &b0->current_config_index,
+                            &next0,
+                            0 /* sizeof config data */);
+
+      ip0 = vlib_buffer_get_current (b0);
+
+      next_worker_index = snat_get_worker_in2out (sm, &ip0->src_address);
+
+      if (PREDICT_FALSE (next_worker_index != cpu_index))
+        {
+          do_handoff = 1;
+
+          if (next_worker_index != current_worker_index)
+            {
+              if (hf)
+                hf->n_vectors = VLIB_FRAME_SIZE - n_left_to_next_worker;
+
+              hf = dpdk_get_handoff_queue_elt (next_worker_index,
+                                               handoff_queue_elt_by_worker_index);
+
+              n_left_to_next_worker = VLIB_FRAME_SIZE - hf->n_vectors;
+              to_next_worker = &hf->buffer_index[hf->n_vectors];
+              current_worker_index = next_worker_index;
+            }
+
+          /* handoff-dispatch on the owner sends it to the session owner */
+          vnet_buffer (b0)->handoff.next_index = sm->in2out_handoff_next_index;
+
+          /* enqueue to correct worker thread */
+          to_next_worker[0] = bi0;
+          to_next_worker++;
+          n_left_to_next_worker--;
+
+          if (n_left_to_next_worker == 0)
+            {
+              hf->n_vectors = VLIB_FRAME_SIZE;
+              vlib_put_handoff_queue_elt (next_worker_index, hf);
+              current_worker_index = ~0;
+              handoff_queue_elt_by_worker_index[next_worker_index] = 0;
+              hf = 0;
+            }
+        }
+      else
+        {
+          do_handoff = 0;
+
+          if (!f)
+            {
+              f = vlib_get_frame_to_node (vm, sm->in2out_node_index);
+              to_next = vlib_frame_vector_args (f);
+            }
+
+          to_next[0] = bi0;
+          to_next += 1;
+          f->n_vectors++;
+          n_same_worker++;
+        }
+
+      if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)
+                        && (b0->flags & VLIB_BUFFER_IS_TRACED)))
+        {
+          snat_in2out_worker_handoff_trace_t *t =
+            vlib_add_trace (vm, node, b0, sizeof (*t));
+          t->next_worker_index = next_worker_index;
+          t->do_handoff = do_handoff;
+        }
+    }
+
+  if (f)
+    vlib_put_frame_to_node (vm, sm->in2out_node_index, f);
+
+  if (hf)
+    hf->n_vectors = VLIB_FRAME_SIZE - n_left_to_next_worker;
+
+  /* Ship frames to the worker nodes */
+  for (i = 0; i < vec_len (handoff_queue_elt_by_worker_index); i++)
+    {
+      if (handoff_queue_elt_by_worker_index[i])
+        {
+          hf = handoff_queue_elt_by_worker_index[i];
+          vlib_put_handoff_queue_elt (i, hf);
+          handoff_queue_elt_by_worker_index[i] = 0;
+        }
+    }
+  vlib_publish_handoff_queue_elts ();
+
+  vlib_node_increment_counter (vm, snat_in2out_worker_handoff_node.index,
+                               SNAT_WORKER_HANDOFF_ERROR_SAME_WORKER,
+                               n_same_worker);
+  vlib_node_increment_counter (vm, snat_in2out_worker_handoff_node.index,
+                               SNAT_WORKER_HANDOFF_ERROR_DO_HANDOFF,
+                               frame->n_vectors - n_same_worker);
+  return frame->n_vectors;
+}
+
+VLIB_REGISTER_NODE (snat_in2out_worker_handoff_node) = {
+  .function = snat_in2out_worker_handoff_fn,
+  .name = "snat-in2out-worker-handoff",
+  .vector_size = sizeof (u32),
+  .format_trace = format_snat_in2out_worker_handoff_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(snat_worker_handoff_error_strings),
+  .error_strings = snat_worker_handoff_error_strings,
+
+  .n_next_nodes = 1,
+
+  .next_nodes = {
+    [0] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (snat_in2out_worker_handoff_node,
+                              snat_in2out_worker_handoff_fn);
+
+/**
+ * @brief Deterministic in2out translation.
+ *
+ * The outside address and port range of the inside host are computed from
+ * its deterministic mapping, only the per-host session vector is searched
+ * to keep the outside port of a flow stable.
+ */
+static uword
+snat_det_in2out_node_fn (vlib_main_t * vm,
+                         vlib_node_runtime_t * node,
+                         vlib_frame_t * frame)
+{
+  u32 n_left_from, * from, * to_next;
+  snat_in2out_next_t next_index;
+  u32 pkts_processed = 0;
+  snat_main_t * sm = &snat_main;
+  snat_runtime_t * rt = (snat_runtime_t *)node->runtime_data;
+  u32 now = (u32) vlib_time_now (vm);
+  u32 cpu_index = os_get_cpu_number ();
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+  next_index = node->cached_next_index;
+
+  while (n_left_from > 0)
+    {
+      u32 n_left_to_next;
+
+      vlib_get_next_frame (vm, node, next_index,
+			   to_next, n_left_to_next);
+
+      while (n_left_from > 0 && n_left_to_next > 0)
+	{
+          u32 bi0;
+	  vlib_buffer_t * b0;
+          u32 next0;
+          u32 sw_if_index0;
+          ip4_header_t * ip0;
+          ip_csum_t sum0;
+          u32 new_addr0, old_addr0;
+          u16 old_port0, new_port0, lo_port0;
+          udp_header_t * udp0;
+          tcp_header_t * tcp0;
+          icmp46_header_t * icmp0;
+          icmp_echo_header_t * echo0 = 0;
+          u32 proto0;
+          ip4_address_t out_addr0;
+          snat_det_map_t * dm0;
+          snat_det_session_t * ses0 = 0;
+
+          /* speculatively enqueue b0 to the current next frame */
+	  bi0 = from[0];
+	  to_next[0] = bi0;
+	  from += 1;
+	  to_next += 1;
+	  n_left_from -= 1;
+	  n_left_to_next -= 1;
+
+	  b0 = vlib_get_buffer (vm, bi0);
+          next0 = SNAT_IN2OUT_NEXT_LOOKUP;
+
+          ip0 = vlib_buffer_get_current (b0);
+          udp0 = ip4_next_header (ip0);
+          tcp0 = (tcp_header_t *) udp0;
+          icmp0 = (icmp46_header_t *) udp0;
+
+          sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_RX];
+
+          proto0 = ~0;
+          proto0 = (ip0->protocol == IP_PROTOCOL_UDP)
+            ? SNAT_PROTOCOL_UDP : proto0;
+          proto0 = (ip0->protocol == IP_PROTOCOL_TCP)
+            ? SNAT_PROTOCOL_TCP : proto0;
+          proto0 = (ip0->protocol == IP_PROTOCOL_ICMP)
+            ? SNAT_PROTOCOL_ICMP : proto0;
+
+          if (PREDICT_FALSE (proto0 == ~0))
+            goto trace0;
+
+          if (PREDICT_FALSE(rt->cached_sw_if_index != sw_if_index0))
+            {
+              ip4_address_t * first_int_addr;
+
+              first_int_addr =
+                ip4_interface_first_address (sm->ip4_main, sw_if_index0,
+                                             0 /* just want the address */);
+              rt->cached_sw_if_index = sw_if_index0;
+              rt->cached_ip4_address = first_int_addr ?
+                first_int_addr->as_u32 : 0;
+            }
+
+          /* Don't NAT packet aimed at the intfc address */
+          if (PREDICT_FALSE(ip0->dst_address.as_u32 ==
+                            rt->cached_ip4_address))
+            goto trace0;
+
+          if (PREDICT_FALSE (proto0 == SNAT_PROTOCOL_ICMP))
+            {
+              if (PREDICT_FALSE(icmp0->type != ICMP4_echo_request))
+                {
+                  b0->error = node->errors[SNAT_IN2OUT_ERROR_BAD_ICMP_TYPE];
+                  next0 = SNAT_IN2OUT_NEXT_DROP;
+                  goto trace0;
+                }
+              echo0 = (icmp_echo_header_t *)(icmp0+1);
+              old_port0 = echo0->identifier;
+            }
+          else
+            old_port0 = udp0->src_port;
+
+          dm0 = snat_det_map_by_user (sm, &ip0->src_address);
+          if (PREDICT_FALSE (!dm0))
+            {
+              b0->error = node->errors[SNAT_IN2OUT_ERROR_NO_TRANSLATION];
+              next0 = SNAT_IN2OUT_NEXT_DROP;
+              goto trace0;
+            }
+
+          snat_det_forward (dm0, &ip0->src_address, &out_addr0, &lo_port0);
+
+          ses0 = snat_det_find_ses_by_in (sm, dm0, &ip0->src_address,
+                                          old_port0, proto0, now);
+          if (PREDICT_FALSE (!ses0))
+            {
+              ses0 = snat_det_ses_create (sm, cpu_index, dm0,
+                                          &ip0->src_address, lo_port0,
+                                          old_port0, proto0, now);
+              if (PREDICT_FALSE (!ses0))
+                {
+                  b0->error = node->errors[SNAT_IN2OUT_ERROR_OUT_OF_PORTS];
+                  next0 = SNAT_IN2OUT_NEXT_DROP;
+                  goto trace0;
+                }
+            }
+          ses0->last_heard = now;
+          new_port0 = ses0->out_port;
+
+          old_addr0 = ip0->src_address.as_u32;
+          new_addr0 = out_addr0.as_u32;
+          ip0->src_address.as_u32 = new_addr0;
+          vnet_buffer(b0)->sw_if_index[VLIB_TX] = sm->outside_fib_index;
+
+          sum0 = ip0->checksum;
+          sum0 = ip_csum_update (sum0, old_addr0, new_addr0,
+                                 ip4_header_t,
+                                 src_address /* changed member */);
+          ip0->checksum = ip_csum_fold (sum0);
+
+          if (PREDICT_FALSE (proto0 == SNAT_PROTOCOL_ICMP))
+            {
+              echo0->identifier = new_port0;
+
+              sum0 = icmp0->checksum;
+              sum0 = ip_csum_update (sum0, old_port0, new_port0,
+                                     icmp_echo_header_t, identifier);
+              icmp0->checksum = ip_csum_fold (sum0);
+            }
+          else if (PREDICT_TRUE(proto0 == SNAT_PROTOCOL_TCP))
+            {
+              tcp0->ports.src = new_port0;
+              snat_session_tcp_state_update (ses0, tcp0, 0);
+
+              sum0 = tcp0->checksum;
+              sum0 = ip_csum_update (sum0, old_addr0, new_addr0,
+                                     ip4_header_t,
+                                     dst_address /* changed member */);
+              sum0 = ip_csum_update (sum0, old_port0, new_port0,
+                                     ip4_header_t /* cheat */,
+                                     length /* changed member */);
+              tcp0->checksum = ip_csum_fold(sum0);
+            }
+          else
+            {
+              udp0->src_port = new_port0;
+              udp0->checksum = 0;
+            }
+
+        trace0:
+          if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)
+                            && (b0->flags & VLIB_BUFFER_IS_TRACED)))
+            {
+              snat_in2out_trace_t *t =
+                 vlib_add_trace (vm, node, b0, sizeof (*t));
+              t->sw_if_index = sw_if_index0;
+              t->next_index = next0;
+              t->session_index = ~0;
+              if (ses0)
+                t->session_index =
+                  ses0 - *snat_det_user_sessions (dm0, &ip0->src_address);
+            }
+
+          pkts_processed += next0 != SNAT_IN2OUT_NEXT_DROP;
+
+          /* verify speculative enqueue, maybe switch current next frame */
+	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+					   to_next, n_left_to_next,
+					   bi0, next0);
+	}
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+
+  vlib_node_increment_counter (vm, snat_det_in2out_node.index,
+                               SNAT_IN2OUT_ERROR_IN2OUT_PACKETS,
+                               pkts_processed);
+  return frame->n_vectors;
+}
+
+VLIB_REGISTER_NODE (snat_det_in2out_node) = {
+  .function = snat_det_in2out_node_fn,
+  .name = "snat-det-in2out",
+  .vector_size = sizeof (u32),
+  .format_trace = format_snat_det_in2out_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(snat_in2out_error_strings),
+  .error_strings = snat_in2out_error_strings,
+
+  .runtime_data_bytes = sizeof (snat_runtime_t),
+
+  .n_next_nodes = SNAT_IN2OUT_N_NEXT,
+
+  /* edit / add dispositions here */
+  .next_nodes = {
+    [SNAT_IN2OUT_NEXT_DROP] = "error-drop",
+    [SNAT_IN2OUT_NEXT_LOOKUP] = "ip4-lookup",
+    [SNAT_IN2OUT_NEXT_SLOW_PATH] = "snat-in2out-slowpath",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (snat_det_in2out_node, snat_det_in2out_node_fn);
@@ -20,7 +20,9 @@
 #include <vnet/ip/ip.h>
 #include <vnet/ethernet/ethernet.h>
 #include <vnet/fib/ip4_fib.h>
+#include <vnet/handoff.h>
 #include <snat/snat.h>
+#include <snat/snat_det.h>
 
 #include <vppinfra/hash.h>
 #include <vppinfra/error.h>
@@ -55,9 +57,20 @@ static u8 * format_snat_out2in_fast_trace (u8 * s, va_list * args)
   return s;
 }
 
+static u8 * format_snat_det_out2in_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  snat_out2in_trace_t * t = va_arg (*args, snat_out2in_trace_t *);
+
+  s = format (s, "SNAT_DET_OUT2IN: sw_if_index %d, next index %d, session %d",
+              t->sw_if_index, t->next_index, t->session_index);
+  return s;
+}
 
 vlib_node_registration_t snat_out2in_node;
 vlib_node_registration_t snat_out2in_fast_node;
+vlib_node_registration_t snat_det_out2in_node;
 
 #define foreach_snat_out2in_error                       \
 _(UNSUPPORTED_PROTOCOL, "Unsupported protocol")         \
@@ -94,6 +107,8 @@ typedef enum {
  * @param in2out In2out SNAT session key.
  * @param out2in Out2in SNAT session key.
  * @param node   Vlib node.
+ * @param now    Current time.
+ * @param cpu_index Thread owning the session.
  *
  * @returns SNAT session if successfully created otherwise 0.
  */
@@ -102,8 +117,11 @@ create_session_for_static_mapping (snat_main_t *sm,
                                    vlib_buffer_t *b0,
                                    snat_session_key_t in2out,
                                    snat_session_key_t out2in,
-                                   vlib_node_runtime_t * node)
+                                   vlib_node_runtime_t * node,
+                                   f64 now,
+                                   u32 cpu_index)
 {
+  snat_main_per_thread_data_t *tsm = &sm->per_thread_data[cpu_index];
   snat_user_t *u;
   snat_user_key_t user_key;
   snat_session_t *s;
@@ -119,28 +137,28 @@ create_session_for_static_mapping (snat_main_t *sm,
   if (clib_bihash_search_8_8 (&sm->user_hash, &kv0, &value0))
     {
       /* no, make a new one */
-      pool_get (sm->users, u);
+      pool_get (tsm->users, u);
       memset (u, 0, sizeof (*u));
       u->addr = in2out.addr;
 
-      pool_get (sm->list_pool, per_user_list_head_elt);
+      pool_get (tsm->list_pool, per_user_list_head_elt);
 
       u->sessions_per_user_list_head_index = per_user_list_head_elt -
-        sm->list_pool;
+        tsm->list_pool;
 
-      clib_dlist_init (sm->list_pool, u->sessions_per_user_list_head_index);
+      clib_dlist_init (tsm->list_pool, u->sessions_per_user_list_head_index);
 
-      kv0.value = u - sm->users;
+      kv0.value = u - tsm->users;
 
       /* add user */
       clib_bihash_add_del_8_8 (&sm->user_hash, &kv0, 1 /* is_add */);
     }
   else
     {
-      u = pool_elt_at_index (sm->users, value0.value);
+      u = pool_elt_at_index (tsm->users, value0.value);
     }
 
-  pool_get (sm->sessions, s);
+  pool_get (tsm->sessions, s);
   memset (s, 0, sizeof (*s));
 
   s->outside_address_index = ~0;
@@ -148,16 +166,16 @@ create_session_for_static_mapping (snat_main_t *sm,
   u->nstaticsessions++;
 
   /* Create list elts */
-  pool_get (sm->list_pool, per_user_translation_list_elt);
-  clib_dlist_init (sm->list_pool, per_user_translation_list_elt -
-                   sm->list_pool);
+  pool_get (tsm->list_pool, per_user_translation_list_elt);
+  clib_dlist_init (tsm->list_pool, per_user_translation_list_elt -
+                   tsm->list_pool);
 
-  per_user_translation_list_elt->value = s - sm->sessions;
-  s->per_user_index = per_user_translation_list_elt - sm->list_pool;
+  per_user_translation_list_elt->value = s - tsm->sessions;
+  s->per_user_index = per_user_translation_list_elt - tsm->list_pool;
   s->per_user_list_head_index = u->sessions_per_user_list_head_index;
 
-  clib_dlist_addtail (sm->list_pool, s->per_user_list_head_index,
-                      per_user_translation_list_elt - sm->list_pool);
+  clib_dlist_addtail (tsm->list_pool, s->per_user_list_head_index,
+                      per_user_translation_list_elt - tsm->list_pool);
 
   s->in2out = in2out;
   s->out2in = out2in;
@@ -165,16 +183,18 @@ create_session_for_static_mapping (snat_main_t *sm,
 
   /* Add to translation hashes */
   kv0.key = s->in2out.as_u64;
-  kv0.value = s - sm->sessions;
+  kv0.value = s - tsm->sessions;
   if (clib_bihash_add_del_8_8 (&sm->in2out, &kv0, 1 /* is_add */))
       clib_warning ("in2out key add failed");
 
   kv0.key = s->out2in.as_u64;
-  kv0.value = s - sm->sessions;
+  kv0.value = s - tsm->sessions;
 
   if (clib_bihash_add_del_8_8 (&sm->out2in, &kv0, 1 /* is_add */))
       clib_warning ("out2in key add failed");
 
+  snat_session_timer_start (sm, cpu_index, s, now);
+
   return s;
 }
 
@@ -185,8 +205,10 @@ static inline u32 icmp_out2in_slow_path (snat_main_t *sm,
                                          u32 sw_if_index0,
                                          u32 rx_fib_index0,
                                          vlib_node_runtime_t * node,
-                                         u32 next0, f64 now)
+                                         u32 next0, f64 now,
+                                         u32 cpu_index)
 {
+  snat_main_per_thread_data_t *tsm = &sm->per_thread_data[cpu_index];
   snat_session_key_t key0, sm0;
   icmp_echo_header_t *echo0;
   clib_bihash_kv_8_8_t kv0, value0;
@@ -233,12 +255,12 @@ static inline u32 icmp_out2in_slow_path (snat_main_t *sm,
 
       /* Create session initiated by host from external network */
       s0 = create_session_for_static_mapping(sm, b0, sm0, key0,
-                                             node);
+                                             node, now, cpu_index);
       if (!s0)
         return SNAT_OUT2IN_NEXT_DROP;
     }
   else
-    s0 = pool_elt_at_index (sm->sessions, value0.value);
+    s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
   old_addr0 = ip0->dst_address.as_u32;
   ip0->dst_address = s0->in2out.addr;
@@ -267,8 +289,8 @@ static inline u32 icmp_out2in_slow_path (snat_main_t *sm,
   /* Per-user LRU list maintenance for dynamic translation */
   if (!snat_is_session_static (s0))
     {
-      clib_dlist_remove (sm->list_pool, s0->per_user_index);
-      clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+      clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+      clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                           s0->per_user_index);
     }
 
@@ -287,6 +309,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
   ip_lookup_main_t * lm = sm->ip4_lookup_main;
   vnet_feature_config_main_t * cm = &lm->feature_config_mains[VNET_IP_RX_UNICAST_FEAT];
   f64 now = vlib_time_now (vm);
+  u32 cpu_index = os_get_cpu_number ();
+  snat_main_per_thread_data_t *tsm = &sm->per_thread_data[cpu_index];
 
   from = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors;
@@ -374,7 +398,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
             {
               next0 = icmp_out2in_slow_path 
                 (sm, b0, ip0, icmp0, sw_if_index0, rx_fib_index0, node, 
-                 next0, now);
+                 next0, now, cpu_index);
               goto trace0;
             }
 
@@ -396,12 +420,13 @@ snat_out2in_node_fn (vlib_main_t * vm,
                 }
 
               /* Create session initiated by host from external network */
-              s0 = create_session_for_static_mapping(sm, b0, sm0, key0, node);
+              s0 = create_session_for_static_mapping(sm, b0, sm0, key0, node,
+                                                     now, cpu_index);
               if (!s0)
                 goto trace0;
             }
           else
-            s0 = pool_elt_at_index (sm->sessions, value0.value);
+            s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
           old_addr0 = ip0->dst_address.as_u32;
           ip0->dst_address = s0->in2out.addr;
@@ -419,6 +444,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
               old_port0 = tcp0->ports.dst;
               tcp0->ports.dst = s0->in2out.port;
               new_port0 = tcp0->ports.dst;
+              snat_session_tcp_state_update (s0, tcp0, 1);
 
               sum0 = tcp0->checksum;
               sum0 = ip_csum_update (sum0, old_addr0, new_addr0,
@@ -444,8 +470,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
           /* Per-user LRU list maintenance for dynamic translation */
           if (!snat_is_session_static (s0))
             {
-              clib_dlist_remove (sm->list_pool, s0->per_user_index);
-              clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+              clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+              clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                                   s0->per_user_index);
             }
         trace0:
@@ -459,7 +485,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
               t->next_index = next0;
               t->session_index = ~0;
               if (s0)
-                  t->session_index = s0 - sm->sessions;
+                  t->session_index = s0 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_OUT2IN_NEXT_DROP;
@@ -493,7 +519,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
             {
               next1 = icmp_out2in_slow_path 
                 (sm, b1, ip1, icmp1, sw_if_index1, rx_fib_index1, node, 
-                 next1, now);
+                 next1, now, cpu_index);
               goto trace1;
             }
 
@@ -515,12 +541,13 @@ snat_out2in_node_fn (vlib_main_t * vm,
                 }
 
               /* Create session initiated by host from external network */
-              s1 = create_session_for_static_mapping(sm, b1, sm1, key1, node);
+              s1 = create_session_for_static_mapping(sm, b1, sm1, key1, node,
+                                                     now, cpu_index);
               if (!s1)
                 goto trace1;
             }
           else
-            s1 = pool_elt_at_index (sm->sessions, value1.value);
+            s1 = pool_elt_at_index (tsm->sessions, value1.value);
 
           old_addr1 = ip1->dst_address.as_u32;
           ip1->dst_address = s1->in2out.addr;
@@ -538,6 +565,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
               old_port1 = tcp1->ports.dst;
               tcp1->ports.dst = s1->in2out.port;
               new_port1 = tcp1->ports.dst;
+              snat_session_tcp_state_update (s1, tcp1, 1);
 
               sum1 = tcp1->checksum;
               sum1 = ip_csum_update (sum1, old_addr1, new_addr1,
@@ -563,8 +591,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
           /* Per-user LRU list maintenance for dynamic translation */
           if (!snat_is_session_static (s1))
             {
-              clib_dlist_remove (sm->list_pool, s1->per_user_index);
-              clib_dlist_addtail (sm->list_pool, s1->per_user_list_head_index,
+              clib_dlist_remove (tsm->list_pool, s1->per_user_index);
+              clib_dlist_addtail (tsm->list_pool, s1->per_user_list_head_index,
                                   s1->per_user_index);
             }
         trace1:
@@ -578,7 +606,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
               t->next_index = next1;
               t->session_index = ~0;
               if (s1)
-                  t->session_index = s1 - sm->sessions;
+                  t->session_index = s1 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_OUT2IN_NEXT_DROP;
@@ -647,7 +675,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
             {
               next0 = icmp_out2in_slow_path 
                 (sm, b0, ip0, icmp0, sw_if_index0, rx_fib_index0, node, 
-                 next0, now);
+                 next0, now, cpu_index);
               goto trace00;
             }
 
@@ -669,12 +697,13 @@ snat_out2in_node_fn (vlib_main_t * vm,
                 }
 
               /* Create session initiated by host from external network */
-              s0 = create_session_for_static_mapping(sm, b0, sm0, key0, node);
+              s0 = create_session_for_static_mapping(sm, b0, sm0, key0, node,
+                                                     now, cpu_index);
               if (!s0)
                 goto trace00;
             }
           else
-            s0 = pool_elt_at_index (sm->sessions, value0.value);
+            s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
           old_addr0 = ip0->dst_address.as_u32;
           ip0->dst_address = s0->in2out.addr;
@@ -692,6 +721,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
               old_port0 = tcp0->ports.dst;
               tcp0->ports.dst = s0->in2out.port;
               new_port0 = tcp0->ports.dst;
+              snat_session_tcp_state_update (s0, tcp0, 1);
 
               sum0 = tcp0->checksum;
               sum0 = ip_csum_update (sum0, old_addr0, new_addr0,
@@ -717,8 +747,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
           /* Per-user LRU list maintenance for dynamic translation */
           if (!snat_is_session_static (s0))
             {
-              clib_dlist_remove (sm->list_pool, s0->per_user_index);
-              clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+              clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+              clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                                   s0->per_user_index);
             }
         trace00:
@@ -732,7 +762,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
               t->next_index = next0;
               t->session_index = ~0;
               if (s0)
-                  t->session_index = s0 - sm->sessions;
+                  t->session_index = s0 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_OUT2IN_NEXT_DROP;
@@ -773,6 +803,283 @@ VLIB_REGISTER_NODE (snat_out2in_node) = {
 };
 VLIB_NODE_FUNCTION_MULTIARCH (snat_out2in_node, snat_out2in_node_fn);
 
+typedef struct {
+  u32 next_worker_index;
+  u8 do_handoff;
+} snat_out2in_worker_handoff_trace_t;
+
+static u8 *
+format_snat_out2in_worker_handoff_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  snat_out2in_worker_handoff_trace_t * t =
+    va_arg (*args, snat_out2in_worker_handoff_trace_t *);
+  char * m;
+
+  m = t->do_handoff ? "next worker" : "same worker";
+  s = format (s, "SNAT_OUT2IN_WORKER_HANDOFF: %s %d", m, t->next_worker_index);
+
+  return s;
+}
+
+vlib_node_registration_t snat_out2in_worker_handoff_node;
+
+#define foreach_snat_worker_handoff_error                       \
+_(SAME_WORKER, "Packets processed on the receiving worker")     \
+_(DO_HANDOFF, "Packets handed off to the session owner")
+
+typedef enum {
+#define _(sym,str) SNAT_WORKER_HANDOFF_ERROR_##sym,
+  foreach_snat_worker_handoff_error
+#undef _
+  SNAT_WORKER_HANDOFF_N_ERROR,
+} snat_worker_handoff_error_t;
+
+static char * snat_worker_handoff_error_strings[] = {
+#define _(sym,string) string,
+  foreach_snat_worker_handoff_error
+#undef _
+};
+
+/**
+ * @brief Worker thread owning the session of an out2in packet.
+ *
+ * Sessions created from a static mapping live on the worker owning the
+ * local address, dynamic sessions on the worker whose outside port range
+ * holds the destination port (or ICMP echo identifier). Deterministic
+ * sessions live on the worker owning the inside host of the port.
+ *
+ * @param sm            SNAT main.
+ * @param ip0           IPv4 header.
+ * @param rx_fib_index0 RX FIB index.
+ * @param cpu_index     Current thread, used for untranslated protocols.
+ *
+ * @returns thread index.
+ */
+static inline u32
+snat_out2in_get_worker (snat_main_t * sm, ip4_header_t * ip0,
+                        u32 rx_fib_index0, u32 cpu_index)
+{
+  snat_session_key_t key0, sm0;
+  udp_header_t * udp0;
+  icmp_echo_header_t * echo0;
+  snat_det_map_t * dm0;
+  ip4_address_t in_addr0;
+  u32 proto0;
+
+  proto0 = ~0;
+  proto0 = (ip0->protocol == IP_PROTOCOL_UDP)
+    ? SNAT_PROTOCOL_UDP : proto0;
+  proto0 = (ip0->protocol == IP_PROTOCOL_TCP)
+    ? SNAT_PROTOCOL_TCP : proto0;
+  proto0 = (ip0->protocol == IP_PROTOCOL_ICMP)
+    ? SNAT_PROTOCOL_ICMP : proto0;
+
+  /* snat-out2in passes it through untouched, no need to move it */
+  if (PREDICT_FALSE (proto0 == ~0))
+    return cpu_index;
+
+  udp0 = ip4_next_header (ip0);
+
+  key0.addr = ip0->dst_address;
+  key0.port = udp0->dst_port;
+  key0.protocol = proto0;
+  key0.fib_index = rx_fib_index0;
+
+  if (PREDICT_FALSE (proto0 == SNAT_PROTOCOL_ICMP))
+    {
+      echo0 = (icmp_echo_header_t *) ((icmp46_header_t *) udp0 + 1);
+      key0.port = echo0->identifier;
+    }
+
+  if (sm->deterministic)
+    {
+      dm0 = snat_det_map_by_out (sm, &ip0->dst_address);
+      if (dm0 && !snat_det_reverse (dm0, &ip0->dst_address,
+                                    clib_net_to_host_u16 (key0.port),
+                                    &in_addr0))
+        return snat_get_worker_in2out (sm, &in_addr0);
+      return cpu_index;
+    }
+
+  if (PREDICT_FALSE (pool_elts (sm->static_mappings)) &&
+      !snat_static_mapping_match (sm, key0, &sm0, 1))
+    return snat_get_worker_in2out (sm, &sm0.addr);
+
+  return snat_get_worker_out2in (sm, key0.port);
+}
+
+/*
+ * Return traffic is steered to the worker owning the session, packets
+ * received by that worker go straight to snat-out2in (snat-det-out2in in
+ * deterministic mode), others are handed off through the frame queues.
+ */
+static uword
+snat_out2in_worker_handoff_fn (vlib_main_t * vm,
+                               vlib_node_runtime_t * node,
+                               vlib_frame_t * frame)
+{
+  snat_main_t *sm = &snat_main;
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  u32 n_left_from, *from, *to_next = 0;
+  static __thread vlib_frame_queue_elt_t **handoff_queue_elt_by_worker_index;
+  vlib_frame_queue_elt_t *hf = 0;
+  vlib_frame_t *f = 0;
+  int i;
+  u32 n_left_to_next_worker = 0, *to_next_worker = 0;
+  u32 next_worker_index = 0;
+  u32 current_worker_index = ~0;
+  u32 cpu_index = os_get_cpu_number ();
+  u32 n_same_worker = 0;
+  ip_lookup_main_t * lm = sm->ip4_lookup_main;
+  vnet_feature_config_main_t * cm =
+    &lm->feature_config_mains[VNET_IP_RX_UNICAST_FEAT];
+
+  if (PREDICT_FALSE (handoff_queue_elt_by_worker_index == 0))
+    vec_validate (handoff_queue_elt_by_worker_index, tm->n_vlib_mains - 1);
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+
+  while (n_left_from > 0)
+    {
+      u32 bi0;
+      vlib_buffer_t *b0;
+      ip4_header_t *ip0;
+      u32 next0;
+      u32 sw_if_index0;
+      u32 rx_fib_index0;
+      u8 do_handoff;
+
+      bi0 = from[0];
+      from += 1;
+      n_left_from -= 1;
+
+      b0 = vlib_get_buffer (vm, bi0);
+
+      /* Step over this feature, the owner continues with snat-out2in */
+      vnet_get_config_data (&cm->config_main,
+                            &b0->current_config_index,
+                            &next0,
+                            0 /* sizeof config data */);
+
+      ip0 = vlib_buffer_get_current (b0);
+
+      sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_RX];
+      rx_fib_index0 = vec_elt (sm->ip4_main->fib_index_by_sw_if_index,
+                               sw_if_index0);
+
+      next_worker_index = snat_out2in_get_worker (sm, ip0, rx_fib_index0,
+                                                  cpu_index);
+
+      if (PREDICT_FALSE (next_worker_index != cpu_index))
+        {
+          do_handoff = 1;
+
+          if (next_worker_index != current_worker_index)
+            {
+              if (hf)
+                hf->n_vectors = VLIB_FRAME_SIZE - n_left_to_next_worker;
+
+              hf = dpdk_get_handoff_queue_elt (next_worker_index,
+                                               handoff_queue_elt_by_worker_index);
+
+              n_left_to_next_worker = VLIB_FRAME_SIZE - hf->n_vectors;
+              to_next_worker = &hf->buffer_index[hf->n_vectors];
+              current_worker_index = next_worker_index;
+            }
+
+          /* handoff-dispatch on the owner sends it to the session owner */
+          vnet_buffer (b0)->handoff.next_index = sm->out2in_handoff_next_index;
+
+          /* enqueue to correct worker thread */
+          to_next_worker[0] = bi0;
+          to_next_worker++;
+          n_left_to_next_worker--;
+
+          if (n_left_to_next_worker == 0)
+            {
+              hf->n_vectors = VLIB_FRAME_SIZE;
+              vlib_put_handoff_queue_elt (next_worker_index, hf);
+              current_worker_index = ~0;
+              handoff_queue_elt_by_worker_index[next_worker_index] = 0;
+              hf = 0;
+            }
+        }
+      else
+        {
+          do_handoff = 0;
+
+          if (!f)
+            {
+              f = vlib_get_frame_to_node (vm, sm->out2in_node_index);
+              to_next = vlib_frame_vector_args (f);
+            }
+
+          to_next[0] = bi0;
+          to_next += 1;
+          f->n_vectors++;
+          n_same_worker++;
+        }
+
+      if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)
+                        && (b0->flags & VLIB_BUFFER_IS_TRACED)))
+        {
+          snat_out2in_worker_handoff_trace_t *t =
+            vlib_add_trace (vm, node, b0, sizeof (*t));
+          t->next_worker_index = next_worker_index;
+          t->do_handoff = do_handoff;
+        }
+    }
+
+  if (f)
+    vlib_put_frame_to_node (vm, sm->out2in_node_index, f);
+
+  if (hf)
+    hf->n_vectors = VLIB_FRAME_SIZE - n_left_to_next_worker;
+
+  /* Ship frames to the worker nodes */
+  for (i = 0; i < vec_len (handoff_queue_elt_by_worker_index); i++)
+    {
+      if (handoff_queue_elt_by_worker_index[i])
+        {
+          hf = handoff_queue_elt_by_worker_index[i];
+          vlib_put_handoff_queue_elt (i, hf);
+          handoff_queue_elt_by_worker_index[i] = 0;
+        }
+    }
+  vlib_publish_handoff_queue_elts ();
+
+  vlib_node_increment_counter (vm, snat_out2in_worker_handoff_node.index,
+                               SNAT_WORKER_HANDOFF_ERROR_SAME_WORKER,
+                               n_same_worker);
+  vlib_node_increment_counter (vm, snat_out2in_worker_handoff_node.index,
+                               SNAT_WORKER_HANDOFF_ERROR_DO_HANDOFF,
+                               frame->n_vectors - n_same_worker);
+  return frame->n_vectors;
+}
+
+VLIB_REGISTER_NODE (snat_out2in_worker_handoff_node) = {
+  .function = snat_out2in_worker_handoff_fn,
+  .name = "snat-out2in-worker-handoff",
+  .vector_size = sizeof (u32),
+  .format_trace = format_snat_out2in_worker_handoff_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(snat_worker_handoff_error_strings),
+  .error_strings = snat_worker_handoff_error_strings,
+
+  .n_next_nodes = 1,
+
+  .next_nodes = {
+    [0] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (snat_out2in_worker_handoff_node,
+                              snat_out2in_worker_handoff_fn);
+
 static inline u32 icmp_out2in_fast (snat_main_t *sm,
                                     vlib_buffer_t * b0,
                                     ip4_header_t * ip0,
@@ -1031,3 +1338,226 @@ VLIB_REGISTER_NODE (snat_out2in_fast_node) = {
   },
 };
 VLIB_NODE_FUNCTION_MULTIARCH (snat_out2in_fast_node, snat_out2in_fast_node_fn);
+
+/**
+ * @brief Deterministic out2in translation.
+ *
+ * The inside host is computed from the destination address and port, no
+ * out2in lookup table is needed. Only ports of an active session of the
+ * host are translated.
+ */
+static uword
+snat_det_out2in_node_fn (vlib_main_t * vm,
+                         vlib_node_runtime_t * node,
+                         vlib_frame_t * frame)
+{
+  u32 n_left_from, * from, * to_next;
+  snat_out2in_next_t next_index;
+  u32 pkts_processed = 0;
+  snat_main_t * sm = &snat_main;
+  snat_runtime_t * rt = (snat_runtime_t *)node->runtime_data;
+  ip_lookup_main_t * lm = sm->ip4_lookup_main;
+  vnet_feature_config_main_t * cm = &lm->feature_config_mains[VNET_IP_RX_UNICAST_FEAT];
+  u32 now = (u32) vlib_time_now (vm);
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+  next_index = node->cached_next_index;
+
+  while (n_left_from > 0)
+    {
+      u32 n_left_to_next;
+
+      vlib_get_next_frame (vm, node, next_index,
+			   to_next, n_left_to_next);
+
+      while (n_left_from > 0 && n_left_to_next > 0)
+	{
+          u32 bi0;
+	  vlib_buffer_t * b0;
+          u32 next0 = SNAT_OUT2IN_NEXT_DROP;
+          u32 sw_if_index0;
+          ip4_header_t * ip0;
+          ip_csum_t sum0;
+          u32 new_addr0, old_addr0;
+          u16 new_port0, old_port0;
+          udp_header_t * udp0;
+          tcp_header_t * tcp0;
+          icmp46_header_t * icmp0;
+          icmp_echo_header_t * echo0 = 0;
+          u32 proto0;
+          ip4_address_t in_addr0;
+          snat_det_map_t * dm0 = 0;
+          snat_det_session_t * ses0 = 0;
+
+          /* speculatively enqueue b0 to the current next frame */
+	  bi0 = from[0];
+	  to_next[0] = bi0;
+	  from += 1;
+	  to_next += 1;
+	  n_left_from -= 1;
+	  n_left_to_next -= 1;
+
+	  b0 = vlib_get_buffer (vm, bi0);
+
+          ip0 = vlib_buffer_get_current (b0);
+          udp0 = ip4_next_header (ip0);
+          tcp0 = (tcp_header_t *) udp0;
+          icmp0 = (icmp46_header_t *) udp0;
+
+          sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_RX];
+
+	  vnet_get_config_data (&cm->config_main,
+                                &b0->current_config_index,
+                                &next0,
+                                0 /* sizeof config data */);
+          proto0 = ~0;
+          proto0 = (ip0->protocol == IP_PROTOCOL_UDP)
+            ? SNAT_PROTOCOL_UDP : proto0;
+          proto0 = (ip0->protocol == IP_PROTOCOL_TCP)
+            ? SNAT_PROTOCOL_TCP : proto0;
+          proto0 = (ip0->protocol == IP_PROTOCOL_ICMP)
+            ? SNAT_PROTOCOL_ICMP : proto0;
+
+          if (PREDICT_FALSE (proto0 == ~0))
+            goto trace0;
+
+          if (PREDICT_FALSE (proto0 == SNAT_PROTOCOL_ICMP))
+            {
+              echo0 = (icmp_echo_header_t *)(icmp0+1);
+              old_port0 = echo0->identifier;
+            }
+          else
+            old_port0 = udp0->dst_port;
+
+          dm0 = snat_det_map_by_out (sm, &ip0->dst_address);
+          if (PREDICT_TRUE (dm0 != 0) &&
+              !snat_det_reverse (dm0, &ip0->dst_address,
+                                 clib_net_to_host_u16 (old_port0), &in_addr0))
+            ses0 = snat_det_find_ses_by_out (sm, dm0, &in_addr0, old_port0,
+                                             proto0, now);
+
+          if (PREDICT_FALSE (!ses0 || (proto0 == SNAT_PROTOCOL_ICMP &&
+                                       icmp0->type != ICMP4_echo_reply)))
+            {
+              ses0 = 0;
+
+              if (PREDICT_FALSE(rt->cached_sw_if_index != sw_if_index0))
+                {
+                  ip4_address_t * first_int_addr;
+
+                  first_int_addr =
+                    ip4_interface_first_address (sm->ip4_main, sw_if_index0,
+                                                 0 /* just want the address */);
+                  rt->cached_sw_if_index = sw_if_index0;
+                  rt->cached_ip4_address = first_int_addr ?
+                    first_int_addr->as_u32 : 0;
+                }
+
+              /* Don't NAT packet aimed at the intfc address */
+              if (PREDICT_FALSE(ip0->dst_address.as_u32 ==
+                                rt->cached_ip4_address))
+                goto trace0;
+
+              b0->error = node->errors[proto0 == SNAT_PROTOCOL_ICMP &&
+                                       icmp0->type != ICMP4_echo_reply ?
+                                       SNAT_OUT2IN_ERROR_BAD_ICMP_TYPE :
+                                       SNAT_OUT2IN_ERROR_NO_TRANSLATION];
+              next0 = SNAT_OUT2IN_NEXT_DROP;
+              goto trace0;
+            }
+
+          ses0->last_heard = now;
+          new_port0 = ses0->in_port;
+
+          old_addr0 = ip0->dst_address.as_u32;
+          new_addr0 = in_addr0.as_u32;
+          ip0->dst_address.as_u32 = new_addr0;
+          vnet_buffer(b0)->sw_if_index[VLIB_TX] = sm->inside_fib_index;
+
+          sum0 = ip0->checksum;
+          sum0 = ip_csum_update (sum0, old_addr0, new_addr0,
+                                 ip4_header_t,
+                                 dst_address /* changed member */);
+          ip0->checksum = ip_csum_fold (sum0);
+
+          if (PREDICT_FALSE (proto0 == SNAT_PROTOCOL_ICMP))
+            {
+              echo0->identifier = new_port0;
+
+              sum0 = icmp0->checksum;
+              sum0 = ip_csum_update (sum0, old_port0, new_port0,
+                                     icmp_echo_header_t, identifier);
+              icmp0->checksum = ip_csum_fold (sum0);
+            }
+          else if (PREDICT_TRUE(proto0 == SNAT_PROTOCOL_TCP))
+            {
+              tcp0->ports.dst = new_port0;
+              snat_session_tcp_state_update (ses0, tcp0, 1);
+
+              sum0 = tcp0->checksum;
+              sum0 = ip_csum_update (sum0, old_addr0, new_addr0,
+                                     ip4_header_t,
+                                     dst_address /* changed member */);
+              sum0 = ip_csum_update (sum0, old_port0, new_port0,
+                                     ip4_header_t /* cheat */,
+                                     length /* changed member */);
+              tcp0->checksum = ip_csum_fold(sum0);
+            }
+          else
+            {
+              udp0->dst_port = new_port0;
+              udp0->checksum = 0;
+            }
+
+        trace0:
+          if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)
+                            && (b0->flags & VLIB_BUFFER_IS_TRACED)))
+            {
+              snat_out2in_trace_t *t =
+                 vlib_add_trace (vm, node, b0, sizeof (*t));
+              t->sw_if_index = sw_if_index0;
+              t->next_index = next0;
+              t->session_index = ~0;
+              if (ses0)
+                t->session_index =
+                  ses0 - *snat_det_user_sessions (dm0, &in_addr0);
+            }
+
+          pkts_processed += next0 != SNAT_OUT2IN_NEXT_DROP;
+
+          /* verify speculative enqueue, maybe switch current next frame */
+	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+					   to_next, n_left_to_next,
+					   bi0, next0);
+	}
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+
+  vlib_node_increment_counter (vm, snat_det_out2in_node.index,
+                               SNAT_OUT2IN_ERROR_OUT2IN_PACKETS,
+                               pkts_processed);
+  return frame->n_vectors;
+}
+
+VLIB_REGISTER_NODE (snat_det_out2in_node) = {
+  .function = snat_det_out2in_node_fn,
+  .name = "snat-det-out2in",
+  .vector_size = sizeof (u32),
+  .format_trace = format_snat_det_out2in_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(snat_out2in_error_strings),
+  .error_strings = snat_out2in_error_strings,
+
+  .runtime_data_bytes = sizeof (snat_runtime_t),
+
+  .n_next_nodes = SNAT_OUT2IN_N_NEXT,
+
+  /* edit / add dispositions here */
+  .next_nodes = {
+    [SNAT_OUT2IN_NEXT_DROP] = "error-drop",
+  },
+};
+VLIB_NODE_FUNCTION_MULTIARCH (snat_det_out2in_node, snat_det_out2in_node_fn);
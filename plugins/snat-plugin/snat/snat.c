@@ -19,6 +19,7 @@
 #include <vnet/plugin/plugin.h>
 #include <vlibapi/api.h>
 #include <snat/snat.h>
+#include <snat/snat_det.h>
 
 #include <vlibapi/api.h>
 #include <vlibmemory/api.h>
@@ -103,6 +104,16 @@ VNET_IP4_UNICAST_FEATURE_INIT (ip4_snat_out2in, static) = {
   .runs_before = (char *[]){"ip4-lookup", 0},
   .feature_index = &snat_main.rx_feature_out2in,
 };
+VNET_IP4_UNICAST_FEATURE_INIT (ip4_snat_in2out_worker_handoff, static) = {
+  .node_name = "snat-in2out-worker-handoff",
+  .runs_before = (char *[]){"snat-in2out", "snat-det-in2out", 0},
+  .feature_index = &snat_main.rx_feature_in2out_worker_handoff,
+};
+VNET_IP4_UNICAST_FEATURE_INIT (ip4_snat_out2in_worker_handoff, static) = {
+  .node_name = "snat-out2in-worker-handoff",
+  .runs_before = (char *[]){"snat-out2in", "snat-det-out2in", 0},
+  .feature_index = &snat_main.rx_feature_out2in_worker_handoff,
+};
 VNET_IP4_UNICAST_FEATURE_INIT (ip4_snat_in2out_fast, static) = {
   .node_name = "snat-in2out-fast",
   .runs_before = (char *[]){"snat-out2in-fast", 0},
@@ -113,6 +124,16 @@ VNET_IP4_UNICAST_FEATURE_INIT (ip4_snat_out2in_fast, static) = {
   .runs_before = (char *[]){"ip4-lookup", 0},
   .feature_index = &snat_main.rx_feature_out2in_fast,
 };
+VNET_IP4_UNICAST_FEATURE_INIT (ip4_snat_det_in2out, static) = {
+  .node_name = "snat-det-in2out",
+  .runs_before = (char *[]){"snat-det-out2in", 0},
+  .feature_index = &snat_main.rx_feature_det_in2out,
+};
+VNET_IP4_UNICAST_FEATURE_INIT (ip4_snat_det_out2in, static) = {
+  .node_name = "snat-det-out2in",
+  .runs_before = (char *[]){"ip4-lookup", 0},
+  .feature_index = &snat_main.rx_feature_det_out2in,
+};
 
 
 /* 
@@ -212,6 +233,14 @@ void snat_add_address (snat_main_t *sm, ip4_address_t *addr)
   vec_add2 (sm->addresses, ap, 1);
   ap->addr = *addr;
 
+  /* Workers update their own words of the bitmap, it must never be resized */
+  clib_bitmap_alloc (ap->busy_port_bitmap, 65536);
+  vec_validate (ap->busy_ports_per_thread,
+                clib_max (vec_len (sm->workers), 1) - 1);
+
+  if (sm->port_block_size)
+    vec_validate_init_empty (ap->block_user,
+                             (65536 - 1024) / sm->port_block_size - 1, ~0);
 }
 
 static int is_snat_address_used_in_static_mapping (snat_main_t *sm,
@@ -236,6 +265,8 @@ int snat_del_address (snat_main_t *sm, ip4_address_t addr)
   clib_bihash_kv_8_8_t kv, value;
   snat_user_key_t user_key;
   snat_user_t *u;
+  snat_main_per_thread_data_t *tsm;
+  u32 *handle;
 
   int i;
 
@@ -261,32 +292,62 @@ int snat_del_address (snat_main_t *sm, ip4_address_t addr)
   /* Delete sessions using address */
   if (a->busy_ports)
     {
-      pool_foreach (ses, sm->sessions, ({
-        if (ses->out2in.addr.as_u32 == addr.as_u32)
-          {
-            vec_add1 (ses_to_be_removed, ses - sm->sessions);
-            kv.key = ses->in2out.as_u64;
-            clib_bihash_add_del_8_8 (&sm->in2out, &kv, 0);
-            kv.key = ses->out2in.as_u64;
-            clib_bihash_add_del_8_8 (&sm->out2in, &kv, 0);
-            clib_dlist_remove (sm->list_pool, ses->per_user_index);
-            user_key.addr = ses->in2out.addr;
-            user_key.fib_index = ses->in2out.fib_index;
-            kv.key = user_key.as_u64;
-            if (!clib_bihash_search_8_8 (&sm->user_hash, &kv, &value))
+      vec_foreach (tsm, sm->per_thread_data)
+        {
+          pool_foreach (ses, tsm->sessions, ({
+            if (ses->out2in.addr.as_u32 == addr.as_u32)
               {
-                u = pool_elt_at_index (sm->users, value.value);
-                u->nsessions--;
+                vec_add1 (ses_to_be_removed, ses - tsm->sessions);
+                kv.key = ses->in2out.as_u64;
+                clib_bihash_add_del_8_8 (&sm->in2out, &kv, 0);
+                kv.key = ses->out2in.as_u64;
+                clib_bihash_add_del_8_8 (&sm->out2in, &kv, 0);
+                clib_dlist_remove (tsm->list_pool, ses->per_user_index);
+                user_key.addr = ses->in2out.addr;
+                user_key.fib_index = ses->in2out.fib_index;
+                kv.key = user_key.as_u64;
+                if (!clib_bihash_search_8_8 (&sm->user_hash, &kv, &value))
+                  {
+                    u = pool_elt_at_index (tsm->users, value.value);
+                    u->nsessions--;
+                  }
               }
-          }
-      }));
+          }));
+
+          vec_foreach (ses_index, ses_to_be_removed)
+            pool_put_index (tsm->sessions, ses_index[0]);
 
-      vec_foreach (ses_index, ses_to_be_removed)
-        pool_put_index (sm->sessions, ses_index[0]);
+          vec_reset_length (ses_to_be_removed);
+        }
 
       vec_free (ses_to_be_removed);
     }
 
+  /* Drop port blocks of the address, renumber those of later addresses */
+  if (sm->port_block_size)
+    {
+      vec_foreach (tsm, sm->per_thread_data)
+        {
+          pool_foreach (u, tsm->users, ({
+            for (handle = u->port_blocks;
+                 handle < vec_end (u->port_blocks);)
+              {
+                if ((handle[0] >> 16) == i)
+                  {
+                    vec_del1 (u->port_blocks, handle - u->port_blocks);
+                    continue;
+                  }
+                if ((handle[0] >> 16) > i)
+                  handle[0] -= 1 << 16;
+                handle++;
+              }
+          }));
+        }
+    }
+
+  vec_free (a->block_user);
+  vec_free (a->busy_ports_per_thread);
+  clib_bitmap_free (a->busy_port_bitmap);
   vec_del1 (sm->addresses, i);
 
   return 0;
@@ -328,6 +389,10 @@ int snat_add_static_mapping(ip4_address_t l_addr, ip4_address_t e_addr,
   uword * p;
   int i;
 
+  /* Deterministic translation doesn't look at static mappings */
+  if (sm->deterministic)
+    return VNET_API_ERROR_FEATURE_DISABLED;
+
   /* If outside FIB index is not resolved yet */
   if (sm->outside_fib_index == ~0)
     {
@@ -386,12 +451,16 @@ int snat_add_static_mapping(ip4_address_t l_addr, ip4_address_t e_addr,
                 {
                   a = sm->addresses + i;
                   /* External port must be unused */
-                  if (clib_bitmap_get (a->busy_port_bitmap, e_port))
+                  if (clib_bitmap_get_no_check (a->busy_port_bitmap, e_port))
                     return VNET_API_ERROR_INVALID_VALUE;
-                  a->busy_port_bitmap = clib_bitmap_set (a->busy_port_bitmap,
-                                                         e_port, 1);
+                  clib_bitmap_set_no_check (a->busy_port_bitmap, e_port, 1);
                   if (e_port > 1024)
-                    a->busy_ports++;
+                    {
+                      clib_smp_atomic_add (&a->busy_ports, 1);
+                      clib_smp_atomic_add
+                        (a->busy_ports_per_thread +
+                         snat_port_to_snat_thread_index (sm, e_port), 1);
+                    }
 
                   break;
                 }
@@ -441,9 +510,14 @@ int snat_add_static_mapping(ip4_address_t l_addr, ip4_address_t e_addr,
               if (sm->addresses[i].addr.as_u32 == e_addr.as_u32)
                 {
                   a = sm->addresses + i;
-                  a->busy_port_bitmap = clib_bitmap_set (a->busy_port_bitmap,
-                                                         e_port, 0);
-                  a->busy_ports--;
+                  clib_bitmap_set_no_check (a->busy_port_bitmap, e_port, 0);
+                  if (e_port > 1024)
+                    {
+                      clib_smp_atomic_add (&a->busy_ports, -1);
+                      clib_smp_atomic_add
+                        (a->busy_ports_per_thread +
+                         snat_port_to_snat_thread_index (sm, e_port), -1);
+                    }
 
                   break;
                 }
@@ -472,23 +546,29 @@ int snat_add_static_mapping(ip4_address_t l_addr, ip4_address_t e_addr,
           u32 elt_index, head_index;
           u32 ses_index;
           snat_session_t * s;
+          snat_main_per_thread_data_t * tsm;
+
+          /* Sessions of a static mapping live on the worker owning the
+             local address, see snat_get_worker_in2out */
+          tsm = vec_elt_at_index (sm->per_thread_data,
+                                  snat_get_worker_in2out (sm, &m->local_addr));
 
           u_key.addr = m->local_addr;
           u_key.fib_index = m->fib_index;
           kv.key = u_key.as_u64;
           if (!clib_bihash_search_8_8 (&sm->user_hash, &kv, &value))
             {
-              u = pool_elt_at_index (sm->users, value.value);
+              u = pool_elt_at_index (tsm->users, value.value);
               if (u->nstaticsessions)
                 {
                   head_index = u->sessions_per_user_list_head_index;
-                  head = pool_elt_at_index (sm->list_pool, head_index);
+                  head = pool_elt_at_index (tsm->list_pool, head_index);
                   elt_index = head->next;
-                  elt = pool_elt_at_index (sm->list_pool, elt_index);
+                  elt = pool_elt_at_index (tsm->list_pool, elt_index);
                   ses_index = elt->value;
                   while (ses_index != ~0)
                     {
-                      s =  pool_elt_at_index (sm->sessions, ses_index);
+                      s =  pool_elt_at_index (tsm->sessions, ses_index);
 
                       if (!addr_only)
                         {
@@ -500,28 +580,28 @@ int snat_add_static_mapping(ip4_address_t l_addr, ip4_address_t e_addr,
                       clib_bihash_add_del_8_8 (&sm->in2out, &value, 0);
                       value.key = s->out2in.as_u64;
                       clib_bihash_add_del_8_8 (&sm->out2in, &value, 0);
-                      pool_put (sm->sessions, s);
+                      pool_put (tsm->sessions, s);
 
                       if (!addr_only)
                         break;
 
                       elt_index = elt->next;
-                      elt = pool_elt_at_index (sm->list_pool, elt_index);
+                      elt = pool_elt_at_index (tsm->list_pool, elt_index);
                       ses_index = elt->value;
                     }
                   if (addr_only)
                     {
-                      while ((elt_index = clib_dlist_remove_head(sm->list_pool, head_index)) != ~0)
-                        pool_put_index (sm->list_pool, elt_index);
-                      pool_put (sm->users, u);
+                      while ((elt_index = clib_dlist_remove_head(tsm->list_pool, head_index)) != ~0)
+                        pool_put_index (tsm->list_pool, elt_index);
+                      pool_put (tsm->users, u);
                       clib_bihash_add_del_8_8 (&sm->user_hash, &kv, 0);
                     }
                   else
                     {
                       if (ses_index != ~0)
                         {
-                          clib_dlist_remove (sm->list_pool, elt_index);
-                          pool_put (sm->list_pool, elt);
+                          clib_dlist_remove (tsm->list_pool, elt_index);
+                          pool_put (tsm->list_pool, elt);
                           u->nstaticsessions--;
                         }
                     }
@@ -546,7 +626,10 @@ static int snat_interface_add_del (u32 sw_if_index, u8 is_inside, int is_del)
   vnet_feature_config_main_t * rx_cm = &lm->feature_config_mains[VNET_IP_RX_UNICAST_FEAT];
   u32 feature_index;
 
-  if (sm->static_mapping_only && !(sm->static_mapping_connection_tracking))
+  if (sm->deterministic)
+    feature_index = is_inside ? sm->rx_feature_det_in2out
+      : sm->rx_feature_det_out2in;
+  else if (sm->static_mapping_only && !(sm->static_mapping_connection_tracking))
     feature_index = is_inside ?  sm->rx_feature_in2out_fast
       : sm->rx_feature_out2in_fast;
   else
@@ -564,6 +647,25 @@ static int snat_interface_add_del (u32 sw_if_index, u8 is_inside, int is_del)
      0 /* sizeof config struct*/);
   rx_cm->config_index_by_sw_if_index[sw_if_index] = ci;
 
+  /* Steer packets to the worker owning their session */
+  if (vec_len (sm->workers) > 1 &&
+      !(sm->static_mapping_only && !(sm->static_mapping_connection_tracking)))
+    {
+      feature_index = is_inside ? sm->rx_feature_in2out_worker_handoff
+        : sm->rx_feature_out2in_worker_handoff;
+
+      ci = rx_cm->config_index_by_sw_if_index[sw_if_index];
+      ci = (is_del
+            ? vnet_config_del_feature
+            : vnet_config_add_feature)
+        (sm->vlib_main, &rx_cm->config_main,
+         ci,
+         feature_index,
+         0 /* config struct */,
+         0 /* sizeof config struct*/);
+      rx_cm->config_index_by_sw_if_index[sw_if_index] = ci;
+    }
+
   pool_foreach (i, sm->interfaces,
   ({
     if (i->sw_if_index == sw_if_index)
@@ -605,7 +707,7 @@ vl_api_snat_add_address_range_t_handler
       goto send_reply;
     }
 
-  if (sm->static_mapping_only)
+  if (sm->static_mapping_only || sm->deterministic)
     {
       rv = VNET_API_ERROR_FEATURE_DISABLED;
       goto send_reply;
@@ -984,6 +1086,10 @@ static clib_error_t * snat_init (vlib_main_t * vm)
   clib_error_t * error = 0;
   ip4_main_t * im = &ip4_main;
   ip_lookup_main_t * lm = &im->lookup_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  vlib_thread_registration_t * tr;
+  uword * p;
+  u32 i;
   u8 * name;
 
   name = format (0, "snat_%08x%c", api_version, 0);
@@ -998,6 +1104,19 @@ static clib_error_t * snat_init (vlib_main_t * vm)
   sm->ip4_lookup_main = lm;
   sm->api_main = &api_main;
 
+  /* Spread sessions over all workers unless told otherwise */
+  p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+  if (p)
+    {
+      tr = (vlib_thread_registration_t *) p[0];
+      if (tr)
+        {
+          sm->first_worker_index = tr->first_index;
+          for (i = 0; i < tr->count; i++)
+            vec_add1 (sm->workers, i);
+        }
+    }
+
   error = snat_plugin_api_hookup (vm);
   plugin_custom_dump_configure (sm);
   vec_free(name);
@@ -1012,17 +1131,47 @@ void snat_free_outside_address_and_port (snat_main_t * sm,
                                          u32 address_index)
 {
   snat_address_t *a;
+  snat_main_per_thread_data_t *tsm;
+  snat_user_t *u;
   u16 port_host_byte_order = clib_net_to_host_u16 (k->port);
+  u32 block, block_start, j;
   
   ASSERT (address_index < vec_len (sm->addresses));
 
   a = sm->addresses + address_index;
 
-  ASSERT (clib_bitmap_get (a->busy_port_bitmap, port_host_byte_order) == 1);
+  ASSERT (clib_bitmap_get_no_check (a->busy_port_bitmap,
+                                    port_host_byte_order) == 1);
 
-  a->busy_port_bitmap = clib_bitmap_set (a->busy_port_bitmap, 
-                                         port_host_byte_order, 0);
-  a->busy_ports--;
+  /* Ports are freed by the worker owning them, see snat_get_worker_out2in */
+  clib_bitmap_set_no_check (a->busy_port_bitmap, port_host_byte_order, 0);
+  clib_smp_atomic_add (&a->busy_ports, -1);
+  clib_smp_atomic_add (a->busy_ports_per_thread +
+                       snat_port_to_snat_thread_index (sm,
+                                                       port_host_byte_order),
+                       -1);
+
+  if (sm->port_block_size == 0)
+    return;
+
+  /* Port block mode, the user gives the block back with its last port */
+  block = (port_host_byte_order - 1024) / sm->port_block_size;
+  block_start = 1024 + block * sm->port_block_size;
+  if (clib_bitmap_next_set (a->busy_port_bitmap, block_start)
+      < block_start + sm->port_block_size)
+    return;
+
+  if (PREDICT_FALSE (a->block_user[block] == ~0))
+    return;
+
+  tsm = vec_elt_at_index (sm->per_thread_data,
+                          snat_get_worker_out2in (sm, k->port));
+  u = pool_elt_at_index (tsm->users, a->block_user[block]);
+  j = vec_search (u->port_blocks,
+                  snat_port_block_handle (address_index, block));
+  if (j != ~0)
+    vec_del1 (u->port_blocks, j);
+  a->block_user[block] = ~0;
 }  
 
 /**
@@ -1087,30 +1236,42 @@ int snat_static_mapping_match (snat_main_t * sm,
 }
 
 int snat_alloc_outside_address_and_port (snat_main_t * sm, 
+                                         u32 cpu_index,
                                          snat_session_key_t * k,
                                          u32 * address_indexp)
 {
   int i;
   snat_address_t *a;
-  u32 portnum;
+  u32 portnum, port_min, n_ports;
+  snat_main_per_thread_data_t *tsm;
+
+  tsm = vec_elt_at_index (sm->per_thread_data, cpu_index);
+
+  /*
+   * Each worker allocates from its own range of outside ports, so that
+   * return traffic can be steered to it by port and workers never share
+   * a busy_port_bitmap word.
+   */
+  port_min = 1024 + tsm->snat_thread_index * sm->port_per_thread;
+  if (tsm->snat_thread_index + 1 < clib_max (vec_len (sm->workers), 1))
+    n_ports = sm->port_per_thread;
+  else
+    n_ports = 65536 - port_min;
 
   for (i = 0; i < vec_len (sm->addresses); i++)
     {
-      if (sm->addresses[i].busy_ports < (65535-1024))
+      a = sm->addresses + i;
+      if (a->busy_ports_per_thread[tsm->snat_thread_index] < n_ports - 1)
         {
-          a = sm->addresses + i;
-
           while (1)
             {
-              portnum = random_u32 (&sm->random_seed);
-              portnum &= 0xFFFF;
-              if (portnum < 1024)
-                continue;
-              if (clib_bitmap_get (a->busy_port_bitmap, portnum))
+              portnum = port_min + random_u32 (&tsm->random_seed) % n_ports;
+              if (clib_bitmap_get_no_check (a->busy_port_bitmap, portnum))
                 continue;
-              a->busy_port_bitmap = clib_bitmap_set (a->busy_port_bitmap,
-                                                     portnum, 1);
-              a->busy_ports++;
+              clib_bitmap_set_no_check (a->busy_port_bitmap, portnum, 1);
+              clib_smp_atomic_add (&a->busy_ports, 1);
+              clib_smp_atomic_add (a->busy_ports_per_thread +
+                                   tsm->snat_thread_index, 1);
               /* Caller sets protocol and fib index */
               k->addr = a->addr;
               k->port = clib_host_to_net_u16(portnum);
@@ -1123,6 +1284,86 @@ int snat_alloc_outside_address_and_port (snat_main_t * sm,
   return 1;
 }
 
+/**
+ * @brief Allocate outside address and port in port block mode.
+ *
+ * Ports are handed out from the blocks the user already holds, a new block
+ * is taken from the worker's outside port range once those are full. The
+ * block returns to the free list with its last port, see
+ * snat_free_outside_address_and_port.
+ *
+ * @param sm             SNAT main.
+ * @param cpu_index      Thread owning the user.
+ * @param user_index     User index in the thread's user pool.
+ * @param k              Returned outside address and port.
+ * @param address_indexp Returned index in snat_main_t.addresses.
+ *
+ * @returns 0 on success, 1 if out of ports.
+ */
+int snat_alloc_outside_address_and_port_in_block (snat_main_t * sm,
+                                                  u32 cpu_index,
+                                                  u32 user_index,
+                                                  snat_session_key_t * k,
+                                                  u32 * address_indexp)
+{
+  snat_main_per_thread_data_t *tsm;
+  snat_user_t *u;
+  snat_address_t *a;
+  u32 *handle;
+  u32 i, block, first_block, n_blocks, portnum, port_min, n_ports;
+
+  tsm = vec_elt_at_index (sm->per_thread_data, cpu_index);
+  u = pool_elt_at_index (tsm->users, user_index);
+
+  /* Try the blocks held by the user first */
+  vec_foreach (handle, u->port_blocks)
+    {
+      i = handle[0] >> 16;
+      a = sm->addresses + i;
+      port_min = 1024 + (handle[0] & 0xffff) * sm->port_block_size;
+      portnum = clib_bitmap_next_clear (a->busy_port_bitmap, port_min);
+      if (portnum < port_min + sm->port_block_size &&
+          !clib_bitmap_get_no_check (a->busy_port_bitmap, portnum))
+        goto found;
+    }
+
+  /* Take a free block of the worker's port range, see snat_config */
+  port_min = 1024 + tsm->snat_thread_index * sm->port_per_thread;
+  if (tsm->snat_thread_index + 1 < clib_max (vec_len (sm->workers), 1))
+    n_ports = sm->port_per_thread;
+  else
+    n_ports = 65536 - port_min;
+  first_block = (port_min - 1024) / sm->port_block_size;
+  n_blocks = n_ports / sm->port_block_size;
+
+  for (i = 0; i < vec_len (sm->addresses); i++)
+    {
+      a = sm->addresses + i;
+      for (block = first_block; block < first_block + n_blocks; block++)
+        {
+          if (a->block_user[block] != ~0)
+            continue;
+          a->block_user[block] = user_index;
+          vec_add1 (u->port_blocks, snat_port_block_handle (i, block));
+          portnum = 1024 + block * sm->port_block_size;
+          goto found;
+        }
+    }
+
+  /* Totally out of port blocks to use... */
+  return 1;
+
+ found:
+  clib_bitmap_set_no_check (a->busy_port_bitmap, portnum, 1);
+  clib_smp_atomic_add (&a->busy_ports, 1);
+  clib_smp_atomic_add (a->busy_ports_per_thread + tsm->snat_thread_index, 1);
+  /* Caller sets protocol and fib index */
+  k->addr = a->addr;
+  k->port = clib_host_to_net_u16 (portnum);
+  *address_indexp = i;
+  return 0;
+}
+
 
 static clib_error_t *
 add_address_command_fn (vlib_main_t * vm,
@@ -1160,6 +1401,10 @@ add_address_command_fn (vlib_main_t * vm,
   if (sm->static_mapping_only)
     return clib_error_return (0, "static mapping only mode");
 
+  if (sm->deterministic)
+    return clib_error_return (0, "deterministic mode, see "
+                              "snat deterministic add");
+
   start_host_order = clib_host_to_net_u32 (start_addr.as_u32);
   end_host_order = clib_host_to_net_u32 (end_addr.as_u32);
   
@@ -1331,6 +1576,8 @@ add_static_mapping_command_fn (vlib_main_t * vm,
       return clib_error_return (0, "No such VRF id.");
     case VNET_API_ERROR_VALUE_EXIST:
       return clib_error_return (0, "Mapping already exist.");
+    case VNET_API_ERROR_FEATURE_DISABLED:
+      return clib_error_return (0, "Not supported in deterministic mode.");
     default:
       break;
     }
@@ -1359,6 +1606,142 @@ VLIB_CLI_COMMAND (add_static_mapping_command, static) = {
     "snat add static mapping local <addr> [<port>] external <addr> [<port>] [vrf <table-id>] [del]",
 };
 
+static clib_error_t *
+snat_det_map_command_fn (vlib_main_t * vm,
+                         unformat_input_t * input,
+                         vlib_cli_command_t * cmd)
+{
+  snat_main_t *sm = &snat_main;
+  unformat_input_t _line_input, *line_input = &_line_input;
+  ip4_address_t in_addr, out_addr;
+  u32 in_plen = ~0, out_plen = ~0;
+  int is_add = 1, rv;
+
+  /* Get a line of input. */
+  if (!unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "in %U/%u", unformat_ip4_address, &in_addr,
+                    &in_plen))
+        ;
+      else if (unformat (line_input, "out %U/%u", unformat_ip4_address,
+                         &out_addr, &out_plen))
+        ;
+      else if (unformat (line_input, "del"))
+        is_add = 0;
+      else
+        return clib_error_return (0, "unknown input: '%U'",
+          format_unformat_error, line_input);
+    }
+  unformat_free (line_input);
+
+  if (!sm->deterministic)
+    return clib_error_return (0, "deterministic mode not enabled");
+
+  if (in_plen == ~0 || out_plen == ~0)
+    return clib_error_return (0, "inside and outside prefix required");
+
+  rv = snat_det_add_map (sm, &in_addr, (u8) in_plen, &out_addr, (u8) out_plen,
+                         is_add);
+
+  switch (rv)
+    {
+    case VNET_API_ERROR_INVALID_VALUE:
+      return clib_error_return (0, "Inside prefix must be /8 to /32 and at "
+                                "most 15 bits shorter than outside prefix.");
+    case VNET_API_ERROR_VALUE_EXIST:
+      return clib_error_return (0, "Mapping overlaps an existing one.");
+    case VNET_API_ERROR_NO_SUCH_ENTRY:
+      return clib_error_return (0, "Mapping not exist.");
+    case VNET_API_ERROR_NO_SUCH_FIB:
+      return clib_error_return (0, "No such VRF id.");
+    default:
+      break;
+    }
+
+  return 0;
+}
+
+/*?
+ * @cliexpar
+ * @cliexstart{snat deterministic add}
+ * Map an inside prefix to an outside prefix, each inside host gets a
+ * computed outside address and range of ports:
+ *  vpp# snat deterministic add in 10.0.0.0/16 out 1.1.1.0/24
+ * @cliexend
+?*/
+VLIB_CLI_COMMAND (snat_det_map_command, static) = {
+  .path = "snat deterministic add",
+  .short_help =
+    "snat deterministic add in <addr>/<plen> out <addr>/<plen> [del]",
+  .function = snat_det_map_command_fn,
+};
+
+static clib_error_t *
+snat_det_forward_command_fn (vlib_main_t * vm,
+                             unformat_input_t * input,
+                             vlib_cli_command_t * cmd)
+{
+  snat_main_t *sm = &snat_main;
+  snat_det_map_t *dm;
+  ip4_address_t in_addr, out_addr;
+  u16 lo_port;
+
+  if (!unformat (input, "%U", unformat_ip4_address, &in_addr))
+    return clib_error_return (0, "unknown input '%U'",
+                              format_unformat_error, input);
+
+  dm = snat_det_map_by_user (sm, &in_addr);
+  if (!dm)
+    return clib_error_return (0, "no deterministic mapping of %U",
+                              format_ip4_address, &in_addr);
+
+  snat_det_forward (dm, &in_addr, &out_addr, &lo_port);
+  vlib_cli_output (vm, "%U:<%d-%d>", format_ip4_address, &out_addr,
+                   lo_port, lo_port + dm->ports_per_host - 1);
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (snat_det_forward_command, static) = {
+  .path = "snat deterministic forward",
+  .short_help = "snat deterministic forward <addr>",
+  .function = snat_det_forward_command_fn,
+};
+
+static clib_error_t *
+snat_det_reverse_command_fn (vlib_main_t * vm,
+                             unformat_input_t * input,
+                             vlib_cli_command_t * cmd)
+{
+  snat_main_t *sm = &snat_main;
+  snat_det_map_t *dm;
+  ip4_address_t in_addr, out_addr;
+  u32 out_port;
+
+  if (!unformat (input, "%U:%u", unformat_ip4_address, &out_addr, &out_port)
+      || out_port > 65535)
+    return clib_error_return (0, "unknown input '%U'",
+                              format_unformat_error, input);
+
+  dm = snat_det_map_by_out (sm, &out_addr);
+  if (!dm || snat_det_reverse (dm, &out_addr, (u16) out_port, &in_addr))
+    return clib_error_return (0, "no deterministic mapping of %U:%d",
+                              format_ip4_address, &out_addr, out_port);
+
+  vlib_cli_output (vm, "%U", format_ip4_address, &in_addr);
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (snat_det_reverse_command, static) = {
+  .path = "snat deterministic reverse",
+  .short_help = "snat deterministic reverse <addr>:<port>",
+  .function = snat_det_reverse_command_fn,
+};
+
 static clib_error_t *
 snat_config (vlib_main_t * vm, unformat_input_t * input)
 {
@@ -1374,6 +1757,17 @@ snat_config (vlib_main_t * vm, unformat_input_t * input)
   u32 static_mapping_memory_size = 64<<20;
   u8 static_mapping_only = 0;
   u8 static_mapping_connection_tracking = 0;
+  u8 deterministic = 0;
+  u32 port_block_size = 0;
+  u32 udp_timeout = SNAT_UDP_TIMEOUT;
+  u32 tcp_established_timeout = SNAT_TCP_ESTABLISHED_TIMEOUT;
+  u32 tcp_transitory_timeout = SNAT_TCP_TRANSITORY_TIMEOUT;
+  u32 icmp_timeout = SNAT_ICMP_TIMEOUT;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  snat_main_per_thread_data_t * tsm;
+  vlib_node_t * node;
+  uword * bitmap = 0;
+  u32 n_workers, i;
 
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
     {
@@ -1401,6 +1795,27 @@ snat_config (vlib_main_t * vm, unformat_input_t * input)
           if (unformat (input, "connection tracking"))
             static_mapping_connection_tracking = 1;
         }
+      else if (unformat (input, "workers %U", unformat_bitmap_list, &bitmap))
+        ;
+      else if (unformat (input, "deterministic"))
+        deterministic = 1;
+      else if (unformat (input, "port block size %d", &port_block_size))
+        {
+          if (port_block_size < 16 || port_block_size > 4096 ||
+              !is_pow2 (port_block_size))
+            return clib_error_return (0, "port block size must be a power "
+                                      "of 2 from 16 to 4096");
+        }
+      else if (unformat (input, "udp timeout %d", &udp_timeout))
+        ;
+      else if (unformat (input, "tcp established timeout %d",
+                         &tcp_established_timeout))
+        ;
+      else if (unformat (input, "tcp transitory timeout %d",
+                         &tcp_transitory_timeout))
+        ;
+      else if (unformat (input, "icmp timeout %d", &icmp_timeout))
+        ;
       else 
 	return clib_error_return (0, "unknown input '%U'",
 				  format_unformat_error, input);
@@ -1418,9 +1833,72 @@ snat_config (vlib_main_t * vm, unformat_input_t * input)
   sm->inside_fib_index = ~0;
   sm->static_mapping_only = static_mapping_only;
   sm->static_mapping_connection_tracking = static_mapping_connection_tracking;
+  sm->deterministic = deterministic;
+  sm->port_block_size = deterministic || static_mapping_only ? 0 :
+    port_block_size;
+
+  if (!udp_timeout || !tcp_established_timeout || !tcp_transitory_timeout ||
+      !icmp_timeout)
+    return clib_error_return (0, "session timeouts must be at least 1s");
+  sm->udp_timeout = udp_timeout;
+  sm->tcp_established_timeout = tcp_established_timeout;
+  sm->tcp_transitory_timeout = tcp_transitory_timeout;
+  sm->icmp_timeout = icmp_timeout;
+
+  if (bitmap)
+    {
+      if (clib_bitmap_last_set (bitmap) >= vec_len (sm->workers))
+        return clib_error_return (0, "invalid worker(s) 0x%U",
+                                  format_bitmap_hex, bitmap);
+      vec_reset_length (sm->workers);
+      clib_bitmap_foreach (i, bitmap,
+      ({
+        vec_add1 (sm->workers, i);
+      }));
+      clib_bitmap_free (bitmap);
+    }
+
+  /*
+   * Split the outside ports among the workers, in whole bitmap words so
+   * that no two workers ever update the same word, and in whole port
+   * blocks.
+   */
+  n_workers = clib_max (vec_len (sm->workers), 1);
+  sm->port_per_thread = ((65536 - 1024) / n_workers) &
+    ~(clib_max (BITS (uword), sm->port_block_size) - 1);
+
+  vec_validate (sm->per_thread_data, tm->n_vlib_mains - 1);
+  for (i = 0; i < vec_len (sm->workers); i++)
+    {
+      tsm = vec_elt_at_index (sm->per_thread_data,
+                              sm->first_worker_index + sm->workers[i]);
+      tsm->snat_thread_index = i;
+    }
 
-  if (!static_mapping_only ||
-      (static_mapping_only && static_mapping_connection_tracking))
+  if (deterministic)
+    {
+      sm->in2out_node_index = snat_det_in2out_node.index;
+      sm->out2in_node_index = snat_det_out2in_node.index;
+    }
+  else
+    {
+      sm->in2out_node_index = snat_in2out_node.index;
+      sm->out2in_node_index = snat_out2in_node.index;
+    }
+
+  /* Handed off packets enter the session owning nodes via handoff-dispatch */
+  node = vlib_get_node_by_name (vm, (u8 *) "handoff-dispatch");
+  if (node)
+    {
+      sm->in2out_handoff_next_index =
+        vlib_node_add_next (vm, node->index, sm->in2out_node_index);
+      sm->out2in_handoff_next_index =
+        vlib_node_add_next (vm, node->index, sm->out2in_node_index);
+    }
+
+  /* Deterministic mode keeps no translation hashes */
+  if (!deterministic && (!static_mapping_only ||
+      (static_mapping_only && static_mapping_connection_tracking)))
     {
       clib_bihash_init_8_8 (&sm->in2out, "in2out", translation_buckets,
                             translation_memory_size);
@@ -1430,6 +1908,10 @@ snat_config (vlib_main_t * vm, unformat_input_t * input)
 
       clib_bihash_init_8_8 (&sm->user_hash, "users", user_buckets,
                             user_memory_size);
+
+      /* Polls on the workers as well, input node state is cloned */
+      vlib_node_set_state (vm, snat_expire_node.index,
+                           VLIB_NODE_STATE_POLLING);
     }
   clib_bihash_init_8_8 (&sm->static_mapping_by_local,
                         "static_mapping_by_local", static_mapping_buckets,
@@ -1464,12 +1946,13 @@ u8 * format_snat_key (u8 * s, va_list * args)
 
 u8 * format_snat_session (u8 * s, va_list * args)
 {
-  snat_main_t * sm __attribute__((unused)) = va_arg (*args, snat_main_t *);
+  snat_main_t * sm = va_arg (*args, snat_main_t *);
   snat_session_t * sess = va_arg (*args, snat_session_t *);
 
   s = format (s, "  i2o %U\n", format_snat_key, &sess->in2out);
   s = format (s, "    o2i %U\n", format_snat_key, &sess->out2in);
-  s = format (s, "       last heard %.2f\n", sess->last_heard);
+  s = format (s, "       last heard %.2f, timeout %ds\n", sess->last_heard,
+              snat_session_timeout (sm, sess));
   s = format (s, "       total pkts %d, total bytes %lld\n",
               sess->total_pkts, sess->total_bytes);
   if (snat_is_session_static (sess))
@@ -1482,7 +1965,8 @@ u8 * format_snat_session (u8 * s, va_list * args)
 
 u8 * format_snat_user (u8 * s, va_list * args)
 {
-  snat_main_t * sm = va_arg (*args, snat_main_t *);
+  snat_main_per_thread_data_t * tsm =
+    va_arg (*args, snat_main_per_thread_data_t *);
   snat_user_t * u = va_arg (*args, snat_user_t *);
   int verbose = va_arg (*args, int);
   dlist_elt_t * head, * elt;
@@ -1490,8 +1974,11 @@ u8 * format_snat_user (u8 * s, va_list * args)
   u32 session_index;
   snat_session_t * sess;
 
-  s = format (s, "%U: %d dynamic translations, %d static translations\n",
+  s = format (s, "%U: %d dynamic translations, %d static translations",
               format_ip4_address, &u->addr, u->nsessions, u->nstaticsessions);
+  if (vec_len (u->port_blocks))
+    s = format (s, ", %d port blocks", vec_len (u->port_blocks));
+  s = format (s, "\n");
 
   if (verbose == 0)
     return s;
@@ -1499,20 +1986,20 @@ u8 * format_snat_user (u8 * s, va_list * args)
   if (u->nsessions || u->nstaticsessions)
     {
       head_index = u->sessions_per_user_list_head_index;
-      head = pool_elt_at_index (sm->list_pool, head_index);
+      head = pool_elt_at_index (tsm->list_pool, head_index);
 
       elt_index = head->next;
-      elt = pool_elt_at_index (sm->list_pool, elt_index);
+      elt = pool_elt_at_index (tsm->list_pool, elt_index);
       session_index = elt->value;
 
       while (session_index != ~0)
         {
-          sess = pool_elt_at_index (sm->sessions, session_index);
+          sess = pool_elt_at_index (tsm->sessions, session_index);
 
-          s = format (s, "  %U\n", format_snat_session, sm, sess);
+          s = format (s, "  %U\n", format_snat_session, &snat_main, sess);
 
           elt_index = elt->next;
-          elt = pool_elt_at_index (sm->list_pool, elt_index);
+          elt = pool_elt_at_index (tsm->list_pool, elt_index);
           session_index = elt->value;
         }
     }
@@ -1549,13 +2036,22 @@ show_snat_command_fn (vlib_main_t * vm,
   snat_static_mapping_t *m;
   snat_interface_t *i;
   vnet_main_t *vnm = vnet_get_main();
+  snat_main_per_thread_data_t *tsm;
+  snat_det_map_t *dm;
+  u32 users_num = 0, sessions_num = 0, expired_per_second = 0;
+  u64 expired_sessions = 0;
+  u32 thread_index, j;
 
   if (unformat (input, "detail"))
     verbose = 1;
   else if (unformat (input, "verbose"))
     verbose = 2;
 
-  if (sm->static_mapping_only)
+  if (sm->deterministic)
+    {
+      vlib_cli_output (vm, "SNAT mode: deterministic mapping");
+    }
+  else if (sm->static_mapping_only)
     {
       if (sm->static_mapping_connection_tracking)
         vlib_cli_output (vm, "SNAT mode: static mapping only connection "
@@ -1578,7 +2074,21 @@ show_snat_command_fn (vlib_main_t * vm,
       }));
     }
 
-  if (sm->static_mapping_only && !(sm->static_mapping_connection_tracking))
+  vlib_cli_output (vm, "session timeouts: udp %ds, tcp established %ds, "
+                   "tcp transitory %ds, icmp %ds", sm->udp_timeout,
+                   sm->tcp_established_timeout, sm->tcp_transitory_timeout,
+                   sm->icmp_timeout);
+
+  if (sm->deterministic)
+    {
+      vlib_cli_output (vm, "%d deterministic mappings",
+                       vec_len (sm->det_maps));
+      vec_foreach (dm, sm->det_maps)
+        {
+          vlib_cli_output (vm, "%U", format_snat_det_map, dm, verbose);
+        }
+    }
+  else if (sm->static_mapping_only && !(sm->static_mapping_connection_tracking))
     {
       vlib_cli_output (vm, "%d static mappings",
                        pool_elts (sm->static_mappings));
@@ -1593,12 +2103,41 @@ show_snat_command_fn (vlib_main_t * vm,
     }
   else
     {
+      vec_foreach (tsm, sm->per_thread_data)
+        {
+          users_num += pool_elts (tsm->users);
+          sessions_num += pool_elts (tsm->sessions);
+          expired_sessions += tsm->expired_sessions;
+          expired_per_second += tsm->expired_per_second;
+        }
+
       vlib_cli_output (vm, "%d users, %d outside addresses, %d active sessions,"
                        " %d static mappings",
-                       pool_elts (sm->users),
+                       users_num,
                        vec_len (sm->addresses),
-                       pool_elts (sm->sessions),
+                       sessions_num,
                        pool_elts (sm->static_mappings));
+      vlib_cli_output (vm, "%lld sessions expired, %d per second",
+                       expired_sessions, expired_per_second);
+
+      if (sm->port_block_size)
+        vlib_cli_output (vm, "port block size %d", sm->port_block_size);
+
+      /* Per worker session counters, ports are the worker's outside range */
+      for (j = 0; j < vec_len (sm->workers) && vec_len (sm->workers) > 1; j++)
+        {
+          thread_index = sm->first_worker_index + sm->workers[j];
+          tsm = vec_elt_at_index (sm->per_thread_data, thread_index);
+          vlib_cli_output (vm, "  %s: %d users, %d sessions, "
+                           "%d expired per second, ports %d-%d",
+                           vlib_worker_threads[thread_index].name,
+                           pool_elts (tsm->users),
+                           pool_elts (tsm->sessions),
+                           tsm->expired_per_second,
+                           1024 + j * sm->port_per_thread,
+                           j + 1 < vec_len (sm->workers) ?
+                           1023 + (j + 1) * sm->port_per_thread : 65535);
+        }
 
       if (verbose > 0)
         {
@@ -1606,13 +2145,22 @@ show_snat_command_fn (vlib_main_t * vm,
                            verbose - 1);
           vlib_cli_output (vm, "%U", format_bihash_8_8, &sm->out2in,
                            verbose - 1);
-          vlib_cli_output (vm, "%d list pool elements",
-                           pool_elts (sm->list_pool));
 
-          pool_foreach (u, sm->users,
-          ({
-            vlib_cli_output (vm, "%U", format_snat_user, sm, u, verbose - 1);
-          }));
+          vec_foreach (tsm, sm->per_thread_data)
+            {
+              if (pool_elts (tsm->users) == 0)
+                continue;
+
+              vlib_cli_output (vm, "thread %d: %d list pool elements",
+                               tsm - sm->per_thread_data,
+                               pool_elts (tsm->list_pool));
+
+              pool_foreach (u, tsm->users,
+              ({
+                vlib_cli_output (vm, "%U", format_snat_user, tsm, u,
+                                 verbose - 1);
+              }));
+            }
 
           if (pool_elts (sm->static_mappings))
             {
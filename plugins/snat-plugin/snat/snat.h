@@ -26,6 +26,8 @@
 #include <vppinfra/bihash_8_8.h>
 #include <vppinfra/dlist.h>
 #include <vppinfra/error.h>
+#include <vppinfra/timing_wheel.h>
+#include <vnet/ip/tcp_packet.h>
 #include <vlibapi/api.h>
 
 /* Key */
@@ -77,6 +79,15 @@ typedef enum {
 
 
 #define SNAT_SESSION_FLAG_STATIC_MAPPING 1
+/* TCP state, selects the established or transitory timeout */
+#define SNAT_SESSION_FLAG_TCP_ESTABLISHED 2
+#define SNAT_SESSION_FLAG_TCP_CLOSING 4
+
+/* Default session timeouts, seconds */
+#define SNAT_UDP_TIMEOUT 300
+#define SNAT_TCP_ESTABLISHED_TIMEOUT 7440
+#define SNAT_TCP_TRANSITORY_TIMEOUT 240
+#define SNAT_ICMP_TIMEOUT 60
 
 typedef CLIB_PACKED(struct {
   snat_session_key_t out2in;    /* 0-15 */
@@ -100,6 +111,9 @@ typedef CLIB_PACKED(struct {
   /* Outside address */
   u32 outside_address_index;    /* 64-67 */
 
+  /* Second the armed expiry timer is due, see expire.c */
+  u32 expire;                   /* 68-71 */
+
 }) snat_session_t;
 
 
@@ -108,12 +122,18 @@ typedef struct {
   u32 sessions_per_user_list_head_index;
   u32 nsessions;
   u32 nstaticsessions;
+  /* Port blocks held in port block mode, see snat_port_block_handle */
+  u32 * port_blocks;
 } snat_user_t;
 
 typedef struct {
   ip4_address_t addr;
   u32 busy_ports;
+  /* Busy ports in each worker's port range, indexed by worker */
+  u32 * busy_ports_per_thread;
   uword * busy_port_bitmap;
+  /* Port block mode: user index owning each block, ~0 if free */
+  u32 * block_user;
 } snat_address_t;
 
 typedef struct {
@@ -131,6 +151,72 @@ typedef struct {
   u8 is_inside;
 } snat_interface_t;
 
+/* Deterministic NAT session, 12 bytes */
+typedef struct {
+  /* Inside and outside port (ICMP echo identifier), network byte order */
+  u16 in_port;
+  u16 out_port;
+  u8 protocol;
+  /* SNAT_SESSION_FLAG_TCP_* state */
+  u8 flags;
+  /* Last heard, seconds */
+  u32 last_heard;
+} snat_det_session_t;
+
+typedef struct {
+  /* Inside prefix */
+  ip4_address_t in_addr;
+  u8 in_plen;
+  /* Outside prefix */
+  ip4_address_t out_addr;
+  u8 out_plen;
+  /* Inside hosts sharing an outside address */
+  u32 sharing_ratio;
+  /* Outside ports of an inside host, starting at snat_det_forward lo_port */
+  u16 ports_per_host;
+  /* Active sessions */
+  u32 ses_num;
+  /* Session vectors of each inside host, indexed by offset in the inside
+     prefix, in chunks of SNAT_DET_HOSTS_PER_CHUNK hosts allocated on the
+     first session of one of them */
+  snat_det_session_t *** sessions;
+} snat_det_map_t;
+
+typedef struct {
+  /* User pool */
+  snat_user_t * users;
+
+  /* Session pool */
+  snat_session_t * sessions;
+
+  /* Pool of doubly-linked list elements */
+  dlist_elt_t * list_pool;
+
+  /* Randomize port allocation order */
+  u32 random_seed;
+
+  /* Index in snat_main_t.workers, selects the outside port range */
+  u32 snat_thread_index;
+
+  /* Deterministic mode scratch bitmap of an inside host's busy ports */
+  uword * det_busy_ports;
+
+  /* Session expiry timers, user data is the session index */
+  timing_wheel_t session_timers;
+
+  /* Expired timers not processed yet */
+  u32 * expired_timers;
+
+  /* Next time the timers are advanced */
+  f64 timers_next_advance;
+
+  /* Expired sessions, in total and over the last second */
+  u64 expired_sessions;
+  u64 expired_sessions_last;
+  f64 expired_rate_time;
+  u32 expired_per_second;
+} snat_main_per_thread_data_t;
+
 typedef struct {
   /* Main lookup tables */
   clib_bihash_8_8_t out2in;
@@ -145,11 +231,8 @@ typedef struct {
   /* Find a static mapping by external */
   clib_bihash_8_8_t static_mapping_by_external;
 
-  /* User pool */
-  snat_user_t * users;
-
-  /* Session pool */
-  snat_session_t * sessions;
+  /* Per thread users, sessions and LRU lists, indexed by thread */
+  snat_main_per_thread_data_t * per_thread_data;
 
   /* Static mapping pool */
   snat_static_mapping_t * static_mappings;
@@ -160,21 +243,39 @@ typedef struct {
   /* Vector of outside addresses */
   snat_address_t * addresses;
 
-  /* Pool of doubly-linked list elements */
-  dlist_elt_t * list_pool;
+  /* Deterministic mappings */
+  snat_det_map_t * det_maps;
 
-  /* Randomize port allocation order */
-  u32 random_seed;
+  /* Workers owning sessions, offsets from first_worker_index */
+  u32 * workers;
+  u32 first_worker_index;
+
+  /* Outside ports per worker, a multiple of the bitmap word size */
+  u32 port_per_thread;
+
+  /* Session owning nodes, snat-in2out/out2in or the deterministic ones */
+  u32 in2out_node_index;
+  u32 out2in_node_index;
+
+  /* handoff-dispatch next indices to the session owning nodes */
+  u32 in2out_handoff_next_index;
+  u32 out2in_handoff_next_index;
 
   /* ip4 feature path indices */
   u32 rx_feature_in2out;
   u32 rx_feature_out2in;
   u32 rx_feature_in2out_fast;
   u32 rx_feature_out2in_fast;
+  u32 rx_feature_in2out_worker_handoff;
+  u32 rx_feature_out2in_worker_handoff;
+  u32 rx_feature_det_in2out;
+  u32 rx_feature_det_out2in;
 
   /* Config parameters */
   u8 static_mapping_only;
   u8 static_mapping_connection_tracking;
+  u8 deterministic;
+  u32 port_block_size;
   u32 translation_buckets;
   u32 translation_memory_size;
   u32 user_buckets;
@@ -184,6 +285,10 @@ typedef struct {
   u32 outside_fib_index;
   u32 inside_vrf_id;
   u32 inside_fib_index;
+  u32 udp_timeout;
+  u32 tcp_established_timeout;
+  u32 tcp_transitory_timeout;
+  u32 icmp_timeout;
 
   /* API message ID base */
   u16 msg_id_base;
@@ -202,20 +307,35 @@ extern vlib_node_registration_t snat_in2out_node;
 extern vlib_node_registration_t snat_out2in_node;
 extern vlib_node_registration_t snat_in2out_fast_node;
 extern vlib_node_registration_t snat_out2in_fast_node;
+extern vlib_node_registration_t snat_in2out_worker_handoff_node;
+extern vlib_node_registration_t snat_out2in_worker_handoff_node;
+extern vlib_node_registration_t snat_det_in2out_node;
+extern vlib_node_registration_t snat_det_out2in_node;
+extern vlib_node_registration_t snat_expire_node;
 
 void snat_free_outside_address_and_port (snat_main_t * sm, 
                                          snat_session_key_t * k, 
                                          u32 address_index);
 
 int snat_alloc_outside_address_and_port (snat_main_t * sm, 
+                                         u32 cpu_index,
                                          snat_session_key_t * k,
                                          u32 * address_indexp);
 
+int snat_alloc_outside_address_and_port_in_block (snat_main_t * sm,
+                                                  u32 cpu_index,
+                                                  u32 user_index,
+                                                  snat_session_key_t * k,
+                                                  u32 * address_indexp);
+
 int snat_static_mapping_match (snat_main_t * sm,
                                snat_session_key_t match,
                                snat_session_key_t * mapping,
                                u8 by_external);
 
+void snat_session_timer_start (snat_main_t * sm, u32 cpu_index,
+                               snat_session_t * s, f64 now);
+
 format_function_t format_snat_user;
 
 typedef struct {
@@ -229,6 +349,113 @@ typedef struct {
 */
 #define snat_is_session_static(s) s->flags & SNAT_SESSION_FLAG_STATIC_MAPPING
 
+/** \brief Idle timeout of a translation.
+    @param sm SNAT main
+    @param protocol SNAT protocol
+    @param flags session flags, selects the TCP timeout
+    @return timeout in seconds
+*/
+static inline u32
+snat_timeout (snat_main_t * sm, u8 protocol, u32 flags)
+{
+  switch (protocol)
+    {
+    case SNAT_PROTOCOL_ICMP:
+      return sm->icmp_timeout;
+    case SNAT_PROTOCOL_TCP:
+      if ((flags & (SNAT_SESSION_FLAG_TCP_ESTABLISHED |
+                    SNAT_SESSION_FLAG_TCP_CLOSING)) ==
+          SNAT_SESSION_FLAG_TCP_ESTABLISHED)
+        return sm->tcp_established_timeout;
+      return sm->tcp_transitory_timeout;
+    default:
+      return sm->udp_timeout;
+    }
+}
+
+#define snat_session_timeout(sm, s) \
+  snat_timeout (sm, (s)->in2out.protocol, (s)->flags)
+
+/** \brief Track TCP session state from a translated packet.
+    A reply from outside establishes the session, FIN or RST in either
+    direction moves it to the transitory timeout for good.
+    Used for both SNAT and deterministic sessions.
+    @param s SNAT or deterministic session
+    @param tcp TCP header
+    @param is_out2in 1 if the packet came from outside
+*/
+#define snat_session_tcp_state_update(s, tcp, is_out2in)              \
+do {                                                                  \
+  if (PREDICT_FALSE ((tcp)->flags & (TCP_FLAG_FIN | TCP_FLAG_RST)))   \
+    (s)->flags |= SNAT_SESSION_FLAG_TCP_CLOSING;                      \
+  else if (is_out2in)                                                 \
+    (s)->flags |= SNAT_SESSION_FLAG_TCP_ESTABLISHED;                  \
+} while (0)
+
+/** \brief Worker thread owning the sessions of an inside address.
+    @param sm SNAT main
+    @param addr inside (source) address
+    @return thread index
+*/
+static inline u32
+snat_get_worker_in2out (snat_main_t * sm, ip4_address_t * addr)
+{
+  u32 hash, n_workers = vec_len (sm->workers);
+
+  if (PREDICT_FALSE (n_workers == 0))
+    return 0;
+
+  hash = addr->as_u32 + (addr->as_u32 >> 8) + (addr->as_u32 >> 16) +
+    (addr->as_u32 >> 24);
+
+  if (PREDICT_TRUE (is_pow2 (n_workers)))
+    return sm->first_worker_index + sm->workers[hash & (n_workers - 1)];
+
+  return sm->first_worker_index + sm->workers[hash % n_workers];
+}
+
+/** \brief Index in snat_main_t.workers owning an outside port.
+    @param sm SNAT main
+    @param port outside port in host byte order
+    @return worker index, the last worker also owns the remainder ports
+*/
+static inline u32
+snat_port_to_snat_thread_index (snat_main_t * sm, u16 port)
+{
+  u32 i, n_workers = vec_len (sm->workers);
+
+  if (n_workers <= 1 || port < 1024)
+    return 0;
+
+  i = (port - 1024) / sm->port_per_thread;
+
+  return i < n_workers ? i : n_workers - 1;
+}
+
+/** \brief Worker thread owning the session of an outside port.
+    @param sm SNAT main
+    @param port outside port in network byte order
+    @return thread index
+*/
+static inline u32
+snat_get_worker_out2in (snat_main_t * sm, u16 port)
+{
+  if (PREDICT_FALSE (vec_len (sm->workers) == 0))
+    return 0;
+
+  return sm->first_worker_index +
+    sm->workers[snat_port_to_snat_thread_index
+                (sm, clib_net_to_host_u16 (port))];
+}
+
+/** \brief Port block handle held by a user in port block mode.
+    @param address_index index in snat_main_t.addresses
+    @param block block number, ports 1024 + block * port_block_size onwards
+    @return handle
+*/
+#define snat_port_block_handle(address_index, block) \
+  (((address_index) << 16) | (block))
+
 /* 
  * Why is this here? Because we don't need to touch this layer to
  * simply reply to an icmp. We need to change id to a unique
@@ -0,0 +1,297 @@
+/*
+ * snat_det.c - deterministic nat
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vlib/vlib.h>
+#include <vlib/threads.h>
+#include <snat/snat.h>
+#include <snat/snat_det.h>
+
+/**
+ * @brief Add/delete deterministic mapping.
+ *
+ * Every inside host of the inside prefix gets the same number of outside
+ * ports, so the inside prefix must not be longer than the outside prefix
+ * and each inside host must get at least one port.
+ *
+ * @param sm       SNAT main.
+ * @param in_addr  Inside prefix address.
+ * @param in_plen  Inside prefix length.
+ * @param out_addr Outside prefix address.
+ * @param out_plen Outside prefix length.
+ * @param is_add   If 0 delete mapping, otherwise add.
+ *
+ * @returns 0 on success, non-zero value otherwise.
+ */
+int snat_det_add_map (snat_main_t * sm, ip4_address_t * in_addr, u8 in_plen,
+                      ip4_address_t * out_addr, u8 out_plen, int is_add)
+{
+  snat_det_map_t *dm;
+  snat_det_session_t ***chunkp;
+  ip4_address_t in_net, out_net;
+  u32 i;
+  u32 sharing_ratio;
+  uword * p;
+
+  if (in_plen > 32 || out_plen > 32 || in_plen > out_plen)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  /* Keep at least one port per inside host */
+  if (out_plen - in_plen > 15)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  /* Chunk pointers of up to a /8 inside prefix, 128KB */
+  if (in_plen < 8)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  in_net.as_u32 = in_addr->as_u32 & ip4_main.fib_masks[in_plen];
+  out_net.as_u32 = out_addr->as_u32 & ip4_main.fib_masks[out_plen];
+
+  vec_foreach (dm, sm->det_maps)
+    {
+      if (dm->in_plen == in_plen && dm->in_addr.as_u32 == in_net.as_u32 &&
+          dm->out_plen == out_plen && dm->out_addr.as_u32 == out_net.as_u32)
+        break;
+    }
+  if (dm == vec_end (sm->det_maps))
+    dm = 0;
+
+  if (is_add)
+    {
+      if (dm)
+        return VNET_API_ERROR_VALUE_EXIST;
+
+      /* Prefixes may not overlap those of another mapping */
+      vec_foreach (dm, sm->det_maps)
+        {
+          if (snat_det_addr_in_net (&in_net, &dm->in_addr,
+                                    clib_min (in_plen, dm->in_plen)) ||
+              snat_det_addr_in_net (&out_net, &dm->out_addr,
+                                    clib_min (out_plen, dm->out_plen)))
+            return VNET_API_ERROR_VALUE_EXIST;
+        }
+
+      /* If outside and inside FIB indices are not resolved yet */
+      if (sm->outside_fib_index == ~0)
+        {
+          p = hash_get (sm->ip4_main->fib_index_by_table_id,
+                        sm->outside_vrf_id);
+          if (!p)
+            return VNET_API_ERROR_NO_SUCH_FIB;
+          sm->outside_fib_index = p[0];
+        }
+      if (sm->inside_fib_index == ~0)
+        {
+          p = hash_get (sm->ip4_main->fib_index_by_table_id,
+                        sm->inside_vrf_id);
+          if (!p)
+            return VNET_API_ERROR_NO_SUCH_FIB;
+          sm->inside_fib_index = p[0];
+        }
+
+      sharing_ratio = 1 << (out_plen - in_plen);
+
+      vlib_worker_thread_barrier_sync (sm->vlib_main);
+      vec_add2 (sm->det_maps, dm, 1);
+      dm->in_addr = in_net;
+      dm->in_plen = in_plen;
+      dm->out_addr = out_net;
+      dm->out_plen = out_plen;
+      dm->sharing_ratio = sharing_ratio;
+      dm->ports_per_host = (65536 - SNAT_DET_FIRST_PORT) / sharing_ratio;
+      dm->ses_num = 0;
+      /* Session vectors are allocated on the first packet of each host,
+         only the chunk pointers up front */
+      dm->sessions = 0;
+      vec_validate (dm->sessions, ((1ULL << (32 - in_plen)) - 1) >>
+                    SNAT_DET_HOSTS_PER_CHUNK_LOG2);
+      vlib_worker_thread_barrier_release (sm->vlib_main);
+    }
+  else
+    {
+      if (!dm)
+        return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+      vlib_worker_thread_barrier_sync (sm->vlib_main);
+      vec_foreach (chunkp, dm->sessions)
+        {
+          if (!chunkp[0])
+            continue;
+          for (i = 0; i < SNAT_DET_HOSTS_PER_CHUNK; i++)
+            vec_free (chunkp[0][i]);
+          clib_mem_free (chunkp[0]);
+        }
+      vec_free (dm->sessions);
+      vec_del1 (sm->det_maps, dm - sm->det_maps);
+      vlib_worker_thread_barrier_release (sm->vlib_main);
+    }
+
+  return 0;
+}
+
+/*
+ * Allocate the chunk of session vectors of an inside host. Hosts of one
+ * chunk may be owned by different workers, so the first one to install
+ * its chunk wins.
+ */
+static snat_det_session_t **
+snat_det_user_sessions_alloc (snat_det_map_t * dm, ip4_address_t * in_addr)
+{
+  u32 offset = snat_det_user_offset (dm, in_addr);
+  snat_det_session_t **chunk;
+  uword n_bytes = SNAT_DET_HOSTS_PER_CHUNK * sizeof (chunk[0]);
+
+  chunk = clib_mem_alloc_aligned (n_bytes, CLIB_CACHE_LINE_BYTES);
+  memset (chunk, 0, n_bytes);
+  if (!__sync_bool_compare_and_swap
+      (vec_elt_at_index (dm->sessions,
+                         offset >> SNAT_DET_HOSTS_PER_CHUNK_LOG2), 0, chunk))
+    clib_mem_free (chunk);
+
+  return snat_det_user_sessions (dm, in_addr);
+}
+
+/**
+ * @brief Create deterministic session.
+ *
+ * The outside port is taken from the host's own range, starting at the
+ * inside port modulo the range size so that most sessions keep a stable
+ * port. An expired session of the host is reused first. A host over the
+ * max translations per user quota, or out of ports for the protocol,
+ * recycles its least recently used session.
+ *
+ * @param sm        SNAT main.
+ * @param cpu_index Thread owning the inside host.
+ * @param dm        Deterministic mapping of the host.
+ * @param in_addr   Inside address.
+ * @param lo_port   First outside port of the host, host byte order.
+ * @param in_port   Inside port, network byte order.
+ * @param protocol  SNAT protocol.
+ * @param now       Current time in seconds.
+ *
+ * @returns session, 0 if the host has no ports.
+ */
+snat_det_session_t *
+snat_det_ses_create (snat_main_t * sm, u32 cpu_index, snat_det_map_t * dm,
+                     ip4_address_t * in_addr, u16 lo_port, u16 in_port,
+                     u8 protocol, u32 now)
+{
+  snat_main_per_thread_data_t *tsm =
+    vec_elt_at_index (sm->per_thread_data, cpu_index);
+  snat_det_session_t **sesp, *ses, *oldest = 0, *oldest_proto = 0;
+  snat_det_session_t *expired = 0;
+  u32 n_words, n_proto = 0, offset, port_offset;
+
+  if (PREDICT_FALSE (dm->ports_per_host == 0))
+    return 0;
+
+  sesp = snat_det_user_sessions (dm, in_addr);
+  if (PREDICT_FALSE (sesp == 0))
+    sesp = snat_det_user_sessions_alloc (dm, in_addr);
+
+  /* Busy ports of this protocol, relative to lo_port */
+  n_words = (dm->ports_per_host + BITS (uword) - 1) / BITS (uword);
+  vec_validate (tsm->det_busy_ports, n_words - 1);
+  _vec_len (tsm->det_busy_ports) = n_words;
+  clib_bitmap_zero (tsm->det_busy_ports);
+
+  /* Ports of expired sessions are free */
+  vec_foreach (ses, sesp[0])
+    {
+      if (snat_det_ses_expired (sm, ses, now))
+        {
+          if (!expired)
+            expired = ses;
+          continue;
+        }
+      if (!oldest || ses->last_heard < oldest->last_heard)
+        oldest = ses;
+      if (ses->protocol != protocol)
+        continue;
+      n_proto++;
+      if (!oldest_proto || ses->last_heard < oldest_proto->last_heard)
+        oldest_proto = ses;
+      clib_bitmap_set_no_check (tsm->det_busy_ports,
+                                clib_net_to_host_u16 (ses->out_port) -
+                                lo_port, 1);
+    }
+
+  if (expired)
+    ses = expired;
+  else if (n_proto >= dm->ports_per_host)
+    ses = oldest_proto;
+  else if (vec_len (sesp[0]) >= sm->max_translations_per_user)
+    ses = oldest;
+  else
+    ses = 0;
+
+  if (ses)
+    {
+      /* Recycle, releasing its port if of the same protocol */
+      if (ses != expired && ses->protocol == protocol)
+        clib_bitmap_set_no_check (tsm->det_busy_ports,
+                                  clib_net_to_host_u16 (ses->out_port) -
+                                  lo_port, 0);
+    }
+  else
+    {
+      vec_add2 (sesp[0], ses, 1);
+      clib_smp_atomic_add (&dm->ses_num, 1);
+    }
+
+  port_offset = clib_net_to_host_u16 (in_port) % dm->ports_per_host;
+  offset = clib_bitmap_next_clear (tsm->det_busy_ports, port_offset);
+  if (offset >= dm->ports_per_host ||
+      clib_bitmap_get_no_check (tsm->det_busy_ports, offset))
+    offset = clib_bitmap_next_clear (tsm->det_busy_ports, 0);
+
+  ses->in_port = in_port;
+  ses->out_port = clib_host_to_net_u16 (lo_port + offset);
+  ses->protocol = protocol;
+  ses->flags = 0;
+  ses->last_heard = now;
+
+  return ses;
+}
+
+u8 * format_snat_det_map (u8 * s, va_list * args)
+{
+  snat_det_map_t * dm = va_arg (*args, snat_det_map_t *);
+  int verbose = va_arg (*args, int);
+  snat_det_session_t *** chunkp;
+  u32 i, n_users = 0;
+
+  s = format (s, "in %U/%d out %U/%d\n",
+              format_ip4_address, &dm->in_addr, dm->in_plen,
+              format_ip4_address, &dm->out_addr, dm->out_plen);
+  s = format (s, "  outside address sharing ratio: %d\n", dm->sharing_ratio);
+  s = format (s, "  number of ports per inside host: %d\n",
+              dm->ports_per_host);
+
+  if (verbose == 0)
+    return format (s, "  sessions number: %d", dm->ses_num);
+
+  vec_foreach (chunkp, dm->sessions)
+    {
+      if (!chunkp[0])
+        continue;
+      for (i = 0; i < SNAT_DET_HOSTS_PER_CHUNK; i++)
+        n_users += vec_len (chunkp[0][i]) != 0;
+    }
+
+  return format (s, "  sessions number: %d, active inside hosts: %d",
+                 dm->ses_num, n_users);
+}
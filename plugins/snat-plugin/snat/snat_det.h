@@ -0,0 +1,233 @@
+/*
+ * snat_det.h - deterministic nat definitions
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Deterministic NAT maps each inside host to an outside address and a
+ * fixed range of outside ports computed from the host's offset in the
+ * inside prefix:
+ *
+ *   out_addr = out_prefix + in_offset / sharing_ratio
+ *   lo_port  = 1024 + ports_per_host * (in_offset % sharing_ratio)
+ *
+ * The reverse mapping needs no lookup table, return traffic finds the
+ * inside host from its destination address and port alone. The only
+ * state kept is a small session vector per active inside host, owned by
+ * the worker selected by snat_get_worker_in2out.
+ */
+#ifndef __included_snat_det_h__
+#define __included_snat_det_h__
+
+#include <vnet/ip/ip.h>
+#include <snat/snat.h>
+
+#define SNAT_DET_FIRST_PORT 1024
+
+/* Inside hosts per lazily allocated chunk of session vectors */
+#define SNAT_DET_HOSTS_PER_CHUNK_LOG2 10
+#define SNAT_DET_HOSTS_PER_CHUNK (1 << SNAT_DET_HOSTS_PER_CHUNK_LOG2)
+
+int snat_det_add_map (snat_main_t * sm, ip4_address_t * in_addr, u8 in_plen,
+                      ip4_address_t * out_addr, u8 out_plen, int is_add);
+
+snat_det_session_t * snat_det_ses_create (snat_main_t * sm, u32 cpu_index,
+                                          snat_det_map_t * dm,
+                                          ip4_address_t * in_addr,
+                                          u16 lo_port, u16 in_port,
+                                          u8 protocol, u32 now);
+
+format_function_t format_snat_det_map;
+
+static inline int
+snat_det_addr_in_net (ip4_address_t * addr, ip4_address_t * net, u8 plen)
+{
+  if (plen == 0)
+    return 1;
+
+  return ((clib_net_to_host_u32 (addr->as_u32) ^
+           clib_net_to_host_u32 (net->as_u32)) >> (32 - plen)) == 0;
+}
+
+/** \brief Deterministic mapping of an inside address.
+    @param sm SNAT main
+    @param in_addr inside address
+    @return mapping or 0 if none
+*/
+static inline snat_det_map_t *
+snat_det_map_by_user (snat_main_t * sm, ip4_address_t * in_addr)
+{
+  snat_det_map_t *dm;
+
+  vec_foreach (dm, sm->det_maps)
+    {
+      if (snat_det_addr_in_net (in_addr, &dm->in_addr, dm->in_plen))
+        return dm;
+    }
+
+  return 0;
+}
+
+/** \brief Deterministic mapping of an outside address.
+    @param sm SNAT main
+    @param out_addr outside address
+    @return mapping or 0 if none
+*/
+static inline snat_det_map_t *
+snat_det_map_by_out (snat_main_t * sm, ip4_address_t * out_addr)
+{
+  snat_det_map_t *dm;
+
+  vec_foreach (dm, sm->det_maps)
+    {
+      if (snat_det_addr_in_net (out_addr, &dm->out_addr, dm->out_plen))
+        return dm;
+    }
+
+  return 0;
+}
+
+static inline u32
+snat_det_user_offset (snat_det_map_t * dm, ip4_address_t * in_addr)
+{
+  return clib_net_to_host_u32 (in_addr->as_u32) -
+    clib_net_to_host_u32 (dm->in_addr.as_u32);
+}
+
+/** \brief Outside address and first outside port of an inside host.
+    @param dm deterministic mapping of the host
+    @param in_addr inside address
+    @param out_addr returned outside address
+    @param lo_port returned first port, host byte order
+*/
+static inline void
+snat_det_forward (snat_det_map_t * dm, ip4_address_t * in_addr,
+                  ip4_address_t * out_addr, u16 * lo_port)
+{
+  u32 in_offset;
+
+  in_offset = snat_det_user_offset (dm, in_addr);
+
+  out_addr->as_u32 =
+    clib_host_to_net_u32 (clib_net_to_host_u32 (dm->out_addr.as_u32) +
+                          in_offset / dm->sharing_ratio);
+  *lo_port = SNAT_DET_FIRST_PORT +
+    dm->ports_per_host * (in_offset % dm->sharing_ratio);
+}
+
+/** \brief Inside host of an outside address and port.
+    @param dm deterministic mapping of the outside address
+    @param out_addr outside address
+    @param out_port outside port, host byte order
+    @param in_addr returned inside address
+    @return 0 on success, 1 if the port is not mapped to any host
+*/
+static inline int
+snat_det_reverse (snat_det_map_t * dm, ip4_address_t * out_addr,
+                  u16 out_port, ip4_address_t * in_addr)
+{
+  u32 port_offset, in_offset;
+
+  if (PREDICT_FALSE (out_port < SNAT_DET_FIRST_PORT))
+    return 1;
+
+  port_offset = (out_port - SNAT_DET_FIRST_PORT) / dm->ports_per_host;
+  if (PREDICT_FALSE (port_offset >= dm->sharing_ratio))
+    return 1;
+
+  in_offset = (clib_net_to_host_u32 (out_addr->as_u32) -
+               clib_net_to_host_u32 (dm->out_addr.as_u32)) *
+    dm->sharing_ratio + port_offset;
+
+  in_addr->as_u32 =
+    clib_host_to_net_u32 (clib_net_to_host_u32 (dm->in_addr.as_u32) +
+                          in_offset);
+  return 0;
+}
+
+/** \brief Session vector of an inside host.
+    @return 0 if no host of its chunk has had a session yet
+*/
+static inline snat_det_session_t **
+snat_det_user_sessions (snat_det_map_t * dm, ip4_address_t * in_addr)
+{
+  u32 offset = snat_det_user_offset (dm, in_addr);
+  snat_det_session_t **chunk;
+
+  chunk = *vec_elt_at_index (dm->sessions,
+                             offset >> SNAT_DET_HOSTS_PER_CHUNK_LOG2);
+  if (PREDICT_FALSE (chunk == 0))
+    return 0;
+  return chunk + (offset & (SNAT_DET_HOSTS_PER_CHUNK - 1));
+}
+
+/** \brief Check if deterministic session is idle for longer than its
+    timeout. No timers are kept for deterministic sessions, expired ones
+    are skipped by lookups and reused by snat_det_ses_create.
+    @param sm SNAT main
+    @param ses deterministic session
+    @param now current time in seconds
+    @return 1 if expired, 0 otherwise
+*/
+static inline int
+snat_det_ses_expired (snat_main_t * sm, snat_det_session_t * ses, u32 now)
+{
+  return now - ses->last_heard >
+    snat_timeout (sm, ses->protocol, ses->flags);
+}
+
+static inline snat_det_session_t *
+snat_det_find_ses_by_in (snat_main_t * sm, snat_det_map_t * dm,
+                         ip4_address_t * in_addr, u16 in_port, u8 protocol,
+                         u32 now)
+{
+  snat_det_session_t **sesp, *ses;
+
+  sesp = snat_det_user_sessions (dm, in_addr);
+  if (PREDICT_FALSE (sesp == 0))
+    return 0;
+
+  vec_foreach (ses, sesp[0])
+    {
+      if (ses->in_port == in_port && ses->protocol == protocol &&
+          !snat_det_ses_expired (sm, ses, now))
+        return ses;
+    }
+
+  return 0;
+}
+
+/* Expired sessions are skipped, their ports may be in use again */
+static inline snat_det_session_t *
+snat_det_find_ses_by_out (snat_main_t * sm, snat_det_map_t * dm,
+                          ip4_address_t * in_addr, u16 out_port, u8 protocol,
+                          u32 now)
+{
+  snat_det_session_t **sesp, *ses;
+
+  sesp = snat_det_user_sessions (dm, in_addr);
+  if (PREDICT_FALSE (sesp == 0))
+    return 0;
+
+  vec_foreach (ses, sesp[0])
+    {
+      if (ses->out_port == out_port && ses->protocol == protocol &&
+          !snat_det_ses_expired (sm, ses, now))
+        return ses;
+    }
+
+  return 0;
+}
+
+#endif /* __included_snat_det_h__ */
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "stat_segment.h"
+
+static u32 stat_segment_elt_bytes[STAT_SEGMENT_N_TYPES] = {
+  [STAT_SEGMENT_TYPE_NAME] = STAT_SEGMENT_NAME_BYTES,
+  [STAT_SEGMENT_TYPE_COUNTER] = sizeof (u64),
+  [STAT_SEGMENT_TYPE_COMBINED_COUNTER] =
+    sizeof (stat_segment_combined_counter_t),
+  [STAT_SEGMENT_TYPE_NODE_RUNTIME] = sizeof (stat_segment_node_runtime_t),
+};
+
+u8 *
+format_stat_segment_error (u8 * s, va_list * args)
+{
+  int error = va_arg (*args, int);
+  char *t = 0;
+
+  switch (error)
+    {
+#define _(n,str,c) case c: t = str; break;
+      foreach_ssvm_api_error
+      foreach_stat_segment_error
+#undef _
+    default:
+      break;
+    }
+
+  if (t)
+    return format (s, "%s", t);
+  return format (s, "error %d", error);
+}
+
+/*
+ * Create the segment and an empty directory. The segment is mapped
+ * wherever the kernel likes: readers never follow pointers in it.
+ */
+int
+stat_segment_create (stat_segment_t * s, char *name, u64 size)
+{
+  ssvm_private_t *ssvm = &s->ssvm;
+  ssvm_shared_header_t *sh;
+  stat_segment_directory_t *d;
+  void *oldheap;
+  int rv;
+
+  memset (s, 0, sizeof (*s));
+  ssvm->ssvm_size = size;
+  ssvm->name = format (0, "%s%c", name, 0);
+
+  rv = ssvm_master_init (ssvm, 0 /* master_index */ );
+  if (rv)
+    return rv;
+
+  sh = ssvm->sh;
+  oldheap = ssvm_push_heap (sh);
+  d = clib_mem_alloc_aligned (sizeof (*d), CLIB_CACHE_LINE_BYTES);
+  ssvm_pop_heap (oldheap);
+
+  memset (d, 0, sizeof (*d));
+  d->version = STAT_SEGMENT_VERSION;
+  s->directory = d;
+  sh->opaque[STAT_SEGMENT_OPAQUE_DIRECTORY] = d;
+
+  CLIB_MEMORY_BARRIER ();
+  sh->ready = 1;
+  return 0;
+}
+
+/* Add an empty vector to the directory, returns its index. */
+int
+stat_segment_vector_add (stat_segment_t * s, char *name,
+			 stat_segment_type_t type)
+{
+  stat_segment_directory_t *d = s->directory;
+  stat_segment_vector_t *v;
+
+  ASSERT (type < STAT_SEGMENT_N_TYPES);
+
+  if (d->n_vectors >= STAT_SEGMENT_MAX_VECTORS)
+    return STAT_SEGMENT_ERROR_FULL;
+
+  v = d->vectors + d->n_vectors;
+  memset (v, 0, sizeof (*v));
+  strncpy (v->name, name, sizeof (v->name) - 1);
+  v->type = type;
+  v->elt_bytes = stat_segment_elt_bytes[type];
+
+  /* Publish the entry only once it is complete */
+  CLIB_MEMORY_BARRIER ();
+  return d->n_vectors++;
+}
+
+/*
+ * Start changing a vector, making room for n_elts elements. Elements
+ * below the old length keep their values, new ones are zero. Returns
+ * the elements, or 0 if the segment is out of memory. Every successful
+ * call must be paired with stat_segment_vector_end.
+ */
+void *
+stat_segment_vector_begin (stat_segment_t * s, u32 index, u32 n_elts)
+{
+  ssvm_shared_header_t *sh = s->ssvm.sh;
+  stat_segment_vector_t *v = s->directory->vectors + index;
+  u8 *base = (u8 *) sh;
+  u8 *data, *old;
+  u32 max_elts;
+  void *oldheap;
+
+  ASSERT (index < s->directory->n_vectors);
+
+  v->epoch++;
+  CLIB_MEMORY_BARRIER ();
+
+  if (n_elts > v->max_elts || v->data_offset == 0)
+    {
+      max_elts = clib_max (n_elts + n_elts / 2, 16);
+
+      oldheap = ssvm_push_heap (sh);
+      data = clib_mem_alloc_aligned_or_null (max_elts * v->elt_bytes,
+					     CLIB_CACHE_LINE_BYTES);
+      ssvm_pop_heap (oldheap);
+
+      if (!data)
+	{
+	  CLIB_MEMORY_BARRIER ();
+	  v->epoch++;
+	  return 0;
+	}
+
+      memset (data, 0, max_elts * v->elt_bytes);
+      old = v->data_offset ? base + v->data_offset : 0;
+      if (old)
+	clib_memcpy (data, old, v->n_elts * v->elt_bytes);
+
+      /*
+       * A reader still copying the old elements notices the epoch
+       * change and retries, so they can be freed right away.
+       */
+      v->data_offset = data - base;
+      v->max_elts = max_elts;
+
+      if (old)
+	{
+	  oldheap = ssvm_push_heap (sh);
+	  clib_mem_free (old);
+	  ssvm_pop_heap (oldheap);
+	}
+    }
+
+  if (n_elts > v->n_elts)
+    memset (base + v->data_offset + v->n_elts * v->elt_bytes, 0,
+	    (n_elts - v->n_elts) * v->elt_bytes);
+  v->n_elts = n_elts;
+
+  return base + v->data_offset;
+}
+
+void
+stat_segment_vector_end (stat_segment_t * s, u32 index)
+{
+  stat_segment_vector_t *v = s->directory->vectors + index;
+
+  CLIB_MEMORY_BARRIER ();
+  v->epoch++;
+}
+
+void
+stat_segment_update_done (stat_segment_t * s)
+{
+  s->directory->last_update = unix_time_now ();
+  CLIB_MEMORY_BARRIER ();
+  s->directory->n_updates++;
+}
+
+/* Map an existing segment read-only. */
+int
+stat_client_connect (stat_client_t * c, char *name)
+{
+  ssvm_shared_header_t *sh;
+  struct stat st;
+  uword offset;
+  int fd, rv;
+
+  memset (c, 0, sizeof (*c));
+
+  fd = shm_open (name, O_RDONLY, 0);
+  if (fd < 0)
+    return STAT_SEGMENT_ERROR_NOT_READY;
+
+  if (fstat (fd, &st) < 0 || st.st_size < MMAP_PAGESIZE)
+    {
+      close (fd);
+      return STAT_SEGMENT_ERROR_NOT_READY;
+    }
+
+  c->size = st.st_size;
+  c->base = mmap (0, c->size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (c->base == MAP_FAILED)
+    {
+      c->base = 0;
+      return SSVM_API_ERROR_MMAP;
+    }
+
+  sh = (ssvm_shared_header_t *) c->base;
+  if (!sh->ready)
+    {
+      rv = STAT_SEGMENT_ERROR_NOT_READY;
+      goto error;
+    }
+
+  offset = pointer_to_uword (sh->opaque[STAT_SEGMENT_OPAQUE_DIRECTORY])
+    - sh->ssvm_va;
+  if (offset + sizeof (stat_segment_directory_t) > c->size)
+    {
+      rv = STAT_SEGMENT_ERROR_CORRUPT;
+      goto error;
+    }
+
+  c->directory = (stat_segment_directory_t *) (c->base + offset);
+  if (c->directory->version != STAT_SEGMENT_VERSION)
+    {
+      rv = STAT_SEGMENT_ERROR_VERSION;
+      goto error;
+    }
+
+  return 0;
+
+error:
+  stat_client_disconnect (c);
+  return rv;
+}
+
+void
+stat_client_disconnect (stat_client_t * c)
+{
+  if (c->base)
+    munmap (c->base, c->size);
+  c->base = 0;
+  c->directory = 0;
+}
+
+int
+stat_client_find_vector (stat_client_t * c, char *name)
+{
+  stat_segment_directory_t *d = c->directory;
+  int i;
+
+  for (i = 0; i < d->n_vectors && i < STAT_SEGMENT_MAX_VECTORS; i++)
+    if (!strncmp (d->vectors[i].name, name, STAT_SEGMENT_NAME_BYTES))
+      return i;
+
+  return STAT_SEGMENT_ERROR_NO_SUCH_VECTOR;
+}
+
+/*
+ * Copy a consistent snapshot of a vector's elements into the vector
+ * *data. Returns the number of elements, or an error if the writer
+ * kept changing the vector.
+ */
+int
+stat_client_vector_copy (stat_client_t * c, u32 index, u8 ** data)
+{
+  stat_segment_directory_t *d = c->directory;
+  stat_segment_vector_t *v;
+  u64 epoch, offset, n_bytes;
+  u32 n_elts;
+  int i;
+
+  if (index >= d->n_vectors || index >= STAT_SEGMENT_MAX_VECTORS)
+    return STAT_SEGMENT_ERROR_NO_SUCH_VECTOR;
+  v = d->vectors + index;
+
+  for (i = 0; i < STAT_SEGMENT_READ_RETRIES; i++)
+    {
+      if (i >= STAT_SEGMENT_READ_SPINS)
+	usleep (1);
+
+      epoch = v->epoch;
+      CLIB_MEMORY_BARRIER ();
+
+      if (epoch & 1)
+	{
+	  c->n_retries++;
+	  continue;
+	}
+
+      n_elts = v->n_elts;
+      offset = v->data_offset;
+      n_bytes = (u64) n_elts * v->elt_bytes;
+
+      if (offset + n_bytes <= c->size)
+	{
+	  vec_validate (*data, n_bytes);
+	  _vec_len (*data) = n_bytes;
+	  clib_memcpy (*data, c->base + offset, n_bytes);
+	}
+
+      CLIB_MEMORY_BARRIER ();
+      if (v->epoch == epoch)
+	return offset + n_bytes <= c->size ?
+	  n_elts : STAT_SEGMENT_ERROR_CORRUPT;
+
+      c->n_retries++;
+    }
+
+  return STAT_SEGMENT_ERROR_BUSY;
+}
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
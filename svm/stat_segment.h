@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * stat_segment.h: shared memory statistics segment
+ *
+ * The statistics segment is an ssvm segment holding a directory of
+ * named vectors: counters, and the names which go with them. Its owner
+ * creates and updates it. Readers map it read-only, at any address,
+ * and copy vectors out without locks or API messages, so all
+ * references inside the segment are offsets from the segment base.
+ *
+ * Each vector has an epoch which the writer makes odd before and even
+ * after changing the vector. A reader copies the vector, then retries
+ * if the epoch was odd or has changed meanwhile.
+ */
+
+#ifndef __included_stat_segment_h__
+#define __included_stat_segment_h__
+
+#include "ssvm.h"
+
+#define STAT_SEGMENT_VERSION 1
+#define STAT_SEGMENT_DEFAULT_NAME "vpp-stats"
+#define STAT_SEGMENT_NAME_BYTES 64
+#define STAT_SEGMENT_MAX_VECTORS 64
+
+/* ssvm_shared_header_t opaque slot pointing at the directory */
+#define STAT_SEGMENT_OPAQUE_DIRECTORY 0
+
+/* Times a reader retries a vector the writer keeps changing. Retries
+   after the first few sleep, so that a writer which was preempted
+   half way through an update gets to finish it. */
+#define STAT_SEGMENT_READ_RETRIES 1000
+#define STAT_SEGMENT_READ_SPINS 8
+
+typedef enum
+{
+  /* NUL terminated names, STAT_SEGMENT_NAME_BYTES each */
+  STAT_SEGMENT_TYPE_NAME,
+  /* u64 */
+  STAT_SEGMENT_TYPE_COUNTER,
+  /* stat_segment_combined_counter_t */
+  STAT_SEGMENT_TYPE_COMBINED_COUNTER,
+  /* stat_segment_node_runtime_t */
+  STAT_SEGMENT_TYPE_NODE_RUNTIME,
+  STAT_SEGMENT_N_TYPES,
+} stat_segment_type_t;
+
+typedef struct
+{
+  u64 packets;
+  u64 bytes;
+} stat_segment_combined_counter_t;
+
+typedef struct
+{
+  u64 calls;
+  u64 vectors;
+  u64 clocks;
+  u64 suspends;
+} stat_segment_node_runtime_t;
+
+typedef struct
+{
+  /* Odd while the writer changes the vector */
+  volatile u64 epoch;
+  char name[STAT_SEGMENT_NAME_BYTES];
+  u32 type;
+  u32 elt_bytes;
+  u32 n_elts;
+  u32 max_elts;
+  /* Offset of the elements from the segment base */
+  u64 data_offset;
+} stat_segment_vector_t;
+
+typedef struct
+{
+  u32 version;
+  /* Entries are complete before n_vectors covers them */
+  volatile u32 n_vectors;
+  /* Updates done by the writer, and unix time of the last one */
+  volatile u64 n_updates;
+  volatile f64 last_update;
+  stat_segment_vector_t vectors[STAT_SEGMENT_MAX_VECTORS];
+} stat_segment_directory_t;
+
+#define foreach_stat_segment_error                      \
+_(NOT_READY, "Segment not ready", -20)                  \
+_(VERSION, "Segment version mismatch", -21)             \
+_(FULL, "Segment directory full", -22)                  \
+_(NO_SUCH_VECTOR, "No such vector", -23)                \
+_(BUSY, "Vector kept changing while read", -24)         \
+_(CORRUPT, "Vector outside of the segment", -25)
+
+typedef enum
+{
+#define _(n,s,c) STAT_SEGMENT_ERROR_##n = c,
+  foreach_stat_segment_error
+#undef _
+} stat_segment_error_t;
+
+/* Writer side */
+typedef struct
+{
+  ssvm_private_t ssvm;
+  stat_segment_directory_t *directory;
+} stat_segment_t;
+
+int stat_segment_create (stat_segment_t * s, char *name, u64 size);
+int stat_segment_vector_add (stat_segment_t * s, char *name,
+			     stat_segment_type_t type);
+void *stat_segment_vector_begin (stat_segment_t * s, u32 index, u32 n_elts);
+void stat_segment_vector_end (stat_segment_t * s, u32 index);
+void stat_segment_update_done (stat_segment_t * s);
+
+/* Reader side */
+typedef struct
+{
+  u8 *base;
+  u64 size;
+  stat_segment_directory_t *directory;
+
+  /* Reads which had to be retried */
+  u64 n_retries;
+} stat_client_t;
+
+int stat_client_connect (stat_client_t * c, char *name);
+void stat_client_disconnect (stat_client_t * c);
+int stat_client_find_vector (stat_client_t * c, char *name);
+int stat_client_vector_copy (stat_client_t * c, u32 index, u8 ** data);
+
+format_function_t format_stat_segment_error;
+
+#endif /* __included_stat_segment_h__ */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
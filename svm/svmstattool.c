@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * svmstattool: list, dump and poll the statistics segment.
+ *
+ *   svmstattool [name <segment>] ls
+ *   svmstattool [name <segment>] dump <vector>
+ *   svmstattool [name <segment>] poll <count>
+ *
+ * "poll" copies every vector in the directory <count> times as fast as
+ * it can and reports what one full snapshot costs a reader.
+ */
+#include <vppinfra/time.h>
+#include "stat_segment.h"
+
+static char *stat_segment_type_names[] = {
+  [STAT_SEGMENT_TYPE_NAME] = "name",
+  [STAT_SEGMENT_TYPE_COUNTER] = "counter",
+  [STAT_SEGMENT_TYPE_COMBINED_COUNTER] = "combined",
+  [STAT_SEGMENT_TYPE_NODE_RUNTIME] = "runtime",
+};
+
+static u8 *
+format_stat_segment_type (u8 * s, va_list * args)
+{
+  u32 type = va_arg (*args, u32);
+
+  if (type < STAT_SEGMENT_N_TYPES)
+    return format (s, "%s", stat_segment_type_names[type]);
+  return format (s, "type %d", type);
+}
+
+static void
+list_vectors (stat_client_t * c)
+{
+  stat_segment_directory_t *d = c->directory;
+  stat_segment_vector_t *v;
+  int i;
+
+  fformat (stdout, "%d vectors, %lld updates\n", d->n_vectors,
+	   d->n_updates);
+  fformat (stdout, "%-40s%=10s%=10s%=12s\n", "Name", "Type", "Elts",
+	   "Epoch");
+  for (i = 0; i < d->n_vectors; i++)
+    {
+      v = d->vectors + i;
+      fformat (stdout, "%-40s%=10U%=10d%=12lld\n", v->name,
+	       format_stat_segment_type, v->type, v->n_elts, v->epoch);
+    }
+}
+
+static int
+dump_vector (stat_client_t * c, char *name)
+{
+  stat_segment_vector_t *v;
+  stat_segment_combined_counter_t *cc;
+  stat_segment_node_runtime_t *r;
+  u8 *data = 0;
+  int index, n, i;
+
+  index = stat_client_find_vector (c, name);
+  if (index < 0)
+    return index;
+
+  n = stat_client_vector_copy (c, index, &data);
+  if (n < 0)
+    return n;
+
+  v = c->directory->vectors + index;
+  for (i = 0; i < n; i++)
+    {
+      switch (v->type)
+	{
+	case STAT_SEGMENT_TYPE_NAME:
+	  fformat (stdout, "%8d %s\n", i, data + i * v->elt_bytes);
+	  break;
+	case STAT_SEGMENT_TYPE_COUNTER:
+	  fformat (stdout, "%8d %lld\n", i, ((u64 *) data)[i]);
+	  break;
+	case STAT_SEGMENT_TYPE_COMBINED_COUNTER:
+	  cc = (stat_segment_combined_counter_t *) data + i;
+	  fformat (stdout, "%8d %lld packets %lld bytes\n", i, cc->packets,
+		   cc->bytes);
+	  break;
+	case STAT_SEGMENT_TYPE_NODE_RUNTIME:
+	  r = (stat_segment_node_runtime_t *) data + i;
+	  fformat (stdout, "%8d %lld calls %lld vectors %lld clocks "
+		   "%lld suspends\n", i, r->calls, r->vectors, r->clocks,
+		   r->suspends);
+	  break;
+	}
+    }
+
+  vec_free (data);
+  return 0;
+}
+
+static int
+poll_vectors (stat_client_t * c, u32 count)
+{
+  stat_segment_directory_t *d = c->directory;
+  u8 **data = 0;
+  u64 n_bytes = 0, n_updates;
+  f64 start, dt;
+  u32 i, j;
+  int n;
+
+  vec_validate (data, STAT_SEGMENT_MAX_VECTORS - 1);
+  n_updates = d->n_updates;
+  start = unix_time_now ();
+
+  for (i = 0; i < count; i++)
+    for (j = 0; j < d->n_vectors; j++)
+      {
+	n = stat_client_vector_copy (c, j, &data[j]);
+	if (n < 0)
+	  return n;
+	n_bytes += vec_len (data[j]);
+      }
+
+  dt = unix_time_now () - start;
+
+  fformat (stdout, "%d polls of %d vectors in %.3f sec, %.2f us per poll, "
+	   "%.2f MB/s\n", count, d->n_vectors, dt,
+	   count ? dt * 1e6 / count : 0, dt > 0 ? n_bytes / dt / 1e6 : 0);
+  fformat (stdout, "%lld retries, %lld writer updates meanwhile\n",
+	   c->n_retries, d->n_updates - n_updates);
+
+  for (j = 0; j < vec_len (data); j++)
+    vec_free (data[j]);
+  vec_free (data);
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  unformat_input_t input;
+  stat_client_t _c, *c = &_c;
+  char *name = STAT_SEGMENT_DEFAULT_NAME;
+  u8 *vector = 0, *s;
+  u32 count = 0;
+  int ls = 0, rv;
+
+  clib_mem_init (0, 64 << 20);
+
+  unformat_init_command_line (&input, argv);
+
+  while (unformat_check_input (&input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (&input, "name %s", &s))
+	name = (char *) format (0, "%v%c", s, 0);
+      else if (unformat (&input, "ls"))
+	ls = 1;
+      else if (unformat (&input, "dump %s", &s))
+	vector = format (0, "%v%c", s, 0);
+      else if (unformat (&input, "poll %u", &count))
+	;
+      else
+	{
+	  fformat (stderr, "usage: svmstattool [name <segment>] "
+		   "[ls] [dump <vector>] [poll <count>]\n");
+	  exit (1);
+	}
+    }
+
+  rv = stat_client_connect (c, name);
+  if (rv)
+    {
+      fformat (stderr, "%s: %U\n", name, format_stat_segment_error, rv);
+      exit (1);
+    }
+
+  if (ls || (!vector && !count))
+    list_vectors (c);
+
+  if (vector && (rv = dump_vector (c, (char *) vector)))
+    fformat (stderr, "%s: %U\n", vector, format_stat_segment_error, rv);
+
+  if (count && (rv = poll_vectors (c, count)))
+    fformat (stderr, "poll: %U\n", format_stat_segment_error, rv);
+
+  stat_client_disconnect (c);
+  exit (rv ? 1 : 0);
+}
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
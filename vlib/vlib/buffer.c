@@ -264,6 +264,11 @@ vlib_buffer_validate_alloc_free (vlib_main_t * vm,
   if (CLIB_DEBUG == 0)
     return;
 
+  /* The known state hash belongs to the main thread. Once there are
+     workers buffers move between threads through the depots. */
+  if (vec_len (vlib_mains) > 1)
+    return;
+
   ASSERT (os_get_cpu_number () == 0);
 
   /* smp disaster check */
@@ -450,18 +455,74 @@ vlib_buffer_get_free_list_with_size (vlib_main_t * vm, u32 size)
   return p ? p[0] : ~0;
 }
 
+always_inline void
+vlib_buffer_depot_push (vlib_buffer_depot_t * d, volatile u64 * head,
+			u32 batch_index)
+{
+  u64 old, new;
+
+  do
+    {
+      old = *head;
+      d->batches[batch_index].next = (u32) old;
+      new = (((old >> 32) + 1) << 32) | batch_index;
+    }
+  while (!__sync_bool_compare_and_swap (head, old, new));
+}
+
+always_inline u32
+vlib_buffer_depot_pop (vlib_buffer_depot_t * d, volatile u64 * head)
+{
+  u64 old, new;
+  u32 batch_index;
+
+  do
+    {
+      old = *head;
+      batch_index = (u32) old;
+      if (batch_index == VLIB_BUFFER_DEPOT_EMPTY)
+	return batch_index;
+      new = (((old >> 32) + 1) << 32) | d->batches[batch_index].next;
+    }
+  while (!__sync_bool_compare_and_swap (head, old, new));
+
+  return batch_index;
+}
+
+static void
+vlib_buffer_depot_create (vlib_main_t * vm, u32 free_list_index)
+{
+  vlib_buffer_main_t *bm = vm->buffer_main;
+  vlib_buffer_depot_t *d = 0;
+  u32 i;
+
+  /* One zeroed element, depots live as long as their free list */
+  vec_validate_aligned (d, 0, CLIB_CACHE_LINE_BYTES);
+  d->free_list_index = free_list_index;
+  d->full = d->empty = VLIB_BUFFER_DEPOT_EMPTY;
+
+  vec_validate_aligned (d->batches, VLIB_BUFFER_DEPOT_N_BATCHES - 1,
+			CLIB_CACHE_LINE_BYTES);
+  for (i = 0; i < VLIB_BUFFER_DEPOT_N_BATCHES; i++)
+    vlib_buffer_depot_push (d, &d->empty, i);
+
+  vec_validate (bm->depot_by_free_list_index, free_list_index);
+  bm->depot_by_free_list_index[free_list_index] = d;
+}
+
 /* Add buffer free list. */
 static u32
 vlib_buffer_create_free_list_helper (vlib_main_t * vm,
 				     u32 n_data_bytes,
-				     u32 is_public, u32 is_default, u8 * name)
+				     u32 is_public, u32 is_default, u8 * name,
+				     u32 numa_node)
 {
   vlib_buffer_main_t *bm = vm->buffer_main;
   vlib_buffer_free_list_t *f;
 
   if (!is_default && pool_elts (bm->buffer_free_list_pool) == 0)
     {
-      u32 default_free_free_list_index;
+      u32 default_free_free_list_index, i;
 
       default_free_free_list_index = vlib_buffer_create_free_list_helper (vm,
 									  /* default buffer size */
@@ -472,9 +533,25 @@ vlib_buffer_create_free_list_helper (vlib_main_t * vm,
 									  1,
 									  (u8
 									   *)
-									  "default");
+									  "default",
+									  0);
       ASSERT (default_free_free_list_index ==
 	      VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
+      vec_add1 (bm->default_free_list_index_by_numa_node,
+		default_free_free_list_index);
+
+      /* Other NUMA nodes get their own, private, default free list */
+      for (i = 1; i < vm->physmem_main.n_numa_nodes; i++)
+	vec_add1 (bm->default_free_list_index_by_numa_node,
+		  vlib_buffer_create_free_list_helper
+		  (vm, VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES,
+		   /* is_public */ 0, /* is_default */ 1,
+		   format (0, "default-numa%d", i), i));
+
+      for (i = 0; i < vec_len (bm->default_free_list_index_by_numa_node);
+	   i++)
+	vlib_buffer_depot_create
+	  (vm, bm->default_free_list_index_by_numa_node[i]);
 
       if (n_data_bytes == VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES && is_public)
 	return default_free_free_list_index;
@@ -487,6 +564,7 @@ vlib_buffer_create_free_list_helper (vlib_main_t * vm,
   f->n_data_bytes = vlib_buffer_round_size (n_data_bytes);
   f->min_n_buffers_each_physmem_alloc = 256;
   f->name = clib_mem_is_heap_object (name) ? name : format (0, "%s", name);
+  f->numa_node = numa_node;
 
   /* Setup free buffer template. */
   f->buffer_init_template.free_list_index = f->index;
@@ -515,7 +593,7 @@ vlib_buffer_create_free_list (vlib_main_t * vm, u32 n_data_bytes,
   return vlib_buffer_create_free_list_helper (vm, n_data_bytes,
 					      /* is_public */ 0,
 					      /* is_default */ 0,
-					      name);
+					      name, vm->numa_node);
 }
 
 u32
@@ -536,7 +614,7 @@ vlib_buffer_get_or_create_free_list (vlib_main_t * vm, u32 n_data_bytes,
       i = vlib_buffer_create_free_list_helper (vm, n_data_bytes,
 					       /* is_public */ 1,
 					       /* is_default */ 0,
-					       name);
+					       name, vm->numa_node);
     }
 
   return i;
@@ -614,9 +692,16 @@ fill_free_list (vlib_main_t * vm,
       n_bytes = n_this_chunk * (sizeof (b[0]) + fl->n_data_bytes);
 
       /* drb: removed power-of-2 ASSERT */
-      buffers = vm->os_physmem_alloc_aligned (&vm->physmem_main,
-					      n_bytes,
-					      sizeof (vlib_buffer_t));
+      if (vm->os_physmem_alloc_aligned_on_numa)
+	buffers = vm->os_physmem_alloc_aligned_on_numa (&vm->physmem_main,
+							n_bytes,
+							sizeof
+							(vlib_buffer_t),
+							fl->numa_node);
+      else
+	buffers = vm->os_physmem_alloc_aligned (&vm->physmem_main,
+						n_bytes,
+						sizeof (vlib_buffer_t));
       if (!buffers)
 	return n_alloc;
 
@@ -778,20 +863,201 @@ alloc_from_free_list (vlib_main_t * vm,
   return n_alloc_buffers;
 }
 
+/* Take up to n_buffers free buffers off a free list. Only the main
+   thread may allocate new buffer memory, workers get what their own
+   copy of the free list already holds. */
+static u32
+vlib_buffer_free_list_take (vlib_main_t * vm, vlib_buffer_free_list_t * fl,
+			    u32 * buffers, u32 n_buffers)
+{
+  u32 n;
+
+  if (os_get_cpu_number () == 0)
+    fill_free_list (vm, fl, n_buffers);
+  else
+    trim_aligned (fl);
+
+  n = clib_min (vec_len (fl->aligned_buffers), n_buffers);
+  if (n == 0)
+    return 0;
+
+  _vec_len (fl->aligned_buffers) -= n;
+  clib_memcpy (buffers, vec_end (fl->aligned_buffers), n * sizeof (u32));
+  return n;
+}
+
+always_inline vlib_buffer_cache_t *
+vlib_buffer_get_cache (vlib_buffer_main_t * bm, u32 free_list_index)
+{
+  if (free_list_index >= vec_len (bm->depot_by_free_list_index)
+      || !bm->depot_by_free_list_index[free_list_index])
+    return 0;
+
+  vec_validate_aligned (bm->caches, free_list_index, CLIB_CACHE_LINE_BYTES);
+  return vec_elt_at_index (bm->caches, free_list_index);
+}
+
+/* Refill an empty cache with a batch from the depot, or from the free
+   list if the depot has none. */
+static u32
+vlib_buffer_cache_refill (vlib_main_t * vm, vlib_buffer_cache_t * c,
+			  u32 free_list_index)
+{
+  vlib_buffer_main_t *bm = vm->buffer_main;
+  vlib_buffer_depot_t *d = bm->depot_by_free_list_index[free_list_index];
+  vlib_buffer_batch_t *b;
+  u32 batch_index, n;
+
+  ASSERT (vec_len (c->buffers) == 0);
+
+  batch_index = vlib_buffer_depot_pop (d, &d->full);
+  if (batch_index != VLIB_BUFFER_DEPOT_EMPTY)
+    {
+      __sync_fetch_and_sub (&d->n_full, 1);
+      b = vec_elt_at_index (d->batches, batch_index);
+      n = b->n_buffers;
+      vec_add (c->buffers, b->buffers, n);
+      vlib_buffer_depot_push (d, &d->empty, batch_index);
+      return n;
+    }
+
+  c->n_depot_empty++;
+  vec_validate (c->buffers, VLIB_BUFFER_CACHE_BATCH_SIZE - 1);
+  n = vlib_buffer_free_list_take
+    (vm, pool_elt_at_index (bm->buffer_free_list_pool, free_list_index),
+     c->buffers, VLIB_BUFFER_CACHE_BATCH_SIZE);
+  _vec_len (c->buffers) = n;
+  return n;
+}
+
+/* Move the oldest batch of an overflowing cache to the depot, or to
+   this thread's free list if the depot is full. */
+static void
+vlib_buffer_cache_flush (vlib_main_t * vm, vlib_buffer_cache_t * c,
+			 u32 free_list_index)
+{
+  vlib_buffer_main_t *bm = vm->buffer_main;
+  vlib_buffer_depot_t *d = bm->depot_by_free_list_index[free_list_index];
+  vlib_buffer_free_list_t *fl;
+  vlib_buffer_batch_t *b;
+  u32 batch_index;
+
+  c->n_flushes++;
+  batch_index = vlib_buffer_depot_pop (d, &d->empty);
+  if (batch_index != VLIB_BUFFER_DEPOT_EMPTY)
+    {
+      b = vec_elt_at_index (d->batches, batch_index);
+      b->n_buffers = VLIB_BUFFER_CACHE_BATCH_SIZE;
+      clib_memcpy (b->buffers, c->buffers, sizeof (b->buffers));
+      vlib_buffer_depot_push (d, &d->full, batch_index);
+      __sync_fetch_and_add (&d->n_full, 1);
+    }
+  else
+    {
+      c->n_depot_full++;
+      fl = pool_elt_at_index (bm->buffer_free_list_pool, free_list_index);
+      vec_add_aligned (fl->aligned_buffers, c->buffers,
+		       VLIB_BUFFER_CACHE_BATCH_SIZE,
+		       /* align */ sizeof (vlib_copy_unit_t));
+    }
+
+  vec_delete (c->buffers, VLIB_BUFFER_CACHE_BATCH_SIZE, 0);
+}
+
+static u32
+vlib_buffer_cache_alloc (vlib_main_t * vm, vlib_buffer_cache_t * c,
+			 u32 free_list_index, u32 * buffers, u32 n_buffers)
+{
+  u32 n_left = n_buffers, n_hit, n;
+
+  n_hit = clib_min (vec_len (c->buffers), n_buffers);
+  while (n_left > 0)
+    {
+      n = vec_len (c->buffers);
+      if (n == 0 && (n = vlib_buffer_cache_refill (vm, c,
+						   free_list_index)) == 0)
+	break;
+      n = clib_min (n, n_left);
+      _vec_len (c->buffers) -= n;
+      clib_memcpy (buffers + n_buffers - n_left, vec_end (c->buffers),
+		   n * sizeof (buffers[0]));
+      n_left -= n;
+    }
+
+  n = n_buffers - n_left;
+  c->n_allocs += n;
+  c->n_alloc_misses += n - n_hit;
+
+  vlib_buffer_validate_alloc_free (vm, buffers, n, VLIB_BUFFER_KNOWN_FREE);
+  return n;
+}
+
+always_inline u32
+vlib_buffer_alloc_from_index (vlib_main_t * vm, u32 * buffers,
+			      u32 n_buffers, u32 free_list_index)
+{
+  vlib_buffer_main_t *bm = vm->buffer_main;
+  vlib_buffer_cache_t *c = vlib_buffer_get_cache (bm, free_list_index);
+
+  if (PREDICT_TRUE (c != 0))
+    return vlib_buffer_cache_alloc (vm, c, free_list_index, buffers,
+				    n_buffers);
+
+  return alloc_from_free_list
+    (vm, pool_elt_at_index (bm->buffer_free_list_pool, free_list_index),
+     buffers, n_buffers);
+}
+
+/* Allocate from a NUMA node's default free list, then from the others
+   if the node ran out of memory. */
+u32
+vlib_buffer_alloc_on_numa_node (vlib_main_t * vm, u32 * buffers,
+				u32 n_buffers, u32 numa_node)
+{
+  vlib_buffer_main_t *bm = vm->buffer_main;
+  vlib_buffer_numa_stats_t *ns = &bm->numa_stats;
+  u32 *fi = bm->default_free_list_index_by_numa_node;
+  u32 n_alloc, i;
+
+  if (PREDICT_FALSE (vec_len (fi) == 0))
+    return alloc_from_free_list
+      (vm, pool_elt_at_index (bm->buffer_free_list_pool,
+			      VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX),
+       buffers, n_buffers);
+
+  if (numa_node >= vec_len (fi))
+    numa_node = 0;
+
+  n_alloc = vlib_buffer_alloc_from_index (vm, buffers, n_buffers,
+					  fi[numa_node]);
+  if (numa_node == vm->numa_node)
+    ns->n_local_allocs += n_alloc;
+  else
+    ns->n_remote_allocs += n_alloc;
+
+  for (i = 0; n_alloc < n_buffers && i < vec_len (fi); i++)
+    {
+      u32 n;
+
+      if (i == numa_node)
+	continue;
+      n = vlib_buffer_alloc_from_index (vm, buffers + n_alloc,
+					n_buffers - n_alloc, fi[i]);
+      n_alloc += n;
+      ns->n_remote_allocs += n;
+    }
+
+  return n_alloc;
+}
+
 /* Allocate a given number of buffers into given array.
    Returns number actually allocated which will be either zero or
    number requested. */
 u32
 vlib_buffer_alloc (vlib_main_t * vm, u32 * buffers, u32 n_buffers)
 {
-  vlib_buffer_main_t *bm = vm->buffer_main;
-  ASSERT (os_get_cpu_number () == 0);
-
-  return alloc_from_free_list
-    (vm,
-     pool_elt_at_index (bm->buffer_free_list_pool,
-			VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX),
-     buffers, n_buffers);
+  return vlib_buffer_alloc_on_numa_node (vm, buffers, n_buffers,
+					 vm->numa_node);
 }
 
 u32
@@ -799,10 +1065,12 @@ vlib_buffer_alloc_from_free_list (vlib_main_t * vm,
 				  u32 * buffers,
 				  u32 n_buffers, u32 free_list_index)
 {
-  vlib_buffer_main_t *bm = vm->buffer_main;
-  vlib_buffer_free_list_t *f;
-  f = pool_elt_at_index (bm->buffer_free_list_pool, free_list_index);
-  return alloc_from_free_list (vm, f, buffers, n_buffers);
+  if (free_list_index == VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX)
+    return vlib_buffer_alloc_on_numa_node (vm, buffers, n_buffers,
+					   vm->numa_node);
+
+  return vlib_buffer_alloc_from_index (vm, buffers, n_buffers,
+				       free_list_index);
 }
 
 always_inline void
@@ -850,18 +1118,19 @@ vlib_buffer_free_inline (vlib_main_t * vm,
 {
   vlib_buffer_main_t *bm = vm->buffer_main;
   vlib_buffer_free_list_t *fl;
-  static u32 *next_to_free[2];	/* smp bad */
+  /* per thread: workers free recycled buffers through here too */
+  static __thread u32 *next_to_free[2];
   u32 i_next_to_free, *b, *n, *f, fi;
   uword n_left;
   int i;
-  static vlib_buffer_free_list_t **announce_list;
+  static __thread vlib_buffer_free_list_t **announce_list;
   vlib_buffer_free_list_t *fl0 = 0, *fl1 = 0;
   u32 bi0 = (u32) ~ 0, bi1 = (u32) ~ 0, fi0, fi1 = (u32) ~ 0;
   u8 free0, free1 = 0, free_next0, free_next1;
   u32 (*cb) (vlib_main_t * vm, u32 * buffers, u32 n_buffers,
 	     u32 follow_buffer_next);
-
-  ASSERT (os_get_cpu_number () == 0);
+  u32 numa_node = vm->numa_node, remote;
+  uword n_freed = 0, n_remote = 0;
 
   cb = bm->buffer_free_callback;
 
@@ -880,6 +1149,7 @@ vlib_buffer_free_inline (vlib_main_t * vm,
     fl = buffer_get_free_list (vm, b0, &fi);
     if (fl->buffers_added_to_freelist_function)
       vec_add1 (announce_list, fl);
+    remote = fl->numa_node != numa_node;
   }
 
   vec_validate (next_to_free[0], n_buffers - 1);
@@ -894,6 +1164,8 @@ again:
   vlib_buffer_validate_alloc_free (vm, b,
 				   n_left, VLIB_BUFFER_KNOWN_ALLOCATED);
 
+  n_freed += n_left;
+
   vec_add2_aligned (fl->aligned_buffers, f, n_left,
 		    /* align */ sizeof (vlib_copy_unit_t));
 
@@ -946,6 +1218,7 @@ again:
       binit1 = free1 ? b1 : &dummy_buffers[1];
 
       vlib_buffer_init_two_for_free_list (binit0, binit1, fl);
+      n_remote += remote << 1;
       continue;
 
     slow_path_x2:
@@ -957,6 +1230,8 @@ again:
 
       fl0 = pool_elt_at_index (bm->buffer_free_list_pool, fi0);
       fl1 = pool_elt_at_index (bm->buffer_free_list_pool, fi1);
+      n_remote += (fl0->numa_node != numa_node)
+	+ (fl1->numa_node != numa_node);
 
       add_buffer_to_free_list (vm, fl0, bi0, free0);
       if (PREDICT_FALSE (fl0->buffers_added_to_freelist_function != 0))
@@ -985,6 +1260,7 @@ again:
 	{
 	  fi = fi1;
 	  fl = pool_elt_at_index (bm->buffer_free_list_pool, fi);
+	  remote = fl->numa_node != numa_node;
 	}
 
       vec_add2_aligned (fl->aligned_buffers, f, n_left,
@@ -1024,6 +1300,7 @@ again:
       binit0 = free0 ? b0 : &dummy_buffers[0];
 
       vlib_buffer_init_for_free_list (binit0, fl);
+      n_remote += remote;
       continue;
 
     slow_path_x1:
@@ -1034,6 +1311,7 @@ again:
       _vec_len (fl->aligned_buffers) = f - fl->aligned_buffers;
 
       fl0 = pool_elt_at_index (bm->buffer_free_list_pool, fi0);
+      n_remote += fl0->numa_node != numa_node;
 
       add_buffer_to_free_list (vm, fl0, bi0, free0);
       if (PREDICT_FALSE (fl0->buffers_added_to_freelist_function != 0))
@@ -1048,6 +1326,7 @@ again:
     no_fl00:
       fi = fi0;
       fl = pool_elt_at_index (bm->buffer_free_list_pool, fi);
+      remote = fl->numa_node != numa_node;
 
       vec_add2_aligned (fl->aligned_buffers, f, n_left,
 			/* align */ sizeof (vlib_copy_unit_t));
@@ -1062,6 +1341,9 @@ again:
 
   _vec_len (fl->aligned_buffers) = f - fl->aligned_buffers;
 
+  bm->numa_stats.n_local_frees += n_freed - n_remote;
+  bm->numa_stats.n_remote_frees += n_remote;
+
   if (vec_len (announce_list))
     {
       vlib_buffer_free_list_t *fl;
@@ -1074,18 +1356,95 @@ again:
     }
 }
 
+/* Free buffers into this thread's caches. Buffers of free lists
+   without a depot, and buffers to be recycled, take the free list
+   path instead. */
+static_always_inline void
+vlib_buffer_free_cached (vlib_main_t * vm,
+			 u32 * buffers, u32 n_buffers, u32 follow_buffer_next)
+{
+  vlib_buffer_main_t *bm = vm->buffer_main;
+  vlib_buffer_free_list_t *fl = 0;
+  vlib_buffer_cache_t *c = 0;
+  vlib_buffer_t *b;
+  u32 fi = ~0, bi, next, i;
+  uword n_freed = 0, n_remote = 0;
+  u8 free_next;
+
+  /* Whole vectors of buffers from other free lists, e.g. pg streams */
+  b = vlib_get_buffer (vm, buffers[0]);
+  if (PREDICT_FALSE (bm->buffer_free_callback != 0
+		     || !vlib_buffer_get_cache (bm, b->free_list_index)))
+    {
+      vlib_buffer_free_inline (vm, buffers, n_buffers, follow_buffer_next);
+      return;
+    }
+
+  for (i = 0; i < n_buffers; i++)
+    {
+      if (i + 2 < n_buffers)
+	vlib_prefetch_buffer_with_index (vm, buffers[i + 2], WRITE);
+
+      bi = buffers[i];
+      while (1)
+	{
+	  b = vlib_get_buffer (vm, bi);
+	  if (PREDICT_FALSE (b->free_list_index != fi))
+	    {
+	      /* Cache pointers stay valid: nothing below adds caches */
+	      fi = b->free_list_index;
+	      c = vlib_buffer_get_cache (bm, fi);
+	      fl = pool_elt_at_index (bm->buffer_free_list_pool, fi);
+	    }
+
+	  if (PREDICT_FALSE (!c || (b->flags & VLIB_BUFFER_RECYCLE)))
+	    {
+	      vlib_buffer_free_inline (vm, &bi, 1, follow_buffer_next);
+	      break;
+	    }
+
+	  if (CLIB_DEBUG > 0)
+	    vlib_buffer_validate_alloc_free (vm, &bi, 1,
+					     VLIB_BUFFER_KNOWN_ALLOCATED);
+
+	  /* Must be before init which will over-write buffer flags. */
+	  next = b->next_buffer;
+	  free_next = follow_buffer_next
+	    && (b->flags & VLIB_BUFFER_NEXT_PRESENT) != 0;
+
+	  vlib_buffer_init_for_free_list (b, fl);
+	  vec_add1 (c->buffers, bi);
+	  c->n_frees++;
+	  n_freed++;
+	  n_remote += fl->numa_node != vm->numa_node;
+
+	  if (PREDICT_FALSE (vec_len (c->buffers) >= VLIB_BUFFER_CACHE_SIZE))
+	    vlib_buffer_cache_flush (vm, c, fi);
+
+	  if (!free_next)
+	    break;
+	  bi = next;
+	}
+    }
+
+  bm->numa_stats.n_local_frees += n_freed - n_remote;
+  bm->numa_stats.n_remote_frees += n_remote;
+}
+
 void
 vlib_buffer_free (vlib_main_t * vm, u32 * buffers, u32 n_buffers)
 {
-  vlib_buffer_free_inline (vm, buffers, n_buffers,	/* follow_buffer_next */
-			   1);
+  if (n_buffers)
+    vlib_buffer_free_cached (vm, buffers, n_buffers,	/* follow_buffer_next */
+			     1);
 }
 
 void
 vlib_buffer_free_no_next (vlib_main_t * vm, u32 * buffers, u32 n_buffers)
 {
-  vlib_buffer_free_inline (vm, buffers, n_buffers,	/* follow_buffer_next */
-			   0);
+  if (n_buffers)
+    vlib_buffer_free_cached (vm, buffers, n_buffers,	/* follow_buffer_next */
+			     0);
 }
 
 /* Copy template packet data into buffers as they are allocated. */
@@ -1133,7 +1492,7 @@ vlib_packet_template_init (vlib_main_t * vm,
     (vm, n_packet_data_bytes,
      /* is_public */ 1,
      /* is_default */ 0,
-     name);
+     name, vm->numa_node);
 
   ASSERT (t->free_list_index != 0);
   fl = vlib_buffer_get_free_list (vm, t->free_list_index);
@@ -1492,23 +1851,114 @@ format_vlib_buffer_free_list (u8 * s, va_list * va)
   uword bytes_alloc, bytes_free, n_free, size;
 
   if (!f)
-    return format (s, "%=30s%=12s%=12s%=12s%=12s%=12s%=12s",
+    return format (s, "%=30s%=12s%=12s%=12s%=12s%=12s%=12s%=6s",
 		   "Name", "Index", "Size", "Alloc", "Free", "#Alloc",
-		   "#Free");
+		   "#Free", "Numa");
 
   size = sizeof (vlib_buffer_t) + f->n_data_bytes;
   n_free = vec_len (f->aligned_buffers) + vec_len (f->unaligned_buffers);
   bytes_alloc = size * f->n_alloc;
   bytes_free = size * n_free;
 
-  s = format (s, "%30s%12d%12d%=12U%=12U%=12d%=12d",
+  s = format (s, "%30s%12d%12d%=12U%=12U%=12d%=12d%=6d",
 	      f->name, f->index, f->n_data_bytes,
 	      format_memory_size, bytes_alloc,
-	      format_memory_size, bytes_free, f->n_alloc, n_free);
+	      format_memory_size, bytes_free, f->n_alloc, n_free,
+	      f->numa_node);
 
   return s;
 }
 
+/* Top up a depot from the main thread's free list. */
+static void
+vlib_buffer_depot_fill (vlib_main_t * vm, vlib_buffer_depot_t * d,
+			u32 n_batches)
+{
+  vlib_buffer_main_t *bm = vm->buffer_main;
+  vlib_buffer_free_list_t *fl;
+  vlib_buffer_batch_t *b;
+  u32 batch_index;
+
+  fl = pool_elt_at_index (bm->buffer_free_list_pool, d->free_list_index);
+  while (d->n_full < n_batches)
+    {
+      batch_index = vlib_buffer_depot_pop (d, &d->empty);
+      if (batch_index == VLIB_BUFFER_DEPOT_EMPTY)
+	return;
+
+      b = vec_elt_at_index (d->batches, batch_index);
+      b->n_buffers = vlib_buffer_free_list_take (vm, fl, b->buffers,
+						 VLIB_BUFFER_CACHE_BATCH_SIZE);
+      if (b->n_buffers == 0)
+	{
+	  vlib_buffer_depot_push (d, &d->empty, batch_index);
+	  return;
+	}
+
+      vlib_buffer_depot_push (d, &d->full, batch_index);
+      __sync_fetch_and_add (&d->n_full, 1);
+    }
+}
+
+/*
+ * Workers cannot allocate buffer memory, so keep a quarter of each
+ * depot stocked for them. Without workers the main thread refills its
+ * caches from the free lists directly.
+ */
+static uword
+vlib_buffer_depot_process (vlib_main_t * vm,
+			   vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  vlib_buffer_main_t *bm = vm->buffer_main;
+  vlib_buffer_depot_t *d;
+  u32 i;
+
+  while (1)
+    {
+      vlib_process_suspend (vm, vec_len (vlib_mains) > 1 ? 1e-3 : 1.0);
+
+      if (vec_len (vlib_mains) <= 1)
+	continue;
+
+      for (i = 0; i < vec_len (bm->depot_by_free_list_index); i++)
+	if ((d = bm->depot_by_free_list_index[i]))
+	  vlib_buffer_depot_fill (vm, d, VLIB_BUFFER_DEPOT_N_BATCHES / 4);
+    }
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (vlib_buffer_depot_process_node, static) = {
+  .function = vlib_buffer_depot_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "buffer-depot-process",
+};
+/* *INDENT-ON* */
+
+static u8 *
+format_vlib_buffer_cache (u8 * s, va_list * va)
+{
+  vlib_buffer_cache_t *c = va_arg (*va, vlib_buffer_cache_t *);
+  f64 alloc_hit, free_hit;
+
+  if (!c)
+    return format (s, "%=8s%=8s%=8s%=14s%=8s%=14s%=8s%=8s%=8s",
+		   "Thread", "List", "Cached", "Allocs", "Hit %", "Frees",
+		   "Hit %", "Empty", "Full");
+
+  alloc_hit = c->n_allocs ?
+    100.0 * (c->n_allocs - c->n_alloc_misses) / c->n_allocs : 0;
+  free_hit = c->n_frees ? 100.0 * (1.0 - (f64) c->n_flushes *
+				  VLIB_BUFFER_CACHE_BATCH_SIZE /
+				  c->n_frees) : 0;
+
+  return format (s, "%=8d%=14lld%=8.1f%=14lld%=8.1f%=8lld%=8lld",
+		 vec_len (c->buffers), c->n_allocs, alloc_hit, c->n_frees,
+		 clib_max (free_hit, 0.0), c->n_depot_empty,
+		 c->n_depot_full);
+}
+
 static clib_error_t *
 show_buffers (vlib_main_t * vm,
 	      unformat_input_t * input, vlib_cli_command_t * cmd)
@@ -1516,6 +1966,11 @@ show_buffers (vlib_main_t * vm,
   vlib_buffer_main_t *bm = vm->buffer_main;
   vlib_buffer_free_list_t *f;
 
+  vlib_main_t *this_vm;
+  vlib_buffer_numa_stats_t *ns;
+  vlib_buffer_depot_t *d;
+  u32 i, fi, n_threads;
+
   vlib_cli_output (vm, "%U", format_vlib_buffer_free_list, 0);
   /* *INDENT-OFF* */
   pool_foreach (f, bm->buffer_free_list_pool, ({
@@ -1523,6 +1978,44 @@ show_buffers (vlib_main_t * vm,
   }));
 /* *INDENT-ON* */
 
+  n_threads = vec_len (vlib_mains) ? vec_len (vlib_mains) : 1;
+
+  vlib_cli_output (vm, "\n%U", format_vlib_buffer_cache, 0);
+  for (i = 0; i < n_threads; i++)
+    {
+      this_vm = vec_len (vlib_mains) ? vlib_mains[i] : vm;
+      if (!this_vm)
+	continue;
+      for (fi = 0; fi < vec_len (this_vm->buffer_main->caches); fi++)
+	if (bm->depot_by_free_list_index[fi])
+	  vlib_cli_output (vm, "%=8d%=8d%U", i, fi, format_vlib_buffer_cache,
+			   vec_elt_at_index (this_vm->buffer_main->caches,
+					     fi));
+    }
+
+  for (fi = 0; fi < vec_len (bm->depot_by_free_list_index); fi++)
+    if ((d = bm->depot_by_free_list_index[fi]))
+      vlib_cli_output (vm, "depot of list %d: %d of %d batches full", fi,
+		       d->n_full, VLIB_BUFFER_DEPOT_N_BATCHES);
+
+  if (vm->physmem_main.n_numa_nodes <= 1)
+    return 0;
+
+  vlib_cli_output (vm, "\n%=12s%=6s%=16s%=16s%=16s%=16s", "Thread", "Numa",
+		   "Local alloc", "Remote alloc", "Local free",
+		   "Remote free");
+  for (i = 0; i < n_threads; i++)
+    {
+      this_vm = vec_len (vlib_mains) ? vlib_mains[i] : vm;
+      if (!this_vm)
+	continue;
+      ns = &this_vm->buffer_main->numa_stats;
+      vlib_cli_output (vm, "%=12d%=6d%=16lld%=16lld%=16lld%=16lld", i,
+		       this_vm->numa_node, ns->n_local_allocs,
+		       ns->n_remote_allocs, ns->n_local_frees,
+		       ns->n_remote_frees);
+    }
+
   return 0;
 }
 
@@ -1534,6 +2027,239 @@ VLIB_CLI_COMMAND (show_buffers_command, static) = {
 };
 /* *INDENT-ON* */
 
+/*
+ * Allocate buffers on every NUMA node from this thread, check that
+ * they come from the node's memory and free them again. With
+ * "physmem { fake-numa-nodes <n> }" this exercises the NUMA paths on
+ * a single socket machine.
+ */
+static clib_error_t *
+test_buffer_numa (vlib_main_t * vm,
+		  unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_physmem_main_t *pm = &vm->physmem_main;
+  vlib_buffer_numa_stats_t before, *ns = &vm->buffer_main->numa_stats;
+  u32 *buffers = 0, n_buffers = 1024, n_alloc, n_wrong, node, i;
+  uword o;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "buffers %u", &n_buffers))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  vec_validate (buffers, n_buffers - 1);
+
+  for (node = 0; node < clib_max (pm->n_numa_nodes, 1); node++)
+    {
+      before = *ns;
+      n_alloc = vlib_buffer_alloc_on_numa_node (vm, buffers, n_buffers,
+						node);
+      n_wrong = 0;
+      for (i = 0; i < n_alloc; i++)
+	{
+	  o = vlib_physmem_offset_of (pm, vlib_get_buffer (vm, buffers[i]));
+	  n_wrong += vlib_physmem_numa_node_of_offset (pm, o) != node;
+	}
+      vlib_buffer_free (vm, buffers, n_alloc);
+
+      vlib_cli_output (vm, "numa node %d: %d buffers, %d from another node, "
+		       "%lld remote allocs, %lld remote frees", node,
+		       n_alloc, n_wrong,
+		       ns->n_remote_allocs - before.n_remote_allocs,
+		       ns->n_remote_frees - before.n_remote_frees);
+    }
+
+  vec_free (buffers);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_buffer_numa_command, static) = {
+  .path = "test buffer numa",
+  .short_help = "test buffer numa [buffers <n>]",
+  .function = test_buffer_numa,
+};
+/* *INDENT-ON* */
+
+/*
+ * Buffer allocator benchmark. Every thread runs an input node which
+ * allocates a frame worth of buffers and frees it again, either
+ * itself or, with "cross-thread", by handing the buffers to the next
+ * thread over a single producer, single consumer ring.
+ */
+#define BUFFER_BENCH_RING_SIZE 4096
+
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  /* Buffers handed over by the previous thread, for us to free */
+  u32 *ring;
+  volatile u32 head;
+  volatile u32 tail;
+
+  u64 n_allocs;
+  u64 n_frees;
+  u64 n_remote_frees;
+  u64 clocks;
+} buffer_bench_thread_t;
+
+typedef struct
+{
+  buffer_bench_thread_t *threads;
+  u32 cross_thread;
+} buffer_bench_main_t;
+
+static buffer_bench_main_t buffer_bench_main;
+
+static uword
+buffer_bench_input (vlib_main_t * vm,
+		    vlib_node_runtime_t * node, vlib_frame_t * frame)
+{
+  buffer_bench_main_t *bbm = &buffer_bench_main;
+  u32 cpu_index = os_get_cpu_number ();
+  u32 n_threads = vec_len (bbm->threads);
+  buffer_bench_thread_t *t, *peer;
+  u32 buffers[VLIB_FRAME_SIZE], n, n_handoff, i;
+  u64 start = clib_cpu_time_now ();
+
+  if (cpu_index >= n_threads)
+    return 0;
+  t = vec_elt_at_index (bbm->threads, cpu_index);
+  peer = vec_elt_at_index (bbm->threads, (cpu_index + 1) % n_threads);
+
+  /* Free what the previous thread handed over */
+  while (t->tail != t->head)
+    {
+      i = t->tail & (BUFFER_BENCH_RING_SIZE - 1);
+      n = clib_min (t->head - t->tail, BUFFER_BENCH_RING_SIZE - i);
+      vlib_buffer_free_no_next (vm, t->ring + i, n);
+      CLIB_MEMORY_BARRIER ();
+      t->tail += n;
+      t->n_remote_frees += n;
+    }
+
+  n = vlib_buffer_alloc (vm, buffers, VLIB_FRAME_SIZE);
+  t->n_allocs += n;
+
+  n_handoff = 0;
+  if (bbm->cross_thread && peer != t)
+    {
+      n_handoff = clib_min (n, BUFFER_BENCH_RING_SIZE -
+			    (peer->head - peer->tail));
+      for (i = 0; i < n_handoff; i++)
+	peer->ring[(peer->head + i) & (BUFFER_BENCH_RING_SIZE - 1)] =
+	  buffers[i];
+      CLIB_MEMORY_BARRIER ();
+      peer->head += n_handoff;
+    }
+
+  vlib_buffer_free_no_next (vm, buffers + n_handoff, n - n_handoff);
+  t->n_frees += n - n_handoff;
+
+  t->clocks += clib_cpu_time_now () - start;
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (buffer_bench_input_node, static) = {
+  .function = buffer_bench_input,
+  .type = VLIB_NODE_TYPE_INPUT,
+  .name = "buffer-bench-input",
+  .state = VLIB_NODE_STATE_DISABLED,
+};
+/* *INDENT-ON* */
+
+static void
+buffer_bench_set_state (vlib_main_t * vm, vlib_node_state_t state)
+{
+  u32 i;
+
+  vlib_worker_thread_barrier_sync (vm);
+  if (vec_len (vlib_mains) == 0)
+    vlib_node_set_state (vm, buffer_bench_input_node.index, state);
+  for (i = 0; i < vec_len (vlib_mains); i++)
+    if (vlib_mains[i])
+      vlib_node_set_state (vlib_mains[i], buffer_bench_input_node.index,
+			   state);
+  vlib_worker_thread_barrier_release (vm);
+}
+
+static clib_error_t *
+test_buffer_cache (vlib_main_t * vm,
+		   unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  buffer_bench_main_t *bbm = &buffer_bench_main;
+  buffer_bench_thread_t *t;
+  f64 seconds = 1.0, ns_per_clock = vm->clib_time.seconds_per_clock * 1e9;
+  u64 n_allocs = 0, clocks = 0;
+  u32 n_threads, i;
+
+  bbm->cross_thread = 0;
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "seconds %f", &seconds))
+	;
+      else if (unformat (input, "cross-thread"))
+	bbm->cross_thread = 1;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  n_threads = vec_len (vlib_mains) ? vec_len (vlib_mains) : 1;
+  if (bbm->cross_thread && n_threads < 2)
+    return clib_error_return (0, "cross-thread needs worker threads");
+
+  vec_validate_aligned (bbm->threads, n_threads - 1, CLIB_CACHE_LINE_BYTES);
+  for (i = 0; i < n_threads; i++)
+    {
+      t = vec_elt_at_index (bbm->threads, i);
+      vec_validate (t->ring, BUFFER_BENCH_RING_SIZE - 1);
+      t->head = t->tail = 0;
+      t->n_allocs = t->n_frees = t->n_remote_frees = t->clocks = 0;
+    }
+
+  buffer_bench_set_state (vm, VLIB_NODE_STATE_POLLING);
+  vlib_process_suspend (vm, seconds);
+  buffer_bench_set_state (vm, VLIB_NODE_STATE_DISABLED);
+
+  vlib_cli_output (vm, "%=8s%=16s%=16s%=16s%=12s", "Thread", "Allocs",
+		   "Local frees", "Remote frees", "ns/buffer");
+  for (i = 0; i < n_threads; i++)
+    {
+      t = vec_elt_at_index (bbm->threads, i);
+
+      /* Buffers still in flight */
+      while (t->tail != t->head)
+	vlib_buffer_free_no_next
+	  (vm, t->ring + (t->tail++ & (BUFFER_BENCH_RING_SIZE - 1)), 1);
+
+      vlib_cli_output (vm, "%=8d%=16lld%=16lld%=16lld%=12.2f", i,
+		       t->n_allocs, t->n_frees, t->n_remote_frees,
+		       t->n_allocs ? t->clocks * ns_per_clock / t->n_allocs :
+		       0);
+      n_allocs += t->n_allocs;
+      clocks += t->clocks;
+    }
+
+  vlib_cli_output (vm, "%=8s%=16lld%=16s%=16s%=12.2f", "total", n_allocs,
+		   "", "", n_allocs ? clocks * ns_per_clock / n_allocs : 0);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_buffer_cache_command, static) = {
+  .path = "test buffer cache",
+  .short_help = "test buffer cache [seconds <n>] [cross-thread]",
+  .function = test_buffer_cache,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
 /** @endcond */
 /*
  * fd.io coding-style-patch-verification: ON
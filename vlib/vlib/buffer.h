@@ -264,6 +264,9 @@ typedef struct vlib_buffer_free_list_t
   /* Total number of buffers allocated from this free list. */
   u32 n_alloc;
 
+  /* NUMA node whose physmem the buffers come from */
+  u32 numa_node;
+
   /* Vector of free buffers.  Each element is a byte offset into I/O heap.
      Aligned vectors always has naturally aligned vlib_copy_unit_t sized chunks
      of buffer indices.  Unaligned vector has any left over.  This is meant to
@@ -292,6 +295,66 @@ typedef struct vlib_buffer_free_list_t
   uword buffer_init_function_opaque;
 } __attribute__ ((aligned (16))) vlib_buffer_free_list_t;
 
+typedef struct
+{
+  u64 n_local_allocs;
+  /* Allocated from another node because the local one ran out */
+  u64 n_remote_allocs;
+  u64 n_local_frees;
+  /* Freed buffers which came from another node */
+  u64 n_remote_frees;
+} vlib_buffer_numa_stats_t;
+
+/* Buffers move between thread caches and the depot in batches. A
+   cache holds up to a few frames worth of buffers. */
+#define VLIB_BUFFER_CACHE_BATCH_SIZE 64
+#define VLIB_BUFFER_CACHE_SIZE (8 * VLIB_BUFFER_CACHE_BATCH_SIZE)
+#define VLIB_BUFFER_DEPOT_N_BATCHES 128
+#define VLIB_BUFFER_DEPOT_EMPTY ((u32) ~0)
+
+typedef struct
+{
+  /* Next batch on the same depot stack */
+  volatile u32 next;
+  u32 n_buffers;
+  u32 buffers[VLIB_BUFFER_CACHE_BATCH_SIZE];
+} vlib_buffer_batch_t;
+
+/*
+ * Depot shared by all threads for one default free list. Full and
+ * empty batches sit on two lock-free stacks whose heads hold the top
+ * batch index in the low 32 bits and a change count in the high 32
+ * bits, so that a stale compare-and-swap cannot succeed.
+ */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  volatile u64 full;
+  volatile u32 n_full;
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  volatile u64 empty;
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline2);
+  vlib_buffer_batch_t *batches;
+  u32 free_list_index;
+} vlib_buffer_depot_t;
+
+/* Per-thread cache in front of a depot */
+typedef struct
+{
+  /* Up to VLIB_BUFFER_CACHE_SIZE free buffers */
+  u32 *buffers;
+
+  /* Buffers allocated, and how many needed a refill first */
+  u64 n_allocs;
+  u64 n_alloc_misses;
+  /* Buffers freed, and batches which did not fit in the cache */
+  u64 n_frees;
+  u64 n_flushes;
+  /* Refills which found the depot empty, flushes which found it full */
+  u64 n_depot_empty;
+  u64 n_depot_full;
+} vlib_buffer_cache_t;
+
 typedef struct
 {
   /* Buffer free callback, for subversive activities */
@@ -319,6 +382,21 @@ typedef struct
   /* List of free-lists needing Blue Light Special announcements */
   vlib_buffer_free_list_t **announce_list;
 
+  /* Default free list of each NUMA node. Node 0's is
+     VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX, which also stands for "the
+     default free list of the calling thread's node" when allocating. */
+  u32 *default_free_list_index_by_numa_node;
+
+  /* Buffer traffic of this thread, local or remote to vm->numa_node */
+  vlib_buffer_numa_stats_t numa_stats;
+
+  /* Depot of each default free list, shared by all threads. Indexed
+     by free list index, zero for lists without a depot. */
+  vlib_buffer_depot_t **depot_by_free_list_index;
+
+  /* This thread's caches, indexed by free list index */
+  vlib_buffer_cache_t *caches;
+
   /*  Vector of rte_mempools per socket */
 #if DPDK == 1
   struct rte_mempool **pktmbuf_pools;
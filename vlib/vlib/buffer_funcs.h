@@ -285,6 +285,22 @@ u32 vlib_buffer_alloc_from_free_list (vlib_main_t * vm,
 				      u32 * buffers,
 				      u32 n_buffers, u32 free_list_index);
 
+#if DPDK == 0
+/** \brief Allocate buffers from a NUMA node's default freelist
+    Falls back to other nodes when the node is out of physmem.
+    vlib_buffer_alloc allocates on the calling thread's node.
+
+    @param vm - (vlib_main_t *) vlib main data structure pointer
+    @param buffers - (u32 * ) buffer index array
+    @param n_buffers - (u32) number of buffers requested
+    @param numa_node - (u32) NUMA node to allocate on
+    @return - (u32) number of buffers actually allocated, may be
+    less than the number requested or zero
+*/
+u32 vlib_buffer_alloc_on_numa_node (vlib_main_t * vm, u32 * buffers,
+				    u32 n_buffers, u32 numa_node);
+#endif /* DPDK == 0 */
+
 /** \brief Free buffers
     Frees the entire buffer chain for each buffer
 
@@ -522,6 +538,293 @@ vlib_buffer_chain_append_data_with_alloc (vlib_main_t * vm,
 					  void *data, u16 data_len);
 void vlib_buffer_chain_validate (vlib_main_t * vm, vlib_buffer_t * first);
 
+/*
+ * Buffer chain iterator and zero-copy chain manipulation.
+ *
+ * These move whole segments between chains rather than copying packet
+ * data. The only copies made are of headers being prepended, and of
+ * the smaller side of a segment which a split has to cut in two.
+ */
+
+/** \brief Iterator over the segments of a buffer chain */
+typedef struct
+{
+  /* Current segment, 0 past the end of the chain */
+  vlib_buffer_t *b;
+  u32 bi;
+
+  /* Chain bytes before the current segment */
+  u32 offset;
+} vlib_buffer_chain_iterator_t;
+
+always_inline vlib_buffer_t *
+vlib_buffer_chain_iterator_init (vlib_main_t * vm,
+				 vlib_buffer_chain_iterator_t * it, u32 bi)
+{
+  it->bi = bi;
+  it->b = vlib_get_buffer (vm, bi);
+  it->offset = 0;
+  return it->b;
+}
+
+always_inline vlib_buffer_t *
+vlib_buffer_chain_iterator_next (vlib_main_t * vm,
+				 vlib_buffer_chain_iterator_t * it)
+{
+  it->offset += it->b->current_length;
+  if (!(it->b->flags & VLIB_BUFFER_NEXT_PRESENT))
+    return it->b = 0;
+  it->bi = it->b->next_buffer;
+  return it->b = vlib_get_buffer (vm, it->bi);
+}
+
+/** \brief Move to the segment holding a given chain byte
+
+    @param offset - (u32) byte offset from the start of the chain
+    @return - (vlib_buffer_t *) segment holding that byte, or 0 if the
+    chain is shorter
+*/
+always_inline vlib_buffer_t *
+vlib_buffer_chain_iterator_seek (vlib_main_t * vm,
+				 vlib_buffer_chain_iterator_t * it,
+				 u32 offset)
+{
+  while (it->b && offset >= it->offset + it->b->current_length)
+    vlib_buffer_chain_iterator_next (vm, it);
+  return it->b;
+}
+
+/* Set the chain length in the first buffer after segments changed. */
+always_inline void
+vlib_buffer_chain_update_length (vlib_main_t * vm, vlib_buffer_t * first)
+{
+  vlib_buffer_length_in_chain_slow_path (vm, first);
+  vlib_buffer_chain_validate (vm, first);
+}
+
+/** \brief Prepend headers to a buffer chain
+
+    The headers go into the pre_data area of the first buffer if they
+    fit there. Otherwise they go into a new buffer from the first
+    buffer's free list, linked ahead of the chain, which takes over the
+    packet metadata.
+
+    @param bi - (u32) first buffer of the chain
+    @param data - (void *) headers to prepend
+    @param n_bytes - (u16) header bytes
+    @return - (u32) new first buffer of the chain, or ~0 if no buffer
+    could be allocated
+*/
+always_inline u32
+vlib_buffer_chain_prepend (vlib_main_t * vm, u32 bi, void *data,
+			   u16 n_bytes)
+{
+  vlib_buffer_t *b = vlib_get_buffer (vm, bi), *h;
+  u32 hi;
+
+  if (b->current_data - (word) n_bytes >=
+      -(word) VLIB_BUFFER_PRE_DATA_SIZE)
+    {
+      b->current_data -= n_bytes;
+      b->current_length += n_bytes;
+      clib_memcpy (vlib_buffer_get_current (b), data, n_bytes);
+      vlib_buffer_chain_validate (vm, b);
+      return bi;
+    }
+
+  if (vlib_buffer_alloc_from_free_list (vm, &hi, 1, b->free_list_index) != 1)
+    return ~0;
+
+  h = vlib_get_buffer (vm, hi);
+  h->current_data = 0;
+  h->current_length = n_bytes;
+  clib_memcpy (h->data, data, n_bytes);
+
+  h->error = b->error;
+  h->current_config_index = b->current_config_index;
+  h->trace_index = b->trace_index;
+  clib_memcpy (h->opaque, b->opaque, sizeof (h->opaque));
+  h->flags = (b->flags & VLIB_BUFFER_IS_TRACED) | VLIB_BUFFER_NEXT_PRESENT;
+  h->next_buffer = bi;
+
+  vlib_buffer_chain_update_length (vm, h);
+  return hi;
+}
+
+/** \brief Remove bytes from the end of a buffer chain
+
+    Segments left empty are freed.
+
+    @param first - (vlib_buffer_t *) first buffer of the chain
+    @param n_bytes - (u32) bytes to remove, at most the chain length
+*/
+always_inline void
+vlib_buffer_chain_trim (vlib_main_t * vm, vlib_buffer_t * first,
+			u32 n_bytes)
+{
+  u32 n_keep = vlib_buffer_length_in_chain (vm, first) - n_bytes;
+  vlib_buffer_t *b = first;
+  u32 offset = 0;
+
+  ASSERT (n_bytes <= vlib_buffer_length_in_chain (vm, first));
+
+  while (n_keep > offset + b->current_length
+	 && (b->flags & VLIB_BUFFER_NEXT_PRESENT))
+    {
+      offset += b->current_length;
+      b = vlib_get_buffer (vm, b->next_buffer);
+    }
+
+  b->current_length = n_keep - offset;
+  if (b->flags & VLIB_BUFFER_NEXT_PRESENT)
+    {
+      vlib_buffer_free (vm, &b->next_buffer, 1);
+      b->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+    }
+
+  vlib_buffer_chain_update_length (vm, first);
+}
+
+/** \brief Split a buffer chain in two
+
+    The first chain keeps the bytes before offset, a new chain gets the
+    rest. Whole segments move to the new chain as they are. A segment
+    holding bytes of both is cut by copying the smaller side into a new
+    buffer from the segment's free list. When that is the head of the
+    first segment, the new buffer starts the first chain and takes over
+    the packet metadata, as in vlib_buffer_chain_prepend. The new chain
+    carries no packet metadata.
+
+    @param bi - (u32 *) first buffer of the chain, updated if it moves
+    @param offset - (u32) bytes to keep, more than 0 and less than the
+    chain length
+    @return - (u32) first buffer of the new chain, or ~0 if no buffer
+    could be allocated, in which case the chain is left as it was
+*/
+always_inline u32
+vlib_buffer_chain_split (vlib_main_t * vm, u32 * bi, u32 offset)
+{
+  vlib_buffer_t *first = vlib_get_buffer (vm, bi[0]), *b = first, *prev = 0;
+  vlib_buffer_t *n;
+  u32 n_head, n_tail, ni, segment_offset = 0;
+
+  ASSERT (offset > 0 && offset < vlib_buffer_length_in_chain (vm, first));
+
+  /* Find the segment holding the last byte kept */
+  while (offset > segment_offset + b->current_length)
+    {
+      segment_offset += b->current_length;
+      prev = b;
+      b = vlib_get_buffer (vm, b->next_buffer);
+    }
+
+  n_head = offset - segment_offset;
+  n_tail = b->current_length - n_head;
+
+  if (n_tail == 0)
+    {
+      /* Clean cut between two segments */
+      ni = b->next_buffer;
+      b->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+    }
+  else if (n_tail <= n_head)
+    {
+      /* Copy the tail of the segment ahead of the next chain */
+      if (vlib_buffer_alloc_from_free_list (vm, &ni, 1,
+					    b->free_list_index) != 1)
+	return ~0;
+      n = vlib_get_buffer (vm, ni);
+      n->current_data = 0;
+      n->current_length = n_tail;
+      clib_memcpy (n->data, vlib_buffer_get_current (b) + n_head, n_tail);
+      n->flags = b->flags & VLIB_BUFFER_NEXT_PRESENT;
+      n->next_buffer = b->next_buffer;
+      b->current_length = n_head;
+      b->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+    }
+  else
+    {
+      /* Copy the head of the segment, which then starts the new chain */
+      u32 hi;
+
+      if (vlib_buffer_alloc_from_free_list (vm, &hi, 1,
+					    b->free_list_index) != 1)
+	return ~0;
+      n = vlib_get_buffer (vm, hi);
+      n->current_data = 0;
+      n->current_length = n_head;
+      clib_memcpy (n->data, vlib_buffer_get_current (b), n_head);
+      if (prev)
+	{
+	  n->flags = 0;
+	  ni = prev->next_buffer;
+	  prev->next_buffer = hi;
+	}
+      else
+	{
+	  n->error = b->error;
+	  n->current_config_index = b->current_config_index;
+	  n->trace_index = b->trace_index;
+	  clib_memcpy (n->opaque, b->opaque, sizeof (n->opaque));
+	  n->flags = b->flags & VLIB_BUFFER_IS_TRACED;
+	  b->flags &= ~VLIB_BUFFER_IS_TRACED;
+	  ni = bi[0];
+	  bi[0] = hi;
+	  first = n;
+	}
+      vlib_buffer_advance (b, n_head);
+    }
+
+  vlib_buffer_chain_update_length (vm, first);
+  vlib_buffer_chain_update_length (vm, vlib_get_buffer (vm, ni));
+  return ni;
+}
+
+/** \brief Pull a buffer chain into its first buffer
+
+    For code which can only handle contiguous packets. The other
+    segments are freed.
+
+    @param first - (vlib_buffer_t *) first buffer of the chain
+    @return - (int) 0 on success, -1 if the chain does not fit in one
+    buffer
+*/
+always_inline int
+vlib_buffer_chain_linearize (vlib_main_t * vm, vlib_buffer_t * first)
+{
+  u32 n_buffer_bytes, n_bytes;
+  vlib_buffer_t *b = first;
+
+  if (!(first->flags & VLIB_BUFFER_NEXT_PRESENT))
+    return 0;
+
+  n_buffer_bytes =
+    vlib_buffer_free_list_buffer_size (vm, first->free_list_index);
+  n_bytes = vlib_buffer_length_in_chain (vm, first);
+  if (n_bytes > n_buffer_bytes)
+    return -1;
+
+  if (first->current_data + n_bytes > n_buffer_bytes)
+    {
+      memmove (first->data, vlib_buffer_get_current (first),
+	       first->current_length);
+      first->current_data = 0;
+    }
+
+  while (b->flags & VLIB_BUFFER_NEXT_PRESENT)
+    {
+      b = vlib_get_buffer (vm, b->next_buffer);
+      clib_memcpy (vlib_buffer_get_current (first) + first->current_length,
+		   vlib_buffer_get_current (b), b->current_length);
+      first->current_length += b->current_length;
+    }
+
+  vlib_buffer_free (vm, &first->next_buffer, 1);
+  first->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+  vlib_buffer_chain_update_length (vm, first);
+  return 0;
+}
+
 format_function_t format_vlib_buffer, format_vlib_buffer_and_data,
   format_vlib_buffer_contents;
 
@@ -44,24 +44,32 @@
 
     Optimized thread-safe counters.
 
-    Each vlib_[simple|combined]_counter_main_t consists of a single
-    vector of thread-safe / atomically-updated u64 counters [the
-    "maxi" vector], and a (u16 **) per-thread vector [the "minis"
-    vector] of narrow, per-thread counters.
-
-    The idea is to drastically reduce the number of atomic operations.
-    In the case of packet counts, we divide the number of atomic ops
-    by 2**16, etc.
+    Each vlib_[simple|combined]_counter_main_t consists of one vector
+    of full width counters per thread. A thread only ever writes its
+    own vector, so incrementing a counter is a plain add: no atomic
+    operations, no overflow checks, and since each thread's vector
+    is cache line aligned, no false sharing between threads.
+
+    Readers add up the per-thread values. Since 64-bit loads are
+    atomic and each per-thread value only grows, a reader always sees
+    a value which the counter really held at some point since the
+    read began, with or without the workers running.
+
+    Clearing never writes into the per-thread vectors, which would
+    race with their owners: it records the current values, and
+    readers subtract them.
 */
 
+/** 64-bit counter, one per thread per index */
+typedef u64 counter_t;
+
 /** A collection of simple counters */
 
 typedef struct
 {
-  u16 **minis;	 /**< Per-thread u16 non-atomic counters */
-  u64 *maxi;	 /**< Shared wide counters */
-  u64 *value_at_last_clear; /**< Counter values as of last clear. */
-  u64 *value_at_last_serialize;	/**< Values as of last serialize. */
+  counter_t **counters;	 /**< Per-thread u64 non-atomic counters */
+  counter_t *value_at_last_clear; /**< Counter values as of last clear. */
+  counter_t *value_at_last_serialize; /**< Values as of last serialize. */
   u32 last_incremental_serialize_index;	/**< Last counter index
                                            serialized incrementally. */
 
@@ -72,33 +80,74 @@ typedef struct
     @param cm - (vlib_simple_counter_main_t *) simple counter main pointer
     @param cpu_index - (u32) the current cpu index
     @param index - (u32) index of the counter to increment
-    @param increment - (u32) quantitiy to add to the counter
+    @param increment - (u64) quantitiy to add to the counter
 */
 always_inline void
 vlib_increment_simple_counter (vlib_simple_counter_main_t * cm,
-			       u32 cpu_index, u32 index, u32 increment)
+			       u32 cpu_index, u32 index, u64 increment)
+{
+  counter_t *my_counters;
+
+  my_counters = cm->counters[cpu_index];
+  my_counters[index] += increment;
+}
+
+/** Increment a set of simple counters by one each
+    For vector nodes which count per packet: the per-thread vector is
+    looked up once for the whole batch.
+
+    @param cm - (vlib_simple_counter_main_t *) simple counter main pointer
+    @param cpu_index - (u32) the current cpu index
+    @param indices - (u32 *) indices of the counters to increment,
+    repeats allowed
+    @param n_indices - (u32) number of indices
+*/
+always_inline void
+vlib_increment_simple_counters (vlib_simple_counter_main_t * cm,
+				u32 cpu_index, u32 * indices, u32 n_indices)
+{
+  counter_t *my_counters = cm->counters[cpu_index];
+
+  while (n_indices >= 4)
+    {
+      my_counters[indices[0]] += 1;
+      my_counters[indices[1]] += 1;
+      my_counters[indices[2]] += 1;
+      my_counters[indices[3]] += 1;
+      indices += 4;
+      n_indices -= 4;
+    }
+
+  while (n_indices > 0)
+    {
+      my_counters[indices[0]] += 1;
+      indices += 1;
+      n_indices -= 1;
+    }
+}
+
+/** Get the raw value of a simple counter, ignoring the last clear */
+always_inline u64
+vlib_get_simple_counter_raw (vlib_simple_counter_main_t * cm, u32 index)
 {
-  u16 *my_minis;
-  u16 *mini;
-  u32 old, new;
+  counter_t *my_counters;
+  u64 v;
+  int i;
 
-  my_minis = cm->minis[cpu_index];
-  mini = vec_elt_at_index (my_minis, index);
-  old = mini[0];
-  new = old + increment;
-  mini[0] = new;
+  v = 0;
 
-  if (PREDICT_FALSE (mini[0] != new))
+  for (i = 0; i < vec_len (cm->counters); i++)
     {
-      __sync_fetch_and_add (&cm->maxi[index], new);
-      my_minis[index] = 0;
+      my_counters = cm->counters[i];
+      v += my_counters[index];
     }
+
+  return v;
 }
 
 /** Get the value of a simple counter
-    Scrapes the entire set of mini counters. Innacurate unless
-    worker threads which might increment the counter are
-    barrier-synchronized
+    Adds up the per-thread counters. Safe to call while worker threads
+    increment the counter, see above.
 
     @param cm - (vlib_simple_counter_main_t *) simple counter main pointer
     @param index - (u32) index of the counter to fetch
@@ -107,22 +156,11 @@ vlib_increment_simple_counter (vlib_simple_counter_main_t * cm,
 always_inline u64
 vlib_get_simple_counter (vlib_simple_counter_main_t * cm, u32 index)
 {
-  u16 *my_minis, *mini;
   u64 v;
-  int i;
 
-  ASSERT (index < vec_len (cm->maxi));
+  ASSERT (index < vec_len (cm->counters[0]));
 
-  v = 0;
-
-  for (i = 0; i < vec_len (cm->minis); i++)
-    {
-      my_minis = cm->minis[i];
-      mini = vec_elt_at_index (my_minis, index);
-      v += mini[0];
-    }
-
-  v += cm->maxi[index];
+  v = vlib_get_simple_counter_raw (cm, index);
 
   if (index < vec_len (cm->value_at_last_clear))
     {
@@ -134,7 +172,9 @@ vlib_get_simple_counter (vlib_simple_counter_main_t * cm, u32 index)
 }
 
 /** Clear a simple counter
-    Clears the set of per-thread u16 counters, and the u64 counter
+    Clears the per-thread counters. Unlike vlib_clear_simple_counters,
+    this writes the per-thread counters: only use it on counters which
+    no thread is incrementing, e.g. the counters of a new interface.
 
     @param cm - (vlib_simple_counter_main_t *) simple counter main pointer
     @param index - (u32) index of the counter to clear
@@ -142,19 +182,17 @@ vlib_get_simple_counter (vlib_simple_counter_main_t * cm, u32 index)
 always_inline void
 vlib_zero_simple_counter (vlib_simple_counter_main_t * cm, u32 index)
 {
-  u16 *my_minis;
+  counter_t *my_counters;
   int i;
 
-  ASSERT (index < vec_len (cm->maxi));
+  ASSERT (index < vec_len (cm->counters[0]));
 
-  for (i = 0; i < vec_len (cm->minis); i++)
+  for (i = 0; i < vec_len (cm->counters); i++)
     {
-      my_minis = cm->minis[i];
-      my_minis[index] = 0;
+      my_counters = cm->counters[i];
+      my_counters[index] = 0;
     }
 
-  cm->maxi[index] = 0;
-
   if (index < vec_len (cm->value_at_last_clear))
     cm->value_at_last_clear[index] = 0;
 }
@@ -201,18 +239,10 @@ vlib_counter_zero (vlib_counter_t * a)
   a->packets = a->bytes = 0;
 }
 
-/** Mini combined counter */
-typedef struct
-{
-  u16 packets;			/**< Packet count */
-  i16 bytes;			/**< Byte count */
-} vlib_mini_counter_t;
-
 /** A collection of combined counters */
 typedef struct
 {
-  vlib_mini_counter_t **minis;	/**< Per-thread u16 non-atomic counter pairs */
-  vlib_counter_t *maxi;		/**< Shared wide counter pairs */
+  vlib_counter_t **counters;	/**< Per-thread non-atomic counter pairs */
   vlib_counter_t *value_at_last_clear;	/**< Counter values as of last clear. */
   vlib_counter_t *value_at_last_serialize; /**< Counter values as of last serialize. */
   u32 last_incremental_serialize_index;	/**< Last counter index serialized incrementally. */
@@ -233,50 +263,82 @@ void vlib_clear_combined_counters (vlib_combined_counter_main_t * cm);
     @param cm - (vlib_combined_counter_main_t *) comined counter main pointer
     @param cpu_index - (u32) the current cpu index
     @param index - (u32) index of the counter to increment
-    @param packet_increment - (u32) number of packets to add to the counter
-    @param byte_increment - (u32) number of bytes to add to the counter
+    @param packet_increment - (u64) number of packets to add to the counter
+    @param byte_increment - (u64) number of bytes to add to the counter
 */
 
 always_inline void
 vlib_increment_combined_counter (vlib_combined_counter_main_t * cm,
 				 u32 cpu_index,
 				 u32 index,
-				 u32 packet_increment, u32 byte_increment)
+				 u64 packet_increment, u64 byte_increment)
 {
-  vlib_mini_counter_t *my_minis, *mini;
-  u32 old_packets, new_packets;
-  i32 old_bytes, new_bytes;
+  vlib_counter_t *my_counters;
 
-  /* Use this CPU's mini counter array */
-  my_minis = cm->minis[cpu_index];
+  /* Use this CPU's counter array */
+  my_counters = cm->counters[cpu_index];
 
-  mini = vec_elt_at_index (my_minis, index);
-  old_packets = mini->packets;
-  old_bytes = mini->bytes;
+  my_counters[index].packets += packet_increment;
+  my_counters[index].bytes += byte_increment;
+}
 
-  new_packets = old_packets + packet_increment;
-  new_bytes = old_bytes + byte_increment;
+/** Prefetch a combined counter for a later increment
+    @param cm - (vlib_combined_counter_main_t *) comined counter main pointer
+    @param cpu_index - (u32) the current cpu index
+    @param index - (u32) index of the counter to prefetch
+*/
+always_inline void
+vlib_prefetch_combined_counter (vlib_combined_counter_main_t * cm,
+				u32 cpu_index, u32 index)
+{
+  vlib_counter_t *my_counters = cm->counters[cpu_index];
 
-  mini->packets = new_packets;
-  mini->bytes = new_bytes;
+  CLIB_PREFETCH (my_counters + index, CLIB_CACHE_LINE_BYTES, STORE);
+}
 
-  /* Bytes always overflow before packets.. */
-  if (PREDICT_FALSE (mini->bytes != new_bytes))
-    {
-      vlib_counter_t *maxi = vec_elt_at_index (cm->maxi, index);
+/** Increment a set of combined counters by one packet each
+    For vector nodes which count per packet: the per-thread vector is
+    looked up once for the whole batch.
 
-      __sync_fetch_and_add (&maxi->packets, new_packets);
-      __sync_fetch_and_add (&maxi->bytes, new_bytes);
+    @param cm - (vlib_combined_counter_main_t *) comined counter main pointer
+    @param cpu_index - (u32) the current cpu index
+    @param indices - (u32 *) indices of the counters to increment,
+    repeats allowed
+    @param n_bytes - (u32 *) bytes to add to each counter
+    @param n_indices - (u32) number of indices
+*/
+always_inline void
+vlib_increment_combined_counters (vlib_combined_counter_main_t * cm,
+				  u32 cpu_index, u32 * indices,
+				  u32 * n_bytes, u32 n_indices)
+{
+  vlib_counter_t *my_counters = cm->counters[cpu_index];
+  vlib_counter_t *c0, *c1;
 
-      mini->packets = 0;
-      mini->bytes = 0;
+  while (n_indices >= 2)
+    {
+      c0 = my_counters + indices[0];
+      c1 = my_counters + indices[1];
+      c0->packets += 1;
+      c0->bytes += n_bytes[0];
+      c1->packets += 1;
+      c1->bytes += n_bytes[1];
+      indices += 2;
+      n_bytes += 2;
+      n_indices -= 2;
+    }
+
+  if (n_indices > 0)
+    {
+      c0 = my_counters + indices[0];
+      c0->packets += 1;
+      c0->bytes += n_bytes[0];
     }
 }
 
 /** Get the value of a combined counter, never called in the speed path
-    Scrapes the entire set of mini counters. Innacurate unless
-    worker threads which might increment the counter are
-    barrier-synchronized
+    Adds up the per-thread counters. Safe to call while worker threads
+    increment the counter, see above.
 
     @param cm - (vlib_combined_counter_main_t *) combined counter main pointer
     @param index - (u32) index of the combined counter to fetch
@@ -287,32 +349,29 @@ static inline void
 vlib_get_combined_counter (vlib_combined_counter_main_t * cm,
 			   u32 index, vlib_counter_t * result)
 {
-  vlib_mini_counter_t *my_minis, *mini;
-  vlib_counter_t *maxi;
+  vlib_counter_t *my_counters, *counter;
   int i;
 
   result->packets = 0;
   result->bytes = 0;
 
-  for (i = 0; i < vec_len (cm->minis); i++)
+  for (i = 0; i < vec_len (cm->counters); i++)
     {
-      my_minis = cm->minis[i];
+      my_counters = cm->counters[i];
 
-      mini = vec_elt_at_index (my_minis, index);
-      result->packets += mini->packets;
-      result->bytes += mini->bytes;
+      counter = vec_elt_at_index (my_counters, index);
+      result->packets += counter->packets;
+      result->bytes += counter->bytes;
     }
 
-  maxi = vec_elt_at_index (cm->maxi, index);
-  result->packets += maxi->packets;
-  result->bytes += maxi->bytes;
-
   if (index < vec_len (cm->value_at_last_clear))
     vlib_counter_sub (result, &cm->value_at_last_clear[index]);
 }
 
 /** Clear a combined counter
-    Clears the set of per-thread u16 counters, and the shared vlib_counter_t
+    Clears the per-thread counters. Unlike vlib_clear_combined_counters,
+    this writes the per-thread counters: only use it on counters which
+    no thread is incrementing, e.g. the counters of a new interface.
 
     @param cm - (vlib_combined_counter_main_t *) combined counter main pointer
     @param index - (u32) index of the counter to clear
@@ -320,23 +379,39 @@ vlib_get_combined_counter (vlib_combined_counter_main_t * cm,
 always_inline void
 vlib_zero_combined_counter (vlib_combined_counter_main_t * cm, u32 index)
 {
-  vlib_mini_counter_t *mini, *my_minis;
+  vlib_counter_t *my_counters;
   int i;
 
-  for (i = 0; i < vec_len (cm->minis); i++)
+  for (i = 0; i < vec_len (cm->counters); i++)
     {
-      my_minis = cm->minis[i];
-
-      mini = vec_elt_at_index (my_minis, index);
-      mini->packets = 0;
-      mini->bytes = 0;
+      my_counters = cm->counters[i];
+      vlib_counter_zero (vec_elt_at_index (my_counters, index));
     }
 
-  vlib_counter_zero (&cm->maxi[index]);
   if (index < vec_len (cm->value_at_last_clear))
     vlib_counter_zero (&cm->value_at_last_clear[index]);
 }
 
+/** Get every counter of a collection
+    Walks the per-thread vectors one after the other, rather than all
+    threads for each counter, so it is the cheap way to read a whole
+    collection.
+
+    @param cm - (vlib_simple_counter_main_t *) collection to read
+    @param result [in,out] - (u64 **) vector of values, resized to
+    vlib_counter_len (cm)
+*/
+void vlib_get_simple_counters (vlib_simple_counter_main_t * cm,
+			       u64 ** result);
+
+/** Get every counter of a collection
+    @param cm - (vlib_combined_counter_main_t *) collection to read
+    @param result [in,out] - (vlib_counter_t **) vector of values,
+    resized to vlib_counter_len (cm)
+*/
+void vlib_get_combined_counters (vlib_combined_counter_main_t * cm,
+				 vlib_counter_t ** result);
+
 /** validate a simple counter
     @param cm - (vlib_simple_counter_main_t *) pointer to the counter collection
     @param index - (u32) index of the counter to validate
@@ -354,14 +429,15 @@ void vlib_validate_combined_counter (vlib_combined_counter_main_t * cm,
 				     u32 index);
 
 /** Obtain the number of simple or combined counters allocated.
-    A macro which reduces to to vec_len(cm->maxi), the answer in either
-    case.
+    A macro which reduces to to vec_len(cm->counters[0]), the answer in
+    either case, or 0 if no counter was validated yet.
 
     @param cm - (vlib_simple_counter_main_t) or
     (vlib_combined_counter_main_t) the counter collection to interrogate
-    @returns vec_len(cm->maxi)
+    @returns vec_len(cm->counters[0])
 */
-#define vlib_counter_len(cm) vec_len((cm)->maxi)
+#define vlib_counter_len(cm) \
+  (vec_len((cm)->counters) ? vec_len((cm)->counters[0]) : 0)
 
 serialize_function_t serialize_vlib_simple_counter_main,
   unserialize_vlib_simple_counter_main;
@@ -941,27 +941,33 @@ vlib_buffer_chain_append_data_with_alloc (vlib_main_t * vm,
 
 /*
  * Fills in the required rte_mbuf fields for chained buffers given a VLIB chain.
+ * The mbuf chain is rebuilt from scratch, so chains which were split or
+ * had segments added in front are handled as well.
  */
 void
 vlib_buffer_chain_validate (vlib_main_t * vm, vlib_buffer_t * b_first)
 {
-  vlib_buffer_t *b = b_first, *prev = b_first;
+  vlib_buffer_t *b = b_first;
   struct rte_mbuf *mb_prev, *mb, *mb_first;
 
   mb_first = rte_mbuf_from_vlib_buffer (b_first);
 
+  mb_first->nb_segs = 1;
   mb_first->pkt_len = mb_first->data_len = b_first->current_length;
+  mb_first->data_off = VLIB_BUFFER_PRE_DATA_SIZE + b_first->current_data;
+  mb_prev = mb_first;
   while (b->flags & VLIB_BUFFER_NEXT_PRESENT)
     {
       b = vlib_get_buffer (vm, b->next_buffer);
       mb = rte_mbuf_from_vlib_buffer (b);
-      mb_prev = rte_mbuf_from_vlib_buffer (prev);
       mb_first->nb_segs++;
       mb_first->pkt_len += b->current_length;
       mb_prev->next = mb;
       mb->data_len = b->current_length;
-      prev = b;
+      mb->data_off = VLIB_BUFFER_PRE_DATA_SIZE + b->current_data;
+      mb_prev = mb;
     }
+  mb_prev->next = 0;
 }
 
 clib_error_t *
@@ -914,6 +914,79 @@ vlib_dump_context_trace (vlib_main_t * vm, u32 bi)
     }
 }
 
+/*
+ * Adaptive mode: a polling input node goes to interrupt mode after
+ * empty_polls_threshold consecutive empty polls, and an interrupt
+ * dispatch returning at least polling_threshold vectors puts it back
+ * in polling mode. The node's driver must either signal interrupts
+ * or be content with being polled after each idle sleep.
+ */
+static void
+dispatch_node_adaptive (vlib_main_t * vm, vlib_node_runtime_t * node,
+			vlib_node_state_t dispatch_state, uword n_vectors,
+			u64 dispatch_time, u64 t)
+{
+  vlib_node_t *n = vlib_get_node (vm, node->node_index);
+  vlib_node_adaptive_t *a = &n->adaptive;
+  ELOG_TYPE_DECLARE (e) =
+  {
+    .function = (char *) __FUNCTION__,.format =
+      "%s adaptive, %d vectors, switching to %s",.format_args =
+      "T4i4t4",.n_enum_strings = 2,.enum_strings =
+    {
+  "interrupt", "polling",},};
+  struct
+  {
+    u32 node_name, n_vectors, is_polling;
+  } *ed;
+
+  if (dispatch_state == VLIB_NODE_STATE_POLLING)
+    {
+      if (n_vectors > 0)
+	{
+	  a->n_empty_polls = 0;
+	  return;
+	}
+      if (++a->n_empty_polls < a->empty_polls_threshold)
+	return;
+
+      a->n_empty_polls = 0;
+      a->n_switch_to_interrupt++;
+      a->interrupt_mode_start_time = t;
+      a->interrupt_signal_time = 0;
+      vlib_node_set_state (vm, node->node_index, VLIB_NODE_STATE_INTERRUPT);
+
+      ed = ELOG_DATA (&vm->elog_main, e);
+      ed->node_name = n->name_elog_string;
+      ed->n_vectors = n_vectors;
+      ed->is_polling = 0;
+      return;
+    }
+
+  if (a->interrupt_signal_time)
+    {
+      a->n_wakeups++;
+      vlib_node_adaptive_histogram_add
+	(vm, a->wakeup_latency_histogram,
+	 dispatch_time - a->interrupt_signal_time);
+      a->interrupt_signal_time = 0;
+    }
+
+  if (n_vectors < a->polling_threshold)
+    return;
+
+  a->n_switch_to_polling++;
+  /* Nodes registered in interrupt mode have no start time */
+  if (a->interrupt_mode_start_time)
+    vlib_node_adaptive_histogram_add (vm, a->interrupt_time_histogram,
+				      t - a->interrupt_mode_start_time);
+  vlib_node_set_state (vm, node->node_index, VLIB_NODE_STATE_POLLING);
+
+  ed = ELOG_DATA (&vm->elog_main, e);
+  ed->node_name = n->name_elog_string;
+  ed->n_vectors = n_vectors;
+  ed->is_polling = 1;
+}
 
 /* static_always_inline */ u64
 dispatch_node (vlib_main_t * vm,
@@ -1003,17 +1076,33 @@ dispatch_node (vlib_main_t * vm,
       vm->main_loop_vectors_processed += n;
       vm->main_loop_nodes_processed += n > 0;
 
+      if (type == VLIB_NODE_TYPE_INTERNAL)
+	vm->internal_node_clocks += t - last_time_stamp;
+      else if (type == VLIB_NODE_TYPE_INPUT
+	       && dispatch_state == VLIB_NODE_STATE_POLLING)
+	{
+	  vm->input_node_calls++;
+	  vm->input_node_vectors += n;
+	}
+
       v = vlib_node_runtime_update_stats (stat_vm, node,
 					  /* n_calls */ 1,
 					  /* n_vectors */ n,
 					  /* n_clocks */ t - last_time_stamp);
 
+      if (PREDICT_FALSE (nm->node_profiles != 0))
+	vlib_node_profile_add (nm, node->node_index, n, t - last_time_stamp);
+
+      if (PREDICT_FALSE (node->flags & VLIB_NODE_FLAG_ADAPTIVE_MODE))
+	dispatch_node_adaptive (vm, node, dispatch_state, n,
+				last_time_stamp, t);
+
       /* When in interrupt mode and vector rate crosses threshold switch to
          polling mode. */
-      if ((DPDK == 0 && dispatch_state == VLIB_NODE_STATE_INTERRUPT)
-	  || (DPDK == 0 && dispatch_state == VLIB_NODE_STATE_POLLING
-	      && (node->flags
-		  & VLIB_NODE_FLAG_SWITCH_FROM_INTERRUPT_TO_POLLING_MODE)))
+      else if ((DPDK == 0 && dispatch_state == VLIB_NODE_STATE_INTERRUPT)
+	       || (DPDK == 0 && dispatch_state == VLIB_NODE_STATE_POLLING
+		   && (node->flags
+		       & VLIB_NODE_FLAG_SWITCH_FROM_INTERRUPT_TO_POLLING_MODE)))
 	{
 	  ELOG_TYPE_DECLARE (e) =
 	  {
@@ -1524,6 +1613,10 @@ vlib_main_loop (vlib_main_t * vm)
       if (_vec_len (nm->data_from_advancing_timing_wheel) > 0)
 	goto processes_timing_wheel_data;
 
+      /* Run frees deferred until the workers pass a quiescent state. */
+      if (PREDICT_FALSE (vec_len (vlib_thread_main.deferred_calls) > 0))
+	vlib_worker_thread_run_deferred_calls (vm);
+
       vlib_increment_main_loop_counter (vm);
 
       /* Record time stamp in case there are no enabled nodes and above
@@ -74,6 +74,16 @@ typedef struct vlib_main_t
   u32 main_loop_vectors_processed;
   u32 main_loop_nodes_processed;
 
+  /* Totals since start, written only by this thread; other threads
+     may read them without the barrier. Clocks of internal nodes, calls
+     and vectors of polling input nodes. */
+  u64 internal_node_clocks;
+  u64 input_node_calls;
+  u64 input_node_vectors;
+
+  /* Last epoch this thread announced as quiescent. */
+  volatile u64 quiescent_epoch;
+
   /* Circular buffer of input node vector counts.
      Indexed by low bits of
      (main_loop_count >> VLIB_LOG2_INPUT_VECTORS_PER_MAIN_LOOP). */
@@ -109,6 +119,9 @@ typedef struct vlib_main_t
      buffer memory is guaranteed to be cache-aligned. */
   void *(*os_physmem_alloc_aligned) (vlib_physmem_main_t * pm,
 				     uword n_bytes, uword alignment);
+  void *(*os_physmem_alloc_aligned_on_numa) (vlib_physmem_main_t * pm,
+					     uword n_bytes, uword alignment,
+					     u32 numa_node);
   void (*os_physmem_free) (void *x);
 
   /* Node graph main structure. */
@@ -158,6 +171,9 @@ typedef struct vlib_main_t
   /* to compare with node runtime */
   u32 cpu_index;
 
+  /* NUMA node this thread allocates buffers from */
+  u32 numa_node;
+
   void **mbuf_alloc_list;
 
   /* List of init functions to call, setup by constructors */
@@ -415,7 +415,14 @@ register_node (vlib_main_t * vm, vlib_node_registration_t * r)
       }
 
     if (n->type == VLIB_NODE_TYPE_INPUT)
-      nm->input_node_counts_by_state[n->state] += 1;
+      {
+	nm->input_node_counts_by_state[n->state] += 1;
+	n->adaptive.empty_polls_threshold =
+	  VLIB_NODE_ADAPTIVE_DEFAULT_EMPTY_POLLS;
+	n->adaptive.polling_threshold =
+	  VLIB_NODE_ADAPTIVE_DEFAULT_POLLING_THRESHOLD;
+	n->adaptive.saved_state = n->state;
+      }
 
     rt->function = n->function;
     rt->flags = n->flags;
@@ -455,6 +462,104 @@ vlib_register_node (vlib_main_t * vm, vlib_node_registration_t * r)
   return r->index;
 }
 
+/*
+ * Turn adaptive mode on or off for an input node on one thread. Zero
+ * thresholds keep the current values. Turning adaptive mode off puts
+ * the node back in the state it had when adaptive mode was turned on.
+ */
+void
+vlib_node_set_adaptive_mode (vlib_main_t * vm, u32 node_index, int enable,
+			     u32 empty_polls_threshold, u32 polling_threshold)
+{
+  vlib_node_t *n = vlib_get_node (vm, node_index);
+  vlib_node_runtime_t *r = vlib_node_get_runtime (vm, node_index);
+  vlib_node_adaptive_t *a = &n->adaptive;
+
+  ASSERT (n->type == VLIB_NODE_TYPE_INPUT);
+
+  if (empty_polls_threshold)
+    a->empty_polls_threshold = empty_polls_threshold;
+  if (polling_threshold)
+    a->polling_threshold = polling_threshold;
+
+  if (enable && !(n->flags & VLIB_NODE_FLAG_ADAPTIVE_MODE))
+    {
+      a->saved_state = n->state;
+      a->n_empty_polls = 0;
+      a->interrupt_signal_time = 0;
+      a->interrupt_mode_start_time = clib_cpu_time_now ();
+      n->flags |= VLIB_NODE_FLAG_ADAPTIVE_MODE;
+      r->flags |= VLIB_NODE_FLAG_ADAPTIVE_MODE;
+      r->flags &= ~(VLIB_NODE_FLAG_SWITCH_FROM_INTERRUPT_TO_POLLING_MODE
+		    | VLIB_NODE_FLAG_SWITCH_FROM_POLLING_TO_INTERRUPT_MODE);
+    }
+  else if (!enable && (n->flags & VLIB_NODE_FLAG_ADAPTIVE_MODE))
+    {
+      n->flags &= ~VLIB_NODE_FLAG_ADAPTIVE_MODE;
+      r->flags &= ~VLIB_NODE_FLAG_ADAPTIVE_MODE;
+      /* Leave nodes the driver has disabled alone */
+      if (n->state != VLIB_NODE_STATE_DISABLED
+	  && a->saved_state != VLIB_NODE_STATE_DISABLED)
+	vlib_node_set_state (vm, node_index, a->saved_state);
+    }
+}
+
+/*
+ * Turn the node cycle profiler on or off for one thread. Caller holds
+ * the worker barrier.
+ */
+void
+vlib_node_profile_enable_disable (vlib_main_t * vm, int enable)
+{
+  vlib_node_main_t *nm = &vm->node_main;
+
+  if (enable && !nm->node_profiles)
+    vec_validate_aligned (nm->node_profiles, vec_len (nm->nodes) - 1,
+			  CLIB_CACHE_LINE_BYTES);
+  else if (!enable)
+    vec_free (nm->node_profiles);
+}
+
+void
+vlib_node_profile_clear (vlib_main_t * vm)
+{
+  vlib_node_main_t *nm = &vm->node_main;
+
+  if (nm->node_profiles)
+    memset (nm->node_profiles, 0, vec_bytes (nm->node_profiles));
+}
+
+/*
+ * Estimate the p-th quantile (0 < p <= 1) of a log2 clocks histogram,
+ * interpolating linearly inside the bucket it falls in.
+ */
+f64
+vlib_node_profile_percentile (u64 * histogram, u32 n_buckets, f64 p)
+{
+  u64 total = 0, sum = 0;
+  f64 rank, lo, hi;
+  u32 i;
+
+  for (i = 0; i < n_buckets; i++)
+    total += histogram[i];
+  if (total == 0)
+    return 0;
+
+  rank = p * total;
+  for (i = 0; i < n_buckets; i++)
+    {
+      if (histogram[i] && sum + histogram[i] >= rank)
+	{
+	  lo = i ? (f64) (1ULL << i) : 0;
+	  hi = (f64) (1ULL << (i + 1));
+	  return lo + (hi - lo) * (rank - sum) / histogram[i];
+	}
+      sum += histogram[i];
+    }
+
+  return (f64) (1ULL << n_buckets);
+}
+
 static uword
 null_node_fn (vlib_main_t * vm,
 	      vlib_node_runtime_t * node, vlib_frame_t * frame)
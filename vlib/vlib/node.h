@@ -212,6 +212,48 @@ typedef enum
     VLIB_N_NODE_STATE,
 } vlib_node_state_t;
 
+/* Adaptive mode histograms, log2 microseconds. */
+#define VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS 20
+
+/* Adaptive mode defaults, see vlib_node_adaptive_t. */
+#define VLIB_NODE_ADAPTIVE_DEFAULT_EMPTY_POLLS 1024
+#define VLIB_NODE_ADAPTIVE_DEFAULT_POLLING_THRESHOLD 8
+
+/* Per thread state of an input node in adaptive mode. */
+typedef struct
+{
+  /* Consecutive polls returning no vectors which switch the node
+     to interrupt mode. */
+  u32 empty_polls_threshold;
+
+  /* Vectors returned by an interrupt dispatch which switch the node
+     back to polling mode. */
+  u32 polling_threshold;
+
+  /* Consecutive empty polls so far. */
+  u32 n_empty_polls;
+
+  /* State to restore when adaptive mode is turned off. */
+  u8 saved_state;
+
+  /* CPU time of the first pending interrupt, zero if none. */
+  u64 interrupt_signal_time;
+
+  /* CPU time the node last entered interrupt mode. */
+  u64 interrupt_mode_start_time;
+
+  u64 n_switch_to_interrupt;
+  u64 n_switch_to_polling;
+  u64 n_wakeups;
+
+  /* Interrupt signal to dispatch latency. */
+  u64 wakeup_latency_histogram[VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS];
+
+  /* Time spent in interrupt mode before load switched the node
+     back to polling. */
+  u64 interrupt_time_histogram[VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS];
+} vlib_node_adaptive_t;
+
 typedef struct vlib_node_t
 {
   /* Vector processing function for this node. */
@@ -230,6 +272,9 @@ typedef struct vlib_node_t
      Current values are always stats_total - stats_last_clear. */
   vlib_node_stats_t stats_last_clear;
 
+  /* Adaptive polling/interrupt mode state, input nodes only. */
+  vlib_node_adaptive_t adaptive;
+
   /* Type of this node. */
   vlib_node_type_t type;
 
@@ -261,6 +306,10 @@ typedef struct vlib_node_t
 #define VLIB_NODE_FLAG_SWITCH_FROM_INTERRUPT_TO_POLLING_MODE (1 << 6)
 #define VLIB_NODE_FLAG_SWITCH_FROM_POLLING_TO_INTERRUPT_MODE (1 << 7)
 
+  /* Input node switches to interrupt mode after a run of empty polls,
+     and back to polling mode under load. See vlib_node_adaptive_t. */
+#define VLIB_NODE_FLAG_ADAPTIVE_MODE (1 << 8)
+
   /* State for input nodes. */
   u8 state;
 
@@ -627,6 +676,26 @@ vlib_timing_wheel_data_get_index (u32 d)
   return d / 2;
 }
 
+/* Log2 histogram sizes of the node cycle profiler. */
+#define VLIB_NODE_PROFILE_N_CLOCK_BUCKETS 32
+#define VLIB_NODE_PROFILE_N_VECTOR_BUCKETS 10
+
+/*
+ * Per thread cycle profile of one node. Clock bucket i counts
+ * dispatches taking [2^i, 2^(i+1)) clocks. Vector bucket 0 counts
+ * dispatches which returned no vectors, bucket i > 0 those which
+ * returned [2^(i-1), 2^i) vectors.
+ */
+typedef struct
+{
+  u64 clocks_per_call[VLIB_NODE_PROFILE_N_CLOCK_BUCKETS];
+  u64 clocks_per_vector[VLIB_NODE_PROFILE_N_CLOCK_BUCKETS];
+  u64 vectors_per_call[VLIB_NODE_PROFILE_N_VECTOR_BUCKETS];
+
+  /* Slowest dispatch seen. */
+  u64 max_clocks;
+} vlib_node_profile_t;
+
 typedef struct
 {
   /* Public nodes. */
@@ -693,6 +762,9 @@ typedef struct
   /* Time of last node runtime stats clear. */
   f64 time_last_runtime_stats_clear;
 
+  /* Cycle profile indexed by node index, or zero when profiling is off. */
+  vlib_node_profile_t *node_profiles;
+
   /* Node registrations added by constructors */
   vlib_node_registration_t *node_registrations;
 } vlib_node_main_t;
@@ -703,8 +775,8 @@ typedef struct
 {
   CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
   u64 head;
-  u64 head_hint;
   u64 tail;
+  u64 backlog;
   u32 n_in_use;
   u32 nelts;
   u32 written;
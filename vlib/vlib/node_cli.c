@@ -451,6 +451,485 @@ VLIB_CLI_COMMAND (clear_node_runtime_command, static) = {
 };
 /* *INDENT-ON* */
 
+static void
+node_thread_vms (vlib_main_t * vm, vlib_main_t *** stat_vms)
+{
+  int i;
+
+  if (vec_len (vlib_mains) == 0)
+    vec_add1 (*stat_vms, vm);
+  else
+    {
+      for (i = 0; i < vec_len (vlib_mains); i++)
+	if (vlib_mains[i])
+	  vec_add1 (*stat_vms, vlib_mains[i]);
+    }
+}
+
+static clib_error_t *
+set_node_adaptive (vlib_main_t * vm,
+		   unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_main_t **stat_vms = 0;
+  vlib_node_t *n;
+  u32 node_index = ~0;
+  u32 empty_polls = 0, polling_threshold = 0;
+  int enable = 1;
+  int j;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vlib_node, vm, &node_index))
+	;
+      else if (unformat (input, "empty-polls %u", &empty_polls))
+	;
+      else if (unformat (input, "polling-threshold %u", &polling_threshold))
+	;
+      else if (unformat (input, "disable"))
+	enable = 0;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (node_index == ~0)
+    return clib_error_return (0, "please specify an input node");
+
+  n = vlib_get_node (vm, node_index);
+  if (n->type != VLIB_NODE_TYPE_INPUT)
+    return clib_error_return (0, "%v is not an input node", n->name);
+
+  /* Each thread has its own copy of the node */
+  node_thread_vms (vm, &stat_vms);
+  for (j = 0; j < vec_len (stat_vms); j++)
+    vlib_node_set_adaptive_mode (stat_vms[j], node_index, enable,
+				 empty_polls, polling_threshold);
+
+  vec_free (stat_vms);
+  return 0;
+}
+
+/*?
+ * Put an input node in adaptive mode. The node switches to interrupt
+ * mode after a run of empty polls, and back to polling mode when an
+ * interrupt dispatch returns at least the polling threshold of
+ * vectors. Applies to the node on every thread.
+ *
+ * @cliexpar
+ * @cliexcmd{set node adaptive af-packet-input empty-polls 256 polling-threshold 4}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_node_adaptive_command, static) = {
+  .path = "set node adaptive",
+  .short_help = "set node adaptive <input-node> [empty-polls <n>] "
+  "[polling-threshold <n>] [disable]",
+  .function = set_node_adaptive,
+};
+/* *INDENT-ON* */
+
+static void
+show_node_adaptive_histogram (vlib_main_t * vm, char *what, u64 * histogram)
+{
+  u32 i;
+
+  vlib_cli_output (vm, "  %s:", what);
+  for (i = 0; i < VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS; i++)
+    if (histogram[i])
+      vlib_cli_output (vm, "    %-20U %lld",
+		       format_vlib_node_adaptive_bucket, i, histogram[i]);
+}
+
+static clib_error_t *
+show_node_adaptive (vlib_main_t * vm,
+		    unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_main_t **stat_vms = 0, *stat_vm;
+  vlib_node_adaptive_t *stats = 0, *a;
+  vlib_node_t *n;
+  u32 *node_indices = 0;
+  u8 *states = 0;
+  int verbose = 0;
+  int i, j, k;
+
+  if (unformat (input, "verbose") || unformat (input, "v"))
+    verbose = 1;
+
+  node_thread_vms (vm, &stat_vms);
+
+  for (j = 0; j < vec_len (stat_vms); j++)
+    {
+      stat_vm = stat_vms[j];
+
+      /* Snapshot under the barrier, print afterwards */
+      vec_reset_length (node_indices);
+      vec_reset_length (stats);
+      vec_reset_length (states);
+      vlib_worker_thread_barrier_sync (vm);
+      for (i = 0; i < vec_len (stat_vm->node_main.nodes); i++)
+	{
+	  n = stat_vm->node_main.nodes[i];
+	  if (!(n->flags & VLIB_NODE_FLAG_ADAPTIVE_MODE))
+	    continue;
+	  vec_add1 (node_indices, n->index);
+	  vec_add1 (stats, n->adaptive);
+	  vec_add1 (states, n->state);
+	}
+      vlib_worker_thread_barrier_release (vm);
+
+      if (vec_len (node_indices) == 0)
+	continue;
+
+      if (j > 0)
+	vlib_cli_output (vm, "---------------");
+      if (stat_vm->cpu_index < vec_len (vlib_worker_threads))
+	vlib_cli_output (vm, "Thread %d %v", stat_vm->cpu_index,
+			 vlib_worker_threads[stat_vm->cpu_index].name);
+
+      vlib_cli_output (vm, "%-30s%=10s%=12s%=12s%=12s%=12s%=12s", "Name",
+		       "State", "EmptyPolls", "PollThresh", "ToIntr",
+		       "ToPoll", "Wakeups");
+      for (k = 0; k < vec_len (node_indices); k++)
+	{
+	  a = stats + k;
+	  vlib_cli_output (vm, "%-30U%=10s%=12d%=12d%=12lld%=12lld%=12lld",
+			   format_vlib_node_name, stat_vm, node_indices[k],
+			   states[k] == VLIB_NODE_STATE_POLLING ? "polling"
+			   : states[k] == VLIB_NODE_STATE_INTERRUPT
+			   ? "interrupt" : "disabled",
+			   a->empty_polls_threshold, a->polling_threshold,
+			   a->n_switch_to_interrupt, a->n_switch_to_polling,
+			   a->n_wakeups);
+	  if (verbose)
+	    {
+	      show_node_adaptive_histogram (vm, "wakeup latency",
+					    a->wakeup_latency_histogram);
+	      show_node_adaptive_histogram (vm, "time in interrupt mode",
+					    a->interrupt_time_histogram);
+	    }
+	}
+    }
+
+  vec_free (node_indices);
+  vec_free (stats);
+  vec_free (states);
+  vec_free (stat_vms);
+  return 0;
+}
+
+/*?
+ * Display input nodes in adaptive mode on each thread: their current
+ * state, thresholds, and how often they switched mode. With
+ * <em>verbose</em>, also show the interrupt wakeup latency histogram
+ * and how long the node stayed in interrupt mode before load switched
+ * it back to polling.
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_node_adaptive_command, static) = {
+  .path = "show node adaptive",
+  .short_help = "show node adaptive [verbose]",
+  .function = show_node_adaptive,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+clear_node_adaptive (vlib_main_t * vm,
+		     unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_main_t **stat_vms = 0;
+  vlib_node_adaptive_t *a;
+  int i, j;
+
+  node_thread_vms (vm, &stat_vms);
+
+  for (j = 0; j < vec_len (stat_vms); j++)
+    {
+      vlib_node_main_t *nm = &stat_vms[j]->node_main;
+
+      for (i = 0; i < vec_len (nm->nodes); i++)
+	{
+	  a = &nm->nodes[i]->adaptive;
+	  a->n_switch_to_interrupt = 0;
+	  a->n_switch_to_polling = 0;
+	  a->n_wakeups = 0;
+	  memset (a->wakeup_latency_histogram, 0,
+		  sizeof (a->wakeup_latency_histogram));
+	  memset (a->interrupt_time_histogram, 0,
+		  sizeof (a->interrupt_time_histogram));
+	}
+    }
+
+  vec_free (stat_vms);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (clear_node_adaptive_command, static) = {
+  .path = "clear node adaptive",
+  .short_help = "Clear adaptive mode statistics",
+  .function = clear_node_adaptive,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+set_node_profile (vlib_main_t * vm,
+		  unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_main_t **stat_vms = 0;
+  int enable = 1;
+  int j;
+
+  if (unformat (input, "off") || unformat (input, "disable"))
+    enable = 0;
+  else if (unformat (input, "on") || unformat (input, "enable"))
+    enable = 1;
+  else if (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    return clib_error_return (0, "unknown input `%U'",
+			      format_unformat_error, input);
+
+  node_thread_vms (vm, &stat_vms);
+  for (j = 0; j < vec_len (stat_vms); j++)
+    vlib_node_profile_enable_disable (stat_vms[j], enable);
+
+  vec_free (stat_vms);
+  return 0;
+}
+
+/*?
+ * Turn the node cycle profiler on or off on every thread. While on,
+ * each dispatch of a node is counted in log2 histograms of clocks per
+ * call, clocks per vector and vectors per call, which cost a few
+ * instructions per dispatch rather than per packet. Turning it off
+ * discards the histograms.
+ *
+ * @cliexpar
+ * @cliexcmd{set node profile on}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_node_profile_command, static) = {
+  .path = "set node profile",
+  .short_help = "set node profile [on|off]",
+  .function = set_node_profile,
+};
+/* *INDENT-ON* */
+
+static void
+show_node_profile_histogram (vlib_main_t * vm, char *what, u64 * histogram,
+			     u32 n_buckets, int is_vectors)
+{
+  u64 lo, hi;
+  u32 i;
+
+  vlib_cli_output (vm, "  %s:", what);
+  for (i = 0; i < n_buckets; i++)
+    {
+      if (!histogram[i])
+	continue;
+      if (is_vectors)
+	{
+	  lo = i ? 1ULL << (i - 1) : 0;
+	  hi = i ? (1ULL << i) - 1 : 0;
+	}
+      else
+	{
+	  lo = i ? 1ULL << i : 0;
+	  hi = (1ULL << (i + 1)) - 1;
+	}
+      vlib_cli_output (vm, "    %12lld - %-12lld %lld", lo, hi,
+		       histogram[i]);
+    }
+}
+
+static void
+show_node_profile_one (vlib_main_t * vm, vlib_node_t * n,
+		       vlib_node_profile_t * p, int verbose)
+{
+  u64 calls = 0;
+  f64 pc;
+  u32 i;
+
+  for (i = 0; i < VLIB_NODE_PROFILE_N_VECTOR_BUCKETS; i++)
+    calls += p->vectors_per_call[i];
+  if (calls == 0)
+    return;
+
+#define _(h,q) vlib_node_profile_percentile \
+    (p->h, VLIB_NODE_PROFILE_N_CLOCK_BUCKETS, q)
+  pc = vlib_node_profile_percentile (p->vectors_per_call,
+				     VLIB_NODE_PROFILE_N_VECTOR_BUCKETS, .5);
+  /* Vector buckets are shifted up by one, see vlib_node_profile_t */
+  pc /= 2;
+
+  vlib_cli_output (vm, "%-30v%12lld%10.1f%10.2e%10.2e%10.2e%10.2e%10.2e"
+		   "%10.2e%10.2e", n->name, calls, pc,
+		   _(clocks_per_call, .5), _(clocks_per_call, .9),
+		   _(clocks_per_call, .99), _(clocks_per_call, .999),
+		   (f64) p->max_clocks, _(clocks_per_vector, .5),
+		   _(clocks_per_vector, .99));
+#undef _
+
+  if (verbose)
+    {
+      show_node_profile_histogram (vm, "clocks per call",
+				   p->clocks_per_call,
+				   VLIB_NODE_PROFILE_N_CLOCK_BUCKETS, 0);
+      show_node_profile_histogram (vm, "clocks per vector",
+				   p->clocks_per_vector,
+				   VLIB_NODE_PROFILE_N_CLOCK_BUCKETS, 0);
+      show_node_profile_histogram (vm, "vectors per call",
+				   p->vectors_per_call,
+				   VLIB_NODE_PROFILE_N_VECTOR_BUCKETS, 1);
+    }
+}
+
+static void
+node_profile_merge (vlib_node_profile_t * to, vlib_node_profile_t * from)
+{
+  u32 i;
+
+  for (i = 0; i < VLIB_NODE_PROFILE_N_CLOCK_BUCKETS; i++)
+    {
+      to->clocks_per_call[i] += from->clocks_per_call[i];
+      to->clocks_per_vector[i] += from->clocks_per_vector[i];
+    }
+  for (i = 0; i < VLIB_NODE_PROFILE_N_VECTOR_BUCKETS; i++)
+    to->vectors_per_call[i] += from->vectors_per_call[i];
+  to->max_clocks = clib_max (to->max_clocks, from->max_clocks);
+}
+
+static clib_error_t *
+show_node_profile (vlib_main_t * vm,
+		   unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_main_t **stat_vms = 0, *stat_vm;
+  vlib_node_profile_t **profiles = 0, *merged = 0, *p;
+  vlib_node_t **nodes = 0, *n;
+  u32 node_index = ~0, thread_index = ~0;
+  int verbose = 0, merge = 0;
+  int i, j;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vlib_node, vm, &node_index))
+	;
+      else if (unformat (input, "thread %u", &thread_index))
+	;
+      else if (unformat (input, "merge"))
+	merge = 1;
+      else if (unformat (input, "verbose") || unformat (input, "v"))
+	verbose = 1;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  node_thread_vms (vm, &stat_vms);
+
+  /* Snapshot under the barrier, print afterwards */
+  vlib_worker_thread_barrier_sync (vm);
+  for (j = 0; j < vec_len (stat_vms); j++)
+    vec_add1 (profiles, vec_dup (stat_vms[j]->node_main.node_profiles));
+  nodes = vec_dup (vm->node_main.nodes);
+  vlib_worker_thread_barrier_release (vm);
+
+  if (vec_len (profiles) == 0 || profiles[0] == 0)
+    {
+      vlib_cli_output (vm, "Node profiling is off, "
+		       "see \"set node profile\"");
+      goto done;
+    }
+
+  vec_sort_with_function (nodes, node_cmp);
+
+  if (merge)
+    {
+      vec_validate (merged, vec_len (nodes) - 1);
+      for (j = 0; j < vec_len (profiles); j++)
+	if (thread_index == ~0 || stat_vms[j]->cpu_index == thread_index)
+	  for (i = 0; i < vec_len (profiles[j]); i++)
+	    node_profile_merge (merged + i, profiles[j] + i);
+    }
+
+  for (j = 0; j < (merge ? 1 : vec_len (profiles)); j++)
+    {
+      stat_vm = stat_vms[j];
+      if (!merge && thread_index != ~0 && stat_vm->cpu_index != thread_index)
+	continue;
+
+      if (merge)
+	vlib_cli_output (vm, "All threads");
+      else if (stat_vm->cpu_index < vec_len (vlib_worker_threads))
+	vlib_cli_output (vm, "Thread %d %v", stat_vm->cpu_index,
+			 vlib_worker_threads[stat_vm->cpu_index].name);
+
+      vlib_cli_output (vm, "%-30s%12s%10s%10s%10s%10s%10s%10s%10s%10s",
+		       "Name", "Calls", "Vec/Call", "Clk p50", "Clk p90",
+		       "Clk p99", "Clk p99.9", "Clk max", "Clk/V p50",
+		       "Clk/V p99");
+      for (i = 0; i < vec_len (nodes); i++)
+	{
+	  n = nodes[i];
+	  if (node_index != ~0 && n->index != node_index)
+	    continue;
+	  p = merge ? merged : profiles[j];
+	  if (n->index < vec_len (p))
+	    show_node_profile_one (vm, n, p + n->index, verbose);
+	}
+    }
+
+done:
+  for (j = 0; j < vec_len (profiles); j++)
+    vec_free (profiles[j]);
+  vec_free (profiles);
+  vec_free (merged);
+  vec_free (nodes);
+  vec_free (stat_vms);
+  return 0;
+}
+
+/*?
+ * Show the node cycle profile: per thread, or with <em>merge</em>
+ * summed over all threads, the median vectors per call and estimated
+ * percentiles of clocks per call and per vector for each node which
+ * ran since profiling was turned on or last cleared. Percentiles are
+ * interpolated inside log2 buckets, so read them as magnitudes.
+ * <em>verbose</em> adds the histograms themselves.
+ *
+ * @cliexpar
+ * @cliexcmd{show node profile ip4-lookup merge verbose}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_node_profile_command, static) = {
+  .path = "show node profile",
+  .short_help = "show node profile [<node>] [thread <n>] [merge] [verbose]",
+  .function = show_node_profile,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+clear_node_profile (vlib_main_t * vm,
+		    unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_main_t **stat_vms = 0;
+  int j;
+
+  node_thread_vms (vm, &stat_vms);
+  for (j = 0; j < vec_len (stat_vms); j++)
+    vlib_node_profile_clear (stat_vms[j]);
+
+  vec_free (stat_vms);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (clear_node_profile_command, static) = {
+  .path = "clear node profile",
+  .short_help = "Clear node cycle profile",
+  .function = clear_node_profile,
+};
+/* *INDENT-ON* */
+
 /* Dummy function to get us linked in. */
 void
 vlib_node_cli_reference (void)
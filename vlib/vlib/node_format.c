@@ -178,6 +178,19 @@ format_vlib_cpu_time (u8 * s, va_list * va)
   return format (s, "%U", format_vlib_time, vm, dt);
 }
 
+/* Bucket label of a log2 microsecond adaptive mode histogram. */
+u8 *
+format_vlib_node_adaptive_bucket (u8 * s, va_list * va)
+{
+  u32 i = va_arg (*va, u32);
+
+  if (i == 0)
+    return format (s, "< 1 us");
+  if (i == VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS - 1)
+    return format (s, ">= %lld us", 1ULL << (i - 1));
+  return format (s, "%lld - %lld us", 1ULL << (i - 1), (1ULL << i) - 1);
+}
+
 /*
  * fd.io coding-style-patch-verification: ON
  *
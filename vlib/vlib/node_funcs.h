@@ -184,8 +184,85 @@ vlib_node_set_interrupt_pending (vlib_main_t * vm, u32 node_index)
   vlib_node_t *n = vec_elt (nm->nodes, node_index);
   ASSERT (n->type == VLIB_NODE_TYPE_INPUT);
   vec_add1 (nm->pending_interrupt_node_runtime_indices, n->runtime_index);
+
+  /* Time stamp the first signal for the wakeup latency histogram. */
+  if (PREDICT_FALSE (n->flags & VLIB_NODE_FLAG_ADAPTIVE_MODE)
+      && n->adaptive.interrupt_signal_time == 0)
+    n->adaptive.interrupt_signal_time = clib_cpu_time_now ();
+}
+
+/* Count a time interval in a log2 microsecond histogram. */
+always_inline void
+vlib_node_adaptive_histogram_add (vlib_main_t * vm, u64 * histogram,
+				  u64 n_clocks)
+{
+  f64 usec = n_clocks * vm->clib_time.seconds_per_clock * 1e6;
+  u32 bucket;
+
+  bucket = usec < 1 ? 0 : 1 + min_log2 ((u64) usec);
+  if (bucket >= VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS)
+    bucket = VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS - 1;
+  histogram[bucket]++;
+}
+
+/*
+ * Schedule every adaptive input node sitting in interrupt mode for one
+ * dispatch. Called after an idle sleep, so that nodes whose driver has
+ * no interrupt to signal still notice traffic and switch back to
+ * polling mode.
+ */
+always_inline void
+vlib_node_adaptive_poll_interrupt_nodes (vlib_main_t * vm)
+{
+  vlib_node_main_t *nm = &vm->node_main;
+  vlib_node_runtime_t *rt;
+
+  vec_foreach (rt, nm->nodes_by_type[VLIB_NODE_TYPE_INPUT])
+  {
+    if ((rt->flags & VLIB_NODE_FLAG_ADAPTIVE_MODE)
+	&& rt->state == VLIB_NODE_STATE_INTERRUPT)
+      vec_add1 (nm->pending_interrupt_node_runtime_indices,
+		rt - nm->nodes_by_type[VLIB_NODE_TYPE_INPUT]);
+  }
+}
+
+void vlib_node_set_adaptive_mode (vlib_main_t * vm, u32 node_index,
+				  int enable, u32 empty_polls_threshold,
+				  u32 polling_threshold);
+
+/* Add one dispatch to a node's cycle profile. */
+always_inline void
+vlib_node_profile_add (vlib_node_main_t * nm, u32 node_index,
+		       uword n_vectors, u64 n_clocks)
+{
+  vlib_node_profile_t *p;
+  u32 b;
+
+  /* Nodes registered after profiling was turned on are not profiled. */
+  if (PREDICT_FALSE (node_index >= vec_len (nm->node_profiles)))
+    return;
+  p = nm->node_profiles + node_index;
+
+  b = n_clocks ? min_log2 (n_clocks) : 0;
+  p->clocks_per_call[clib_min (b, VLIB_NODE_PROFILE_N_CLOCK_BUCKETS - 1)]++;
+  p->max_clocks = clib_max (p->max_clocks, n_clocks);
+
+  b = n_vectors ? 1 + min_log2 (n_vectors) : 0;
+  p->vectors_per_call[clib_min (b, VLIB_NODE_PROFILE_N_VECTOR_BUCKETS - 1)]++;
+
+  if (n_vectors)
+    {
+      n_clocks /= n_vectors;
+      b = n_clocks ? min_log2 (n_clocks) : 0;
+      p->clocks_per_vector[clib_min
+			   (b, VLIB_NODE_PROFILE_N_CLOCK_BUCKETS - 1)]++;
+    }
 }
 
+void vlib_node_profile_enable_disable (vlib_main_t * vm, int enable);
+void vlib_node_profile_clear (vlib_main_t * vm);
+f64 vlib_node_profile_percentile (u64 * histogram, u32 n_buckets, f64 p);
+
 always_inline vlib_process_t *
 vlib_get_process_from_node (vlib_main_t * vm, vlib_node_t * node)
 {
@@ -1103,6 +1180,7 @@ clib_error_t *vlib_node_main_init (vlib_main_t * vm);
 format_function_t format_vlib_node_graph;
 format_function_t format_vlib_node_name;
 format_function_t format_vlib_next_node_name;
+format_function_t format_vlib_node_adaptive_bucket;
 format_function_t format_vlib_node_and_next;
 format_function_t format_vlib_cpu_time;
 format_function_t format_vlib_time;
@@ -58,6 +58,13 @@ typedef struct
 
   /* is fake physmem */
   u8 is_fake;
+
+  /* Physmem is split in n_numa_nodes parts of 1 << log2_numa_node_bytes,
+     part i on NUMA node i. Fake NUMA splits it the same way but leaves
+     the memory wherever the kernel put it. */
+  u8 is_fake_numa;
+  u32 n_numa_nodes;
+  u32 log2_numa_node_bytes;
 } vlib_physmem_main_t;
 
 always_inline u64
@@ -97,6 +104,15 @@ vlib_physmem_at_offset (vlib_physmem_main_t * pm, uword offset)
   return uword_to_pointer (pm->virtual.start + offset, void *);
 }
 
+/* NUMA node holding the memory at the given offset */
+always_inline u32
+vlib_physmem_numa_node_of_offset (vlib_physmem_main_t * pm, uword o)
+{
+  if (pm->n_numa_nodes <= 1)
+    return 0;
+  return o >> pm->log2_numa_node_bytes;
+}
+
 #endif /* included_vlib_physmem_h */
 
 /*
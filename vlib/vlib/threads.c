@@ -16,6 +16,9 @@
 
 #include <signal.h>
 #include <math.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/eventfd.h>
 #include <vppinfra/format.h>
 #include <vlib/vlib.h>
 
@@ -32,8 +35,6 @@
 #endif
 DECLARE_CJ_GLOBAL_LOG;
 
-#define FRAME_QUEUE_NELTS 32
-
 
 #if DPDK==1
 /*
@@ -310,34 +311,35 @@ vlib_alloc_thread (vlib_main_t * vm)
 }
 
 vlib_frame_queue_t *
-vlib_frame_queue_alloc (int nelts)
+vlib_frame_queue_alloc (int nelts, int n_producers)
 {
   vlib_frame_queue_t *fq;
+  vlib_frame_queue_ring_t *r;
+
+  if (nelts & (nelts - 1))
+    {
+      fformat (stderr, "FATAL: nelts MUST be a power of 2\n");
+      abort ();
+    }
 
   fq = clib_mem_alloc_aligned (sizeof (*fq), CLIB_CACHE_LINE_BYTES);
   memset (fq, 0, sizeof (*fq));
   fq->nelts = nelts;
   fq->vector_threshold = 128;	// packets
-  vec_validate_aligned (fq->elts, nelts - 1, CLIB_CACHE_LINE_BYTES);
 
-  if (1)
-    {
-      if (((uword) & fq->tail) & (CLIB_CACHE_LINE_BYTES - 1))
-	fformat (stderr, "WARNING: fq->tail unaligned\n");
-      if (((uword) & fq->head) & (CLIB_CACHE_LINE_BYTES - 1))
-	fformat (stderr, "WARNING: fq->head unaligned\n");
-      if (((uword) fq->elts) & (CLIB_CACHE_LINE_BYTES - 1))
-	fformat (stderr, "WARNING: fq->elts unaligned\n");
-
-      if (sizeof (fq->elts[0]) % CLIB_CACHE_LINE_BYTES)
-	fformat (stderr, "WARNING: fq->elts[0] size %d\n",
-		 sizeof (fq->elts[0]));
-      if (nelts & (nelts - 1))
-	{
-	  fformat (stderr, "FATAL: nelts MUST be a power of 2\n");
-	  abort ();
-	}
-    }
+  /* One ring per producer thread, so the fast path needs no atomics */
+  vec_validate_aligned (fq->rings, n_producers - 1, CLIB_CACHE_LINE_BYTES);
+  vec_foreach (r, fq->rings)
+  {
+    vec_validate_aligned (r->elts, nelts - 1, CLIB_CACHE_LINE_BYTES);
+
+    if (((uword) r->elts) & (CLIB_CACHE_LINE_BYTES - 1))
+      fformat (stderr, "WARNING: fq->elts unaligned\n");
+  }
+
+  if (sizeof (fq->rings[0].elts[0]) % CLIB_CACHE_LINE_BYTES)
+    fformat (stderr, "WARNING: fq->elts[0] size %d\n",
+	     sizeof (fq->rings[0].elts[0]));
 
   return (fq);
 }
@@ -549,6 +551,38 @@ vlib_launch_thread (void *fp, vlib_worker_thread_t * w, unsigned lcore_id)
     }
 }
 
+/* NUMA node whose physmem a thread allocates buffers from */
+static u32
+vlib_thread_numa_node (vlib_main_t * vm, u32 cpu_index, int lcore_id)
+{
+  vlib_physmem_main_t *pm = &vm->physmem_main;
+  struct dirent *e;
+  u8 *dir_name;
+  DIR *d;
+  u32 node = 0;
+
+  if (pm->n_numa_nodes <= 1)
+    return 0;
+
+  /* Fake NUMA: spread the threads over the nodes */
+  if (pm->is_fake_numa)
+    return cpu_index % pm->n_numa_nodes;
+
+  /* The cpu's directory links to its node, as nodeN */
+  dir_name = format (0, "/sys/devices/system/cpu/cpu%d%c", lcore_id, 0);
+  d = opendir ((char *) dir_name);
+  if (d)
+    {
+      while ((e = readdir (d)))
+	if (sscanf (e->d_name, "node%u", &node) == 1)
+	  break;
+      closedir (d);
+    }
+  vec_free (dir_name);
+
+  return node < pm->n_numa_nodes ? node : 0;
+}
+
 static clib_error_t *
 start_workers (vlib_main_t * vm)
 {
@@ -596,7 +630,7 @@ start_workers (vlib_main_t * vm)
 
       vec_validate (vlib_frame_queues, tm->n_vlib_mains - 1);
       _vec_len (vlib_frame_queues) = 0;
-      fq = vlib_frame_queue_alloc (FRAME_QUEUE_NELTS);
+      fq = vlib_frame_queue_alloc (FRAME_QUEUE_NELTS, tm->n_vlib_mains);
       vec_add1 (vlib_frame_queues, fq);
 
       vlib_worker_threads->wait_at_barrier =
@@ -608,6 +642,11 @@ start_workers (vlib_main_t * vm)
       *vlib_worker_threads->workers_at_barrier = 0;
       *vlib_worker_threads->wait_at_barrier = 1;
 
+      /* Workers copy the buffer free lists, make sure the default ones
+         and the depots shared by all threads exist first */
+      vlib_buffer_get_or_create_free_list
+	(vm, VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES, "default");
+
       worker_thread_index = 1;
 
       for (i = 0; i < vec_len (tm->registrations); i++)
@@ -645,23 +684,32 @@ start_workers (vlib_main_t * vm)
 	      if (tr->no_data_structure_clone)
 		continue;
 
+	      w->idle_sleep_us = tm->worker_idle_sleep_us;
+	      w->idle_wakeup_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	      if (w->idle_wakeup_fd < 0)
+		return clib_error_return_unix (0, "eventfd");
+
 	      /* Allocate "to-worker-N" frame queue */
 	      if (tr->frame_queue_nelts)
 		{
-		  fq = vlib_frame_queue_alloc (tr->frame_queue_nelts);
+		  fq = vlib_frame_queue_alloc (tr->frame_queue_nelts,
+					       tm->n_vlib_mains);
 		}
 	      else
 		{
-		  fq = vlib_frame_queue_alloc (FRAME_QUEUE_NELTS);
+		  fq = vlib_frame_queue_alloc (FRAME_QUEUE_NELTS,
+					       tm->n_vlib_mains);
 		}
 
+	      fq->thread_index = worker_thread_index;
 	      vec_validate (vlib_frame_queues, worker_thread_index);
 	      vlib_frame_queues[worker_thread_index] = fq;
 
 	      /* Fork vlib_global_main et al. Look for bugs here */
 	      oldheap = clib_mem_set_heap (w->thread_mheap);
 
-	      vm_clone = clib_mem_alloc (sizeof (*vm_clone));
+	      vm_clone = clib_mem_alloc_aligned (sizeof (*vm_clone),
+						CLIB_CACHE_LINE_BYTES);
 	      clib_memcpy (vm_clone, vlib_mains[0], sizeof (*vm_clone));
 
 	      vm_clone->cpu_index = worker_thread_index;
@@ -731,8 +779,13 @@ start_workers (vlib_main_t * vm)
 		vec_dup (vlib_mains[0]->error_main.counters_last_clear);
 
 	      /* Fork the vlib_buffer_main_t free lists, etc. */
-	      bm_clone = vec_dup (vm_clone->buffer_main);
+	      bm_clone = 0;
+	      vec_validate (bm_clone, 0);
+	      clib_memcpy (bm_clone, vm_clone->buffer_main, sizeof (*bm_clone));
 	      vm_clone->buffer_main = bm_clone;
+	      memset (&bm_clone->numa_stats, 0, sizeof (bm_clone->numa_stats));
+	      /* Caches are per thread, the depots are shared */
+	      bm_clone->caches = 0;
 
 	      orig_freelist_pool = bm_clone->buffer_free_list_pool;
 	      bm_clone->buffer_free_list_pool = 0;
@@ -815,6 +868,13 @@ start_workers (vlib_main_t * vm)
 /* *INDENT-ON* */
 	}
     }
+
+  /* Workers wait at the initial barrier, so before their first buffer */
+  vm->numa_node = vlib_thread_numa_node (vm, 0, tm->main_lcore);
+  for (i = 1; i < vec_len (vlib_mains); i++)
+    vlib_mains[i]->numa_node =
+      vlib_thread_numa_node (vm, i, vlib_worker_threads[i].lcore_id);
+
   vlib_worker_thread_barrier_sync (vm);
   vlib_worker_thread_barrier_release (vm);
   return 0;
@@ -832,6 +892,9 @@ vlib_worker_thread_node_runtime_update (void)
   vlib_node_t **old_nodes_clone;
   vlib_main_t *vm_clone;
   vlib_node_runtime_t *rt, *old_rt;
+  u16 mode_flags = (VLIB_NODE_FLAG_ADAPTIVE_MODE
+		    | VLIB_NODE_FLAG_SWITCH_FROM_INTERRUPT_TO_POLLING_MODE
+		    | VLIB_NODE_FLAG_SWITCH_FROM_POLLING_TO_INTERRUPT_MODE);
   void *oldheap;
   never_inline void
     vlib_node_runtime_sync_stats (vlib_main_t * vm,
@@ -948,8 +1011,13 @@ vlib_worker_thread_node_runtime_update (void)
 			   &old_n_clone->stats_last_clear,
 			   sizeof (new_n_clone->stats_last_clear));
 
-	      /* keep previous node state */
+	      /* keep previous node state, adaptive mode is per thread */
 	      new_n_clone->state = old_n_clone->state;
+	      new_n_clone->flags &= ~VLIB_NODE_FLAG_ADAPTIVE_MODE;
+	      new_n_clone->flags |=
+		old_n_clone->flags & VLIB_NODE_FLAG_ADAPTIVE_MODE;
+	      clib_memcpy (&new_n_clone->adaptive, &old_n_clone->adaptive,
+			   sizeof (new_n_clone->adaptive));
 	    }
 	  vec_add1 (nm_clone->nodes, new_n_clone);
 	}
@@ -963,7 +1031,7 @@ vlib_worker_thread_node_runtime_update (void)
       nm_clone->nodes_by_type[VLIB_NODE_TYPE_INTERNAL] =
 	vec_dup (nm->nodes_by_type[VLIB_NODE_TYPE_INTERNAL]);
 
-      /* clone input node runtime */
+      /* clone input node runtime, keeping the per thread mode flags */
       old_rt = nm_clone->nodes_by_type[VLIB_NODE_TYPE_INPUT];
 
       nm_clone->nodes_by_type[VLIB_NODE_TYPE_INPUT] =
@@ -978,6 +1046,7 @@ vlib_worker_thread_node_runtime_update (void)
 	{
 	  rt = vlib_node_get_runtime (vm_clone, old_rt[j].node_index);
 	  rt->state = old_rt[j].state;
+	  rt->flags = (rt->flags & ~mode_flags) | (old_rt[j].flags & mode_flags);
 	}
 
       vec_free (old_rt);
@@ -1080,6 +1149,8 @@ cpu_config (vlib_main_t * vm, unformat_input_t * input)
 	;
       else if (unformat (input, "scheduler-priority %u", &tm->sched_priority))
 	;
+      else if (unformat (input, "idle-sleep %u", &tm->worker_idle_sleep_us))
+	;
       else if (unformat (input, "%s %u", &name, &count))
 	{
 	  p = hash_get_mem (tm->thread_registrations_by_name, name);
@@ -1178,11 +1249,33 @@ vlib_worker_thread_fork_fixup (vlib_fork_fixup_t which)
   vlib_worker_thread_barrier_release (vm);
 }
 
+static void
+vlib_worker_thread_barrier_hold_stats (vlib_main_t * vm)
+{
+  vlib_thread_main_t *tm = &vlib_thread_main;
+  f64 hold;
+  u32 bucket;
+
+  /* Workers were held from the sync request until now */
+  hold = (clib_cpu_time_now () - tm->barrier_sync_start)
+    * vm->clib_time.seconds_per_clock;
+
+  tm->barrier_hold_count++;
+  tm->barrier_hold_total += hold;
+  if (hold > tm->barrier_hold_max)
+    tm->barrier_hold_max = hold;
+
+  bucket = hold < 1e-6 ? 0 : 1 + min_log2 ((u64) (hold * 1e6));
+  if (bucket >= VLIB_BARRIER_HOLD_HISTOGRAM_N_BUCKETS)
+    bucket = VLIB_BARRIER_HOLD_HISTOGRAM_N_BUCKETS - 1;
+  tm->barrier_hold_histogram[bucket]++;
+}
+
 void
 vlib_worker_thread_barrier_sync (vlib_main_t * vm)
 {
   f64 deadline;
-  u32 count;
+  u32 count, i;
 
   if (!vlib_mains)
     return;
@@ -1198,8 +1291,14 @@ vlib_worker_thread_barrier_sync (vlib_main_t * vm)
   ASSERT (os_get_cpu_number () == 0);
 
   deadline = vlib_time_now (vm) + BARRIER_SYNC_TIMEOUT;
+  vlib_thread_main.barrier_sync_start = clib_cpu_time_now ();
 
   *vlib_worker_threads->wait_at_barrier = 1;
+
+  /* Idle sleeping workers would only notice at their next timeout */
+  for (i = 1; i <= count; i++)
+    vlib_worker_thread_idle_wakeup (i);
+
   while (*vlib_worker_threads->workers_at_barrier != count)
     {
       if (vlib_time_now (vm) > deadline)
@@ -1233,18 +1332,134 @@ vlib_worker_thread_barrier_release (vlib_main_t * vm)
 	  os_panic ();
 	}
     }
+
+  vlib_worker_thread_barrier_hold_stats (vm);
+}
+
+/* Start a new epoch, returning it. Also orders the caller's unpublish
+   stores before any worker can announce the new epoch. */
+u64
+vlib_worker_thread_epoch_advance (void)
+{
+  return __sync_add_and_fetch (&vlib_thread_main.epoch, 1);
+}
+
+/* True once every worker has announced a quiescent state in epoch */
+int
+vlib_worker_thread_epoch_is_safe (u64 epoch)
+{
+  int i;
+
+  /* Workers parked at the barrier hold no references */
+  if (vec_len (vlib_mains) > 1 && vlib_worker_threads[0].recursion_level)
+    return 1;
+
+  /* A worker in idle sleep holds no references either */
+  for (i = 1; i < vec_len (vlib_mains); i++)
+    if (vlib_mains[i] && vlib_mains[i]->quiescent_epoch < epoch
+	&& !vlib_worker_threads[i].idle_sleeping)
+      return 0;
+
+  return 1;
+}
+
+void
+vlib_worker_thread_defer_call (void (*function) (void *), void *arg)
+{
+  vlib_thread_main_t *tm = &vlib_thread_main;
+  vlib_worker_thread_deferred_call_t *dc;
+
+  ASSERT (os_get_cpu_number () == 0);
+
+  /* No workers, or workers parked at the barrier: nobody can see it */
+  if (vec_len (vlib_mains) <= 1 || vlib_worker_threads[0].recursion_level)
+    {
+      function (arg);
+      return;
+    }
+
+  vec_add2 (tm->deferred_calls, dc, 1);
+  dc->epoch = vlib_worker_thread_epoch_advance ();
+  dc->function = function;
+  dc->arg = arg;
+}
+
+void
+vlib_worker_thread_defer_free (void *p)
+{
+  vlib_worker_thread_defer_call (clib_mem_free, p);
+}
+
+/*
+ * Run the deferred calls whose grace period has ended. Called from
+ * the main loop; calls are in epoch order, so stop at the first one
+ * that is not safe yet.
+ */
+void
+vlib_worker_thread_run_deferred_calls (vlib_main_t * vm)
+{
+  vlib_thread_main_t *tm = &vlib_thread_main;
+  vlib_worker_thread_deferred_call_t dc;
+  u64 safe_epoch = tm->epoch;
+  u32 i, n_ripe;
+
+  for (i = 1; i < vec_len (vlib_mains); i++)
+    if (vlib_mains[i] && vlib_mains[i]->quiescent_epoch < safe_epoch)
+      safe_epoch = vlib_mains[i]->quiescent_epoch;
+
+  for (n_ripe = 0; n_ripe < vec_len (tm->deferred_calls); n_ripe++)
+    if (tm->deferred_calls[n_ripe].epoch > safe_epoch)
+      break;
+
+  if (n_ripe == 0)
+    return;
+
+  /* Calls may defer more calls, which land after the ripe ones */
+  for (i = 0; i < n_ripe; i++)
+    {
+      dc = tm->deferred_calls[i];
+      dc.function (dc.arg);
+    }
+  vec_delete (tm->deferred_calls, n_ripe, 0);
+}
+
+/*
+ * Wait until every worker has passed a quiescent state, without
+ * stopping them. For writers which must reuse memory immediately.
+ */
+void
+vlib_worker_thread_wait_grace_period (vlib_main_t * vm)
+{
+  f64 deadline;
+  u64 epoch;
+
+  if (vec_len (vlib_mains) <= 1 || vlib_worker_threads[0].recursion_level)
+    return;
+
+  epoch = vlib_worker_thread_epoch_advance ();
+  deadline = vlib_time_now (vm) + BARRIER_SYNC_TIMEOUT;
+
+  while (!vlib_worker_thread_epoch_is_safe (epoch))
+    {
+      if (vlib_time_now (vm) > deadline)
+	{
+	  fformat (stderr, "%s: worker thread deadlock\n", __FUNCTION__);
+	  os_panic ();
+	}
+    }
 }
 
 /*
- * Check the frame queue to see if any frames are available.
+ * Check the frame queue rings to see if any frames are available.
  * If so, pull the packets off the frames and put them to
- * the handoff node.
+ * the given node, the handoff node for a thread's own queue.
  */
 static inline int
-vlib_frame_queue_dequeue_internal (vlib_main_t * vm)
+vlib_frame_queue_dequeue_internal (vlib_main_t * vm, vlib_frame_queue_t * fq,
+				   u32 node_index)
 {
   u32 thread_id = vm->cpu_index;
-  vlib_frame_queue_t *fq = vlib_frame_queues[thread_id];
+  vlib_frame_queue_ring_t *r;
   vlib_frame_queue_elt_t *elt;
   u32 *from, *to;
   vlib_frame_t *f;
@@ -1252,12 +1467,14 @@ vlib_frame_queue_dequeue_internal (vlib_main_t * vm)
   int processed = 0;
   u32 n_left_to_node;
   u32 vectors = 0;
+  u32 n_rings, ring_index, i;
+  u64 head;
   vlib_thread_main_t *tm = vlib_get_thread_main ();
 
   ASSERT (fq);
   ASSERT (vm == vlib_mains[thread_id]);
 
-  if (PREDICT_FALSE (tm->handoff_dispatch_node_index == ~0))
+  if (PREDICT_FALSE (node_index == ~0))
     return 0;
   /*
    * Gather trace data for frame queues
@@ -1271,9 +1488,13 @@ vlib_frame_queue_dequeue_internal (vlib_main_t * vm)
       fqt = &tm->frame_queue_traces[thread_id];
 
       fqt->nelts = fq->nelts;
-      fqt->head = fq->head;
-      fqt->head_hint = fq->head_hint;
-      fqt->tail = fq->tail;
+      fqt->head = fqt->tail = 0;
+      vec_foreach (r, fq->rings)
+      {
+	fqt->head += r->head;
+	fqt->tail += r->tail_published;
+      }
+      fqt->backlog = fq->dequeue_backlog_events;
       fqt->threshold = fq->vector_threshold;
       fqt->n_in_use = fqt->tail - fqt->head;
       if (fqt->n_in_use >= fqt->nelts)
@@ -1286,102 +1507,221 @@ vlib_frame_queue_dequeue_internal (vlib_main_t * vm)
       fqh = &tm->frame_queue_histogram[thread_id];
       fqh->count[fqt->n_in_use]++;
 
-      /* Record a snapshot of the elements in use */
+      /* Record a snapshot of the ring to be served next */
+      r = fq->rings + fq->next_ring;
       for (elix = 0; elix < fqt->nelts; elix++)
 	{
-	  elt = fq->elts + ((fq->head + 1 + elix) & (fq->nelts - 1));
-	  if (1 || elt->valid)
-	    {
-	      fqt->n_vectors[elix] = elt->n_vectors;
-	    }
+	  elt = r->elts + ((r->head + elix) & (fq->nelts - 1));
+	  fqt->n_vectors[elix] = elt->n_vectors;
 	}
       fqt->written = 1;
     }
 
-  while (1)
+  /* Serve each producer's ring in turn, resuming where we stopped */
+  n_rings = vec_len (fq->rings);
+  ring_index = fq->next_ring;
+
+  for (i = 0; i < n_rings; i++)
     {
-      if (fq->head == fq->tail)
-	{
-	  fq->head_hint = fq->head;
-	  return processed;
-	}
+      r = fq->rings + ring_index;
+      if (++ring_index == n_rings)
+	ring_index = 0;
 
-      elt = fq->elts + ((fq->head + 1) & (fq->nelts - 1));
+      head = r->head;
 
-      if (!elt->valid)
+      /* Only look at the producer's cache line when we run dry */
+      if (head == r->tail_cache)
 	{
-	  fq->head_hint = fq->head;
-	  return processed;
+	  r->tail_cache = r->tail_published;
+	  if (head == r->tail_cache)
+	    continue;
+	  CLIB_MEMORY_BARRIER ();
 	}
 
-      from = elt->buffer_index;
-      msg_type = elt->msg_type;
+      while (head != r->tail_cache)
+	{
+	  elt = r->elts + (head & (fq->nelts - 1));
 
-      ASSERT (msg_type == VLIB_FRAME_QUEUE_ELT_DISPATCH_FRAME);
-      ASSERT (elt->n_vectors <= VLIB_FRAME_SIZE);
+	  from = elt->buffer_index;
+	  msg_type = elt->msg_type;
 
-      f = vlib_get_frame_to_node (vm, tm->handoff_dispatch_node_index);
+	  ASSERT (msg_type == VLIB_FRAME_QUEUE_ELT_DISPATCH_FRAME);
+	  ASSERT (elt->n_vectors <= VLIB_FRAME_SIZE);
 
-      to = vlib_frame_vector_args (f);
+	  f = vlib_get_frame_to_node (vm, node_index);
 
-      n_left_to_node = elt->n_vectors;
+	  to = vlib_frame_vector_args (f);
 
-      while (n_left_to_node >= 4)
-	{
-	  to[0] = from[0];
-	  to[1] = from[1];
-	  to[2] = from[2];
-	  to[3] = from[3];
-	  to += 4;
-	  from += 4;
-	  n_left_to_node -= 4;
-	}
+	  n_left_to_node = elt->n_vectors;
 
-      while (n_left_to_node > 0)
-	{
-	  to[0] = from[0];
-	  to++;
-	  from++;
-	  n_left_to_node--;
-	}
+	  while (n_left_to_node >= 4)
+	    {
+	      to[0] = from[0];
+	      to[1] = from[1];
+	      to[2] = from[2];
+	      to[3] = from[3];
+	      to += 4;
+	      from += 4;
+	      n_left_to_node -= 4;
+	    }
 
-      vectors += elt->n_vectors;
-      f->n_vectors = elt->n_vectors;
-      vlib_put_frame_to_node (vm, tm->handoff_dispatch_node_index, f);
+	  while (n_left_to_node > 0)
+	    {
+	      to[0] = from[0];
+	      to++;
+	      from++;
+	      n_left_to_node--;
+	    }
 
-      elt->valid = 0;
-      elt->n_vectors = 0;
-      elt->msg_type = 0xfefefefe;
+	  vectors += elt->n_vectors;
+	  r->dequeue_vectors += elt->n_vectors;
+	  f->n_vectors = elt->n_vectors;
+	  vlib_put_frame_to_node (vm, node_index, f);
+
+	  elt->n_vectors = 0;
+	  elt->msg_type = 0xfefefefe;
+	  head++;
+	  r->dequeues++;
+	  processed++;
+
+	  /*
+	   * Limit the number of packets pushed into the graph
+	   */
+	  if (vectors >= fq->vector_threshold)
+	    break;
+	}
+
+      /* Hand the elements back to the producer, one store per pass */
       CLIB_MEMORY_BARRIER ();
-      fq->head++;
-      processed++;
+      r->head = head;
 
-      /*
-       * Limit the number of packets pushed into the graph
-       */
       if (vectors >= fq->vector_threshold)
 	{
-	  fq->head_hint = fq->head;
-	  return processed;
+	  if (head != r->tail_cache)
+	    fq->dequeue_backlog_events++;
+	  break;
 	}
     }
-  ASSERT (0);
+
+  fq->next_ring = ring_index;
   return processed;
 }
 
+int
+vlib_frame_queue_dequeue_to_node (vlib_main_t * vm, vlib_frame_queue_t * fq,
+				  u32 node_index)
+{
+  return vlib_frame_queue_dequeue_internal (vm, fq, node_index);
+}
+
+void
+vlib_worker_thread_idle_kick (vlib_worker_thread_t * w)
+{
+  u64 one = 1;
+
+  /* Racy, but only the latency sample suffers */
+  if (w->idle_wakeup_time == 0)
+    w->idle_wakeup_time = clib_cpu_time_now ();
+
+  if (write (w->idle_wakeup_fd, &one, sizeof (one)) != sizeof (one))
+    clib_unix_warning ("idle wakeup");
+}
+
+static int
+vlib_frame_queue_is_empty (vlib_frame_queue_t * fq)
+{
+  vlib_frame_queue_ring_t *r;
+
+  vec_foreach (r, fq->rings)
+  {
+    if (r->head != r->tail_published)
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * Idle sleep. A worker none of whose input nodes is polling (they are
+ * disabled, or adaptive nodes now in interrupt mode) and which found no
+ * work for VLIB_WORKER_IDLE_LOOPS loops blocks on its eventfd for up to
+ * idle_sleep_us. Handoff publish and barrier sync kick the eventfd. On
+ * wakeup, adaptive nodes in interrupt mode get one dispatch, which is
+ * how drivers without interrupts notice new traffic.
+ */
+static void
+vlib_worker_thread_idle_sleep (vlib_main_t * vm, vlib_worker_thread_t * w)
+{
+  vlib_node_main_t *nm = &vm->node_main;
+  struct pollfd pfd;
+  struct timespec ts;
+  u64 t0, t1, wakeup_time, value;
+  int rv;
+
+  w->idle_sleeping = 1;
+  CLIB_MEMORY_BARRIER ();
+  if (*vlib_worker_threads->wait_at_barrier
+      || !vlib_frame_queue_is_empty (vlib_frame_queues[vm->cpu_index]))
+    {
+      w->idle_sleeping = 0;
+      return;
+    }
+
+  pfd.fd = w->idle_wakeup_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  ts.tv_sec = w->idle_sleep_us / 1000000;
+  ts.tv_nsec = (w->idle_sleep_us % 1000000) * 1000;
+
+  t0 = clib_cpu_time_now ();
+  rv = ppoll (&pfd, 1, &ts, 0);
+  t1 = clib_cpu_time_now ();
+
+  /* Our next loads must not pass this store, see epoch_is_safe */
+  w->idle_sleeping = 0;
+  CLIB_MEMORY_BARRIER ();
+
+  wakeup_time = w->idle_wakeup_time;
+  w->idle_wakeup_time = 0;
+
+  w->idle_sleeps++;
+  vlib_node_adaptive_histogram_add (vm, w->idle_sleep_histogram, t1 - t0);
+
+  if (rv > 0)
+    {
+      /* Non-blocking, resets the count */
+      if (read (w->idle_wakeup_fd, &value, sizeof (value)) < 0)
+	;
+      w->idle_wakeups++;
+      if (wakeup_time && wakeup_time < t1)
+	vlib_node_adaptive_histogram_add
+	  (vm, w->idle_wakeup_latency_histogram, t1 - wakeup_time);
+    }
+
+  if (nm->input_node_counts_by_state[VLIB_NODE_STATE_INTERRUPT])
+    vlib_node_adaptive_poll_interrupt_nodes (vm);
+}
+
 static_always_inline void
 vlib_worker_thread_internal (vlib_main_t * vm)
 {
   vlib_node_main_t *nm = &vm->node_main;
+  vlib_worker_thread_t *w = vlib_worker_threads + vm->cpu_index;
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
   u64 cpu_time_now = clib_cpu_time_now ();
+  u64 last_vectors_processed = 0;
+  u32 n_idle_loops = 0;
+  int n_dequeued;
 
   vec_alloc (nm->pending_interrupt_node_runtime_indices, 32);
 
   while (1)
     {
       vlib_worker_thread_barrier_check ();
+      vlib_worker_thread_quiescent (vm);
 
-      vlib_frame_queue_dequeue_internal (vm);
+      n_dequeued =
+	vlib_frame_queue_dequeue_internal (vm, vlib_frame_queues[vm->cpu_index],
+					   tm->handoff_dispatch_node_index);
 
       vlib_node_runtime_t *n;
       vec_foreach (n, nm->nodes_by_type[VLIB_NODE_TYPE_INPUT])
@@ -1429,6 +1769,20 @@ vlib_worker_thread_internal (vlib_main_t * vm)
 	}
       vlib_increment_main_loop_counter (vm);
 
+      if (PREDICT_FALSE (w->idle_sleep_us != 0))
+	{
+	  if (n_dequeued || vm->main_loop_vectors_processed
+	      != last_vectors_processed
+	      || nm->input_node_counts_by_state[VLIB_NODE_STATE_POLLING])
+	    n_idle_loops = 0;
+	  else if (++n_idle_loops >= VLIB_WORKER_IDLE_LOOPS)
+	    {
+	      vlib_worker_thread_idle_sleep (vm, w);
+	      n_idle_loops = 0;
+	    }
+	  last_vectors_processed = vm->main_loop_vectors_processed;
+	}
+
       /* Record time stamp in case there are no enabled nodes and above
          calls do not update time stamp. */
       cpu_time_now = clib_cpu_time_now ();
@@ -1450,7 +1804,10 @@ vlib_worker_thread_fn (void *arg)
 
   /* Wait until the dpdk init sequence is complete */
   while (tm->worker_thread_release == 0)
-    vlib_worker_thread_barrier_check ();
+    {
+      vlib_worker_thread_barrier_check ();
+      vlib_worker_thread_quiescent (vm);
+    }
 
   vlib_worker_thread_internal (vm);
 }
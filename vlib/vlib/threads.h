@@ -72,7 +72,6 @@ typedef enum
 
 typedef struct
 {
-  volatile u32 valid;
   u32 msg_type;
   u32 n_vectors;
   u32 last_n_vectors;
@@ -81,7 +80,7 @@ typedef struct
   u32 buffer_index[VLIB_FRAME_SIZE];
 
   /* Pad to a cache line boundary */
-  u8 pad[CLIB_CACHE_LINE_BYTES - 4 * sizeof (u32)];
+  u8 pad[CLIB_CACHE_LINE_BYTES - 3 * sizeof (u32)];
 }
 vlib_frame_queue_elt_t;
 
@@ -107,42 +106,122 @@ typedef struct
   long lwp;
   int lcore_id;
   pthread_t thread_id;
+
+  /* Idle sleep, see vlib_worker_thread_idle_sleep. Zero: never sleep */
+  u32 idle_sleep_us;
+  volatile u32 idle_sleeping;
+  int idle_wakeup_fd;
+
+  /* CPU time of the first wakeup request since the worker went idle */
+  volatile u64 idle_wakeup_time;
+
+  u64 idle_sleeps;
+  u64 idle_wakeups;
+  u64 idle_sleep_histogram[VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS];
+  u64 idle_wakeup_latency_histogram[VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS];
 } vlib_worker_thread_t;
 
 vlib_worker_thread_t *vlib_worker_threads;
 
+void vlib_worker_thread_idle_kick (vlib_worker_thread_t * w);
+
+/*
+ * Wake a worker sleeping in vlib_worker_thread_idle_sleep. Call after
+ * making work visible to it: the barrier here pairs with the one the
+ * worker issues between announcing its sleep and its last look for
+ * work, so either the worker sees the work or we see it sleeping.
+ */
+always_inline void
+vlib_worker_thread_idle_wakeup (u32 thread_index)
+{
+  vlib_worker_thread_t *w = vlib_worker_threads + thread_index;
+
+  if (PREDICT_TRUE (w->idle_sleep_us == 0))
+    return;
+
+  CLIB_MEMORY_BARRIER ();
+  if (w->idle_sleeping)
+    vlib_worker_thread_idle_kick (w);
+}
+
+/*
+ * Single producer, single consumer frame queue ring.
+ *
+ * There is one ring per (producer thread, consumer thread) pair, so
+ * neither side needs atomic operations. The producer fills elements at
+ * its private tail and makes them visible to the consumer in batches by
+ * storing tail_published. The consumer drains up to tail_published and
+ * stores head once per pass. Each side keeps a cached copy of the other
+ * side's index, and only touches the shared cache line when the cached
+ * copy says the ring is full (producer) or empty (consumer).
+ */
 typedef struct
 {
-  /* enqueue side */
-  volatile u64 tail;
+  /* producer private */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u64 tail;
+  u64 head_cache;
   u64 enqueues;
-  u64 enqueue_ticks;
   u64 enqueue_vectors;
-  u32 enqueue_full_events;
-  u32 enqueue_efd_discards;
-  u8 pad2[CLIB_CACHE_LINE_BYTES - (2 * sizeof (u32)) - (4 * sizeof (u64))];
+  u64 enqueue_full_events;
+  u64 enqueue_full_ticks;
+  u64 enqueue_congested_events;
 
-  /* dequeue side */
+  /* written by the producer, read by the consumer */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  volatile u64 tail_published;
+
+  /* written by the consumer, read by the producer */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline2);
   volatile u64 head;
+
+  /* consumer private */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline3);
+  u64 tail_cache;
   u64 dequeues;
-  u64 dequeue_ticks;
   u64 dequeue_vectors;
-  u64 trace;
-  u64 vector_threshold;
-  u8 pad4[CLIB_CACHE_LINE_BYTES - (6 * sizeof (u64))];
-
-  /* dequeue hint to enqueue side */
-  volatile u64 head_hint;
-  u8 pad5[CLIB_CACHE_LINE_BYTES - sizeof (u64)];
 
   /* read-only, constant, shared */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline4);
   vlib_frame_queue_elt_t *elts;
+}
+vlib_frame_queue_ring_t;
+
+typedef struct
+{
+  /* read-mostly, shared */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /* Rings into this thread, indexed by producer thread index */
+  vlib_frame_queue_ring_t *rings;
   u32 nelts;
+
+  /* Consumer thread, woken by publish when idle sleeping */
+  u32 thread_index;
+  u64 trace;
+  u64 vector_threshold;
+
+  /* consumer private */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  u32 next_ring;
+
+  /* Dequeue stopped at vector_threshold with frames still queued */
+  u64 dequeue_backlog_events;
 }
 vlib_frame_queue_t;
 
 vlib_frame_queue_t **vlib_frame_queues;
 
+#define FRAME_QUEUE_NELTS 32
+
+vlib_frame_queue_t *vlib_frame_queue_alloc (int nelts, int n_producers);
+
+always_inline vlib_frame_queue_ring_t *
+vlib_frame_queue_get_ring (vlib_frame_queue_t * fq, u32 producer_index)
+{
+  return vec_elt_at_index (fq->rings, producer_index);
+}
+
 /* Called early, in thread 0's context */
 clib_error_t *vlib_thread_init (vlib_main_t * vm);
 
@@ -155,6 +234,11 @@ int vlib_frame_queue_enqueue (vlib_main_t * vm, u32 node_runtime_index,
 int vlib_frame_queue_dequeue (int thread_id,
 			      vlib_main_t * vm, vlib_node_main_t * nm);
 
+/* Dequeue a queue's frames to a node, on the calling thread */
+int vlib_frame_queue_dequeue_to_node (vlib_main_t * vm,
+				      vlib_frame_queue_t * fq,
+				      u32 node_index);
+
 u64 dispatch_node (vlib_main_t * vm,
 		   vlib_node_runtime_t * node,
 		   vlib_node_type_t type,
@@ -181,9 +265,37 @@ void vlib_worker_thread_init (vlib_worker_thread_t * w);
 #define BARRIER_SYNC_TIMEOUT (1.0)
 #endif
 
+/* Loops without work before an idle sleep, see idle_sleep_us */
+#define VLIB_WORKER_IDLE_LOOPS 64
+
 void vlib_worker_thread_barrier_sync (vlib_main_t * vm);
 void vlib_worker_thread_barrier_release (vlib_main_t * vm);
 
+/*
+ * Quiescent state based reclamation, an alternative to the barrier for
+ * updates that readers can tolerate seeing half done. The writer
+ * unpublishes the old data, then defers its free. The deferred call
+ * runs on the main thread once every worker has passed the top of its
+ * dispatch loop, where it holds no references into the graph's data.
+ */
+typedef struct
+{
+  /* Runs once all workers have announced at least this epoch */
+  u64 epoch;
+  void (*function) (void *);
+  void *arg;
+} vlib_worker_thread_deferred_call_t;
+
+u64 vlib_worker_thread_epoch_advance (void);
+int vlib_worker_thread_epoch_is_safe (u64 epoch);
+void vlib_worker_thread_defer_call (void (*function) (void *), void *arg);
+void vlib_worker_thread_defer_free (void *p);
+void vlib_worker_thread_run_deferred_calls (vlib_main_t * vm);
+void vlib_worker_thread_wait_grace_period (vlib_main_t * vm);
+
+/* Barrier hold time histogram, log2 microseconds */
+#define VLIB_BARRIER_HOLD_HISTOGRAM_N_BUCKETS 22
+
 always_inline void
 vlib_smp_unsafe_warning (void)
 {
@@ -214,6 +326,71 @@ vlib_worker_thread_barrier_check (void)
     }
 }
 
+/* Make every element filled since the last publish visible */
+always_inline void
+vlib_frame_queue_ring_publish (vlib_frame_queue_t * fq,
+			       vlib_frame_queue_ring_t * r)
+{
+  if (r->tail != r->tail_published)
+    {
+      /* element contents before the tail store */
+      CLIB_MEMORY_BARRIER ();
+      r->tail_published = r->tail;
+      vlib_worker_thread_idle_wakeup (fq->thread_index);
+    }
+}
+
+/* Number of elements the producer may still fill without waiting */
+always_inline u32
+vlib_frame_queue_ring_n_free (vlib_frame_queue_t * fq,
+			      vlib_frame_queue_ring_t * r)
+{
+  if (r->tail - r->head_cache >= fq->nelts)
+    r->head_cache = r->head;
+  return fq->nelts - (r->tail - r->head_cache);
+}
+
+/*
+ * Return the element at the producer's tail. The element is owned by
+ * the producer until vlib_frame_queue_ring_put; it reaches the consumer
+ * at the next publish. Waits for the consumer when the ring is full.
+ */
+always_inline vlib_frame_queue_elt_t *
+vlib_frame_queue_ring_get (vlib_frame_queue_t * fq,
+			   vlib_frame_queue_ring_t * r)
+{
+  vlib_frame_queue_elt_t *elt;
+
+  if (PREDICT_FALSE (vlib_frame_queue_ring_n_free (fq, r) == 0))
+    {
+      u64 t0 = clib_cpu_time_now ();
+
+      /* Consumer can only free what it can see */
+      vlib_frame_queue_ring_publish (fq, r);
+      r->enqueue_full_events++;
+      while (vlib_frame_queue_ring_n_free (fq, r) == 0)
+	vlib_worker_thread_barrier_check ();
+      r->enqueue_full_ticks += clib_cpu_time_now () - t0;
+    }
+
+  elt = r->elts + (r->tail & (fq->nelts - 1));
+  elt->msg_type = VLIB_FRAME_QUEUE_ELT_DISPATCH_FRAME;
+  elt->last_n_vectors = elt->n_vectors = 0;
+
+  return elt;
+}
+
+always_inline void
+vlib_frame_queue_ring_put (vlib_frame_queue_t * fq,
+			   vlib_frame_queue_ring_t * r,
+			   vlib_frame_queue_elt_t * elt)
+{
+  ASSERT (elt == r->elts + (r->tail & (fq->nelts - 1)));
+  r->enqueues++;
+  r->enqueue_vectors += elt->n_vectors;
+  r->tail++;
+}
+
 #define foreach_vlib_main(body)			                        \
 do {                                                                    \
     vlib_main_t ** __vlib_mains = 0, *this_vlib_main;                   \
@@ -337,10 +514,36 @@ typedef struct
   /* scheduling policy priority */
   u32 sched_priority;
 
+  /* idle sleep for new workers, microseconds, zero: never sleep */
+  u32 worker_idle_sleep_us;
+
+  /* barrier hold time statistics */
+  u64 barrier_sync_start;
+  u64 barrier_hold_count;
+  f64 barrier_hold_total;
+  f64 barrier_hold_max;
+  u64 barrier_hold_histogram[VLIB_BARRIER_HOLD_HISTOGRAM_N_BUCKETS];
+
+  /* deferred calls, oldest first */
+  vlib_worker_thread_deferred_call_t *deferred_calls;
+
+  /* current epoch, read by every worker once per loop */
+  CLIB_CACHE_LINE_ALIGN_MARK (epoch_cacheline);
+  volatile u64 epoch;
 } vlib_thread_main_t;
 
 vlib_thread_main_t vlib_thread_main;
 
+/*
+ * Announce a quiescent state. Called at the top of the worker dispatch
+ * loop, after the previous iteration's node functions have returned.
+ */
+always_inline void
+vlib_worker_thread_quiescent (vlib_main_t * vm)
+{
+  vm->quiescent_epoch = vlib_thread_main.epoch;
+}
+
 #define VLIB_REGISTER_THREAD(x,...)                     \
   __VA_ARGS__ vlib_thread_registration_t x;             \
 static void __vlib_add_thread_registration_##x (void)   \
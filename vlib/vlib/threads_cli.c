@@ -149,6 +149,165 @@ VLIB_CLI_COMMAND (show_threads_command, static) = {
 };
 /* *INDENT-ON* */
 
+static u8 *
+format_barrier_hold_bucket (u8 * s, va_list * args)
+{
+  u32 i = va_arg (*args, u32);
+
+  if (i == 0)
+    return format (s, "< 1 us");
+  if (i == VLIB_BARRIER_HOLD_HISTOGRAM_N_BUCKETS - 1)
+    return format (s, ">= %lld us", 1ULL << (i - 1));
+  return format (s, "%lld - %lld us", 1ULL << (i - 1), (1ULL << i) - 1);
+}
+
+/*
+ * Display how long the workers have been held at the barrier, and
+ * the state of the deferred (quiescent state) calls. Both commands
+ * are mp-safe so that looking does not add a barrier sample.
+ */
+static clib_error_t *
+show_threads_barrier_fn (vlib_main_t * vm,
+			 unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  u32 i;
+
+  vlib_cli_output (vm, "Barrier holds %lld, total %.6f sec, "
+		   "average %.3f us, max %.3f us",
+		   tm->barrier_hold_count, tm->barrier_hold_total,
+		   tm->barrier_hold_count ?
+		   tm->barrier_hold_total * 1e6 / tm->barrier_hold_count : 0,
+		   tm->barrier_hold_max * 1e6);
+  vlib_cli_output (vm, "Epoch %lld, deferred calls pending %d",
+		   tm->epoch, vec_len (tm->deferred_calls));
+
+  if (tm->barrier_hold_count == 0)
+    return 0;
+
+  vlib_cli_output (vm, "%12s  %s", "Count", "Hold time");
+  for (i = 0; i < VLIB_BARRIER_HOLD_HISTOGRAM_N_BUCKETS; i++)
+    if (tm->barrier_hold_histogram[i])
+      vlib_cli_output (vm, "%12lld  %U", tm->barrier_hold_histogram[i],
+		       format_barrier_hold_bucket, i);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_threads_barrier_command, static) = {
+  .path = "show threads barrier",
+  .short_help = "show threads barrier",
+  .function = show_threads_barrier_fn,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+clear_threads_barrier_fn (vlib_main_t * vm,
+			  unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+
+  tm->barrier_hold_count = 0;
+  tm->barrier_hold_total = 0;
+  tm->barrier_hold_max = 0;
+  memset (tm->barrier_hold_histogram, 0, sizeof (tm->barrier_hold_histogram));
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (clear_threads_barrier_command, static) = {
+  .path = "clear threads barrier",
+  .short_help = "clear threads barrier",
+  .function = clear_threads_barrier_fn,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+set_threads_idle_sleep_fn (vlib_main_t * vm,
+			   unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  u32 usec;
+  int i;
+
+  if (unformat (input, "disable"))
+    usec = 0;
+  else if (!unformat (input, "%u", &usec))
+    return clib_error_return (0, "expected <usec> or disable, got `%U'",
+			      format_unformat_error, input);
+
+  /* Runs under the barrier, no worker is asleep */
+  tm->worker_idle_sleep_us = usec;
+  for (i = 1; i < vec_len (vlib_mains); i++)
+    vlib_worker_threads[i].idle_sleep_us = usec;
+
+  return 0;
+}
+
+/*?
+ * Let workers sleep when idle: a worker none of whose input nodes is
+ * polling, and which found no work for a few loops, blocks for up to
+ * <usec> microseconds or until a frame is handed off to it. Combine
+ * with <b>set node adaptive</b>. Also settable at startup with
+ * <b>cpu { idle-sleep <usec> }</b>.
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_threads_idle_sleep_command, static) = {
+  .path = "set threads idle-sleep",
+  .short_help = "set threads idle-sleep <usec> | disable",
+  .function = set_threads_idle_sleep_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+show_threads_idle_fn (vlib_main_t * vm,
+		      unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vlib_worker_thread_t *w;
+  int verbose = 0;
+  u32 i, j;
+
+  if (unformat (input, "verbose") || unformat (input, "v"))
+    verbose = 1;
+
+  vlib_cli_output (vm, "%-7s%-20s%=12s%=14s%=14s", "ID", "Name",
+		   "Sleep(us)", "Sleeps", "Wakeups");
+
+  for (i = 1; i < vec_len (vlib_mains); i++)
+    {
+      w = vlib_worker_threads + i;
+      vlib_cli_output (vm, "%-7d%-20v%=12d%=14lld%=14lld", i, w->name,
+		       w->idle_sleep_us, w->idle_sleeps, w->idle_wakeups);
+      if (!verbose)
+	continue;
+
+      vlib_cli_output (vm, "  time asleep:");
+      for (j = 0; j < VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS; j++)
+	if (w->idle_sleep_histogram[j])
+	  vlib_cli_output (vm, "    %-20U %lld",
+			   format_vlib_node_adaptive_bucket, j,
+			   w->idle_sleep_histogram[j]);
+      vlib_cli_output (vm, "  wakeup latency:");
+      for (j = 0; j < VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS; j++)
+	if (w->idle_wakeup_latency_histogram[j])
+	  vlib_cli_output (vm, "    %-20U %lld",
+			   format_vlib_node_adaptive_bucket, j,
+			   w->idle_wakeup_latency_histogram[j]);
+    }
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_threads_idle_command, static) = {
+  .path = "show threads idle",
+  .short_help = "show threads idle [verbose]",
+  .function = show_threads_idle_fn,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
 /*
  * Trigger threads to grab frame queue trace data
  */
@@ -313,8 +472,8 @@ show_frame_queue_internal (vlib_main_t * vm, u32 histogram)
 	  vlib_cli_output (vm,
 			   "  vector-threshold %d  ring size %d  in use %d\n",
 			   fqt->threshold, fqt->nelts, fqt->n_in_use);
-	  vlib_cli_output (vm, "  head %12d  head_hint %12d  tail %12d\n",
-			   fqt->head, fqt->head_hint, fqt->tail);
+	  vlib_cli_output (vm, "  head %12d  tail %12d  backlog %12d\n",
+			   fqt->head, fqt->tail, fqt->backlog);
 	  vlib_cli_output (vm,
 			   "  %3d %3d %3d %3d %3d %3d %3d %3d %3d %3d %3d %3d %3d %3d %3d %3d\n",
 			   fqt->n_vectors[0], fqt->n_vectors[1],
@@ -376,6 +535,98 @@ VLIB_CLI_COMMAND (cmd_show_frame_queue_histogram,static) = {
 /* *INDENT-ON* */
 
 
+/*
+ * Display per-ring enqueue and dequeue counters. Full events and
+ * wait clocks are backpressure seen by the producer, backlog events
+ * are dequeues cut short by the vector threshold.
+ */
+static clib_error_t *
+show_frame_queue_counters (vlib_main_t * vm, unformat_input_t * input,
+			   vlib_cli_command_t * cmd)
+{
+  vlib_frame_queue_t *fq;
+  vlib_frame_queue_ring_t *r;
+  u32 fqix;
+
+  if (vec_len (vlib_frame_queues) == 0)
+    {
+      vlib_cli_output (vm, "No frame queues exist\n");
+      return 0;
+    }
+
+  for (fqix = 0; fqix < vec_len (vlib_frame_queues); fqix++)
+    {
+      fq = vlib_frame_queues[fqix];
+      if (fq == 0)
+	continue;
+
+      vlib_cli_output (vm, "Thread %d %v: backlog events %lld\n", fqix,
+		       vlib_worker_threads[fqix].name,
+		       fq->dequeue_backlog_events);
+      vlib_cli_output (vm, "  %6s %12s %12s %12s %12s %10s %10s %6s",
+		       "from", "enqueues", "vectors", "dequeues",
+		       "full", "full-clks", "congested", "in-use");
+
+      vec_foreach (r, fq->rings)
+      {
+	if (r->enqueues == 0 && r->enqueue_congested_events == 0)
+	  continue;
+	vlib_cli_output (vm,
+			 "  %6d %12lld %12lld %12lld %12lld %10lld %10lld %6lld",
+			 r - fq->rings, r->enqueues, r->enqueue_vectors,
+			 r->dequeues, r->enqueue_full_events,
+			 r->enqueue_full_ticks, r->enqueue_congested_events,
+			 r->tail_published - r->head);
+      }
+    }
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (cmd_show_frame_queue_counters,static) = {
+    .path = "show frame-queue counters",
+    .short_help = "show frame-queue counters",
+    .function = show_frame_queue_counters,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+clear_frame_queue_counters (vlib_main_t * vm, unformat_input_t * input,
+			    vlib_cli_command_t * cmd)
+{
+  vlib_frame_queue_ring_t *r;
+  u32 fqix;
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  for (fqix = 0; fqix < vec_len (vlib_frame_queues); fqix++)
+    {
+      if (vlib_frame_queues[fqix] == 0)
+	continue;
+      vlib_frame_queues[fqix]->dequeue_backlog_events = 0;
+      vec_foreach (r, vlib_frame_queues[fqix]->rings)
+      {
+	r->enqueues = r->enqueue_vectors = 0;
+	r->enqueue_full_events = r->enqueue_full_ticks = 0;
+	r->enqueue_congested_events = 0;
+	r->dequeues = r->dequeue_vectors = 0;
+      }
+    }
+
+  vlib_worker_thread_barrier_release (vm);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (cmd_clear_frame_queue_counters,static) = {
+    .path = "clear frame-queue counters",
+    .short_help = "clear frame-queue counters",
+    .function = clear_frame_queue_counters,
+};
+/* *INDENT-ON* */
+
+
 /*
  * Modify the number of elements on the frame_queues
  */
@@ -401,11 +652,33 @@ test_frame_queue_nelts (vlib_main_t * vm, unformat_input_t * input,
       return error;
     }
 
+  /* Ring indices are masked with nelts, so only resize empty rings */
+  vlib_worker_thread_barrier_sync (vm);
+
+  for (fqix = 0; fqix < num_fq; fqix++)
+    {
+      vlib_frame_queue_t *fq = vlib_frame_queues[fqix];
+      vlib_frame_queue_ring_t *r;
+
+      vec_foreach (r, fq->rings)
+      {
+	if (nelts > vec_len (r->elts))
+	  error = clib_error_return (0, "thread %d: ring size is %d",
+				     fqix, vec_len (r->elts));
+	else if (r->head != r->tail)
+	  error = clib_error_return (0, "thread %d: frame queue busy", fqix);
+	if (error)
+	  goto done;
+      }
+    }
+
   for (fqix = 0; fqix < num_fq; fqix++)
     {
       vlib_frame_queues[fqix]->nelts = nelts;
     }
 
+done:
+  vlib_worker_thread_barrier_release (vm);
   return error;
 }
 
@@ -466,6 +739,329 @@ VLIB_CLI_COMMAND (cmd_test_frame_queue_threshold,static) = {
 /* *INDENT-ON* */
 
 
+/*
+ * Frame queue handoff benchmark. Producer pthreads hand elements round
+ * robin to every worker thread through their own ring of a test queue,
+ * and publish once per batch, like a handoff node does once per
+ * dispatch. The workers poll their test queue from an input node which
+ * runs the dequeue the handoff path uses, into a sink node. Elements
+ * carry their enqueue time, so the sink measures the latency the queue
+ * adds.
+ */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  struct frame_queue_test_main_t *ftm;
+  pthread_t thread;
+  u32 index;
+  u64 n_elts;
+  u64 n_vectors;
+  u64 latency;
+} frame_queue_test_thread_t;
+
+typedef struct frame_queue_test_main_t
+{
+  /* One queue per worker, with one ring per producer */
+  vlib_frame_queue_t **fqs;
+  frame_queue_test_thread_t *producers;
+  /* Indexed by worker, cpu_index - 1 */
+  frame_queue_test_thread_t *consumers;
+  u32 n_elts;
+  u32 n_vectors;
+  u32 batch;
+  u32 yield;
+  volatile u32 go;
+} frame_queue_test_main_t;
+
+static frame_queue_test_main_t frame_queue_test_main;
+
+static inline void
+frame_queue_test_pause (frame_queue_test_main_t * ftm)
+{
+  if (ftm->yield)
+    sched_yield ();
+}
+
+static void
+frame_queue_test_publish (frame_queue_test_main_t * ftm, u32 producer)
+{
+  vlib_frame_queue_t **fqp;
+
+  vec_foreach (fqp, ftm->fqs)
+    vlib_frame_queue_ring_publish (*fqp, vlib_frame_queue_get_ring (*fqp,
+								    producer));
+}
+
+static void *
+frame_queue_test_producer (void *arg)
+{
+  frame_queue_test_thread_t *t = arg;
+  frame_queue_test_main_t *ftm = t->ftm;
+  u32 n_consumers = vec_len (ftm->fqs);
+  u32 consumer = t->index % n_consumers;
+  vlib_frame_queue_t *fq;
+  vlib_frame_queue_ring_t *r;
+  vlib_frame_queue_elt_t *elt;
+  u64 now;
+  u32 i;
+
+  while (ftm->go == 0)
+    ;
+
+  for (i = 0; i < ftm->n_elts; i++)
+    {
+      fq = ftm->fqs[consumer];
+      r = vlib_frame_queue_get_ring (fq, t->index);
+
+      /* Not vlib_frame_queue_ring_get, a pthread can't join the barrier */
+      if (PREDICT_FALSE (vlib_frame_queue_ring_n_free (fq, r) == 0))
+	{
+	  vlib_frame_queue_ring_publish (fq, r);
+	  r->enqueue_full_events++;
+	  while (vlib_frame_queue_ring_n_free (fq, r) == 0)
+	    frame_queue_test_pause (ftm);
+	}
+
+      elt = r->elts + (r->tail & (fq->nelts - 1));
+      elt->msg_type = VLIB_FRAME_QUEUE_ELT_DISPATCH_FRAME;
+      elt->n_vectors = ftm->n_vectors;
+      now = clib_cpu_time_now ();
+      elt->buffer_index[0] = now;
+      elt->buffer_index[1] = now >> 32;
+      vlib_frame_queue_ring_put (fq, r, elt);
+
+      t->n_elts++;
+      t->n_vectors += elt->n_vectors;
+
+      if (++consumer == n_consumers)
+	consumer = 0;
+      if ((i + 1) % ftm->batch == 0)
+	frame_queue_test_publish (ftm, t->index);
+    }
+
+  frame_queue_test_publish (ftm, t->index);
+  return 0;
+}
+
+static uword
+frame_queue_test_sink_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+			       vlib_frame_t * frame)
+{
+  frame_queue_test_main_t *ftm = &frame_queue_test_main;
+  frame_queue_test_thread_t *t =
+    vec_elt_at_index (ftm->consumers, vm->cpu_index - 1);
+  u32 *from = vlib_frame_vector_args (frame);
+
+  /* Each frame is one element, its first indices hold the enqueue time */
+  t->latency += clib_cpu_time_now () - (from[0] | ((u64) from[1] << 32));
+  t->n_vectors += frame->n_vectors;
+  t->n_elts++;
+  return frame->n_vectors;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (frame_queue_test_sink_node,static) = {
+  .function = frame_queue_test_sink_node_fn,
+  .name = "frame-queue-test-sink",
+  .vector_size = sizeof (u32),
+};
+/* *INDENT-ON* */
+
+static uword
+frame_queue_test_input_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+				vlib_frame_t * frame)
+{
+  frame_queue_test_main_t *ftm = &frame_queue_test_main;
+
+  return vlib_frame_queue_dequeue_to_node (vm, ftm->fqs[vm->cpu_index - 1],
+					   frame_queue_test_sink_node.index);
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (frame_queue_test_input_node,static) = {
+  .function = frame_queue_test_input_node_fn,
+  .name = "frame-queue-test-input",
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_DISABLED,
+};
+/* *INDENT-ON* */
+
+static void
+frame_queue_test_set_state (vlib_node_state_t state)
+{
+  int i;
+
+  vlib_worker_thread_barrier_sync (vlib_mains[0]);
+  for (i = 1; i < vec_len (vlib_mains); i++)
+    vlib_node_set_state (vlib_mains[i], frame_queue_test_input_node.index,
+			 state);
+  vlib_worker_thread_barrier_release (vlib_mains[0]);
+}
+
+static clib_error_t *
+test_frame_queue_handoff (vlib_main_t * vm, unformat_input_t * input,
+			  vlib_cli_command_t * cmd)
+{
+  frame_queue_test_main_t *ftm = &frame_queue_test_main;
+  frame_queue_test_thread_t *t;
+  vlib_frame_queue_ring_t *r;
+  clib_error_t *error = 0;
+  u32 n_producers = ~0, nelts = FRAME_QUEUE_NELTS;
+  u32 n_consumers, n_started = 0, i;
+  u64 n_elts = 0, n_vectors = 0, n_sent = 0, latency = 0, full = 0;
+  f64 t0 = 0, dt, deadline;
+
+  if (vec_len (vlib_mains) <= 1)
+    return clib_error_return (0, "needs worker threads");
+  if (ftm->fqs)
+    return clib_error_return (0, "test already running");
+
+  memset (ftm, 0, sizeof (*ftm));
+  ftm->n_elts = 1 << 20;
+  ftm->n_vectors = 64;
+  ftm->batch = 4;
+  n_consumers = vec_len (vlib_mains) - 1;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "producers %d", &n_producers))
+	;
+      else if (unformat (input, "frames %d", &ftm->n_elts))
+	;
+      else if (unformat (input, "vectors %d", &ftm->n_vectors))
+	;
+      else if (unformat (input, "batch %d", &ftm->batch))
+	;
+      else if (unformat (input, "nelts %d", &nelts))
+	;
+      else if (unformat (input, "yield"))
+	ftm->yield = 1;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_producers == ~0)
+    n_producers = n_consumers;
+  if (n_producers == 0)
+    return clib_error_return (0, "need at least 1 producer");
+  if (nelts < 2 || (nelts & (nelts - 1)))
+    return clib_error_return (0, "nelts must be a power of 2");
+  if (ftm->n_vectors < 2 || ftm->n_vectors > VLIB_FRAME_SIZE)
+    return clib_error_return (0, "vectors must be 2 to %d",
+			      VLIB_FRAME_SIZE);
+  if (ftm->batch == 0)
+    ftm->batch = 1;
+
+  for (i = 0; i < n_consumers; i++)
+    {
+      vec_add1 (ftm->fqs, vlib_frame_queue_alloc (nelts, n_producers));
+      ftm->fqs[i]->thread_index = i + 1;
+    }
+  vec_validate_aligned (ftm->producers, n_producers - 1,
+			CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (ftm->consumers, n_consumers - 1,
+			CLIB_CACHE_LINE_BYTES);
+
+  frame_queue_test_set_state (VLIB_NODE_STATE_POLLING);
+
+  vec_foreach (t, ftm->producers)
+  {
+    t->ftm = ftm;
+    t->index = t - ftm->producers;
+    if (pthread_create (&t->thread, 0, frame_queue_test_producer, t))
+      {
+	error = clib_error_return_unix (0, "pthread_create");
+	goto done;
+      }
+    n_started++;
+  }
+
+  t0 = vlib_time_now (vm);
+  ftm->go = 1;
+
+done:
+  /* Threads that did start run to completion once released */
+  ftm->go = 1;
+  vec_foreach (t, ftm->producers)
+  {
+    if (t->thread)
+      pthread_join (t->thread, 0);
+    n_sent += t->n_elts;
+  }
+
+  /* Then the workers drain the queues */
+  deadline = vlib_time_now (vm) + 10.0;
+  while (1)
+    {
+      n_elts = 0;
+      vec_foreach (t, ftm->consumers) n_elts += t->n_elts;
+      if (n_elts == n_sent)
+	break;
+      if (vlib_time_now (vm) > deadline)
+	{
+	  if (error == 0)
+	    error = clib_error_return (0, "workers dequeued %lld of %lld "
+				       "frames", n_elts, n_sent);
+	  break;
+	}
+      vlib_process_suspend (vm, 1e-3);
+    }
+  dt = vlib_time_now (vm) - t0;
+
+  frame_queue_test_set_state (VLIB_NODE_STATE_DISABLED);
+
+  if (error == 0)
+    {
+      vec_foreach (t, ftm->consumers)
+      {
+	n_vectors += t->n_vectors;
+	latency += t->latency;
+      }
+      for (i = 0; i < n_consumers; i++)
+	{
+	  vec_foreach (r, ftm->fqs[i]->rings)
+	    full += r->enqueue_full_events;
+	}
+
+      vlib_cli_output (vm, "%d producers, %d workers, %d vectors/frame, "
+		       "batch %d, ring size %d", n_producers, n_consumers,
+		       ftm->n_vectors, ftm->batch, nelts);
+      vlib_cli_output (vm, "  %lld frames, %lld vectors in %.3f sec",
+		       n_elts, n_vectors, dt);
+      vlib_cli_output (vm, "  %.2f Mpps, %.2f Mframes/sec",
+		       (f64) n_vectors / dt * 1e-6, (f64) n_elts / dt * 1e-6);
+      vlib_cli_output (vm, "  latency %.0f clocks (%.3f us), "
+		       "%lld full events",
+		       (f64) latency / n_elts,
+		       (f64) latency / n_elts / vm->clib_time.clocks_per_second
+		       * 1e6, full);
+    }
+
+  for (i = 0; i < vec_len (ftm->fqs); i++)
+    {
+      vec_foreach (r, ftm->fqs[i]->rings)
+	vec_free (r->elts);
+      vec_free (ftm->fqs[i]->rings);
+      clib_mem_free (ftm->fqs[i]);
+    }
+  vec_free (ftm->fqs);
+  vec_free (ftm->producers);
+  vec_free (ftm->consumers);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (cmd_test_frame_queue_handoff,static) = {
+    .path = "test frame-queue handoff",
+    .short_help = "test frame-queue handoff [producers <n>] [frames <n>] "
+      "[vectors <n>] [batch <n>] [nelts <n>] [yield]",
+    .function = test_frame_queue_handoff,
+    .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
+
 /*
  * fd.io coding-style-patch-verification: ON
  *
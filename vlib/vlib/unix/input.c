@@ -93,6 +93,7 @@ linux_epoll_input (vlib_main_t * vm,
   linux_epoll_main_t *em = &linux_epoll_main;
   struct epoll_event *e;
   int n_fds_ready;
+  int may_sleep;
 
   {
     vlib_node_main_t *nm = &vm->node_main;
@@ -137,6 +138,8 @@ linux_epoll_input (vlib_main_t * vm,
       /* We're not busy; go to sleep for a while. */
       node->input_main_loops_per_call = 0;
 
+    may_sleep = timeout_ms > 0;
+
     /* Allow any signal to wakeup our sleep. */
     {
       static sigset_t unblock_all_signals;
@@ -167,6 +170,11 @@ linux_epoll_input (vlib_main_t * vm,
   em->epoll_waits += 1;
   em->epoll_files_ready += n_fds_ready;
 
+  /* After sleeping, give adaptive nodes in interrupt mode a poll */
+  if (may_sleep
+      && vm->node_main.input_node_counts_by_state[VLIB_NODE_STATE_INTERRUPT])
+    vlib_node_adaptive_poll_interrupt_nodes (vm);
+
   for (e = em->epoll_events; e < em->epoll_events + n_fds_ready; e++)
     {
       u32 i = e->data.u32;
@@ -42,23 +42,30 @@
 static physmem_main_t physmem_main;
 
 static void *
-unix_physmem_alloc_aligned (vlib_physmem_main_t * vpm, uword n_bytes,
-			    uword alignment)
+unix_physmem_alloc_aligned_on_numa (vlib_physmem_main_t * vpm, uword n_bytes,
+				    uword alignment, u32 numa_node)
 {
   physmem_main_t *pm = &physmem_main;
-  uword lo_offset, hi_offset;
+  uword lo_offset, hi_offset, heap_offset;
   uword *to_free = 0;
+  void *heap;
 
 #if DPDK > 0
   clib_warning ("unsafe alloc!");
 #endif
 
+  if (numa_node >= vec_len (pm->heaps))
+    numa_node = 0;
+  heap = pm->heaps[numa_node];
+  heap_offset = heap - pm->mem;
+  pm->heaps_in_use = 1;
+
   /* IO memory is always at least cache aligned. */
   alignment = clib_max (alignment, CLIB_CACHE_LINE_BYTES);
 
   while (1)
     {
-      mheap_get_aligned (pm->heap, n_bytes,
+      mheap_get_aligned (heap, n_bytes,
 			 /* align */ alignment,
 			 /* align offset */ 0,
 			 &lo_offset);
@@ -68,9 +75,9 @@ unix_physmem_alloc_aligned (vlib_physmem_main_t * vpm, uword n_bytes,
 	break;
 
       /* Make sure allocation does not span DMA physical chunk boundary. */
-      hi_offset = lo_offset + n_bytes - 1;
+      hi_offset = heap_offset + lo_offset + n_bytes - 1;
 
-      if ((lo_offset >> vpm->log2_n_bytes_per_page) ==
+      if (((heap_offset + lo_offset) >> vpm->log2_n_bytes_per_page) ==
 	  (hi_offset >> vpm->log2_n_bytes_per_page))
 	break;
 
@@ -83,20 +90,121 @@ unix_physmem_alloc_aligned (vlib_physmem_main_t * vpm, uword n_bytes,
     {
       uword i;
       for (i = 0; i < vec_len (to_free); i++)
-	mheap_put (pm->heap, to_free[i]);
+	mheap_put (heap, to_free[i]);
       vec_free (to_free);
     }
 
-  return lo_offset != ~0 ? pm->heap + lo_offset : 0;
+  return lo_offset != ~0 ? heap + lo_offset : 0;
+}
+
+static void *
+unix_physmem_alloc_aligned (vlib_physmem_main_t * vpm, uword n_bytes,
+			    uword alignment)
+{
+  return unix_physmem_alloc_aligned_on_numa (vpm, n_bytes, alignment, 0);
 }
 
 static void
 unix_physmem_free (void *x)
 {
   physmem_main_t *pm = &physmem_main;
+  vlib_physmem_main_t *vpm = &vlib_global_main.physmem_main;
+  void *heap;
 
   /* Return object to region's heap. */
-  mheap_put (pm->heap, x - pm->heap);
+  heap = pm->heaps[vlib_physmem_numa_node_of_offset (vpm, x - pm->mem)];
+  mheap_put (heap, x - heap);
+}
+
+/* Number of NUMA nodes the system has, 1 if it can't tell */
+static u32
+physmem_n_system_numa_nodes (void)
+{
+  uword *bitmap = 0;
+  u32 n = 0;
+
+  if (!vlib_sysfs_read ("/sys/devices/system/node/online", "%U",
+			unformat_bitmap_list, &bitmap) && bitmap)
+    n = clib_bitmap_last_set (bitmap) + 1;
+  clib_bitmap_free (bitmap);
+
+  return n ? n : 1;
+}
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+/* Bind each NUMA node's part of mem to the node, moving touched pages */
+static void
+physmem_numa_bind (physmem_main_t * pm, u32 n_numa_nodes,
+		   uword n_bytes_per_node)
+{
+  u64 mask;
+  u32 i;
+
+  if (n_numa_nodes <= 1 || pm->fake_numa)
+    return;
+
+  for (i = 0; i < n_numa_nodes && i < 64; i++)
+    {
+      mask = 1ULL << i;
+      if (syscall (__NR_mbind, pm->mem + i * n_bytes_per_node,
+		   n_bytes_per_node, MPOL_BIND, &mask, 8 * sizeof (mask),
+		   MPOL_MF_MOVE) < 0)
+	clib_unix_warning ("mbind physmem to numa node %d", i);
+    }
+}
+
+/*
+ * Carve mem into one heap per NUMA node. Each part is a power of 2
+ * bytes, so the node of an address is a shift away; with a single node
+ * the heap covers all of mem as before.
+ */
+static clib_error_t *
+physmem_numa_split (vlib_main_t * vm)
+{
+  vlib_physmem_main_t *vpm = &vm->physmem_main;
+  physmem_main_t *pm = &physmem_main;
+  u32 i, n, log2_n_bytes;
+  uword n_bytes;
+  void *heap;
+
+  if (pm->heaps_in_use)
+    return clib_error_return (0, "physmem already in use, can't split it "
+			      "over NUMA nodes any more");
+
+  n = pm->n_numa_nodes ? pm->n_numa_nodes : physmem_n_system_numa_nodes ();
+  log2_n_bytes = min_log2 (pm->mem_size / n);
+  n_bytes = n > 1 ? (1ULL << log2_n_bytes) : pm->mem_size;
+
+  /* Parts must not share a DMA page */
+  if (n > 1 && !vpm->is_fake && log2_n_bytes < vpm->log2_n_bytes_per_page)
+    return clib_error_return (0, "physmem of %U too small for %d numa nodes",
+			      format_memory_size, pm->mem_size, n);
+
+  physmem_numa_bind (pm, n, n_bytes);
+
+  vec_reset_length (pm->heaps);
+  for (i = 0; i < n; i++)
+    {
+      if (vpm->is_fake)
+	heap = mheap_alloc (pm->mem + i * n_bytes, n_bytes);
+      else
+	heap = mheap_alloc_with_flags (pm->mem + i * n_bytes, n_bytes,
+				       /* Don't want mheap mmap/munmap with IO memory. */
+				       MHEAP_FLAG_DISABLE_VM);
+      vec_add1 (pm->heaps, heap);
+    }
+  pm->heap = pm->heaps[0];
+
+  vpm->n_numa_nodes = n;
+  vpm->log2_numa_node_bytes = log2_n_bytes;
+  vpm->is_fake_numa = n > 1 && pm->fake_numa;
+  return 0;
 }
 
 static void
@@ -136,6 +244,14 @@ htlb_init (vlib_main_t * vm)
       return 0;
     }
 
+  /* Place the pages on their NUMA nodes before touching them */
+  {
+    u32 n = pm->n_numa_nodes ? pm->n_numa_nodes :
+      physmem_n_system_numa_nodes ();
+    if (n > 1)
+      physmem_numa_bind (pm, n, 1ULL << min_log2 (pm->mem_size / n));
+  }
+
   memset (pm->mem, 0, pm->mem_size);
 
   /* $$$ get page size info from /proc/meminfo */
@@ -157,10 +273,6 @@ htlb_init (vlib_main_t * vm)
       return 0;
     }
 
-  pm->heap = mheap_alloc_with_flags (pm->mem, pm->mem_size,
-				     /* Don't want mheap mmap/munmap with IO memory. */
-				     MHEAP_FLAG_DISABLE_VM);
-
   cur = pointer_to_uword (pm->mem);
   i = 0;
 
@@ -217,6 +329,7 @@ unix_physmem_init (vlib_main_t * vm, int physical_memory_required)
     return error;
 
   vm->os_physmem_alloc_aligned = unix_physmem_alloc_aligned;
+  vm->os_physmem_alloc_aligned_on_numa = unix_physmem_alloc_aligned_on_numa;
   vm->os_physmem_free = unix_physmem_free;
   pm->mem = MAP_FAILED;
 
@@ -230,7 +343,7 @@ unix_physmem_init (vlib_main_t * vm, int physical_memory_required)
   if (!pm->no_hugepages && htlb_init (vm))
     {
       fformat (stderr, "%s: use huge pages\n", __FUNCTION__);
-      return 0;
+      return physmem_numa_split (vm);
     }
 
   pm->mem =
@@ -242,8 +355,6 @@ unix_physmem_init (vlib_main_t * vm, int physical_memory_required)
       goto done;
     }
 
-  pm->heap = mheap_alloc (pm->mem, pm->mem_size);
-
   /* Identity map with a single page. */
   vpm->log2_n_bytes_per_page = min_log2 (pm->mem_size);
   vec_add1 (vpm->page_table, pointer_to_uword (pm->mem));
@@ -254,6 +365,10 @@ unix_physmem_init (vlib_main_t * vm, int physical_memory_required)
   vpm->virtual.end = vpm->virtual.start + vpm->virtual.size;
   vpm->is_fake = 1;
 
+  error = physmem_numa_split (vm);
+  if (error)
+    goto done;
+
   fformat (stderr, "%s: use fake dma pages\n", __FUNCTION__);
 
 done:
@@ -274,7 +389,15 @@ show_physmem (vlib_main_t * vm,
 #else
   physmem_main_t *pm = &physmem_main;
 
-  if (pm->heap)
+  vlib_physmem_main_t *vpm = &vm->physmem_main;
+  int i;
+
+  if (vec_len (pm->heaps) > 1)
+    for (i = 0; i < vec_len (pm->heaps); i++)
+      vlib_cli_output (vm, "numa node %d%s:\n%U", i,
+		       vpm->is_fake_numa ? " (fake)" : "",
+		       format_mheap, pm->heaps[i], /* verbose */ 1);
+  else if (pm->heap)
     vlib_cli_output (vm, "%U", format_mheap, pm->heap, /* verbose */ 1);
   else
     vlib_cli_output (vm, "No physmem allocated.");
@@ -441,7 +564,7 @@ static clib_error_t *
 vlib_physmem_configure (vlib_main_t * vm, unformat_input_t * input)
 {
   physmem_main_t *pm = &physmem_main;
-  u32 size_in_mb;
+  u32 size_in_mb, n_numa_nodes = 0;
 
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
     {
@@ -451,11 +574,25 @@ vlib_physmem_configure (vlib_main_t * vm, unformat_input_t * input)
       else if (unformat (input, "size-in-mb %d", &size_in_mb) ||
 	       unformat (input, "size %d", &size_in_mb))
 	pm->mem_size = size_in_mb << 20;
+      else if (unformat (input, "numa-nodes %d", &n_numa_nodes))
+	pm->fake_numa = 0;
+      else if (unformat (input, "fake-numa-nodes %d", &n_numa_nodes))
+	pm->fake_numa = 1;
       else
 	return unformat_parse_error (input);
     }
 
   unformat_free (input);
+
+  if (n_numa_nodes)
+    {
+      pm->n_numa_nodes = n_numa_nodes;
+
+      /* vpp maps its memory before reading the config, split it now */
+      if (vec_len (pm->heaps))
+	return physmem_numa_split (vm);
+    }
+
   return 0;
 }
 
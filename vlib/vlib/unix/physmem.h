@@ -34,6 +34,7 @@
 #include <fcntl.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/syscall.h>
 
 typedef struct
 {
@@ -43,9 +44,21 @@ typedef struct
   /* Size in bytes. */
   uword mem_size;
 
-  /* Heap allocated out of virtual memory. */
+  /* Heap allocated out of virtual memory, heaps[0] */
   void *heap;
 
+  /* Heap of each NUMA node's part of mem */
+  void **heaps;
+
+  /* NUMA nodes to split mem over, 0: as many as the system has */
+  u32 n_numa_nodes;
+
+  /* Split without binding the parts to their nodes */
+  int fake_numa;
+
+  /* Set by the first allocation, the split is final from then on */
+  int heaps_in_use;
+
   /* huge TLB segment id */
   int shmid;
 
@@ -0,0 +1,1364 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vnet/acl/acl.h>
+#include <vlib/threads.h>
+#include <vppinfra/random.h>
+
+#include <vppinfra/bihash_40_8.h>
+#include <vppinfra/bihash_template.c>
+
+/**
+ * @file
+ * @brief Stateless IP ACLs, rule and tuple management.
+ *
+ * All changes are made with the worker threads held at the barrier, so
+ * that rule lists and tuple vectors can be reallocated in place.
+ */
+
+ip_acl_main_t ip_acl_main;
+
+#define IP_ACL_DEFAULT_HASH_BUCKETS (64 << 10)
+#define IP_ACL_DEFAULT_HASH_MEMORY_SIZE (256 << 20)
+
+/* Two hash entries per session */
+#define IP_ACL_DEFAULT_SESSIONS_PER_THREAD (256 << 10)
+#define IP_ACL_DEFAULT_SESSION_HASH_BUCKETS (128 << 10)
+#define IP_ACL_DEFAULT_SESSION_HASH_MEMORY_SIZE (128 << 20)
+
+/* Seconds */
+#define IP_ACL_DEFAULT_UDP_TIMEOUT 300
+#define IP_ACL_DEFAULT_TCP_ESTABLISHED_TIMEOUT 7440
+#define IP_ACL_DEFAULT_TCP_TRANSITORY_TIMEOUT 240
+#define IP_ACL_DEFAULT_SESSION_TIMEOUT 60
+
+/* Tuple indices share the key's last word with the protocol */
+#define IP_ACL_MAX_TUPLES (1 << (32 - IP_ACL_TUPLE_SHIFT))
+
+static void
+ip_acl_tuple_init_mask (ip_acl_tuple_t * t)
+{
+  ip_acl_key_t *m = &t->mask;
+
+  memset (m, 0, sizeof (*m));
+
+  if (t->is_ip6)
+    {
+      m->src.ip6 = ip6_main.fib_masks[t->src_plen];
+      m->dst.ip6 = ip6_main.fib_masks[t->dst_plen];
+    }
+  else
+    {
+      m->src.ip4.as_u32 = ip4_main.fib_masks[t->src_plen];
+      m->dst.ip4.as_u32 = ip4_main.fib_masks[t->dst_plen];
+    }
+
+  m->proto_tuple = t->proto_exact ? 0xff : 0;
+  m->src_port = t->src_port_exact ? 0xffff : 0;
+  m->dst_port = t->dst_port_exact ? 0xffff : 0;
+}
+
+/* Key of a rule in its tuple */
+static void
+ip_acl_rule_key (ip_acl_main_t * am, ip_acl_rule_t * r,
+		 clib_bihash_kv_40_8_t * kv)
+{
+  ip_acl_tuple_t *t = pool_elt_at_index (am->tuples, r->tuple_index);
+  ip_acl_key_t *k = (ip_acl_key_t *) kv->key;
+  int i;
+
+  k->src = r->src;
+  k->dst = r->dst;
+  k->src_port = r->src_port_lo;
+  k->dst_port = r->dst_port_lo;
+  k->proto_tuple = r->proto;
+
+  for (i = 0; i < ARRAY_LEN (k->as_u64); i++)
+    k->as_u64[i] &= t->mask.as_u64[i];
+
+  k->proto_tuple |= r->tuple_index << IP_ACL_TUPLE_SHIFT;
+}
+
+static int
+ip_acl_tuple_sort_cmp (void *a1, void *a2)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  u32 *i1 = a1, *i2 = a2;
+  ip_acl_tuple_t *t1 = pool_elt_at_index (am->tuples, i1[0]);
+  ip_acl_tuple_t *t2 = pool_elt_at_index (am->tuples, i2[0]);
+
+  if (t1->min_priority == t2->min_priority)
+    return 0;
+  return t1->min_priority < t2->min_priority ? -1 : 1;
+}
+
+/* Tuple of a rule, created if the ACL has none with its mask yet */
+static u32
+ip_acl_tuple_get (ip_acl_main_t * am, ip_acl_t * acl, ip_acl_rule_t * r)
+{
+  ip_acl_tuple_t *t;
+  u8 proto_exact, src_port_exact, dst_port_exact;
+  u32 *ti;
+
+  proto_exact = r->proto != 0;
+  src_port_exact = r->src_port_lo == r->src_port_hi;
+  dst_port_exact = r->dst_port_lo == r->dst_port_hi;
+
+  vec_foreach (ti, acl->tuples[r->is_ip6])
+  {
+    t = pool_elt_at_index (am->tuples, ti[0]);
+    if (t->src_plen == r->src_plen && t->dst_plen == r->dst_plen
+	&& t->proto_exact == proto_exact
+	&& t->src_port_exact == src_port_exact
+	&& t->dst_port_exact == dst_port_exact)
+      return ti[0];
+  }
+
+  if (pool_elts (am->tuples) >= IP_ACL_MAX_TUPLES - 1)
+    return ~0;
+
+  pool_get (am->tuples, t);
+  memset (t, 0, sizeof (*t));
+  t->src_plen = r->src_plen;
+  t->dst_plen = r->dst_plen;
+  t->is_ip6 = r->is_ip6;
+  t->proto_exact = proto_exact;
+  t->src_port_exact = src_port_exact;
+  t->dst_port_exact = dst_port_exact;
+  t->min_priority = ~0;
+  ip_acl_tuple_init_mask (t);
+
+  vec_add1 (acl->tuples[r->is_ip6], t - am->tuples);
+  return t - am->tuples;
+}
+
+static void
+ip_acl_hash_init (ip_acl_main_t * am)
+{
+  if (am->hash.nbuckets)
+    return;
+
+  clib_bihash_init_40_8 (&am->hash, "ip acl", am->hash_buckets,
+			 am->hash_memory_size);
+}
+
+/**
+ * @brief Create an ACL.
+ *
+ * @param default_action ip_acl_action_t of packets matching no rule.
+ * @param acl_index      Returned ACL index.
+ *
+ * @returns 0 on success, VNET_API_ERROR_* otherwise.
+ */
+int
+ip_acl_add (u8 default_action, u32 * acl_index)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  ip_acl_t *acl;
+
+  if (default_action >= IP_ACL_N_ACTION)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  ip_acl_hash_init (am);
+
+  vlib_worker_thread_barrier_sync (am->vlib_main);
+  pool_get (am->acls, acl);
+  memset (acl, 0, sizeof (*acl));
+  acl->default_action = default_action;
+  vlib_worker_thread_barrier_release (am->vlib_main);
+
+  *acl_index = acl - am->acls;
+  return 0;
+}
+
+/**
+ * @brief Delete an ACL and its rules.
+ *
+ * @param acl_index ACL index.
+ *
+ * @returns 0 on success, VNET_API_ERROR_INSTANCE_IN_USE if the ACL is
+ * applied to an interface.
+ */
+int
+ip_acl_del (u32 acl_index)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  ip_acl_t *acl;
+  int rv;
+
+  if (pool_is_free_index (am->acls, acl_index))
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  acl = pool_elt_at_index (am->acls, acl_index);
+  if (acl->n_interfaces)
+    return VNET_API_ERROR_INSTANCE_IN_USE;
+
+  while (vec_len (acl->rules))
+    {
+      rv = ip_acl_rule_del (acl->rules[vec_len (acl->rules) - 1]);
+      if (rv)
+	return rv;
+      acl = pool_elt_at_index (am->acls, acl_index);
+    }
+
+  vlib_worker_thread_barrier_sync (am->vlib_main);
+  ip_acl_sessions_flush (am, acl_index);
+  vec_free (acl->rules);
+  vec_free (acl->tuples[0]);
+  vec_free (acl->tuples[1]);
+  pool_put (am->acls, acl);
+  vlib_worker_thread_barrier_release (am->vlib_main);
+
+  return 0;
+}
+
+/**
+ * @brief Add a rule to an ACL.
+ *
+ * Prefixes are masked to their length. A port range of a single port is
+ * matched exactly in the rule's tuple, other ranges are wildcarded and
+ * checked on the rules found.
+ *
+ * @param acl_index  ACL index.
+ * @param rule       Rule, the priority ~0 for one past the ACL's highest.
+ * @param rule_index Returned rule index.
+ *
+ * @returns 0 on success, VNET_API_ERROR_* otherwise.
+ */
+int
+ip_acl_rule_add (u32 acl_index, ip_acl_rule_t * rule, u32 * rule_index)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  clib_bihash_kv_40_8_t kv, value;
+  ip_acl_tuple_t *t;
+  ip_acl_rule_t *r, *r2;
+  ip_acl_t *acl;
+  u32 *rules, *ri, **list, tuple_index, list_index, i;
+  u32 max_priority = 0;
+
+  if (pool_is_free_index (am->acls, acl_index))
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+  acl = pool_elt_at_index (am->acls, acl_index);
+
+  if (rule->src_plen > (rule->is_ip6 ? 128 : 32) ||
+      rule->dst_plen > (rule->is_ip6 ? 128 : 32) ||
+      rule->src_port_lo > rule->src_port_hi ||
+      rule->dst_port_lo > rule->dst_port_hi ||
+      rule->action >= IP_ACL_N_ACTION)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  vec_foreach (ri, acl->rules)
+  {
+    r = pool_elt_at_index (am->rules, ri[0]);
+    if (rule->priority != ~0 && r->priority == rule->priority)
+      return VNET_API_ERROR_VALUE_EXIST;
+    max_priority = clib_max (max_priority, r->priority + 1);
+  }
+
+  vlib_worker_thread_barrier_sync (am->vlib_main);
+
+  pool_get (am->rules, r);
+  r[0] = rule[0];
+  r->acl_index = acl_index;
+  r->hits = 0;
+  if (r->priority == ~0)
+    r->priority = max_priority;
+
+  if (r->is_ip6)
+    {
+      for (i = 0; i < ARRAY_LEN (r->src.as_u64); i++)
+	{
+	  r->src.as_u64[i] &= ip6_main.fib_masks[r->src_plen].as_u64[i];
+	  r->dst.as_u64[i] &= ip6_main.fib_masks[r->dst_plen].as_u64[i];
+	}
+    }
+  else
+    {
+      ip46_address_mask_ip4 (&r->src);
+      ip46_address_mask_ip4 (&r->dst);
+      r->src.ip4.as_u32 &= ip4_main.fib_masks[r->src_plen];
+      r->dst.ip4.as_u32 &= ip4_main.fib_masks[r->dst_plen];
+    }
+
+  tuple_index = ip_acl_tuple_get (am, acl, r);
+  if (tuple_index == ~0)
+    {
+      pool_put (am->rules, r);
+      vlib_worker_thread_barrier_release (am->vlib_main);
+      return VNET_API_ERROR_TABLE_TOO_BIG;
+    }
+  r->tuple_index = tuple_index;
+
+  /* Add to the rules sharing its masked key, in priority order */
+  ip_acl_rule_key (am, r, &kv);
+  if (clib_bihash_search_40_8 (&am->hash, &kv, &value) == 0)
+    {
+      list_index = value.value;
+      rules = am->rule_lists[list_index];
+      for (i = 0; i < vec_len (rules); i++)
+	{
+	  r2 = pool_elt_at_index (am->rules, rules[i]);
+	  if (r2->priority > r->priority)
+	    break;
+	}
+      vec_insert (rules, 1, i);
+      rules[i] = r - am->rules;
+      am->rule_lists[list_index] = rules;
+    }
+  else
+    {
+      pool_get (am->rule_lists, list);
+      list[0] = 0;
+      vec_add1 (list[0], r - am->rules);
+      kv.value = list - am->rule_lists;
+      clib_bihash_add_del_40_8 (&am->hash, &kv, 1 /* is_add */ );
+    }
+
+  t = pool_elt_at_index (am->tuples, tuple_index);
+  t->n_rules++;
+  if (r->priority < t->min_priority)
+    {
+      t->min_priority = r->priority;
+      vec_sort_with_function (acl->tuples[r->is_ip6], ip_acl_tuple_sort_cmp);
+    }
+
+  vec_add1 (acl->rules, r - am->rules);
+
+  if (r->action == IP_ACL_ACTION_REFLECT)
+    ip_acl_sessions_enable (am);
+
+  vlib_worker_thread_barrier_release (am->vlib_main);
+
+  *rule_index = r - am->rules;
+  return 0;
+}
+
+/**
+ * @brief Delete a rule.
+ *
+ * @param rule_index Rule index.
+ *
+ * @returns 0 on success, VNET_API_ERROR_NO_SUCH_ENTRY otherwise.
+ */
+int
+ip_acl_rule_del (u32 rule_index)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  clib_bihash_kv_40_8_t kv, value;
+  ip_acl_rule_t *r, *r2;
+  ip_acl_tuple_t *t;
+  ip_acl_t *acl;
+  u32 *rules, *ri, i;
+
+  if (pool_is_free_index (am->rules, rule_index))
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  r = pool_elt_at_index (am->rules, rule_index);
+  acl = pool_elt_at_index (am->acls, r->acl_index);
+  t = pool_elt_at_index (am->tuples, r->tuple_index);
+
+  vlib_worker_thread_barrier_sync (am->vlib_main);
+
+  ip_acl_rule_key (am, r, &kv);
+  if (clib_bihash_search_40_8 (&am->hash, &kv, &value) == 0)
+    {
+      rules = am->rule_lists[value.value];
+      for (i = 0; i < vec_len (rules); i++)
+	if (rules[i] == rule_index)
+	  {
+	    vec_delete (rules, 1, i);
+	    break;
+	  }
+      am->rule_lists[value.value] = rules;
+
+      if (vec_len (rules) == 0)
+	{
+	  vec_free (am->rule_lists[value.value]);
+	  pool_put_index (am->rule_lists, value.value);
+	  clib_bihash_add_del_40_8 (&am->hash, &kv, 0 /* is_add */ );
+	}
+    }
+
+  for (i = 0; i < vec_len (acl->rules); i++)
+    if (acl->rules[i] == rule_index)
+      {
+	vec_delete (acl->rules, 1, i);
+	break;
+      }
+
+  t->n_rules--;
+  if (t->n_rules == 0)
+    {
+      for (i = 0; i < vec_len (acl->tuples[r->is_ip6]); i++)
+	if (acl->tuples[r->is_ip6][i] == r->tuple_index)
+	  {
+	    vec_delete (acl->tuples[r->is_ip6], 1, i);
+	    break;
+	  }
+      pool_put (am->tuples, t);
+    }
+  else if (r->priority == t->min_priority)
+    {
+      t->min_priority = ~0;
+      vec_foreach (ri, acl->rules)
+      {
+	r2 = pool_elt_at_index (am->rules, ri[0]);
+	if (r2->tuple_index == r->tuple_index)
+	  t->min_priority = clib_min (t->min_priority, r2->priority);
+      }
+      vec_sort_with_function (acl->tuples[r->is_ip6], ip_acl_tuple_sort_cmp);
+    }
+
+  pool_put (am->rules, r);
+
+  vlib_worker_thread_barrier_release (am->vlib_main);
+
+  return 0;
+}
+
+/**
+ * @brief Apply an ACL to an interface, or remove it.
+ *
+ * An interface has at most one ACL per direction and address family,
+ * applying another one replaces it.
+ *
+ * @param sw_if_index Interface.
+ * @param acl_index   ACL index, ignored on delete.
+ * @param tid         Direction and address family.
+ * @param is_add      Apply if non-zero, otherwise remove.
+ *
+ * @returns 0 on success, VNET_API_ERROR_* otherwise.
+ */
+int
+ip_acl_set_interface (u32 sw_if_index, u32 acl_index,
+		      ip_acl_table_id_t tid, int is_add)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  vlib_main_t *vm = am->vlib_main;
+  int is_ip6 = tid == IP_ACL_TABLE_IP6_INPUT
+    || tid == IP_ACL_TABLE_IP6_OUTPUT;
+  int is_output = tid == IP_ACL_TABLE_IP4_OUTPUT
+    || tid == IP_ACL_TABLE_IP6_OUTPUT;
+  ip_lookup_main_t *lm;
+  vnet_feature_config_main_t *cm;
+  u32 ci, current;
+
+  if (tid >= IP_ACL_N_TABLES)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  if (is_add && pool_is_free_index (am->acls, acl_index))
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  vec_validate_init_empty (am->acl_index_by_sw_if_index[tid], sw_if_index,
+			   ~0);
+  current = am->acl_index_by_sw_if_index[tid][sw_if_index];
+
+  if (!is_add && current == ~0)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+  if (is_add && current == acl_index)
+    return 0;
+
+  lm = is_ip6 ? &ip6_main.lookup_main : &ip4_main.lookup_main;
+  cm = &lm->feature_config_mains[is_output ? VNET_IP_TX_FEAT :
+				 VNET_IP_RX_UNICAST_FEAT];
+  vec_validate (cm->config_index_by_sw_if_index, sw_if_index);
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  /* Remove the current ACL, if any */
+  if (current != ~0)
+    {
+      ci = cm->config_index_by_sw_if_index[sw_if_index];
+      ci = vnet_config_del_feature (vm, &cm->config_main, ci,
+				    am->feature_index[tid], &current,
+				    sizeof (current));
+      cm->config_index_by_sw_if_index[sw_if_index] = ci;
+      if (is_output)
+	vnet_config_update_tx_feature_count (lm, cm, sw_if_index, 0);
+      pool_elt_at_index (am->acls, current)->n_interfaces--;
+      am->acl_index_by_sw_if_index[tid][sw_if_index] = ~0;
+    }
+
+  if (is_add)
+    {
+      ci = cm->config_index_by_sw_if_index[sw_if_index];
+      ci = vnet_config_add_feature (vm, &cm->config_main, ci,
+				    am->feature_index[tid], &acl_index,
+				    sizeof (acl_index));
+      cm->config_index_by_sw_if_index[sw_if_index] = ci;
+      if (is_output)
+	vnet_config_update_tx_feature_count (lm, cm, sw_if_index, 1);
+      pool_elt_at_index (am->acls, acl_index)->n_interfaces++;
+      am->acl_index_by_sw_if_index[tid][sw_if_index] = acl_index;
+    }
+
+  vlib_worker_thread_barrier_release (vm);
+
+  return 0;
+}
+
+u8 *
+format_ip_acl_action (u8 * s, va_list * args)
+{
+  u32 action = va_arg (*args, u32);
+
+  switch (action)
+    {
+#define _(sym,str) case IP_ACL_ACTION_##sym: return format (s, str);
+      foreach_ip_acl_action
+#undef _
+    default:
+      return format (s, "unknown %d", action);
+    }
+}
+
+static uword
+unformat_ip_acl_action (unformat_input_t * input, va_list * args)
+{
+  u8 *action = va_arg (*args, u8 *);
+
+  if (0);
+#define _(sym,str) else if (unformat (input, str)) *action = IP_ACL_ACTION_##sym;
+  foreach_ip_acl_action
+#undef _
+  else
+    return 0;
+
+  return 1;
+}
+
+static u8 *
+format_ip_acl_port_range (u8 * s, va_list * args)
+{
+  u32 lo = va_arg (*args, u32);
+  u32 hi = va_arg (*args, u32);
+
+  if (lo == 0 && hi == 65535)
+    return format (s, "any");
+  if (lo == hi)
+    return format (s, "%d", lo);
+  return format (s, "%d-%d", lo, hi);
+}
+
+u8 *
+format_ip_acl_rule (u8 * s, va_list * args)
+{
+  ip_acl_rule_t *r = va_arg (*args, ip_acl_rule_t *);
+  format_function_t *f = r->is_ip6 ? format_ip6_address : format_ip4_address;
+  void *src = r->is_ip6 ? (void *) &r->src.ip6 : (void *) &r->src.ip4;
+  void *dst = r->is_ip6 ? (void *) &r->dst.ip6 : (void *) &r->dst.ip4;
+
+  s = format (s, "priority %d %U src %U/%d dst %U/%d",
+	      r->priority, format_ip_acl_action, r->action,
+	      f, src, r->src_plen, f, dst, r->dst_plen);
+  if (r->proto)
+    s = format (s, " proto %U", format_ip_protocol, r->proto);
+  s = format (s, " sport %U dport %U",
+	      format_ip_acl_port_range, r->src_port_lo, r->src_port_hi,
+	      format_ip_acl_port_range, r->dst_port_lo, r->dst_port_hi);
+  return s;
+}
+
+static uword
+unformat_ip_acl_port_range (unformat_input_t * input, va_list * args)
+{
+  u16 *lo = va_arg (*args, u16 *);
+  u16 *hi = va_arg (*args, u16 *);
+  u32 l, h;
+
+  if (unformat (input, "%d-%d", &l, &h))
+    ;
+  else if (unformat (input, "%d", &l))
+    h = l;
+  else
+    return 0;
+
+  if (l > h || h > 65535)
+    return 0;
+
+  *lo = l;
+  *hi = h;
+  return 1;
+}
+
+/**
+ * @brief Parse a rule.
+ *
+ * permit|deny|reflect [priority <n>] [src <addr>/<len>] [dst <addr>/<len>]
+ * [proto <proto>] [sport <lo>[-<hi>]] [dport <lo>[-<hi>]]
+ *
+ * Fields not given match any value.
+ */
+uword
+unformat_ip_acl_rule (unformat_input_t * input, va_list * args)
+{
+  ip_acl_rule_t *r = va_arg (*args, ip_acl_rule_t *);
+  int have_action = 0, have_ip4 = 0, have_ip6 = 0;
+  u32 plen;
+  u8 proto;
+
+  memset (r, 0, sizeof (*r));
+  r->priority = ~0;
+  r->src_port_hi = r->dst_port_hi = 65535;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_ip_acl_action, &r->action))
+	have_action = 1;
+      else if (unformat (input, "priority %d", &r->priority))
+	;
+      else if (unformat (input, "src %U/%d", unformat_ip4_address,
+			 &r->src.ip4, &plen))
+	r->src_plen = plen, have_ip4 = 1;
+      else if (unformat (input, "dst %U/%d", unformat_ip4_address,
+			 &r->dst.ip4, &plen))
+	r->dst_plen = plen, have_ip4 = 1;
+      else if (unformat (input, "src %U/%d", unformat_ip6_address,
+			 &r->src.ip6, &plen))
+	r->src_plen = plen, have_ip6 = 1;
+      else if (unformat (input, "dst %U/%d", unformat_ip6_address,
+			 &r->dst.ip6, &plen))
+	r->dst_plen = plen, have_ip6 = 1;
+      else if (unformat (input, "proto %U", unformat_ip_protocol, &proto))
+	r->proto = proto;
+      else if (unformat (input, "proto %d", &plen))
+	r->proto = plen;
+      else if (unformat (input, "sport %U", unformat_ip_acl_port_range,
+			 &r->src_port_lo, &r->src_port_hi))
+	;
+      else if (unformat (input, "dport %U", unformat_ip_acl_port_range,
+			 &r->dst_port_lo, &r->dst_port_hi))
+	;
+      else if (unformat (input, "ip6"))
+	have_ip6 = 1;
+      else
+	break;
+    }
+
+  if (!have_action || (have_ip4 && have_ip6))
+    return 0;
+
+  r->is_ip6 = have_ip6;
+  return 1;
+}
+
+static clib_error_t *
+ip_acl_add_command_fn (vlib_main_t * vm,
+		       unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  u8 default_action = IP_ACL_ACTION_DENY;
+  u32 acl_index;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "default %U", unformat_ip_acl_action,
+		    &default_action))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  rv = ip_acl_add (default_action, &acl_index);
+  if (rv)
+    return clib_error_return (0, "ip_acl_add returned %d", rv);
+
+  vlib_cli_output (vm, "acl %d", acl_index);
+  return 0;
+}
+
+/*?
+ * Create an ACL. Packets matching none of its rules get the default
+ * action, deny unless given.
+ *
+ * @cliexpar
+ * @cliexstart{ip acl add default permit}
+ * acl 0
+ * @cliexend
+ ?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ip_acl_add_command, static) = {
+  .path = "ip acl add",
+  .short_help = "ip acl add [default permit|deny]",
+  .function = ip_acl_add_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+ip_acl_del_command_fn (vlib_main_t * vm,
+		       unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  u32 acl_index;
+  int rv;
+
+  if (!unformat (input, "%d", &acl_index))
+    return clib_error_return (0, "ACL index required");
+
+  rv = ip_acl_del (acl_index);
+  if (rv == VNET_API_ERROR_INSTANCE_IN_USE)
+    return clib_error_return (0, "acl %d is applied to interfaces",
+			      acl_index);
+  if (rv)
+    return clib_error_return (0, "ip_acl_del returned %d", rv);
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ip_acl_del_command, static) = {
+  .path = "ip acl del",
+  .short_help = "ip acl del <acl-index>",
+  .function = ip_acl_del_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+ip_acl_rule_command_fn (vlib_main_t * vm,
+			unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  ip_acl_rule_t rule;
+  u32 acl_index, rule_index;
+  int rv;
+
+  if (unformat (input, "del %d", &rule_index))
+    {
+      rv = ip_acl_rule_del (rule_index);
+      if (rv)
+	return clib_error_return (0, "ip_acl_rule_del returned %d", rv);
+      return 0;
+    }
+
+  if (!unformat (input, "add acl %d %U", &acl_index,
+		 unformat_ip_acl_rule, &rule))
+    return clib_error_return (0, "parse error `%U'",
+			      format_unformat_error, input);
+
+  rv = ip_acl_rule_add (acl_index, &rule, &rule_index);
+  switch (rv)
+    {
+    case 0:
+      break;
+    case VNET_API_ERROR_VALUE_EXIST:
+      return clib_error_return (0, "priority %d already used",
+				rule.priority);
+    default:
+      return clib_error_return (0, "ip_acl_rule_add returned %d", rv);
+    }
+
+  vlib_cli_output (vm, "rule %d", rule_index);
+  return 0;
+}
+
+/*?
+ * Add a rule to an ACL, or delete a rule. Of the rules matching a packet
+ * the one with the lowest priority wins, rules added without a priority
+ * come after all others of their ACL. Fields not given match any value.
+ * A reflect rule permits and records a session, whose packets in either
+ * direction are then permitted by the ACLs of all interfaces.
+ *
+ * @cliexpar
+ * @cliexstart{ip acl rule add acl 0 deny src 10.0.0.0/8 proto tcp dport 22}
+ * rule 0
+ * @cliexend
+ ?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ip_acl_rule_command, static) = {
+  .path = "ip acl rule",
+  .short_help = "ip acl rule add acl <acl-index> permit|deny|reflect\n"
+  "  [priority <n>] [src <addr>/<len>] [dst <addr>/<len>] [proto <proto>]\n"
+  "  [sport <lo>[-<hi>]] [dport <lo>[-<hi>]] [ip6]\n"
+  "ip acl rule del <rule-index>",
+  .function = ip_acl_rule_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+set_interface_ip_acl_command_fn (vlib_main_t * vm,
+				 unformat_input_t * input,
+				 vlib_cli_command_t * cmd)
+{
+  vnet_main_t *vnm = vnet_get_main ();
+  u32 sw_if_index = ~0, acl_index = ~0;
+  int is_ip6 = 0, is_output = 0, is_add = 1;
+  ip_acl_table_id_t tid;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface, vnm,
+		    &sw_if_index))
+	;
+      else if (unformat (input, "acl %d", &acl_index))
+	;
+      else if (unformat (input, "input"))
+	is_output = 0;
+      else if (unformat (input, "output"))
+	is_output = 1;
+      else if (unformat (input, "ip4"))
+	is_ip6 = 0;
+      else if (unformat (input, "ip6"))
+	is_ip6 = 1;
+      else if (unformat (input, "del"))
+	is_add = 0;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "Interface required but not specified");
+  if (is_add && acl_index == ~0)
+    return clib_error_return (0, "ACL index required but not specified");
+
+  if (is_ip6)
+    tid = is_output ? IP_ACL_TABLE_IP6_OUTPUT : IP_ACL_TABLE_IP6_INPUT;
+  else
+    tid = is_output ? IP_ACL_TABLE_IP4_OUTPUT : IP_ACL_TABLE_IP4_INPUT;
+
+  rv = ip_acl_set_interface (sw_if_index, acl_index, tid, is_add);
+  if (rv)
+    return clib_error_return (0, "ip_acl_set_interface returned %d", rv);
+
+  return 0;
+}
+
+/*?
+ * Apply an ACL to the ip4 or ip6 input or output feature path of an
+ * interface, replacing the one applied before, if any.
+ *
+ * @cliexpar
+ * @cliexcmd{set interface ip acl GigabitEthernet2/0/0 acl 0 input ip4}
+ ?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_interface_ip_acl_command, static) = {
+  .path = "set interface ip acl",
+  .short_help = "set interface ip acl <intfc> acl <acl-index> "
+  "[input|output] [ip4|ip6] [del]",
+  .function = set_interface_ip_acl_command_fn,
+};
+/* *INDENT-ON* */
+
+static u8 *
+format_ip_acl (u8 * s, va_list * args)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  ip_acl_t *acl = va_arg (*args, ip_acl_t *);
+  int verbose = va_arg (*args, int);
+  ip_acl_rule_t *r;
+  ip_acl_tuple_t *t;
+  u32 *ri, *ti;
+  int is_ip6;
+
+  s = format (s, "acl %d: %d rules, %d ip4 tuples, %d ip6 tuples, "
+	      "default %U, %d interfaces",
+	      acl - am->acls, vec_len (acl->rules),
+	      vec_len (acl->tuples[0]), vec_len (acl->tuples[1]),
+	      format_ip_acl_action, acl->default_action, acl->n_interfaces);
+
+  if (!verbose)
+    return s;
+
+  vec_foreach (ri, acl->rules)
+  {
+    r = pool_elt_at_index (am->rules, ri[0]);
+    s = format (s, "\n  [%d] %U, %lld hits", ri[0], format_ip_acl_rule, r,
+		r->hits);
+  }
+
+  for (is_ip6 = 0; is_ip6 < 2; is_ip6++)
+    vec_foreach (ti, acl->tuples[is_ip6])
+    {
+      t = pool_elt_at_index (am->tuples, ti[0]);
+      s = format (s, "\n  tuple %d: %s src /%d dst /%d proto %s sport %s "
+		  "dport %s, %d rules, min priority %d",
+		  ti[0], is_ip6 ? "ip6" : "ip4", t->src_plen, t->dst_plen,
+		  t->proto_exact ? "exact" : "any",
+		  t->src_port_exact ? "exact" : "range",
+		  t->dst_port_exact ? "exact" : "range",
+		  t->n_rules, t->min_priority);
+    }
+
+  return s;
+}
+
+static clib_error_t *
+show_ip_acl_command_fn (vlib_main_t * vm,
+			unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  vnet_main_t *vnm = vnet_get_main ();
+  static char *table_names[] = { "ip4 input", "ip4 output",
+    "ip6 input", "ip6 output"
+  };
+  u32 acl_index = ~0, sw_if_index;
+  int verbose = 0, tid;
+  ip_acl_t *acl;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "verbose"))
+	verbose = 1;
+      else if (unformat (input, "%d", &acl_index))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (acl_index != ~0)
+    {
+      if (pool_is_free_index (am->acls, acl_index))
+	return clib_error_return (0, "no acl %d", acl_index);
+      vlib_cli_output (vm, "%U", format_ip_acl,
+		       pool_elt_at_index (am->acls, acl_index), 1);
+      return 0;
+    }
+
+  /* *INDENT-OFF* */
+  pool_foreach (acl, am->acls,
+  ({
+    vlib_cli_output (vm, "%U", format_ip_acl, acl, verbose);
+  }));
+  /* *INDENT-ON* */
+
+  for (tid = 0; tid < IP_ACL_N_TABLES; tid++)
+    for (sw_if_index = 0;
+	 sw_if_index < vec_len (am->acl_index_by_sw_if_index[tid]);
+	 sw_if_index++)
+      if (am->acl_index_by_sw_if_index[tid][sw_if_index] != ~0)
+	vlib_cli_output (vm, "%U %s: acl %d",
+			 format_vnet_sw_if_index_name, vnm, sw_if_index,
+			 table_names[tid],
+			 am->acl_index_by_sw_if_index[tid][sw_if_index]);
+
+  return 0;
+}
+
+/*?
+ * Show ACLs, their rules and tuples, and the interfaces they are applied
+ * to. A lookup probes at most one hash bucket per tuple.
+ ?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_ip_acl_command, static) = {
+  .path = "show ip acl",
+  .short_help = "show ip acl [<acl-index>] [verbose]",
+  .function = show_ip_acl_command_fn,
+};
+/* *INDENT-ON* */
+
+/*
+ * Lookup benchmark: an ACL of random rules, mixing prefix lengths,
+ * protocols, single ports, port ranges and wildcards, is searched
+ * for random packets, half of them built to hit a rule, with the tuple
+ * space search and with a linear scan of the rules in priority order.
+ */
+static int
+ip_acl_rule_match_linear (ip_acl_rule_t * r, ip_acl_key_t * key)
+{
+  if (r->is_ip6)
+    {
+      ip6_address_t *m;
+
+      m = &ip6_main.fib_masks[r->src_plen];
+      if (((key->src.as_u64[0] & m->as_u64[0]) ^ r->src.as_u64[0]) |
+	  ((key->src.as_u64[1] & m->as_u64[1]) ^ r->src.as_u64[1]))
+	return 0;
+      m = &ip6_main.fib_masks[r->dst_plen];
+      if (((key->dst.as_u64[0] & m->as_u64[0]) ^ r->dst.as_u64[0]) |
+	  ((key->dst.as_u64[1] & m->as_u64[1]) ^ r->dst.as_u64[1]))
+	return 0;
+    }
+  else
+    {
+      if ((key->src.ip4.as_u32 & ip4_main.fib_masks[r->src_plen]) !=
+	  r->src.ip4.as_u32)
+	return 0;
+      if ((key->dst.ip4.as_u32 & ip4_main.fib_masks[r->dst_plen]) !=
+	  r->dst.ip4.as_u32)
+	return 0;
+    }
+
+  if (r->proto && r->proto != (key->proto_tuple & 0xff))
+    return 0;
+
+  return ip_acl_rule_ports_match (r, key);
+}
+
+static void
+test_ip_acl_random_address (ip46_address_t * a, ip46_address_t * base,
+			    u32 base_plen, int is_ip6, u32 * seed)
+{
+  int i;
+
+  if (is_ip6)
+    {
+      for (i = 0; i < ARRAY_LEN (a->as_u64); i++)
+	a->as_u64[i] = (random_u64 (seed) &
+			~ip6_main.fib_masks[base_plen].as_u64[i])
+	  | base->as_u64[i];
+    }
+  else
+    {
+      ip46_address_reset (a);
+      a->ip4.as_u32 = (random_u32 (seed) & ~ip4_main.fib_masks[base_plen])
+	| base->ip4.as_u32;
+    }
+}
+
+static u16
+test_ip_acl_random_port (u16 lo, u16 hi, u32 * seed)
+{
+  return lo + random_u32 (seed) % ((u32) hi - lo + 1);
+}
+
+static clib_error_t *
+test_ip_acl_command_fn (vlib_main_t * vm,
+			unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  u32 n_rules = 1000, n_packets = 1024, iterations = 100;
+  u32 seed = 0xdeadbeef, acl_index = ~0, rule_index;
+  static u8 src_plens4[] = { 16, 24, 32 }, dst_plens4[] = { 16, 24, 32 };
+  static u8 src_plens6[] = { 48, 64, 128 }, dst_plens6[] = { 56, 64, 128 };
+  static u8 protos[] = { 0, IP_PROTOCOL_TCP, IP_PROTOCOL_UDP };
+  ip46_address_t src_base, dst_base;
+  ip_acl_key_t *keys = 0;
+  ip_acl_rule_t rule, *r, **result = 0, *best;
+  ip_acl_t *acl;
+  u32 i, j, src_base_plen, dst_base_plen, n_matched = 0, n_mismatch = 0;
+  u64 t0, tss_clocks, linear_clocks;
+  int is_ip6 = 0, sessions = 0, rv;
+  clib_error_t *error = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "rules %d", &n_rules))
+	;
+      else if (unformat (input, "packets %d", &n_packets))
+	;
+      else if (unformat (input, "iterations %d", &iterations))
+	;
+      else if (unformat (input, "seed %d", &seed))
+	;
+      else if (unformat (input, "ip6"))
+	is_ip6 = 1;
+      else if (unformat (input, "sessions"))
+	sessions = 1;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_rules == 0 || n_packets == 0 || iterations == 0)
+    return clib_error_return (0, "rules, packets and iterations must be "
+			      "non-zero");
+
+  /* Rules from 10.0.0.0/8 to 172.16.0.0/12,
+     or from 2001:db8::/32 to 2001:db8:ffff::/48 */
+  ip46_address_reset (&src_base);
+  ip46_address_reset (&dst_base);
+  if (is_ip6)
+    {
+      src_base.ip6.as_u32[0] = clib_host_to_net_u32 (0x20010db8);
+      dst_base.ip6.as_u32[0] = clib_host_to_net_u32 (0x20010db8);
+      dst_base.ip6.as_u32[1] = clib_host_to_net_u32 (0xffff0000);
+      src_base_plen = 32;
+      dst_base_plen = 48;
+    }
+  else
+    {
+      src_base.ip4.as_u32 = clib_host_to_net_u32 (0x0a000000);
+      dst_base.ip4.as_u32 = clib_host_to_net_u32 (0xac100000);
+      src_base_plen = 8;
+      dst_base_plen = 12;
+    }
+
+  rv = ip_acl_add (IP_ACL_ACTION_DENY, &acl_index);
+  if (rv)
+    return clib_error_return (0, "ip_acl_add returned %d", rv);
+
+  for (i = 0; i < n_rules; i++)
+    {
+      memset (&rule, 0, sizeof (rule));
+      rule.is_ip6 = is_ip6;
+      rule.priority = i;
+      rule.action = random_u32 (&seed) & 1;
+      rule.src_plen = is_ip6 ?
+	src_plens6[random_u32 (&seed) % ARRAY_LEN (src_plens6)] :
+	src_plens4[random_u32 (&seed) % ARRAY_LEN (src_plens4)];
+      rule.dst_plen = is_ip6 ?
+	dst_plens6[random_u32 (&seed) % ARRAY_LEN (dst_plens6)] :
+	dst_plens4[random_u32 (&seed) % ARRAY_LEN (dst_plens4)];
+      test_ip_acl_random_address (&rule.src, &src_base, src_base_plen, is_ip6,
+				  &seed);
+      test_ip_acl_random_address (&rule.dst, &dst_base,
+				  dst_base_plen, is_ip6, &seed);
+      rule.proto = protos[random_u32 (&seed) % ARRAY_LEN (protos)];
+      rule.src_port_hi = rule.dst_port_hi = 65535;
+      if (rule.proto)
+	{
+	  /* Destination port: any, single or range; source: any or range */
+	  switch (random_u32 (&seed) % 5)
+	    {
+	    case 0:
+	    case 1:
+	      rule.dst_port_lo = rule.dst_port_hi =
+		test_ip_acl_random_port (1, 1023, &seed);
+	      break;
+	    case 2:
+	      rule.dst_port_lo = test_ip_acl_random_port (1024, 60000, &seed);
+	      rule.dst_port_hi = rule.dst_port_lo + 1000;
+	      break;
+	    default:
+	      break;
+	    }
+	  if (random_u32 (&seed) % 5 == 0)
+	    rule.src_port_lo = 1024;
+	}
+
+      rv = ip_acl_rule_add (acl_index, &rule, &rule_index);
+      if (rv)
+	{
+	  error = clib_error_return (0, "rule %d: ip_acl_rule_add returned %d",
+				     i, rv);
+	  goto done;
+	}
+    }
+
+  acl = pool_elt_at_index (am->acls, acl_index);
+
+  /* Packets: half built from a random rule, half random */
+  vec_validate_aligned (keys, n_packets - 1, CLIB_CACHE_LINE_BYTES);
+  vec_validate (result, n_packets - 1);
+  for (i = 0; i < n_packets; i++)
+    {
+      ip_acl_key_t *k = &keys[i];
+
+      memset (k, 0, sizeof (*k));
+      k->proto_tuple = random_u32 (&seed) & 1 ?
+	IP_PROTOCOL_TCP : IP_PROTOCOL_UDP;
+      k->src_port = test_ip_acl_random_port (1024, 65535, &seed);
+      k->dst_port = test_ip_acl_random_port (1, 65535, &seed);
+      test_ip_acl_random_address (&k->src, &src_base, src_base_plen, is_ip6,
+				  &seed);
+      test_ip_acl_random_address (&k->dst, &dst_base, dst_base_plen, is_ip6,
+				  &seed);
+      if (i & 1)
+	continue;
+
+      r = pool_elt_at_index (am->rules,
+			     acl->rules[random_u32 (&seed) %
+					vec_len (acl->rules)]);
+      test_ip_acl_random_address (&k->src, &r->src, r->src_plen, is_ip6,
+				  &seed);
+      test_ip_acl_random_address (&k->dst, &r->dst, r->dst_plen, is_ip6,
+				  &seed);
+      if (r->proto)
+	k->proto_tuple = r->proto;
+      k->src_port = test_ip_acl_random_port (r->src_port_lo, r->src_port_hi,
+					     &seed);
+      k->dst_port = test_ip_acl_random_port (r->dst_port_lo, r->dst_port_hi,
+					     &seed);
+    }
+
+  t0 = clib_cpu_time_now ();
+  for (j = 0; j < iterations; j++)
+    for (i = 0; i < n_packets; i++)
+      result[i] = ip_acl_match (am, acl, &keys[i], is_ip6);
+  tss_clocks = clib_cpu_time_now () - t0;
+
+  /* Rules are in priority order, the first match is the best */
+  t0 = clib_cpu_time_now ();
+  for (j = 0; j < iterations; j++)
+    for (i = 0; i < n_packets; i++)
+      {
+	best = 0;
+	vec_foreach_index (rule_index, acl->rules)
+	{
+	  r = pool_elt_at_index (am->rules, acl->rules[rule_index]);
+	  if (ip_acl_rule_match_linear (r, &keys[i]))
+	    {
+	      best = r;
+	      break;
+	    }
+	}
+	n_mismatch += (j == 0 && best != result[i]);
+	n_matched += (j == 0 && best != 0);
+      }
+  linear_clocks = clib_cpu_time_now () - t0;
+
+  vlib_cli_output (vm, "%d %s rules in %d tuples, %d of %d packets matched",
+		   n_rules, is_ip6 ? "ip6" : "ip4",
+		   vec_len (acl->tuples[is_ip6]), n_matched, n_packets);
+  vlib_cli_output (vm, "  tuple space search %10.2f clocks/pkt",
+		   (f64) tss_clocks / ((f64) iterations * n_packets));
+  vlib_cli_output (vm, "  linear scan        %10.2f clocks/pkt",
+		   (f64) linear_clocks / ((f64) iterations * n_packets));
+  if (n_mismatch)
+    vlib_cli_output (vm, "%d lookup mismatches", n_mismatch);
+
+  /* Packets of established sessions skip the ACL */
+  if (sessions)
+    {
+      ip_acl_per_thread_data_t *ptd;
+      ip_acl_session_t *s, **ses = 0;
+      ip_acl_session_key_t skey;
+      u32 now = (u32) vlib_time_now (vm), is_reverse, n_found = 0;
+
+      vlib_worker_thread_barrier_sync (vm);
+      ip_acl_sessions_enable (am);
+      vlib_worker_thread_barrier_release (vm);
+      ptd = vec_elt_at_index (am->per_thread_data, vm->cpu_index);
+
+      /* Sessions of this thread, as if it owned them all */
+      for (i = 0; i < n_packets; i++)
+	{
+	  ip_acl_session_key_init (&skey, &keys[i], is_ip6, 0, acl_index);
+	  s = ip_acl_session_create (am, vm->cpu_index, &skey, now);
+	  if (s)
+	    vec_add1 (ses, s);
+	}
+
+      t0 = clib_cpu_time_now ();
+      for (j = 0; j < iterations; j++)
+	for (i = 0; i < n_packets; i++)
+	  {
+	    ip_acl_session_key_init (&skey, &keys[i], is_ip6, 0, acl_index);
+	    n_found += ip_acl_session_find (ptd, &skey, &is_reverse) != 0;
+	  }
+      t0 = clib_cpu_time_now () - t0;
+
+      vlib_cli_output (vm, "  session lookup     %10.2f clocks/pkt, "
+		       "%d of %d found",
+		       (f64) t0 / ((f64) iterations * n_packets),
+		       n_found / iterations, n_packets);
+
+      for (i = 0; i < vec_len (ses); i++)
+	if (!pool_is_free_index (ptd->sessions, ses[i] - ptd->sessions))
+	  ip_acl_session_delete (am, vm->cpu_index, ses[i]);
+      vec_free (ses);
+    }
+
+done:
+  vec_free (keys);
+  vec_free (result);
+  if (acl_index != ~0)
+    ip_acl_del (acl_index);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_ip_acl_command, static) = {
+  .path = "test ip acl",
+  .short_help = "test ip acl [rules <n>] [packets <n>] [iterations <n>] "
+  "[seed <n>] [ip6] [sessions]",
+  .function = test_ip_acl_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+ip_acl_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  uword memory_size;
+  u32 buckets;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "hash buckets %d", &buckets))
+	am->hash_buckets = 1 << max_log2 (buckets);
+      else if (unformat (input, "hash memory %U",
+			 unformat_memory_size, &memory_size))
+	am->hash_memory_size = memory_size;
+      else if (unformat (input, "sessions per thread %d",
+			 &am->sessions_per_thread))
+	;
+      else if (unformat (input, "session hash buckets %d", &buckets))
+	am->session_hash_buckets = 1 << max_log2 (buckets);
+      else if (unformat (input, "session hash memory %U",
+			 unformat_memory_size, &memory_size))
+	am->session_hash_memory_size = memory_size;
+      else if (unformat (input, "udp timeout %d",
+			 &am->session_timeouts[IP_ACL_SESSION_CLASS_UDP]))
+	;
+      else if (unformat (input, "tcp established timeout %d",
+			 &am->session_timeouts
+			 [IP_ACL_SESSION_CLASS_TCP_ESTABLISHED]))
+	;
+      else if (unformat (input, "tcp transitory timeout %d",
+			 &am->session_timeouts
+			 [IP_ACL_SESSION_CLASS_TCP_TRANSITORY]))
+	;
+      else if (unformat (input, "session timeout %d",
+			 &am->session_timeouts[IP_ACL_SESSION_CLASS_OTHER]))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (ip_acl_config, "ip-acl");
+
+static clib_error_t *
+ip_acl_init (vlib_main_t * vm)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  vlib_node_t *node;
+
+  am->vlib_main = vm;
+  am->vnet_main = vnet_get_main ();
+  am->hash_buckets = IP_ACL_DEFAULT_HASH_BUCKETS;
+  am->hash_memory_size = IP_ACL_DEFAULT_HASH_MEMORY_SIZE;
+  am->sessions_per_thread = IP_ACL_DEFAULT_SESSIONS_PER_THREAD;
+  am->session_hash_buckets = IP_ACL_DEFAULT_SESSION_HASH_BUCKETS;
+  am->session_hash_memory_size = IP_ACL_DEFAULT_SESSION_HASH_MEMORY_SIZE;
+  am->session_timeouts[IP_ACL_SESSION_CLASS_UDP] =
+    IP_ACL_DEFAULT_UDP_TIMEOUT;
+  am->session_timeouts[IP_ACL_SESSION_CLASS_TCP_ESTABLISHED] =
+    IP_ACL_DEFAULT_TCP_ESTABLISHED_TIMEOUT;
+  am->session_timeouts[IP_ACL_SESSION_CLASS_TCP_TRANSITORY] =
+    IP_ACL_DEFAULT_TCP_TRANSITORY_TIMEOUT;
+  am->session_timeouts[IP_ACL_SESSION_CLASS_OTHER] =
+    IP_ACL_DEFAULT_SESSION_TIMEOUT;
+
+  /* Packets handed off to a session's owner re-enter the same ACL node */
+  node = vlib_get_node_by_name (vm, (u8 *) "handoff-dispatch");
+  if (node)
+    {
+      am->handoff_next_index[IP_ACL_TABLE_IP4_INPUT] =
+	vlib_node_add_next (vm, node->index, ip4_acl_in_node.index);
+      am->handoff_next_index[IP_ACL_TABLE_IP4_OUTPUT] =
+	vlib_node_add_next (vm, node->index, ip4_acl_out_node.index);
+      am->handoff_next_index[IP_ACL_TABLE_IP6_INPUT] =
+	vlib_node_add_next (vm, node->index, ip6_acl_in_node.index);
+      am->handoff_next_index[IP_ACL_TABLE_IP6_OUTPUT] =
+	vlib_node_add_next (vm, node->index, ip6_acl_out_node.index);
+    }
+
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (ip_acl_init);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * @brief Stateless IP ACLs, tuple space search.
+ *
+ * An ACL is a list of rules, each matching a source and destination prefix,
+ * an IP protocol or any, and source and destination port ranges. Of the
+ * rules matching a packet the one with the lowest priority value wins, its
+ * action is applied. A packet matching no rule gets the ACL's default
+ * action.
+ *
+ * Rules are grouped into tuples, the rules of a tuple sharing one mask:
+ * the same prefix lengths, and the same protocol and port fields matched
+ * exactly or wildcarded. Port ranges other than a single port are
+ * wildcarded in the mask and checked once the masked key is found. Each
+ * tuple is one exact match lookup in a bihash, so a lookup costs at most
+ * one hash probe per tuple of the ACL, whatever its number of rules.
+ * Tuples are kept sorted on the best priority of their rules and the
+ * search stops at the first tuple which cannot hold a better match.
+ *
+ * Rules with the reflect action permit and record the packet's 5-tuple,
+ * with the interface and the ACL, as a session. Packets of a recorded
+ * session, in either direction, are then permitted by that ACL on that
+ * interface without rule evaluation. Sessions are deleted once idle for
+ * the timeout of their protocol, see session.c.
+ */
+
+#ifndef included_vnet_acl_h
+#define included_vnet_acl_h
+
+#include <vnet/vnet.h>
+#include <vnet/ip/ip.h>
+#include <vppinfra/bihash_40_8.h>
+#include <vppinfra/bihash_48_8.h>
+#include <vppinfra/dlist.h>
+#include <vppinfra/xxhash.h>
+
+/** \brief Lookup key, the packet's fields in the layout masked by tuples.
+    ip4 addresses are the last 4 bytes of src and dst. Ports are in host
+    byte order, 0 for protocols other than TCP and UDP.
+*/
+typedef union
+{
+  struct
+  {
+    ip46_address_t src;
+    ip46_address_t dst;
+    u16 src_port;
+    u16 dst_port;
+    /* protocol in the low byte, tuple index above it */
+    u32 proto_tuple;
+  };
+  u64 as_u64[5];
+} ip_acl_key_t;
+
+#define IP_ACL_TUPLE_SHIFT 8
+
+/* Set in the tuple bits of ip6 session keys */
+#define IP_ACL_SESSION_KEY_IP6 (1 << IP_ACL_TUPLE_SHIFT)
+
+#define foreach_ip_acl_action                   \
+  _(DENY, "deny")                               \
+  _(PERMIT, "permit")                           \
+  _(REFLECT, "reflect")
+
+typedef enum
+{
+#define _(sym,str) IP_ACL_ACTION_##sym,
+  foreach_ip_acl_action
+#undef _
+    IP_ACL_N_ACTION,
+} ip_acl_action_t;
+
+typedef struct
+{
+  /** Masked prefixes */
+  ip46_address_t src;
+  ip46_address_t dst;
+  u8 src_plen;
+  u8 dst_plen;
+  u8 is_ip6;
+
+  /** IP protocol, 0 for any */
+  u8 proto;
+
+  /** Port ranges, host byte order, inclusive */
+  u16 src_port_lo;
+  u16 src_port_hi;
+  u16 dst_port_lo;
+  u16 dst_port_hi;
+
+  /** ip_acl_action_t */
+  u8 action;
+
+  /** Lowest value wins, unique within an ACL */
+  u32 priority;
+
+  u32 acl_index;
+  u32 tuple_index;
+
+  /** Packets matched */
+  u64 hits;
+} ip_acl_rule_t;
+
+typedef struct
+{
+  ip_acl_key_t mask;
+
+  /** Lowest priority of the tuple's rules */
+  u32 min_priority;
+  u32 n_rules;
+
+  u8 src_plen;
+  u8 dst_plen;
+  u8 is_ip6;
+  u8 proto_exact;
+  u8 src_port_exact;
+  u8 dst_port_exact;
+} ip_acl_tuple_t;
+
+typedef struct
+{
+  /** Tuples of ip4 and ip6 rules, sorted on their min_priority */
+  u32 *tuples[2];
+
+  /** Rules of the ACL */
+  u32 *rules;
+
+  /** ip_acl_action_t of packets matching no rule */
+  u8 default_action;
+
+  /** Interfaces the ACL is applied to */
+  u32 n_interfaces;
+} ip_acl_t;
+
+/** \brief Session key: the packet key, the tuple bits replaced by
+    IP_ACL_SESSION_KEY_IP6, plus the interface and the ACL it is
+    recorded for.
+*/
+typedef union
+{
+  struct
+  {
+    ip_acl_key_t key;
+    u32 sw_if_index;
+    u32 acl_index;
+  };
+  u64 as_u64[6];
+} ip_acl_session_key_t;
+
+#define IP_ACL_SESSION_FLAG_TCP_ESTABLISHED (1 << 0)
+#define IP_ACL_SESSION_FLAG_TCP_CLOSING (1 << 1)
+
+/* Sessions of one class share a timeout */
+#define foreach_ip_acl_session_class            \
+  _(UDP, "udp")                                 \
+  _(TCP_TRANSITORY, "tcp transitory")           \
+  _(TCP_ESTABLISHED, "tcp established")         \
+  _(OTHER, "other")
+
+typedef enum
+{
+#define _(sym,str) IP_ACL_SESSION_CLASS_##sym,
+  foreach_ip_acl_session_class
+#undef _
+    IP_ACL_N_SESSION_CLASS,
+} ip_acl_session_class_t;
+
+typedef struct
+{
+  /** Key of the packet which created the session */
+  ip_acl_session_key_t key;
+
+  /** Seconds */
+  u32 last_heard;
+
+  /** Element in the idle list of the session's class */
+  u32 lru_index;
+
+  u8 flags;
+  u8 class;
+} ip_acl_session_t;
+
+/**
+ * Sessions owned by a thread. Only the owner thread reads or writes them,
+ * packets of the session received by other threads are handed off to it.
+ */
+typedef struct
+{
+  /**
+   * Forward and reverse keys of the thread's sessions. Values are session
+   * indices shifted left by one, the low bit set for reverse keys.
+   */
+  clib_bihash_48_8_t session_hash;
+
+  /** Allocated once at its maximum size */
+  ip_acl_session_t *sessions;
+
+  /**
+   * Per class lists of sessions, least recently heard first. Element
+   * values are session indices.
+   */
+  dlist_elt_t *lru_pool;
+  u32 lru_head_index[IP_ACL_N_SESSION_CLASS];
+
+  /** Second in which idle sessions were last looked for */
+  u32 last_expire_check;
+
+  u64 sessions_created;
+  u64 sessions_expired;
+} ip_acl_per_thread_data_t;
+
+typedef enum
+{
+  IP_ACL_TABLE_IP4_INPUT,
+  IP_ACL_TABLE_IP4_OUTPUT,
+  IP_ACL_TABLE_IP6_INPUT,
+  IP_ACL_TABLE_IP6_OUTPUT,
+  IP_ACL_N_TABLES,
+} ip_acl_table_id_t;
+
+typedef struct
+{
+  ip_acl_t *acls;
+  ip_acl_rule_t *rules;
+  ip_acl_tuple_t *tuples;
+
+  /**
+   * Rules sharing a masked key in a tuple, sorted on priority.
+   * Hash values are indices in this pool.
+   */
+  u32 **rule_lists;
+
+  /** Masked keys of all tuples of all ACLs */
+  clib_bihash_40_8_t hash;
+  u32 hash_buckets;
+  uword hash_memory_size;
+
+  /** ACL applied per interface, direction and address family */
+  u32 *acl_index_by_sw_if_index[IP_ACL_N_TABLES];
+
+  /** Feature path indices, see @ref vnet_feature_arc_init() */
+  u32 feature_index[IP_ACL_N_TABLES];
+
+  /** Sessions, set up with the first reflect rule */
+  u8 sessions_enabled;
+  ip_acl_per_thread_data_t *per_thread_data;
+  u32 sessions_per_thread;
+  u32 session_hash_buckets;
+  uword session_hash_memory_size;
+
+  /** Threads owning sessions: the workers, else the main thread */
+  u32 first_session_thread_index;
+  u32 n_session_threads;
+
+  /** handoff-dispatch next of the ACL node of each table */
+  u32 handoff_next_index[IP_ACL_N_TABLES];
+
+  /** Session timeouts, seconds */
+  u32 session_timeouts[IP_ACL_N_SESSION_CLASS];
+
+  /* convenience */
+  vlib_main_t *vlib_main;
+  vnet_main_t *vnet_main;
+} ip_acl_main_t;
+
+extern ip_acl_main_t ip_acl_main;
+
+extern vlib_node_registration_t ip4_acl_in_node;
+extern vlib_node_registration_t ip4_acl_out_node;
+extern vlib_node_registration_t ip6_acl_in_node;
+extern vlib_node_registration_t ip6_acl_out_node;
+extern vlib_node_registration_t ip_acl_session_expire_node;
+
+int ip_acl_add (u8 default_action, u32 * acl_index);
+int ip_acl_del (u32 acl_index);
+int ip_acl_rule_add (u32 acl_index, ip_acl_rule_t * rule, u32 * rule_index);
+int ip_acl_rule_del (u32 rule_index);
+int ip_acl_set_interface (u32 sw_if_index, u32 acl_index,
+			  ip_acl_table_id_t tid, int is_add);
+
+void ip_acl_sessions_enable (ip_acl_main_t * am);
+void ip_acl_sessions_flush (ip_acl_main_t * am, u32 acl_index);
+ip_acl_session_t *ip_acl_session_create (ip_acl_main_t * am,
+					 u32 thread_index,
+					 ip_acl_session_key_t * key, u32 now);
+void ip_acl_session_delete (ip_acl_main_t * am, u32 thread_index,
+			    ip_acl_session_t * s);
+void ip_acl_session_touch (ip_acl_per_thread_data_t * ptd,
+			   ip_acl_session_t * s, u32 now, u8 class);
+
+format_function_t format_ip_acl_rule;
+format_function_t format_ip_acl_action;
+format_function_t format_ip_acl_session;
+unformat_function_t unformat_ip_acl_rule;
+
+/** \brief Fill the lookup key of an ip4 packet */
+always_inline void
+ip4_acl_key_init (ip_acl_key_t * key, ip4_header_t * ip)
+{
+  udp_header_t *udp;
+
+  key->as_u64[0] = key->as_u64[1] = 0;
+  key->as_u64[2] = key->as_u64[3] = 0;
+  key->src.ip4.as_u32 = ip->src_address.as_u32;
+  key->dst.ip4.as_u32 = ip->dst_address.as_u32;
+  key->proto_tuple = ip->protocol;
+  key->src_port = key->dst_port = 0;
+
+  /* Ports of first fragments only */
+  if ((ip->protocol == IP_PROTOCOL_TCP || ip->protocol == IP_PROTOCOL_UDP)
+      && !ip4_get_fragment_offset (ip))
+    {
+      udp = ip4_next_header (ip);
+      key->src_port = clib_net_to_host_u16 (udp->src_port);
+      key->dst_port = clib_net_to_host_u16 (udp->dst_port);
+    }
+}
+
+/** \brief Fill the lookup key of an ip6 packet. Extension headers are not
+    walked, ports are only found right after the ip6 header.
+*/
+always_inline void
+ip6_acl_key_init (ip_acl_key_t * key, ip6_header_t * ip)
+{
+  udp_header_t *udp;
+
+  key->src.ip6.as_u64[0] = ip->src_address.as_u64[0];
+  key->src.ip6.as_u64[1] = ip->src_address.as_u64[1];
+  key->dst.ip6.as_u64[0] = ip->dst_address.as_u64[0];
+  key->dst.ip6.as_u64[1] = ip->dst_address.as_u64[1];
+  key->proto_tuple = ip->protocol;
+  key->src_port = key->dst_port = 0;
+
+  if (ip->protocol == IP_PROTOCOL_TCP || ip->protocol == IP_PROTOCOL_UDP)
+    {
+      udp = ip6_next_header (ip);
+      key->src_port = clib_net_to_host_u16 (udp->src_port);
+      key->dst_port = clib_net_to_host_u16 (udp->dst_port);
+    }
+}
+
+always_inline int
+ip_acl_rule_ports_match (ip_acl_rule_t * r, ip_acl_key_t * key)
+{
+  return (key->src_port >= r->src_port_lo && key->src_port <= r->src_port_hi
+	  && key->dst_port >= r->dst_port_lo
+	  && key->dst_port <= r->dst_port_hi);
+}
+
+/** \brief Find the best rule of an ACL matching a key.
+    @param am ACL main
+    @param acl ACL
+    @param key packet key, see ip4_acl_key_init / ip6_acl_key_init
+    @param is_ip6 ip6 packet
+    @return matching rule with the lowest priority value, 0 if none
+*/
+always_inline ip_acl_rule_t *
+ip_acl_match (ip_acl_main_t * am, ip_acl_t * acl, ip_acl_key_t * key,
+	      int is_ip6)
+{
+  clib_bihash_kv_40_8_t kv;
+  ip_acl_tuple_t *tp;
+  ip_acl_rule_t *r, *best = 0;
+  u32 *ti, *ri, *rules;
+
+  vec_foreach (ti, acl->tuples[is_ip6])
+  {
+    tp = pool_elt_at_index (am->tuples, ti[0]);
+
+    /* No rule of this or the next tuples can do better */
+    if (best && tp->min_priority > best->priority)
+      break;
+
+    kv.key[0] = key->as_u64[0] & tp->mask.as_u64[0];
+    kv.key[1] = key->as_u64[1] & tp->mask.as_u64[1];
+    kv.key[2] = key->as_u64[2] & tp->mask.as_u64[2];
+    kv.key[3] = key->as_u64[3] & tp->mask.as_u64[3];
+    kv.key[4] = key->as_u64[4] & tp->mask.as_u64[4];
+    ((ip_acl_key_t *) kv.key)->proto_tuple |= ti[0] << IP_ACL_TUPLE_SHIFT;
+
+    if (clib_bihash_search_40_8 (&am->hash, &kv, &kv))
+      continue;
+
+    rules = am->rule_lists[kv.value];
+    vec_foreach (ri, rules)
+    {
+      r = pool_elt_at_index (am->rules, ri[0]);
+      if (best && r->priority > best->priority)
+	break;
+      if (ip_acl_rule_ports_match (r, key))
+	{
+	  best = r;
+	  break;
+	}
+    }
+  }
+
+  return best;
+}
+
+/** \brief Build the session key of a packet */
+always_inline void
+ip_acl_session_key_init (ip_acl_session_key_t * skey, ip_acl_key_t * key,
+			 int is_ip6, u32 sw_if_index, u32 acl_index)
+{
+  skey->as_u64[0] = key->as_u64[0];
+  skey->as_u64[1] = key->as_u64[1];
+  skey->as_u64[2] = key->as_u64[2];
+  skey->as_u64[3] = key->as_u64[3];
+  skey->as_u64[4] = key->as_u64[4];
+  skey->key.proto_tuple &= 0xff;
+  if (is_ip6)
+    skey->key.proto_tuple |= IP_ACL_SESSION_KEY_IP6;
+  skey->sw_if_index = sw_if_index;
+  skey->acl_index = acl_index;
+}
+
+/** \brief Thread owning the session of a packet.
+    The hash is symmetric, so that both directions of a flow map to the
+    same thread.
+*/
+always_inline u32
+ip_acl_session_owner (ip_acl_main_t * am, ip_acl_key_t * key)
+{
+  u64 h;
+
+  if (am->n_session_threads == 1)
+    return am->first_session_thread_index;
+
+  h = key->as_u64[0] ^ key->as_u64[1] ^ key->as_u64[2] ^ key->as_u64[3];
+  h ^= key->src_port ^ key->dst_port ^ (key->proto_tuple & 0xff);
+  return am->first_session_thread_index +
+    clib_xxhash (h) % am->n_session_threads;
+}
+
+/** \brief Find the session of a packet, on its owner thread.
+    @param ptd the owner thread's sessions
+    @param skey session key of the packet
+    @param is_reverse returned 1 if the packet is return traffic
+    @return session or 0 if none
+*/
+always_inline ip_acl_session_t *
+ip_acl_session_find (ip_acl_per_thread_data_t * ptd,
+		     ip_acl_session_key_t * skey, u32 * is_reverse)
+{
+  clib_bihash_kv_48_8_t kv;
+
+  clib_memcpy (kv.key, skey, sizeof (kv.key));
+  if (clib_bihash_search_48_8 (&ptd->session_hash, &kv, &kv) < 0)
+    return 0;
+
+  *is_reverse = kv.value & 1;
+  return pool_elt_at_index (ptd->sessions, kv.value >> 1);
+}
+
+always_inline u8
+ip_acl_session_class (ip_acl_session_t * s)
+{
+  switch (s->key.key.proto_tuple & 0xff)
+    {
+    case IP_PROTOCOL_TCP:
+      if ((s->flags & (IP_ACL_SESSION_FLAG_TCP_ESTABLISHED |
+		       IP_ACL_SESSION_FLAG_TCP_CLOSING)) ==
+	  IP_ACL_SESSION_FLAG_TCP_ESTABLISHED)
+	return IP_ACL_SESSION_CLASS_TCP_ESTABLISHED;
+      return IP_ACL_SESSION_CLASS_TCP_TRANSITORY;
+    case IP_PROTOCOL_UDP:
+      return IP_ACL_SESSION_CLASS_UDP;
+    default:
+      return IP_ACL_SESSION_CLASS_OTHER;
+    }
+}
+
+/** \brief Refresh a session on a packet, on its owner thread.
+    A packet in the reverse direction establishes a TCP session, FIN or RST
+    in either direction moves it to the transitory timeout. The session
+    moves to the end of its idle list at most once per second.
+*/
+always_inline void
+ip_acl_session_update (ip_acl_per_thread_data_t * ptd, ip_acl_session_t * s,
+		       u32 now, u8 tcp_flags, u32 is_reverse)
+{
+  u8 class = s->class;
+
+  if ((s->key.key.proto_tuple & 0xff) == IP_PROTOCOL_TCP)
+    {
+      if (PREDICT_FALSE (tcp_flags & (TCP_FLAG_FIN | TCP_FLAG_RST)))
+	s->flags |= IP_ACL_SESSION_FLAG_TCP_CLOSING;
+      else if (is_reverse)
+	s->flags |= IP_ACL_SESSION_FLAG_TCP_ESTABLISHED;
+      class = ip_acl_session_class (s);
+    }
+
+  if (PREDICT_FALSE (s->last_heard != now || s->class != class))
+    ip_acl_session_touch (ptd, s, now, class);
+}
+
+#endif /* included_vnet_acl_h */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vnet/acl/acl.h>
+#include <vnet/handoff.h>
+
+/**
+ * @file
+ * @brief IP ACL feature nodes.
+ *
+ * The ACL of the interface is the feature's config data. Permitted
+ * packets continue on the feature path, denied ones are dropped. Once
+ * reflect rules exist, packets of a known session are permitted without
+ * evaluating the ACL. Packets are then handled by the thread owning their
+ * session, or which would own it: other threads hand them off to it, and
+ * it runs the same ACL node on them.
+ */
+
+typedef struct
+{
+  u32 sw_if_index;
+  u32 acl_index;
+  u32 rule_index;
+  u8 action;
+  u8 is_session;
+  u32 handoff_thread_index;
+} ip_acl_trace_t;
+
+static u8 *
+format_ip_acl_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  ip_acl_trace_t *t = va_arg (*args, ip_acl_trace_t *);
+
+  if (t->handoff_thread_index != ~0)
+    return format (s, "IP_ACL: handoff to session owner thread %d",
+		   t->handoff_thread_index);
+
+  s = format (s, "IP_ACL: sw_if_index %d acl %d ", t->sw_if_index,
+	      t->acl_index);
+  if (t->is_session)
+    s = format (s, "session ");
+  else if (t->rule_index == ~0)
+    s = format (s, "no match, default ");
+  else
+    s = format (s, "rule %d ", t->rule_index);
+  return format (s, "%U", format_ip_acl_action, t->action);
+}
+
+#define foreach_ip_acl_error                    \
+_(PERMIT, "ACL permitted packets")              \
+_(DENY, "ACL denied packets")                   \
+_(SESSION, "ACL packets of known sessions")     \
+_(SESSION_CREATED, "ACL sessions created")      \
+_(SESSION_TABLE_FULL, "ACL session table full")       \
+_(HANDOFF, "ACL packets handed off to the session owner")
+
+typedef enum
+{
+#define _(sym,str) IP_ACL_ERROR_##sym,
+  foreach_ip_acl_error
+#undef _
+    IP_ACL_N_ERROR,
+} ip_acl_error_t;
+
+static char *ip_acl_error_strings[] = {
+#define _(sym,string) string,
+  foreach_ip_acl_error
+#undef _
+};
+
+typedef enum
+{
+  IP_ACL_NEXT_DROP,
+  IP_ACL_N_NEXT,
+} ip_acl_next_t;
+
+/* TCP flags of a packet known to be TCP, with ports in its key */
+always_inline u8
+ip_acl_tcp_flags (u8 * h, int is_ip6)
+{
+  tcp_header_t *tcp = is_ip6 ? ip6_next_header ((ip6_header_t *) h) :
+    ip4_next_header ((ip4_header_t *) h);
+
+  return tcp->flags;
+}
+
+always_inline uword
+ip_acl_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
+	       vlib_frame_t * frame, int is_ip6, int is_output)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  ip_lookup_main_t *lm = is_ip6 ?
+    &ip6_main.lookup_main : &ip4_main.lookup_main;
+  vnet_feature_config_main_t *cm =
+    &lm->feature_config_mains[is_output ? VNET_IP_TX_FEAT :
+			      VNET_IP_RX_UNICAST_FEAT];
+  static __thread vlib_frame_queue_elt_t **handoff_queue_elt_by_worker_index;
+  vlib_frame_queue_elt_t *hf;
+  u32 n_left_from, *from, *to_next, next_index;
+  u32 n_permit = 0, n_deny = 0, n_session = 0, n_created = 0, n_full = 0;
+  u32 n_handoff = 0;
+  u32 thread_index = vm->cpu_index;
+  u32 now = (u32) vlib_time_now (vm);
+  u32 handoff_next_index =
+    am->handoff_next_index[is_ip6 * 2 + is_output];
+  ip_acl_per_thread_data_t *ptd = 0;
+  ip_acl_key_t key0;
+  ip_acl_session_key_t skey0;
+  int i;
+
+  if (am->sessions_enabled)
+    {
+      ptd = vec_elt_at_index (am->per_thread_data, thread_index);
+      if (PREDICT_FALSE (handoff_queue_elt_by_worker_index == 0))
+	vec_validate (handoff_queue_elt_by_worker_index,
+		      vec_len (am->per_thread_data) - 1);
+    }
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+  next_index = node->cached_next_index;
+
+  while (n_left_from > 0)
+    {
+      u32 n_left_to_next;
+
+      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+      while (n_left_from > 0 && n_left_to_next > 0)
+	{
+	  vlib_buffer_t *b0;
+	  ip_acl_rule_t *r0 = 0;
+	  ip_acl_session_t *s0 = 0;
+	  ip_acl_t *acl0;
+	  u32 bi0, next0, *acl_index0, is_reverse0, owner0, sw_if_index0;
+	  u8 *h0, action0, tcp_flags0;
+
+	  if (n_left_from > 2)
+	    {
+	      vlib_buffer_t *p2 = vlib_get_buffer (vm, from[2]);
+
+	      vlib_prefetch_buffer_header (p2, LOAD);
+	      CLIB_PREFETCH (p2->data, 2 * CLIB_CACHE_LINE_BYTES, LOAD);
+	    }
+
+	  bi0 = from[0];
+	  from += 1;
+	  n_left_from -= 1;
+
+	  b0 = vlib_get_buffer (vm, bi0);
+	  h0 = vlib_buffer_get_current (b0);
+	  if (is_output)
+	    h0 += vnet_buffer (b0)->ip.save_rewrite_length;
+
+	  if (is_ip6)
+	    ip6_acl_key_init (&key0, (ip6_header_t *) h0);
+	  else
+	    ip4_acl_key_init (&key0, (ip4_header_t *) h0);
+
+	  if (ptd)
+	    {
+	      owner0 = ip_acl_session_owner (am, &key0);
+	      if (PREDICT_FALSE (owner0 != thread_index))
+		{
+		  /* The owner runs this node again, config index untouched */
+		  hf = dpdk_get_handoff_queue_elt
+		    (owner0, handoff_queue_elt_by_worker_index);
+		  vnet_buffer (b0)->handoff.next_index = handoff_next_index;
+		  hf->buffer_index[hf->n_vectors++] = bi0;
+		  if (hf->n_vectors == VLIB_FRAME_SIZE)
+		    {
+		      vlib_put_handoff_queue_elt (owner0, hf);
+		      handoff_queue_elt_by_worker_index[owner0] = 0;
+		    }
+		  n_handoff++;
+
+		  if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+		    {
+		      ip_acl_trace_t *t =
+			vlib_add_trace (vm, node, b0, sizeof (*t));
+		      t->handoff_thread_index = owner0;
+		    }
+		  continue;
+		}
+	    }
+
+	  to_next[0] = bi0;
+	  to_next += 1;
+	  n_left_to_next -= 1;
+
+	  acl_index0 = vnet_get_config_data (&cm->config_main,
+					     &b0->current_config_index,
+					     &next0, sizeof (acl_index0[0]));
+	  acl0 = pool_elt_at_index (am->acls, acl_index0[0]);
+	  sw_if_index0 =
+	    vnet_buffer (b0)->sw_if_index[is_output ? VLIB_TX : VLIB_RX];
+
+	  if (ptd)
+	    {
+	      ip_acl_session_key_init (&skey0, &key0, is_ip6, sw_if_index0,
+				       acl_index0[0]);
+	      s0 = ip_acl_session_find (ptd, &skey0, &is_reverse0);
+	    }
+
+	  if (s0)
+	    {
+	      tcp_flags0 = 0;
+	      if ((key0.proto_tuple & 0xff) == IP_PROTOCOL_TCP)
+		tcp_flags0 = ip_acl_tcp_flags (h0, is_ip6);
+	      ip_acl_session_update (ptd, s0, now, tcp_flags0, is_reverse0);
+	      action0 = IP_ACL_ACTION_PERMIT;
+	      n_session++;
+	    }
+	  else
+	    {
+	      r0 = ip_acl_match (am, acl0, &key0, is_ip6);
+	      if (r0)
+		{
+		  r0->hits++;
+		  action0 = r0->action;
+		}
+	      else
+		action0 = acl0->default_action;
+
+	      if (action0 == IP_ACL_ACTION_REFLECT)
+		{
+		  if (ip_acl_session_create (am, thread_index, &skey0, now))
+		    n_created++;
+		  else
+		    n_full++;
+		}
+	    }
+
+	  if (action0 == IP_ACL_ACTION_DENY)
+	    {
+	      next0 = IP_ACL_NEXT_DROP;
+	      b0->error = node->errors[IP_ACL_ERROR_DENY];
+	      n_deny++;
+	    }
+	  else if (!s0)
+	    n_permit++;
+
+	  if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+	    {
+	      ip_acl_trace_t *t = vlib_add_trace (vm, node, b0, sizeof (*t));
+	      t->sw_if_index = sw_if_index0;
+	      t->acl_index = acl_index0[0];
+	      t->rule_index = r0 ? r0 - am->rules : ~0;
+	      t->action = action0;
+	      t->is_session = s0 != 0;
+	      t->handoff_thread_index = ~0;
+	    }
+
+	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index, to_next,
+					   n_left_to_next, bi0, next0);
+	}
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+
+  if (n_handoff)
+    {
+      for (i = 0; i < vec_len (handoff_queue_elt_by_worker_index); i++)
+	{
+	  hf = handoff_queue_elt_by_worker_index[i];
+	  if (hf)
+	    {
+	      vlib_put_handoff_queue_elt (i, hf);
+	      handoff_queue_elt_by_worker_index[i] = 0;
+	    }
+	}
+      vlib_publish_handoff_queue_elts ();
+    }
+
+  vlib_node_increment_counter (vm, node->node_index, IP_ACL_ERROR_PERMIT,
+			       n_permit);
+  vlib_node_increment_counter (vm, node->node_index, IP_ACL_ERROR_DENY,
+			       n_deny);
+  vlib_node_increment_counter (vm, node->node_index, IP_ACL_ERROR_SESSION,
+			       n_session);
+  vlib_node_increment_counter (vm, node->node_index,
+			       IP_ACL_ERROR_SESSION_CREATED, n_created);
+  vlib_node_increment_counter (vm, node->node_index,
+			       IP_ACL_ERROR_SESSION_TABLE_FULL, n_full);
+  vlib_node_increment_counter (vm, node->node_index, IP_ACL_ERROR_HANDOFF,
+			       n_handoff);
+  return frame->n_vectors;
+}
+
+static uword
+ip4_acl_in_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+		    vlib_frame_t * frame)
+{
+  return ip_acl_inline (vm, node, frame, 0 /* is_ip6 */ , 0 /* is_output */ );
+}
+
+static uword
+ip4_acl_out_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+		     vlib_frame_t * frame)
+{
+  return ip_acl_inline (vm, node, frame, 0 /* is_ip6 */ , 1 /* is_output */ );
+}
+
+static uword
+ip6_acl_in_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+		    vlib_frame_t * frame)
+{
+  return ip_acl_inline (vm, node, frame, 1 /* is_ip6 */ , 0 /* is_output */ );
+}
+
+static uword
+ip6_acl_out_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+		     vlib_frame_t * frame)
+{
+  return ip_acl_inline (vm, node, frame, 1 /* is_ip6 */ , 1 /* is_output */ );
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (ip4_acl_in_node) = {
+  .function = ip4_acl_in_node_fn,
+  .name = "ip4-acl-in",
+  .vector_size = sizeof (u32),
+  .format_trace = format_ip_acl_trace,
+  .n_errors = ARRAY_LEN (ip_acl_error_strings),
+  .error_strings = ip_acl_error_strings,
+  .n_next_nodes = IP_ACL_N_NEXT,
+  .next_nodes = {
+    [IP_ACL_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (ip4_acl_in_node, ip4_acl_in_node_fn);
+
+VLIB_REGISTER_NODE (ip4_acl_out_node) = {
+  .function = ip4_acl_out_node_fn,
+  .name = "ip4-acl-out",
+  .vector_size = sizeof (u32),
+  .format_trace = format_ip_acl_trace,
+  .n_errors = ARRAY_LEN (ip_acl_error_strings),
+  .error_strings = ip_acl_error_strings,
+  .n_next_nodes = IP_ACL_N_NEXT,
+  .next_nodes = {
+    [IP_ACL_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (ip4_acl_out_node, ip4_acl_out_node_fn);
+
+VLIB_REGISTER_NODE (ip6_acl_in_node) = {
+  .function = ip6_acl_in_node_fn,
+  .name = "ip6-acl-in",
+  .vector_size = sizeof (u32),
+  .format_trace = format_ip_acl_trace,
+  .n_errors = ARRAY_LEN (ip_acl_error_strings),
+  .error_strings = ip_acl_error_strings,
+  .n_next_nodes = IP_ACL_N_NEXT,
+  .next_nodes = {
+    [IP_ACL_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (ip6_acl_in_node, ip6_acl_in_node_fn);
+
+VLIB_REGISTER_NODE (ip6_acl_out_node) = {
+  .function = ip6_acl_out_node_fn,
+  .name = "ip6-acl-out",
+  .vector_size = sizeof (u32),
+  .format_trace = format_ip_acl_trace,
+  .n_errors = ARRAY_LEN (ip_acl_error_strings),
+  .error_strings = ip_acl_error_strings,
+  .n_next_nodes = IP_ACL_N_NEXT,
+  .next_nodes = {
+    [IP_ACL_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (ip6_acl_out_node, ip6_acl_out_node_fn);
+
+VNET_IP4_UNICAST_FEATURE_INIT (ip4_acl_in, static) = {
+  .node_name = "ip4-acl-in",
+  .runs_before = ORDER_CONSTRAINTS {"ip4-inacl", 0},
+  .feature_index = &ip_acl_main.feature_index[IP_ACL_TABLE_IP4_INPUT],
+};
+
+VNET_IP4_TX_FEATURE_INIT (ip4_acl_out, static) = {
+  .node_name = "ip4-acl-out",
+  .runs_before = ORDER_CONSTRAINTS {"interface-output", 0},
+  .feature_index = &ip_acl_main.feature_index[IP_ACL_TABLE_IP4_OUTPUT],
+};
+
+VNET_IP6_UNICAST_FEATURE_INIT (ip6_acl_in, static) = {
+  .node_name = "ip6-acl-in",
+  .runs_before = ORDER_CONSTRAINTS {"ip6-inacl", 0},
+  .feature_index = &ip_acl_main.feature_index[IP_ACL_TABLE_IP6_INPUT],
+};
+
+VNET_IP6_TX_FEATURE_INIT (ip6_acl_out, static) = {
+  .node_name = "ip6-acl-out",
+  .runs_before = ORDER_CONSTRAINTS {"interface-output", 0},
+  .feature_index = &ip_acl_main.feature_index[IP_ACL_TABLE_IP6_OUTPUT],
+};
+/* *INDENT-ON* */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vnet/acl/acl.h>
+#include <vlib/threads.h>
+
+#include <vppinfra/bihash_48_8.h>
+#include <vppinfra/bihash_template.c>
+
+/**
+ * @file
+ * @brief Reflexive ACL sessions.
+ *
+ * Each session belongs to one thread, chosen by a hash of its 5-tuple
+ * which is the same in both directions. The ACL nodes hand packets off
+ * to the owner, so a thread's session hash, pool and idle lists are only
+ * ever touched by that thread, or by the main thread at the barrier.
+ *
+ * All sessions of a class have the same timeout, so keeping each class
+ * in a list ordered on last heard time is enough to find the idle ones:
+ * they are at the head. A packet moves its session to the tail, at most
+ * once per second since last heard times are in seconds.
+ */
+
+/**
+ * @brief Set up the session tables of all threads.
+ *
+ * Called with the first reflect rule, with the worker threads held at the
+ * barrier. Sessions stay enabled from then on.
+ */
+void
+ip_acl_sessions_enable (ip_acl_main_t * am)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  ip_acl_per_thread_data_t *ptd;
+  dlist_elt_t *head;
+  uword *p;
+  int i;
+
+  if (am->sessions_enabled)
+    return;
+
+  am->first_session_thread_index = 0;
+  am->n_session_threads = 1;
+  p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+  if (p)
+    {
+      vlib_thread_registration_t *tr = (vlib_thread_registration_t *) p[0];
+      if (tr->count)
+	{
+	  am->first_session_thread_index = tr->first_index;
+	  am->n_session_threads = tr->count;
+	}
+    }
+
+  vec_validate (am->per_thread_data, tm->n_vlib_mains - 1);
+  vec_foreach (ptd, am->per_thread_data)
+  {
+    clib_bihash_init_48_8 (&ptd->session_hash, "ip acl sessions",
+			   am->session_hash_buckets,
+			   am->session_hash_memory_size);
+    pool_alloc_aligned (ptd->sessions, am->sessions_per_thread,
+			CLIB_CACHE_LINE_BYTES);
+    pool_alloc (ptd->lru_pool,
+		am->sessions_per_thread + IP_ACL_N_SESSION_CLASS);
+    for (i = 0; i < IP_ACL_N_SESSION_CLASS; i++)
+      {
+	pool_get (ptd->lru_pool, head);
+	ptd->lru_head_index[i] = head - ptd->lru_pool;
+	clib_dlist_init (ptd->lru_pool, ptd->lru_head_index[i]);
+      }
+  }
+
+  /* *INDENT-OFF* */
+  foreach_vlib_main (({
+    vlib_node_set_state (this_vlib_main, ip_acl_session_expire_node.index,
+                         VLIB_NODE_STATE_POLLING);
+  }));
+  /* *INDENT-ON* */
+
+  am->sessions_enabled = 1;
+}
+
+static void
+ip_acl_session_reverse_key (ip_acl_session_key_t * skey,
+			    ip_acl_session_key_t * reverse)
+{
+  *reverse = *skey;
+  reverse->key.src = skey->key.dst;
+  reverse->key.dst = skey->key.src;
+  reverse->key.src_port = skey->key.dst_port;
+  reverse->key.dst_port = skey->key.src_port;
+}
+
+/**
+ * @brief Create the session of a packet permitted by a reflect rule.
+ *
+ * @param am           ACL main.
+ * @param thread_index Current thread, the session's owner.
+ * @param skey         Session key of the packet.
+ * @param now          Current time, seconds.
+ *
+ * @returns the session, 0 if the thread's table is full.
+ */
+ip_acl_session_t *
+ip_acl_session_create (ip_acl_main_t * am, u32 thread_index,
+		       ip_acl_session_key_t * skey, u32 now)
+{
+  ip_acl_per_thread_data_t *ptd =
+    vec_elt_at_index (am->per_thread_data, thread_index);
+  clib_bihash_kv_48_8_t kv, value;
+  ip_acl_session_t *s;
+  dlist_elt_t *lru;
+  u32 session_index;
+
+  clib_memcpy (kv.key, skey, sizeof (kv.key));
+
+  /* An earlier packet of the frame may have created it */
+  if (clib_bihash_search_48_8 (&ptd->session_hash, &kv, &value) == 0)
+    return ptd->sessions + (value.value >> 1);
+
+  if (pool_elts (ptd->sessions) >= am->sessions_per_thread)
+    return 0;
+
+  pool_get (ptd->sessions, s);
+  memset (s, 0, sizeof (*s));
+  s->key = *skey;
+  s->last_heard = now;
+  s->class = ip_acl_session_class (s);
+  session_index = s - ptd->sessions;
+
+  pool_get (ptd->lru_pool, lru);
+  lru->value = session_index;
+  s->lru_index = lru - ptd->lru_pool;
+  clib_dlist_addtail (ptd->lru_pool, ptd->lru_head_index[s->class],
+		      s->lru_index);
+
+  kv.value = session_index << 1;
+  clib_bihash_add_del_48_8 (&ptd->session_hash, &kv, 1 /* is_add */ );
+  ip_acl_session_reverse_key (&s->key, (ip_acl_session_key_t *) kv.key);
+  kv.value = (session_index << 1) | 1;
+  clib_bihash_add_del_48_8 (&ptd->session_hash, &kv, 1 /* is_add */ );
+
+  ptd->sessions_created++;
+
+  return s;
+}
+
+/**
+ * @brief Move a session heard from to the end of its class's idle list.
+ */
+void
+ip_acl_session_touch (ip_acl_per_thread_data_t * ptd, ip_acl_session_t * s,
+		      u32 now, u8 class)
+{
+  s->last_heard = now;
+  s->class = class;
+  clib_dlist_remove (ptd->lru_pool, s->lru_index);
+  clib_dlist_addtail (ptd->lru_pool, ptd->lru_head_index[class],
+		      s->lru_index);
+}
+
+/**
+ * @brief Delete a session, on its owner thread or at the barrier.
+ */
+void
+ip_acl_session_delete (ip_acl_main_t * am, u32 thread_index,
+		       ip_acl_session_t * s)
+{
+  ip_acl_per_thread_data_t *ptd =
+    vec_elt_at_index (am->per_thread_data, thread_index);
+  clib_bihash_kv_48_8_t kv;
+
+  clib_memcpy (kv.key, &s->key, sizeof (kv.key));
+  clib_bihash_add_del_48_8 (&ptd->session_hash, &kv, 0 /* is_add */ );
+  ip_acl_session_reverse_key (&s->key, (ip_acl_session_key_t *) kv.key);
+  clib_bihash_add_del_48_8 (&ptd->session_hash, &kv, 0 /* is_add */ );
+
+  clib_dlist_remove (ptd->lru_pool, s->lru_index);
+  pool_put_index (ptd->lru_pool, s->lru_index);
+  pool_put (ptd->sessions, s);
+}
+
+/**
+ * @brief Delete the sessions of an ACL on all threads.
+ *
+ * Called with the worker threads held at the barrier, before the ACL
+ * index can be reused.
+ */
+void
+ip_acl_sessions_flush (ip_acl_main_t * am, u32 acl_index)
+{
+  ip_acl_per_thread_data_t *ptd;
+  ip_acl_session_t *s;
+  u32 *to_delete = 0, *i;
+
+  if (!am->sessions_enabled)
+    return;
+
+  vec_foreach (ptd, am->per_thread_data)
+  {
+    /* *INDENT-OFF* */
+    pool_foreach (s, ptd->sessions,
+    ({
+      if (s->key.acl_index == acl_index)
+        vec_add1 (to_delete, s - ptd->sessions);
+    }));
+    /* *INDENT-ON* */
+    vec_foreach (i, to_delete)
+      ip_acl_session_delete (am, ptd - am->per_thread_data,
+			     pool_elt_at_index (ptd->sessions, i[0]));
+    vec_reset_length (to_delete);
+  }
+  vec_free (to_delete);
+}
+
+#define foreach_ip_acl_session_expire_error             \
+_(EXPIRED, "ACL sessions expired")
+
+typedef enum
+{
+#define _(sym,str) IP_ACL_SESSION_EXPIRE_ERROR_##sym,
+  foreach_ip_acl_session_expire_error
+#undef _
+    IP_ACL_SESSION_EXPIRE_N_ERROR,
+} ip_acl_session_expire_error_t;
+
+static char *ip_acl_session_expire_error_strings[] = {
+#define _(sym,string) string,
+  foreach_ip_acl_session_expire_error
+#undef _
+};
+
+/**
+ * @brief Session expiry.
+ *
+ * Polls on every thread once sessions are enabled, but only looks at the
+ * heads of the idle lists when the second changes. Deletes at most a
+ * frame's worth of sessions per call, the remaining idle sessions are
+ * found again on the next call.
+ */
+static uword
+ip_acl_session_expire_node_fn (vlib_main_t * vm,
+			       vlib_node_runtime_t * node,
+			       vlib_frame_t * frame)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  ip_acl_per_thread_data_t *ptd;
+  ip_acl_session_t *s;
+  dlist_elt_t *head;
+  u32 now = (u32) vlib_time_now (vm);
+  u32 class, n_expired = 0;
+
+  ptd = vec_elt_at_index (am->per_thread_data, vm->cpu_index);
+
+  if (PREDICT_TRUE (now == ptd->last_expire_check))
+    return 0;
+
+  for (class = 0; class < IP_ACL_N_SESSION_CLASS; class++)
+    {
+      head = pool_elt_at_index (ptd->lru_pool, ptd->lru_head_index[class]);
+      /* A new list head links to ~0, an emptied one to itself */
+      while (head->next != ~0 && head->next != ptd->lru_head_index[class])
+	{
+	  s = pool_elt_at_index
+	    (ptd->sessions, pool_elt_at_index (ptd->lru_pool,
+					       head->next)->value);
+	  if (now - s->last_heard <= am->session_timeouts[class])
+	    break;
+	  ip_acl_session_delete (am, vm->cpu_index, s);
+	  if (++n_expired == VLIB_FRAME_SIZE)
+	    goto done;
+	}
+    }
+
+  ptd->last_expire_check = now;
+
+done:
+  ptd->sessions_expired += n_expired;
+  vlib_node_increment_counter (vm, node->node_index,
+			       IP_ACL_SESSION_EXPIRE_ERROR_EXPIRED,
+			       n_expired);
+  return n_expired;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (ip_acl_session_expire_node) = {
+  .function = ip_acl_session_expire_node_fn,
+  .name = "ip-acl-session-expire",
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_DISABLED,
+  .n_errors = ARRAY_LEN (ip_acl_session_expire_error_strings),
+  .error_strings = ip_acl_session_expire_error_strings,
+};
+/* *INDENT-ON* */
+
+u8 *
+format_ip_acl_session (u8 * s, va_list * args)
+{
+  ip_acl_session_t *ses = va_arg (*args, ip_acl_session_t *);
+  f64 now = va_arg (*args, f64);
+  ip_acl_key_t *k = &ses->key.key;
+  u32 proto = k->proto_tuple & 0xff;
+
+  if (k->proto_tuple & IP_ACL_SESSION_KEY_IP6)
+    s = format (s, "%U:%d -> %U:%d",
+		format_ip6_address, &k->src.ip6, k->src_port,
+		format_ip6_address, &k->dst.ip6, k->dst_port);
+  else
+    s = format (s, "%U:%d -> %U:%d",
+		format_ip4_address, &k->src.ip4, k->src_port,
+		format_ip4_address, &k->dst.ip4, k->dst_port);
+
+  s = format (s, " %U, sw_if_index %d acl %d, last heard %ds ago",
+	      format_ip_protocol, proto, ses->key.sw_if_index,
+	      ses->key.acl_index, (u32) now - ses->last_heard);
+  if (ses->flags & IP_ACL_SESSION_FLAG_TCP_CLOSING)
+    s = format (s, ", closing");
+  else if (ses->flags & IP_ACL_SESSION_FLAG_TCP_ESTABLISHED)
+    s = format (s, ", established");
+  return s;
+}
+
+static clib_error_t *
+show_ip_acl_sessions_command_fn (vlib_main_t * vm,
+				 unformat_input_t * input,
+				 vlib_cli_command_t * cmd)
+{
+  ip_acl_main_t *am = &ip_acl_main;
+  ip_acl_per_thread_data_t *ptd;
+  ip_acl_session_t *s;
+  f64 now = vlib_time_now (vm);
+  int verbose = 0;
+
+  if (unformat (input, "verbose"))
+    verbose = 1;
+
+  if (!am->sessions_enabled)
+    {
+      vlib_cli_output (vm, "no reflect rules, sessions disabled");
+      return 0;
+    }
+
+  vlib_cli_output (vm, "timeouts: udp %ds, tcp established %ds, "
+		   "tcp transitory %ds, other %ds",
+		   am->session_timeouts[IP_ACL_SESSION_CLASS_UDP],
+		   am->session_timeouts[IP_ACL_SESSION_CLASS_TCP_ESTABLISHED],
+		   am->session_timeouts[IP_ACL_SESSION_CLASS_TCP_TRANSITORY],
+		   am->session_timeouts[IP_ACL_SESSION_CLASS_OTHER]);
+
+  /* Sessions are only stable while their owners are stopped */
+  if (verbose)
+    vlib_worker_thread_barrier_sync (vm);
+
+  vec_foreach (ptd, am->per_thread_data)
+  {
+    vlib_cli_output (vm, "thread %d: %d of %d sessions, %lld created, "
+		     "%lld expired",
+		     ptd - am->per_thread_data, pool_elts (ptd->sessions),
+		     am->sessions_per_thread, ptd->sessions_created,
+		     ptd->sessions_expired);
+    if (verbose)
+      {
+	vlib_cli_output (vm, "%U", format_bihash_48_8, &ptd->session_hash,
+			 0 /* verbose */ );
+	/* *INDENT-OFF* */
+	pool_foreach (s, ptd->sessions,
+	({
+	  vlib_cli_output (vm, "  %U", format_ip_acl_session, s, now);
+	}));
+	/* *INDENT-ON* */
+      }
+  }
+
+  if (verbose)
+    vlib_worker_thread_barrier_release (vm);
+
+  return 0;
+}
+
+/*?
+ * Show the reflexive ACL sessions of each thread.
+ ?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_ip_acl_sessions_command, static) = {
+  .path = "show ip acl sessions",
+  .short_help = "show ip acl sessions [verbose]",
+  .function = show_ip_acl_sessions_command_fn,
+};
+/* *INDENT-ON* */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
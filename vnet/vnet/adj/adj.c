@@ -138,6 +138,23 @@ format_ip_adjacency (u8 * s, va_list * args)
     return s;
 }
 
+/*
+ * adj_reclaim
+ *
+ * no worker can still be using the adj, release it.
+ */
+static void
+adj_reclaim (void *arg)
+{
+    ip_adjacency_t *adj = adj_get(pointer_to_uword(arg));
+
+    if (IP_LOOKUP_NEXT_MIDCHAIN == adj->lookup_next_index)
+        dpo_reset(&adj->sub_type.midchain.next_dpo);
+
+    fib_node_deinit(&adj->ia_node);
+    pool_put(adj_pool, adj);
+}
+
 /*
  * adj_last_lock_gone
  *
@@ -146,18 +163,12 @@ format_ip_adjacency (u8 * s, va_list * args)
 static void
 adj_last_lock_gone (ip_adjacency_t *adj)
 {
-    vlib_main_t * vm = vlib_get_main();
-
     ASSERT(0 == fib_node_list_get_size(adj->ia_node.fn_children));
     ADJ_DBG(adj, "last-lock-gone");
 
-    vlib_worker_thread_barrier_sync (vm);
-
     switch (adj->lookup_next_index)
     {
     case IP_LOOKUP_NEXT_MIDCHAIN:
-        dpo_reset(&adj->sub_type.midchain.next_dpo);
-        /* FALL THROUGH */
     case IP_LOOKUP_NEXT_ARP:
     case IP_LOOKUP_NEXT_REWRITE:
 	/*
@@ -179,10 +190,14 @@ adj_last_lock_gone (ip_adjacency_t *adj)
 	break;
     }
 
-    vlib_worker_thread_barrier_release(vm);
-
-    fib_node_deinit(&adj->ia_node);
-    pool_put(adj_pool, adj);
+    /*
+     * the DBs are control plane only, so no new references can be taken.
+     * workers may still have the index in packets in flight, so hold
+     * the memory until they have all passed a quiescent state.
+     */
+    vlib_worker_thread_defer_call(adj_reclaim,
+				  uword_to_pointer(adj_get_index(adj),
+						   void *));
 }
 
 void
@@ -67,6 +67,11 @@
 #define LOG2_BUFFER_HANDOFF_NEXT_VALID LOG2_VLIB_BUFFER_FLAG_USER(6)
 #define BUFFER_HANDOFF_NEXT_VALID (1 << LOG2_BUFFER_HANDOFF_NEXT_VALID)
 
+/* Packet continues past the buffer data in the sending vhost-user guest's
+   memory, see vnet_buffer2 (b)->vhost_user_zc */
+#define LOG2_BUFFER_VHOST_USER_ZC LOG2_VLIB_BUFFER_FLAG_USER(7)
+#define BUFFER_VHOST_USER_ZC (1 << LOG2_BUFFER_VHOST_USER_ZC)
+
 #define foreach_buffer_opaque_union_subtype     \
 _(ethernet)                                     \
 _(ip)                                           \
@@ -332,14 +337,30 @@ typedef struct
 
 #define vnet_buffer(b) ((vnet_buffer_opaque_t *) (b)->opaque)
 
+#define VNET_BUFFER_VHOST_USER_ZC_MAX_SEGS 3
+
 /* Full cache line (64 bytes) of additional space */
 typedef struct
 {
   union
   {
+    /* vhost-user zero-copy */
+    struct
+    {
+      u32 if_index;		/**< vhost-user interface the packet came from */
+      u16 qid;			/**< queue pair it came in on */
+      u16 desc_head;		/**< descriptor chain to return when done */
+      u32 free_list_index;	/**< free list the buffer goes back to */
+      u32 n_segs;
+      /** payload in guest memory, mapped, following the buffer data */
+      u64 seg_addr[VNET_BUFFER_VHOST_USER_ZC_MAX_SEGS];
+      u32 seg_len[VNET_BUFFER_VHOST_USER_ZC_MAX_SEGS];
+    } vhost_user_zc;
   };
 } vnet_buffer_opaque2_t;
 
+#define vnet_buffer2(b) ((vnet_buffer_opaque2_t *) (b)->opaque2)
+
 
 
 #endif /* included_vnet_buffer_h */
@@ -74,99 +74,43 @@ flow_classify_inline (vlib_main_t * vm,
   u32 misses = 0;
   u32 chain_hits = 0;
   u32 drop = 0;
+  u8 * h[VLIB_FRAME_SIZE];
+  u32 table_index[VLIB_FRAME_SIZE];
+  vnet_classify_entry_t * e[VLIB_FRAME_SIZE];
+  u32 i;
 
   from = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors;
 
-  /* First pass: compute hashes */
-  while (n_left_from > 2)
-    {
-      vlib_buffer_t * b0, * b1;
-      u32 bi0, bi1;
-      u8 * h0, * h1;
-      u32 sw_if_index0, sw_if_index1;
-      u32 table_index0, table_index1;
-      vnet_classify_table_t * t0, * t1;
-
-      /* Prefetch next iteration */
-      {
-        vlib_buffer_t * p1, * p2;
-
-        p1 = vlib_get_buffer (vm, from[1]);
-        p2 = vlib_get_buffer (vm, from[2]);
-
-        vlib_prefetch_buffer_header (p1, STORE);
-        CLIB_PREFETCH (p1->data, CLIB_CACHE_LINE_BYTES, STORE);
-        vlib_prefetch_buffer_header (p2, STORE);
-        CLIB_PREFETCH (p2->data, CLIB_CACHE_LINE_BYTES, STORE);
-      }
-
-      bi0 = from[0];
-      b0 = vlib_get_buffer (vm, bi0);
-      h0 = b0->data;
-
-      bi1 = from[1];
-      b1 = vlib_get_buffer (vm, bi1);
-      h1 = b1->data;
-
-      sw_if_index0 = vnet_buffer (b0)->sw_if_index[VLIB_RX];
-      table_index0 = fcm->classify_table_index_by_sw_if_index[tid][sw_if_index0];
-
-      sw_if_index1 = vnet_buffer (b1)->sw_if_index[VLIB_RX];
-      table_index1 = fcm->classify_table_index_by_sw_if_index[tid][sw_if_index1];
-
-      t0 = pool_elt_at_index (vcm->tables, table_index0);
-
-      t1 = pool_elt_at_index (vcm->tables, table_index1);
-
-      vnet_buffer(b0)->l2_classify.hash =
-        vnet_classify_hash_packet (t0, (u8 *) h0);
-
-      vnet_classify_prefetch_bucket (t0, vnet_buffer(b0)->l2_classify.hash);
-
-      vnet_buffer(b1)->l2_classify.hash =
-        vnet_classify_hash_packet (t1, (u8 *) h1);
-
-      vnet_classify_prefetch_bucket (t1, vnet_buffer(b1)->l2_classify.hash);
-
-      vnet_buffer(b0)->l2_classify.table_index = table_index0;
-
-      vnet_buffer(b1)->l2_classify.table_index = table_index1;
-
-      from += 2;
-      n_left_from -= 2;
-    }
-
-  while (n_left_from > 0)
+  /* First pass: gather packet data and first tables */
+  for (i = 0; i < n_left_from; i++)
     {
       vlib_buffer_t * b0;
-      u32 bi0;
-      u8 * h0;
       u32 sw_if_index0;
-      u32 table_index0;
-      vnet_classify_table_t * t0;
-
-      bi0 = from[0];
-      b0 = vlib_get_buffer (vm, bi0);
-      h0 = b0->data;
 
-      sw_if_index0 = vnet_buffer (b0)->sw_if_index[VLIB_RX];
-      table_index0 = fcm->classify_table_index_by_sw_if_index[tid][sw_if_index0];
+      if (PREDICT_TRUE (i + 2 < n_left_from))
+        {
+          vlib_buffer_t * p2 = vlib_get_buffer (vm, from[i + 2]);
 
-      t0 = pool_elt_at_index (vcm->tables, table_index0);
-      vnet_buffer(b0)->l2_classify.hash =
-        vnet_classify_hash_packet (t0, (u8 *) h0);
+          vlib_prefetch_buffer_header (p2, STORE);
+          CLIB_PREFETCH (p2->data, CLIB_CACHE_LINE_BYTES, STORE);
+        }
 
-      vnet_buffer(b0)->l2_classify.table_index = table_index0;
-      vnet_classify_prefetch_bucket (t0, vnet_buffer(b0)->l2_classify.hash);
+      b0 = vlib_get_buffer (vm, from[i]);
+      h[i] = b0->data;
 
-      from++;
-      n_left_from--;
+      sw_if_index0 = vnet_buffer (b0)->sw_if_index[VLIB_RX];
+      table_index[i] =
+        fcm->classify_table_index_by_sw_if_index[tid][sw_if_index0];
+      vnet_buffer(b0)->l2_classify.table_index = table_index[i];
     }
 
+  /* Second pass: classify the whole frame, chains included */
+  hits = vnet_classify_find_entries_inline (vcm, h, table_index, e,
+                                            n_left_from, now);
+
   next_index = node->cached_next_index;
-  from = vlib_frame_vector_args (frame);
-  n_left_from = frame->n_vectors;
+  i = 0;
 
   while (n_left_from > 0)
     {
@@ -174,35 +118,13 @@ flow_classify_inline (vlib_main_t * vm,
 
       vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
 
-      /* Not enough load/store slots to dual loop... */
       while (n_left_from > 0 && n_left_to_next > 0)
         {
           u32 bi0;
           vlib_buffer_t * b0;
           u32 next0 = FLOW_CLASSIFY_NEXT_INDEX_DROP;
-          u32 table_index0;
           vnet_classify_table_t * t0;
           vnet_classify_entry_t * e0;
-          u64 hash0;
-          u8 * h0;
-
-          /* Stride 3 seems to work best */
-          if (PREDICT_TRUE (n_left_from > 3))
-            {
-              vlib_buffer_t * p1 = vlib_get_buffer(vm, from[3]);
-              vnet_classify_table_t * tp1;
-              u32 table_index1;
-              u64 phash1;
-
-              table_index1 = vnet_buffer(p1)->l2_classify.table_index;
-
-              if (PREDICT_TRUE (table_index1 != ~0))
-                {
-                  tp1 = pool_elt_at_index (vcm->tables, table_index1);
-                  phash1 = vnet_buffer(p1)->l2_classify.hash;
-                  vnet_classify_prefetch_entry (tp1, phash1);
-                }
-            }
 
           /* Speculatively enqueue b0 to the current next frame */
           bi0 = from[0];
@@ -213,9 +135,7 @@ flow_classify_inline (vlib_main_t * vm,
           n_left_to_next -= 1;
 
           b0 = vlib_get_buffer (vm, bi0);
-          h0 = b0->data;
-          table_index0 = vnet_buffer(b0)->l2_classify.table_index;
-          e0 = 0;
+          e0 = e[i];
           t0 = 0;
 
           vnet_get_config_data (fcm->vnet_config_main[tid],
@@ -223,42 +143,21 @@ flow_classify_inline (vlib_main_t * vm,
                                 &next0,
                                 /* # bytes of config data */ 0);
 
-          if (PREDICT_TRUE(table_index0 != ~0))
+          if (PREDICT_TRUE(table_index[i] != ~0))
             {
-              hash0 = vnet_buffer(b0)->l2_classify.hash;
-              t0 = pool_elt_at_index (vcm->tables, table_index0);
-              e0 = vnet_classify_find_entry (t0, (u8 *) h0, hash0, now);
+              t0 = pool_elt_at_index (vcm->tables, table_index[i]);
 
               if (e0)
                 {
-                  hits++;
+                  if (table_index[i] !=
+                      vnet_buffer(b0)->l2_classify.table_index)
+                    chain_hits++;
                 }
               else
-                {
-                  while (1)
-                    {
-                      if (PREDICT_TRUE(t0->next_table_index != ~0))
-                        {
-                          t0 = pool_elt_at_index (vcm->tables,
-                                                  t0->next_table_index);
-                        }
-                      else
-                        {
-                          misses++;
-                          break;
-                        }
-
-                      hash0 = vnet_classify_hash_packet (t0, (u8 *) h0);
-                      e0 = vnet_classify_find_entry (t0, (u8 *) h0, hash0, now);
-                      if (e0)
-                        {
-                          hits++;
-                          chain_hits++;
-                          break;
-                        }
-                    }
-                }
+                misses++;
             }
+          i++;
+
           if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)
                             && (b0->flags & VLIB_BUFFER_IS_TRACED)))
             {
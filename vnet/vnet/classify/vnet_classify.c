@@ -160,6 +160,33 @@ void vnet_classify_delete_table_index (vnet_classify_main_t *cm,
   pool_put (cm->tables, t);
 }
 
+/* 
+ * Move entries whose grace period has ended from the deferred list
+ * to the freelists.
+ */
+static void
+vnet_classify_entry_recycle (vnet_classify_table_t * t)
+{
+  vnet_classify_deferred_free_t * df;
+  u32 free_list_index, n_recycled = 0;
+
+  vec_foreach (df, t->deferred_frees)
+    {
+      if (!vlib_worker_thread_epoch_is_safe (df->epoch))
+        break;
+
+      free_list_index = min_log2(vec_len(df->entry)/t->entries_per_page);
+      ASSERT(vec_len (t->freelists) > free_list_index);
+
+      df->entry->next_free = t->freelists[free_list_index];
+      t->freelists[free_list_index] = df->entry;
+      n_recycled++;
+    }
+
+  if (n_recycled)
+    vec_delete (t->deferred_frees, n_recycled, 0);
+}
+
 static vnet_classify_entry_t *
 vnet_classify_entry_alloc (vnet_classify_table_t * t, u32 log2_pages)
 {
@@ -172,6 +199,10 @@ vnet_classify_entry_alloc (vnet_classify_table_t * t, u32 log2_pages)
   void * oldheap;
 
   ASSERT (t->writer_lock[0]);
+
+  if (vec_len (t->deferred_frees))
+    vnet_classify_entry_recycle (t);
+
   if (log2_pages >= vec_len (t->freelists) || t->freelists [log2_pages] == 0)
     {
       oldheap = clib_mem_set_heap (t->mheap);
@@ -226,73 +257,39 @@ static void
 vnet_classify_entry_free (vnet_classify_table_t * t,
                           vnet_classify_entry_t * v)
 {
-    u32 free_list_index;
+    vnet_classify_deferred_free_t * df;
+    void * oldheap;
 
     ASSERT (t->writer_lock[0]);
 
-    free_list_index = min_log2(vec_len(v)/t->entries_per_page);
-
-    ASSERT(vec_len (t->freelists) > free_list_index);
-
-    v->next_free = t->freelists[free_list_index];
-    t->freelists[free_list_index] = v;
+    /* 
+     * Workers may still be walking the old bucket pages. Park them
+     * until every worker passes a quiescent state, so session add/del
+     * needs no barrier.
+     */
+    oldheap = clib_mem_set_heap (t->mheap);
+    vec_add2 (t->deferred_frees, df, 1);
+    clib_mem_set_heap (oldheap);
+
+    df->entry = v;
+    df->epoch = vlib_worker_thread_epoch_advance ();
 }
 
-static inline void make_working_copy
+/*
+ * Point the bucket at a private copy of its pages while they are
+ * edited. Workers may still be walking the copy after the bucket moves
+ * on, so every update takes a fresh one from the freelists and retires
+ * it with vnet_classify_entry_free once done.
+ */
+static inline vnet_classify_entry_t * make_working_copy
 (vnet_classify_table_t * t, vnet_classify_bucket_t * b)
 {
   vnet_classify_entry_t * v;
   vnet_classify_bucket_t working_bucket __attribute__((aligned (8)));
-  void * oldheap;
   vnet_classify_entry_t * working_copy;
-#define _(size)                                 \
-  vnet_classify_entry_##size##_t * working_copy##size = 0;
-  foreach_size_in_u32x4;
-#undef _
-  u32 cpu_number = os_get_cpu_number();
-
-  if (cpu_number >= vec_len (t->working_copies))
-    {
-      oldheap = clib_mem_set_heap (t->mheap);
-      vec_validate (t->working_copies, cpu_number);
-      clib_mem_set_heap (oldheap);
-    }
-
-  /* 
-   * working_copies are per-cpu so that near-simultaneous
-   * updates from multiple threads will not result in sporadic, spurious
-   * lookup failures. 
-   */
-  working_copy = t->working_copies[cpu_number];
 
   t->saved_bucket.as_u64 = b->as_u64;
-  oldheap = clib_mem_set_heap (t->mheap);
-
-  if ((1<<b->log2_pages)*t->entries_per_page > vec_len (working_copy))
-    {
-      switch(t->match_n_vectors)
-        {
-          /* Euchre the vector allocator into allocating the right sizes */
-#define _(size)                                                         \
-        case size:                                                      \
-          working_copy##size = (void *) working_copy;                   \
-          vec_validate_aligned                                          \
-            (working_copy##size, 					\
-             ((1<<b->log2_pages)*t->entries_per_page) - 1,              \
-             CLIB_CACHE_LINE_BYTES);                                    \
-          working_copy = (void *) working_copy##size;                   \
-            break;
-        foreach_size_in_u32x4;
-#undef _
-
-        default:
-          abort();
-        }
-      t->working_copies[cpu_number] = working_copy;
-    }
-
-  _vec_len(working_copy) = (1<<b->log2_pages)*t->entries_per_page;
-  clib_mem_set_heap (oldheap);
+  working_copy = vnet_classify_entry_alloc (t, b->log2_pages);
 
   v = vnet_classify_get_entry (t, b->offset);
   
@@ -316,7 +313,7 @@ static inline void make_working_copy
   working_bucket.offset = vnet_classify_get_offset (t, working_copy);
   CLIB_MEMORY_BARRIER();
   b->as_u64 = working_bucket.as_u64;
-  t->working_copies[cpu_number] = working_copy;
+  return working_copy;
 }
 
 static vnet_classify_entry_t *
@@ -379,13 +376,13 @@ int vnet_classify_add_del (vnet_classify_table_t * t,
 {
   u32 bucket_index;
   vnet_classify_bucket_t * b, tmp_b;
-  vnet_classify_entry_t * v, * new_v, * save_new_v, * working_copy, * save_v;
+  vnet_classify_entry_t * v, * new_v, * save_new_v, * save_v;
+  vnet_classify_entry_t * working_copy = 0;
   u32 value_index;
   int rv = 0;
   int i;
   u64 hash, new_hash;
   u32 new_log2_pages;
-  u32 cpu_number = os_get_cpu_number();
   u8 * key_minus_skip;
 
   ASSERT ((add_v->flags & VNET_CLASSIFY_ENTRY_FREE) == 0);
@@ -426,7 +423,7 @@ int vnet_classify_add_del (vnet_classify_table_t * t,
       goto unlock;
     }
   
-  make_working_copy (t, b);
+  working_copy = make_working_copy (t, b);
   
   save_v = vnet_classify_get_entry (t, t->saved_bucket.offset);
   value_index = hash & ((1<<t->saved_bucket.log2_pages)-1);
@@ -496,7 +493,6 @@ int vnet_classify_add_del (vnet_classify_table_t * t,
   new_log2_pages = t->saved_bucket.log2_pages + 1;
 
  expand_again:
-  working_copy = t->working_copies[cpu_number];
   new_v = split_and_rehash (t, working_copy, new_log2_pages);
 
   if (new_v == 0)
@@ -542,6 +538,9 @@ int vnet_classify_add_del (vnet_classify_table_t * t,
   vnet_classify_entry_free (t, v);
 
  unlock:
+  /* the bucket no longer points at the working copy */
+  if (working_copy)
+    vnet_classify_entry_free (t, working_copy);
   CLIB_MEMORY_BARRIER();
   t->writer_lock[0] = 0;
 
@@ -2095,6 +2094,7 @@ VLIB_CLI_COMMAND (classify_session_command, static) = {
     "acl-hit-next <next_index>|policer-hit-next <policer_name>]"
     "\n table-index <nn> match [hex] [l2] [l3 ip4] [opaque-index <index>]",
     .function = classify_session_command_fn,
+    .is_mp_safe = 1,
 };
 
 static uword 
@@ -2387,4 +2387,258 @@ VLIB_CLI_COMMAND (test_classify_command, static) = {
     "test classify [src <ip>] [sessions <nn>] [buckets <nn>] [table <nn>] [del]",
     .function = test_classify_command_fn,
 };
+
+/*
+ * Chain walk benchmark: packets are classified frame by frame as the
+ * classifier nodes did, one packet and one table at a time, and with
+ * vnet_classify_find_entries_inline, built for the baseline and for each
+ * multiarch variant the cpu supports.
+ */
+static u32
+test_classify_per_packet (vnet_classify_main_t * cm, u8 ** h,
+                          u32 * table_index, vnet_classify_entry_t ** e,
+                          u32 n_packets, f64 now)
+{
+  vnet_classify_table_t * t;
+  u64 hash[VLIB_FRAME_SIZE];
+  u32 n_hits = 0;
+  int i;
+
+  for (i = 0; i < n_packets; i++)
+    {
+      t = pool_elt_at_index (cm->tables, table_index[i]);
+      hash[i] = vnet_classify_hash_packet (t, h[i]);
+      vnet_classify_prefetch_bucket (t, hash[i]);
+    }
+
+  for (i = 0; i < n_packets; i++)
+    {
+      if (i + 3 < n_packets)
+        {
+          t = pool_elt_at_index (cm->tables, table_index[i + 3]);
+          vnet_classify_prefetch_entry (t, hash[i + 3]);
+        }
+
+      t = pool_elt_at_index (cm->tables, table_index[i]);
+      e[i] = vnet_classify_find_entry (t, h[i], hash[i], now);
+      while (e[i] == 0 && t->next_table_index != ~0)
+        {
+          table_index[i] = t->next_table_index;
+          t = pool_elt_at_index (cm->tables, table_index[i]);
+          e[i] = vnet_classify_find_entry
+            (t, h[i], vnet_classify_hash_packet (t, h[i]), now);
+        }
+      n_hits += e[i] != 0;
+    }
+
+  return n_hits;
+}
+
+static u32
+test_classify_batch (vnet_classify_main_t * cm, u8 ** h, u32 * table_index,
+                     vnet_classify_entry_t ** e, u32 n_packets, f64 now)
+{
+  return vnet_classify_find_entries_inline (cm, h, table_index, e,
+                                            n_packets, now);
+}
+
+typedef u32 (test_classify_lookup_fn_t) (vnet_classify_main_t * cm,
+                                         u8 ** h, u32 * table_index,
+                                         vnet_classify_entry_t ** e,
+                                         u32 n_packets, f64 now);
+
+#define TEST_CLASSIFY_CLONE_TEMPLATE(arch, fn, tgt)                     \
+  static u32                                                            \
+  __attribute__ ((flatten))                                             \
+  __attribute__ ((target (tgt)))                                        \
+  CLIB_CPU_OPTIMIZED                                                    \
+  fn ## _ ## arch (vnet_classify_main_t * cm, u8 ** h,                  \
+                   u32 * table_index, vnet_classify_entry_t ** e,       \
+                   u32 n_packets, f64 now)                              \
+  { return fn (cm, h, table_index, e, n_packets, now); }
+
+foreach_march_variant (TEST_CLASSIFY_CLONE_TEMPLATE, test_classify_batch)
+
+static f64
+test_classify_run (vlib_main_t * vm, test_classify_lookup_fn_t * fn,
+                   u8 ** h, u32 * table_index, vnet_classify_entry_t ** e,
+                   u32 n_packets, u32 iterations, u32 * n_hits)
+{
+  vnet_classify_main_t * cm = &vnet_classify_main;
+  u32 ti[VLIB_FRAME_SIZE];
+  u64 t0, clocks = 0;
+  f64 now = vlib_time_now (vm);
+  u32 i, j, n;
+
+  *n_hits = 0;
+  for (i = 0; i < iterations; i++)
+    for (j = 0; j < n_packets; j += n)
+      {
+        n = clib_min (n_packets - j, VLIB_FRAME_SIZE);
+        clib_memcpy (ti, table_index + j, n * sizeof (ti[0]));
+        t0 = clib_cpu_time_now ();
+        *n_hits += fn (cm, h + j, ti, e + j, n, now);
+        clocks += clib_cpu_time_now () - t0;
+      }
+
+  return (f64) clocks / ((f64) iterations * n_packets);
+}
+
+static clib_error_t *
+test_classify_batch_command_fn (vlib_main_t * vm,
+                                unformat_input_t * input,
+                                vlib_cli_command_t * cmd)
+{
+  vnet_classify_main_t * cm = &vnet_classify_main;
+  vnet_classify_table_t * t;
+  u32 n_tables = 3, n_vectors = 3, sessions = 10000;
+  u32 n_packets = 4096, iterations = 100, memory_size = 0;
+  u32 first_table_index = ~0, prev_table_index = ~0, seed = 0xdeadbeef;
+  u32 * table_index = 0, * ids = 0, n_hits, tmp;
+  u8 * mask = 0, * data = 0, ** h = 0;
+  vnet_classify_entry_t ** e = 0, ** e_ref = 0;
+  u32 i, j, k, rv, mismatch = 0;
+  f64 cpp;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+    if (unformat (input, "tables %d", &n_tables))
+      ;
+    else if (unformat (input, "vectors %d", &n_vectors))
+      ;
+    else if (unformat (input, "sessions %d", &sessions))
+      ;
+    else if (unformat (input, "packets %d", &n_packets))
+      ;
+    else if (unformat (input, "iterations %d", &iterations))
+      ;
+    else if (unformat (input, "memory-size %uM", &tmp))
+      memory_size = tmp<<20;
+    else
+      return clib_error_return (0, "unknown input `%U'",
+                                format_unformat_error, input);
+  }
+
+  if (n_vectors < 1 || n_vectors > 5)
+    return clib_error_return (0, "vectors must be 1 to 5");
+  if (n_tables < 1 || sessions < 1 || n_packets < 1 || iterations < 1)
+    return clib_error_return (0, "tables, sessions, packets and "
+                              "iterations must be non-zero");
+
+  if (memory_size == 0)
+    memory_size = clib_max (2<<20, sessions * (sizeof (vnet_classify_entry_t)
+                                               + n_vectors * sizeof (u32x4))
+                            * 4);
+
+  /* Match on the first word of each vector */
+  vec_validate_aligned (mask, n_vectors * sizeof (u32x4) - 1,
+                        sizeof (u32x4));
+  for (k = 0; k < n_vectors; k++)
+    *(u32 *) (mask + k * sizeof (u32x4)) = ~0;
+
+  /* Session id i of table i / sessions, hit after a walk of that many */
+  vec_validate_aligned (data, 5 * sizeof (u32x4) - 1, sizeof (u32x4));
+  for (i = 0; i < n_tables; i++)
+    {
+      t = vnet_classify_new_table (cm, mask, 1<<max_log2 (sessions / 2 + 1),
+                                   memory_size, 0 /* skip */, n_vectors);
+      t->miss_next_index = ~0;
+      /* Tables may have moved, chain by index */
+      if (prev_table_index != ~0)
+        pool_elt_at_index (cm->tables, prev_table_index)->next_table_index =
+          t - cm->tables;
+      else
+        first_table_index = t - cm->tables;
+      prev_table_index = t - cm->tables;
+
+      for (j = 0; j < sessions; j++)
+        {
+          for (k = 0; k < n_vectors; k++)
+            *(u32 *) (data + k * sizeof (u32x4)) =
+              (i * sessions + j) ^ (k * 0x9e3779b9);
+          rv = vnet_classify_add_del_session (cm, t - cm->tables, data,
+                                              ~0 /* hit_next_index */,
+                                              i * sessions + j,
+                                              0 /* advance */, 1 /* is_add */);
+          if (rv != 0)
+            {
+              vlib_cli_output (vm, "table %d session %d: add returned %d",
+                               i, j, rv);
+              goto out;
+            }
+        }
+    }
+
+  /* Packets spread over all sessions, one data block each */
+  vec_validate (ids, n_packets - 1);
+  vec_validate_aligned (data, n_packets * 5 * sizeof (u32x4) - 1,
+                        sizeof (u32x4));
+  vec_validate (h, n_packets - 1);
+  vec_validate (table_index, n_packets - 1);
+  vec_validate (e, n_packets - 1);
+  vec_validate (e_ref, n_packets - 1);
+  for (i = 0; i < n_packets; i++)
+    {
+      ids[i] = random_u32 (&seed) % (n_tables * sessions);
+      h[i] = data + i * 5 * sizeof (u32x4);
+      for (k = 0; k < n_vectors; k++)
+        *(u32 *) (h[i] + k * sizeof (u32x4)) = ids[i] ^ (k * 0x9e3779b9);
+      table_index[i] = first_table_index;
+    }
+
+  vlib_cli_output (vm, "%d tables of %d sessions, %d vectors, "
+                   "%d packets x %d iterations",
+                   n_tables, sessions, n_vectors, n_packets, iterations);
+
+  cpp = test_classify_run (vm, test_classify_per_packet, h, table_index,
+                           e_ref, n_packets, iterations, &n_hits);
+  vlib_cli_output (vm, "  %-12s %8.2f clocks/pkt, %d hits", "per packet",
+                   cpp, n_hits);
+
+  for (i = 0; i < n_packets; i++)
+    if (e_ref[i] == 0 || e_ref[i]->opaque_index != ids[i])
+      mismatch++;
+
+#define _(arch, fn, tgt)                                                \
+  if (clib_cpu_supports_ ## arch ())                                    \
+    {                                                                   \
+      cpp = test_classify_run (vm, fn ## _ ## arch, h, table_index, e,  \
+                               n_packets, iterations, &n_hits);         \
+      vlib_cli_output (vm, "  %-12s %8.2f clocks/pkt, %d hits",         \
+                       "batch " #arch, cpp, n_hits);                    \
+      for (i = 0; i < n_packets; i++)                                   \
+        mismatch += e[i] != e_ref[i];                                   \
+    }
+  foreach_march_variant (_, test_classify_batch)
+#undef _
+
+  cpp = test_classify_run (vm, test_classify_batch, h, table_index, e,
+                           n_packets, iterations, &n_hits);
+  vlib_cli_output (vm, "  %-12s %8.2f clocks/pkt, %d hits", "batch",
+                   cpp, n_hits);
+  for (i = 0; i < n_packets; i++)
+    mismatch += e[i] != e_ref[i];
+
+  if (mismatch)
+    vlib_cli_output (vm, "%d lookup mismatches", mismatch);
+
+ out:
+  if (first_table_index != ~0)
+    vnet_classify_delete_table_index (cm, first_table_index);
+  vec_free (mask);
+  vec_free (data);
+  vec_free (ids);
+  vec_free (h);
+  vec_free (table_index);
+  vec_free (e);
+  vec_free (e_ref);
+  return 0;
+}
+
+VLIB_CLI_COMMAND (test_classify_batch_command, static) = {
+    .path = "test classify batch",
+    .short_help =
+    "test classify batch [tables <nn>] [vectors <1-5>] [sessions <nn>]\n"
+    "  [packets <nn>] [iterations <nn>] [memory-size <nn>M]",
+    .function = test_classify_batch_command_fn,
+};
 #endif /* TEST_CODE */
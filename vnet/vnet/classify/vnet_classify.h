@@ -46,6 +46,74 @@ extern vlib_node_registration_t ip6_classify_node;
 
 #define U32X4_ALIGNED(p) PREDICT_TRUE((((intptr_t)p) & 0xf) == 0)
 
+#ifdef CLASSIFY_USE_SSE
+/*
+ * Pairs of match vectors are processed as one 256 bit vector. Packet data,
+ * masks and keys are only 16 byte aligned, hence the type's alignment.
+ * Built for SSE these are split in two 128 bit operations, in the avx2
+ * variants of the graph nodes (see VLIB_NODE_FUNCTION_MULTIARCH) they
+ * are single AVX2 operations.
+ */
+typedef u32 vnet_classify_u32x8_t
+  __attribute__ ((vector_size (32), aligned (16)));
+
+typedef union {
+  vnet_classify_u32x8_t as_u32x8;
+  u32x4 as_u32x4[2];
+} vnet_classify_u32x8_union_t;
+
+/* XOR of the masked match vectors, hashed by vnet_classify_hash_packet */
+static inline u32x4
+vnet_classify_masked_xor (u32x4 * data, u32x4 * mask, u32 match_n_vectors)
+{
+  vnet_classify_u32x8_t * d8 = (vnet_classify_u32x8_t *) data;
+  vnet_classify_u32x8_t * m8 = (vnet_classify_u32x8_t *) mask;
+  vnet_classify_u32x8_union_t r;
+  u32x4 r4;
+
+  if (match_n_vectors == 1)
+    return data[0] & mask[0];
+
+  r.as_u32x8 = d8[0] & m8[0];
+  if (match_n_vectors >= 4)
+    r.as_u32x8 ^= d8[1] & m8[1];
+
+  r4 = r.as_u32x4[0] ^ r.as_u32x4[1];
+  if (match_n_vectors & 1)
+    r4 ^= data[match_n_vectors - 1] & mask[match_n_vectors - 1];
+
+  return r4;
+}
+
+/* Non-zero if the masked match vectors equal the key */
+static inline int
+vnet_classify_key_match (u32x4 * data, u32x4 * mask, u32x4 * key,
+                         u32 match_n_vectors)
+{
+  vnet_classify_u32x8_t * d8 = (vnet_classify_u32x8_t *) data;
+  vnet_classify_u32x8_t * m8 = (vnet_classify_u32x8_t *) mask;
+  vnet_classify_u32x8_t * k8 = (vnet_classify_u32x8_t *) key;
+  vnet_classify_u32x8_union_t r;
+  u32x4 r4;
+
+  if (match_n_vectors == 1)
+    r4 = (data[0] & mask[0]) ^ key[0];
+  else
+    {
+      r.as_u32x8 = (d8[0] & m8[0]) ^ k8[0];
+      if (match_n_vectors >= 4)
+        r.as_u32x8 |= (d8[1] & m8[1]) ^ k8[1];
+
+      r4 = r.as_u32x4[0] | r.as_u32x4[1];
+      if (match_n_vectors & 1)
+        r4 |= (data[match_n_vectors - 1] & mask[match_n_vectors - 1]) ^
+          key[match_n_vectors - 1];
+    }
+
+  return u32x4_zero_byte_mask (r4) == 0xffff;
+}
+#endif /* CLASSIFY_USE_SSE */
+
 struct _vnet_classify_main;
 typedef struct _vnet_classify_main vnet_classify_main_t;
 
@@ -117,6 +185,12 @@ typedef struct {
   };
 } vnet_classify_bucket_t;
 
+typedef struct {
+  vnet_classify_entry_t * entry;
+  /* Recycle once all workers have passed this epoch */
+  u64 epoch;
+} vnet_classify_deferred_free_t;
+
 typedef struct {
   /* Mask to apply after skipping N vectors */
   u32x4 *mask;
@@ -137,13 +211,15 @@ typedef struct {
   /* Miss next index, return if next_table_index = 0 */
   u32 miss_next_index;
   
-  /* Per-bucket working copies, one per thread */
-  vnet_classify_entry_t ** working_copies;
+  /* Bucket being updated, as it was before the working copy */
   vnet_classify_bucket_t saved_bucket;
   
   /* Free entry freelists */
   vnet_classify_entry_t **freelists;
 
+  /* Freed entries which workers may still be reading */
+  vnet_classify_deferred_free_t * deferred_frees;
+
   u8 * name;
   
   /* Private allocation arena, protected by the writer lock */
@@ -192,26 +268,9 @@ vnet_classify_hash_packet_inline (vnet_classify_table_t * t,
 #ifdef CLASSIFY_USE_SSE
   if (U32X4_ALIGNED(h)) {  //SSE can't handle unaligned data
     u32x4 *data = (u32x4 *)h;
-    xor_sum.as_u32x4  = data[0 + t->skip_n_vectors] & mask[0];
-    switch (t->match_n_vectors)
-    {
-      case 5:
-        xor_sum.as_u32x4 ^= data[4 + t->skip_n_vectors] & mask[4];
-        /* FALLTHROUGH */
-      case 4:
-        xor_sum.as_u32x4 ^= data[3 + t->skip_n_vectors] & mask[3];
-        /* FALLTHROUGH */
-      case 3:
-        xor_sum.as_u32x4 ^= data[2 + t->skip_n_vectors] & mask[2];
-        /* FALLTHROUGH */
-      case 2:
-        xor_sum.as_u32x4 ^= data[1 + t->skip_n_vectors] & mask[1];
-        /* FALLTHROUGH */
-      case 1:
-        break;
-      default:
-        abort();
-    }
+    ASSERT (t->match_n_vectors >= 1 && t->match_n_vectors <= 5);
+    xor_sum.as_u32x4 = vnet_classify_masked_xor (data + t->skip_n_vectors,
+                                                 mask, t->match_n_vectors);
   } else
 #endif /* CLASSIFY_USE_SSE */
   {
@@ -356,31 +415,10 @@ vnet_classify_find_entry_inline (vnet_classify_table_t * t,
 
 #ifdef CLASSIFY_USE_SSE
   if (U32X4_ALIGNED(h)) {
-    u32x4 *data = (u32x4 *) h;
+    u32x4 *data = (u32x4 *) h + t->skip_n_vectors;
+    ASSERT (t->match_n_vectors >= 1 && t->match_n_vectors <= 5);
     for (i = 0; i < t->entries_per_page; i++) {
-      key = v->key;
-      result.as_u32x4 = (data[0 + t->skip_n_vectors] & mask[0]) ^ key[0];
-      switch (t->match_n_vectors)
-      {
-        case 5:
-          result.as_u32x4 |= (data[4 + t->skip_n_vectors] & mask[4]) ^ key[4];
-          /* FALLTHROUGH */
-        case 4:
-          result.as_u32x4 |= (data[3 + t->skip_n_vectors] & mask[3]) ^ key[3];
-          /* FALLTHROUGH */
-        case 3:
-          result.as_u32x4 |= (data[2 + t->skip_n_vectors] & mask[2]) ^ key[2];
-          /* FALLTHROUGH */
-        case 2:
-          result.as_u32x4 |= (data[1 + t->skip_n_vectors] & mask[1]) ^ key[1];
-          /* FALLTHROUGH */
-        case 1:
-          break;
-        default:
-          abort();
-      }
-
-      if (u32x4_zero_byte_mask (result.as_u32x4) == 0xffff) {
+      if (vnet_classify_key_match (data, mask, v->key, t->match_n_vectors)) {
         if (PREDICT_TRUE(now)) {
           v->hits++;
           v->last_heard = now;
@@ -437,6 +475,94 @@ vnet_classify_find_entry_inline (vnet_classify_table_t * t,
   return 0;
   }
 
+#ifndef VNET_CLASSIFY_BATCH_STRIDE
+#define VNET_CLASSIFY_BATCH_STRIDE 32
+#endif
+
+/*
+ * Classify a frame of packets, walking each packet's table chain.
+ * Per stride of packets, all hashes are computed and bucket headers
+ * prefetched, then all entry pages prefetched, and only then are keys
+ * compared. Packets which miss move on to the next table of their chain
+ * together, so that a chain walk also overlaps its misses across the
+ * stride instead of paying them one packet at a time.
+ *
+ * h[i] is the packet data the table masks apply to. On entry
+ * table_index[i] is the first table, ~0 for none. On return e[i] is the
+ * matching entry or 0, and table_index[i] the table matched or, on a
+ * miss, the last table of the chain. Returns the number of hits.
+ */
+static inline u32
+vnet_classify_find_entries_inline (vnet_classify_main_t * cm,
+                                   u8 ** h, u32 * table_index,
+                                   vnet_classify_entry_t ** e,
+                                   u32 n_packets, f64 now)
+{
+  vnet_classify_table_t * t[VNET_CLASSIFY_BATCH_STRIDE];
+  u64 hash[VNET_CLASSIFY_BATCH_STRIDE];
+  u8 pending[VNET_CLASSIFY_BATCH_STRIDE];
+  u32 n_hits = 0;
+  u32 n_this_stride, n_pending, n_next;
+  int i, j;
+
+  while (n_packets > 0)
+    {
+      n_this_stride = n_packets < VNET_CLASSIFY_BATCH_STRIDE ?
+        n_packets : VNET_CLASSIFY_BATCH_STRIDE;
+
+      n_pending = 0;
+      for (i = 0; i < n_this_stride; i++)
+        {
+          e[i] = 0;
+          if (PREDICT_TRUE (table_index[i] != ~0))
+            pending[n_pending++] = i;
+        }
+
+      while (n_pending > 0)
+        {
+          /* Stage 1: hash, prefetch buckets */
+          for (j = 0; j < n_pending; j++)
+            {
+              i = pending[j];
+              t[i] = pool_elt_at_index (cm->tables, table_index[i]);
+              hash[i] = vnet_classify_hash_packet_inline (t[i], h[i]);
+              vnet_classify_prefetch_bucket (t[i], hash[i]);
+            }
+
+          /* Stage 2: prefetch entry pages */
+          for (j = 0; j < n_pending; j++)
+            {
+              i = pending[j];
+              vnet_classify_prefetch_entry (t[i], hash[i]);
+            }
+
+          /* Stage 3: compare, misses move to the next table */
+          n_next = 0;
+          for (j = 0; j < n_pending; j++)
+            {
+              i = pending[j];
+              e[i] = vnet_classify_find_entry_inline (t[i], h[i], hash[i],
+                                                      now);
+              if (e[i])
+                n_hits++;
+              else if (t[i]->next_table_index != ~0)
+                {
+                  table_index[i] = t[i]->next_table_index;
+                  pending[n_next++] = i;
+                }
+            }
+          n_pending = n_next;
+        }
+
+      h += n_this_stride;
+      table_index += n_this_stride;
+      e += n_this_stride;
+      n_packets -= n_this_stride;
+    }
+
+  return n_hits;
+}
+
 vnet_classify_table_t * 
 vnet_classify_new_table (vnet_classify_main_t *cm,
                          u8 * mask, u32 nbuckets, u32 memory_size,
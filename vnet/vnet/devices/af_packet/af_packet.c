@@ -24,6 +24,7 @@
 #include <vlib/unix/unix.h>
 #include <vnet/ip/ip.h>
 #include <vnet/ethernet/ethernet.h>
+#include <vnet/devices/rx_balance.h>
 
 #include <vnet/devices/af_packet/af_packet.h>
 
@@ -37,13 +38,16 @@
 #define AF_PACKET_TX_BLOCK_SIZE	 	(AF_PACKET_TX_FRAME_SIZE * \
 					 AF_PACKET_TX_FRAMES_PER_BLOCK)
 
-#define AF_PACKET_RX_FRAMES_PER_BLOCK	1024
-#define AF_PACKET_RX_FRAME_SIZE	 	(2048 * 5)
-#define AF_PACKET_RX_BLOCK_NR		1
+/* TPACKET_V3 packs received packets back to back into blocks and hands
+   a block over once it is full or has been open for the retire timeout,
+   so the frame size only sets the ring geometry */
+#define AF_PACKET_RX_BLOCK_SIZE		(1 << 17)
+#define AF_PACKET_RX_BLOCK_NR		64
+#define AF_PACKET_RX_FRAME_SIZE	 	2048
 #define AF_PACKET_RX_FRAME_NR		(AF_PACKET_RX_BLOCK_NR * \
-					 AF_PACKET_RX_FRAMES_PER_BLOCK)
-#define AF_PACKET_RX_BLOCK_SIZE		(AF_PACKET_RX_FRAME_SIZE * \
-					 AF_PACKET_RX_FRAMES_PER_BLOCK)
+					 AF_PACKET_RX_BLOCK_SIZE / \
+					 AF_PACKET_RX_FRAME_SIZE)
+#define AF_PACKET_RX_RETIRE_TOV		1	/* msec */
 
 #if AF_PACKET_DEBUG_SOCKET == 1
 #define DBG_SOCK(args...) clib_warning(args);
@@ -55,6 +59,7 @@
 unsigned int if_nametoindex (const char *ifname);
 
 typedef struct tpacket_req tpacket_req_t;
+typedef struct tpacket_req3 tpacket_req3_t;
 
 static u32
 af_packet_eth_flag_change (vnet_main_t * vnm, vnet_hw_interface_t * hi,
@@ -80,28 +85,27 @@ af_packet_fd_read_ready (unix_file_t * uf)
   return 0;
 }
 
+/*
+ * Open a PACKET socket with a single mmap'ed ring. Rx uses TPACKET_V3
+ * blocks; tx stays on TPACKET_V2 frames since a V3 tx ring needs Linux
+ * 4.11. The ring version is per socket, so each queue gets one socket
+ * per direction. The tx socket is bound with protocol 0 and never
+ * receives anything.
+ */
 static int
-create_packet_v2_sock (u8 * name, tpacket_req_t * rx_req,
-		       tpacket_req_t * tx_req, int *fd, u8 ** ring)
+create_packet_sock (int host_if_index, int ver, int ring_opt, void *req,
+		    socklen_t req_sz, u32 ring_sz, int *fd, u8 ** ring,
+		    u32 fanout_id)
 {
   int ret, err;
   struct sockaddr_ll sll;
-  uint host_if_index;
-  int ver = TPACKET_V2;
-  socklen_t req_sz = sizeof (struct tpacket_req);
-  u32 ring_sz = rx_req->tp_block_size * rx_req->tp_block_nr +
-    tx_req->tp_block_size * tx_req->tp_block_nr;
-
-  host_if_index = if_nametoindex ((const char *) name);
+  int is_tx = ring_opt == PACKET_TX_RING;
+  u16 protocol = is_tx ? 0 : htons (ETH_P_ALL);
+  int opt;
 
-  if (!host_if_index)
-    {
-      DBG_SOCK ("Wrong host interface name");
-      ret = VNET_API_ERROR_INVALID_INTERFACE;
-      goto error;
-    }
+  *ring = MAP_FAILED;
 
-  if ((*fd = socket (AF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0)
+  if ((*fd = socket (AF_PACKET, SOCK_RAW, protocol)) < 0)
     {
       DBG_SOCK ("Failed to create socket");
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
@@ -111,32 +115,33 @@ create_packet_v2_sock (u8 * name, tpacket_req_t * rx_req,
   if ((err =
        setsockopt (*fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof (ver))) < 0)
     {
-      DBG_SOCK ("Failed to set rx packet interface version");
+      DBG_SOCK ("Failed to set packet interface version");
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
       goto error;
     }
 
-  int opt = 1;
-  if ((err =
-       setsockopt (*fd, SOL_PACKET, PACKET_LOSS, &opt, sizeof (opt))) < 0)
+  if (is_tx)
     {
-      DBG_SOCK ("Failed to set packet tx ring error handling option");
-      ret = VNET_API_ERROR_SYSCALL_ERROR_1;
-      goto error;
+      opt = 1;
+      if ((err = setsockopt (*fd, SOL_PACKET, PACKET_LOSS, &opt,
+			     sizeof (opt))) < 0)
+	{
+	  DBG_SOCK ("Failed to set packet tx ring error handling option");
+	  ret = VNET_API_ERROR_SYSCALL_ERROR_1;
+	  goto error;
+	}
+
+      /* hand tx frames straight to the driver, best effort since it is
+         only an optimization */
+      opt = 1;
+      if ((err = setsockopt (*fd, SOL_PACKET, PACKET_QDISC_BYPASS, &opt,
+			     sizeof (opt))) < 0)
+	DBG_SOCK ("Failed to set packet qdisc bypass option");
     }
 
-  if ((err =
-       setsockopt (*fd, SOL_PACKET, PACKET_RX_RING, rx_req, req_sz)) < 0)
+  if ((err = setsockopt (*fd, SOL_PACKET, ring_opt, req, req_sz)) < 0)
     {
-      DBG_SOCK ("Failed to set packet rx ring options");
-      ret = VNET_API_ERROR_SYSCALL_ERROR_1;
-      goto error;
-    }
-
-  if ((err =
-       setsockopt (*fd, SOL_PACKET, PACKET_TX_RING, tx_req, req_sz)) < 0)
-    {
-      DBG_SOCK ("Failed to set packet rx ring options");
+      DBG_SOCK ("Failed to set packet %s ring options", is_tx ? "tx" : "rx");
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
       goto error;
     }
@@ -153,32 +158,114 @@ create_packet_v2_sock (u8 * name, tpacket_req_t * rx_req,
 
   memset (&sll, 0, sizeof (sll));
   sll.sll_family = PF_PACKET;
-  sll.sll_protocol = htons (ETH_P_ALL);
+  sll.sll_protocol = protocol;
   sll.sll_ifindex = host_if_index;
 
   if ((err = bind (*fd, (struct sockaddr *) &sll, sizeof (sll))) < 0)
     {
-      DBG_SOCK ("Failed to bind rx packet socket (error %d)", err);
+      DBG_SOCK ("Failed to bind packet socket (error %d)", err);
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
       goto error;
     }
 
+  if (is_tx)
+    return 0;
+
+#ifdef PACKET_IGNORE_OUTGOING
+  /* tx goes out on other sockets, which rx would otherwise see when
+     the qdisc is not bypassed */
+  opt = 1;
+  (void) setsockopt (*fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &opt,
+		     sizeof (opt));
+#endif
+
+  if (fanout_id != ~0)
+    {
+      /* flows stay on one socket, and spill over when its ring is full */
+      opt = fanout_id | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG |
+			  PACKET_FANOUT_FLAG_ROLLOVER) << 16);
+      if ((err = setsockopt (*fd, SOL_PACKET, PACKET_FANOUT, &opt,
+			     sizeof (opt))) < 0)
+	{
+	  DBG_SOCK ("Failed to join packet fanout group");
+	  ret = VNET_API_ERROR_SYSCALL_ERROR_1;
+	  goto error;
+	}
+    }
+
   return 0;
 error:
+  if (*ring != MAP_FAILED)
+    munmap (*ring, ring_sz);
+  *ring = 0;
   if (*fd >= 0)
     close (*fd);
   *fd = -1;
   return ret;
 }
 
+static void
+af_packet_close_queue (af_packet_queue_t * q, tpacket_req3_t * rx_req,
+		       tpacket_req_t * tx_req)
+{
+  if (q->unix_file_index != ~0)
+    {
+      unix_file_del (&unix_main, unix_main.file_pool + q->unix_file_index);
+      q->unix_file_index = ~0;
+    }
+  else if (q->fd >= 0)
+    close (q->fd);
+
+  if (q->tx_fd >= 0)
+    close (q->tx_fd);
+
+  if (q->rx_ring && munmap (q->rx_ring,
+			    rx_req->tp_block_size * rx_req->tp_block_nr))
+    clib_warning ("could not free rx ring");
+  if (q->tx_ring && munmap (q->tx_ring,
+			    tx_req->tp_block_size * tx_req->tp_block_nr))
+    clib_warning ("could not free tx ring");
+  q->rx_ring = NULL;
+  q->tx_ring = NULL;
+  q->fd = -1;
+  q->tx_fd = -1;
+
+  if (q->lockp)
+    clib_mem_free ((void *) q->lockp);
+  q->lockp = 0;
+}
+
+/* Poll on every worker which may own af_packet queues once there is an
+   interface, go back to interrupt mode when the last one is gone. Only
+   the main thread gets epoll interrupts, so workers never go adaptive. */
+static void
+af_packet_set_input_node_state (vlib_node_state_t state)
+{
+  af_packet_main_t *apm = &af_packet_main;
+  u32 i;
+
+  if (apm->input_cpu_first_index == 0)
+    return;
+
+  for (i = apm->input_cpu_first_index;
+       i < apm->input_cpu_first_index + apm->input_cpu_count; i++)
+    {
+      vlib_node_set_adaptive_mode (vlib_mains[i], af_packet_input_node.index,
+				   /* enable */ 0, 0, 0);
+      vlib_node_set_state (vlib_mains[i], af_packet_input_node.index, state);
+    }
+}
+
 int
 af_packet_create_if (vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
-		     u32 * sw_if_index)
+		     u32 n_queues, u32 * sw_if_index)
 {
   af_packet_main_t *apm = &af_packet_main;
-  int ret, fd = -1;
-  struct tpacket_req *rx_req = 0;
-  struct tpacket_req *tx_req = 0;
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  int ret, fd = -1, host_if_index;
+  tpacket_req3_t *rx_req = 0;
+  tpacket_req_t *tx_req = 0;
+  af_packet_queue_t *queues = 0, *q;
   u8 *ring = 0;
   af_packet_if_t *apif = 0;
   u8 hw_addr[6];
@@ -187,7 +274,8 @@ af_packet_create_if (vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
   vnet_main_t *vnm = vnet_get_main ();
   uword *p;
   uword if_index;
-  u8 *host_if_name_dup = vec_dup (host_if_name);
+  u32 fanout_id = ~0, qid;
+  u8 *host_if_name_dup;
 
   p = mhash_get (&apm->if_index_by_host_if_name, host_if_name);
   if (p)
@@ -195,11 +283,26 @@ af_packet_create_if (vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
       return VNET_API_ERROR_SUBIF_ALREADY_EXISTS;
     }
 
+  if (n_queues == 0)
+    n_queues = 1;
+  if (n_queues > AF_PACKET_MAX_QUEUES)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  host_if_index = if_nametoindex ((const char *) host_if_name);
+  if (!host_if_index)
+    {
+      DBG_SOCK ("Wrong host interface name");
+      return VNET_API_ERROR_INVALID_INTERFACE;
+    }
+
+  host_if_name_dup = vec_dup (host_if_name);
+
   vec_validate (rx_req, 0);
   rx_req->tp_block_size = AF_PACKET_RX_BLOCK_SIZE;
   rx_req->tp_frame_size = AF_PACKET_RX_FRAME_SIZE;
   rx_req->tp_block_nr = AF_PACKET_RX_BLOCK_NR;
   rx_req->tp_frame_nr = AF_PACKET_RX_FRAME_NR;
+  rx_req->tp_retire_blk_tov = AF_PACKET_RX_RETIRE_TOV;
 
   vec_validate (tx_req, 0);
   tx_req->tp_block_size = AF_PACKET_TX_BLOCK_SIZE;
@@ -207,32 +310,83 @@ af_packet_create_if (vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
   tx_req->tp_block_nr = AF_PACKET_TX_BLOCK_NR;
   tx_req->tp_frame_nr = AF_PACKET_TX_FRAME_NR;
 
-  ret = create_packet_v2_sock (host_if_name, rx_req, tx_req, &fd, &ring);
+  /* fanout group ids are shared by the whole network namespace */
+  if (n_queues > 1)
+    fanout_id = ((getpid () << 8) ^ host_if_index) & 0xffff;
 
-  if (ret != 0)
-    goto error;
+  vec_validate_aligned (queues, n_queues - 1, CLIB_CACHE_LINE_BYTES);
+  for (qid = 0; qid < n_queues; qid++)
+    {
+      q = vec_elt_at_index (queues, qid);
+      q->fd = -1;
+      q->tx_fd = -1;
+      q->unix_file_index = ~0;
+    }
+
+  for (qid = 0; qid < n_queues; qid++)
+    {
+      q = vec_elt_at_index (queues, qid);
+      ret = create_packet_sock (host_if_index, TPACKET_V3, PACKET_RX_RING,
+				rx_req, sizeof (*rx_req),
+				rx_req->tp_block_size * rx_req->tp_block_nr,
+				&fd, &ring, fanout_id);
+      if (ret != 0)
+	goto error;
+      q->fd = fd;
+      q->rx_ring = ring;
+
+      ret = create_packet_sock (host_if_index, TPACKET_V2, PACKET_TX_RING,
+				tx_req, sizeof (*tx_req),
+				tx_req->tp_block_size * tx_req->tp_block_nr,
+				&fd, &ring, ~0);
+      if (ret != 0)
+	goto error;
+      q->tx_fd = fd;
+      q->tx_ring = ring;
+    }
+
+  vlib_worker_thread_barrier_sync (vm);
 
   /* So far everything looks good, let's create interface */
-  pool_get (apm->interfaces, apif);
+  pool_get_aligned (apm->interfaces, apif, CLIB_CACHE_LINE_BYTES);
   if_index = apif - apm->interfaces;
 
-  apif->fd = fd;
-  apif->rx_ring = ring;
-  apif->tx_ring = ring + rx_req->tp_block_size * rx_req->tp_block_nr;
   apif->rx_req = rx_req;
   apif->tx_req = tx_req;
+  apif->queues = queues;
   apif->host_if_name = host_if_name_dup;
+  apif->host_if_index = host_if_index;
   apif->per_interface_next_index = ~0;
-  apif->next_tx_frame = 0;
-  apif->next_rx_frame = 0;
 
+  vec_foreach (q, apif->queues)
   {
-    unix_file_t template = { 0 };
-    template.read_function = af_packet_fd_read_ready;
-    template.file_descriptor = fd;
-    template.private_data = if_index;
-    template.flags = UNIX_FILE_EVENT_EDGE_TRIGGERED;
-    apif->unix_file_index = unix_file_add (&unix_main, &template);
+    qid = q - apif->queues;
+    q->next_tx_frame = 0;
+    q->next_rx_block = 0;
+    q->rx_pkt_offset = 0;
+    q->rx_pkts_left = 0;
+    q->n_rx_packets = 0;
+    q->input_cpu_index = apm->input_cpu_first_index +
+      (if_index + qid) % apm->input_cpu_count;
+
+    /* threads share tx queues when there are more threads than queues */
+    if (tm->n_vlib_mains > n_queues)
+      {
+	q->lockp = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
+					   CLIB_CACHE_LINE_BYTES);
+	memset ((void *) q->lockp, 0, CLIB_CACHE_LINE_BYTES);
+      }
+
+    /* workers poll, the main thread waits for the socket */
+    if (apm->input_cpu_first_index == 0)
+      {
+	unix_file_t template = { 0 };
+	template.read_function = af_packet_fd_read_ready;
+	template.file_descriptor = q->fd;
+	template.private_data = if_index;
+	template.flags = UNIX_FILE_EVENT_EDGE_TRIGGERED;
+	q->unix_file_index = unix_file_add (&unix_main, &template);
+      }
   }
 
   /*use configured or generate random MAC address */
@@ -258,6 +412,7 @@ af_packet_create_if (vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
     {
       memset (apif, 0, sizeof (*apif));
       pool_put (apm->interfaces, apif);
+      vlib_worker_thread_barrier_release (vm);
       clib_error_report (error);
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
       goto error;
@@ -271,11 +426,20 @@ af_packet_create_if (vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
 
   mhash_set_mem (&apm->if_index_by_host_if_name, host_if_name_dup, &if_index,
 		 0);
+
+  if (pool_elts (apm->interfaces) == 1)
+    af_packet_set_input_node_state (VLIB_NODE_STATE_POLLING);
+
+  vlib_worker_thread_barrier_release (vm);
+
   if (sw_if_index)
     *sw_if_index = apif->sw_if_index;
   return 0;
 
 error:
+  vec_foreach (q, queues)
+    af_packet_close_queue (q, rx_req, tx_req);
+  vec_free (queues);
   vec_free (host_if_name_dup);
   vec_free (rx_req);
   vec_free (tx_req);
@@ -288,9 +452,9 @@ af_packet_delete_if (vlib_main_t * vm, u8 * host_if_name)
   vnet_main_t *vnm = vnet_get_main ();
   af_packet_main_t *apm = &af_packet_main;
   af_packet_if_t *apif;
+  af_packet_queue_t *q;
   uword *p;
   uword if_index;
-  u32 ring_sz;
 
   p = mhash_get (&apm->if_index_by_host_if_name, host_if_name);
   if (p == NULL)
@@ -301,52 +465,122 @@ af_packet_delete_if (vlib_main_t * vm, u8 * host_if_name)
   apif = pool_elt_at_index (apm->interfaces, p[0]);
   if_index = apif - apm->interfaces;
 
+  vlib_worker_thread_barrier_sync (vm);
+
   /* bring down the interface */
   vnet_hw_interface_set_flags (vnm, apif->hw_if_index, 0);
 
   /* clean up */
-  if (apif->unix_file_index != ~0)
-    {
-      unix_file_del (&unix_main, unix_main.file_pool + apif->unix_file_index);
-      apif->unix_file_index = ~0;
-    }
-  else
-    close (apif->fd);
-
-  ring_sz = apif->rx_req->tp_block_size * apif->rx_req->tp_block_nr +
-    apif->tx_req->tp_block_size * apif->tx_req->tp_block_nr;
-  if (munmap (apif->rx_ring, ring_sz))
-    clib_warning ("Host interface %s could not free rx/tx ring",
-		  host_if_name);
-  apif->rx_ring = NULL;
-  apif->tx_ring = NULL;
-  apif->fd = -1;
+  vec_foreach (q, apif->queues)
+    af_packet_close_queue (q, apif->rx_req, apif->tx_req);
+  vec_free (apif->queues);
 
   vec_free (apif->rx_req);
   apif->rx_req = NULL;
   vec_free (apif->tx_req);
   apif->tx_req = NULL;
 
+  mhash_unset (&apm->if_index_by_host_if_name, host_if_name, &if_index);
+
   vec_free (apif->host_if_name);
   apif->host_if_name = NULL;
 
-  mhash_unset (&apm->if_index_by_host_if_name, host_if_name, &if_index);
-
   ethernet_delete_interface (vnm, apif->hw_if_index);
 
   pool_put (apm->interfaces, apif);
 
+  if (pool_elts (apm->interfaces) == 0)
+    af_packet_set_input_node_state (VLIB_NODE_STATE_INTERRUPT);
+
+  vlib_worker_thread_barrier_release (vm);
+
   return 0;
 }
 
+static void
+af_packet_rx_balance_get_queues (vnet_rx_balance_queue_t ** queues)
+{
+  af_packet_main_t *apm = &af_packet_main;
+  vnet_rx_balance_queue_t *bq;
+  af_packet_if_t *apif;
+  af_packet_queue_t *q;
+
+  /* *INDENT-OFF* */
+  pool_foreach (apif, apm->interfaces,
+  ({
+    vec_foreach (q, apif->queues)
+      {
+	vec_add2 (*queues, bq, 1);
+	bq->hw_if_index = apif->hw_if_index;
+	bq->queue_id = q - apif->queues;
+	bq->cpu_index = q->input_cpu_index;
+	bq->n_rx_packets = q->n_rx_packets;
+      }
+  }));
+  /* *INDENT-ON* */
+}
+
+/* every worker polls af-packet-input, so a move only changes the owner */
+static clib_error_t *
+af_packet_rx_balance_move_queue (u32 hw_if_index, u32 queue_id,
+				 u32 cpu_index)
+{
+  af_packet_main_t *apm = &af_packet_main;
+  vnet_main_t *vnm = vnet_get_main ();
+  vnet_hw_interface_t *hw;
+  af_packet_if_t *apif;
+
+  hw = vnet_get_hw_interface (vnm, hw_if_index);
+  if (hw->dev_class_index != af_packet_device_class.index)
+    return clib_error_return (0, "no such af_packet queue");
+
+  apif = pool_elt_at_index (apm->interfaces, hw->dev_instance);
+  if (queue_id >= vec_len (apif->queues))
+    return clib_error_return (0, "no such af_packet queue");
+
+  if (cpu_index < apm->input_cpu_first_index
+      || cpu_index >= apm->input_cpu_first_index + apm->input_cpu_count)
+    return clib_error_return (0, "thread %d does not poll af_packet",
+			      cpu_index);
+
+  apif->queues[queue_id].input_cpu_index = cpu_index;
+  return 0;
+}
+
+static vnet_rx_balance_provider_t af_packet_rx_balance_provider = {
+  .name = "af-packet",
+  .get_queues = af_packet_rx_balance_get_queues,
+  .move_queue = af_packet_rx_balance_move_queue,
+};
+
 static clib_error_t *
 af_packet_init (vlib_main_t * vm)
 {
   af_packet_main_t *apm = &af_packet_main;
   vlib_thread_main_t *tm = vlib_get_thread_main ();
+  vlib_thread_registration_t *tr;
+  uword *p;
 
   memset (apm, 0, sizeof (af_packet_main_t));
 
+  apm->input_cpu_first_index = 0;
+  apm->input_cpu_count = 1;
+
+  /* find out which cpus will be used for input */
+  p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+  tr = p ? (vlib_thread_registration_t *) p[0] : 0;
+
+  if (tr && tr->count > 0)
+    {
+      apm->input_cpu_first_index = tr->first_index;
+      apm->input_cpu_count = tr->count;
+    }
+
+  af_packet_rx_balance_provider.first_cpu_index =
+    apm->input_cpu_first_index;
+  af_packet_rx_balance_provider.n_cpus = apm->input_cpu_count;
+  vnet_rx_balance_register_provider (&af_packet_rx_balance_provider);
+
   mhash_init_vec_string (&apm->if_index_by_host_if_name, sizeof (uword));
 
   vec_validate_aligned (apm->rx_buffers, tm->n_vlib_mains - 1,
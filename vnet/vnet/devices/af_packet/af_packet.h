@@ -17,22 +17,45 @@
  *------------------------------------------------------------------
  */
 
+/*
+ * A TPACKET_V3 rx socket and a TPACKET_V2 tx socket. With more than one
+ * queue the rx sockets form a fanout group, so the kernel spreads
+ * received flows over them.
+ */
 typedef struct
 {
   CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
-  u8 *host_if_name;
+  volatile u32 *lockp;
   int fd;
-  struct tpacket_req *rx_req;
-  struct tpacket_req *tx_req;
+  int tx_fd;
   u8 *rx_ring;
   u8 *tx_ring;
-  u32 hw_if_index;
-  u32 sw_if_index;
   u32 unix_file_index;
 
-  u32 next_rx_frame;
+  /* rx block to look at next, and where we stopped inside it; a zero
+     offset means the block has not been started yet */
+  u32 next_rx_block;
+  u32 rx_pkt_offset;
+  u32 rx_pkts_left;
+
   u32 next_tx_frame;
 
+  /* worker polling the queue, and packets received so far */
+  u32 input_cpu_index;
+  u64 n_rx_packets;
+} af_packet_queue_t;
+
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u8 *host_if_name;
+  int host_if_index;
+  struct tpacket_req3 *rx_req;
+  struct tpacket_req *tx_req;
+  af_packet_queue_t *queues;
+  u32 hw_if_index;
+  u32 sw_if_index;
+
   u32 per_interface_next_index;
   u8 is_admin_up;
 } af_packet_if_t;
@@ -50,14 +73,22 @@ typedef struct
 
   /* hash of host interface names */
   mhash_t if_index_by_host_if_name;
+
+  /* first cpu index */
+  u32 input_cpu_first_index;
+
+  /* total cpu count */
+  u32 input_cpu_count;
 } af_packet_main_t;
 
 af_packet_main_t af_packet_main;
 extern vnet_device_class_t af_packet_device_class;
 extern vlib_node_registration_t af_packet_input_node;
 
+#define AF_PACKET_MAX_QUEUES 16
+
 int af_packet_create_if (vlib_main_t * vm, u8 * host_if_name,
-			 u8 * hw_addr_set, u32 * sw_if_index);
+			 u8 * hw_addr_set, u32 n_queues, u32 * sw_if_index);
 int af_packet_delete_if (vlib_main_t * vm, u8 * host_if_name);
 
 /*
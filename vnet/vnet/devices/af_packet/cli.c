@@ -24,6 +24,9 @@
 #include <sys/types.h>
 #include <sys/uio.h>		/* for iovec */
 #include <netinet/in.h>
+#include <linux/if.h>
+#include <linux/rtnetlink.h>
+#include <linux/veth.h>
 
 #include <vlib/vlib.h>
 #include <vlib/unix/unix.h>
@@ -40,7 +43,7 @@ af_packet_create_command_fn (vlib_main_t * vm, unformat_input_t * input,
   u8 *host_if_name = NULL;
   u8 hwaddr[6];
   u8 *hw_addr_ptr = 0;
-  u32 sw_if_index;
+  u32 sw_if_index, n_queues = 1;
   int r;
 
   /* Get a line of input. */
@@ -55,6 +58,8 @@ af_packet_create_command_fn (vlib_main_t * vm, unformat_input_t * input,
 	if (unformat
 	    (line_input, "hw-addr %U", unformat_ethernet_address, hwaddr))
 	hw_addr_ptr = hwaddr;
+      else if (unformat (line_input, "queues %d", &n_queues))
+	;
       else
 	return clib_error_return (0, "unknown input `%U'",
 				  format_unformat_error, input);
@@ -64,7 +69,8 @@ af_packet_create_command_fn (vlib_main_t * vm, unformat_input_t * input,
   if (host_if_name == NULL)
     return clib_error_return (0, "missing host interface name");
 
-  r = af_packet_create_if (vm, host_if_name, hw_addr_ptr, &sw_if_index);
+  r = af_packet_create_if (vm, host_if_name, hw_addr_ptr, n_queues,
+			   &sw_if_index);
   vec_free (host_if_name);
 
   if (r == VNET_API_ERROR_SYSCALL_ERROR_1)
@@ -76,6 +82,10 @@ af_packet_create_command_fn (vlib_main_t * vm, unformat_input_t * input,
   if (r == VNET_API_ERROR_SUBIF_ALREADY_EXISTS)
     return clib_error_return (0, "Interface elready exists");
 
+  if (r == VNET_API_ERROR_INVALID_VALUE)
+    return clib_error_return (0, "queues must be 1 to %d",
+			      AF_PACKET_MAX_QUEUES);
+
   vlib_cli_output (vm, "%U\n", format_vnet_sw_if_index_name, vnet_get_main (),
 		   sw_if_index);
   return 0;
@@ -84,7 +94,8 @@ af_packet_create_command_fn (vlib_main_t * vm, unformat_input_t * input,
 /* *INDENT-OFF* */
 VLIB_CLI_COMMAND (af_packet_create_command, static) = {
   .path = "create host-interface",
-  .short_help = "create host-interface name <interface name> [hw-addr <mac>]",
+  .short_help = "create host-interface name <interface name> [hw-addr <mac>] "
+    "[queues <n>]",
   .function = af_packet_create_command_fn,
 };
 /* *INDENT-ON* */
@@ -127,6 +138,341 @@ VLIB_CLI_COMMAND (af_packet_delete_command, static) = {
 };
 /* *INDENT-ON* */
 
+/*
+ * veth pair benchmark: packets go out of one end of a veth pair through
+ * its tx ring, the kernel hands them to the other end, and they come
+ * back in through the rx rings of a host-interface with the requested
+ * number of queues. Flows differ in their udp source port so the fanout
+ * spreads them.
+ */
+
+static void
+af_packet_bench_rta_add (struct nlmsghdr *nh, u16 type, void *data,
+			 int len)
+{
+  struct rtattr *rta = (struct rtattr *) ((u8 *) nh +
+					  NLMSG_ALIGN (nh->nlmsg_len));
+  rta->rta_type = type;
+  rta->rta_len = RTA_LENGTH (len);
+  if (len)
+    clib_memcpy (RTA_DATA (rta), data, len);
+  nh->nlmsg_len = NLMSG_ALIGN (nh->nlmsg_len) + RTA_ALIGN (rta->rta_len);
+}
+
+/* close a nested attribute started at rta */
+static void
+af_packet_bench_rta_end (struct nlmsghdr *nh, struct rtattr *rta)
+{
+  rta->rta_len = (u8 *) nh + nh->nlmsg_len - (u8 *) rta;
+}
+
+static clib_error_t *
+af_packet_bench_veth (u8 * name, u8 * peer, int is_add)
+{
+  struct
+  {
+    struct nlmsghdr nh;
+    struct ifinfomsg ifi;
+    u8 attrs[256];
+  } req;
+  struct
+  {
+    struct nlmsghdr nh;
+    struct nlmsgerr err;
+  } reply;
+  struct rtattr *linkinfo, *data, *info_peer;
+  struct ifinfomsg peer_ifi;
+  clib_error_t *error = 0;
+  int fd, n;
+
+  memset (&req, 0, sizeof (req));
+  req.nh.nlmsg_len = NLMSG_LENGTH (sizeof (req.ifi));
+  req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  req.ifi.ifi_family = AF_UNSPEC;
+
+  if (is_add)
+    {
+      req.nh.nlmsg_type = RTM_NEWLINK;
+      req.nh.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+      af_packet_bench_rta_add (&req.nh, IFLA_IFNAME, name,
+			       strlen ((char *) name) + 1);
+      linkinfo = (struct rtattr *) ((u8 *) & req + req.nh.nlmsg_len);
+      af_packet_bench_rta_add (&req.nh, IFLA_LINKINFO, 0, 0);
+      af_packet_bench_rta_add (&req.nh, IFLA_INFO_KIND, "veth", 4);
+      data = (struct rtattr *) ((u8 *) & req + req.nh.nlmsg_len);
+      af_packet_bench_rta_add (&req.nh, IFLA_INFO_DATA, 0, 0);
+      info_peer = (struct rtattr *) ((u8 *) & req + req.nh.nlmsg_len);
+      memset (&peer_ifi, 0, sizeof (peer_ifi));
+      af_packet_bench_rta_add (&req.nh, VETH_INFO_PEER, &peer_ifi,
+			       sizeof (peer_ifi));
+      af_packet_bench_rta_add (&req.nh, IFLA_IFNAME, peer,
+			       strlen ((char *) peer) + 1);
+      af_packet_bench_rta_end (&req.nh, info_peer);
+      af_packet_bench_rta_end (&req.nh, data);
+      af_packet_bench_rta_end (&req.nh, linkinfo);
+    }
+  else
+    {
+      /* deleting one end takes the other with it */
+      req.nh.nlmsg_type = RTM_DELLINK;
+      af_packet_bench_rta_add (&req.nh, IFLA_IFNAME, name,
+			       strlen ((char *) name) + 1);
+    }
+
+  if ((fd = socket (AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0)
+    return clib_error_return_unix (0, "netlink socket");
+
+  if (send (fd, &req, req.nh.nlmsg_len, 0) < 0)
+    error = clib_error_return_unix (0, "netlink send");
+  else if ((n = recv (fd, &reply, sizeof (reply), 0)) < 0)
+    error = clib_error_return_unix (0, "netlink recv");
+  else if (reply.nh.nlmsg_type == NLMSG_ERROR && reply.err.error)
+    error = clib_error_return (0, "%s veth pair %s: %s",
+			       is_add ? "create" : "delete", name,
+			       strerror (-reply.err.error));
+  close (fd);
+  return error;
+}
+
+static clib_error_t *
+af_packet_bench_link_up (u8 * name)
+{
+  struct ifreq ifr;
+  clib_error_t *error = 0;
+  int fd;
+
+  if ((fd = socket (AF_INET, SOCK_DGRAM, 0)) < 0)
+    return clib_error_return_unix (0, "socket");
+
+  memset (&ifr, 0, sizeof (ifr));
+  strncpy (ifr.ifr_name, (char *) name, sizeof (ifr.ifr_name) - 1);
+  if (ioctl (fd, SIOCGIFFLAGS, &ifr) < 0)
+    error = clib_error_return_unix (0, "ioctl SIOCGIFFLAGS %s", name);
+  else
+    {
+      ifr.ifr_flags |= IFF_UP;
+      if (ioctl (fd, SIOCSIFFLAGS, &ifr) < 0)
+	error = clib_error_return_unix (0, "ioctl SIOCSIFFLAGS %s", name);
+    }
+  close (fd);
+  return error;
+}
+
+static void
+af_packet_bench_fill (vlib_main_t * vm, u32 * buffers, u32 n_buffers,
+		      u8 * template, u32 frame_size, u32 sw_if_index,
+		      u32 n_flows, u32 * flow)
+{
+  u32 i;
+
+  for (i = 0; i < n_buffers; i++)
+    {
+      vlib_buffer_t *b = vlib_get_buffer (vm, buffers[i]);
+      ip4_header_t *ip;
+      udp_header_t *udp;
+
+      clib_memcpy (b->data, template, frame_size);
+      b->current_data = 0;
+      b->current_length = frame_size;
+      b->flags = 0;
+      vnet_buffer (b)->sw_if_index[VLIB_RX] = sw_if_index;
+      vnet_buffer (b)->sw_if_index[VLIB_TX] = sw_if_index;
+
+      ip = (ip4_header_t *) (b->data + sizeof (ethernet_header_t));
+      udp = (udp_header_t *) (ip + 1);
+      udp->src_port = clib_host_to_net_u16 (1024 + *flow);
+      if (++*flow >= n_flows)
+	*flow = 0;
+    }
+}
+
+static clib_error_t *
+af_packet_bench_command_fn (vlib_main_t * vm, unformat_input_t * input,
+			    vlib_cli_command_t * cmd)
+{
+  af_packet_main_t *apm = &af_packet_main;
+  vnet_main_t *vnm = vnet_get_main ();
+  u8 *name = 0, *peer = 0, *template = 0;
+  u32 n_queues = 1, frame_size = 64, n_flows = 1024, flow = 0;
+  u32 tx_sw_if_index = ~0, rx_sw_if_index = ~0;
+  u32 buffers[VLIB_FRAME_SIZE];
+  vnet_hw_interface_t *tx_hi, *rx_hi;
+  af_packet_if_t *apif;
+  af_packet_queue_t *q;
+  vlib_node_t *drop;
+  f64 duration = 1.0, t0, t1;
+  u64 n_tx = 0, n_rx = 0, *rx0 = 0;
+  clib_error_t *error = 0;
+  int created = 0, r;
+  ethernet_header_t *e;
+  ip4_header_t *ip;
+  udp_header_t *udp;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "name %s peer %s", &name, &peer))
+	;
+      else if (unformat (input, "queues %d", &n_queues))
+	;
+      else if (unformat (input, "size %d", &frame_size))
+	;
+      else if (unformat (input, "flows %d", &n_flows))
+	;
+      else if (unformat (input, "time %f", &duration))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (frame_size < 60 || frame_size > VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES)
+    return clib_error_return (0, "size must be 60 to %d",
+			      VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES);
+  if (n_flows < 1 || n_flows > 60000)
+    return clib_error_return (0, "flows must be 1 to 60000");
+
+  /* without names, bring a veth pair of our own */
+  if (!name)
+    {
+      name = format (0, "vpp-bench-tx%c", 0);
+      peer = format (0, "vpp-bench-rx%c", 0);
+      if ((error = af_packet_bench_veth (name, peer, 1 /* is_add */ )))
+	goto done;
+      created = 1;
+    }
+  else
+    {
+      vec_add1 (name, 0);
+      vec_add1 (peer, 0);
+    }
+  if ((error = af_packet_bench_link_up (name))
+      || (error = af_packet_bench_link_up (peer)))
+    goto done;
+
+  if ((r = af_packet_create_if (vm, name, 0, 1, &tx_sw_if_index))
+      || (r = af_packet_create_if (vm, peer, 0, n_queues, &rx_sw_if_index)))
+    {
+      error = clib_error_return (0, "create host-interface failed (%d)", r);
+      goto done;
+    }
+
+  vlib_worker_thread_barrier_sync (vm);
+  tx_hi = vnet_get_sup_hw_interface (vnm, tx_sw_if_index);
+  rx_hi = vnet_get_sup_hw_interface (vnm, rx_sw_if_index);
+  vnet_sw_interface_set_flags (vnm, tx_sw_if_index,
+			       VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+  vnet_sw_interface_set_flags (vnm, rx_sw_if_index,
+			       VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+
+  /* count what arrives and drop it right away */
+  drop = vlib_get_node_by_name (vm, (u8 *) "error-drop");
+  vnet_hw_interface_rx_redirect_to_node (vnm, rx_hi->hw_if_index,
+					 drop->index);
+  apif = pool_elt_at_index (apm->interfaces, rx_hi->dev_instance);
+  vec_foreach (q, apif->queues) vec_add1 (rx0, q->n_rx_packets);
+  vlib_worker_thread_barrier_release (vm);
+
+  /* udp to a mac nobody has, so the kernel stack leaves it alone */
+  vec_validate (template, frame_size - 1);
+  e = (ethernet_header_t *) template;
+  e->dst_address[0] = 0x02;
+  e->dst_address[5] = 0x01;
+  clib_memcpy (e->src_address, tx_hi->hw_address, 6);
+  e->type = clib_host_to_net_u16 (ETHERNET_TYPE_IP4);
+  ip = (ip4_header_t *) (e + 1);
+  ip->ip_version_and_header_length = 0x45;
+  ip->ttl = 64;
+  ip->protocol = IP_PROTOCOL_UDP;
+  ip->length = clib_host_to_net_u16 (frame_size - sizeof (*e));
+  ip->src_address.as_u32 = clib_host_to_net_u32 (0x0a000001);
+  ip->dst_address.as_u32 = clib_host_to_net_u32 (0x0a000002);
+  ip->checksum = ip4_header_checksum (ip);
+  udp = (udp_header_t *) (ip + 1);
+  udp->dst_port = clib_host_to_net_u16 (4789);
+  udp->length = clib_host_to_net_u16 (frame_size - sizeof (*e) -
+				      sizeof (*ip));
+
+  t0 = vlib_time_now (vm);
+  do
+    {
+      vlib_frame_t *f;
+      u32 n = vlib_buffer_alloc (vm, buffers, VLIB_FRAME_SIZE);
+
+      if (n)
+	{
+	  af_packet_bench_fill (vm, buffers, n, template, frame_size,
+				tx_sw_if_index, n_flows, &flow);
+	  f = vlib_get_frame_to_node (vm, tx_hi->output_node_index);
+	  clib_memcpy (vlib_frame_vector_args (f), buffers,
+		       n * sizeof (u32));
+	  f->n_vectors = n;
+	  vlib_put_frame_to_node (vm, tx_hi->output_node_index, f);
+	  n_tx += n;
+	}
+
+      vlib_process_suspend (vm, 10e-6);
+      t1 = vlib_time_now (vm);
+    }
+  while (t1 - t0 < duration);
+
+  /* let the last blocks retire */
+  vlib_process_suspend (vm, 10e-3);
+
+  vlib_worker_thread_barrier_sync (vm);
+  t1 = vlib_time_now (vm);
+  apif = pool_elt_at_index (apm->interfaces, rx_hi->dev_instance);
+
+  vlib_cli_output (vm, "%s -> %s, %d rx queue%s, %d byte frames, %d flows, "
+		   "%.2f sec", name, peer, n_queues, n_queues > 1 ? "s" : "",
+		   frame_size, n_flows, t1 - t0);
+  vlib_cli_output (vm, "%5s %7s %12s %9s", "queue", "thread", "rx",
+		   "rx Mpps");
+  vec_foreach (q, apif->queues)
+  {
+    u64 n = q->n_rx_packets - rx0[q - apif->queues];
+    vlib_cli_output (vm, "%5d %7d %12llu %9.2f", q - apif->queues,
+		     q->input_cpu_index, n, n / (t1 - t0) * 1e-6);
+    n_rx += n;
+  }
+  vlib_cli_output (vm, "%5s %7s %12llu %9.2f", "total", "", n_rx,
+		   n_rx / (t1 - t0) * 1e-6);
+  vlib_cli_output (vm, "sent %llu (%.2f Mpps), received %.1f%%",
+		   n_tx, n_tx / (t1 - t0) * 1e-6,
+		   n_tx ? 100.0 * n_rx / n_tx : 0.0);
+
+  vnet_hw_interface_rx_redirect_to_node (vnm, rx_hi->hw_if_index, ~0);
+  vlib_worker_thread_barrier_release (vm);
+
+done:
+  if (rx_sw_if_index != ~0)
+    af_packet_delete_if (vm, peer);
+  if (tx_sw_if_index != ~0)
+    af_packet_delete_if (vm, name);
+  if (created)
+    {
+      clib_error_t *e = af_packet_bench_veth (name, peer, 0 /* is_add */ );
+      if (!error)
+	error = e;
+      else
+	clib_error_free (e);
+    }
+  vec_free (name);
+  vec_free (peer);
+  vec_free (template);
+  vec_free (rx0);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (af_packet_bench_command, static) = {
+  .path = "test host-interface veth",
+  .short_help = "test host-interface veth [name <if> peer <if>] "
+    "[queues <n>] [size <bytes>] [flows <n>] [time <sec>]",
+  .function = af_packet_bench_command_fn,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
 clib_error_t *
 af_packet_cli_init (vlib_main_t * vm)
 {
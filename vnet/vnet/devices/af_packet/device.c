@@ -61,7 +61,29 @@ format_af_packet_device_name (u8 * s, va_list * args)
 static u8 *
 format_af_packet_device (u8 * s, va_list * args)
 {
+  u32 dev_instance = va_arg (*args, u32);
+  int verbose = va_arg (*args, int);
+  af_packet_main_t *apm = &af_packet_main;
+  af_packet_if_t *apif = pool_elt_at_index (apm->interfaces, dev_instance);
+  af_packet_queue_t *q;
+  uword indent = format_get_indent (s);
+
   s = format (s, "Linux PACKET socket interface");
+  if (verbose)
+    {
+      s = format (s, "\n%Urx %u blocks of %u bytes, tx %u frames of %u "
+		  "bytes, %u queue%s",
+		  format_white_space, indent + 2,
+		  apif->rx_req->tp_block_nr, apif->rx_req->tp_block_size,
+		  apif->tx_req->tp_frame_nr, apif->tx_req->tp_frame_size,
+		  vec_len (apif->queues),
+		  vec_len (apif->queues) > 1 ? "s (fanout)" : "");
+      vec_foreach (q, apif->queues)
+	s = format (s, "\n%Uqueue %u: rx fd %d tx fd %d thread %u "
+		    "rx packets %llu", format_white_space, indent + 2,
+		    q - apif->queues, q->fd, q->tx_fd, q->input_cpu_index,
+		    q->n_rx_packets);
+    }
   return s;
 }
 
@@ -83,15 +105,25 @@ af_packet_interface_tx (vlib_main_t * vm,
   vnet_interface_output_runtime_t *rd = (void *) node->runtime_data;
   af_packet_if_t *apif =
     pool_elt_at_index (apm->interfaces, rd->dev_instance);
+  af_packet_queue_t *q =
+    vec_elt_at_index (apif->queues, vm->cpu_index % vec_len (apif->queues));
   int block = 0;
   u32 block_size = apif->tx_req->tp_block_size;
   u32 frame_size = apif->tx_req->tp_frame_size;
   u32 frame_num = apif->tx_req->tp_frame_nr;
-  u8 *block_start = apif->tx_ring + block * block_size;
-  u32 tx_frame = apif->next_tx_frame;
+  u8 *block_start = q->tx_ring + block * block_size;
+  u32 tx_frame;
   struct tpacket2_hdr *tph;
   u32 frame_not_ready = 0;
 
+  if (PREDICT_FALSE (q->lockp != 0))
+    {
+      while (__sync_lock_test_and_set (q->lockp, 1))
+	;
+    }
+
+  tx_frame = q->next_tx_frame;
+
   while (n_left > 0)
     {
       u32 len;
@@ -136,9 +168,9 @@ af_packet_interface_tx (vlib_main_t * vm,
 
   if (PREDICT_TRUE (n_sent))
     {
-      apif->next_tx_frame = tx_frame;
+      q->next_tx_frame = tx_frame;
 
-      if (PREDICT_FALSE (sendto (apif->fd, NULL, 0,
+      if (PREDICT_FALSE (sendto (q->tx_fd, NULL, 0,
 				 MSG_DONTWAIT, NULL, 0) == -1))
 	{
 	  /* Uh-oh, drop & move on, but count whether it was fatal or not.
@@ -160,6 +192,9 @@ af_packet_interface_tx (vlib_main_t * vm,
     vlib_error_count (vm, node->node_index, AF_PACKET_TX_ERROR_TXRING_OVERRUN,
 		      n_left);
 
+  if (PREDICT_FALSE (q->lockp != 0))
+    *q->lockp = 0;
+
   vlib_buffer_free (vm, vlib_frame_args (frame), frame->n_vectors);
   return frame->n_vectors;
 }
@@ -48,8 +48,9 @@ typedef struct
 {
   u32 next_index;
   u32 hw_if_index;
-  int block;
-  struct tpacket2_hdr tph;
+  u16 queue_id;
+  u16 block;
+  struct tpacket3_hdr tph;
 } af_packet_input_trace_t;
 
 static u8 *
@@ -60,18 +61,19 @@ format_af_packet_input_trace (u8 * s, va_list * args)
   af_packet_input_trace_t *t = va_arg (*args, af_packet_input_trace_t *);
   uword indent = format_get_indent (s);
 
-  s = format (s, "af_packet: hw_if_index %d next-index %d",
-	      t->hw_if_index, t->next_index);
+  s = format (s, "af_packet: hw_if_index %d queue %d next-index %d",
+	      t->hw_if_index, t->queue_id, t->next_index);
 
   s =
     format (s,
-	    "\n%Utpacket2_hdr:\n%Ustatus 0x%x len %u snaplen %u mac %u net %u"
-	    "\n%Usec 0x%x nsec 0x%x vlan %U"
+	    "\n%Utpacket3_hdr (block %u):\n%Ustatus 0x%x len %u snaplen %u "
+	    "mac %u net %u"
+	    "\n%Usec 0x%x nsec 0x%x rxhash 0x%x vlan %U"
 #ifdef TP_STATUS_VLAN_TPID_VALID
 	    " vlan_tpid %u"
 #endif
 	    ,
-	    format_white_space, indent + 2,
+	    format_white_space, indent + 2, t->block,
 	    format_white_space, indent + 4,
 	    t->tph.tp_status,
 	    t->tph.tp_len,
@@ -80,9 +82,10 @@ format_af_packet_input_trace (u8 * s, va_list * args)
 	    t->tph.tp_net,
 	    format_white_space, indent + 4,
 	    t->tph.tp_sec,
-	    t->tph.tp_nsec, format_ethernet_vlan_tci, t->tph.tp_vlan_tci
+	    t->tph.tp_nsec, t->tph.hv1.tp_rxhash,
+	    format_ethernet_vlan_tci, t->tph.hv1.tp_vlan_tci
 #ifdef TP_STATUS_VLAN_TPID_VALID
-	    , t->tph.tp_vlan_tpid
+	    , t->tph.hv1.tp_vlan_tpid
 #endif
     );
   return s;
@@ -117,60 +120,88 @@ buffer_add_to_chain (vlib_main_t * vm, u32 bi, u32 first_bi, u32 prev_bi)
 #endif
 }
 
+always_inline u32
+af_packet_rx_refill (vlib_main_t * vm, af_packet_main_t * apm, u32 cpu_index)
+{
+  u32 n_free_bufs = vec_len (apm->rx_buffers[cpu_index]);
+
+  if (PREDICT_FALSE (n_free_bufs < VLIB_FRAME_SIZE))
+    {
+      vec_validate (apm->rx_buffers[cpu_index],
+		    VLIB_FRAME_SIZE + n_free_bufs - 1);
+      n_free_bufs +=
+	vlib_buffer_alloc (vm, &apm->rx_buffers[cpu_index][n_free_bufs],
+			   VLIB_FRAME_SIZE);
+      _vec_len (apm->rx_buffers[cpu_index]) = n_free_bufs;
+    }
+  return n_free_bufs;
+}
+
+/*
+ * TPACKET_V3 rx: the kernel fills a block with packets back to back and
+ * hands the whole block over. Packets are copied out in order and the
+ * block goes back to the kernel in one go once it is empty. Running out
+ * of buffers leaves the rest of the block for the next call.
+ */
 always_inline uword
 af_packet_device_input_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
-			   vlib_frame_t * frame, u32 device_idx)
+			   vlib_frame_t * frame, af_packet_if_t * apif,
+			   af_packet_queue_t * q)
 {
   af_packet_main_t *apm = &af_packet_main;
-  af_packet_if_t *apif = pool_elt_at_index (apm->interfaces, device_idx);
-  struct tpacket2_hdr *tph;
+  struct tpacket_block_desc *bd;
+  struct tpacket3_hdr *tph;
   u32 next_index = VNET_DEVICE_INPUT_NEXT_ETHERNET_INPUT;
-  u32 block = 0;
-  u32 rx_frame;
   u32 n_free_bufs;
   u32 n_rx_packets = 0;
   u32 n_rx_bytes = 0;
   u32 *to_next = 0;
   u32 block_size = apif->rx_req->tp_block_size;
-  u32 frame_size = apif->rx_req->tp_frame_size;
-  u32 frame_num = apif->rx_req->tp_frame_nr;
-  u8 *block_start = apif->rx_ring + block * block_size;
+  u32 block_num = apif->rx_req->tp_block_nr;
   uword n_trace = vlib_get_trace_count (vm, node);
   u32 n_buffer_bytes = vlib_buffer_free_list_buffer_size (vm,
 							  VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
-  u32 min_bufs = apif->rx_req->tp_frame_size / n_buffer_bytes;
   int cpu_index = node->cpu_index;
+  int out_of_buffers = 0;
 
   if (apif->per_interface_next_index != ~0)
     next_index = apif->per_interface_next_index;
 
-  n_free_bufs = vec_len (apm->rx_buffers[cpu_index]);
-  if (PREDICT_FALSE (n_free_bufs < VLIB_FRAME_SIZE))
-    {
-      vec_validate (apm->rx_buffers[cpu_index],
-		    VLIB_FRAME_SIZE + n_free_bufs - 1);
-      n_free_bufs +=
-	vlib_buffer_alloc (vm, &apm->rx_buffers[cpu_index][n_free_bufs],
-			   VLIB_FRAME_SIZE);
-      _vec_len (apm->rx_buffers[cpu_index]) = n_free_bufs;
-    }
+  n_free_bufs = af_packet_rx_refill (vm, apm, cpu_index);
 
-  rx_frame = apif->next_rx_frame;
-  tph = (struct tpacket2_hdr *) (block_start + rx_frame * frame_size);
-  while ((tph->tp_status & TP_STATUS_USER) && (n_free_bufs > min_bufs))
+  bd = (struct tpacket_block_desc *) (q->rx_ring +
+				      q->next_rx_block * block_size);
+  while (bd->hdr.bh1.block_status & TP_STATUS_USER)
     {
       vlib_buffer_t *b0 = 0, *first_b0 = 0;
       u32 next0 = next_index;
-
       u32 n_left_to_next;
+
+      if (q->rx_pkt_offset == 0)
+	{
+	  q->rx_pkts_left = bd->hdr.bh1.num_pkts;
+	  q->rx_pkt_offset = bd->hdr.bh1.offset_to_first_pkt;
+	}
+
       vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
-      while ((tph->tp_status & TP_STATUS_USER) && (n_free_bufs > min_bufs) &&
-	     n_left_to_next)
+      while (q->rx_pkts_left && n_left_to_next)
 	{
-	  u32 data_len = tph->tp_snaplen;
-	  u32 offset = 0;
+	  u32 data_len, offset = 0;
 	  u32 bi0 = 0, first_bi0 = 0, prev_bi0;
 
+	  tph = (struct tpacket3_hdr *) ((u8 *) bd + q->rx_pkt_offset);
+	  data_len = tph->tp_snaplen;
+
+	  if (PREDICT_FALSE (n_free_bufs * n_buffer_bytes < data_len))
+	    {
+	      n_free_bufs = af_packet_rx_refill (vm, apm, cpu_index);
+	      if (n_free_bufs * n_buffer_bytes < data_len)
+		{
+		  out_of_buffers = 1;
+		  break;
+		}
+	    }
+
 	  while (data_len)
 	    {
 	      /* grab free buffer */
@@ -229,33 +260,63 @@ af_packet_device_input_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
 	      tr = vlib_add_trace (vm, node, first_b0, sizeof (*tr));
 	      tr->next_index = next0;
 	      tr->hw_if_index = apif->hw_if_index;
-	      clib_memcpy (&tr->tph, tph, sizeof (struct tpacket2_hdr));
+	      tr->queue_id = q - apif->queues;
+	      tr->block = q->next_rx_block;
+	      clib_memcpy (&tr->tph, tph, sizeof (struct tpacket3_hdr));
 	    }
 
 	  /* redirect if feature path enabled */
 	  vnet_feature_device_input_redirect_x1 (node, apif->sw_if_index,
-						 &next0, b0, 0);
+						 &next0, first_b0, 0);
 
 	  /* enque and take next packet */
 	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index, to_next,
 					   n_left_to_next, first_bi0, next0);
 
 	  /* next packet */
-	  tph->tp_status = TP_STATUS_KERNEL;
-	  rx_frame = (rx_frame + 1) % frame_num;
-	  tph = (struct tpacket2_hdr *) (block_start + rx_frame * frame_size);
+	  q->rx_pkt_offset += tph->tp_next_offset;
+	  q->rx_pkts_left--;
 	}
 
       vlib_put_next_frame (vm, node, next_index, n_left_to_next);
-    }
 
-  apif->next_rx_frame = rx_frame;
+      if (q->rx_pkts_left)
+	{
+	  if (out_of_buffers)
+	    break;
+	  continue;
+	}
+
+      /* block done, give it back to the kernel */
+      bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+      q->rx_pkt_offset = 0;
+      q->next_rx_block = (q->next_rx_block + 1) % block_num;
+      bd = (struct tpacket_block_desc *) (q->rx_ring +
+					  q->next_rx_block * block_size);
+    }
 
   vlib_increment_combined_counter
     (vnet_get_main ()->interface_main.combined_sw_if_counters
      + VNET_INTERFACE_COUNTER_RX,
      os_get_cpu_number (), apif->hw_if_index, n_rx_packets, n_rx_bytes);
 
+  q->n_rx_packets += n_rx_packets;
+  return n_rx_packets;
+}
+
+always_inline uword
+af_packet_if_input (vlib_main_t * vm, vlib_node_runtime_t * node,
+		    vlib_frame_t * frame, af_packet_if_t * apif,
+		    u32 cpu_index)
+{
+  af_packet_queue_t *q;
+  uword n_rx_packets = 0;
+
+  vec_foreach (q, apif->queues)
+  {
+    if (q->input_cpu_index == cpu_index)
+      n_rx_packets += af_packet_device_input_fn (vm, node, frame, apif, q);
+  }
   return n_rx_packets;
 }
 
@@ -265,14 +326,32 @@ af_packet_input_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
 {
   int i;
   u32 n_rx_packets = 0;
+  u32 cpu_index = os_get_cpu_number ();
 
   af_packet_main_t *apm = &af_packet_main;
+  af_packet_if_t *apif;
+
+  /* In polling mode (see adaptive mode, or workers) check every ring */
+  if (node->state == VLIB_NODE_STATE_POLLING)
+    {
+      if (cpu_index == 0)
+	clib_bitmap_zero (apm->pending_input_bitmap);
+      /* *INDENT-OFF* */
+      pool_foreach (apif, apm->interfaces,
+	({
+	  n_rx_packets += af_packet_if_input (vm, node, frame, apif,
+					      cpu_index);
+	}));
+      /* *INDENT-ON* */
+      return n_rx_packets;
+    }
 
   /* *INDENT-OFF* */
   clib_bitmap_foreach (i, apm->pending_input_bitmap,
     ({
       clib_bitmap_set (apm->pending_input_bitmap, i, 0);
-      n_rx_packets += af_packet_device_input_fn(vm, node, frame, i);
+      n_rx_packets += af_packet_if_input
+	(vm, node, frame, pool_elt_at_index (apm->interfaces, i), cpu_index);
     }));
   /* *INDENT-ON* */
 
@@ -286,6 +365,7 @@ VLIB_REGISTER_NODE (af_packet_input_node) = {
   .format_trace = format_af_packet_input_trace,
   .type = VLIB_NODE_TYPE_INPUT,
   .state = VLIB_NODE_STATE_INTERRUPT,
+  .flags = VLIB_NODE_FLAG_ADAPTIVE_MODE,
   .n_errors = AF_PACKET_INPUT_N_ERROR,
   .error_strings = af_packet_input_error_strings,
 
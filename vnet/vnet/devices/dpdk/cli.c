@@ -20,6 +20,7 @@
 
 #include <vnet/ethernet/ethernet.h>
 #include <vnet/devices/dpdk/dpdk.h>
+#include <vnet/devices/rx_balance.h>
 #include <vnet/classify/vnet_classify.h>
 #include <vnet/mpls/packet.h>
 
@@ -373,16 +374,22 @@ show_efd (vlib_main_t * vm,
 	  fq = vlib_frame_queues[thread_id];
 	  if (fq)
 	    {
+	      vlib_frame_queue_ring_t *r;
+	      u64 queued = 0, full = 0, congested = 0;
+
+	      vec_foreach (r, fq->rings)
+	      {
+		queued += r->tail_published - r->head;
+		full += r->enqueue_full_events;
+		congested += r->enqueue_congested_events;
+	      }
 	      vlib_cli_output (vm,
-			       "%2d: frames_queued         %u\n"
-			       "    frames_queued_hint    %u\n"
-			       "    enqueue_full_events   %u\n"
-			       "    enqueue_efd_discards  %u\n",
-			       thread_id,
-			       (fq->tail - fq->head),
-			       (fq->tail - fq->head_hint),
-			       fq->enqueue_full_events,
-			       fq->enqueue_efd_discards);
+			       "%2d: frames_queued             %llu\n"
+			       "    enqueue_full_events       %llu\n"
+			       "    enqueue_congested_events  %llu\n"
+			       "    dequeue_backlog_events    %llu\n",
+			       thread_id, queued, full, congested,
+			       fq->dequeue_backlog_events);
 	    }
 	}
     }
@@ -437,8 +444,15 @@ clear_efd (vlib_main_t * vm,
       fq = vlib_frame_queues[thread_id];
       if (fq)
 	{
-	  fq->enqueue_full_events = 0;
-	  fq->enqueue_efd_discards = 0;
+	  vlib_frame_queue_ring_t *r;
+
+	  vec_foreach (r, fq->rings)
+	  {
+	    r->enqueue_full_events = 0;
+	    r->enqueue_full_ticks = 0;
+	    r->enqueue_congested_events = 0;
+	  }
+	  fq->dequeue_backlog_events = 0;
 	}
     }
 
@@ -792,43 +806,20 @@ dpdk_device_queue_sort (void *a1, void *a2)
     return 0;
 }
 
-static clib_error_t *
-set_dpdk_if_placement (vlib_main_t * vm, unformat_input_t * input,
-		       vlib_cli_command_t * cmd)
+/*
+ * Move an rx queue to another worker thread. The caller holds the
+ * worker barrier, so no worker is polling the queue meanwhile.
+ */
+clib_error_t *
+dpdk_device_queue_set_cpu (dpdk_main_t * dm, u32 hw_if_index, u32 queue,
+			   u32 cpu)
 {
-  unformat_input_t _line_input, *line_input = &_line_input;
-  dpdk_main_t *dm = &dpdk_main;
   dpdk_device_and_queue_t *dq;
   vnet_hw_interface_t *hw;
   dpdk_device_t *xd;
-  u32 hw_if_index = (u32) ~ 0;
-  u32 queue = (u32) 0;
-  u32 cpu = (u32) ~ 0;
+  u64 n_rx_packets;
   int i;
 
-  if (!unformat_user (input, unformat_line_input, line_input))
-    return 0;
-
-  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
-    {
-      if (unformat
-	  (line_input, "%U", unformat_vnet_hw_interface, dm->vnet_main,
-	   &hw_if_index))
-	;
-      else if (unformat (line_input, "queue %d", &queue))
-	;
-      else if (unformat (line_input, "thread %d", &cpu))
-	;
-      else
-	return clib_error_return (0, "parse error: '%U'",
-				  format_unformat_error, line_input);
-    }
-
-  unformat_free (line_input);
-
-  if (hw_if_index == (u32) ~ 0)
-    return clib_error_return (0, "please specify valid interface name");
-
   if (cpu < dm->input_cpu_first_index ||
       cpu >= (dm->input_cpu_first_index + dm->input_cpu_count))
     return clib_error_return (0, "please specify valid thread id");
@@ -847,10 +838,12 @@ set_dpdk_if_placement (vlib_main_t * vm, unformat_input_t * input,
               if (cpu == i) /* nothing to do */
                 return 0;
 
+              n_rx_packets = dq->n_rx_packets;
               vec_del1(dm->devices_by_cpu[i], dq - dm->devices_by_cpu[i]);
               vec_add2(dm->devices_by_cpu[cpu], dq, 1);
               dq->queue_id = queue;
               dq->device = xd->device_index;
+              dq->n_rx_packets = n_rx_packets;
               xd->cpu_socket_id_by_queue[queue] =
                 rte_lcore_to_socket_id(vlib_worker_threads[cpu].lcore_id);
 
@@ -877,6 +870,42 @@ set_dpdk_if_placement (vlib_main_t * vm, unformat_input_t * input,
   return clib_error_return (0, "not found");
 }
 
+static clib_error_t *
+set_dpdk_if_placement (vlib_main_t * vm, unformat_input_t * input,
+		       vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, *line_input = &_line_input;
+  dpdk_main_t *dm = &dpdk_main;
+  u32 hw_if_index = (u32) ~ 0;
+  u32 queue = (u32) 0;
+  u32 cpu = (u32) ~ 0;
+
+  if (!unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat
+	  (line_input, "%U", unformat_vnet_hw_interface, dm->vnet_main,
+	   &hw_if_index))
+	;
+      else if (unformat (line_input, "queue %d", &queue))
+	;
+      else if (unformat (line_input, "thread %d", &cpu))
+	;
+      else
+	return clib_error_return (0, "parse error: '%U'",
+				  format_unformat_error, line_input);
+    }
+
+  unformat_free (line_input);
+
+  if (hw_if_index == (u32) ~ 0)
+    return clib_error_return (0, "please specify valid interface name");
+
+  return dpdk_device_queue_set_cpu (dm, hw_if_index, queue, cpu);
+}
+
 /* *INDENT-OFF* */
 VLIB_CLI_COMMAND (cmd_set_dpdk_if_placement,static) = {
     .path = "set dpdk interface placement",
@@ -885,6 +914,50 @@ VLIB_CLI_COMMAND (cmd_set_dpdk_if_placement,static) = {
 };
 /* *INDENT-ON* */
 
+static void
+dpdk_rx_balance_get_queues (vnet_rx_balance_queue_t ** queues)
+{
+  dpdk_main_t *dm = &dpdk_main;
+  dpdk_device_and_queue_t *dq;
+  vnet_rx_balance_queue_t *q;
+  int cpu;
+
+  for (cpu = 0; cpu < vec_len (dm->devices_by_cpu); cpu++)
+    {
+      /* *INDENT-OFF* */
+      vec_foreach(dq, dm->devices_by_cpu[cpu])
+        {
+          vec_add2 (*queues, q, 1);
+          q->hw_if_index = dm->devices[dq->device].vlib_hw_if_index;
+          q->queue_id = dq->queue_id;
+          q->cpu_index = cpu;
+          q->n_rx_packets = dq->n_rx_packets;
+        }
+      /* *INDENT-ON* */
+    }
+}
+
+static clib_error_t *
+dpdk_rx_balance_move_queue (u32 hw_if_index, u32 queue_id, u32 cpu_index)
+{
+  return dpdk_device_queue_set_cpu (&dpdk_main, hw_if_index, queue_id,
+				    cpu_index);
+}
+
+static vnet_rx_balance_provider_t dpdk_rx_balance_provider = {
+  .name = "dpdk",
+  .get_queues = dpdk_rx_balance_get_queues,
+  .move_queue = dpdk_rx_balance_move_queue,
+};
+
+void
+dpdk_rx_balance_register (dpdk_main_t * dm)
+{
+  dpdk_rx_balance_provider.first_cpu_index = dm->input_cpu_first_index;
+  dpdk_rx_balance_provider.n_cpus = dm->input_cpu_count;
+  vnet_rx_balance_register_provider (&dpdk_rx_balance_provider);
+}
+
 static clib_error_t *
 show_dpdk_if_hqos_placement (vlib_main_t * vm, unformat_input_t * input,
 			     vlib_cli_command_t * cmd)
@@ -283,6 +283,9 @@ typedef struct
 {
   u32 device;
   u16 queue_id;
+
+  /* packets received from this queue, follows it between workers */
+  u64 n_rx_packets;
 } dpdk_device_and_queue_t;
 
 /* Early-Fast-Discard (EFD) */
@@ -511,6 +514,11 @@ void dpdk_set_flowcontrol_callback (vlib_main_t * vm,
 
 u32 dpdk_interface_tx_vector (vlib_main_t * vm, u32 dev_instance);
 
+clib_error_t *dpdk_device_queue_set_cpu (dpdk_main_t * dm, u32 hw_if_index,
+					 u32 queue, u32 cpu);
+
+void dpdk_rx_balance_register (dpdk_main_t * dm);
+
 void set_efd_bitmap (u8 * bitmap, u32 value, u32 op);
 
 struct rte_mbuf *dpdk_replicate_packet_mb (vlib_buffer_t * b);
@@ -275,6 +275,8 @@ dpdk_lib_init (dpdk_main_t * dm)
   vec_validate_aligned (dm->devices_by_cpu, tm->n_vlib_mains - 1,
 			CLIB_CACHE_LINE_BYTES);
 
+  dpdk_rx_balance_register (dm);
+
   vec_validate_aligned (dm->workers, tm->n_vlib_mains - 1,
 			CLIB_CACHE_LINE_BYTES);
 
@@ -630,7 +630,7 @@ dpdk_input (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f)
 {
   dpdk_main_t *dm = &dpdk_main;
   dpdk_device_t *xd;
-  uword n_rx_packets = 0;
+  uword n_rx_packets = 0, n;
   dpdk_device_and_queue_t *dq;
   u32 cpu_index = os_get_cpu_number ();
 
@@ -642,7 +642,9 @@ dpdk_input (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f)
     {
       xd = vec_elt_at_index(dm->devices, dq->device);
       ASSERT(dq->queue_id == 0);
-      n_rx_packets += dpdk_device_input (dm, xd, node, cpu_index, 0, 0);
+      n = dpdk_device_input (dm, xd, node, cpu_index, 0, 0);
+      dq->n_rx_packets += n;
+      n_rx_packets += n;
     }
   /* *INDENT-ON* */
 
@@ -657,7 +659,7 @@ dpdk_input_rss (vlib_main_t * vm,
 {
   dpdk_main_t *dm = &dpdk_main;
   dpdk_device_t *xd;
-  uword n_rx_packets = 0;
+  uword n_rx_packets = 0, n;
   dpdk_device_and_queue_t *dq;
   u32 cpu_index = os_get_cpu_number ();
 
@@ -668,7 +670,9 @@ dpdk_input_rss (vlib_main_t * vm,
   vec_foreach (dq, dm->devices_by_cpu[cpu_index])
     {
       xd = vec_elt_at_index(dm->devices, dq->device);
-      n_rx_packets += dpdk_device_input (dm, xd, node, cpu_index, dq->queue_id, 0);
+      n = dpdk_device_input (dm, xd, node, cpu_index, dq->queue_id, 0);
+      dq->n_rx_packets += n;
+      n_rx_packets += n;
     }
   /* *INDENT-ON* */
 
@@ -683,7 +687,7 @@ dpdk_input_efd (vlib_main_t * vm,
 {
   dpdk_main_t *dm = &dpdk_main;
   dpdk_device_t *xd;
-  uword n_rx_packets = 0;
+  uword n_rx_packets = 0, n;
   dpdk_device_and_queue_t *dq;
   u32 cpu_index = os_get_cpu_number ();
 
@@ -694,7 +698,9 @@ dpdk_input_efd (vlib_main_t * vm,
   vec_foreach (dq, dm->devices_by_cpu[cpu_index])
     {
       xd = vec_elt_at_index(dm->devices, dq->device);
-      n_rx_packets += dpdk_device_input (dm, xd, node, cpu_index, dq->queue_id, 1);
+      n = dpdk_device_input (dm, xd, node, cpu_index, dq->queue_id, 1);
+      dq->n_rx_packets += n;
+      n_rx_packets += n;
     }
   /* *INDENT-ON* */
 
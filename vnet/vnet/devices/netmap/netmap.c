@@ -25,6 +25,7 @@
 #include <vlib/vlib.h>
 #include <vlib/unix/unix.h>
 #include <vnet/ethernet/ethernet.h>
+#include <vnet/devices/rx_balance.h>
 #include <vnet/devices/netmap/netmap.h>
 
 static u32
@@ -183,6 +184,9 @@ netmap_create_if (vlib_main_t * vm, u8 * if_name, u8 * hw_addr_set,
   nif->last_tx_ring = 0;
   nif->host_if_name = if_name;
   nif->per_interface_next_index = ~0;
+  nif->input_cpu_index = nm->input_cpu_first_index +
+    nif->if_index % nm->input_cpu_count;
+  nif->n_rx_packets = 0;
 
   if (tm->n_vlib_mains > 1)
     {
@@ -274,6 +278,54 @@ netmap_delete_if (vlib_main_t * vm, u8 * host_if_name)
   return 0;
 }
 
+static void
+netmap_rx_balance_get_queues (vnet_rx_balance_queue_t ** queues)
+{
+  netmap_main_t *nm = &netmap_main;
+  vnet_rx_balance_queue_t *q;
+  netmap_if_t *nif;
+
+  /* *INDENT-OFF* */
+  pool_foreach (nif, nm->interfaces,
+  ({
+    vec_add2 (*queues, q, 1);
+    q->hw_if_index = nif->hw_if_index;
+    q->queue_id = 0;
+    q->cpu_index = nif->input_cpu_index;
+    q->n_rx_packets = nif->n_rx_packets;
+  }));
+  /* *INDENT-ON* */
+}
+
+/* every worker polls netmap-input, so a move only changes the owner */
+static clib_error_t *
+netmap_rx_balance_move_queue (u32 hw_if_index, u32 queue_id, u32 cpu_index)
+{
+  netmap_main_t *nm = &netmap_main;
+  vnet_main_t *vnm = vnet_get_main ();
+  vnet_hw_interface_t *hw;
+  netmap_if_t *nif;
+
+  hw = vnet_get_hw_interface (vnm, hw_if_index);
+  if (hw->dev_class_index != netmap_device_class.index || queue_id != 0)
+    return clib_error_return (0, "no such netmap queue");
+
+  if (cpu_index < nm->input_cpu_first_index
+      || cpu_index >= nm->input_cpu_first_index + nm->input_cpu_count)
+    return clib_error_return (0, "thread %d does not poll netmap",
+			      cpu_index);
+
+  nif = pool_elt_at_index (nm->interfaces, hw->dev_instance);
+  nif->input_cpu_index = cpu_index;
+  return 0;
+}
+
+static vnet_rx_balance_provider_t netmap_rx_balance_provider = {
+  .name = "netmap",
+  .get_queues = netmap_rx_balance_get_queues,
+  .move_queue = netmap_rx_balance_move_queue,
+};
+
 static clib_error_t *
 netmap_init (vlib_main_t * vm)
 {
@@ -297,6 +349,10 @@ netmap_init (vlib_main_t * vm)
       nm->input_cpu_count = tr->count;
     }
 
+  netmap_rx_balance_provider.first_cpu_index = nm->input_cpu_first_index;
+  netmap_rx_balance_provider.n_cpus = nm->input_cpu_count;
+  vnet_rx_balance_register_provider (&netmap_rx_balance_provider);
+
   mhash_init_vec_string (&nm->if_index_by_host_if_name, sizeof (uword));
 
   vec_validate_aligned (nm->rx_buffers, tm->n_vlib_mains - 1,
@@ -63,6 +63,9 @@ typedef struct
   u16 first_rx_ring;
   u16 last_rx_ring;
 
+  /* worker polling the interface, and packets received so far */
+  u32 input_cpu_index;
+  u64 n_rx_packets;
 } netmap_if_t;
 
 typedef struct
@@ -264,6 +264,8 @@ netmap_device_input_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
      + VNET_INTERFACE_COUNTER_RX,
      os_get_cpu_number (), nif->hw_if_index, n_rx_packets, n_rx_bytes);
 
+  nif->n_rx_packets += n_rx_packets;
+
   return n_rx_packets;
 }
 
@@ -280,9 +282,7 @@ netmap_input_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
   for (i = 0; i < vec_len (nm->interfaces); i++)
     {
       nmi = vec_elt_at_index (nm->interfaces, i);
-      if (nmi->is_admin_up &&
-	  (i % nm->input_cpu_count) ==
-	  (cpu_index - nm->input_cpu_first_index))
+      if (nmi->is_admin_up && nmi->input_cpu_index == cpu_index)
 	n_rx_packets += netmap_device_input_fn (vm, node, frame, nmi);
     }
 
@@ -0,0 +1,624 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vnet/vnet.h>
+#include <vlib/threads.h>
+#include <vnet/devices/rx_balance.h>
+
+typedef struct
+{
+  /* Graph node clocks over elapsed clocks. Input nodes are left out:
+     a polling worker spends all its idle time in them. */
+  f64 utilization;
+  f64 vectors_per_call;
+  f64 clocks_per_packet;
+  f64 rx_pps;
+  u32 n_queues;
+
+  /* Totals as of the previous sample */
+  u64 last_clocks;
+  u64 last_input_calls;
+  u64 last_input_vectors;
+} rx_balance_worker_t;
+
+typedef struct
+{
+  vnet_rx_balance_queue_t q;
+  u32 provider_index;
+  f64 rx_pps;
+
+  /* Share of its worker's utilization, by packet rate */
+  f64 load;
+} rx_balance_queue_t;
+
+typedef struct
+{
+  vnet_rx_balance_provider_t **providers;
+
+  /* Configuration */
+  int enabled;
+  f64 interval;
+  f64 high_threshold;
+  f64 min_imbalance;
+  u32 hold_intervals;
+  u32 cooldown_intervals;
+
+  /* Last sample */
+  f64 last_sample_time;
+  rx_balance_worker_t *workers;
+  rx_balance_queue_t *queues;
+  vnet_rx_balance_queue_t *provider_queues;
+  uword *last_rx_packets_by_queue;
+  u32 n_samples;
+
+  /* Hysteresis: a worker must stay hot for hold_intervals samples
+     before a queue moves, and nothing moves for cooldown_intervals
+     samples after a move, while the stats settle. */
+  u32 hot_cpu_index;
+  u32 n_hot_intervals;
+  u32 cooldown;
+  u32 n_moves;
+
+  /* Recent decisions, oldest first */
+  u8 **decisions;
+} rx_balance_main_t;
+
+rx_balance_main_t rx_balance_main;
+
+#define RX_BALANCE_MAX_DECISIONS 32
+
+static vlib_node_registration_t rx_balance_process_node;
+
+void
+vnet_rx_balance_register_provider (vnet_rx_balance_provider_t * p)
+{
+  vec_add1 (rx_balance_main.providers, p);
+}
+
+always_inline uword
+rx_balance_queue_key (u32 hw_if_index, u32 queue_id)
+{
+  return ((u64) hw_if_index << 32) | queue_id;
+}
+
+static u8 *
+format_rx_balance_hw_if (u8 * s, va_list * args)
+{
+  vnet_main_t *vnm = va_arg (*args, vnet_main_t *);
+  u32 hw_if_index = va_arg (*args, u32);
+
+  if (pool_is_free_index (vnm->interface_main.hw_interfaces, hw_if_index))
+    return format (s, "hw_if_index %d", hw_if_index);
+  return format (s, "%v", vnet_get_hw_interface (vnm, hw_if_index)->name);
+}
+
+static void
+rx_balance_log (rx_balance_main_t * rbm, vlib_main_t * vm, char *fmt, ...)
+{
+  va_list va;
+  u8 *s;
+
+  s = format (0, "%10.3f: ", vlib_time_now (vm));
+  va_start (va, fmt);
+  s = va_format (s, fmt, &va);
+  va_end (va);
+
+  if (vec_len (rbm->decisions) >= RX_BALANCE_MAX_DECISIONS)
+    {
+      vec_free (rbm->decisions[0]);
+      vec_delete (rbm->decisions, 1, 0);
+    }
+  vec_add1 (rbm->decisions, s);
+}
+
+/* Is cpu_index one of the workers a provider may use */
+always_inline int
+rx_balance_provider_has_cpu (vnet_rx_balance_provider_t * p, u32 cpu_index)
+{
+  return cpu_index >= p->first_cpu_index
+    && cpu_index < p->first_cpu_index + p->n_cpus;
+}
+
+/*
+ * Take a sample of every thread's dispatch totals and every queue's
+ * packet counter, and turn the differences to the previous sample into
+ * rates. The counters are u64s written only by their thread, so they
+ * are read without the barrier; a sample may miss the last dispatch.
+ */
+static void
+rx_balance_sample (rx_balance_main_t * rbm, vlib_main_t * vm)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  rx_balance_worker_t *w;
+  rx_balance_queue_t *rq;
+  vnet_rx_balance_queue_t *q;
+  vlib_main_t *stat_vm;
+  u64 clocks, calls, vectors;
+  f64 now, dt;
+  uword *p;
+  u32 cpu, i;
+
+  vec_validate (rbm->workers, tm->n_vlib_mains - 1);
+  vec_reset_length (rbm->queues);
+
+  now = vlib_time_now (vm);
+  dt = now - rbm->last_sample_time;
+
+  for (cpu = 0; cpu < tm->n_vlib_mains; cpu++)
+    {
+      stat_vm = vlib_mains ? vlib_mains[cpu] : vm;
+      if (!stat_vm)
+	continue;
+
+      clocks = stat_vm->internal_node_clocks;
+      calls = stat_vm->input_node_calls;
+      vectors = stat_vm->input_node_vectors;
+
+      w = vec_elt_at_index (rbm->workers, cpu);
+      if (rbm->n_samples)
+	{
+	  w->utilization = (clocks - w->last_clocks)
+	    / (dt * vm->clib_time.clocks_per_second);
+	  w->vectors_per_call = calls > w->last_input_calls ?
+	    (f64) (vectors - w->last_input_vectors)
+	    / (calls - w->last_input_calls) : 0;
+	  w->clocks_per_packet = vectors > w->last_input_vectors ?
+	    (f64) (clocks - w->last_clocks)
+	    / (vectors - w->last_input_vectors) : 0;
+	}
+      w->last_clocks = clocks;
+      w->last_input_calls = calls;
+      w->last_input_vectors = vectors;
+      w->rx_pps = 0;
+      w->n_queues = 0;
+    }
+
+  for (i = 0; i < vec_len (rbm->providers); i++)
+    {
+      vec_reset_length (rbm->provider_queues);
+      rbm->providers[i]->get_queues (&rbm->provider_queues);
+      vec_foreach (q, rbm->provider_queues)
+      {
+	vec_add2 (rbm->queues, rq, 1);
+	rq->q = q[0];
+	rq->provider_index = i;
+	rq->rx_pps = 0;
+	rq->load = 0;
+      }
+    }
+
+  /* Queue rates; a queue seen for the first time has none yet */
+  vec_foreach (rq, rbm->queues)
+  {
+    uword key = rx_balance_queue_key (rq->q.hw_if_index, rq->q.queue_id);
+
+    p = hash_get (rbm->last_rx_packets_by_queue, key);
+    if (p && rbm->n_samples && rq->q.n_rx_packets >= p[0])
+      rq->rx_pps = (rq->q.n_rx_packets - p[0]) / dt;
+    hash_set (rbm->last_rx_packets_by_queue, key, rq->q.n_rx_packets);
+
+    if (rq->q.cpu_index < vec_len (rbm->workers))
+      {
+	w = vec_elt_at_index (rbm->workers, rq->q.cpu_index);
+	w->rx_pps += rq->rx_pps;
+	w->n_queues++;
+      }
+  }
+
+  vec_foreach (rq, rbm->queues)
+  {
+    if (rq->q.cpu_index >= vec_len (rbm->workers))
+      continue;
+    w = vec_elt_at_index (rbm->workers, rq->q.cpu_index);
+    if (w->rx_pps > 0)
+      rq->load = w->utilization * rq->rx_pps / w->rx_pps;
+  }
+
+  /* Forget queues which went away */
+  if (hash_elts (rbm->last_rx_packets_by_queue) > vec_len (rbm->queues))
+    {
+      uword *h = 0;
+
+      vec_foreach (rq, rbm->queues)
+	hash_set (h, rx_balance_queue_key (rq->q.hw_if_index,
+					   rq->q.queue_id),
+		  rq->q.n_rx_packets);
+      hash_free (rbm->last_rx_packets_by_queue);
+      rbm->last_rx_packets_by_queue = h;
+    }
+
+  rbm->last_sample_time = now;
+  rbm->n_samples++;
+}
+
+/* Least utilized worker a queue of this provider could move to */
+static u32
+rx_balance_coldest_cpu (rx_balance_main_t * rbm,
+			vnet_rx_balance_provider_t * p, u32 exclude)
+{
+  u32 cpu, best = ~0;
+
+  for (cpu = p->first_cpu_index; cpu < p->first_cpu_index + p->n_cpus;
+       cpu++)
+    {
+      if (cpu == exclude || cpu >= vec_len (rbm->workers))
+	continue;
+      if (best == ~0
+	  || rbm->workers[cpu].utilization < rbm->workers[best].utilization)
+	best = cpu;
+    }
+  return best;
+}
+
+/*
+ * Find the hottest worker. If it has been above the high threshold and
+ * ahead of the coldest worker by the imbalance margin for
+ * hold_intervals samples, move the single queue which leaves the two
+ * workers most evenly loaded, assuming the queue costs the same on
+ * either. The move must lower the busier worker's load by at least half
+ * the imbalance margin, so that queues do not bounce back and forth.
+ */
+static void
+rx_balance_decide (rx_balance_main_t * rbm, vlib_main_t * vm)
+{
+  vnet_main_t *vnm = vnet_get_main ();
+  vnet_rx_balance_provider_t *p;
+  rx_balance_worker_t *hot, *cold, *to;
+  rx_balance_queue_t *rq, *best = 0, *largest = 0;
+  u32 cpu, hot_cpu = ~0, cold_cpu = ~0, best_cpu = ~0;
+  f64 new_max, best_max = 0;
+  clib_error_t *error;
+  int i, is_balanced_cpu;
+
+  /* Only workers some provider may place queues on take part */
+  for (cpu = 0; cpu < vec_len (rbm->workers); cpu++)
+    {
+      is_balanced_cpu = 0;
+      for (i = 0; i < vec_len (rbm->providers); i++)
+	if (rbm->providers[i]->n_cpus > 1
+	    && rx_balance_provider_has_cpu (rbm->providers[i], cpu))
+	  is_balanced_cpu = 1;
+      if (!is_balanced_cpu)
+	continue;
+      if (hot_cpu == ~0 || rbm->workers[cpu].utilization
+	  > rbm->workers[hot_cpu].utilization)
+	hot_cpu = cpu;
+      if (cold_cpu == ~0 || rbm->workers[cpu].utilization
+	  < rbm->workers[cold_cpu].utilization)
+	cold_cpu = cpu;
+    }
+
+  if (hot_cpu == ~0 || hot_cpu == cold_cpu)
+    return;
+
+  hot = rbm->workers + hot_cpu;
+  cold = rbm->workers + cold_cpu;
+
+  if (hot->utilization < rbm->high_threshold
+      || hot->utilization - cold->utilization < rbm->min_imbalance)
+    {
+      if (rbm->n_hot_intervals)
+	rx_balance_log (rbm, vm, "thread %d back to %.0f%%, "
+			"thread %d at %.0f%%: balanced", hot_cpu,
+			hot->utilization * 100, cold_cpu,
+			cold->utilization * 100);
+      rbm->n_hot_intervals = 0;
+      if (rbm->cooldown)
+	rbm->cooldown--;
+      return;
+    }
+
+  if (hot_cpu != rbm->hot_cpu_index)
+    rbm->n_hot_intervals = 0;
+  rbm->hot_cpu_index = hot_cpu;
+
+  if (rbm->n_hot_intervals++ == 0)
+    rx_balance_log (rbm, vm, "thread %d hot at %.0f%% "
+		    "(%.1f vectors/call), thread %d at %.0f%%",
+		    hot_cpu, hot->utilization * 100, hot->vectors_per_call,
+		    cold_cpu, cold->utilization * 100);
+
+  if (rbm->cooldown)
+    {
+      rbm->cooldown--;
+      return;
+    }
+
+  if (rbm->n_hot_intervals < rbm->hold_intervals)
+    return;
+
+  vec_foreach (rq, rbm->queues)
+  {
+    if (rq->q.cpu_index != hot_cpu)
+      continue;
+    if (!largest || rq->load > largest->load)
+      largest = rq;
+
+    p = rbm->providers[rq->provider_index];
+    cpu = rx_balance_coldest_cpu (rbm, p, hot_cpu);
+    if (cpu == ~0)
+      continue;
+    to = rbm->workers + cpu;
+
+    new_max = clib_max (hot->utilization - rq->load,
+			to->utilization + rq->load);
+    if (new_max > hot->utilization - rbm->min_imbalance / 2)
+      continue;
+    if (!best || new_max < best_max)
+      {
+	best = rq;
+	best_cpu = cpu;
+	best_max = new_max;
+      }
+  }
+
+  rbm->n_hot_intervals = 0;
+
+  if (!best)
+    {
+      if (largest)
+	rx_balance_log (rbm, vm, "thread %d: no single queue move helps, "
+			"largest is %U queue %d at %.0f%% (%.0f pps)",
+			hot_cpu, format_rx_balance_hw_if, vnm,
+			largest->q.hw_if_index, largest->q.queue_id,
+			largest->load * 100, largest->rx_pps);
+      else
+	rx_balance_log (rbm, vm, "thread %d: hot, but polls none of "
+			"our queues", hot_cpu);
+      return;
+    }
+
+  p = rbm->providers[best->provider_index];
+  to = rbm->workers + best_cpu;
+
+  vlib_worker_thread_barrier_sync (vm);
+  error = p->move_queue (best->q.hw_if_index, best->q.queue_id, best_cpu);
+  vlib_worker_thread_barrier_release (vm);
+
+  if (error)
+    {
+      rx_balance_log (rbm, vm, "moving %U queue %d to thread %d "
+		      "failed: %U", format_rx_balance_hw_if, vnm,
+		      best->q.hw_if_index, best->q.queue_id, best_cpu,
+		      format_clib_error, error);
+      clib_error_free (error);
+      return;
+    }
+
+  rx_balance_log (rbm, vm, "moved %U queue %d (%.0f%%, %.0f pps) "
+		  "from thread %d (%.0f%%) to thread %d (%.0f%%), "
+		  "expected max %.0f%%", format_rx_balance_hw_if, vnm,
+		  best->q.hw_if_index, best->q.queue_id, best->load * 100,
+		  best->rx_pps, hot_cpu, hot->utilization * 100, best_cpu,
+		  to->utilization * 100, best_max * 100);
+
+  /* Keep the sample consistent with the new placement */
+  hot->utilization -= best->load;
+  to->utilization += best->load;
+  best->q.cpu_index = best_cpu;
+
+  rbm->cooldown = rbm->cooldown_intervals;
+  rbm->n_moves++;
+}
+
+static uword
+rx_balance_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+		    vlib_frame_t * f)
+{
+  rx_balance_main_t *rbm = &rx_balance_main;
+
+  while (1)
+    {
+      if (rbm->enabled)
+	vlib_process_wait_for_event_or_clock (vm, rbm->interval);
+      else
+	vlib_process_wait_for_event (vm);
+
+      /* Configuration changed, or time for a sample */
+      vlib_process_get_events (vm, 0);
+
+      if (!rbm->enabled)
+	continue;
+
+      rx_balance_sample (rbm, vm);
+      if (rbm->n_samples > 1)
+	rx_balance_decide (rbm, vm);
+    }
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (rx_balance_process_node, static) = {
+  .function = rx_balance_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "rx-balance-process",
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+set_rx_balance_command_fn (vlib_main_t * vm,
+			   unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  rx_balance_main_t *rbm = &rx_balance_main;
+  int enabled = rbm->enabled;
+  f64 interval = rbm->interval;
+  u32 high = rbm->high_threshold * 100;
+  u32 imbalance = rbm->min_imbalance * 100;
+  u32 hold = rbm->hold_intervals;
+  u32 cooldown = rbm->cooldown_intervals;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "enable"))
+	enabled = 1;
+      else if (unformat (input, "disable"))
+	enabled = 0;
+      else if (unformat (input, "interval %f", &interval))
+	;
+      else if (unformat (input, "high %u", &high))
+	;
+      else if (unformat (input, "imbalance %u", &imbalance))
+	;
+      else if (unformat (input, "hold %u", &hold))
+	;
+      else if (unformat (input, "cooldown %u", &cooldown))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (interval < 0.1)
+    return clib_error_return (0, "interval must be at least 0.1 seconds");
+  if (high > 100 || imbalance > 100)
+    return clib_error_return (0, "high and imbalance are percentages");
+
+  if (enabled && !rbm->enabled)
+    {
+      /* Start over, the old totals are stale */
+      rbm->n_samples = 0;
+      rbm->n_hot_intervals = 0;
+      rbm->cooldown = 0;
+    }
+
+  rbm->enabled = enabled;
+  rbm->interval = interval;
+  rbm->high_threshold = high / 100.0;
+  rbm->min_imbalance = imbalance / 100.0;
+  rbm->hold_intervals = hold;
+  rbm->cooldown_intervals = cooldown;
+
+  vlib_process_signal_event (vm, rx_balance_process_node.index, 0, 0);
+  return 0;
+}
+
+/*?
+ * Configure the rx queue balancer. Every <em>interval</em> seconds it
+ * samples each worker's utilization, the share of time spent in graph
+ * nodes after input. When the busiest worker has been above
+ * <em>high</em> percent, and at least <em>imbalance</em> points ahead
+ * of the least busy one, for <em>hold</em> samples in a row, it moves
+ * the one rx queue that best evens them out. After a move it waits
+ * <em>cooldown</em> samples before considering another.
+ *
+ * @cliexpar
+ * @cliexcmd{set rx-balance enable interval 2 high 80 imbalance 25 hold 3 cooldown 5}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_rx_balance_command, static) = {
+  .path = "set rx-balance",
+  .short_help = "set rx-balance [enable|disable] [interval <sec>] "
+  "[high <pct>] [imbalance <pct>] [hold <n>] [cooldown <n>]",
+  .function = set_rx_balance_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+show_rx_balance_command_fn (vlib_main_t * vm,
+			    unformat_input_t * input,
+			    vlib_cli_command_t * cmd)
+{
+  rx_balance_main_t *rbm = &rx_balance_main;
+  vnet_main_t *vnm = vnet_get_main ();
+  rx_balance_worker_t *w;
+  rx_balance_queue_t *rq;
+  u32 cpu;
+  int i;
+
+  vlib_cli_output (vm, "rx-balance %s, interval %.1fs, high %.0f%%, "
+		   "imbalance %.0f%%, hold %d, cooldown %d, %d moves",
+		   rbm->enabled ? "enabled" : "disabled", rbm->interval,
+		   rbm->high_threshold * 100, rbm->min_imbalance * 100,
+		   rbm->hold_intervals, rbm->cooldown_intervals,
+		   rbm->n_moves);
+
+  for (i = 0; i < vec_len (rbm->providers); i++)
+    vlib_cli_output (vm, "  %s: threads %d - %d", rbm->providers[i]->name,
+		     rbm->providers[i]->first_cpu_index,
+		     rbm->providers[i]->first_cpu_index
+		     + rbm->providers[i]->n_cpus - 1);
+
+  if (rbm->n_samples < 2)
+    {
+      vlib_cli_output (vm, "No samples yet");
+      goto decisions;
+    }
+
+  vlib_cli_output (vm, "\n%-8s%=8s%=12s%=14s%=14s%=8s", "Thread", "Util",
+		   "Vec/Call", "Clocks/Pkt", "Rx pps", "Queues");
+  for (cpu = 0; cpu < vec_len (rbm->workers); cpu++)
+    {
+      w = rbm->workers + cpu;
+      vlib_cli_output (vm, "%-8d%=7.0f%%%=12.2f%=14.1f%=14.0f%=8d", cpu,
+		       w->utilization * 100, w->vectors_per_call,
+		       w->clocks_per_packet, w->rx_pps, w->n_queues);
+    }
+
+  vlib_cli_output (vm, "\n%-32s%=8s%=8s%=14s%=8s", "Interface", "Queue",
+		   "Thread", "Rx pps", "Load");
+  vec_foreach (rq, rbm->queues)
+    vlib_cli_output (vm, "%-32U%=8d%=8d%=14.0f%=7.0f%%",
+		     format_rx_balance_hw_if, vnm, rq->q.hw_if_index,
+		     rq->q.queue_id, rq->q.cpu_index, rq->rx_pps,
+		     rq->load * 100);
+
+decisions:
+  if (vec_len (rbm->decisions))
+    {
+      vlib_cli_output (vm, "\nRecent decisions:");
+      for (i = 0; i < vec_len (rbm->decisions); i++)
+	vlib_cli_output (vm, "  %v", rbm->decisions[i]);
+    }
+  return 0;
+}
+
+/*?
+ * Show the rx queue balancer's configuration, the last sample of
+ * worker and queue load, and its recent decisions with the numbers
+ * behind them.
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_rx_balance_command, static) = {
+  .path = "show rx-balance",
+  .short_help = "show rx-balance",
+  .function = show_rx_balance_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+rx_balance_init (vlib_main_t * vm)
+{
+  rx_balance_main_t *rbm = &rx_balance_main;
+
+  rbm->interval = 2.0;
+  rbm->high_threshold = 0.8;
+  rbm->min_imbalance = 0.25;
+  rbm->hold_intervals = 3;
+  rbm->cooldown_intervals = 5;
+  rbm->hot_cpu_index = ~0;
+
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (rx_balance_init);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
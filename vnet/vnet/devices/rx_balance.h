@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * rx_balance.h: move rx queues between workers based on measured load
+ *
+ * Drivers which poll rx queues on worker threads register a provider.
+ * The "rx-balance-process" samples the workers' node runtime stats and
+ * the providers' per queue packet counters, and when one worker stays
+ * hot while another has room, asks the provider to move a queue. Moves
+ * happen under the worker barrier, so no worker is inside an input node
+ * and packets simply wait in the ring for their new owner.
+ */
+
+#ifndef included_vnet_devices_rx_balance_h
+#define included_vnet_devices_rx_balance_h
+
+#include <vnet/vnet.h>
+
+typedef struct
+{
+  u32 hw_if_index;
+  u32 queue_id;
+
+  /* Worker polling the queue */
+  u32 cpu_index;
+
+  /* Packets received from the queue so far, never cleared */
+  u64 n_rx_packets;
+} vnet_rx_balance_queue_t;
+
+typedef struct
+{
+  char *name;
+
+  /* Workers which may poll this provider's queues */
+  u32 first_cpu_index;
+  u32 n_cpus;
+
+  /* Append every queue to *queues. Called from the main thread, without
+     the barrier; n_rx_packets may be read while the worker updates it. */
+  void (*get_queues) (vnet_rx_balance_queue_t ** queues);
+
+  /* Move a queue to another worker. Called with the barrier held. */
+  clib_error_t *(*move_queue) (u32 hw_if_index, u32 queue_id,
+			       u32 cpu_index);
+} vnet_rx_balance_provider_t;
+
+void vnet_rx_balance_register_provider (vnet_rx_balance_provider_t * p);
+
+#endif /* included_vnet_devices_rx_balance_h */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
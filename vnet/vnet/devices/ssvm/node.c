@@ -20,6 +20,7 @@ typedef struct
 {
   u32 next_index;
   u32 sw_if_index;
+  u16 queue_id;
 } ssvm_eth_input_trace_t;
 
 /* packet trace format function */
@@ -30,8 +31,8 @@ format_ssvm_eth_input_trace (u8 * s, va_list * args)
   CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
   ssvm_eth_input_trace_t *t = va_arg (*args, ssvm_eth_input_trace_t *);
 
-  s = format (s, "SSVM_ETH_INPUT: sw_if_index %d, next index %d",
-	      t->sw_if_index, t->next_index);
+  s = format (s, "SSVM_ETH_INPUT: sw_if_index %d, queue %d, next index %d",
+	      t->sw_if_index, t->queue_id, t->next_index);
   return s;
 }
 
@@ -64,110 +65,117 @@ typedef enum
   SSVM_ETH_INPUT_N_NEXT,
 } ssvm_eth_input_next_t;
 
-static inline uword
-ssvm_eth_device_input (ssvm_eth_main_t * em,
-		       ssvm_private_t * intfc, vlib_node_runtime_t * node)
+/*
+ * True when this dispatch may be the last before the node waits for a
+ * doorbell: it runs in interrupt mode already, or an empty poll now is
+ * the one which makes adaptive mode switch it there.
+ */
+static_always_inline int
+ssvm_eth_input_may_sleep (vlib_main_t * vm, vlib_node_runtime_t * node)
+{
+  vlib_node_t *n;
+
+  if (node->state == VLIB_NODE_STATE_INTERRUPT)
+    return 1;
+  if (!(node->flags & VLIB_NODE_FLAG_ADAPTIVE_MODE))
+    return 0;
+  n = vlib_get_node (vm, node->node_index);
+  return n->adaptive.n_empty_polls + 1 >= n->adaptive.empty_polls_threshold;
+}
+
+/*
+ * Copy up to a frame of packets out of one rx ring, then hand the
+ * elements back to the producer with a single head store.
+ */
+static_always_inline uword
+ssvm_eth_queue_input (vlib_main_t * vm, vlib_node_runtime_t * node,
+		      ssvm_eth_main_t * em, ssvm_private_t * intfc,
+		      ssvm_eth_queue_t * q, ssvm_eth_per_thread_t * pt)
 {
-  ssvm_shared_header_t *sh = intfc->sh;
-  vlib_main_t *vm = em->vlib_main;
-  unix_shared_memory_queue_t *q;
-  ssvm_eth_queue_elt_t *elt, *elts;
-  u32 elt_index;
-  u32 my_pid = intfc->my_pid;
-  int rx_queue_index;
-  u32 n_to_alloc = VLIB_FRAME_SIZE * 2;
-  u32 n_allocated, n_present_in_cache;
+  ssvm_eth_ring_t *r = q->rx_ring;
+  ssvm_eth_queue_elt_t *elt;
+  u32 head = r->head, mask = r->nelts - 1;
 #if DPDK > 0
   u32 next_index = VNET_DEVICE_INPUT_NEXT_ETHERNET_INPUT;
 #else
-  u32 next_index = 0;
+  u32 next_index = SSVM_ETH_INPUT_NEXT_ETHERNET_INPUT;
 #endif
   vlib_buffer_free_list_t *fl;
   u32 n_left_to_next, *to_next;
   u32 next0;
-  u32 n_buffers;
-  u32 n_available;
-  u32 bi0, saved_bi0;
+  u32 n_chunks, n_cached;
+  u32 bi0, first_bi0;
   vlib_buffer_t *b0, *prev;
-  u32 saved_cache_size = 0;
   ethernet_header_t *eh0;
   u16 type0;
-  u32 n_rx_bytes = 0, l3_offset0;
-  u32 cpu_index = os_get_cpu_number ();
-  u32 trace_cnt __attribute__ ((unused)) = vlib_get_trace_count (vm, node);
-  volatile u32 *lock;
-  u32 *elt_indices;
+  u32 n_rx_packets = 0, n_rx_bytes = 0, n_no_buffers = 0, l3_offset0;
   uword n_trace = vlib_get_trace_count (vm, node);
 
-  /* Either side down? buh-bye... */
-  if (pointer_to_uword (sh->opaque[MASTER_ADMIN_STATE_INDEX]) == 0 ||
-      pointer_to_uword (sh->opaque[SLAVE_ADMIN_STATE_INDEX]) == 0)
-    return 0;
-
-  if (intfc->i_am_master)
-    q = (unix_shared_memory_queue_t *) (sh->opaque[TO_MASTER_Q_INDEX]);
-  else
-    q = (unix_shared_memory_queue_t *) (sh->opaque[TO_SLAVE_Q_INDEX]);
-
-  /* Nothing to do? */
-  if (q->cursize == 0)
-    return 0;
-
-  fl = vlib_buffer_get_free_list (vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
-
-  vec_reset_length (intfc->rx_queue);
-
-  lock = (u32 *) q;
-  while (__sync_lock_test_and_set (lock, 1))
-    ;
-  while (q->cursize > 0)
+  /* Only look at the producer's cache line when we run dry */
+  if (head == q->rx_tail_cache)
     {
-      unix_shared_memory_queue_sub_raw (q, (u8 *) & elt_index);
-      ASSERT (elt_index < 2048);
-      vec_add1 (intfc->rx_queue, elt_index);
+      q->rx_tail_cache = r->tail;
+      if (head == q->rx_tail_cache)
+	{
+	  if (q->rx_doorbell_fd < 0 || r->doorbell_armed
+	      || !ssvm_eth_input_may_sleep (vm, node))
+	    return 0;
+
+	  /* Ask for the doorbell, then look again so none is lost */
+	  r->doorbell_armed = 1;
+	  CLIB_MEMORY_BARRIER ();
+	  q->rx_tail_cache = r->tail;
+	  if (head == q->rx_tail_cache)
+	    return 0;
+	}
+      CLIB_MEMORY_BARRIER ();
     }
-  CLIB_MEMORY_BARRIER ();
-  *lock = 0;
 
-  n_present_in_cache = vec_len (em->buffer_cache);
-
-  if (vec_len (em->buffer_cache) < vec_len (intfc->rx_queue) * 2)
+  n_cached = vec_len (pt->buffer_cache);
+  if (n_cached < VLIB_FRAME_SIZE)
     {
-      vec_validate (em->buffer_cache,
-		    n_to_alloc + vec_len (em->buffer_cache) - 1);
-      n_allocated =
-	vlib_buffer_alloc (vm, &em->buffer_cache[n_present_in_cache],
-			   n_to_alloc);
-
-      n_present_in_cache += n_allocated;
-      _vec_len (em->buffer_cache) = n_present_in_cache;
+      vec_validate (pt->buffer_cache, n_cached + 2 * VLIB_FRAME_SIZE - 1);
+      n_cached += vlib_buffer_alloc (vm, pt->buffer_cache + n_cached,
+				     2 * VLIB_FRAME_SIZE);
+      _vec_len (pt->buffer_cache) = n_cached;
     }
 
-  elts = (ssvm_eth_queue_elt_t *) (sh->opaque[CHUNK_POOL_INDEX]);
+  fl = vlib_buffer_get_free_list (vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
 
-  n_buffers = vec_len (intfc->rx_queue);
-  rx_queue_index = 0;
+  if (PREDICT_FALSE (intfc->per_interface_next_index != ~0))
+    next_index = intfc->per_interface_next_index;
 
-  while (n_buffers > 0)
+  while (head != q->rx_tail_cache && n_rx_packets < VLIB_FRAME_SIZE)
     {
       vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
 
-      while (n_buffers > 0 && n_left_to_next > 0)
+      while (head != q->rx_tail_cache && n_left_to_next > 0
+	     && n_rx_packets < VLIB_FRAME_SIZE)
 	{
-	  elt = elts + intfc->rx_queue[rx_queue_index];
+	  elt = r->elts + (head & mask);
+
+	  n_chunks = 1;
+	  while (r->elts[(head + n_chunks - 1) & mask].flags
+		 & SSVM_BUFFER_NEXT_PRESENT)
+	    n_chunks++;
+
+	  CLIB_PREFETCH (r->elts + ((head + n_chunks) & mask),
+			 2 * CLIB_CACHE_LINE_BYTES, LOAD);
 
-	  saved_cache_size = n_present_in_cache;
-	  if (PREDICT_FALSE (saved_cache_size == 0))
+	  if (PREDICT_FALSE (n_cached < n_chunks))
 	    {
-	      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
-	      goto out;
+	      head += n_chunks;
+	      n_no_buffers++;
+	      continue;
 	    }
-	  saved_bi0 = bi0 = em->buffer_cache[--n_present_in_cache];
-	  b0 = vlib_get_buffer (vm, bi0);
+
+	  first_bi0 = pt->buffer_cache[n_cached - 1];
 	  prev = 0;
 
 	  while (1)
 	    {
+	      bi0 = pt->buffer_cache[--n_cached];
+	      b0 = vlib_get_buffer (vm, bi0);
 	      vlib_buffer_init_for_free_list (b0, fl);
 
 	      b0->current_data = elt->current_data_hint;
@@ -179,55 +187,52 @@ ssvm_eth_device_input (ssvm_eth_main_t * em,
 			   b0->current_length);
 
 	      if (PREDICT_FALSE (prev != 0))
-		prev->next_buffer = bi0;
-
-	      if (PREDICT_FALSE (elt->flags & SSVM_BUFFER_NEXT_PRESENT))
 		{
-		  prev = b0;
-		  if (PREDICT_FALSE (n_present_in_cache == 0))
-		    {
-		      vlib_put_next_frame (vm, node, next_index,
-					   n_left_to_next);
-		      goto out;
-		    }
-		  bi0 = em->buffer_cache[--n_present_in_cache];
-		  b0 = vlib_get_buffer (vm, bi0);
+		  prev->next_buffer = bi0;
+		  prev->flags |= VLIB_BUFFER_NEXT_PRESENT;
 		}
-	      else
+
+	      head++;
+	      if (PREDICT_TRUE (!(elt->flags & SSVM_BUFFER_NEXT_PRESENT)))
 		break;
+	      prev = b0;
+	      elt = r->elts + (head & mask);
 	    }
 
-	  saved_cache_size = n_present_in_cache;
-
-	  to_next[0] = saved_bi0;
+	  to_next[0] = first_bi0;
 	  to_next++;
 	  n_left_to_next--;
+	  n_rx_packets++;
 
-	  b0 = vlib_get_buffer (vm, saved_bi0);
-	  eh0 = vlib_buffer_get_current (b0);
+	  b0 = vlib_get_buffer (vm, first_bi0);
+	  b0->flags |= VLIB_BUFFER_TOTAL_LENGTH_VALID;
+	  n_rx_bytes += b0->current_length
+	    + b0->total_length_not_including_first_buffer;
 
-	  type0 = clib_net_to_host_u16 (eh0->type);
+	  if (PREDICT_FALSE (intfc->per_interface_next_index != ~0))
+	    next0 = intfc->per_interface_next_index;
+	  else
+	    {
+	      eh0 = vlib_buffer_get_current (b0);
+	      type0 = clib_net_to_host_u16 (eh0->type);
 
-	  next0 = SSVM_ETH_INPUT_NEXT_ETHERNET_INPUT;
+	      next0 = SSVM_ETH_INPUT_NEXT_ETHERNET_INPUT;
 
-	  if (type0 == ETHERNET_TYPE_IP4)
-	    next0 = SSVM_ETH_INPUT_NEXT_IP4_INPUT;
-	  else if (type0 == ETHERNET_TYPE_IP6)
-	    next0 = SSVM_ETH_INPUT_NEXT_IP6_INPUT;
-	  else if (type0 == ETHERNET_TYPE_MPLS_UNICAST)
-	    next0 = SSVM_ETH_INPUT_NEXT_MPLS_INPUT;
+	      if (type0 == ETHERNET_TYPE_IP4)
+		next0 = SSVM_ETH_INPUT_NEXT_IP4_INPUT;
+	      else if (type0 == ETHERNET_TYPE_IP6)
+		next0 = SSVM_ETH_INPUT_NEXT_IP6_INPUT;
+	      else if (type0 == ETHERNET_TYPE_MPLS_UNICAST)
+		next0 = SSVM_ETH_INPUT_NEXT_MPLS_INPUT;
 
-	  l3_offset0 = ((next0 == SSVM_ETH_INPUT_NEXT_IP4_INPUT ||
-			 next0 == SSVM_ETH_INPUT_NEXT_IP6_INPUT ||
-			 next0 == SSVM_ETH_INPUT_NEXT_MPLS_INPUT) ?
-			sizeof (ethernet_header_t) : 0);
+	      l3_offset0 = ((next0 == SSVM_ETH_INPUT_NEXT_IP4_INPUT ||
+			     next0 == SSVM_ETH_INPUT_NEXT_IP6_INPUT ||
+			     next0 == SSVM_ETH_INPUT_NEXT_MPLS_INPUT) ?
+			    sizeof (ethernet_header_t) : 0);
 
-	  n_rx_bytes += b0->current_length
-	    + b0->total_length_not_including_first_buffer;
-
-	  b0->current_data += l3_offset0;
-	  b0->current_length -= l3_offset0;
-	  b0->flags = VLIB_BUFFER_TOTAL_LENGTH_VALID;
+	      b0->current_data += l3_offset0;
+	      b0->current_length -= l3_offset0;
+	    }
 
 	  vnet_buffer (b0)->sw_if_index[VLIB_RX] = intfc->vlib_hw_if_index;
 	  vnet_buffer (b0)->sw_if_index[VLIB_TX] = (u32) ~ 0;
@@ -250,61 +255,58 @@ ssvm_eth_device_input (ssvm_eth_main_t * em,
 
 	      tr->next_index = next0;
 	      tr->sw_if_index = intfc->vlib_hw_if_index;
+	      tr->queue_id = q - em->queues[intfc - em->intfcs];
 	    }
 
 	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
 					   to_next, n_left_to_next,
-					   bi0, next0);
-	  n_buffers--;
-	  rx_queue_index++;
+					   first_bi0, next0);
 	}
 
       vlib_put_next_frame (vm, node, next_index, n_left_to_next);
     }
 
-out:
-  if (em->buffer_cache)
-    _vec_len (em->buffer_cache) = saved_cache_size;
-  else
-    ASSERT (saved_cache_size == 0);
-
-  ssvm_lock (sh, my_pid, 2);
-
-  ASSERT (vec_len (intfc->rx_queue) > 0);
-
-  n_available = (u32) pointer_to_uword (sh->opaque[CHUNK_POOL_NFREE]);
-  elt_indices = (u32 *) (sh->opaque[CHUNK_POOL_FREELIST_INDEX]);
-
-  clib_memcpy (&elt_indices[n_available], intfc->rx_queue,
-	       vec_len (intfc->rx_queue) * sizeof (u32));
-
-  n_available += vec_len (intfc->rx_queue);
-  sh->opaque[CHUNK_POOL_NFREE] = uword_to_pointer (n_available, void *);
+  _vec_len (pt->buffer_cache) = n_cached;
 
-  ssvm_unlock (sh);
+  /* Hand the elements back to the producer, one store per pass */
+  CLIB_MEMORY_BARRIER ();
+  r->head = head;
 
-  vlib_error_count (vm, node->node_index, SSVM_ETH_INPUT_ERROR_NO_BUFFERS,
-		    n_buffers);
+  if (PREDICT_FALSE (n_no_buffers))
+    vlib_error_count (vm, node->node_index, SSVM_ETH_INPUT_ERROR_NO_BUFFERS,
+		      n_no_buffers);
 
+  q->n_rx_packets += n_rx_packets;
   vlib_increment_combined_counter
     (vnet_get_main ()->interface_main.combined_sw_if_counters
-     + VNET_INTERFACE_COUNTER_RX, cpu_index,
-     intfc->vlib_hw_if_index, rx_queue_index, n_rx_bytes);
+     + VNET_INTERFACE_COUNTER_RX, vm->cpu_index,
+     intfc->vlib_hw_if_index, n_rx_packets, n_rx_bytes);
 
-  return rx_queue_index;
+  return n_rx_packets;
 }
 
+/*
+ * No admin state check here: the producer drops while either side is
+ * down, so those rings drain and stay empty, and an idle ring still
+ * gets to arm its doorbell.
+ */
 static uword
 ssvm_eth_input_node_fn (vlib_main_t * vm,
 			vlib_node_runtime_t * node, vlib_frame_t * frame)
 {
   ssvm_eth_main_t *em = &ssvm_eth_main;
+  ssvm_eth_per_thread_t *pt = vec_elt_at_index (em->threads, vm->cpu_index);
   ssvm_private_t *intfc;
+  ssvm_eth_queue_t *q;
   uword n_rx_packets = 0;
 
   vec_foreach (intfc, em->intfcs)
   {
-    n_rx_packets += ssvm_eth_device_input (em, intfc, node);
+    vec_foreach (q, em->queues[intfc - em->intfcs])
+    {
+      if (q->input_cpu_index == vm->cpu_index)
+	n_rx_packets += ssvm_eth_queue_input (vm, node, em, intfc, q, pt);
+    }
   }
 
   return n_rx_packets;
@@ -337,6 +339,49 @@ VLIB_REGISTER_NODE (ssvm_eth_input_node) = {
 VLIB_NODE_FUNCTION_MULTIARCH (ssvm_eth_input_node, ssvm_eth_input_node_fn)
 /* *INDENT-ON* */
 
+/*
+ * "test ssvm-eth" redirects rx here: take the round trip time of each
+ * benchmark frame and free it.
+ */
+static uword
+ssvm_eth_bench_sink_node_fn (vlib_main_t * vm,
+			     vlib_node_runtime_t * node, vlib_frame_t * frame)
+{
+  ssvm_eth_per_thread_t *pt = vec_elt_at_index (ssvm_eth_main.threads,
+						vm->cpu_index);
+  u32 *from = vlib_frame_vector_args (frame);
+  u32 n_left = frame->n_vectors;
+  u64 now = clib_cpu_time_now ();
+
+  while (n_left > 0)
+    {
+      vlib_buffer_t *b0 = vlib_get_buffer (vm, from[0]);
+      ssvm_eth_bench_header_t *h0 = vlib_buffer_get_current (b0);
+      u64 dt = now > h0->timestamp ? now - h0->timestamp : 0;
+
+      pt->bench_latency_clocks += dt;
+      pt->bench_latency_min = clib_min (pt->bench_latency_min, dt);
+      pt->bench_latency_max = clib_max (pt->bench_latency_max, dt);
+      vlib_node_adaptive_histogram_add (vm, pt->bench_latency_histogram, dt);
+
+      from++;
+      n_left--;
+    }
+
+  pt->bench_rx_packets += frame->n_vectors;
+  vlib_buffer_free (vm, vlib_frame_vector_args (frame), frame->n_vectors);
+  return frame->n_vectors;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (ssvm_eth_bench_sink_node) = {
+  .function = ssvm_eth_bench_sink_node_fn,
+  .name = "ssvm-eth-bench-sink",
+  .vector_size = sizeof (u32),
+  .type = VLIB_NODE_TYPE_INTERNAL,
+};
+/* *INDENT-ON* */
+
 
 /*
  * fd.io coding-style-patch-verification: ON
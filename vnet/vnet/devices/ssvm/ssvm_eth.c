@@ -12,13 +12,16 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 #include "ssvm_eth.h"
 
 ssvm_eth_main_t ssvm_eth_main;
 
 #define foreach_ssvm_eth_tx_func_error          \
 _(RING_FULL, "Tx packet drops (ring full)")     \
-_(NO_BUFFERS, "Tx packet drops (no buffers)")   \
 _(ADMIN_DOWN, "Tx packet drops (admin down)")
 
 typedef enum
@@ -32,78 +35,340 @@ typedef enum
 static u32 ssvm_eth_flag_change (vnet_main_t * vnm,
 				 vnet_hw_interface_t * hi, u32 flags);
 
+/*
+ * Doorbells. The master makes one eventfd per ring and hands them to
+ * the slave over a unix socket next to the segment. Each side watches
+ * the eventfds of its rx rings from the main thread's epoll. Their
+ * unix files carry the interface index in the upper and the queue id
+ * in the lower 32 bits of private_data.
+ */
+static clib_error_t *
+ssvm_eth_doorbell_read (unix_file_t * uf)
+{
+  ssvm_eth_main_t *em = &ssvm_eth_main;
+  u32 intfc_index = uf->private_data >> 32;
+  u32 qid = uf->private_data & 0xffffffff;
+  ssvm_eth_queue_t *q = vec_elt_at_index (em->queues[intfc_index], qid);
+  u64 value;
+
+  /* Non-blocking, resets the count */
+  if (read (uf->file_descriptor, &value, sizeof (value)) < 0)
+    ;
+  q->n_rx_doorbells++;
+
+  if (q->input_cpu_index == 0)
+    vlib_node_set_interrupt_pending (em->vlib_main,
+				     ssvm_eth_input_node.index);
+  else
+    vlib_worker_thread_idle_wakeup (q->input_cpu_index);
+  return 0;
+}
+
+static clib_error_t *
+ssvm_eth_doorbell_accept (unix_file_t * uf)
+{
+  ssvm_eth_main_t *em = &ssvm_eth_main;
+  ssvm_eth_queue_t *q, *queues = em->queues[uf->private_data];
+  int fds[2 * SSVM_ETH_MAX_QUEUES];
+  char ctl[CMSG_SPACE (sizeof (fds))];
+  clib_error_t *error = 0;
+  struct msghdr mh;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  u32 n_fds = 0;
+  int fd;
+
+  fd = accept (uf->file_descriptor, 0, 0);
+  if (fd < 0)
+    return clib_error_return_unix (0, "accept");
+
+  /* In ring order, see ssvm_eth_get_ring */
+  vec_foreach (q, queues)
+  {
+    fds[n_fds++] = q->rx_doorbell_fd;
+    fds[n_fds++] = q->tx_doorbell_fd;
+  }
+
+  memset (&mh, 0, sizeof (mh));
+  memset (ctl, 0, sizeof (ctl));
+  iov.iov_base = &n_fds;
+  iov.iov_len = sizeof (n_fds);
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = ctl;
+  mh.msg_controllen = CMSG_SPACE (n_fds * sizeof (int));
+  cmsg = CMSG_FIRSTHDR (&mh);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (n_fds * sizeof (int));
+  clib_memcpy (CMSG_DATA (cmsg), fds, n_fds * sizeof (int));
+
+  if (sendmsg (fd, &mh, 0) < 0)
+    error = clib_error_return_unix (0, "sendmsg");
+  close (fd);
+  return error;
+}
+
+static int
+ssvm_eth_doorbell_listen (ssvm_eth_main_t * em, ssvm_private_t * intfc)
+{
+  unix_file_t template = { 0 };
+  struct sockaddr_un sun;
+  u8 *path;
+  int fd;
+
+  fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    {
+      clib_unix_warning ("doorbell socket");
+      return VNET_API_ERROR_SYSCALL_ERROR_1;
+    }
+
+  memset (&sun, 0, sizeof (sun));
+  sun.sun_family = AF_UNIX;
+  path = format (0, SSVM_ETH_DOORBELL_SOCKET_FORMAT, intfc->name, 0);
+  strncpy (sun.sun_path, (char *) path, sizeof (sun.sun_path) - 1);
+  unlink ((char *) path);
+  vec_free (path);
+
+  if (bind (fd, (struct sockaddr *) &sun, sizeof (sun)) < 0
+      || listen (fd, 1) < 0)
+    {
+      clib_unix_warning ("doorbell socket %s", sun.sun_path);
+      close (fd);
+      return VNET_API_ERROR_SYSCALL_ERROR_2;
+    }
+
+  template.read_function = ssvm_eth_doorbell_accept;
+  template.file_descriptor = fd;
+  template.private_data = intfc - em->intfcs;
+  unix_file_add (&unix_main, &template);
+  return 0;
+}
+
+static int
+ssvm_eth_doorbell_connect (ssvm_private_t * intfc, int *fds, u32 n_fds)
+{
+  char ctl[CMSG_SPACE (2 * SSVM_ETH_MAX_QUEUES * sizeof (int))];
+  struct timeval tv = {.tv_sec = 20 };
+  struct sockaddr_un sun;
+  struct msghdr mh;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  u32 n_sent;
+  u8 *path;
+  int fd, rv = 0;
+
+  fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    {
+      clib_unix_warning ("doorbell socket");
+      return VNET_API_ERROR_SYSCALL_ERROR_1;
+    }
+
+  memset (&sun, 0, sizeof (sun));
+  sun.sun_family = AF_UNIX;
+  path = format (0, SSVM_ETH_DOORBELL_SOCKET_FORMAT, intfc->name, 0);
+  strncpy (sun.sun_path, (char *) path, sizeof (sun.sun_path) - 1);
+  vec_free (path);
+
+  /* The master answers from its main loop, give it time to get there */
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+
+  if (connect (fd, (struct sockaddr *) &sun, sizeof (sun)) < 0)
+    {
+      clib_unix_warning ("doorbell connect %s", sun.sun_path);
+      close (fd);
+      return VNET_API_ERROR_SYSCALL_ERROR_3;
+    }
+
+  memset (&mh, 0, sizeof (mh));
+  iov.iov_base = &n_sent;
+  iov.iov_len = sizeof (n_sent);
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = ctl;
+  mh.msg_controllen = sizeof (ctl);
+
+  if (recvmsg (fd, &mh, MSG_CMSG_CLOEXEC) < 0)
+    {
+      clib_unix_warning ("doorbell recvmsg %s", sun.sun_path);
+      close (fd);
+      return VNET_API_ERROR_SYSCALL_ERROR_4;
+    }
+  close (fd);
+
+  cmsg = CMSG_FIRSTHDR (&mh);
+  if (cmsg == 0 || cmsg->cmsg_level != SOL_SOCKET
+      || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+      clib_warning ("no doorbells from master of '%s'", intfc->name);
+      return VNET_API_ERROR_SYSCALL_ERROR_5;
+    }
+
+  if (n_sent != n_fds || cmsg->cmsg_len != CMSG_LEN (n_fds * sizeof (int)))
+    {
+      int i, n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+      clib_warning ("got %d doorbells from master of '%s', expected %d",
+		    n, intfc->name, n_fds);
+      clib_memcpy (fds, CMSG_DATA (cmsg), n * sizeof (int));
+      for (i = 0; i < n; i++)
+	close (fds[i]);
+      rv = VNET_API_ERROR_SYSCALL_ERROR_5;
+    }
+  else
+    clib_memcpy (fds, CMSG_DATA (cmsg), n_fds * sizeof (int));
+
+  return rv;
+}
+
 int
 ssvm_eth_create (ssvm_eth_main_t * em, u8 * name, int is_master)
 {
+  vlib_thread_main_t *vtm = vlib_get_thread_main ();
   ssvm_private_t *intfc;
   void *oldheap;
   clib_error_t *e;
-  unix_shared_memory_queue_t *q;
   ssvm_shared_header_t *sh;
-  ssvm_eth_queue_elt_t *elts;
-  u32 *elt_indices;
+  ssvm_eth_ring_t *rings, *r;
+  ssvm_eth_queue_t *queues = 0, *q;
+  int fds[2 * SSVM_ETH_MAX_QUEUES];
+  u32 intfc_index, n_queues, qid;
+  u64 size;
   u8 enet_addr[6];
-  int i, rv;
+  int i, rv, doorbells;
 
   vec_add2 (em->intfcs, intfc, 1);
+  intfc_index = intfc - em->intfcs;
 
   intfc->ssvm_size = em->segment_size;
   intfc->i_am_master = 1;
   intfc->name = name;
   intfc->my_pid = getpid ();
+  intfc->per_interface_next_index = ~0;
   if (is_master == 0)
     {
       rv = ssvm_slave_init (intfc, 20 /* timeout in seconds */ );
       if (rv < 0)
 	return rv;
+      sh = intfc->sh;
+      n_queues = pointer_to_uword (sh->opaque[N_QUEUES_INDEX]);
+      rings = (ssvm_eth_ring_t *) sh->opaque[RINGS_INDEX];
+      /* Don't trust the segment further than our fd and queue arrays */
+      if (n_queues == 0 || n_queues > SSVM_ETH_MAX_QUEUES
+	  || vec_len (rings) != 2 * n_queues)
+	{
+	  clib_warning ("bad queue count %d from master of '%s'",
+			n_queues, name);
+	  return VNET_API_ERROR_INVALID_VALUE;
+	}
+      doorbells = sh->opaque[DOORBELLS_INDEX] != 0;
+      if (doorbells
+	  && (rv = ssvm_eth_doorbell_connect (intfc, fds, 2 * n_queues)) < 0)
+	return rv;
       goto create_vnet_interface;
     }
 
+  n_queues = em->n_queues ? em->n_queues :
+    clib_min (em->input_cpu_count, SSVM_ETH_MAX_QUEUES);
+  doorbells = em->use_doorbells;
+
+  /* Make room for the rings, with slack for the heap itself */
+  size = 2 * n_queues * (sizeof (ssvm_eth_ring_t) + CLIB_CACHE_LINE_BYTES
+			 + em->queue_elts * sizeof (ssvm_eth_queue_elt_t));
+  size += 1 << 20;
+  if (intfc->ssvm_size < size)
+    intfc->ssvm_size = 1ULL << max_log2 (size);
+
   intfc->requested_va = em->next_base_va;
-  em->next_base_va += em->segment_size;
-  rv = ssvm_master_init (intfc, intfc - em->intfcs /* master index */ );
+  em->next_base_va += intfc->ssvm_size;
+  rv = ssvm_master_init (intfc, intfc_index /* master index */ );
 
   if (rv < 0)
     return rv;
 
-  /* OK, segment created, set up queues and so forth.  */
+  /* OK, segment created, set up the rings */
 
   sh = intfc->sh;
   oldheap = ssvm_push_heap (sh);
 
-  q = unix_shared_memory_queue_init (em->queue_elts, sizeof (u32),
-				     0 /* consumer pid not interesting */ ,
-				     0 /* signal not sent */ );
-  sh->opaque[TO_MASTER_Q_INDEX] = (void *) q;
-  q = unix_shared_memory_queue_init (em->queue_elts, sizeof (u32),
-				     0 /* consumer pid not interesting */ ,
-				     0 /* signal not sent */ );
-  sh->opaque[TO_SLAVE_Q_INDEX] = (void *) q;
-
-  /*
-   * Preallocate the requested number of buffer chunks
-   * There must be a better way to do this, etc.
-   * Add some slop to avoid pool reallocation, which will not go well
-   */
-  elts = 0;
-  elt_indices = 0;
+  rings = 0;
+  vec_validate_aligned (rings, 2 * n_queues - 1, CLIB_CACHE_LINE_BYTES);
+  vec_foreach (r, rings)
+  {
+    r->nelts = em->queue_elts;
+    vec_validate_aligned (r->elts, r->nelts - 1, CLIB_CACHE_LINE_BYTES);
+  }
 
-  vec_validate_aligned (elts, em->nbuffers - 1, CLIB_CACHE_LINE_BYTES);
-  vec_validate_aligned (elt_indices, em->nbuffers - 1, CLIB_CACHE_LINE_BYTES);
-
-  for (i = 0; i < em->nbuffers; i++)
-    elt_indices[i] = i;
+  ssvm_pop_heap (oldheap);
 
-  sh->opaque[CHUNK_POOL_INDEX] = (void *) elts;
-  sh->opaque[CHUNK_POOL_FREELIST_INDEX] = (void *) elt_indices;
-  sh->opaque[CHUNK_POOL_NFREE] = (void *) (uword) em->nbuffers;
+  sh->opaque[RINGS_INDEX] = (void *) rings;
+  sh->opaque[N_QUEUES_INDEX] = uword_to_pointer (n_queues, void *);
+  sh->opaque[DOORBELLS_INDEX] = uword_to_pointer (doorbells, void *);
 
-  ssvm_pop_heap (oldheap);
+  if (doorbells)
+    {
+      for (i = 0; i < 2 * n_queues; i++)
+	{
+	  fds[i] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	  if (fds[i] < 0)
+	    {
+	      clib_unix_warning ("eventfd");
+	      while (--i >= 0)
+		close (fds[i]);
+	      return VNET_API_ERROR_SYSCALL_ERROR_1;
+	    }
+	}
+      if ((rv = ssvm_eth_doorbell_listen (em, intfc)) < 0)
+	{
+	  for (i = 0; i < 2 * n_queues; i++)
+	    close (fds[i]);
+	  return rv;
+	}
+    }
 
 create_vnet_interface:
 
   sh = intfc->sh;
 
+  vec_validate_aligned (queues, n_queues - 1, CLIB_CACHE_LINE_BYTES);
+  for (qid = 0; qid < n_queues; qid++)
+    {
+      q = queues + qid;
+      q->tx_ring = ssvm_eth_get_ring (sh, qid, /* to_master */ !is_master);
+      q->rx_ring = ssvm_eth_get_ring (sh, qid, /* to_master */ is_master);
+      q->tx_head_cache = q->tx_ring->head;
+      q->rx_tail_cache = q->rx_ring->head;
+      q->input_cpu_index = em->input_cpu_first_index +
+	(intfc_index + qid) % em->input_cpu_count;
+      q->tx_doorbell_fd = q->rx_doorbell_fd = -1;
+      q->rx_unix_file_index = ~0;
+
+      /* tx from more threads than there are queues */
+      if (vtm->n_vlib_mains > n_queues)
+	{
+	  q->tx_lock = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
+					       CLIB_CACHE_LINE_BYTES);
+	  memset ((void *) q->tx_lock, 0, CLIB_CACHE_LINE_BYTES);
+	}
+
+      if (doorbells)
+	{
+	  unix_file_t template = { 0 };
+
+	  /* fds are in ring order, to master first */
+	  q->rx_doorbell_fd = fds[2 * qid + !is_master];
+	  q->tx_doorbell_fd = fds[2 * qid + is_master];
+
+	  template.read_function = ssvm_eth_doorbell_read;
+	  template.file_descriptor = q->rx_doorbell_fd;
+	  template.private_data = ((uword) intfc_index << 32) | qid;
+	  q->rx_unix_file_index = unix_file_add (&unix_main, &template);
+	}
+    }
+  vec_validate (em->queues, intfc_index);
+  em->queues[intfc_index] = queues;
+
   memset (enet_addr, 0, sizeof (enet_addr));
   enet_addr[0] = 2;
   enet_addr[1] = 0xFE;
@@ -111,7 +376,7 @@ create_vnet_interface:
   enet_addr[5] = sh->master_index;
 
   e = ethernet_register_interface
-    (em->vnet_main, ssvm_eth_device_class.index, intfc - em->intfcs,
+    (em->vnet_main, ssvm_eth_device_class.index, intfc_index,
      /* ethernet address */ enet_addr,
      &intfc->vlib_hw_if_index, ssvm_eth_flag_change);
 
@@ -132,12 +397,72 @@ create_vnet_interface:
   return 0;
 }
 
+/*
+ * Poll the rx rings on the threads they are mapped to. With doorbells,
+ * input goes adaptive: idle rings put the node in interrupt mode and
+ * the peer's doorbell brings it back. Workers only look at interrupt
+ * mode nodes after an idle sleep, so they go adaptive only when idle
+ * sleep is configured.
+ */
+static void
+ssvm_eth_set_input_node_state (vlib_main_t * vm)
+{
+  ssvm_eth_main_t *em = &ssvm_eth_main;
+  u32 node_index = ssvm_eth_input_node.index;
+  int i, doorbells = 0;
+
+  if (vec_len (em->intfcs) == 0)
+    return;
+
+  for (i = 0; i < vec_len (em->queues); i++)
+    doorbells |= em->queues[i][0].rx_doorbell_fd >= 0;
+
+  if (em->input_cpu_first_index == 0)
+    {
+      vlib_node_set_state (vm, node_index, VLIB_NODE_STATE_POLLING);
+      vlib_node_set_adaptive_mode (vm, node_index, doorbells, 0, 0);
+      return;
+    }
+
+  vlib_worker_thread_barrier_sync (vm);
+  vlib_node_set_state (vm, node_index, VLIB_NODE_STATE_DISABLED);
+  for (i = em->input_cpu_first_index;
+       i < em->input_cpu_first_index + em->input_cpu_count; i++)
+    {
+      vlib_node_set_state (vlib_mains[i], node_index,
+			   VLIB_NODE_STATE_POLLING);
+      vlib_node_set_adaptive_mode (vlib_mains[i], node_index,
+				   doorbells
+				   && vlib_worker_threads[i].idle_sleep_us,
+				   0, 0);
+    }
+  vlib_worker_thread_barrier_release (vm);
+}
+
+/* Runs once the worker threads, which clone node state, are up */
+static uword
+ssvm_eth_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+		  vlib_frame_t * f)
+{
+  ssvm_eth_set_input_node_state (vm);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (ssvm_eth_process_node, static) = {
+  .function = ssvm_eth_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "ssvm-eth-process",
+};
+/* *INDENT-ON* */
+
 static clib_error_t *
 ssvm_config (vlib_main_t * vm, unformat_input_t * input)
 {
   u8 *name;
   int is_master = 1;
   int i, rv;
+  u64 junk;
   ssvm_eth_main_t *em = &ssvm_eth_main;
 
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
@@ -146,9 +471,14 @@ ssvm_config (vlib_main_t * vm, unformat_input_t * input)
 	;
       else if (unformat (input, "segment-size %lld", &em->segment_size))
 	em->segment_size = 1ULL << (max_log2 (em->segment_size));
-      else if (unformat (input, "nbuffers %lld", &em->nbuffers))
-	;
       else if (unformat (input, "queue-elts %lld", &em->queue_elts))
+	em->queue_elts = 1ULL << (max_log2 (em->queue_elts));
+      else if (unformat (input, "queues %d", &em->n_queues))
+	;
+      else if (unformat (input, "doorbell"))
+	em->use_doorbells = 1;
+      /* chunks now live in the rings */
+      else if (unformat (input, "nbuffers %lld", &junk))
 	;
       else if (unformat (input, "slave"))
 	is_master = 0;
@@ -162,6 +492,12 @@ ssvm_config (vlib_main_t * vm, unformat_input_t * input)
   if (vec_len (em->names) == 0)
     return 0;
 
+  if (em->n_queues > SSVM_ETH_MAX_QUEUES)
+    return clib_error_return (0, "ssvm_eth: at most %d queues",
+			      SSVM_ETH_MAX_QUEUES);
+  if (em->queue_elts < 2)
+    return clib_error_return (0, "ssvm_eth: queue-elts too small");
+
   for (i = 0; i < vec_len (em->names); i++)
     {
       rv = ssvm_eth_create (em, em->names[i], is_master);
@@ -170,9 +506,6 @@ ssvm_config (vlib_main_t * vm, unformat_input_t * input)
 				  em->names[i], rv);
     }
 
-  vlib_node_set_state (vm, ssvm_eth_input_node.index,
-		       VLIB_NODE_STATE_POLLING);
-
   return 0;
 }
 
@@ -183,6 +516,9 @@ static clib_error_t *
 ssvm_eth_init (vlib_main_t * vm)
 {
   ssvm_eth_main_t *em = &ssvm_eth_main;
+  vlib_thread_main_t *vtm = vlib_get_thread_main ();
+  vlib_thread_registration_t *tr;
+  uword *p;
 
   if (((sizeof (ssvm_eth_queue_elt_t) / CLIB_CACHE_LINE_BYTES)
        * CLIB_CACHE_LINE_BYTES) != sizeof (ssvm_eth_queue_elt_t))
@@ -197,12 +533,25 @@ ssvm_eth_init (vlib_main_t * vm)
 
   em->next_base_va = 0x600000000ULL;
   /*
-   * Allocate 2 full superframes in each dir (256 x 2 x 2 x 2048 bytes),
-   * 2mb; double that so we have plenty of space... 4mb
+   * Room for the rings of a couple of queues, ssvm_eth_create grows
+   * the segment when more are configured.
    */
   em->segment_size = 8 << 20;
-  em->nbuffers = 1024;
   em->queue_elts = 512;
+
+  /* find out which cpus will be used for input */
+  em->input_cpu_first_index = 0;
+  em->input_cpu_count = 1;
+  p = hash_get_mem (vtm->thread_registrations_by_name, "workers");
+  tr = p ? (vlib_thread_registration_t *) p[0] : 0;
+  if (tr && tr->count > 0)
+    {
+      em->input_cpu_first_index = tr->first_index;
+      em->input_cpu_count = tr->count;
+    }
+
+  vec_validate_aligned (em->threads, vtm->n_vlib_mains - 1,
+			CLIB_CACHE_LINE_BYTES);
   return 0;
 }
 
@@ -226,7 +575,29 @@ format_ssvm_eth_device_name (u8 * s, va_list * args)
 static u8 *
 format_ssvm_eth_device (u8 * s, va_list * args)
 {
-  s = format (s, "SSVM Ethernet");
+  u32 i = va_arg (*args, u32);
+  CLIB_UNUSED (int verbose) = va_arg (*args, int);
+  ssvm_eth_main_t *em = &ssvm_eth_main;
+  ssvm_private_t *intfc = vec_elt_at_index (em->intfcs, i);
+  ssvm_eth_queue_t *q, *queues = em->queues[i];
+  uword indent = format_get_indent (s);
+
+  s = format (s, "SSVM Ethernet %s, %s, %d queue%s%s", intfc->name,
+	      intfc->i_am_master ? "master" : "slave", vec_len (queues),
+	      vec_len (queues) == 1 ? "" : "s",
+	      queues[0].rx_doorbell_fd >= 0 ? ", doorbells" : "");
+  vec_foreach (q, queues)
+  {
+    s = format (s, "\n%Uqueue %d: thread %d rx %llu tx %llu, "
+		"ring rx %u/%u tx %u/%u",
+		format_white_space, indent + 2, q - queues,
+		q->input_cpu_index, q->n_rx_packets, q->n_tx_packets,
+		q->rx_ring->tail - q->rx_ring->head, q->rx_ring->nelts,
+		q->tx_ring->tail - q->tx_ring->head, q->tx_ring->nelts);
+    if (q->rx_doorbell_fd >= 0)
+      s = format (s, ", doorbells rx %llu tx %llu", q->n_rx_doorbells,
+		  q->n_tx_doorbells);
+  }
   return s;
 }
 
@@ -237,7 +608,10 @@ format_ssvm_eth_tx_trace (u8 * s, va_list * args)
   return s;
 }
 
-
+/*
+ * Copy the frame into the queue's tx ring, one element per vlib buffer,
+ * and publish it with a single tail store.
+ */
 static uword
 ssvm_eth_interface_tx (vlib_main_t * vm,
 		       vlib_node_runtime_t * node, vlib_frame_t * f)
@@ -245,134 +619,118 @@ ssvm_eth_interface_tx (vlib_main_t * vm,
   ssvm_eth_main_t *em = &ssvm_eth_main;
   vnet_interface_output_runtime_t *rd = (void *) node->runtime_data;
   ssvm_private_t *intfc = vec_elt_at_index (em->intfcs, rd->dev_instance);
+  ssvm_eth_queue_t *queues = em->queues[rd->dev_instance];
+  ssvm_eth_queue_t *q;
   ssvm_shared_header_t *sh = intfc->sh;
-  unix_shared_memory_queue_t *q;
+  ssvm_eth_ring_t *r;
+  ssvm_eth_queue_elt_t *elt;
   u32 *from;
   u32 n_left;
-  ssvm_eth_queue_elt_t *elts, *elt, *prev_elt;
-  u32 my_pid = intfc->my_pid;
-  vlib_buffer_t *b0;
-  u32 bi0;
-  u32 size_this_buffer;
-  u32 chunks_this_buffer;
-  u8 i_am_master = intfc->i_am_master;
-  u32 elt_index;
-  int is_ring_full, interface_down;
-  int i;
-  volatile u32 *queue_lock;
-  u32 n_to_alloc = VLIB_FRAME_SIZE;
-  u32 n_allocated, n_present_in_cache, n_available;
-  u32 *elt_indices;
-
-  if (i_am_master)
-    q = (unix_shared_memory_queue_t *) sh->opaque[TO_SLAVE_Q_INDEX];
-  else
-    q = (unix_shared_memory_queue_t *) sh->opaque[TO_MASTER_Q_INDEX];
-
-  queue_lock = (u32 *) q;
+  vlib_buffer_t *b0, *b;
+  u32 n_chunks, tail, mask;
+  int is_ring_full;
 
   from = vlib_frame_vector_args (f);
   n_left = f->n_vectors;
   is_ring_full = 0;
-  interface_down = 0;
-
-  n_present_in_cache = vec_len (em->chunk_cache);
 
   /* admin / link up/down check */
   if (sh->opaque[MASTER_ADMIN_STATE_INDEX] == 0 ||
       sh->opaque[SLAVE_ADMIN_STATE_INDEX] == 0)
-    {
-      interface_down = 1;
-      goto out;
-    }
+    goto out;
 
-  ssvm_lock (sh, my_pid, 1);
+  q = vec_elt_at_index (queues, vm->cpu_index % vec_len (queues));
+  r = q->tx_ring;
 
-  elts = (ssvm_eth_queue_elt_t *) (sh->opaque[CHUNK_POOL_INDEX]);
-  elt_indices = (u32 *) (sh->opaque[CHUNK_POOL_FREELIST_INDEX]);
-  n_available = (u32) pointer_to_uword (sh->opaque[CHUNK_POOL_NFREE]);
+  if (q->tx_lock)
+    while (__sync_lock_test_and_set (q->tx_lock, 1))
+      ;
 
-  if (n_present_in_cache < n_left * 2)
-    {
-      vec_validate (em->chunk_cache, n_to_alloc + n_present_in_cache - 1);
-
-      n_allocated = n_to_alloc < n_available ? n_to_alloc : n_available;
-
-      if (PREDICT_TRUE (n_allocated > 0))
-	{
-	  clib_memcpy (&em->chunk_cache[n_present_in_cache],
-		       &elt_indices[n_available - n_allocated],
-		       sizeof (u32) * n_allocated);
-	}
-
-      n_present_in_cache += n_allocated;
-      n_available -= n_allocated;
-      sh->opaque[CHUNK_POOL_NFREE] = uword_to_pointer (n_available, void *);
-      _vec_len (em->chunk_cache) = n_present_in_cache;
-    }
-
-  ssvm_unlock (sh);
+  tail = r->tail;
+  mask = r->nelts - 1;
 
   while (n_left)
     {
-      bi0 = from[0];
-      b0 = vlib_get_buffer (vm, bi0);
+      if (PREDICT_TRUE (n_left > 2))
+	vlib_prefetch_buffer_with_index (vm, from[2], LOAD);
+      if (PREDICT_TRUE (n_left > 1))
+	{
+	  b = vlib_get_buffer (vm, from[1]);
+	  CLIB_PREFETCH (vlib_buffer_get_current (b), CLIB_CACHE_LINE_BYTES,
+			 LOAD);
+	}
 
-      size_this_buffer = vlib_buffer_length_in_chain (vm, b0);
-      chunks_this_buffer = (size_this_buffer + (SSVM_BUFFER_SIZE - 1))
-	/ SSVM_BUFFER_SIZE;
+      b0 = vlib_get_buffer (vm, from[0]);
+      n_chunks = 1;
+      for (b = b0; b->flags & VLIB_BUFFER_NEXT_PRESENT;
+	   b = vlib_get_buffer (vm, b->next_buffer))
+	n_chunks++;
 
       /* If we're not going to be able to enqueue the buffer, tail drop. */
-      if (q->cursize >= q->maxsize)
+      if (PREDICT_FALSE (tail - q->tx_head_cache + n_chunks > r->nelts))
 	{
-	  is_ring_full = 1;
-	  break;
+	  q->tx_head_cache = r->head;
+	  if (tail - q->tx_head_cache + n_chunks > r->nelts)
+	    {
+	      is_ring_full = 1;
+	      break;
+	    }
 	}
 
-      prev_elt = 0;
-      elt_index = ~0;
-      for (i = 0; i < chunks_this_buffer; i++)
+      b = b0;
+      while (1)
 	{
-	  if (PREDICT_FALSE (n_present_in_cache == 0))
-	    goto out;
-
-	  elt_index = em->chunk_cache[--n_present_in_cache];
-	  elt = elts + elt_index;
+	  elt = r->elts + (tail++ & mask);
 
 	  elt->type = SSVM_PACKET_TYPE;
 	  elt->flags = 0;
-	  elt->total_length_not_including_first_buffer =
-	    b0->total_length_not_including_first_buffer;
-	  elt->length_this_buffer = b0->current_length;
-	  elt->current_data_hint = b0->current_data;
-	  elt->owner = !i_am_master;
-	  elt->tag = 1;
+	  elt->current_data_hint = b->current_data;
+	  elt->length_this_buffer = b->current_length;
+	  elt->total_length_not_including_first_buffer = 0;
 
-	  clib_memcpy (elt->data, b0->data + b0->current_data,
-		       b0->current_length);
+	  clib_memcpy (elt->data, vlib_buffer_get_current (b),
+		       b->current_length);
 
-	  if (PREDICT_FALSE (prev_elt != 0))
-	    prev_elt->next_index = elt - elts;
+	  if (PREDICT_TRUE (!(b->flags & VLIB_BUFFER_NEXT_PRESENT)))
+	    break;
 
-	  if (PREDICT_FALSE (i < (chunks_this_buffer - 1)))
-	    {
-	      elt->flags = SSVM_BUFFER_NEXT_PRESENT;
-	      ASSERT (b0->flags & VLIB_BUFFER_NEXT_PRESENT);
-	      b0 = vlib_get_buffer (vm, b0->next_buffer);
-	    }
-	  prev_elt = elt;
+	  if (b == b0)
+	    elt->total_length_not_including_first_buffer =
+	      vlib_buffer_length_in_chain (vm, b0) - b0->current_length;
+	  elt->flags = SSVM_BUFFER_NEXT_PRESENT;
+	  b = vlib_get_buffer (vm, b->next_buffer);
 	}
 
-      while (__sync_lock_test_and_set (queue_lock, 1))
-	;
+      from++;
+      n_left--;
+    }
 
-      unix_shared_memory_queue_add_raw (q, (u8 *) & elt_index);
+  if (tail != r->tail)
+    {
+      /* chunk contents before the tail store */
       CLIB_MEMORY_BARRIER ();
-      *queue_lock = 0;
+      r->tail = tail;
 
-      from++;
-      n_left--;
+      if (q->tx_doorbell_fd >= 0)
+	{
+	  /* tail store before the doorbell_armed load, the consumer
+	     arms, then looks at tail again */
+	  CLIB_MEMORY_BARRIER ();
+	  if (PREDICT_FALSE (r->doorbell_armed))
+	    {
+	      u64 one = 1;
+
+	      r->doorbell_armed = 0;
+	      q->n_tx_doorbells++;
+	      if (write (q->tx_doorbell_fd, &one, sizeof (one)) < 0)
+		;
+	    }
+	}
     }
+  q->n_tx_packets += f->n_vectors - n_left;
+
+  if (q->tx_lock)
+    *q->tx_lock = 0;
 
 out:
   if (PREDICT_FALSE (n_left))
@@ -380,20 +738,13 @@ out:
       if (is_ring_full)
 	vlib_error_count (vm, node->node_index, SSVM_ETH_TX_ERROR_RING_FULL,
 			  n_left);
-      else if (interface_down)
-	vlib_error_count (vm, node->node_index, SSVM_ETH_TX_ERROR_ADMIN_DOWN,
-			  n_left);
       else
-	vlib_error_count (vm, node->node_index, SSVM_ETH_TX_ERROR_NO_BUFFERS,
+	vlib_error_count (vm, node->node_index, SSVM_ETH_TX_ERROR_ADMIN_DOWN,
 			  n_left);
-
-      vlib_buffer_free (vm, from, n_left);
     }
-  else
-    vlib_buffer_free (vm, vlib_frame_vector_args (f), f->n_vectors);
 
-  if (PREDICT_TRUE (vec_len (em->chunk_cache)))
-    _vec_len (em->chunk_cache) = n_present_in_cache;
+  /* Sent ones were copied, the rest are dropped */
+  vlib_buffer_free (vm, vlib_frame_vector_args (f), f->n_vectors);
 
   return f->n_vectors;
 }
@@ -443,7 +794,7 @@ ssvm_eth_set_interface_next_node (vnet_main_t * vnm, u32 hw_if_index,
 {
   ssvm_eth_main_t *em = &ssvm_eth_main;
   vnet_hw_interface_t *hw = vnet_get_hw_interface (vnm, hw_if_index);
-  ssvm_private_t *intfc = pool_elt_at_index (em->intfcs, hw->dev_instance);
+  ssvm_private_t *intfc = vec_elt_at_index (em->intfcs, hw->dev_instance);
 
   /* Shut off redirection */
   if (node_index == ~0)
@@ -483,6 +834,252 @@ VLIB_DEVICE_TX_FUNCTION_MULTIARCH (ssvm_eth_device_class,
 				   ssvm_eth_interface_tx)
 /* *INDENT-ON* */
 
+/*
+ * Two process benchmark. The peer reflects everything it receives back
+ * out of the same interface ("test ssvm-eth reflect"). This side sends
+ * timestamped frames and takes the round trip time of each one that
+ * comes back; both processes share the host's TSC.
+ */
+static clib_error_t *
+ssvm_eth_bench_command_fn (vlib_main_t * vm, unformat_input_t * input,
+			   vlib_cli_command_t * cmd)
+{
+  ssvm_eth_main_t *em = &ssvm_eth_main;
+  vnet_main_t *vnm = vnet_get_main ();
+  u32 sw_if_index = ~0, frame_size = 64, burst = 32;
+  u32 buffers[VLIB_FRAME_SIZE];
+  u64 histogram[VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS];
+  u64 n_tx = 0, n_rx = 0, clocks = 0, min = ~0ULL, max = 0, *tx0 = 0;
+  f64 duration = 1.0, t0, t1, us_per_clock;
+  vnet_hw_interface_t *hi;
+  ssvm_private_t *intfc;
+  ssvm_eth_queue_t *q, *queues;
+  ssvm_eth_per_thread_t *pt;
+  ssvm_eth_bench_header_t *h;
+  ip4_header_t *ip;
+  u8 *template = 0;
+  int i;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface, vnm,
+		    &sw_if_index))
+	;
+      else if (unformat (input, "size %d", &frame_size))
+	;
+      else if (unformat (input, "burst %d", &burst))
+	;
+      else if (unformat (input, "time %f", &duration))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "interface required");
+  hi = vnet_get_sup_hw_interface (vnm, sw_if_index);
+  if (hi->dev_class_index != ssvm_eth_device_class.index)
+    return clib_error_return (0, "%U is not an ssvm-eth interface",
+			      format_vnet_sw_if_index_name, vnm,
+			      sw_if_index);
+  if (frame_size < 60 || frame_size > VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES)
+    return clib_error_return (0, "size must be 60 to %d",
+			      VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES);
+  if (burst < 1 || burst > VLIB_FRAME_SIZE)
+    return clib_error_return (0, "burst must be 1 to %d", VLIB_FRAME_SIZE);
+
+  intfc = vec_elt_at_index (em->intfcs, hi->dev_instance);
+  if (intfc->sh->opaque[intfc->i_am_master ? SLAVE_ADMIN_STATE_INDEX :
+			MASTER_ADMIN_STATE_INDEX] == 0)
+    return clib_error_return (0, "peer is down, run \"test ssvm-eth "
+			      "reflect\" there first");
+
+  vlib_worker_thread_barrier_sync (vm);
+  vnet_sw_interface_set_flags (vnm, hi->sw_if_index,
+			       VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+  vnet_hw_interface_rx_redirect_to_node (vnm, hi->hw_if_index,
+					 ssvm_eth_bench_sink_node.index);
+  vec_foreach (pt, em->threads)
+  {
+    pt->bench_rx_packets = 0;
+    pt->bench_latency_clocks = 0;
+    pt->bench_latency_min = ~0ULL;
+    pt->bench_latency_max = 0;
+    memset (pt->bench_latency_histogram, 0,
+	    sizeof (pt->bench_latency_histogram));
+  }
+  queues = em->queues[hi->dev_instance];
+  vec_foreach (q, queues) vec_add1 (tx0, q->n_tx_packets);
+  vlib_worker_thread_barrier_release (vm);
+
+  vec_validate (template, frame_size - 1);
+  h = (ssvm_eth_bench_header_t *) template;
+  h->ethernet.dst_address[0] = 0x02;
+  h->ethernet.dst_address[5] = 0x01;
+  clib_memcpy (h->ethernet.src_address, hi->hw_address, 6);
+  h->ethernet.type = clib_host_to_net_u16 (ETHERNET_TYPE_IP4);
+  ip = (ip4_header_t *) (template + sizeof (h->ethernet));
+  ip->ip_version_and_header_length = 0x45;
+  ip->ttl = 64;
+  ip->protocol = IP_PROTOCOL_UDP;
+  ip->length = clib_host_to_net_u16 (frame_size - sizeof (h->ethernet));
+  ip->src_address.as_u32 = clib_host_to_net_u32 (0x0a000001);
+  ip->dst_address.as_u32 = clib_host_to_net_u32 (0x0a000002);
+  ip->checksum = ip4_header_checksum (ip);
+  h->udp.src_port = clib_host_to_net_u16 (1024);
+  h->udp.dst_port = clib_host_to_net_u16 (4789);
+  h->udp.length = clib_host_to_net_u16 (frame_size - sizeof (h->ethernet)
+					- sizeof (h->ip4));
+
+  t0 = vlib_time_now (vm);
+  do
+    {
+      vlib_frame_t *f;
+      u32 n = vlib_buffer_alloc (vm, buffers, burst);
+      u64 now = clib_cpu_time_now ();
+
+      for (i = 0; i < n; i++)
+	{
+	  vlib_buffer_t *b = vlib_get_buffer (vm, buffers[i]);
+
+	  clib_memcpy (b->data, template, frame_size);
+	  b->current_data = 0;
+	  b->current_length = frame_size;
+	  b->flags = 0;
+	  vnet_buffer (b)->sw_if_index[VLIB_RX] = hi->sw_if_index;
+	  vnet_buffer (b)->sw_if_index[VLIB_TX] = hi->sw_if_index;
+	  ((ssvm_eth_bench_header_t *) b->data)->timestamp = now;
+	}
+
+      if (n)
+	{
+	  f = vlib_get_frame_to_node (vm, hi->output_node_index);
+	  clib_memcpy (vlib_frame_vector_args (f), buffers,
+		       n * sizeof (u32));
+	  f->n_vectors = n;
+	  vlib_put_frame_to_node (vm, hi->output_node_index, f);
+	  n_tx += n;
+	}
+
+      vlib_process_suspend (vm, 10e-6);
+      t1 = vlib_time_now (vm);
+    }
+  while (t1 - t0 < duration);
+
+  /* let the last ones come back */
+  vlib_process_suspend (vm, 10e-3);
+
+  vlib_worker_thread_barrier_sync (vm);
+  t1 = vlib_time_now (vm);
+  memset (histogram, 0, sizeof (histogram));
+  vec_foreach (pt, em->threads)
+  {
+    n_rx += pt->bench_rx_packets;
+    clocks += pt->bench_latency_clocks;
+    min = clib_min (min, pt->bench_latency_min);
+    max = clib_max (max, pt->bench_latency_max);
+    for (i = 0; i < VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS; i++)
+      histogram[i] += pt->bench_latency_histogram[i];
+  }
+  us_per_clock = vm->clib_time.seconds_per_clock * 1e6;
+
+  vlib_cli_output (vm, "%U, %d queue%s%s, %d byte frames, burst %d, "
+		   "%.2f sec", format_vnet_sw_if_index_name, vnm,
+		   hi->sw_if_index, vec_len (queues),
+		   vec_len (queues) == 1 ? "" : "s",
+		   queues[0].tx_doorbell_fd >= 0 ? ", doorbells" : "",
+		   frame_size, burst, t1 - t0);
+  vec_foreach (q, queues)
+    vlib_cli_output (vm, "  queue %d: tx %llu", q - queues,
+		     q->n_tx_packets - tx0[q - queues]);
+  vlib_cli_output (vm, "sent %llu (%.2f Mpps), returned %llu (%.2f Mpps, "
+		   "%.1f%%)", n_tx, n_tx / (t1 - t0) * 1e-6, n_rx,
+		   n_rx / (t1 - t0) * 1e-6,
+		   n_tx ? 100.0 * n_rx / n_tx : 0.0);
+  if (n_rx)
+    {
+      vlib_cli_output (vm, "round trip: min %.2f us, avg %.2f us, "
+		       "max %.2f us", min * us_per_clock,
+		       clocks * us_per_clock / n_rx, max * us_per_clock);
+      for (i = 0; i < VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS; i++)
+	if (histogram[i])
+	  vlib_cli_output (vm, "  %-20U %lld",
+			   format_vlib_node_adaptive_bucket, i,
+			   histogram[i]);
+    }
+
+  vnet_hw_interface_rx_redirect_to_node (vnm, hi->hw_if_index, ~0);
+  vlib_worker_thread_barrier_release (vm);
+
+  vec_free (template);
+  vec_free (tx0);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ssvm_eth_bench_command, static) = {
+  .path = "test ssvm-eth",
+  .short_help = "test ssvm-eth <interface> [size <bytes>] [burst <n>] "
+    "[time <sec>]",
+  .function = ssvm_eth_bench_command_fn,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+ssvm_eth_reflect_command_fn (vlib_main_t * vm, unformat_input_t * input,
+			     vlib_cli_command_t * cmd)
+{
+  vnet_main_t *vnm = vnet_get_main ();
+  vnet_hw_interface_t *hi;
+  u32 sw_if_index = ~0;
+  int enable = 1;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface, vnm,
+		    &sw_if_index))
+	;
+      else if (unformat (input, "disable"))
+	enable = 0;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "interface required");
+  hi = vnet_get_sup_hw_interface (vnm, sw_if_index);
+  if (hi->dev_class_index != ssvm_eth_device_class.index)
+    return clib_error_return (0, "%U is not an ssvm-eth interface",
+			      format_vnet_sw_if_index_name, vnm,
+			      sw_if_index);
+
+  /* straight from the rx ring into the tx ring */
+  vlib_worker_thread_barrier_sync (vm);
+  if (enable)
+    {
+      vnet_sw_interface_set_flags (vnm, hi->sw_if_index,
+				   VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+      vnet_hw_interface_rx_redirect_to_node (vnm, hi->hw_if_index,
+					     hi->tx_node_index);
+    }
+  else
+    vnet_hw_interface_rx_redirect_to_node (vnm, hi->hw_if_index, ~0);
+  vlib_worker_thread_barrier_release (vm);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ssvm_eth_reflect_command, static) = {
+  .path = "test ssvm-eth reflect",
+  .short_help = "test ssvm-eth reflect <interface> [disable]",
+  .function = ssvm_eth_reflect_command_fn,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
 /*
  * fd.io coding-style-patch-verification: ON
  *
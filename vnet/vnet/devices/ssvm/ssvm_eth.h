@@ -27,7 +27,7 @@
 #include <vnet/ethernet/ethernet.h>
 #include <vnet/ip/ip.h>
 #include <vnet/pg/pg.h>
-#include <vlibmemory/unix_shared_memory_queue.h>
+#include <vlib/unix/unix.h>
 
 #include <ssvm.h>
 
@@ -57,20 +57,98 @@ typedef struct
   u8 pad2[CLIB_CACHE_LINE_BYTES - 16];
 } ssvm_eth_queue_elt_t;
 
+/*
+ * Single producer, single consumer chunk ring in the shared segment.
+ * Each queue has one ring in each direction. A packet takes consecutive
+ * elements, one per vlib buffer in its chain. The producer copies a
+ * whole frame in before it stores tail, and the consumer copies a whole
+ * frame out before it stores head. Each side keeps a private copy of the
+ * other side's index and reads the shared one only when its copy says
+ * the ring is full (producer) or empty (consumer).
+ */
+typedef struct
+{
+  /* written by the producer, read by the consumer */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  volatile u32 tail;
+
+  /* written by the consumer, read by the producer */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  volatile u32 head;
+  /* Set by a consumer about to stop polling; the producer clears it
+     and rings the doorbell after its next tail store. */
+  volatile u32 doorbell_armed;
+
+  /* constant */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline2);
+  u32 nelts;
+  ssvm_eth_queue_elt_t *elts;
+} ssvm_eth_ring_t;
+
+#define SSVM_ETH_MAX_QUEUES 16
+
+/* Where the master hands out doorbell eventfds, next to the segment */
+#define SSVM_ETH_DOORBELL_SOCKET_FORMAT "/dev/shm/%s.sock%c"
+
+/* This process's end of one queue pair */
+typedef struct
+{
+  /* tx, used by the threads mapped to this queue */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  ssvm_eth_ring_t *tx_ring;
+  /* set when more threads than queues */
+  volatile u32 *tx_lock;
+  u32 tx_head_cache;
+  int tx_doorbell_fd;
+  u64 n_tx_packets;
+  u64 n_tx_doorbells;
+
+  /* rx, used only by input_cpu_index */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  ssvm_eth_ring_t *rx_ring;
+  u32 rx_tail_cache;
+  u32 input_cpu_index;
+  int rx_doorbell_fd;
+  u32 rx_unix_file_index;
+  u64 n_rx_packets;
+  u64 n_rx_doorbells;
+} ssvm_eth_queue_t;
+
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u32 *buffer_cache;
+
+  /* benchmark sink, see "test ssvm-eth" */
+  u64 bench_rx_packets;
+  u64 bench_latency_clocks;
+  u64 bench_latency_min;
+  u64 bench_latency_max;
+  u64 bench_latency_histogram[VLIB_NODE_ADAPTIVE_HISTOGRAM_N_BUCKETS];
+} ssvm_eth_per_thread_t;
+
 typedef struct
 {
   /* vector of point-to-point connections */
   ssvm_private_t *intfcs;
 
-  u32 *buffer_cache;
-  u32 *chunk_cache;
+  /* per connection vector of queues, parallel to intfcs */
+  ssvm_eth_queue_t **queues;
+
+  ssvm_eth_per_thread_t *threads;
+
+  /* Threads which poll the rx rings */
+  u32 input_cpu_first_index;
+  u32 input_cpu_count;
 
   /* Configurable parameters */
   /* base address for next placement */
   u64 next_base_va;
   u64 segment_size;
-  u64 nbuffers;
   u64 queue_elts;
+  /* zero: one per input thread */
+  u32 n_queues;
+  int use_doorbells;
 
   /* Segment names */
   u8 **names;
@@ -85,50 +163,34 @@ ssvm_eth_main_t ssvm_eth_main;
 
 typedef enum
 {
-  CHUNK_POOL_FREELIST_INDEX = 0,
-  CHUNK_POOL_INDEX,
-  CHUNK_POOL_NFREE,
-  TO_MASTER_Q_INDEX,
-  TO_SLAVE_Q_INDEX,
+  RINGS_INDEX = 0,
+  N_QUEUES_INDEX,
+  DOORBELLS_INDEX,
   MASTER_ADMIN_STATE_INDEX,
   SLAVE_ADMIN_STATE_INDEX,
 } ssvm_eth_opaque_index_t;
 
-/*
- * debug scaffolding.
- */
-static inline void
-ssvm_eth_validate_freelists (int need_lock)
+/* Ring carrying queue qid towards the master or towards the slave */
+always_inline ssvm_eth_ring_t *
+ssvm_eth_get_ring (ssvm_shared_header_t * sh, u32 qid, int to_master)
 {
-#if CLIB_DEBUG > 0
-  ssvm_eth_main_t *em = &ssvm_eth_main;
-  ssvm_private_t *intfc;
-  ssvm_shared_header_t *sh;
-  u32 *elt_indices;
-  u32 n_available;
-  int i;
-
-  for (i = 0; i < vec_len (em->intfcs); i++)
-    {
-      intfc = em->intfcs + i;
-      sh = intfc->sh;
-      u32 my_pid = intfc->my_pid;
-
-      if (need_lock)
-	ssvm_lock (sh, my_pid, 15);
-
-      elt_indices = (u32 *) (sh->opaque[CHUNK_POOL_FREELIST_INDEX]);
-      n_available = (u32) (uword) (sh->opaque[CHUNK_POOL_NFREE]);
-
-      for (i = 0; i < n_available; i++)
-	ASSERT (elt_indices[i] < 2048);
-
-      if (need_lock)
-	ssvm_unlock (sh);
-    }
-#endif
+  ssvm_eth_ring_t *rings = (ssvm_eth_ring_t *) sh->opaque[RINGS_INDEX];
+  return rings + 2 * qid + (to_master == 0);
 }
 
+/* Benchmark frame, the timestamp rides in the udp payload */
+/* *INDENT-OFF* */
+typedef CLIB_PACKED (struct
+{
+  ethernet_header_t ethernet;
+  ip4_header_t ip4;
+  udp_header_t udp;
+  u64 timestamp;
+}) ssvm_eth_bench_header_t;
+/* *INDENT-ON* */
+
+extern vlib_node_registration_t ssvm_eth_bench_sink_node;
+
 #endif /* __included_ssvm_eth_h__ */
 
 /*
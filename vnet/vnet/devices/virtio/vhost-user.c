@@ -24,6 +24,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>		/* for iovec */
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <sys/vfs.h>
 
@@ -37,7 +39,10 @@
 
 #include <vnet/ethernet/ethernet.h>
 #include <vnet/devices/devices.h>
+#include <vnet/devices/rx_balance.h>
 #include <vnet/feature/feature.h>
+#include <vnet/l2/l2_input.h>
+#include <vnet/l2/l2_output.h>
 
 #include <vnet/devices/virtio/vhost-user.h>
 
@@ -48,6 +53,11 @@
    details will be shown in  packet trace */
 #define VHOST_USER_COPY_TX_HDR 0
 
+/* Zero-copy receive: bytes of a packet copied into the buffer for
+   forwarding, and the smallest rest of a descriptor left in guest memory */
+#define VHOST_USER_ZC_HEAD_BYTES 128
+#define VHOST_USER_ZC_MIN_BYTES 256
+
 #if VHOST_USER_DEBUG_SOCKET == 1
 #define DBG_SOCK(args...) clib_warning(args);
 #else
@@ -289,6 +299,42 @@ vhost_user_callfd_read_ready (unix_file_t * uf)
   return 0;
 }
 
+/*
+ * Poll on a thread only while a guest tx vring assigned to it is
+ * enabled; vrings the guest never enables cost no polling. Called with
+ * the barrier held.
+ */
+static void
+vhost_user_update_input_node_state (void)
+{
+  vhost_user_main_t *vum = &vhost_user_main;
+  vhost_user_intf_t *vui;
+  vlib_main_t *vm;
+  u32 qid, cpu, n_enabled[VLIB_MAX_CPUS];
+
+  memset (n_enabled, 0, sizeof (n_enabled));
+  vec_foreach (vui, vum->vhost_user_interfaces)
+  {
+    if (!vui->active)
+      continue;
+    for (qid = 0; VHOST_VRING_IDX_TX (qid) < vui->num_vrings; qid++)
+      {
+	vhost_user_vring_t *txvq = &vui->vrings[VHOST_VRING_IDX_TX (qid)];
+	if (txvq->enabled)
+	  n_enabled[txvq->input_cpu_index]++;
+      }
+  }
+
+  for (cpu = vum->input_cpu_first_index;
+       cpu < vum->input_cpu_first_index + vum->input_cpu_count; cpu++)
+    {
+      vm = vlib_mains ? vlib_mains[cpu] : vlib_get_main ();
+      vlib_node_set_state (vm, vhost_user_input_node.index,
+			   n_enabled[cpu] ? VLIB_NODE_STATE_POLLING :
+			   VLIB_NODE_STATE_DISABLED);
+    }
+}
+
 static inline void
 vhost_user_if_disconnect (vhost_user_intf_t * vui)
 {
@@ -329,9 +375,11 @@ vhost_user_if_disconnect (vhost_user_intf_t * vui)
       vui->vrings[q].used = NULL;
       vui->vrings[q].log_guest_addr = 0;
       vui->vrings[q].log_used = 0;
+      vui->vrings[q].enabled = 0;
     }
 
   unmap_all_mem_regions (vui);
+  vhost_user_update_input_node_state ();
   DBG_SOCK ("interface ifindex %d disconnected", vui->sw_if_index);
 }
 
@@ -365,6 +413,235 @@ vhost_user_log_dirty_pages (vhost_user_intf_t * vui, u64 addr, u64 len)
                              sizeof(vq->used->member)); \
   }
 
+/* With event_idx the driver ignores VRING_USED_F_NO_NOTIFY and kicks us
+   when its avail idx crosses avail_event. We poll, so keep avail_event
+   half the index space ahead of what we have consumed. */
+always_inline void
+vhost_user_suppress_notify (vhost_user_vring_t * vq)
+{
+  vring_avail_event (vq->used, vq->qsz) = vq->last_avail_idx + 0x8000;
+}
+
+/* Does the driver want a call for what has been put in the used ring? */
+always_inline int
+vhost_user_want_call (vhost_user_intf_t * vui, vhost_user_vring_t * vq)
+{
+  if (vui->features & (1 << FEAT_VIRTIO_RING_F_EVENT_IDX))
+    return vhost_user_vring_need_event
+      (vring_used_event (vq->avail, vq->qsz), vq->last_used_idx,
+       vq->last_call_used_idx);
+
+  return !(vq->avail->flags & VRING_AVAIL_F_NO_INTERRUPT);
+}
+
+/*
+ * Pick the queue pair each thread transmits on. A worker which polls a
+ * queue pair's guest tx vring also transmits on that pair, so a pinned
+ * pair is served by one worker in both directions. Other threads are
+ * spread over the enabled pairs. Threads sharing a pair serialize on
+ * the vring lock. Called with the barrier held, as workers read
+ * per_cpu_tx_qid.
+ */
+static void
+vhost_user_tx_thread_placement (vhost_user_intf_t * vui)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  u32 qids[VHOST_VRING_MAX_QUEUE_PAIRS];
+  u32 n_qids = 0, qid, cpu, i;
+
+  for (qid = 0; VHOST_VRING_IDX_TX (qid) < vui->num_vrings; qid++)
+    {
+      vhost_user_vring_t *rxvq = &vui->vrings[VHOST_VRING_IDX_RX (qid)];
+      if (rxvq->desc && rxvq->enabled)
+	qids[n_qids++] = qid;
+    }
+
+  for (cpu = 0; cpu < tm->n_vlib_mains; cpu++)
+    {
+      u32 tx_qid = n_qids ? qids[cpu % n_qids] : 0;
+
+      for (i = 0; i < n_qids; i++)
+	if (vui->vrings[VHOST_VRING_IDX_TX (qids[i])].input_cpu_index == cpu)
+	  {
+	    tx_qid = qids[i];
+	    break;
+	  }
+      vui->per_cpu_tx_qid[cpu] = tx_qid;
+    }
+}
+
+static vnet_device_class_t vhost_user_dev_class;
+
+/*
+ * Zero-copy keeps the payload of a received packet in the sending
+ * guest's memory and copies only its head into the vlib buffer. That is
+ * safe on a path which looks at nothing but headers and ends in another
+ * vhost-user interface, whose tx copies the payload straight into the
+ * receiving guest: a plain L2 cross-connect to a vhost-user interface.
+ */
+static_always_inline int
+vhost_user_zero_copy_ok (vhost_user_intf_t * vui, vlib_node_runtime_t * node)
+{
+  vnet_main_t *vnm = vnet_get_main ();
+  vnet_hw_interface_t *hi;
+  l2_input_config_t *in;
+  l2_output_config_t *out;
+  u32 sw_if_index = vui->sw_if_index;
+
+  if (PREDICT_TRUE (!vui->zero_copy))
+    return 0;
+
+  /* l2 mode redirects to ethernet-input, anything else is a tap */
+  if ((vui->per_interface_next_index != ~0
+       && vui->per_interface_next_index !=
+       VNET_DEVICE_INPUT_NEXT_ETHERNET_INPUT)
+      || vnet_have_features (node->feature_arc_index, sw_if_index))
+    return 0;
+
+  /* tagged packets might be classified to a sub-interface */
+  hi = vnet_get_hw_interface (vnm, vui->hw_if_index);
+  if (hash_elts (hi->sub_interface_sw_if_index_by_id))
+    return 0;
+
+  if (sw_if_index >= vec_len (l2input_main.configs))
+    return 0;
+  in = vec_elt_at_index (l2input_main.configs, sw_if_index);
+  if (!in->xconnect
+      || (in->feature_bitmap & ~(L2INPUT_FEAT_DROP | L2INPUT_FEAT_XCONNECT
+				 | L2INPUT_FEAT_VTR)))
+    return 0;
+
+  if (in->output_sw_if_index >= vec_len (l2output_main.configs))
+    return 0;
+  out = vec_elt_at_index (l2output_main.configs, in->output_sw_if_index);
+  if (out->feature_bitmap & ~L2OUTPUT_FEAT_EFP_FILTER)
+    return 0;
+
+  hi = vnet_get_sup_hw_interface (vnm, in->output_sw_if_index);
+  return hi->dev_class_index == vhost_user_dev_class.index;
+}
+
+/*
+ * Zero-copy receive of one descriptor's data. The head of the packet is
+ * copied, a large enough rest is only recorded in the buffer. Once some
+ * data is recorded, everything after it has to be recorded too, or when
+ * that does not fit the recorded data is copied after all and *zc is
+ * cleared. Returns how many bytes from the start of data the caller
+ * still has to copy, or ~0 when out of buffers.
+ */
+static_always_inline u32
+vhost_user_zero_copy_rx (vlib_main_t * vm, vlib_buffer_t * b_head,
+			 vlib_buffer_t ** b_current, u8 * data, u16 len,
+			 u8 * zc)
+{
+  vnet_buffer_opaque2_t *o = vnet_buffer2 (b_head);
+  u32 n_segs = o->vhost_user_zc.n_segs;
+  u32 head = 0, i;
+
+  if (n_segs == 0)
+    {
+      if (b_head->current_length < VHOST_USER_ZC_HEAD_BYTES)
+	head = VHOST_USER_ZC_HEAD_BYTES - b_head->current_length;
+      if (len < head + VHOST_USER_ZC_MIN_BYTES)
+	return len;
+    }
+  else if (n_segs == VNET_BUFFER_VHOST_USER_ZC_MAX_SEGS)
+    {
+      for (i = 0; i < n_segs; i++)
+	{
+	  u16 seg_len = o->vhost_user_zc.seg_len[i];
+	  if (vlib_buffer_chain_append_data_with_alloc
+	      (vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX, b_head, b_current,
+	       uword_to_pointer (o->vhost_user_zc.seg_addr[i], void *),
+	       seg_len) != seg_len)
+	    return ~0;
+	}
+      o->vhost_user_zc.n_segs = 0;
+      *zc = 0;
+      return len;
+    }
+
+  o->vhost_user_zc.seg_addr[n_segs] = pointer_to_uword (data + head);
+  o->vhost_user_zc.seg_len[n_segs] = len - head;
+  o->vhost_user_zc.n_segs = n_segs + 1;
+  return head;
+}
+
+/*
+ * Zero-copy buffers carry a per thread free list of their own and the
+ * recycle flag, so that once transmitted or dropped they land here.
+ * Their descriptors go back to the sending guest's used ring, which the
+ * vring's next poll publishes, and the buffers go back to the list they
+ * came from.
+ */
+static void
+vhost_user_zero_copy_recycle (vlib_main_t * vm, vlib_buffer_free_list_t * fl)
+{
+  vhost_user_main_t *vum = &vhost_user_main;
+  u32 cpu_index = os_get_cpu_number ();
+  u32 *recycled = vum->zc_recycled[cpu_index];
+  u32 *from, n_left, i;
+
+  /* freeing the buffers below may announce this list again */
+  if (vec_len (fl->aligned_buffers) + vec_len (fl->unaligned_buffers) == 0)
+    return;
+
+  for (i = 0; i < 2; i++)
+    {
+      from = i == 0 ? fl->aligned_buffers : fl->unaligned_buffers;
+      n_left = vec_len (from);
+
+      while (n_left > 0)
+	{
+	  vlib_buffer_t *b;
+	  vnet_buffer_opaque2_t *o;
+	  vhost_user_intf_t *vui;
+	  vhost_user_vring_t *txvq;
+	  u32 bi = from[0];
+
+	  if (PREDICT_TRUE (n_left > 1))
+	    vlib_prefetch_buffer_with_index (vm, from[1], LOAD);
+
+	  b = vlib_get_buffer (vm, bi);
+	  o = vnet_buffer2 (b);
+	  vui = vec_elt_at_index (vum->vhost_user_interfaces,
+				  o->vhost_user_zc.if_index);
+	  txvq = &vui->vrings[VHOST_VRING_IDX_TX (o->vhost_user_zc.qid)];
+
+	  if (PREDICT_TRUE (txvq->used != 0))
+	    {
+	      u16 qsz_mask = txvq->qsz - 1;
+	      txvq->used->ring[txvq->last_used_idx & qsz_mask].id =
+		o->vhost_user_zc.desc_head;
+	      txvq->used->ring[txvq->last_used_idx & qsz_mask].len = 0;
+	      vhost_user_log_dirty_ring (vui, txvq,
+					 ring[txvq->last_used_idx &
+					      qsz_mask]);
+	      txvq->last_used_idx++;
+	    }
+	  txvq->n_zc_pending--;
+
+	  b->flags &= ~(VLIB_BUFFER_RECYCLE | BUFFER_VHOST_USER_ZC);
+	  b->free_list_index = o->vhost_user_zc.free_list_index;
+#if (CLIB_DEBUG > 0)
+#if DPDK == 0
+	  vlib_buffer_set_known_state (vm, bi, VLIB_BUFFER_KNOWN_ALLOCATED);
+#endif
+#endif
+	  vec_add1 (recycled, bi);
+	  from++;
+	  n_left--;
+	}
+    }
+
+  vec_reset_length (fl->aligned_buffers);
+  vec_reset_length (fl->unaligned_buffers);
+
+  vlib_buffer_free (vm, recycled, vec_len (recycled));
+  vec_reset_length (recycled);
+  vum->zc_recycled[cpu_index] = recycled;
+}
+
 static clib_error_t *
 vhost_user_socket_read (unix_file_t * uf)
 {
@@ -392,6 +669,9 @@ vhost_user_socket_read (unix_file_t * uf)
   else
     vui = vec_elt_at_index (vum->vhost_user_interfaces, p[0]);
 
+  /* Workers use the vrings, memory regions and queue placement */
+  vlib_worker_thread_barrier_sync (vlib_get_main ());
+
   char control[CMSG_SPACE (VHOST_MEMORY_MAX_NREGIONS * sizeof (int))];
 
   memset (&mh, 0, sizeof (mh));
@@ -443,6 +723,23 @@ vhost_user_socket_read (unix_file_t * uf)
     rv = read (uf->file_descriptor, ((char *) &msg) + n, msg.size);
   }
 
+  /* vring messages must name a vring we have room for */
+  if ((msg.request >= VHOST_USER_SET_VRING_NUM &&
+       msg.request <= VHOST_USER_GET_VRING_BASE) ||
+      msg.request == VHOST_USER_SET_VRING_ENABLE)
+    {
+      if (msg.state.index >= VHOST_VRING_MAX_N)
+	goto close_socket;
+      vui->num_vrings = clib_max (vui->num_vrings, msg.state.index + 1);
+    }
+  else if (msg.request >= VHOST_USER_SET_VRING_KICK &&
+	   msg.request <= VHOST_USER_SET_VRING_ERR)
+    {
+      if ((msg.u64 & 0xFF) >= VHOST_VRING_MAX_N)
+	goto close_socket;
+      vui->num_vrings = clib_max (vui->num_vrings, (msg.u64 & 0xFF) + 1);
+    }
+
   switch (msg.request)
     {
     case VHOST_USER_GET_FEATURES:
@@ -454,6 +751,8 @@ vhost_user_socket_read (unix_file_t * uf)
 	(1 << FEAT_VIRTIO_F_INDIRECT_DESC) |
 	(1 << FEAT_VHOST_F_LOG_ALL) |
 	(1 << FEAT_VIRTIO_NET_F_GUEST_ANNOUNCE) |
+	(1 << FEAT_VIRTIO_NET_F_MQ) |
+	(1 << FEAT_VIRTIO_RING_F_EVENT_IDX) |
 	(1 << FEAT_VHOST_USER_F_PROTOCOL_FEATURES) |
 	(1UL << FEAT_VIRTIO_F_VERSION_1);
       msg.u64 &= vui->feature_mask;
@@ -479,7 +778,7 @@ vhost_user_socket_read (unix_file_t * uf)
       vnet_hw_interface_set_flags (vnm, vui->hw_if_index, 0);
       vui->is_up = 0;
 
-      for (q = 0; q < 2; q++)
+      for (q = 0; q < VHOST_VRING_MAX_N; q++)
 	{
 	  vui->vrings[q].desc = 0;
 	  vui->vrings[q].avail = 0;
@@ -591,10 +890,13 @@ vhost_user_socket_read (unix_file_t * uf)
 
       vui->vrings[msg.state.index].last_used_idx =
 	vui->vrings[msg.state.index].last_avail_idx =
+	vui->vrings[msg.state.index].last_call_used_idx =
 	vui->vrings[msg.state.index].used->idx;
 
-      /* tell driver that we don't want interrupts */
-      vui->vrings[msg.state.index].used->flags |= 1;
+      /* tell driver that we don't want notifications, we poll */
+      vui->vrings[msg.state.index].used->flags |= VRING_USED_F_NO_NOTIFY;
+      if (vui->features & (1 << FEAT_VIRTIO_RING_F_EVENT_IDX))
+	vhost_user_suppress_notify (&vui->vrings[msg.state.index]);
       break;
 
     case VHOST_USER_SET_OWNER:
@@ -753,7 +1055,8 @@ vhost_user_socket_read (unix_file_t * uf)
 		vui->hw_if_index);
 
       msg.flags |= 4;
-      msg.u64 = (1 << VHOST_USER_PROTOCOL_F_LOG_SHMFD);
+      msg.u64 = (1 << VHOST_USER_PROTOCOL_F_LOG_SHMFD) |
+	(1 << VHOST_USER_PROTOCOL_F_MQ);
       msg.size = sizeof (msg.u64);
       break;
 
@@ -765,6 +1068,14 @@ vhost_user_socket_read (unix_file_t * uf)
 
       break;
 
+    case VHOST_USER_GET_QUEUE_NUM:
+      DBG_SOCK ("if %d msg VHOST_USER_GET_QUEUE_NUM", vui->hw_if_index);
+
+      msg.flags |= 4;
+      msg.u64 = VHOST_VRING_MAX_QUEUE_PAIRS;
+      msg.size = sizeof (msg.u64);
+      break;
+
     case VHOST_USER_SET_VRING_ENABLE:
       DBG_SOCK ("if %d VHOST_USER_SET_VRING_ENABLE, enable: %d",
 		vui->hw_if_index, msg.state.num);
@@ -791,6 +1102,10 @@ vhost_user_socket_read (unix_file_t * uf)
 
     }
 
+  /* vrings may have come, gone, or been enabled */
+  vhost_user_tx_thread_placement (vui);
+  vhost_user_update_input_node_state ();
+
   /* if we need to reply */
   if (msg.flags & 4)
     {
@@ -800,10 +1115,12 @@ vhost_user_socket_read (unix_file_t * uf)
 	goto close_socket;
     }
 
+  vlib_worker_thread_barrier_release (vlib_get_main ());
   return 0;
 
 close_socket:
   vhost_user_if_disconnect (vui);
+  vlib_worker_thread_barrier_release (vlib_get_main ());
   return 0;
 }
 
@@ -824,7 +1141,9 @@ vhost_user_socket_error (unix_file_t * uf)
   else
     vui = vec_elt_at_index (vum->vhost_user_interfaces, p[0]);
 
+  vlib_worker_thread_barrier_sync (vlib_get_main ());
   vhost_user_if_disconnect (vui);
+  vlib_worker_thread_barrier_release (vlib_get_main ());
   return 0;
 }
 
@@ -868,6 +1187,66 @@ vhost_user_socksvr_accept_ready (unix_file_t * uf)
   return 0;
 }
 
+static void
+vhost_user_rx_balance_get_queues (vnet_rx_balance_queue_t ** queues)
+{
+  vhost_user_main_t *vum = &vhost_user_main;
+  vnet_rx_balance_queue_t *q;
+  vhost_user_intf_t *vui;
+  u32 qid;
+
+  vec_foreach (vui, vum->vhost_user_interfaces)
+  {
+    if (!vui->active)
+      continue;
+    for (qid = 0; VHOST_VRING_IDX_TX (qid) < vui->num_vrings; qid++)
+      {
+	vhost_user_vring_t *txvq = &vui->vrings[VHOST_VRING_IDX_TX (qid)];
+	vec_add2 (*queues, q, 1);
+	q->hw_if_index = vui->hw_if_index;
+	q->queue_id = qid;
+	q->cpu_index = txvq->input_cpu_index;
+	q->n_rx_packets = txvq->n_rx_packets;
+      }
+  }
+}
+
+static clib_error_t *
+vhost_user_rx_balance_move_queue (u32 hw_if_index, u32 queue_id,
+				  u32 cpu_index)
+{
+  vhost_user_main_t *vum = &vhost_user_main;
+  vhost_user_intf_t *vui;
+  vhost_user_vring_t *txvq;
+
+  vec_foreach (vui, vum->vhost_user_interfaces)
+  {
+    if (vui->active && vui->hw_if_index == hw_if_index)
+      break;
+  }
+
+  if (vui == vec_end (vum->vhost_user_interfaces)
+      || VHOST_VRING_IDX_TX (queue_id) >= vui->num_vrings)
+    return clib_error_return (0, "no such vhost-user queue");
+
+  if (vlib_mains == 0 || cpu_index < vum->input_cpu_first_index
+      || cpu_index >= vum->input_cpu_first_index + vum->input_cpu_count)
+    return clib_error_return (0, "thread %d does not poll vhost-user",
+			      cpu_index);
+
+  txvq = &vui->vrings[VHOST_VRING_IDX_TX (queue_id)];
+  txvq->input_cpu_index = cpu_index;
+  vhost_user_tx_thread_placement (vui);
+  vhost_user_update_input_node_state ();
+  return 0;
+}
+
+static vnet_rx_balance_provider_t vhost_user_rx_balance_provider = {
+  .name = "vhost-user",
+  .get_queues = vhost_user_rx_balance_get_queues,
+  .move_queue = vhost_user_rx_balance_move_queue,
+};
+
 static clib_error_t *
 vhost_user_init (vlib_main_t * vm)
 {
@@ -876,6 +1255,7 @@ vhost_user_init (vlib_main_t * vm)
   vlib_thread_main_t *tm = vlib_get_thread_main ();
   vlib_thread_registration_t *tr;
   uword *p;
+  u32 i;
 
   error = vlib_call_init_function (vm, ip4_init);
   if (error)
@@ -892,6 +1272,25 @@ vhost_user_init (vlib_main_t * vm)
 
   vec_validate_aligned (vum->rx_buffers, tm->n_vlib_mains - 1,
 			CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (vum->tx_copy, tm->n_vlib_mains - 1,
+			CLIB_CACHE_LINE_BYTES);
+
+  STATIC_ASSERT (sizeof (vnet_buffer_opaque2_t) <=
+		 STRUCT_SIZE_OF (vlib_buffer_t, opaque2),
+		 "vhost-user zero-copy metadata does not fit in opaque2");
+  vec_validate (vum->zc_recycled, tm->n_vlib_mains - 1);
+  vec_validate (vum->zc_free_list_index_by_cpu, tm->n_vlib_mains - 1);
+  for (i = 0; i < tm->n_vlib_mains; i++)
+    {
+      vlib_buffer_free_list_t *fl;
+      u32 fi = vlib_buffer_create_free_list
+	(vm, VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES, "vhost-user-zero-copy-%d",
+	 i);
+
+      fl = vlib_buffer_get_free_list (vm, fi);
+      fl->buffers_added_to_freelist_function = vhost_user_zero_copy_recycle;
+      vum->zc_free_list_index_by_cpu[i] = fi;
+    }
 
   /* find out which cpus will be used for input */
   vum->input_cpu_first_index = 0;
@@ -905,6 +1304,11 @@ vhost_user_init (vlib_main_t * vm)
       vum->input_cpu_count = tr->count;
     }
 
+  vhost_user_rx_balance_provider.first_cpu_index =
+    vum->input_cpu_first_index;
+  vhost_user_rx_balance_provider.n_cpus = vum->input_cpu_count;
+  vnet_rx_balance_register_provider (&vhost_user_rx_balance_provider);
+
   return 0;
 }
 
@@ -1001,6 +1405,7 @@ vhost_user_send_call (vlib_main_t * vm, vhost_user_vring_t * vq)
   /* $$$$ pay attention to rv */
   rv = write (vq->callfd, &x, sizeof (x));
   vq->n_since_last_int = 0;
+  vq->last_call_used_idx = vq->last_used_idx;
   vq->int_deadline = vlib_time_now (vm) + vum->coalesce_time;
 }
 
@@ -1008,10 +1413,11 @@ vhost_user_send_call (vlib_main_t * vm, vhost_user_vring_t * vq)
 static u32
 vhost_user_if_input (vlib_main_t * vm,
 		     vhost_user_main_t * vum,
-		     vhost_user_intf_t * vui, vlib_node_runtime_t * node)
+		     vhost_user_intf_t * vui,
+		     u32 qid, vlib_node_runtime_t * node)
 {
-  vhost_user_vring_t *txvq = &vui->vrings[VHOST_NET_VRING_IDX_TX];
-  vhost_user_vring_t *rxvq = &vui->vrings[VHOST_NET_VRING_IDX_RX];
+  vhost_user_vring_t *txvq = &vui->vrings[VHOST_VRING_IDX_TX (qid)];
+  vhost_user_vring_t *rxvq = &vui->vrings[VHOST_VRING_IDX_RX (qid)];
   uword n_rx_packets = 0, n_rx_bytes = 0;
   uword n_left;
   u32 n_left_to_next, *to_next;
@@ -1024,6 +1430,8 @@ vhost_user_if_input (vlib_main_t * vm,
   u32 map_guest_hint_desc = 0;
   u32 map_guest_hint_indirect = 0;
   u32 *map_guest_hint_p = &map_guest_hint_desc;
+  u32 n_zc = 0;
+  int zc;
 
   vec_reset_length (vui->d_trace_buffers);
 
@@ -1031,6 +1439,22 @@ vhost_user_if_input (vlib_main_t * vm,
   if (PREDICT_FALSE (!txvq->desc || !txvq->avail || !txvq->enabled))
     return 0;
 
+  /* give back descriptors which zero-copy packets have released since the
+     last poll */
+  if (PREDICT_FALSE (txvq->used->idx != txvq->last_used_idx))
+    {
+      u16 n_released = txvq->last_used_idx - txvq->used->idx;
+      CLIB_MEMORY_BARRIER ();
+      txvq->used->idx = txvq->last_used_idx;
+      vhost_user_log_dirty_ring (vui, txvq, idx);
+      if ((txvq->callfd > -1) && vhost_user_want_call (vui, txvq))
+	{
+	  txvq->n_since_last_int += n_released;
+	  if (txvq->n_since_last_int > vum->coalesce_frames)
+	    vhost_user_send_call (vm, txvq);
+	}
+    }
+
   /* do we have pending intterupts ? */
   if ((txvq->n_since_last_int) && (txvq->int_deadline < now))
     vhost_user_send_call (vm, txvq);
@@ -1071,6 +1495,7 @@ vhost_user_if_input (vlib_main_t * vm,
   cpu_index = os_get_cpu_number ();
   drops = 0;
   flush = 0;
+  zc = vhost_user_zero_copy_ok (vui, node);
 
   if (n_left > VLIB_FRAME_SIZE)
     n_left = VLIB_FRAME_SIZE;
@@ -1137,6 +1562,7 @@ vhost_user_if_input (vlib_main_t * vm,
 	  u32 bi_head, bi_current;
 	  u16 desc_chain_head, desc_current;
 	  u8 error = VHOST_USER_INPUT_FUNC_ERROR_NO_ERROR;
+	  u8 zc0 = zc;
 
 	  if (PREDICT_TRUE (n_left > 1))
 	    {
@@ -1158,6 +1584,8 @@ vhost_user_if_input (vlib_main_t * vm,
 	  bi_head = bi_current = vum->rx_buffers[cpu_index][--rx_len];
 	  b_head = b_current = vlib_get_buffer (vm, bi_head);
 	  vlib_buffer_chain_init (b_head);
+	  if (PREDICT_FALSE (zc0))
+	    vnet_buffer2 (b_head)->vhost_user_zc.n_segs = 0;
 
 	  uword offset;
 	  if (PREDICT_TRUE (vui->is_any_layout) ||
@@ -1216,14 +1644,28 @@ vhost_user_if_input (vlib_main_t * vm,
 	      if (desc_table[desc_index].len > offset)
 		{
 		  u16 len = desc_table[desc_index].len - offset;
-		  u16 copied = vlib_buffer_chain_append_data_with_alloc (vm,
-									 VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX,
-									 b_head,
-									 &b_current,
-									 buffer_addr
-									 +
-									 offset,
-									 len);
+		  u16 copied;
+
+		  if (PREDICT_FALSE (zc0))
+		    {
+		      u32 n = vhost_user_zero_copy_rx (vm, b_head, &b_current,
+						       buffer_addr + offset,
+						       len, &zc0);
+		      if (n == ~0)
+			{
+			  error = VHOST_USER_INPUT_FUNC_ERROR_NO_BUFFER;
+			  break;
+			}
+		      len = n;
+		    }
+
+		  copied = vlib_buffer_chain_append_data_with_alloc (vm,
+								     VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX,
+								     b_head,
+								     &b_current,
+								     buffer_addr
+								     + offset,
+								     len);
 		  if (copied != len)
 		    {
 		      error = VHOST_USER_INPUT_FUNC_ERROR_NO_BUFFER;
@@ -1240,19 +1682,36 @@ vhost_user_if_input (vlib_main_t * vm,
 	    }
 	out:
 
-	  /* consume the descriptor and return it as used */
+	  /* consume the descriptor, zero-copy packets keep it until their
+	     buffer is freed */
 	  txvq->last_avail_idx++;
-	  txvq->used->ring[txvq->last_used_idx & qsz_mask].id =
-	    desc_chain_head;
-	  txvq->used->ring[txvq->last_used_idx & qsz_mask].len = 0;
-	  vhost_user_log_dirty_ring (vui, txvq,
-				     ring[txvq->last_used_idx & qsz_mask]);
-	  txvq->last_used_idx++;
-
-	  //It is important to free RX as fast as possible such that the TX
-	  //process does not drop packets
-	  if ((txvq->last_used_idx & 0x3f) == 0)	// Every 64 packets
-	    txvq->used->idx = txvq->last_used_idx;
+	  if (PREDICT_FALSE (zc0 && !error &&
+			     vnet_buffer2 (b_head)->vhost_user_zc.n_segs))
+	    {
+	      vnet_buffer_opaque2_t *o = vnet_buffer2 (b_head);
+	      u32 i;
+
+	      o->vhost_user_zc.if_index = vui - vum->vhost_user_interfaces;
+	      o->vhost_user_zc.qid = qid;
+	      o->vhost_user_zc.desc_head = desc_chain_head;
+	      o->vhost_user_zc.free_list_index = b_head->free_list_index;
+	      b_head->free_list_index =
+		vum->zc_free_list_index_by_cpu[cpu_index];
+	      b_head->flags |= VLIB_BUFFER_RECYCLE | BUFFER_VHOST_USER_ZC;
+	      for (i = 0; i < o->vhost_user_zc.n_segs; i++)
+		n_rx_bytes += o->vhost_user_zc.seg_len[i];
+	      txvq->n_zc_pending++;
+	      n_zc++;
+	    }
+	  else
+	    {
+	      txvq->used->ring[txvq->last_used_idx & qsz_mask].id =
+		desc_chain_head;
+	      txvq->used->ring[txvq->last_used_idx & qsz_mask].len = 0;
+	      vhost_user_log_dirty_ring (vui, txvq,
+					 ring[txvq->last_used_idx & qsz_mask]);
+	      txvq->last_used_idx++;
+	    }
 
 	  if (PREDICT_FALSE (b_head->current_length < 14 &&
 			     error == VHOST_USER_INPUT_FUNC_ERROR_NO_ERROR))
@@ -1279,6 +1738,8 @@ vhost_user_if_input (vlib_main_t * vm,
 		b_head->total_length_not_including_first_buffer;
 	      n_rx_packets++;
 	      next0 = VNET_DEVICE_INPUT_NEXT_ETHERNET_INPUT;
+	      if (PREDICT_FALSE (vui->per_interface_next_index != ~0))
+		next0 = vui->per_interface_next_index;
 	    }
 
 	  to_next[0] = bi_head;
@@ -1302,22 +1763,24 @@ vhost_user_if_input (vlib_main_t * vm,
   if (PREDICT_TRUE (vum->rx_buffers[cpu_index] != 0))
     _vec_len (vum->rx_buffers[cpu_index]) = rx_len;
 
-  /* give buffers back to driver */
+  /* give buffers back to driver, once for the whole frame */
   CLIB_MEMORY_BARRIER ();
   txvq->used->idx = txvq->last_used_idx;
   vhost_user_log_dirty_ring (vui, txvq, idx);
+  if (vui->features & (1 << FEAT_VIRTIO_RING_F_EVENT_IDX))
+    vhost_user_suppress_notify (txvq);
 
   if (PREDICT_FALSE (vec_len (vui->d_trace_buffers) > 0))
     {
-      vhost_user_rx_trace (vm, node, vui, VHOST_NET_VRING_IDX_TX);
+      vhost_user_rx_trace (vm, node, vui, VHOST_VRING_IDX_TX (qid));
       vlib_set_trace_count (vm, node,
 			    n_trace - vec_len (vui->d_trace_buffers));
     }
 
   /* interrupt (call) handling */
-  if ((txvq->callfd > -1) && !(txvq->avail->flags & 1))
+  if ((txvq->callfd > -1) && vhost_user_want_call (vui, txvq))
     {
-      txvq->n_since_last_int += n_rx_packets;
+      txvq->n_since_last_int += n_rx_packets - n_zc;
 
       if (txvq->n_since_last_int > vum->coalesce_frames)
 	vhost_user_send_call (vm, txvq);
@@ -1337,6 +1800,9 @@ vhost_user_if_input (vlib_main_t * vm,
      + VNET_INTERFACE_COUNTER_RX,
      os_get_cpu_number (), vui->sw_if_index, n_rx_packets, n_rx_bytes);
 
+  txvq->n_rx_packets += n_rx_packets;
+  txvq->n_zc_packets += n_zc;
+
   return n_rx_packets;
 }
 
@@ -1348,17 +1814,18 @@ vhost_user_input (vlib_main_t * vm,
   u32 cpu_index = os_get_cpu_number ();
   vhost_user_intf_t *vui;
   uword n_rx_packets = 0;
+  u32 qid;
   int i;
 
   for (i = 0; i < vec_len (vum->vhost_user_interfaces); i++)
     {
       vui = vec_elt_at_index (vum->vhost_user_interfaces, i);
-      if (vui->is_up)
-	{
-	  if ((i % vum->input_cpu_count) ==
-	      (cpu_index - vum->input_cpu_first_index))
-	    n_rx_packets += vhost_user_if_input (vm, vum, vui, node);
-	}
+      if (!vui->is_up)
+	continue;
+      for (qid = 0; VHOST_VRING_IDX_TX (qid) < vui->num_vrings; qid++)
+	if (vui->vrings[VHOST_VRING_IDX_TX (qid)].input_cpu_index ==
+	    cpu_index)
+	  n_rx_packets += vhost_user_if_input (vm, vum, vui, qid, node);
     }
   return n_rx_packets;
 }
@@ -1385,6 +1852,40 @@ VLIB_REGISTER_NODE (vhost_user_input_node) = {
 VLIB_NODE_FUNCTION_MULTIARCH (vhost_user_input_node, vhost_user_input)
 /* *INDENT-ON* */
 
+/*
+ * Copy the frame's data into guest buffers. The descriptor walk only
+ * queues copies, so the copies run back to back here with their sources
+ * prefetched, and dirty pages are logged once the data is in place.
+ */
+static_always_inline void
+vhost_user_tx_copy (vhost_user_intf_t * vui, vhost_copy_t * cpy,
+		    u32 n_copies)
+{
+  vhost_copy_t *c = cpy;
+  u32 n_left = n_copies;
+
+  while (n_left >= 4)
+    {
+      CLIB_PREFETCH ((void *) c[2].src, CLIB_CACHE_LINE_BYTES, LOAD);
+      CLIB_PREFETCH ((void *) c[3].src, CLIB_CACHE_LINE_BYTES, LOAD);
+      clib_memcpy ((void *) c[0].dst, (void *) c[0].src, c[0].len);
+      clib_memcpy ((void *) c[1].dst, (void *) c[1].src, c[1].len);
+      c += 2;
+      n_left -= 2;
+    }
+
+  while (n_left > 0)
+    {
+      clib_memcpy ((void *) c[0].dst, (void *) c[0].src, c[0].len);
+      c += 1;
+      n_left -= 1;
+    }
+
+  if (PREDICT_FALSE (vui->log_base_addr != 0))
+    for (c = cpy; c < cpy + n_copies; c++)
+      vhost_user_log_dirty_pages (vui, c->dst_guest_addr, c->len);
+}
+
 static uword
 vhost_user_intfc_tx (vlib_main_t * vm,
 		     vlib_node_runtime_t * node, vlib_frame_t * frame)
@@ -1396,8 +1897,11 @@ vhost_user_intfc_tx (vlib_main_t * vm,
   vnet_interface_output_runtime_t *rd = (void *) node->runtime_data;
   vhost_user_intf_t *vui =
     vec_elt_at_index (vum->vhost_user_interfaces, rd->dev_instance);
-  vhost_user_vring_t *rxvq = &vui->vrings[VHOST_NET_VRING_IDX_RX];
-  u16 qsz_mask;
+  u32 cpu_index = os_get_cpu_number ();
+  u32 qid = vui->per_cpu_tx_qid[cpu_index];
+  vhost_user_vring_t *rxvq = &vui->vrings[VHOST_VRING_IDX_RX (qid)];
+  vhost_copy_t *cpy = vum->tx_copy[cpu_index];
+  u16 qsz_mask, avail_idx;
   u8 error = VHOST_USER_TX_FUNC_ERROR_NONE;
 
   n_left = n_packets = frame->n_vectors;
@@ -1406,7 +1910,13 @@ vhost_user_intfc_tx (vlib_main_t * vm,
   u32 *map_guest_hint_p = &map_guest_hint_desc;
 
   if (PREDICT_FALSE (!vui->is_up))
-    goto done2;
+    goto done3;
+
+  if (PREDICT_FALSE (rxvq->lockp != 0))
+    {
+      while (__sync_lock_test_and_set (rxvq->lockp, 1))
+	;
+    }
 
   if (PREDICT_FALSE
       (!rxvq->desc || !rxvq->avail || vui->sock_errno != 0 || !rxvq->enabled))
@@ -1415,12 +1925,6 @@ vhost_user_intfc_tx (vlib_main_t * vm,
       goto done2;
     }
 
-  if (PREDICT_FALSE (vui->lockp != 0))
-    {
-      while (__sync_lock_test_and_set (vui->lockp, 1))
-	;
-    }
-
   /* only bit 0 of avail.flags is used so we don't want to deal with this
      interface if any other bit is set */
   if (PREDICT_FALSE (rxvq->avail->flags & 0xFFFE))
@@ -1429,31 +1933,46 @@ vhost_user_intfc_tx (vlib_main_t * vm,
       goto done2;
     }
 
-  if (PREDICT_FALSE ((rxvq->avail->idx == rxvq->last_avail_idx)))
+  /* read the avail index once, the frame is served from what the driver
+     had posted by now */
+  avail_idx = *(volatile u16 *) &rxvq->avail->idx;
+  CLIB_MEMORY_BARRIER ();
+
+  if (PREDICT_FALSE (avail_idx == rxvq->last_avail_idx))
     {
       error = VHOST_USER_TX_FUNC_ERROR_PKT_DROP_NOBUF;
       goto done2;
     }
 
   qsz_mask = rxvq->qsz - 1;	/* qsz is always power of 2 */
+  vec_reset_length (cpy);
 
   while (n_left > 0)
     {
       vlib_buffer_t *b0, *current_b0;
       u16 desc_head, desc_index, desc_len;
       vring_desc_t *desc_table;
-      void *buffer_addr;
-      u32 buffer_len;
+      void *buffer_addr, *src;
+      u32 buffer_len, zc_seg, zc_n_segs;
+      vhost_copy_t *c;
 
       b0 = vlib_get_buffer (vm, buffers[0]);
       buffers++;
 
-      if (PREDICT_FALSE (rxvq->last_avail_idx == rxvq->avail->idx))
+      if (PREDICT_FALSE (rxvq->last_avail_idx == avail_idx))
 	{
 	  error = VHOST_USER_TX_FUNC_ERROR_PKT_DROP_NOBUF;
 	  goto done;
 	}
 
+      if (PREDICT_TRUE (n_left > 1))
+	{
+	  vlib_prefetch_buffer_with_index (vm, buffers[0], LOAD);
+	  CLIB_PREFETCH (&rxvq->desc[rxvq->avail->ring
+				     [(rxvq->last_avail_idx + 1) & qsz_mask]],
+			 sizeof (vring_desc_t), LOAD);
+	}
+
       desc_table = rxvq->desc;
       map_guest_hint_p = &map_guest_hint_desc;
       desc_head = desc_index =
@@ -1506,6 +2025,10 @@ vhost_user_intfc_tx (vlib_main_t * vm,
       buffer_addr += vui->virtio_net_hdr_sz;
       buffer_len -= vui->virtio_net_hdr_sz;
       current_b0 = b0;
+      src = vlib_buffer_get_current (b0);
+      zc_seg = 0;
+      zc_n_segs = (b0->flags & BUFFER_VHOST_USER_ZC) ?
+	vnet_buffer2 (b0)->vhost_user_zc.n_segs : 0;
       while (1)
 	{
 	  if (!bytes_left)
@@ -1513,8 +2036,17 @@ vhost_user_intfc_tx (vlib_main_t * vm,
 	      if (current_b0->flags & VLIB_BUFFER_NEXT_PRESENT)
 		{
 		  current_b0 = vlib_get_buffer (vm, current_b0->next_buffer);
+		  src = vlib_buffer_get_current (current_b0);
 		  bytes_left = current_b0->current_length;
 		}
+	      else if (PREDICT_FALSE (zc_seg < zc_n_segs))
+		{
+		  //Rest of a zero-copy packet, still in the sender's memory
+		  src = uword_to_pointer
+		    (vnet_buffer2 (b0)->vhost_user_zc.seg_addr[zc_seg], void *);
+		  bytes_left = vnet_buffer2 (b0)->vhost_user_zc.seg_len[zc_seg];
+		  zc_seg++;
+		}
 	      else
 		{
 		  //End of packet
@@ -1553,9 +2085,9 @@ vhost_user_intfc_tx (vlib_main_t * vm,
 		  rxvq->last_avail_idx++;
 		  rxvq->last_used_idx++;
 		  hdr->num_buffers++;
+		  desc_len = 0;
 
-		  if (PREDICT_FALSE
-		      (rxvq->last_avail_idx == rxvq->avail->idx))
+		  if (PREDICT_FALSE (rxvq->last_avail_idx == avail_idx))
 		    {
 		      //Dequeue queued descriptors for this packet
 		      rxvq->last_used_idx -= hdr->num_buffers - 1;
@@ -1613,20 +2145,18 @@ vhost_user_intfc_tx (vlib_main_t * vm,
 	  u16 bytes_to_copy = bytes_left;
 	  bytes_to_copy =
 	    (bytes_to_copy > buffer_len) ? buffer_len : bytes_to_copy;
-	  clib_memcpy (buffer_addr,
-		       vlib_buffer_get_current (current_b0) +
-		       current_b0->current_length - bytes_left,
-		       bytes_to_copy);
 
-	  vhost_user_log_dirty_pages (vui,
-				      desc_table[desc_index].addr +
-				      desc_table[desc_index].len -
-				      bytes_left - bytes_to_copy,
-				      bytes_to_copy);
+	  vec_add2 (cpy, c, 1);
+	  c->dst = pointer_to_uword (buffer_addr);
+	  c->src = pointer_to_uword (src);
+	  c->len = bytes_to_copy;
+	  c->dst_guest_addr = desc_table[desc_index].addr +
+	    desc_table[desc_index].len - buffer_len;
 
 	  bytes_left -= bytes_to_copy;
 	  buffer_len -= bytes_to_copy;
 	  buffer_addr += bytes_to_copy;
+	  src += bytes_to_copy;
 	  desc_len += bytes_to_copy;
 	}
 
@@ -1643,12 +2173,21 @@ vhost_user_intfc_tx (vlib_main_t * vm,
     }
 
 done:
+  /* copies of a packet dropped half way land in descriptors which are
+     not made used, and later copies into the same descriptors run after
+     them */
+  vhost_user_tx_copy (vui, cpy, vec_len (cpy));
+  vum->tx_copy[cpu_index] = cpy;
+
+  /* publish the whole frame at once */
   CLIB_MEMORY_BARRIER ();
   rxvq->used->idx = rxvq->last_used_idx;
   vhost_user_log_dirty_ring (vui, rxvq, idx);
+  if (vui->features & (1 << FEAT_VIRTIO_RING_F_EVENT_IDX))
+    vhost_user_suppress_notify (rxvq);
 
   /* interrupt (call) handling */
-  if ((rxvq->callfd > -1) && !(rxvq->avail->flags & 1))
+  if ((rxvq->callfd > -1) && vhost_user_want_call (vui, rxvq))
     {
       rxvq->n_since_last_int += n_packets - n_left;
 
@@ -1657,10 +2196,10 @@ done:
     }
 
 done2:
+  if (PREDICT_FALSE (rxvq->lockp != 0))
+    *rxvq->lockp = 0;
 
-  if (PREDICT_FALSE (vui->lockp != 0))
-    *vui->lockp = 0;
-
+done3:
   if (PREDICT_FALSE (n_left && error != VHOST_USER_TX_FUNC_ERROR_NONE))
     {
       vlib_error_count (vm, node->node_index, error, n_left);
@@ -1693,6 +2232,27 @@ vhost_user_interface_admin_up_down (vnet_main_t * vnm, u32 hw_if_index,
   return /* no error */ 0;
 }
 
+static void
+vhost_user_set_interface_next_node (vnet_main_t * vnm, u32 hw_if_index,
+				    u32 node_index)
+{
+  vhost_user_main_t *vum = &vhost_user_main;
+  vnet_hw_interface_t *hw = vnet_get_hw_interface (vnm, hw_if_index);
+  vhost_user_intf_t *vui =
+    vec_elt_at_index (vum->vhost_user_interfaces, hw->dev_instance);
+
+  /* Shut off redirection */
+  if (node_index == ~0)
+    {
+      vui->per_interface_next_index = node_index;
+      return;
+    }
+
+  vui->per_interface_next_index =
+    vlib_node_add_next (vlib_get_main (), vhost_user_input_node.index,
+			node_index);
+}
+
 /* *INDENT-OFF* */
 VNET_DEVICE_CLASS (vhost_user_dev_class,static) = {
   .name = "vhost-user",
@@ -1702,6 +2262,7 @@ VNET_DEVICE_CLASS (vhost_user_dev_class,static) = {
   .format_device_name = format_vhost_user_interface_name,
   .name_renumber = vhost_user_name_renumber,
   .admin_up_down_function = vhost_user_interface_admin_up_down,
+  .rx_redirect_to_node = vhost_user_set_interface_next_node,
   .no_flatten_output_chains = 1,
 };
 
@@ -1780,7 +2341,11 @@ vhost_user_process (vlib_main_t * vm,
 	      getsockopt (vui->unix_fd, SOL_SOCKET, SO_ERROR, &error, &len);
 
 	    if (retval)
-	      vhost_user_if_disconnect (vui);
+	      {
+		vlib_worker_thread_barrier_sync (vm);
+		vhost_user_if_disconnect (vui);
+		vlib_worker_thread_barrier_release (vm);
+	      }
 	  }
       }
     }
@@ -1830,6 +2395,23 @@ vhost_user_delete_if (vnet_main_t * vnm, vlib_main_t * vm, u32 sw_if_index)
   return rv;
 }
 
+int
+vhost_user_set_zero_copy (vnet_main_t * vnm, u32 sw_if_index, u8 enable)
+{
+  vhost_user_main_t *vum = &vhost_user_main;
+  vhost_user_intf_t *vui;
+  uword *p;
+
+  p = hash_get (vum->vhost_user_interface_index_by_sw_if_index, sw_if_index);
+  if (p == 0)
+    return VNET_API_ERROR_INVALID_SW_IF_INDEX;
+
+  /* packets already in flight keep their descriptors until freed */
+  vui = vec_elt_at_index (vum->vhost_user_interfaces, p[0]);
+  vui->zero_copy = enable;
+  return 0;
+}
+
 // init server socket on specified sock_filename
 static int
 vhost_user_init_server_sock (const char *sock_filename, int *sockfd)
@@ -1901,7 +2483,8 @@ vhost_user_vui_new ()
 
   // vui was not retrieved from inactive ifaces - create new
   if (!vui)
-    vec_add2 (vum->vhost_user_interfaces, vui, 1);
+    vec_add2_aligned (vum->vhost_user_interfaces, vui, 1,
+		      CLIB_CACHE_LINE_BYTES);
   return vui;
 }
 
@@ -1942,6 +2525,7 @@ vhost_user_create_ethernet (vnet_main_t * vnm, vlib_main_t * vm,
 
   vnet_hw_interface_t *hi = vnet_get_hw_interface (vnm, vui->hw_if_index);
   hi->max_l3_packet_bytes[VLIB_RX] = hi->max_l3_packet_bytes[VLIB_TX] = 9000;
+  vui->per_interface_next_index = ~0;
 }
 
 // initialize vui with specified attributes
@@ -1968,25 +2552,33 @@ vhost_user_vui_init (vnet_main_t * vnm,
   vui->active = 1;
   vui->unix_file_index = ~0;
   vui->log_base_addr = 0;
+  vui->zero_copy = 0;
 
-  for (q = 0; q < 2; q++)
+  for (q = 0; q < VHOST_VRING_MAX_N; q++)
     {
       vui->vrings[q].enabled = 0;
       vui->vrings[q].callfd = -1;
       vui->vrings[q].kickfd = -1;
+      vui->vrings[q].n_rx_packets = 0;
+      vui->vrings[q].n_zc_packets = 0;
+      vui->vrings[q].n_zc_pending = 0;
+
+      /* threads may share a vring for transmit */
+      if (tm->n_vlib_mains > 1 && (q & 1) == 0 && !vui->vrings[q].lockp)
+	{
+	  vui->vrings[q].lockp =
+	    clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
+				    CLIB_CACHE_LINE_BYTES);
+	  memset ((void *) vui->vrings[q].lockp, 0, CLIB_CACHE_LINE_BYTES);
+	}
     }
 
+  vec_validate_init_empty (vui->per_cpu_tx_qid, tm->n_vlib_mains - 1, 0);
+
   vnet_hw_interface_set_flags (vnm, vui->hw_if_index, 0);
 
   if (sw_if_index)
     *sw_if_index = vui->sw_if_index;
-
-  if (tm->n_vlib_mains > 1)
-    {
-      vui->lockp = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
-					   CLIB_CACHE_LINE_BYTES);
-      memset ((void *) vui->lockp, 0, CLIB_CACHE_LINE_BYTES);
-    }
 }
 
 // register vui and start polling on it
@@ -1995,23 +2587,23 @@ vhost_user_vui_register (vlib_main_t * vm, vhost_user_intf_t * vui)
 {
   vhost_user_main_t *vum = &vhost_user_main;
   int cpu_index;
-  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  u32 qid;
 
   hash_set (vum->vhost_user_interface_index_by_listener_fd, vui->unix_fd,
 	    vui - vum->vhost_user_interfaces);
   hash_set (vum->vhost_user_interface_index_by_sw_if_index, vui->sw_if_index,
 	    vui - vum->vhost_user_interfaces);
 
-  /* start polling */
-  cpu_index = vum->input_cpu_first_index +
-    (vui - vum->vhost_user_interfaces) % vum->input_cpu_count;
-
-  if (tm->n_vlib_mains == 1)
-    vlib_node_set_state (vm, vhost_user_input_node.index,
-			 VLIB_NODE_STATE_POLLING);
-  else
-    vlib_node_set_state (vlib_mains[cpu_index], vhost_user_input_node.index,
-			 VLIB_NODE_STATE_POLLING);
+  /* queue pairs spread over the workers starting at a different worker
+     for each interface; a worker polls once the guest enables one */
+  for (qid = 0; qid < VHOST_VRING_MAX_QUEUE_PAIRS; qid++)
+    {
+      cpu_index = vum->input_cpu_first_index +
+	(vui - vum->vhost_user_interfaces + qid) % vum->input_cpu_count;
+      vui->vrings[VHOST_VRING_IDX_TX (qid)].input_cpu_index = cpu_index;
+    }
+  vhost_user_tx_thread_placement (vui);
+  vhost_user_update_input_node_state ();
 
   /* tell process to start polling for sockets */
   vlib_process_signal_event (vm, vhost_user_process_node.index, 0, 0);
@@ -2122,6 +2714,7 @@ vhost_user_connect_command_fn (vlib_main_t * vm,
   u32 custom_dev_instance = ~0;
   u8 hwaddr[6];
   u8 *hw = NULL;
+  u8 zero_copy = 0;
 
   /* Get a line of input. */
   if (!unformat_user (input, unformat_line_input, line_input))
@@ -2143,6 +2736,8 @@ vhost_user_connect_command_fn (vlib_main_t * vm,
 	{
 	  renumber = 1;
 	}
+      else if (unformat (line_input, "zero-copy"))
+	zero_copy = 1;
       else
 	return clib_error_return (0, "unknown input `%U'",
 				  format_unformat_error, input);
@@ -2160,6 +2755,9 @@ vhost_user_connect_command_fn (vlib_main_t * vm,
       return clib_error_return (0, "vhost_user_create_if returned %d", rv);
     }
 
+  if (zero_copy)
+    vhost_user_set_zero_copy (vnm, sw_if_index, 1);
+
   vec_free (sock_filename);
   vlib_cli_output (vm, "%U\n", format_vnet_sw_if_index_name, vnet_get_main (),
 		   sw_if_index);
@@ -2331,6 +2929,15 @@ show_vhost_user_command_fn (vlib_main_t * vm,
 		       vui->sock_is_server ? "server" : "client",
 		       strerror (vui->sock_errno));
 
+      if (vui->zero_copy)
+	vlib_cli_output (vm, " zero-copy receive enabled\n");
+
+      vlib_cli_output (vm, " tx placement:");
+      for (j = 0; j < vec_len (vui->per_cpu_tx_qid); j++)
+	vlib_cli_output (vm, "   thread %d on queue pair %d", j,
+			 vui->per_cpu_tx_qid[j]);
+      vlib_cli_output (vm, "\n");
+
       vlib_cli_output (vm, " Memory regions (total %d)\n", vui->nregions);
 
       if (vui->nregions)
@@ -2360,6 +2967,16 @@ show_vhost_user_command_fn (vlib_main_t * vm,
 			   vui->vrings[q].qsz, vui->vrings[q].last_avail_idx,
 			   vui->vrings[q].last_used_idx);
 
+	  if (q & 1)
+	    vlib_cli_output (vm, "  polled by thread %d, %llu packets\n",
+			     vui->vrings[q].input_cpu_index,
+			     vui->vrings[q].n_rx_packets);
+
+	  if ((q & 1) && vui->vrings[q].n_zc_packets)
+	    vlib_cli_output (vm, "  zero-copy %llu packets, %u pending\n",
+			     vui->vrings[q].n_zc_packets,
+			     vui->vrings[q].n_zc_pending);
+
 	  if (vui->vrings[q].avail && vui->vrings[q].used)
 	    vlib_cli_output (vm,
 			     "  avail.flags %x avail.idx %d used.flags %x used.idx %d\n",
@@ -2402,6 +3019,356 @@ done:
   return error;
 }
 
+/*
+ * Loopback benchmark
+ *
+ * A driver stub plays the guest. It takes a chunk of process memory as
+ * guest memory, lays out the vrings of each queue pair in it, keeps the
+ * guest tx vrings full of frames and the guest rx vrings full of empty
+ * buffers. Received packets are redirected to the interface's own tx
+ * node, so each frame crosses vhost-user-input and the tx function and
+ * nothing else.
+ */
+
+#define VHOST_USER_BENCH_BUF_SIZE 2048
+#define VHOST_USER_BENCH_MAX_FRAME 9216
+
+typedef struct
+{
+  vring_desc_t *desc;
+  vring_avail_t *avail;
+  vring_used_t *used;
+
+  /* driver side indices */
+  u16 avail_idx;
+  u16 used_idx;
+
+  u64 n_packets;
+  u64 n_kicks;
+  int callfd;
+} vhost_user_bench_vring_t;
+
+static uword
+vhost_user_bench_vring_bytes (u32 qsz, u32 buf_size)
+{
+  return qsz * sizeof (vring_desc_t)
+    + round_pow2 (4 + 2 * qsz + 2, CLIB_CACHE_LINE_BYTES)
+    + round_pow2 (4 + 8 * qsz + 2, CLIB_CACHE_LINE_BYTES)
+    + qsz * buf_size;
+}
+
+static u8 *
+vhost_user_bench_vring_init (vhost_user_bench_vring_t * bv, u8 * p,
+			     u32 qsz, u32 buf_size, int is_tx,
+			     u32 frame_size)
+{
+  u8 *bufs;
+  u32 i;
+
+  bv->desc = (vring_desc_t *) p;
+  p += qsz * sizeof (vring_desc_t);
+  bv->avail = (vring_avail_t *) p;
+  p += round_pow2 (4 + 2 * qsz + 2, CLIB_CACHE_LINE_BYTES);
+  bv->used = (vring_used_t *) p;
+  p += round_pow2 (4 + 8 * qsz + 2, CLIB_CACHE_LINE_BYTES);
+  bufs = p;
+  p += qsz * buf_size;
+
+  for (i = 0; i < qsz; i++)
+    {
+      u8 *b = bufs + i * buf_size;
+      bv->desc[i].addr = pointer_to_uword (b);
+      if (is_tx)
+	{
+	  ethernet_header_t *e;
+	  e = (ethernet_header_t *) (b + sizeof (virtio_net_hdr_mrg_rxbuf_t));
+	  memset (e->dst_address, 0xff, sizeof (e->dst_address));
+	  e->src_address[0] = 2;
+	  e->type = clib_host_to_net_u16 (ETHERNET_TYPE_IP4);
+	  bv->desc[i].len = sizeof (virtio_net_hdr_mrg_rxbuf_t) + frame_size;
+	  bv->desc[i].flags = 0;
+	}
+      else
+	{
+	  bv->desc[i].len = buf_size;
+	  bv->desc[i].flags = VIRTQ_DESC_F_WRITE;
+	}
+      bv->avail->ring[i] = i;
+    }
+
+  /* every descriptor is posted, the first poll publishes them */
+  bv->avail_idx = qsz;
+  bv->callfd = eventfd (0, EFD_NONBLOCK);
+  return p;
+}
+
+/*
+ * Reap what the device used and post the descriptors again, in the
+ * order the device gave them back.
+ */
+static void
+vhost_user_bench_vring_poll (vhost_user_bench_vring_t * bv, u32 qsz,
+			     int event_idx, int interrupts)
+{
+  u16 used_idx = *(volatile u16 *) &bv->used->idx;
+  u16 old = bv->avail->idx;
+  int kick;
+
+  CLIB_MEMORY_BARRIER ();
+  while (bv->used_idx != used_idx)
+    {
+      bv->avail->ring[bv->avail_idx & (qsz - 1)] =
+	bv->used->ring[bv->used_idx & (qsz - 1)].id;
+      bv->avail_idx++;
+      bv->used_idx++;
+      bv->n_packets++;
+    }
+
+  /* ask for a call on the next used entry, or for no calls at all */
+  if (interrupts)
+    {
+      bv->avail->flags = 0;
+      vring_used_event (bv->avail, qsz) = used_idx;
+    }
+  else
+    bv->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+
+  CLIB_MEMORY_BARRIER ();
+  bv->avail->idx = bv->avail_idx;
+
+  if (bv->avail_idx == old)
+    return;
+
+  /* count the kicks a real driver would have had to make */
+  CLIB_MEMORY_BARRIER ();
+  if (event_idx)
+    kick = vhost_user_vring_need_event
+      (vring_avail_event (bv->used, qsz), bv->avail_idx, old);
+  else
+    kick = !(bv->used->flags & VRING_USED_F_NO_NOTIFY);
+  bv->n_kicks += kick;
+}
+
+static clib_error_t *
+vhost_user_bench_command_fn (vlib_main_t * vm,
+			     unformat_input_t * input,
+			     vlib_cli_command_t * cmd)
+{
+  vnet_main_t *vnm = vnet_get_main ();
+  vhost_user_intf_t *vui;
+  vhost_user_bench_vring_t *bvs = 0, *rx, *tx;
+  vnet_hw_interface_t *hi;
+  u32 n_queues = 1, qsz = 256, frame_size = 64, sw_if_index, qid, i;
+  u32 buf_size;
+  int event_idx = 0, interrupts = 0, xconnect = 0, zero_copy = 0;
+  f64 duration = 1.0, t0, t1;
+  u64 n_rx = 0, n_tx = 0, n_calls = 0, n_kicks = 0;
+  uword mem_size;
+  u8 *mem, *p;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "queues %d", &n_queues))
+	;
+      else if (unformat (input, "ring-size %d", &qsz))
+	;
+      else if (unformat (input, "size %d", &frame_size))
+	;
+      else if (unformat (input, "time %f", &duration))
+	;
+      else if (unformat (input, "event-idx"))
+	event_idx = 1;
+      else if (unformat (input, "interrupts"))
+	interrupts = 1;
+      else if (unformat (input, "xconnect"))
+	xconnect = 1;
+      else if (unformat (input, "zero-copy"))
+	xconnect = zero_copy = 1;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_queues < 1 || n_queues > VHOST_VRING_MAX_QUEUE_PAIRS)
+    return clib_error_return (0, "queues must be 1 to %d",
+			      VHOST_VRING_MAX_QUEUE_PAIRS);
+  if (qsz < 2 || qsz > VHOST_VRING_MAX_SIZE || !is_pow2 (qsz))
+    return clib_error_return (0, "ring-size must be a power of 2 up to %d",
+			      VHOST_VRING_MAX_SIZE);
+  if (frame_size < 60 || frame_size > VHOST_USER_BENCH_MAX_FRAME)
+    return clib_error_return (0, "size must be 60 to %d",
+			      VHOST_USER_BENCH_MAX_FRAME);
+
+  /* guest tx frames always fit in a single descriptor */
+  buf_size = round_pow2 (frame_size + sizeof (virtio_net_hdr_mrg_rxbuf_t),
+			 CLIB_CACHE_LINE_BYTES);
+  buf_size = clib_max (buf_size, VHOST_USER_BENCH_BUF_SIZE);
+
+  mem_size = 2 * n_queues * vhost_user_bench_vring_bytes (qsz, buf_size);
+  mem = mmap (0, mem_size, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return clib_error_return_unix (0, "mmap");
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  vui = vhost_user_vui_new ();
+  vhost_user_create_ethernet (vnm, vm, vui, 0);
+  /* a server which never listens is left alone by vhost-user-process */
+  vhost_user_vui_init (vnm, vui, -1, "loopback", 1 /* is_server */ ,
+		       (u64) ~ 0, &sw_if_index);
+
+  vui->nregions = 1;
+  vui->regions[0].guest_phys_addr = pointer_to_uword (mem);
+  vui->regions[0].userspace_addr = pointer_to_uword (mem);
+  vui->regions[0].memory_size = mem_size;
+  vui->regions[0].mmap_offset = 0;
+  vui->region_mmap_addr[0] = mem;
+  vui->region_mmap_fd[0] = -1;
+  vui->region_guest_addr_lo[0] = pointer_to_uword (mem);
+  vui->region_guest_addr_hi[0] = pointer_to_uword (mem) + mem_size;
+
+  vui->features = (1 << FEAT_VIRTIO_NET_F_MRG_RXBUF) |
+    (1 << FEAT_VIRTIO_F_ANY_LAYOUT) | (1 << FEAT_VIRTIO_NET_F_MQ) |
+    (1ULL << FEAT_VIRTIO_F_VERSION_1);
+  if (event_idx)
+    vui->features |= (1 << FEAT_VIRTIO_RING_F_EVENT_IDX);
+  vui->virtio_net_hdr_sz = sizeof (virtio_net_hdr_mrg_rxbuf_t);
+  vui->is_any_layout = 1;
+  vui->num_vrings = 2 * n_queues;
+
+  vec_validate (bvs, 2 * n_queues - 1);
+  p = mem;
+  for (i = 0; i < 2 * n_queues; i++)
+    {
+      vhost_user_vring_t *vq = &vui->vrings[i];
+      /* odd vrings carry guest tx */
+      p = vhost_user_bench_vring_init (bvs + i, p, qsz, buf_size, i & 1,
+				       frame_size);
+      vq->qsz = qsz;
+      vq->desc = bvs[i].desc;
+      vq->avail = bvs[i].avail;
+      vq->used = bvs[i].used;
+      vq->last_avail_idx = vq->last_used_idx = vq->last_call_used_idx = 0;
+      vq->n_since_last_int = 0;
+      vq->callfd = bvs[i].callfd;
+      vq->enabled = 1;
+      vq->used->flags = VRING_USED_F_NO_NOTIFY;
+      if (event_idx)
+	vhost_user_suppress_notify (vq);
+    }
+
+  vhost_user_vui_register (vm, vui);
+  vui->is_up = 1;
+  hi = vnet_get_hw_interface (vnm, vui->hw_if_index);
+  vnet_hw_interface_set_flags (vnm, vui->hw_if_index,
+			       VNET_HW_INTERFACE_FLAG_LINK_UP);
+  vnet_sw_interface_set_flags (vnm, sw_if_index,
+			       VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+  /* either straight back to tx, or the long way through l2 */
+  if (xconnect)
+    {
+      vlib_node_t *n = vlib_get_node_by_name (vm, (u8 *) "l2-output");
+      set_int_l2_mode (vm, vnm, MODE_L2_XC, sw_if_index, 0, 0, 0,
+		       sw_if_index);
+      /* add the l2-output arc now rather than from a worker */
+      l2output_get_output_node (vm, vnm, n->index, sw_if_index,
+				&l2output_main.next_nodes.
+				output_node_index_vec);
+    }
+  else
+    vnet_hw_interface_rx_redirect_to_node (vnm, vui->hw_if_index,
+					   hi->tx_node_index);
+  if (zero_copy)
+    vhost_user_set_zero_copy (vnm, sw_if_index, 1);
+
+  vlib_worker_thread_barrier_release (vm);
+
+  t0 = vlib_time_now (vm);
+  do
+    {
+      vec_foreach (rx, bvs)
+	vhost_user_bench_vring_poll (rx, qsz, event_idx, interrupts);
+      vlib_process_suspend (vm, 10e-6);
+      t1 = vlib_time_now (vm);
+    }
+  while (t1 - t0 < duration);
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  /* device counts stop here */
+  vec_foreach (rx, bvs)
+    vhost_user_bench_vring_poll (rx, qsz, event_idx, interrupts);
+  t1 = vlib_time_now (vm);
+
+  vlib_cli_output (vm, "%d queue pairs, ring size %d, %d byte frames, "
+		   "%.2f sec%s%s%s%s", n_queues, qsz, frame_size, t1 - t0,
+		   event_idx ? ", event-idx" : "",
+		   interrupts ? ", interrupts" : "",
+		   xconnect ? ", xconnect" : "",
+		   zero_copy ? ", zero-copy" : "");
+  vlib_cli_output (vm, "%5s %7s %12s %12s %9s %9s %9s %9s", "queue",
+		   "thread", "rx", "tx", "rx Mpps", "tx Mpps", "calls",
+		   "kicks");
+
+  for (qid = 0; qid < n_queues; qid++)
+    {
+      u64 calls[2] = { 0, 0 };
+      int rv __attribute__ ((unused));
+
+      rx = bvs + VHOST_VRING_IDX_RX (qid);
+      tx = bvs + VHOST_VRING_IDX_TX (qid);
+      rv = read (rx->callfd, &calls[0], sizeof (calls[0]));
+      rv = read (tx->callfd, &calls[1], sizeof (calls[1]));
+
+      /* guest tx is what the device received and the other way round */
+      vlib_cli_output (vm, "%5d %7d %12llu %12llu %9.2f %9.2f %9llu %9llu",
+		       qid,
+		       vui->vrings[VHOST_VRING_IDX_TX (qid)].input_cpu_index,
+		       tx->n_packets, rx->n_packets,
+		       tx->n_packets / (t1 - t0) * 1e-6,
+		       rx->n_packets / (t1 - t0) * 1e-6,
+		       calls[0] + calls[1], rx->n_kicks + tx->n_kicks);
+      n_rx += tx->n_packets;
+      n_tx += rx->n_packets;
+      n_calls += calls[0] + calls[1];
+      n_kicks += rx->n_kicks + tx->n_kicks;
+    }
+  vlib_cli_output (vm, "%5s %7s %12llu %12llu %9.2f %9.2f %9llu %9llu",
+		   "total", "", n_rx, n_tx, n_rx / (t1 - t0) * 1e-6,
+		   n_tx / (t1 - t0) * 1e-6, n_calls, n_kicks);
+  if (zero_copy)
+    {
+      u64 n_zc = 0;
+      for (qid = 0; qid < n_queues; qid++)
+	n_zc += vui->vrings[VHOST_VRING_IDX_TX (qid)].n_zc_packets;
+      vlib_cli_output (vm, "%llu packets received zero-copy", n_zc);
+    }
+
+  /* tear down, leaving nothing for disconnect to close or unmap */
+  if (xconnect)
+    set_int_l2_mode (vm, vnm, MODE_L3, sw_if_index, 0, 0, 0, 0);
+  else
+    vnet_hw_interface_rx_redirect_to_node (vnm, vui->hw_if_index, ~0);
+  vnet_sw_interface_set_flags (vnm, sw_if_index, 0);
+  for (i = 0; i < 2 * n_queues; i++)
+    {
+      close (bvs[i].callfd);
+      vui->vrings[i].callfd = -1;
+      vui->vrings[i].desc = 0;
+      vui->vrings[i].avail = 0;
+      vui->vrings[i].used = 0;
+    }
+  vui->nregions = 0;
+  vhost_user_delete_if (vnm, vm, sw_if_index);
+
+  vlib_worker_thread_barrier_release (vm);
+
+  munmap (mem, mem_size);
+  vec_free (bvs);
+  return 0;
+}
+
 /*
  * CLI functions
  */
@@ -2409,7 +3376,7 @@ done:
 /* *INDENT-OFF* */
 VLIB_CLI_COMMAND (vhost_user_connect_command, static) = {
     .path = "create vhost-user",
-    .short_help = "create vhost-user socket <socket-filename> [server] [feature-mask <hex>] [renumber <dev_instance>]",
+    .short_help = "create vhost-user socket <socket-filename> [server] [feature-mask <hex>] [renumber <dev_instance>] [zero-copy]",
     .function = vhost_user_connect_command_fn,
 };
 
@@ -2424,6 +3391,15 @@ VLIB_CLI_COMMAND (show_vhost_user_command, static) = {
     .short_help = "show vhost-user interface",
     .function = show_vhost_user_command_fn,
 };
+
+VLIB_CLI_COMMAND (vhost_user_bench_command, static) = {
+    .path = "test vhost-user loopback",
+    .short_help = "test vhost-user loopback [queues <n>] [ring-size <n>] "
+    "[size <bytes>] [time <sec>] [event-idx] [interrupts] [xconnect] "
+    "[zero-copy]",
+    .function = vhost_user_bench_command_fn,
+    .is_mp_safe = 1,
+};
 /* *INDENT-ON* */
 
 static clib_error_t *
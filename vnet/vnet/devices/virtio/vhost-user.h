@@ -23,8 +23,18 @@
 #define VHOST_NET_VRING_IDX_TX          1
 #define VHOST_NET_VRING_NUM             2
 
+/* Queue pair qid uses vring 2*qid (host to guest, "rx" from the guest's
+   point of view) and vring 2*qid+1 (guest to host). */
+#define VHOST_VRING_MAX_N               16
+#define VHOST_VRING_MAX_QUEUE_PAIRS     (VHOST_VRING_MAX_N / 2)
+#define VHOST_VRING_IDX_RX(qid)         (2 * (qid))
+#define VHOST_VRING_IDX_TX(qid)         (2 * (qid) + 1)
+
 #define VIRTQ_DESC_F_NEXT               1
+#define VIRTQ_DESC_F_WRITE              2
 #define VIRTQ_DESC_F_INDIRECT           4
+#define VRING_AVAIL_F_NO_INTERRUPT      1
+#define VRING_USED_F_NO_NOTIFY          1
 #define VHOST_USER_REPLY_MASK       (0x1 << 2)
 
 #define VHOST_USER_PROTOCOL_F_MQ   0
@@ -51,6 +61,8 @@
  _ (VIRTIO_F_INDIRECT_DESC, 28)         \
  _ (VHOST_F_LOG_ALL, 26)                \
  _ (VIRTIO_NET_F_GUEST_ANNOUNCE, 21)    \
+ _ (VIRTIO_NET_F_MQ, 22)                \
+ _ (VIRTIO_RING_F_EVENT_IDX, 29)        \
  _ (VHOST_USER_F_PROTOCOL_FEATURES, 30) \
  _ (VIRTIO_F_VERSION_1, 32)
 
@@ -72,6 +84,8 @@ int vhost_user_modify_if (vnet_main_t * vnm, vlib_main_t * vm,
 			  u8 renumber, u32 custom_dev_instance);
 int vhost_user_delete_if (vnet_main_t * vnm, vlib_main_t * vm,
 			  u32 sw_if_index);
+int vhost_user_set_zero_copy (vnet_main_t * vnm, u32 sw_if_index,
+			      u8 enable);
 
 typedef struct vhost_user_memory_region
 {
@@ -204,12 +218,40 @@ typedef struct
   u32 callfd_idx;
   u32 n_since_last_int;
   f64 int_deadline;
+
+  /* used idx when the driver was last called, for event_idx */
+  u16 last_call_used_idx;
+
+  /* Serializes transmit when several threads share this vring */
+  volatile u32 *lockp;
+
+  /* Guest to host vrings only: worker polling the vring, and packets
+     received from it so far */
+  u32 input_cpu_index;
+  u64 n_rx_packets;
+
+  /* Guest to host vrings only: packets whose payload was left in guest
+     memory, and how many of them still hold their descriptors */
+  u64 n_zc_packets;
+  u32 n_zc_pending;
 } vhost_user_vring_t;
 
+/* With VIRTIO_RING_F_EVENT_IDX the driver's used_event follows the avail
+   ring and the device's avail_event follows the used ring. */
+#define vring_used_event(avail, qsz) \
+  (*(volatile u16 *) &(avail)->ring[(qsz)])
+#define vring_avail_event(used, qsz) \
+  (*(volatile u16 *) ((u8 *) (used)->ring + (qsz) * sizeof ((used)->ring[0])))
+
+always_inline int
+vhost_user_vring_need_event (u16 event, u16 new, u16 old)
+{
+  return (u16) (new - event - 1) < (u16) (new - old);
+}
+
 typedef struct
 {
   CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
-  volatile u32 *lockp;
   u32 is_up;
   u32 admin_up;
   u32 unix_fd;
@@ -231,18 +273,37 @@ typedef struct
   u64 region_guest_addr_lo[VHOST_MEMORY_MAX_NREGIONS];
   u64 region_guest_addr_hi[VHOST_MEMORY_MAX_NREGIONS];
   u32 region_mmap_fd[VHOST_MEMORY_MAX_NREGIONS];
-  vhost_user_vring_t vrings[2];
+  vhost_user_vring_t vrings[VHOST_VRING_MAX_N];
   int virtio_net_hdr_sz;
   int is_any_layout;
   u32 *d_trace_buffers;
 
   void *log_base_addr;
   u64 log_size;
+
+  /* Queue pair each thread transmits on */
+  u32 *per_cpu_tx_qid;
+
+  /* Next node for received packets, ~0 for the default */
+  u32 per_interface_next_index;
+
+  /* Leave the payload of large received packets in guest memory while
+     the interface is cross-connected to another vhost-user interface */
+  u8 zero_copy;
 } vhost_user_intf_t;
 
+typedef struct
+{
+  uword dst;
+  uword src;
+  u32 len;
+  u64 dst_guest_addr;
+} vhost_copy_t;
+
 typedef struct
 {
   u32 **rx_buffers;
+  vhost_copy_t **tx_copy;
   u32 mtu_bytes;
   vhost_user_intf_t *vhost_user_interfaces;
   u32 *vhost_user_inactive_interfaces_index;
@@ -259,6 +320,11 @@ typedef struct
 
   /* total cpu count */
   u32 input_cpu_count;
+
+  /* Zero-copy: per thread free list which zero-copy buffers are freed
+     to, and buffers on their way back to their own lists */
+  u32 *zc_free_list_index_by_cpu;
+  u32 **zc_recycled;
 } vhost_user_main_t;
 
 typedef struct
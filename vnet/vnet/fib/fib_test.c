@@ -6631,6 +6631,213 @@ lfib_test_deagg (void)
              lb_count+1, pool_elts(load_balance_pool));
 }
 
+/*
+ * Approximate prefix length distribution of the IPv6 BGP table, in
+ * percent.
+ */
+static const struct {
+    u8 length;
+    u8 percent;
+} fib_test_v6_length_mix[] = {
+    { 19, 1 }, { 20, 1 }, { 24, 1 }, { 28, 1 }, { 29, 4 }, { 30, 1 },
+    { 31, 1 }, { 32, 17 }, { 33, 2 }, { 34, 1 }, { 35, 1 }, { 36, 4 },
+    { 38, 1 }, { 40, 5 }, { 42, 1 }, { 44, 6 }, { 45, 1 }, { 46, 3 },
+    { 47, 2 }, { 48, 44 }, { 56, 1 }, { 64, 1 },
+};
+
+static u32
+fib_test_v6_random_len (u32 *seed)
+{
+    u32 r = random_u32(seed) % 100;
+    u32 i, sum = 0;
+
+    for (i = 0; i < ARRAY_LEN(fib_test_v6_length_mix); i++)
+    {
+	sum += fib_test_v6_length_mix[i].percent;
+	if (r < sum)
+	    return (fib_test_v6_length_mix[i].length);
+    }
+    return (48);
+}
+
+/*
+ * A random global unicast address, i.e. in 2000::/3. If a prefix is
+ * given the address is within it.
+ */
+static void
+fib_test_v6_random_addr (ip6_address_t *a,
+			 const fib_prefix_t *within,
+			 u32 *seed)
+{
+    const ip6_address_t *mask;
+    int i;
+
+    for (i = 0; i < ARRAY_LEN(a->as_u32); i++)
+	a->as_u32[i] = random_u32(seed);
+    a->as_u8[0] = 0x20 | (a->as_u8[0] & 0x1f);
+
+    if (NULL != within)
+    {
+	mask = &ip6_main.fib_masks[within->fp_len];
+	for (i = 0; i < ARRAY_LEN(a->as_u64); i++)
+	    a->as_u64[i] = ((a->as_u64[i] & ~mask->as_u64[i]) |
+			    (within->fp_addr.ip6.as_u64[i] & mask->as_u64[i]));
+    }
+}
+
+/*
+ * Compare each algorithm's forwarding lookup with the FIB's own
+ * longest prefix match, and count the hash probes made.
+ */
+static int
+fib_test_v6_lookup_check (u32 fib_index,
+			  const ip6_address_t *addrs,
+			  f64 *probes_per_lookup)
+{
+    ip6_fib_fwding_lookup_algo_t algo;
+    fib_prefix_t pfx = {
+	.fp_len = 128,
+	.fp_proto = FIB_PROTOCOL_IP6,
+    };
+    u32 i, lbi, n_probes, n_bad = 0;
+    fib_node_index_t fei;
+
+    for (algo = IP6_FIB_FWDING_LOOKUP_LINEAR;
+	 algo <= IP6_FIB_FWDING_LOOKUP_BINARY;
+	 algo++)
+    {
+	n_probes = 0;
+	for (i = 0; i < vec_len(addrs); i++)
+	{
+	    pfx.fp_addr.ip6 = addrs[i];
+	    fei = fib_table_lookup(fib_index, &pfx);
+	    lbi = ip6_fib_table_fwding_lookup_with_algo(&ip6_main, fib_index,
+							&addrs[i], algo,
+							&n_probes);
+	    if (lbi != fib_entry_contribute_ip_forwarding(fei)->dpoi_index)
+		n_bad++;
+	}
+	probes_per_lookup[algo] = (f64)n_probes / vec_len(addrs);
+    }
+    return (n_bad);
+}
+
+/*
+ * Load a table shaped like the IPv6 BGP table into a FIB and compare
+ * the linear and the binary search on prefix lengths: each must agree
+ * with the FIB, before and after half the routes are withdrawn; then
+ * report probes per lookup and lookup rate.
+ */
+static void
+fib_test_v6_lookup (u32 n_routes,
+		    u32 n_lookups,
+		    u32 n_iter,
+		    u32 seed)
+{
+    static const char *algo_names[] = {
+	[IP6_FIB_FWDING_LOOKUP_LINEAR] = "linear",
+	[IP6_FIB_FWDING_LOOKUP_BINARY] = "binary",
+    };
+    ip6_fib_fwding_lookup_algo_t algo, saved_algo;
+    vlib_main_t *vm = vlib_get_main();
+    ip6_main_t *im = &ip6_main;
+    fib_prefix_t *pfxs = NULL, pfx = {
+	.fp_proto = FIB_PROTOCOL_IP6,
+    };
+    ip6_address_t *addrs = NULL, addr;
+    f64 probes[2], before, delta;
+    u32 fib_index, i, j, sum;
+
+    saved_algo = im->fwding_lookup_algo;
+    ip6_fib_table_fwding_lookup_algo_set(IP6_FIB_FWDING_LOOKUP_BINARY);
+
+    fib_index = fib_table_find_or_create_and_lock(FIB_PROTOCOL_IP6, 12);
+
+    /*
+     * about a third of the routes are more specifics of routes already
+     * present, as in the real table.
+     */
+    for (i = 0; i < n_routes; i++)
+    {
+	const fib_prefix_t *cover = NULL;
+
+	pfx.fp_len = fib_test_v6_random_len(&seed);
+	if (vec_len(pfxs) && random_u32(&seed) % 3 == 0)
+	{
+	    cover = &pfxs[random_u32(&seed) % vec_len(pfxs)];
+	    if (cover->fp_len >= pfx.fp_len)
+		cover = NULL;
+	}
+	fib_test_v6_random_addr(&addr, cover, &seed);
+	ip6_address_mask(&addr, &im->fib_masks[pfx.fp_len]);
+	pfx.fp_addr.ip6 = addr;
+
+	if (FIB_NODE_INDEX_INVALID !=
+	    fib_table_lookup_exact_match(fib_index, &pfx))
+	    continue;
+
+	fib_table_entry_special_add(fib_index, &pfx, FIB_SOURCE_API,
+				    FIB_ENTRY_FLAG_DROP, ADJ_INDEX_INVALID);
+	vec_add1(pfxs, pfx);
+    }
+
+    /* mostly traffic to routed destinations, some to the default route */
+    for (i = 0; i < n_lookups; i++)
+    {
+	fib_test_v6_random_addr(&addr,
+				(random_u32(&seed) % 10 ?
+				 &pfxs[random_u32(&seed) % vec_len(pfxs)] :
+				 NULL),
+				&seed);
+	vec_add1(addrs, addr);
+    }
+
+    FIB_TEST((0 == fib_test_v6_lookup_check(fib_index, addrs, probes)),
+	     "linear and binary lookups agree with the FIB for %d routes",
+	     vec_len(pfxs));
+
+    vlib_cli_output(vm, "%d routes, %d prefix lengths, %d markers",
+		    vec_len(pfxs), vec_len(im->fwding_bsl.lengths),
+		    im->fwding_bsl.n_markers);
+
+    for (algo = IP6_FIB_FWDING_LOOKUP_LINEAR;
+	 algo <= IP6_FIB_FWDING_LOOKUP_BINARY;
+	 algo++)
+    {
+	sum = 0;
+	before = vlib_time_now(vm);
+	for (j = 0; j < n_iter; j++)
+	    for (i = 0; i < vec_len(addrs); i++)
+		sum += ip6_fib_table_fwding_lookup_with_algo(im, fib_index,
+							     &addrs[i], algo,
+							     NULL);
+	delta = vlib_time_now(vm) - before;
+
+	vlib_cli_output(vm, "%-8s %.2f probes/lookup, %.2f Mlookups/s [%x]",
+			algo_names[algo], probes[algo],
+			((f64)n_iter * vec_len(addrs)) / delta / 1e6, sum);
+    }
+
+    /*
+     * withdraw every other route; the markers the survivors rely on
+     * must follow.
+     */
+    for (i = 0; i < vec_len(pfxs); i += 2)
+	fib_table_entry_special_remove(fib_index, &pfxs[i], FIB_SOURCE_API);
+
+    FIB_TEST((0 == fib_test_v6_lookup_check(fib_index, addrs, probes)),
+	     "linear and binary lookups agree with the FIB after withdraws");
+
+    for (i = 1; i < vec_len(pfxs); i += 2)
+	fib_table_entry_special_remove(fib_index, &pfxs[i], FIB_SOURCE_API);
+
+    fib_table_unlock(fib_index, FIB_PROTOCOL_IP6);
+    ip6_fib_table_fwding_lookup_algo_set(saved_algo);
+
+    vec_free(pfxs);
+    vec_free(addrs);
+}
+
 static clib_error_t *
 lfib_test (vlib_main_t * vm, 
            unformat_input_t * input,
@@ -6650,7 +6857,27 @@ fib_test (vlib_main_t * vm,
 {
     fib_test_mk_intf(4);
 
-    if (unformat (input, "ip"))
+    if (unformat (input, "lookup"))
+    {
+	u32 n_routes = 50000, n_lookups = 1 << 16, n_iter = 10;
+	u32 seed = 0xdeaddabe;
+
+	while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+	{
+	    if (unformat (input, "routes %d", &n_routes))
+		;
+	    else if (unformat (input, "lookups %d", &n_lookups))
+		;
+	    else if (unformat (input, "iterations %d", &n_iter))
+		;
+	    else if (unformat (input, "seed %d", &seed))
+		;
+	    else
+		break;
+	}
+	fib_test_v6_lookup(n_routes, n_lookups, n_iter, seed);
+    }
+    else if (unformat (input, "ip"))
     {
 	fib_test_v4();
 	fib_test_v6();
@@ -126,7 +126,7 @@ ip4_create_fib_with_table_id (u32 table_id)
     
     fib_table_lock(fib_table->ft_index, FIB_PROTOCOL_IP4);
 
-    ip4_mtrie_init(&fib_table->v4.mtrie);
+    ip4_mtrie_init(&fib_table->v4.mtrie, ip4_main.mtrie_layout);
 
     /*
      * add the special entries into the new FIB
@@ -184,6 +184,7 @@ ip4_fib_table_destroy (ip4_fib_t *fib)
     {
 	hash_unset (ip4_main.fib_index_by_table_id, fib_table->ft_table_id);
     }
+    ip4_fib_free(&fib->mtrie);
     pool_put(ip4_main.fibs, fib_table);
 }
 
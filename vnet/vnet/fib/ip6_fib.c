@@ -388,18 +388,725 @@ ip6_fib_table_entry_insert (u32 fib_index,
     compute_prefix_lengths_in_search_order (table);
 }
 
-u32 
-ip6_fib_table_fwding_lookup (ip6_main_t * im,
-                             u32 fib_index,
-                             const ip6_address_t * dst)
+/*
+ * Binary search on prefix lengths.
+ *
+ * The value of a BSL hash entry packs the load-balance index of a
+ * prefix, the length of the best matching prefix of a marker, a flag
+ * saying the entry is a prefix, and the number of longer prefixes that
+ * need the entry as a marker.
+ */
+#define IP6_FIB_BSL_LBI_MASK   (0xffffffffULL)
+#define IP6_FIB_BSL_BMP_SHIFT  32
+#define IP6_FIB_BSL_BMP_MASK   (0xffULL << IP6_FIB_BSL_BMP_SHIFT)
+#define IP6_FIB_BSL_IS_PREFIX  (1ULL << 40)
+#define IP6_FIB_BSL_REF_SHIFT  41
+#define IP6_FIB_BSL_REF_ONE    (1ULL << IP6_FIB_BSL_REF_SHIFT)
+
+/*
+ * The deepest search on 129 lengths visits 8 levels, at most 7 of
+ * which are shorter than the target.
+ */
+#define IP6_FIB_BSL_MAX_MARKERS 8
+
+#define IP6_FIB_BSL_NODE_NONE (~0)
+
+always_inline u32
+ip6_fib_bsl_value_bmp (u64 value)
+{
+    return ((value >> IP6_FIB_BSL_BMP_SHIFT) & 0xff);
+}
+
+always_inline u64
+ip6_fib_bsl_value_refs (u64 value)
+{
+    return (value >> IP6_FIB_BSL_REF_SHIFT);
+}
+
+always_inline void
+ip6_fib_bsl_mk_key (BVT(clib_bihash_kv) *kv,
+		    u32 fib_index,
+		    const ip6_address_t *addr,
+		    u32 len)
+{
+    const ip6_address_t *mask = &ip6_main.fib_masks[len];
+
+    kv->key[0] = addr->as_u64[0] & mask->as_u64[0];
+    kv->key[1] = addr->as_u64[1] & mask->as_u64[1];
+    kv->key[2] = ((u64)((fib_index))<<32) | len;
+}
+
+always_inline int
+ip6_fib_bsl_addr_bit (const ip6_address_t *addr, u32 bit)
+{
+    return ((addr->as_u8[bit >> 3] >> (7 - (bit & 7))) & 1);
+}
+
+static u32
+ip6_fib_bsl_common_len (const ip6_address_t *a1,
+			const ip6_address_t *a2,
+			u32 max)
+{
+    u64 x;
+    u32 n;
+
+    x = clib_net_to_host_u64(a1->as_u64[0] ^ a2->as_u64[0]);
+    if (x)
+	count_leading_zeros(n, x);
+    else
+    {
+	x = clib_net_to_host_u64(a1->as_u64[1] ^ a2->as_u64[1]);
+	if (x)
+	{
+	    count_leading_zeros(n, x);
+	    n += 64;
+	}
+	else
+	    n = 128;
+    }
+    return (clib_min(n, max));
+}
+
+/*
+ * The lengths, shorter than len, at which the search for a prefix of
+ * length len probes. Each of them needs a marker.
+ */
+static u32
+ip6_fib_bsl_marker_lengths (const ip6_fib_bsl_t *bsl,
+			    u32 len,
+			    u8 *markers)
+{
+    i32 lo, hi, mid;
+    u32 n = 0;
+
+    lo = 0;
+    hi = vec_len(bsl->lengths) - 1;
+
+    while (lo <= hi)
+    {
+	mid = (lo + hi) >> 1;
+	if (bsl->lengths[mid] == len)
+	    break;
+	if (bsl->lengths[mid] < len)
+	{
+	    markers[n++] = bsl->lengths[mid];
+	    lo = mid + 1;
+	}
+	else
+	    hi = mid - 1;
+    }
+    ASSERT(n <= IP6_FIB_BSL_MAX_MARKERS);
+    return (n);
+}
+
+always_inline u32 *
+ip6_fib_bsl_slot (ip6_fib_bsl_t *bsl,
+		  u32 fib_index,
+		  u32 parent,
+		  u32 side)
+{
+    if (IP6_FIB_BSL_NODE_NONE == parent)
+	return (&bsl->root_by_fib_index[fib_index]);
+    return (&pool_elt_at_index(bsl->nodes, parent)->child[side]);
+}
+
+static u32
+ip6_fib_bsl_node_alloc (ip6_fib_bsl_t *bsl,
+			const ip6_address_t *addr,
+			u32 len,
+			u8 is_prefix)
+{
+    const ip6_address_t *mask = &ip6_main.fib_masks[len];
+    ip6_fib_bsl_node_t *node;
+
+    pool_get(bsl->nodes, node);
+    node->addr.as_u64[0] = addr->as_u64[0] & mask->as_u64[0];
+    node->addr.as_u64[1] = addr->as_u64[1] & mask->as_u64[1];
+    node->len = len;
+    node->is_prefix = is_prefix;
+    node->child[0] = node->child[1] = IP6_FIB_BSL_NODE_NONE;
+
+    return (node - bsl->nodes);
+}
+
+static void
+ip6_fib_bsl_trie_insert (ip6_fib_bsl_t *bsl,
+			 u32 fib_index,
+			 const ip6_address_t *addr,
+			 u32 len)
+{
+    u32 parent, side, ni, new_index, branch_index, common;
+    ip6_fib_bsl_node_t *node, *new;
+
+    vec_validate_init_empty(bsl->root_by_fib_index, fib_index,
+			    IP6_FIB_BSL_NODE_NONE);
+
+    parent = IP6_FIB_BSL_NODE_NONE;
+    side = common = 0;
+    ni = bsl->root_by_fib_index[fib_index];
+
+    while (IP6_FIB_BSL_NODE_NONE != ni)
+    {
+	node = pool_elt_at_index(bsl->nodes, ni);
+	common = ip6_fib_bsl_common_len(&node->addr, addr,
+					clib_min(node->len, len));
+	if (common < node->len)
+	    break;
+	if (node->len == len)
+	{
+	    node->is_prefix = 1;
+	    return;
+	}
+	parent = ni;
+	side = ip6_fib_bsl_addr_bit(addr, node->len);
+	ni = node->child[side];
+    }
+
+    new_index = ip6_fib_bsl_node_alloc(bsl, addr, len, 1);
+
+    if (IP6_FIB_BSL_NODE_NONE == ni)
+    {
+	*ip6_fib_bsl_slot(bsl, fib_index, parent, side) = new_index;
+	return;
+    }
+
+    node = pool_elt_at_index(bsl->nodes, ni);
+
+    if (common == len)
+    {
+	/* the new prefix covers the node */
+	new = pool_elt_at_index(bsl->nodes, new_index);
+	new->child[ip6_fib_bsl_addr_bit(&node->addr, len)] = ni;
+	*ip6_fib_bsl_slot(bsl, fib_index, parent, side) = new_index;
+    }
+    else
+    {
+	/* the two diverge; join them under a branch node */
+	u32 node_bit = ip6_fib_bsl_addr_bit(&node->addr, common);
+
+	branch_index = ip6_fib_bsl_node_alloc(bsl, addr, common, 0);
+	new = pool_elt_at_index(bsl->nodes, branch_index);
+	new->child[node_bit] = ni;
+	new->child[!node_bit] = new_index;
+	*ip6_fib_bsl_slot(bsl, fib_index, parent, side) = branch_index;
+    }
+}
+
+static void
+ip6_fib_bsl_trie_remove (ip6_fib_bsl_t *bsl,
+			 u32 fib_index,
+			 const ip6_address_t *addr,
+			 u32 len)
+{
+    u32 gparent, gside, parent, side, ni, other;
+    ip6_fib_bsl_node_t *node, *pnode;
+
+    if (fib_index >= vec_len(bsl->root_by_fib_index))
+	return;
+
+    gparent = parent = IP6_FIB_BSL_NODE_NONE;
+    gside = side = 0;
+    ni = bsl->root_by_fib_index[fib_index];
+
+    while (IP6_FIB_BSL_NODE_NONE != ni)
+    {
+	node = pool_elt_at_index(bsl->nodes, ni);
+	if (node->len > len ||
+	    ip6_fib_bsl_common_len(&node->addr, addr, node->len) < node->len)
+	    return;
+	if (node->len == len)
+	    break;
+	gparent = parent;
+	gside = side;
+	parent = ni;
+	side = ip6_fib_bsl_addr_bit(addr, node->len);
+	ni = node->child[side];
+    }
+    if (IP6_FIB_BSL_NODE_NONE == ni)
+	return;
+
+    node = pool_elt_at_index(bsl->nodes, ni);
+    node->is_prefix = 0;
+
+    if (IP6_FIB_BSL_NODE_NONE != node->child[0] &&
+	IP6_FIB_BSL_NODE_NONE != node->child[1])
+    {
+	/* still needed as a branch */
+	return;
+    }
+
+    other = (IP6_FIB_BSL_NODE_NONE != node->child[0] ?
+	     node->child[0] :
+	     node->child[1]);
+    *ip6_fib_bsl_slot(bsl, fib_index, parent, side) = other;
+    pool_put(bsl->nodes, node);
+
+    if (IP6_FIB_BSL_NODE_NONE != other ||
+	IP6_FIB_BSL_NODE_NONE == parent)
+	return;
+
+    /*
+     * a leaf went away. a branch parent is left with one child,
+     * which takes its place.
+     */
+    pnode = pool_elt_at_index(bsl->nodes, parent);
+    if (!pnode->is_prefix)
+    {
+	other = pnode->child[!side];
+	*ip6_fib_bsl_slot(bsl, fib_index, gparent, gside) = other;
+	pool_put(bsl->nodes, pnode);
+    }
+}
+
+/*
+ * The length of the longest prefix, no longer than max_len, that
+ * covers the address. The default route means there is always one.
+ */
+static u32
+ip6_fib_bsl_trie_bmp (const ip6_fib_bsl_t *bsl,
+		      u32 fib_index,
+		      const ip6_address_t *addr,
+		      u32 max_len)
+{
+    const ip6_fib_bsl_node_t *node;
+    u32 ni, best = 0;
+
+    if (fib_index >= vec_len(bsl->root_by_fib_index))
+	return (0);
+
+    ni = bsl->root_by_fib_index[fib_index];
+
+    while (IP6_FIB_BSL_NODE_NONE != ni)
+    {
+	node = pool_elt_at_index(bsl->nodes, ni);
+	if (node->len > max_len ||
+	    ip6_fib_bsl_common_len(&node->addr, addr, node->len) < node->len)
+	    break;
+	if (node->is_prefix)
+	    best = node->len;
+	if (node->len == max_len)
+	    break;
+	ni = node->child[ip6_fib_bsl_addr_bit(addr, node->len)];
+    }
+    return (best);
+}
+
+typedef void (*ip6_fib_bsl_walk_fn_t)(ip6_fib_bsl_t *bsl,
+				      u32 fib_index,
+				      const ip6_address_t *addr,
+				      u32 len,
+				      void *ctx);
+
+static void
+ip6_fib_bsl_trie_walk (ip6_fib_bsl_t *bsl,
+		       u32 fib_index,
+		       u32 ni,
+		       ip6_fib_bsl_walk_fn_t fn,
+		       void *ctx)
+{
+    ip6_fib_bsl_node_t *node;
+    ip6_address_t addr;
+    u32 children[2], len;
+
+    if (IP6_FIB_BSL_NODE_NONE == ni)
+	return;
+
+    /* copy out; the callback must not see a pointer into the pool */
+    node = pool_elt_at_index(bsl->nodes, ni);
+    addr = node->addr;
+    len = node->len;
+    children[0] = node->child[0];
+    children[1] = node->child[1];
+
+    if (node->is_prefix)
+	fn(bsl, fib_index, &addr, len, ctx);
+
+    ip6_fib_bsl_trie_walk(bsl, fib_index, children[0], fn, ctx);
+    ip6_fib_bsl_trie_walk(bsl, fib_index, children[1], fn, ctx);
+}
+
+/*
+ * Walk the prefixes strictly more specific than addr/len
+ */
+static void
+ip6_fib_bsl_trie_walk_more_specifics (ip6_fib_bsl_t *bsl,
+				      u32 fib_index,
+				      const ip6_address_t *addr,
+				      u32 len,
+				      ip6_fib_bsl_walk_fn_t fn,
+				      void *ctx)
+{
+    ip6_fib_bsl_node_t *node;
+    u32 ni;
+
+    if (fib_index >= vec_len(bsl->root_by_fib_index))
+	return;
+
+    ni = bsl->root_by_fib_index[fib_index];
+
+    while (IP6_FIB_BSL_NODE_NONE != ni)
+    {
+	node = pool_elt_at_index(bsl->nodes, ni);
+	if (ip6_fib_bsl_common_len(&node->addr, addr,
+				   clib_min(node->len, len)) <
+	    clib_min(node->len, len))
+	    return;
+	if (node->len > len)
+	{
+	    ip6_fib_bsl_trie_walk(bsl, fib_index, ni, fn, ctx);
+	    return;
+	}
+	if (node->len == len)
+	{
+	    u32 children[2] = { node->child[0], node->child[1], };
+
+	    ip6_fib_bsl_trie_walk(bsl, fib_index, children[0], fn, ctx);
+	    ip6_fib_bsl_trie_walk(bsl, fib_index, children[1], fn, ctx);
+	    return;
+	}
+	ni = node->child[ip6_fib_bsl_addr_bit(addr, node->len)];
+    }
+}
+
+static void
+ip6_fib_bsl_marker_add (ip6_fib_bsl_t *bsl,
+			u32 fib_index,
+			const ip6_address_t *addr,
+			u32 len)
+{
+    BVT(clib_bihash_kv) kv, value;
+
+    ip6_fib_bsl_mk_key(&kv, fib_index, addr, len);
+
+    if (0 == BV(clib_bihash_search)(&bsl->hash, &kv, &value))
+    {
+	if (0 == ip6_fib_bsl_value_refs(value.value))
+	    bsl->n_markers++;
+	kv.value = value.value + IP6_FIB_BSL_REF_ONE;
+    }
+    else
+    {
+	kv.value = (IP6_FIB_BSL_REF_ONE |
+		    ((u64)ip6_fib_bsl_trie_bmp(bsl, fib_index, addr, len) <<
+		     IP6_FIB_BSL_BMP_SHIFT));
+	bsl->n_markers++;
+    }
+    BV(clib_bihash_add_del)(&bsl->hash, &kv, 1);
+}
+
+static void
+ip6_fib_bsl_marker_remove (ip6_fib_bsl_t *bsl,
+			   u32 fib_index,
+			   const ip6_address_t *addr,
+			   u32 len)
+{
+    BVT(clib_bihash_kv) kv, value;
+
+    ip6_fib_bsl_mk_key(&kv, fib_index, addr, len);
+
+    if (0 != BV(clib_bihash_search)(&bsl->hash, &kv, &value))
+    {
+	ASSERT(0);
+	return;
+    }
+    ASSERT(ip6_fib_bsl_value_refs(value.value) > 0);
+
+    kv.value = value.value - IP6_FIB_BSL_REF_ONE;
+
+    if (0 == ip6_fib_bsl_value_refs(kv.value))
+    {
+	bsl->n_markers--;
+	if (!(kv.value & IP6_FIB_BSL_IS_PREFIX))
+	{
+	    BV(clib_bihash_add_del)(&bsl->hash, &kv, 0);
+	    return;
+	}
+    }
+    BV(clib_bihash_add_del)(&bsl->hash, &kv, 1);
+}
+
+static void
+ip6_fib_bsl_markers_add (ip6_fib_bsl_t *bsl,
+			 u32 fib_index,
+			 const ip6_address_t *addr,
+			 u32 len,
+			 void *ctx)
+{
+    u8 markers[IP6_FIB_BSL_MAX_MARKERS];
+    u32 i, n;
+
+    n = ip6_fib_bsl_marker_lengths(bsl, len, markers);
+
+    for (i = 0; i < n; i++)
+	ip6_fib_bsl_marker_add(bsl, fib_index, addr, markers[i]);
+}
+
+static void
+ip6_fib_bsl_prefix_set (ip6_fib_bsl_t *bsl,
+			u32 fib_index,
+			const ip6_address_t *addr,
+			u32 len,
+			u32 lbi)
+{
+    BVT(clib_bihash_kv) kv, value;
+
+    ip6_fib_bsl_mk_key(&kv, fib_index, addr, len);
+
+    /* keep the marker references; a prefix has no use for a bmp */
+    if (0 == BV(clib_bihash_search)(&bsl->hash, &kv, &value))
+	kv.value = value.value & ~(IP6_FIB_BSL_LBI_MASK |
+				   IP6_FIB_BSL_BMP_MASK);
+    else
+	kv.value = 0;
+
+    kv.value |= IP6_FIB_BSL_IS_PREFIX | lbi;
+    BV(clib_bihash_add_del)(&bsl->hash, &kv, 1);
+}
+
+/*
+ * Recompute the best matching prefix of the markers that a
+ * more specific prefix of a changed prefix relies on
+ */
+static void
+ip6_fib_bsl_markers_refresh (ip6_fib_bsl_t *bsl,
+			     u32 fib_index,
+			     const ip6_address_t *addr,
+			     u32 len,
+			     void *ctx)
+{
+    u8 markers[IP6_FIB_BSL_MAX_MARKERS];
+    BVT(clib_bihash_kv) kv, value;
+    u32 i, n, changed_len = *(u32*)ctx;
+
+    n = ip6_fib_bsl_marker_lengths(bsl, len, markers);
+
+    for (i = 0; i < n; i++)
+    {
+	if (markers[i] <= changed_len)
+	    continue;
+
+	ip6_fib_bsl_mk_key(&kv, fib_index, addr, markers[i]);
+	if (0 != BV(clib_bihash_search)(&bsl->hash, &kv, &value) ||
+	    (value.value & IP6_FIB_BSL_IS_PREFIX))
+	    continue;
+
+	kv.value = ((value.value & ~IP6_FIB_BSL_BMP_MASK) |
+		    ((u64)ip6_fib_bsl_trie_bmp(bsl, fib_index,
+					      addr, markers[i]) <<
+		     IP6_FIB_BSL_BMP_SHIFT));
+	BV(clib_bihash_add_del)(&bsl->hash, &kv, 1);
+    }
+}
+
+static void
+ip6_fib_bsl_prefix_reinstall (ip6_fib_bsl_t *bsl,
+			      u32 fib_index,
+			      const ip6_address_t *addr,
+			      u32 len,
+			      void *ctx)
+{
+    BVT(clib_bihash_kv) kv, value;
+
+    /* the forwarding hash holds the load-balance of each prefix */
+    ip6_fib_bsl_mk_key(&kv, fib_index, addr, len);
+    if (0 != BV(clib_bihash_search)(
+	    &ip6_main.ip6_table[IP6_FIB_TABLE_FWDING].ip6_hash,
+	    &kv, &value))
+    {
+	ASSERT(0);
+	return;
+    }
+
+    ip6_fib_bsl_markers_add(bsl, fib_index, addr, len, ctx);
+    ip6_fib_bsl_prefix_set(bsl, fib_index, addr, len, value.value);
+}
+
+/*
+ * Rebuild the hash from the trie. Needed whenever the set of
+ * prefix lengths, and so the shape of the search, changes.
+ */
+static void
+ip6_fib_bsl_rebuild (ip6_fib_bsl_t *bsl)
+{
+    vlib_main_t *vm = vlib_get_main();
+    ip6_main_t *im = &ip6_main;
+    u32 fib_index, len;
+
+    vlib_worker_thread_barrier_sync(vm);
+
+    vec_reset_length(bsl->lengths);
+    for (len = 0; len <= 128; len++)
+	if (bsl->prefix_counts[len])
+	    vec_add1(bsl->lengths, len);
+
+    if (bsl->hash.nbuckets)
+	BV(clib_bihash_free)(&bsl->hash);
+    BV(clib_bihash_init)(&bsl->hash,
+			 "ip6 FIB fwding BSL table",
+			 im->lookup_table_nbuckets,
+			 im->lookup_table_size);
+    bsl->n_markers = 0;
+
+    vec_foreach_index(fib_index, bsl->root_by_fib_index)
+    {
+	ip6_fib_bsl_trie_walk(bsl, fib_index,
+			      bsl->root_by_fib_index[fib_index],
+			      ip6_fib_bsl_prefix_reinstall, NULL);
+    }
+
+    vlib_worker_thread_barrier_release(vm);
+}
+
+static void
+ip6_fib_bsl_prefix_add (ip6_fib_bsl_t *bsl,
+			u32 fib_index,
+			const ip6_address_t *addr,
+			u32 len,
+			u32 lbi)
+{
+    BVT(clib_bihash_kv) kv, value;
+
+    ip6_fib_bsl_mk_key(&kv, fib_index, addr, len);
+    if (0 == BV(clib_bihash_search)(&bsl->hash, &kv, &value) &&
+	(value.value & IP6_FIB_BSL_IS_PREFIX))
+    {
+	/* an update of an existing prefix */
+	ip6_fib_bsl_prefix_set(bsl, fib_index, addr, len, lbi);
+	return;
+    }
+
+    ip6_fib_bsl_trie_insert(bsl, fib_index, addr, len);
+
+    if (0 == bsl->prefix_counts[len]++)
+    {
+	ip6_fib_bsl_rebuild(bsl);
+	return;
+    }
+
+    ip6_fib_bsl_markers_add(bsl, fib_index, addr, len, NULL);
+    ip6_fib_bsl_prefix_set(bsl, fib_index, addr, len, lbi);
+    ip6_fib_bsl_trie_walk_more_specifics(bsl, fib_index, addr, len,
+					 ip6_fib_bsl_markers_refresh, &len);
+}
+
+static void
+ip6_fib_bsl_prefix_remove (ip6_fib_bsl_t *bsl,
+			   u32 fib_index,
+			   const ip6_address_t *addr,
+			   u32 len)
+{
+    u8 markers[IP6_FIB_BSL_MAX_MARKERS];
+    BVT(clib_bihash_kv) kv, value;
+    u32 i, n;
+
+    ip6_fib_bsl_mk_key(&kv, fib_index, addr, len);
+    if (0 != BV(clib_bihash_search)(&bsl->hash, &kv, &value) ||
+	!(value.value & IP6_FIB_BSL_IS_PREFIX))
+	return;
+
+    ip6_fib_bsl_trie_remove(bsl, fib_index, addr, len);
+
+    ASSERT(bsl->prefix_counts[len] > 0);
+    if (0 == --bsl->prefix_counts[len])
+    {
+	ip6_fib_bsl_rebuild(bsl);
+	return;
+    }
+
+    if (0 == ip6_fib_bsl_value_refs(value.value))
+    {
+	BV(clib_bihash_add_del)(&bsl->hash, &kv, 0);
+    }
+    else
+    {
+	/* still a marker */
+	kv.value = ((value.value &
+		     ~(IP6_FIB_BSL_IS_PREFIX |
+		       IP6_FIB_BSL_LBI_MASK |
+		       IP6_FIB_BSL_BMP_MASK)) |
+		    ((u64)ip6_fib_bsl_trie_bmp(bsl, fib_index, addr, len) <<
+		     IP6_FIB_BSL_BMP_SHIFT));
+	BV(clib_bihash_add_del)(&bsl->hash, &kv, 1);
+    }
+
+    n = ip6_fib_bsl_marker_lengths(bsl, len, markers);
+    for (i = 0; i < n; i++)
+	ip6_fib_bsl_marker_remove(bsl, fib_index, addr, markers[i]);
+
+    ip6_fib_bsl_trie_walk_more_specifics(bsl, fib_index, addr, len,
+					 ip6_fib_bsl_markers_refresh, &len);
+}
+
+static void
+ip6_fib_bsl_trie_add_fwding (BVT(clib_bihash_kv) * kvp,
+			     void *arg)
+{
+    ip6_fib_bsl_t *bsl = arg;
+    ip6_address_t addr;
+    u32 len;
+
+    addr.as_u64[0] = kvp->key[0];
+    addr.as_u64[1] = kvp->key[1];
+    len = kvp->key[2] & 0xff;
+
+    ip6_fib_bsl_trie_insert(bsl, kvp->key[2] >> 32, &addr, len);
+    bsl->prefix_counts[len]++;
+}
+
+static void
+ip6_fib_bsl_free (ip6_fib_bsl_t *bsl)
+{
+    if (bsl->hash.nbuckets)
+	BV(clib_bihash_free)(&bsl->hash);
+    vec_free(bsl->lengths);
+    pool_free(bsl->nodes);
+    vec_free(bsl->root_by_fib_index);
+    memset(bsl, 0, sizeof(*bsl));
+}
+
+/*
+ * Select the forwarding lookup algorithm. The BSL view is only
+ * maintained while it is in use, so it is built from the forwarding
+ * hash when selected and freed when not.
+ */
+void
+ip6_fib_table_fwding_lookup_algo_set (ip6_fib_fwding_lookup_algo_t algo)
+{
+    ip6_main_t *im = &ip6_main;
+    ip6_fib_bsl_t *bsl = &im->fwding_bsl;
+    vlib_main_t *vm = vlib_get_main();
+
+    if (IP6_FIB_FWDING_LOOKUP_BINARY == algo)
+    {
+	if (0 == bsl->hash.nbuckets)
+	{
+	    BV(clib_bihash_foreach_key_value_pair)(
+		&im->ip6_table[IP6_FIB_TABLE_FWDING].ip6_hash,
+		ip6_fib_bsl_trie_add_fwding, bsl);
+	    ip6_fib_bsl_rebuild(bsl);
+	}
+	im->fwding_lookup_algo = algo;
+    }
+    else
+    {
+	vlib_worker_thread_barrier_sync(vm);
+	im->fwding_lookup_algo = algo;
+	ip6_fib_bsl_free(bsl);
+	vlib_worker_thread_barrier_release(vm);
+    }
+}
+
+static_always_inline u32
+ip6_fib_table_fwding_lookup_linear (const ip6_fib_table_instance_t *table,
+				    u32 fib_index,
+				    const ip6_address_t * dst,
+				    u32 * n_probes)
 {
-    const ip6_fib_table_instance_t *table;
     int i, len;
     int rv;
     BVT(clib_bihash_kv) kv, value;
     u64 fib;
 
-    table = &ip6_main.ip6_table[IP6_FIB_TABLE_FWDING];
     len = vec_len (table->prefix_lengths_in_search_order);
 
     kv.key[0] = dst->as_u64[0];
@@ -416,7 +1123,10 @@ ip6_fib_table_fwding_lookup (ip6_main_t * im,
 	kv.key[0] &= mask->as_u64[0];
 	kv.key[1] &= mask->as_u64[1];
 	kv.key[2] = fib | dst_address_length;
-      
+
+	if (n_probes)
+	    n_probes[0]++;
+
 	rv = BV(clib_bihash_search_inline_2)(&table->ip6_hash, &kv, &value);
 	if (rv == 0)
 	    return value.value;
@@ -427,6 +1137,96 @@ ip6_fib_table_fwding_lookup (ip6_main_t * im,
     return 0;
 }
 
+static_always_inline u32
+ip6_fib_table_fwding_lookup_binary (const ip6_fib_bsl_t *bsl,
+				    u32 fib_index,
+				    const ip6_address_t * dst,
+				    u32 * n_probes)
+{
+    BVT(clib_bihash_kv) kv, value;
+    i32 lo, hi, mid;
+    u64 best = 0;
+    int found = 0;
+
+    lo = 0;
+    hi = vec_len (bsl->lengths) - 1;
+
+    /*
+     * a hit, prefix or marker, means a longer match may exist;
+     * a miss means it cannot.
+     */
+    while (lo <= hi)
+    {
+	mid = (lo + hi) >> 1;
+	ip6_fib_bsl_mk_key(&kv, fib_index, dst, bsl->lengths[mid]);
+
+	if (n_probes)
+	    n_probes[0]++;
+
+	if (0 == BV(clib_bihash_search_inline_2)(&bsl->hash, &kv, &value))
+	{
+	    best = value.value;
+	    found = 1;
+	    lo = mid + 1;
+	}
+	else
+	    hi = mid - 1;
+    }
+
+    if (PREDICT_TRUE(best & IP6_FIB_BSL_IS_PREFIX))
+	return (best & IP6_FIB_BSL_LBI_MASK);
+
+    /* default route is always present */
+    ASSERT(found);
+    if (PREDICT_FALSE(!found))
+	return 0;
+
+    /* the last hit was only a marker; fetch its best matching prefix */
+    ip6_fib_bsl_mk_key(&kv, fib_index, dst, ip6_fib_bsl_value_bmp(best));
+
+    if (n_probes)
+	n_probes[0]++;
+
+    if (0 == BV(clib_bihash_search_inline_2)(&bsl->hash, &kv, &value))
+	return (value.value & IP6_FIB_BSL_LBI_MASK);
+
+    ASSERT(0);
+    return 0;
+}
+
+u32 
+ip6_fib_table_fwding_lookup (ip6_main_t * im,
+                             u32 fib_index,
+                             const ip6_address_t * dst)
+{
+    if (IP6_FIB_FWDING_LOOKUP_BINARY == im->fwding_lookup_algo)
+	return (ip6_fib_table_fwding_lookup_binary(&im->fwding_bsl,
+						   fib_index, dst, NULL));
+
+    return (ip6_fib_table_fwding_lookup_linear(
+		&im->ip6_table[IP6_FIB_TABLE_FWDING],
+		fib_index, dst, NULL));
+}
+
+u32
+ip6_fib_table_fwding_lookup_with_algo (ip6_main_t * im,
+				       u32 fib_index,
+				       const ip6_address_t * dst,
+				       ip6_fib_fwding_lookup_algo_t algo,
+				       u32 * n_probes)
+{
+    if (IP6_FIB_FWDING_LOOKUP_BINARY == algo)
+    {
+	ASSERT(im->fwding_bsl.hash.nbuckets);
+	return (ip6_fib_table_fwding_lookup_binary(&im->fwding_bsl,
+						   fib_index, dst, n_probes));
+    }
+
+    return (ip6_fib_table_fwding_lookup_linear(
+		&im->ip6_table[IP6_FIB_TABLE_FWDING],
+		fib_index, dst, n_probes));
+}
+
 u32 ip6_fib_table_fwding_lookup_with_if_index (ip6_main_t * im,
 					       u32 sw_if_index,
 					       const ip6_address_t * dst)
@@ -483,6 +1283,10 @@ ip6_fib_table_fwding_dpo_update (u32 fib_index,
         clib_bitmap_set (table->non_empty_dst_address_length_bitmap, 
 			 128 - len, 1);
     compute_prefix_lengths_in_search_order (table);
+
+    if (IP6_FIB_FWDING_LOOKUP_BINARY == ip6_main.fwding_lookup_algo)
+	ip6_fib_bsl_prefix_add(&ip6_main.fwding_bsl, fib_index,
+			       addr, len, dpo->dpoi_index);
 }
 
 void
@@ -516,6 +1320,10 @@ ip6_fib_table_fwding_dpo_remove (u32 fib_index,
                              128 - len, 0);
 	compute_prefix_lengths_in_search_order (table);
     }
+
+    if (IP6_FIB_FWDING_LOOKUP_BINARY == ip6_main.fwding_lookup_algo)
+	ip6_fib_bsl_prefix_remove(&ip6_main.fwding_bsl, fib_index,
+				  addr, len);
 }
 
 typedef struct ip6_fib_show_ctx_t_ {
@@ -633,6 +1441,18 @@ ip6_show_fib (vlib_main_t * vm,
 	    break;
     }
 
+    if (! verbose)
+    {
+	ip6_fib_bsl_t *bsl = &im6->fwding_bsl;
+
+	if (IP6_FIB_FWDING_LOOKUP_BINARY == im6->fwding_lookup_algo)
+	    vlib_cli_output (vm, "lookup: binary search on %d prefix lengths, %d markers",
+			     vec_len (bsl->lengths), bsl->n_markers);
+	else
+	    vlib_cli_output (vm, "lookup: linear search on %d prefix lengths",
+			     vec_len (im6->ip6_table[IP6_FIB_TABLE_FWDING].prefix_lengths_in_search_order));
+    }
+
     pool_foreach (fib_table, im6->fibs,
     ({
 	fib = &(fib_table->v6);
@@ -782,3 +1602,42 @@ VLIB_CLI_COMMAND (ip6_show_fib_command, static) = {
     .function = ip6_show_fib,
 };
 /* *INDENT-ON* */
+
+static clib_error_t *
+ip6_set_fib_lookup (vlib_main_t * vm,
+		    unformat_input_t * input,
+		    vlib_cli_command_t * cmd)
+{
+    ip6_fib_fwding_lookup_algo_t algo;
+
+    if (unformat (input, "linear"))
+	algo = IP6_FIB_FWDING_LOOKUP_LINEAR;
+    else if (unformat (input, "binary"))
+	algo = IP6_FIB_FWDING_LOOKUP_BINARY;
+    else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+
+    ip6_fib_table_fwding_lookup_algo_set(algo);
+
+    return (NULL);
+}
+
+/*?
+ * This command selects how the IPv6 forwarding tables are searched.
+ * The default linear search probes the table once for each prefix
+ * length in use, longest first. The binary search probes it once for
+ * each level of a binary search over those lengths, at the cost of
+ * extra memory for the markers that guide the search. The startup
+ * config equivalent is 'ip6 { fib-lookup binary }'.
+ *
+ * @cliexpar
+ * @cliexcmd{set ip6 fib lookup binary}
+ ?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ip6_set_fib_lookup_command, static) = {
+    .path = "set ip6 fib lookup",
+    .short_help = "set ip6 fib lookup [linear|binary]",
+    .function = ip6_set_fib_lookup,
+};
+/* *INDENT-ON* */
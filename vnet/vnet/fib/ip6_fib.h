@@ -57,6 +57,18 @@ u32 ip6_fib_table_fwding_lookup(ip6_main_t * im,
 				u32 fib_index, 
 				const ip6_address_t * dst);
 
+/**
+ * @brief Lookup using the given algorithm, counting the hash probes
+ * made. For the unit tests; the binary search must be enabled.
+ */
+u32 ip6_fib_table_fwding_lookup_with_algo(ip6_main_t * im,
+					  u32 fib_index,
+					  const ip6_address_t * dst,
+					  ip6_fib_fwding_lookup_algo_t algo,
+					  u32 * n_probes);
+
+extern void ip6_fib_table_fwding_lookup_algo_set(ip6_fib_fwding_lookup_algo_t algo);
+
 void ethernet_ndp_change_mac (vlib_main_t * vm, u32 sw_if_index);
 
 /**
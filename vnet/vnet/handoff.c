@@ -163,7 +163,7 @@ worker_handoff_node_fn (vlib_main_t * vm,
       if (n_left_to_next_worker == 0)
 	{
 	  hf->n_vectors = VLIB_FRAME_SIZE;
-	  vlib_put_handoff_queue_elt (hf);
+	  vlib_put_handoff_queue_elt (next_worker_index, hf);
 	  current_worker_index = ~0;
 	  handoff_queue_elt_by_worker_index[next_worker_index] = 0;
 	  hf = 0;
@@ -196,7 +196,7 @@ worker_handoff_node_fn (vlib_main_t * vm,
 	   */
 	  if (1 || hf->n_vectors == hf->last_n_vectors)
 	    {
-	      vlib_put_handoff_queue_elt (hf);
+	      vlib_put_handoff_queue_elt (i, hf);
 	      handoff_queue_elt_by_worker_index[i] = 0;
 	    }
 	  else
@@ -205,6 +205,7 @@ worker_handoff_node_fn (vlib_main_t * vm,
       congested_handoff_queue_by_worker_index[i] =
 	(vlib_frame_queue_t *) (~0);
     }
+  vlib_publish_handoff_queue_elts ();
   hf = 0;
   current_worker_index = ~0;
   return frame->n_vectors;
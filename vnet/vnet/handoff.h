@@ -32,39 +32,45 @@ typedef enum
   HANDOFF_DISPATCH_N_NEXT,
 } handoff_dispatch_next_t;
 
-static inline void
-vlib_put_handoff_queue_elt (vlib_frame_queue_elt_t * hf)
-{
-  CLIB_MEMORY_BARRIER ();
-  hf->valid = 1;
-}
-
 static inline vlib_frame_queue_elt_t *
 vlib_get_handoff_queue_elt (u32 vlib_worker_index)
 {
   vlib_frame_queue_t *fq;
-  vlib_frame_queue_elt_t *elt;
-  u64 new_tail;
 
   fq = vlib_frame_queues[vlib_worker_index];
   ASSERT (fq);
 
-  new_tail = __sync_add_and_fetch (&fq->tail, 1);
-
-  /* Wait until a ring slot is available */
-  while (new_tail >= fq->head_hint + fq->nelts)
-    vlib_worker_thread_barrier_check ();
-
-  elt = fq->elts + (new_tail & (fq->nelts - 1));
+  return vlib_frame_queue_ring_get
+    (fq, vlib_frame_queue_get_ring (fq, os_get_cpu_number ()));
+}
 
-  /* this would be very bad... */
-  while (elt->valid)
-    ;
+static inline void
+vlib_put_handoff_queue_elt (u32 vlib_worker_index,
+			    vlib_frame_queue_elt_t * hf)
+{
+  vlib_frame_queue_t *fq;
 
-  elt->msg_type = VLIB_FRAME_QUEUE_ELT_DISPATCH_FRAME;
-  elt->last_n_vectors = elt->n_vectors = 0;
+  fq = vlib_frame_queues[vlib_worker_index];
+  vlib_frame_queue_ring_put
+    (fq, vlib_frame_queue_get_ring (fq, os_get_cpu_number ()), hf);
+}
 
-  return elt;
+/*
+ * Make the elements put by this thread visible to the workers.
+ * Handoff nodes call this once, after putting their last element.
+ */
+static inline void
+vlib_publish_handoff_queue_elts (void)
+{
+  u32 cpu_index = os_get_cpu_number ();
+  vlib_frame_queue_t **fqp;
+
+  vec_foreach (fqp, vlib_frame_queues)
+  {
+    if (*fqp)
+      vlib_frame_queue_ring_publish
+	(*fqp, vlib_frame_queue_get_ring (*fqp, cpu_index));
+  }
 }
 
 static inline vlib_frame_queue_t *
@@ -74,6 +80,7 @@ is_vlib_handoff_queue_congested (u32 vlib_worker_index,
 				 handoff_queue_by_worker_index)
 {
   vlib_frame_queue_t *fq;
+  vlib_frame_queue_ring_t *r;
 
   fq = handoff_queue_by_worker_index[vlib_worker_index];
   if (fq != (vlib_frame_queue_t *) (~0))
@@ -82,14 +89,21 @@ is_vlib_handoff_queue_congested (u32 vlib_worker_index,
   fq = vlib_frame_queues[vlib_worker_index];
   ASSERT (fq);
 
-  if (PREDICT_FALSE (fq->tail >= (fq->head_hint + queue_hi_thresh)))
+  r = vlib_frame_queue_get_ring (fq, os_get_cpu_number ());
+
+  /* Refresh the cached head only when it says we are congested */
+  if (PREDICT_FALSE (r->tail - r->head_cache >= queue_hi_thresh))
     {
-      /* a valid entry in the array will indicate the queue has reached
-       * the specified threshold and is congested
-       */
-      handoff_queue_by_worker_index[vlib_worker_index] = fq;
-      fq->enqueue_full_events++;
-      return fq;
+      r->head_cache = r->head;
+      if (r->tail - r->head_cache >= queue_hi_thresh)
+	{
+	  /* a valid entry in the array will indicate the queue has reached
+	   * the specified threshold and is congested
+	   */
+	  handoff_queue_by_worker_index[vlib_worker_index] = fq;
+	  r->enqueue_congested_events++;
+	  return fq;
+	}
     }
 
   return NULL;
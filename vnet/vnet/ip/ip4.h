@@ -159,6 +159,9 @@ typedef struct ip4_main_t {
   /** Seed for Jenkins hash used to compute ip4 flow hash. */
   u32 flow_hash_seed;
 
+  /** mtrie layout used for newly created FIBs, see ip4 startup config */
+  ip4_fib_mtrie_layout_t mtrie_layout;
+
   /** @brief Template information for VPP generated packets */
   struct {
     /** TTL to use for host generated packets. */
@@ -330,7 +333,6 @@ serialize_function_t serialize_vnet_ip4_main, unserialize_vnet_ip4_main;
 
 int vnet_set_ip4_flow_hash (u32 table_id, flow_hash_config_t flow_hash_config);
 
-void ip4_mtrie_init (ip4_fib_mtrie_t * m);
 
 int vnet_set_ip4_classify_intfc (vlib_main_t * vm, u32 sw_if_index,
                                  u32 table_index);
@@ -128,33 +128,48 @@ ply_free (ip4_fib_mtrie_t * m, ip4_fib_mtrie_ply_t * p)
     pool_put (m->ply_pool, p);
 }
 
+static void
+ply_16_init (ip4_fib_mtrie_16_ply_t * p)
+{
+  uword i;
+
+  for (i = 0; i < ARRAY_LEN (p->leaves); i++)
+    p->leaves[i] = IP4_FIB_MTRIE_LEAF_EMPTY;
+  memset (p->dst_address_bits_of_leaves, 0,
+	  sizeof (p->dst_address_bits_of_leaves));
+}
+
+/* Frees all plies, including the root plies; re-init before reuse. */
 void ip4_fib_free (ip4_fib_mtrie_t * m)
 {
   ip4_fib_mtrie_ply_t * root_ply = pool_elt_at_index (m->ply_pool, 0);
   ply_free (m, root_ply);
+
+  if (m->root_ply_16)
+    {
+      ip4_fib_mtrie_16_ply_t * p = m->root_ply_16;
+      uword i;
+
+      for (i = 0 ; i < ARRAY_LEN (p->leaves); i++)
+	{
+	  ip4_fib_mtrie_leaf_t l = p->leaves[i];
+	  if (ip4_fib_mtrie_leaf_is_next_ply (l))
+	    ply_free (m, get_next_ply_for_leaf (m, l));
+	}
+      clib_mem_free (p);
+      m->root_ply_16 = 0;
+    }
+
+  pool_free (m->ply_pool);
 }
 
 u32 ip4_mtrie_lookup_address (ip4_fib_mtrie_t * m, ip4_address_t dst)
 {
-  ip4_fib_mtrie_ply_t * p = pool_elt_at_index (m->ply_pool, 0);
   ip4_fib_mtrie_leaf_t l;
 
-  l = p->leaves[dst.as_u8[0]];
-  if (ip4_fib_mtrie_leaf_is_terminal (l))
-    return ip4_fib_mtrie_leaf_get_adj_index (l);
-
-  p = get_next_ply_for_leaf (m, l);
-  l = p->leaves[dst.as_u8[1]];
-  if (ip4_fib_mtrie_leaf_is_terminal (l))
-    return ip4_fib_mtrie_leaf_get_adj_index (l);
-
-  p = get_next_ply_for_leaf (m, l);
-  l = p->leaves[dst.as_u8[2]];
-  if (ip4_fib_mtrie_leaf_is_terminal (l))
-    return ip4_fib_mtrie_leaf_get_adj_index (l);
-
-  p = get_next_ply_for_leaf (m, l);
-  l = p->leaves[dst.as_u8[3]];
+  l = ip4_fib_mtrie_lookup_step_one (m, &dst);
+  l = ip4_fib_mtrie_lookup_step (m, l, &dst, 2);
+  l = ip4_fib_mtrie_lookup_step (m, l, &dst, 3);
 
   ASSERT (ip4_fib_mtrie_leaf_is_terminal (l));
   return ip4_fib_mtrie_leaf_get_adj_index (l);
@@ -296,6 +311,76 @@ set_leaf (ip4_fib_mtrie_t * m,
     }
 }
 
+/* Insert into the 64k entry root ply of the 16-8-8 layout. Same scheme
+   as set_leaf, with a 16 bit stride. */
+static void
+set_root_leaf_16 (ip4_fib_mtrie_t * m,
+		  ip4_fib_mtrie_set_unset_leaf_args_t * a)
+{
+  ip4_fib_mtrie_16_ply_t * root = m->root_ply_16;
+  ip4_fib_mtrie_leaf_t old_leaf, new_leaf;
+  i32 n_dst_bits_next_plies;
+  u32 dst_slot;
+
+  ASSERT (a->dst_address_length > 0 && a->dst_address_length <= 32);
+
+  n_dst_bits_next_plies = a->dst_address_length - 16;
+  dst_slot = ip4_fib_mtrie_16_ply_slot (&a->dst_address);
+
+  /* Number of bits next plies <= 0 => insert leaves this ply. */
+  if (n_dst_bits_next_plies <= 0)
+    {
+      uword i, n_dst_bits_this_ply;
+
+      n_dst_bits_this_ply = -n_dst_bits_next_plies;
+      ASSERT ((dst_slot & pow2_mask (n_dst_bits_this_ply)) == 0);
+
+      for (i = dst_slot; i < dst_slot + (1 << n_dst_bits_this_ply); i++)
+	{
+	  old_leaf = root->leaves[i];
+
+	  /* Is leaf to be inserted more specific? */
+	  if (a->dst_address_length >= root->dst_address_bits_of_leaves[i])
+	    {
+	      new_leaf = ip4_fib_mtrie_leaf_set_adj_index (a->adj_index);
+
+	      if (ip4_fib_mtrie_leaf_is_terminal (old_leaf))
+		{
+		  root->dst_address_bits_of_leaves[i] = a->dst_address_length;
+		  __sync_val_compare_and_swap (&root->leaves[i], old_leaf,
+					       new_leaf);
+		  ASSERT (root->leaves[i] == new_leaf);
+		}
+	      else
+		set_ply_with_more_specific_leaf
+		  (m, get_next_ply_for_leaf (m, old_leaf), new_leaf,
+		   a->dst_address_length);
+	    }
+	  else if (! ip4_fib_mtrie_leaf_is_terminal (old_leaf))
+	    set_leaf (m, a, ip4_fib_mtrie_leaf_get_next_ply_index (old_leaf),
+		      /* dst_address_byte_index */ 2);
+	}
+    }
+  else
+    {
+      old_leaf = root->leaves[dst_slot];
+      if (ip4_fib_mtrie_leaf_is_terminal (old_leaf))
+	{
+	  new_leaf = ply_create (m, old_leaf,
+				 root->dst_address_bits_of_leaves[dst_slot]);
+	  __sync_val_compare_and_swap (&root->leaves[dst_slot], old_leaf,
+				       new_leaf);
+	  ASSERT (root->leaves[dst_slot] == new_leaf);
+	  root->dst_address_bits_of_leaves[dst_slot] = 0;
+	}
+      else
+	new_leaf = old_leaf;
+
+      set_leaf (m, a, ip4_fib_mtrie_leaf_get_next_ply_index (new_leaf),
+		/* dst_address_byte_index */ 2);
+    }
+}
+
 static uword
 unset_leaf (ip4_fib_mtrie_t * m,
 	    ip4_fib_mtrie_set_unset_leaf_args_t * a,
@@ -351,13 +436,58 @@ unset_leaf (ip4_fib_mtrie_t * m,
   return 0;
 }
 
-void ip4_mtrie_init (ip4_fib_mtrie_t * m)
+static void
+unset_root_leaf_16 (ip4_fib_mtrie_t * m,
+		    ip4_fib_mtrie_set_unset_leaf_args_t * a)
+{
+  ip4_fib_mtrie_16_ply_t * root = m->root_ply_16;
+  ip4_fib_mtrie_leaf_t old_leaf, del_leaf;
+  i32 n_dst_bits_next_plies;
+  i32 i, n_dst_bits_this_ply;
+  u32 dst_slot;
+
+  ASSERT (a->dst_address_length > 0 && a->dst_address_length <= 32);
+
+  n_dst_bits_next_plies = a->dst_address_length - 16;
+
+  dst_slot = ip4_fib_mtrie_16_ply_slot (&a->dst_address);
+  if (n_dst_bits_next_plies < 0)
+    dst_slot &= ~pow2_mask (-n_dst_bits_next_plies);
+
+  n_dst_bits_this_ply = n_dst_bits_next_plies <= 0 ? -n_dst_bits_next_plies : 0;
+  n_dst_bits_this_ply = clib_min (16, n_dst_bits_this_ply);
+
+  del_leaf = ip4_fib_mtrie_leaf_set_adj_index (a->adj_index);
+
+  for (i = dst_slot; i < dst_slot + (1 << n_dst_bits_this_ply); i++)
+    {
+      old_leaf = root->leaves[i];
+
+      if (old_leaf == del_leaf
+	  || (! ip4_fib_mtrie_leaf_is_terminal (old_leaf)
+	      && unset_leaf (m, a, get_next_ply_for_leaf (m, old_leaf),
+			     /* dst_address_byte_index */ 2)))
+	{
+	  root->leaves[i] = IP4_FIB_MTRIE_LEAF_EMPTY;
+	  root->dst_address_bits_of_leaves[i] = 0;
+	}
+    }
+}
+
+void ip4_mtrie_init (ip4_fib_mtrie_t * m, ip4_fib_mtrie_layout_t layout)
 {
   ip4_fib_mtrie_leaf_t root;
   memset (m, 0, sizeof (m[0]));
   m->default_leaf = IP4_FIB_MTRIE_LEAF_EMPTY;
   root = ply_create (m, IP4_FIB_MTRIE_LEAF_EMPTY, /* dst_address_bits_of_leaves */ 0);
   ASSERT (ip4_fib_mtrie_leaf_get_next_ply_index (root) == 0);
+
+  if (layout == IP4_FIB_MTRIE_LAYOUT_16_8_8)
+    {
+      m->root_ply_16 = clib_mem_alloc_aligned (sizeof (m->root_ply_16[0]),
+					       CLIB_CACHE_LINE_BYTES);
+      ply_16_init (m->root_ply_16);
+    }
 }
 
 void
@@ -386,6 +516,8 @@ ip4_fib_mtrie_add_del_route (ip4_fib_t * fib,
     {
       if (dst_address_length == 0)
 	m->default_leaf = ip4_fib_mtrie_leaf_set_adj_index (adj_index);
+      else if (m->root_ply_16)
+	set_root_leaf_16 (m, &a);
       else
 	set_leaf (m, &a, /* ply_index */ 0, /* dst_address_byte_index */ 0);
     }
@@ -399,7 +531,10 @@ ip4_fib_mtrie_add_del_route (ip4_fib_t * fib,
 	  ip4_main_t * im = &ip4_main;
 	  uword i;
 
-	  unset_leaf (m, &a, root_ply, 0);
+	  if (m->root_ply_16)
+	    unset_root_leaf_16 (m, &a);
+	  else
+	    unset_leaf (m, &a, root_ply, 0);
 
 	  /* Find next less specific route and insert into mtrie. */
 	  for (i = dst_address_length - 1; i >= 1; i--)
@@ -423,7 +558,10 @@ ip4_fib_mtrie_add_del_route (ip4_fib_t * fib,
 		  a.adj_index = lbi;
 		  a.dst_address_length = i;
 
-		  set_leaf (m, &a, /* ply_index */ 0, /* dst_address_byte_index */ 0);
+		  if (m->root_ply_16)
+		    set_root_leaf_16 (m, &a);
+		  else
+		    set_leaf (m, &a, /* ply_index */ 0, /* dst_address_byte_index */ 0);
 		  break;
 		}
 	    }
@@ -454,6 +592,26 @@ static uword mtrie_memory_usage (ip4_fib_mtrie_t * m, ip4_fib_mtrie_ply_t * p)
   return bytes;
 }
 
+uword ip4_fib_mtrie_memory_usage (ip4_fib_mtrie_t * m)
+{
+  ip4_fib_mtrie_16_ply_t * p = m->root_ply_16;
+  uword bytes, i;
+
+  if (! p)
+    return mtrie_memory_usage (m, 0);
+
+  /* Reserved 8-8-8-8 root ply, plus the 16 bit root ply */
+  bytes = sizeof (m->ply_pool[0]) + sizeof (p[0]);
+  for (i = 0 ; i < ARRAY_LEN (p->leaves); i++)
+    {
+      ip4_fib_mtrie_leaf_t l = p->leaves[i];
+      if (ip4_fib_mtrie_leaf_is_next_ply (l))
+	bytes += mtrie_memory_usage (m, get_next_ply_for_leaf (m, l));
+    }
+
+  return bytes;
+}
+
 static u8 * format_ip4_fib_mtrie_leaf (u8 * s, va_list * va)
 {
   ip4_fib_mtrie_leaf_t l = va_arg (*va, ip4_fib_mtrie_leaf_t);
@@ -511,15 +669,58 @@ static u8 * format_ip4_fib_mtrie_ply (u8 * s, va_list * va)
   return s;
 }
 
+static u8 * format_ip4_fib_mtrie_16_ply (u8 * s, va_list * va)
+{
+  ip4_fib_mtrie_t * m = va_arg (*va, ip4_fib_mtrie_t *);
+  ip4_fib_mtrie_16_ply_t * p = m->root_ply_16;
+  uword i, indent;
+
+  indent = format_get_indent (s);
+  s = format (s, "16 bit root ply");
+  for (i = 0; i < ARRAY_LEN (p->leaves); i++)
+    {
+      ip4_fib_mtrie_leaf_t l = p->leaves[i];
+
+      if (! ip4_fib_mtrie_leaf_is_empty (l))
+	{
+	  u32 a, ia_length;
+	  ip4_address_t ia;
+
+	  a = i << 16;
+	  ia.as_u32 = clib_host_to_net_u32 (a);
+	  if (ip4_fib_mtrie_leaf_is_terminal (l))
+	    ia_length = p->dst_address_bits_of_leaves[i];
+	  else
+	    ia_length = 16;
+	  s = format (s, "\n%U%20U %U",
+		      format_white_space, indent + 2,
+		      format_ip4_address_and_length, &ia, ia_length,
+		      format_ip4_fib_mtrie_leaf, l);
+
+	  if (ip4_fib_mtrie_leaf_is_next_ply (l))
+	    s = format (s, "\n%U%U",
+			format_white_space, indent + 2,
+			format_ip4_fib_mtrie_ply, m, a,
+			ip4_fib_mtrie_leaf_get_next_ply_index (l),
+			/* dst_address_byte_index */ 2);
+	}
+    }
+
+  return s;
+}
+
 u8 * format_ip4_fib_mtrie (u8 * s, va_list * va)
 {
   ip4_fib_mtrie_t * m = va_arg (*va, ip4_fib_mtrie_t *);
 
-  s = format (s, "%d plies, memory usage %U",
+  s = format (s, "%s layout, %d plies, memory usage %U",
+	      m->root_ply_16 ? "16-8-8" : "8-8-8-8",
 	      pool_elts (m->ply_pool),
-	      format_memory_size, mtrie_memory_usage (m, 0));
+	      format_memory_size, ip4_fib_mtrie_memory_usage (m));
 
-  if (pool_elts (m->ply_pool) > 0)
+  if (m->root_ply_16)
+    s = format (s, "\n  %U", format_ip4_fib_mtrie_16_ply, m);
+  else if (pool_elts (m->ply_pool) > 0)
     {
       ip4_address_t base_address;
       base_address.as_u32 = 0;
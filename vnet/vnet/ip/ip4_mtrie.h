@@ -45,7 +45,7 @@
 #include <vnet/ip/lookup.h>
 #include <vnet/ip/ip4_packet.h>	/* for ip4_address_t */
 
-/* ip4 fib leafs: 4 ply 8-8-8-8 mtrie.
+/* ip4 fib leafs: 4 ply 8-8-8-8 mtrie, or 3 ply 16-8-8 mtrie.
    1 + 2*adj_index for terminal leaves.
    0 + 2*next_ply_index for non-terminals.
    1 => empty (adjacency index of zero is special miss adjacency). */
@@ -118,15 +118,37 @@ typedef struct {
 _Static_assert(0  == sizeof(ip4_fib_mtrie_ply_t) % CLIB_CACHE_LINE_BYTES,
 	       "IP4 Mtrie ply cache line");
 
+/* Root ply of the 16-8-8 mtrie, indexed directly by the first two
+   bytes of the address. */
 typedef struct {
-  /* Pool of plies.  Index zero is root ply. */
+  ip4_fib_mtrie_leaf_t leaves[1 << 16];
+
+  /* Prefix length for terminal leaves. */
+  u8 dst_address_bits_of_leaves[1 << 16];
+} ip4_fib_mtrie_16_ply_t;
+
+typedef enum {
+  /* 4 dependent loads per lookup, 1 cache line root ply */
+  IP4_FIB_MTRIE_LAYOUT_8_8_8_8,
+  /* 3 dependent loads per lookup, 320k root ply per FIB */
+  IP4_FIB_MTRIE_LAYOUT_16_8_8,
+} ip4_fib_mtrie_layout_t;
+
+typedef struct {
+  /* Pool of plies.  Index zero is root ply of the 8-8-8-8 layout;
+     it is reserved (unused) in the 16-8-8 layout. */
   ip4_fib_mtrie_ply_t * ply_pool;
 
+  /* Root ply of the 16-8-8 layout, zero for 8-8-8-8 layout. */
+  ip4_fib_mtrie_16_ply_t * root_ply_16;
+
   /* Special case leaf for default route 0.0.0.0/0. */
   ip4_fib_mtrie_leaf_t default_leaf;
 } ip4_fib_mtrie_t;
 
-void ip4_fib_mtrie_init (ip4_fib_mtrie_t * m);
+void ip4_mtrie_init (ip4_fib_mtrie_t * m, ip4_fib_mtrie_layout_t layout);
+
+void ip4_fib_free (ip4_fib_mtrie_t * m);
 
 struct ip4_fib_t;
 
@@ -139,9 +161,19 @@ void ip4_fib_mtrie_add_del_route (struct ip4_fib_t * f,
 /* Returns adjacency index. */
 u32 ip4_mtrie_lookup_address (ip4_fib_mtrie_t * m, ip4_address_t dst);
 
+/* Returns number of bytes of memory used by mtrie. */
+uword ip4_fib_mtrie_memory_usage (ip4_fib_mtrie_t * m);
+
 format_function_t format_ip4_fib_mtrie;
 
-/* Lookup step.  Processes 1 byte of 4 byte ip4 address. */
+always_inline u32
+ip4_fib_mtrie_16_ply_slot (const ip4_address_t * dst_address)
+{
+  return (dst_address->as_u8[0] << 8) | dst_address->as_u8[1];
+}
+
+/* Lookup step.  Processes 1 byte of 4 byte ip4 address.
+   Used for bytes 2 and 3, after ip4_fib_mtrie_lookup_step_one. */
 always_inline ip4_fib_mtrie_leaf_t
 ip4_fib_mtrie_lookup_step (ip4_fib_mtrie_t * m,
 			   ip4_fib_mtrie_leaf_t current_leaf,
@@ -159,4 +191,21 @@ ip4_fib_mtrie_lookup_step (ip4_fib_mtrie_t * m,
   return next_leaf;
 }
 
+/* First lookup step.  Processes the first 2 bytes of the address:
+   a single load from the root ply in the 16-8-8 layout, plies 0 and 1
+   in the 8-8-8-8 layout.  The layout is tested here once per lookup
+   so that the steps for bytes 2 and 3 stay branch free. */
+always_inline ip4_fib_mtrie_leaf_t
+ip4_fib_mtrie_lookup_step_one (ip4_fib_mtrie_t * m,
+			       const ip4_address_t * dst_address)
+{
+  ip4_fib_mtrie_leaf_t next_leaf;
+
+  if (m->root_ply_16)
+    return m->root_ply_16->leaves[ip4_fib_mtrie_16_ply_slot (dst_address)];
+
+  next_leaf = m->ply_pool[0].leaves[dst_address->as_u8[0]];
+  return ip4_fib_mtrie_lookup_step (m, next_leaf, dst_address, 1);
+}
+
 #endif /* included_ip_ip4_fib_h */
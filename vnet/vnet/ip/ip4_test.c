@@ -14,35 +14,20 @@
  */
 #include <vnet/ip/ip.h>
 #include <vnet/ethernet/ethernet.h>
+#include <vnet/fib/ip4_fib.h>
+#include <fcntl.h>
 
 /**
  * @file
  * @brief IPv4 FIB Tester.
  *
- * Not compiled in by default. IPv4 FIB tester. Add, probe, delete a bunch of
- * random routes / masks and make sure that the mtrie agrees with
- * the hash-table FIB.
- * 
- * Manipulate the FIB by means of the debug CLI commands, to minimize
- * the chances of doing something idiotic.
+ * IPv4 FIB tester. Add, probe, delete a bunch of random routes / masks
+ * and make sure that the mtrie agrees with the hash-table FIB; compare
+ * the mtrie layouts.
  */
 
-/* 
- * These routines need to be redeclared non-static elsewhere.
- *
- * Also: rename ip_route() -> vnet_ip_route_cmd() and add the usual
- * test_route_init() call to main.c
- */
-clib_error_t *
-vnet_ip_route_cmd (vlib_main_t * vm, 
-                   unformat_input_t * input, vlib_cli_command_t * cmd_arg);
-
 int ip4_lookup_validate (ip4_address_t *a, u32 fib_index0);
 
-ip4_fib_t *
-find_fib_by_table_index_or_id (ip4_main_t * im, u32 table_index_or_id, 
-                               u32 flags);
-
 /* Routes to insert/delete/probe in FIB */
 typedef struct {
   ip4_address_t address;
@@ -56,6 +41,9 @@ typedef struct {
 
   /* Number of fake ethernets created */
   u32 test_interfaces_created;
+
+  /* Their sw_if_index, by interface_id */
+  u32 *sw_if_indices;
 } test_main_t;
 
 test_main_t test_main;
@@ -94,21 +82,19 @@ thrash (vlib_main_t * vm,
   u32 table_id = 11;            /* my amp goes to 11 (use fib 11) */
   u32 table_index;
   int iter, i;
-  u8 * cmd;
   test_route_t *tr;
   test_main_t *tm = &test_main;
   ip4_main_t * im = &ip4_main;
   vnet_main_t * vnm = vnet_get_main();
-  unformat_input_t cmd_input;
   f64 rf;
   u32 *masks = 0;
   u32 tmp;
   u32 hw_if_index;
   clib_error_t * error = 0;
-  uword *p;
   unformat_input_t _line_input, * line_input = &_line_input;
   u8 hw_address[6];
-  ip4_fib_t * fib;
+  fib_prefix_t pfx;
+  ip46_address_t zero_addr;
   int verbose = 0;
 
   /* Precompute mask width -> mask vector */
@@ -145,7 +131,7 @@ thrash (vlib_main_t * vm,
     }
 
   /* Find or create FIB table 11 */
-  fib = ip4_fib_find_or_create_fib_by_table_id (table_id);
+  table_index = ip4_fib_table_find_or_create_and_lock (table_id);
 
   for (i = tm->test_interfaces_created; i < ninterfaces; i++)
     {
@@ -162,25 +148,24 @@ thrash (vlib_main_t * vm,
          hw_address,
          &hw_if_index, 
          /* flag change */ 0);
-      
+      if (error)
+        return error;
+
       /* Fake interfaces use FIB table 11 */
       hw = vnet_get_hw_interface (vnm, hw_if_index);
       vec_validate (im->fib_index_by_sw_if_index, hw->sw_if_index);
-      im->fib_index_by_sw_if_index[hw->sw_if_index] = fib->index;
-      ip4_sw_interface_enable_disable(sw_if_index, 1);
+      im->fib_index_by_sw_if_index[hw->sw_if_index] = table_index;
+      ip4_sw_interface_enable_disable (hw->sw_if_index, 1);
+      vec_add1 (tm->sw_if_indices, hw->sw_if_index);
+      vnet_sw_interface_set_flags (vnm, hw->sw_if_index,
+                                   VNET_SW_INTERFACE_FLAG_ADMIN_UP);
     }
 
   tm->test_interfaces_created = ninterfaces;
 
-  /* Find fib index corresponding to FIB id 11 */
-  p = hash_get (im->fib_index_by_table_id, table_id);
-  if (p == 0)
-    {
-      vlib_cli_output (vm, "Couldn't map fib id %d to fib index\n",
-                       table_id);
-      return 0;
-    }
-  table_index = p[0];
+  memset (&pfx, 0, sizeof (pfx));
+  memset (&zero_addr, 0, sizeof (zero_addr));
+  pfx.fp_proto = FIB_PROTOCOL_IP4;
 
   for (iter = 0; iter < niter; iter++)
     {
@@ -218,19 +203,18 @@ thrash (vlib_main_t * vm,
       for (i = 0; i < nroutes; i++)
         {
           tr = pool_elt_at_index (tm->route_pool, i);
-          cmd = format (0, "add table %d %U/%d via test-eth%d",
-                        table_id,
-                        format_ip4_address, &tr->address, 
-                        tr->mask_width, tr->interface_id);
-          vec_add1(cmd,0);
           if (verbose)
-            fformat(stderr, "ip route %s\n", cmd);
-          unformat_init_string (&cmd_input, (char *) cmd, vec_len(cmd)-1);
-          error = vnet_ip_route_cmd (vm, &cmd_input, cmd_arg);
-          if (error)
-            clib_error_report(error);
-          unformat_free (&cmd_input);
-          vec_free(cmd);
+            fformat (stderr, "ip route add table %d %U/%d via test-eth%d\n",
+                     table_id, format_ip4_address, &tr->address,
+                     tr->mask_width, tr->interface_id);
+          pfx.fp_len = tr->mask_width;
+          pfx.fp_addr.ip4 = tr->address;
+          fib_table_entry_path_add (table_index, &pfx, FIB_SOURCE_CLI,
+                                    FIB_ENTRY_FLAG_NONE, FIB_PROTOCOL_IP4,
+                                    &zero_addr,
+                                    tm->sw_if_indices[tr->interface_id],
+                                    ~0, 1, MPLS_LABEL_INVALID,
+                                    FIB_ROUTE_PATH_FLAG_NONE);
         }
       /* Probe them */
       for (i = 0; i < nroutes; i++)
@@ -253,25 +237,13 @@ thrash (vlib_main_t * vm,
         {
           int j;
           tr = pool_elt_at_index (tm->route_pool, i);
-          if (0)
-              cmd = format (0, "del table %d %U/%d via test-eth%d",
-                            table_id,
-                        format_ip4_address, &tr->address, 
-                            tr->mask_width, tr->interface_id);
-          else
-              cmd = format (0, "del table %d %U/%d",
-                            table_id,
-                            format_ip4_address, &tr->address, 
-                            tr->mask_width);
-          vec_add1(cmd,0);
           if (verbose)
-            fformat(stderr, "ip route %s\n", cmd);
-          unformat_init_string (&cmd_input, (char *) cmd, vec_len(cmd)-1);
-          error = vnet_ip_route_cmd (vm, &cmd_input, cmd_arg);
-          if (error)
-            clib_error_report(error);
-          unformat_free (&cmd_input);
-          vec_free(cmd);
+            fformat (stderr, "ip route del table %d %U/%d\n",
+                     table_id, format_ip4_address, &tr->address,
+                     tr->mask_width);
+          pfx.fp_len = tr->mask_width;
+          pfx.fp_addr.ip4 = tr->address;
+          fib_table_entry_delete (table_index, &pfx, FIB_SOURCE_CLI);
 
           /* Make sure all undeleted routes still work */
           for (j = i+1; j < nroutes; j++)
@@ -302,8 +274,7 @@ thrash (vlib_main_t * vm,
 }
 
 /*?
- * This command in not in the build by default. It is an internal
- * command used to test the route functonality.
+ * This is an internal command used to test the route functonality.
  *
  * Create test routes on IPv4 FIB table 11. Table will be created if it
  * does not exist.
@@ -327,6 +298,275 @@ VLIB_CLI_COMMAND (test_route_command, static) = {
 };
 /* *INDENT-ON* */
 
+/*
+ * Approximate prefix length distribution of a full BGP table, in
+ * percent. Used when no prefix file is supplied.
+ */
+static const struct {
+  u8 length;
+  u8 percent;
+} bgp_prefix_length_mix[] = {
+  { 8, 1 }, { 12, 1 }, { 14, 1 }, { 16, 2 }, { 17, 1 }, { 18, 2 },
+  { 19, 4 }, { 20, 5 }, { 21, 5 }, { 22, 10 }, { 23, 9 }, { 24, 59 },
+};
+
+static u32
+bgp_random_prefix_length (u32 * seed)
+{
+  u32 r = random_u32 (seed) % 100;
+  u32 i, sum = 0;
+
+  for (i = 0; i < ARRAY_LEN (bgp_prefix_length_mix); i++)
+    {
+      sum += bgp_prefix_length_mix[i].percent;
+      if (r < sum)
+        return bgp_prefix_length_mix[i].length;
+    }
+  return 24;
+}
+
+static f64
+mtrie_bench_lookups (ip4_fib_mtrie_t * m, ip4_address_t * addrs,
+                     u32 niter, u32 * checksum)
+{
+  ip4_fib_mtrie_leaf_t leaf;
+  f64 before;
+  u32 i, j, sum = 0;
+
+  before = vlib_time_now (vlib_get_main ());
+
+  for (j = 0; j < niter; j++)
+    for (i = 0; i < vec_len (addrs); i++)
+      {
+        leaf = ip4_fib_mtrie_lookup_step_one (m, &addrs[i]);
+        leaf = ip4_fib_mtrie_lookup_step (m, leaf, &addrs[i], 2);
+        leaf = ip4_fib_mtrie_lookup_step (m, leaf, &addrs[i], 3);
+        leaf = (leaf == IP4_FIB_MTRIE_LEAF_EMPTY ? m->default_leaf : leaf);
+        sum += ip4_fib_mtrie_leaf_get_adj_index (leaf);
+      }
+
+  *checksum = sum;
+  return vlib_time_now (vlib_get_main ()) - before;
+}
+
+/*
+ * Build the same route set into an 8-8-8-8 and a 16-8-8 mtrie, check
+ * that both layouts agree, and compare lookup rate and memory usage.
+ */
+static clib_error_t *
+mtrie_bench (vlib_main_t * vm,
+             unformat_input_t * main_input, vlib_cli_command_t * cmd_arg)
+{
+  unformat_input_t _line_input, * line_input = &_line_input;
+  u32 seed = 0xdeaddabe;
+  u32 nroutes = 500000;
+  u32 naddrs = 1 << 20;
+  u32 niter = 10;
+  u8 * prefix_file = 0;
+  ip4_address_t * prefixes = 0, * addrs = 0, a;
+  u32 * lengths = 0, len;
+  ip4_fib_t * fibs[2];
+  ip4_main_t * im = &ip4_main;
+  unformat_input_t file_input;
+  clib_error_t * error = 0;
+  u32 i, l, n_del, checksum[2];
+  u32 * order = 0;
+  f64 delta;
+  int fd;
+
+  if (unformat_user (main_input, unformat_line_input, line_input))
+    {
+      while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+        {
+          if (unformat (line_input, "seed %d", &seed))
+            ;
+          else if (unformat (line_input, "nroutes %d", &nroutes))
+            ;
+          else if (unformat (line_input, "naddrs %d", &naddrs))
+            ;
+          else if (unformat (line_input, "niter %d", &niter))
+            ;
+          else if (unformat (line_input, "prefixes %s", &prefix_file))
+            ;
+          else
+            return clib_error_return (0, "unknown input `%U'",
+                                      format_unformat_error, line_input);
+        }
+    }
+
+  /* Prefix file: one a.b.c.d/len per line, e.g. a dump of a BGP RIB */
+  if (prefix_file)
+    {
+      vec_add1 (prefix_file, 0);
+      fd = open ((char *) prefix_file, O_RDONLY);
+      if (fd < 0)
+        return clib_error_return_unix (0, "open `%s'", prefix_file);
+
+      unformat_init_unix_file (&file_input, fd);
+      while (unformat_check_input (&file_input) != UNFORMAT_END_OF_INPUT)
+        {
+          if (unformat (&file_input, "%U/%d", unformat_ip4_address, &a, &len)
+              && len <= 32)
+            {
+              a.as_u32 &= im->fib_masks[len];
+              vec_add1 (prefixes, a);
+              vec_add1 (lengths, len);
+            }
+          else
+            unformat_skip_line (&file_input);
+        }
+      unformat_free (&file_input);
+      close (fd);
+      vec_free (prefix_file);
+    }
+  else
+    {
+      for (i = 0; i < nroutes; i++)
+        {
+          len = bgp_random_prefix_length (&seed);
+          a.as_u32 = random_u32 (&seed) & im->fib_masks[len];
+          vec_add1 (prefixes, a);
+          vec_add1 (lengths, len);
+        }
+    }
+
+  /* Lookup addresses fall inside random installed prefixes */
+  for (i = 0; i < naddrs; i++)
+    {
+      u32 r = random_u32 (&seed) % vec_len (prefixes);
+      a.as_u32 = prefixes[r].as_u32
+        | (random_u32 (&seed) & ~im->fib_masks[lengths[r]]);
+      vec_add1 (addrs, a);
+    }
+
+  for (l = 0; l < 2; l++)
+    {
+      fibs[l] = clib_mem_alloc_aligned (sizeof (ip4_fib_t),
+                                        CLIB_CACHE_LINE_BYTES);
+      memset (fibs[l], 0, sizeof (ip4_fib_t));
+      ip4_mtrie_init (&fibs[l]->mtrie,
+                      l ? IP4_FIB_MTRIE_LAYOUT_16_8_8
+                      : IP4_FIB_MTRIE_LAYOUT_8_8_8_8);
+
+      /* Use the route index + 1 as the adjacency index */
+      for (i = 0; i < vec_len (prefixes); i++)
+        ip4_fib_mtrie_add_del_route (fibs[l], prefixes[i], lengths[i],
+                                     i + 1, /* is_del */ 0);
+    }
+
+  vlib_cli_output (vm, "%d routes, %d lookup addresses, %d iterations",
+                   vec_len (prefixes), vec_len (addrs), niter);
+
+  for (i = 0; i < vec_len (addrs); i++)
+    if (ip4_mtrie_lookup_address (&fibs[0]->mtrie, addrs[i])
+        != ip4_mtrie_lookup_address (&fibs[1]->mtrie, addrs[i]))
+      {
+        error = clib_error_return (0, "layouts disagree on %U",
+                                   format_ip4_address, &addrs[i]);
+        goto done;
+      }
+
+  for (l = 0; l < 2; l++)
+    {
+      delta = mtrie_bench_lookups (&fibs[l]->mtrie, addrs, niter,
+                                   &checksum[l]);
+      vlib_cli_output (vm, "%8s: %.2f Mlookups/s, memory %U",
+                       l ? "16-8-8" : "8-8-8-8",
+                       delta > 0 ?
+                       (f64) niter * vec_len (addrs) / delta / 1e6 : 0.0,
+                       format_memory_size,
+                       ip4_fib_mtrie_memory_usage (&fibs[l]->mtrie));
+    }
+
+  if (checksum[0] != checksum[1])
+    {
+      error = clib_error_return (0, "lookup checksums differ");
+      goto done;
+    }
+
+  /*
+   * Delete pass. With no FIB behind these mtries nothing less specific
+   * is re-inserted, so delete longest prefixes first: a covering route
+   * then never hides a more specific one still installed.
+   */
+  for (len = 33; len > 0; len--)
+    for (i = 0; i < vec_len (prefixes); i++)
+      if (lengths[i] == len - 1)
+        vec_add1 (order, i);
+
+  for (l = 0; l < 2; l++)
+    {
+      n_del = vec_len (order) / 2;
+      delta = vlib_time_now (vm);
+      for (i = 0; i < n_del; i++)
+        ip4_fib_mtrie_add_del_route (fibs[l], prefixes[order[i]],
+                                     lengths[order[i]], order[i] + 1,
+                                     /* is_del */ 1);
+      delta = vlib_time_now (vm) - delta;
+      vlib_cli_output (vm, "%8s: %.2f Mdeletes/s",
+                       l ? "16-8-8" : "8-8-8-8",
+                       delta > 0 ? n_del / delta / 1e6 : 0.0);
+    }
+
+  for (i = 0; i < vec_len (addrs); i++)
+    if (ip4_mtrie_lookup_address (&fibs[0]->mtrie, addrs[i])
+        != ip4_mtrie_lookup_address (&fibs[1]->mtrie, addrs[i]))
+      {
+        error = clib_error_return (0, "layouts disagree on %U after "
+                                   "deleting %d routes",
+                                   format_ip4_address, &addrs[i], n_del);
+        goto done;
+      }
+
+  for (l = 0; l < 2; l++)
+    {
+      for (i = n_del; i < vec_len (order); i++)
+        ip4_fib_mtrie_add_del_route (fibs[l], prefixes[order[i]],
+                                     lengths[order[i]], order[i] + 1,
+                                     /* is_del */ 1);
+      for (i = 0; i < vec_len (addrs); i++)
+        if (ip4_mtrie_lookup_address (&fibs[l]->mtrie, addrs[i]) != 0)
+          {
+            error = clib_error_return (0, "%s: %U still routed after "
+                                       "deleting all routes",
+                                       l ? "16-8-8" : "8-8-8-8",
+                                       format_ip4_address, &addrs[i]);
+            goto done;
+          }
+    }
+
+ done:
+  for (l = 0; l < 2; l++)
+    {
+      ip4_fib_free (&fibs[l]->mtrie);
+      clib_mem_free (fibs[l]);
+    }
+  vec_free (order);
+  vec_free (prefixes);
+  vec_free (lengths);
+  vec_free (addrs);
+  return error;
+}
+
+/*?
+ * Compare lookup rate and memory usage of the 8-8-8-8 and 16-8-8
+ * mtrie layouts on the same route set: either a prefix file (one
+ * <em>a.b.c.d/len</em> per line, e.g. a BGP RIB dump) or random routes
+ * with a BGP-like prefix length distribution. The routes are then
+ * deleted from both layouts, half first; the layouts must agree after
+ * the first half and must be empty at the end.
+ *
+ * @cliexpar
+ * @cliexcmd{test mtrie prefixes /tmp/bgp-rib.txt naddrs 4000000}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_mtrie_command, static) = {
+    .path = "test mtrie",
+    .short_help = "test mtrie [prefixes <file>] [nroutes <n>] [naddrs <n>] [niter <n>] [seed <seed-num>]",
+    .function = mtrie_bench,
+};
+/* *INDENT-ON* */
+
 clib_error_t *test_route_init (vlib_main_t *vm)
 {
   return 0;
@@ -123,12 +123,66 @@ typedef struct ip6_fib_table_instance_t_ {
   i32 dst_address_length_refcounts[129];
 } ip6_fib_table_instance_t;
 
+/**
+ * The algorithm used to search the forwarding table
+ */
+typedef enum ip6_fib_fwding_lookup_algo_t_ {
+    /**
+     * One hash probe per distinct prefix length, longest first.
+     */
+    IP6_FIB_FWDING_LOOKUP_LINEAR,
+    /**
+     * Binary search on prefix lengths, guided by markers.
+     */
+    IP6_FIB_FWDING_LOOKUP_BINARY,
+} ip6_fib_fwding_lookup_algo_t;
+
+/**
+ * A node in the path compressed binary trie of forwarding prefixes.
+ * Control plane only; it is used to find the best matching prefix of
+ * a marker and the more specifics of a prefix.
+ */
+typedef struct ip6_fib_bsl_node_t_ {
+  ip6_address_t addr;
+  u32 child[2];
+  u8 len;
+  u8 is_prefix;
+} ip6_fib_bsl_node_t;
+
+/**
+ * Binary search on prefix lengths (Waldvogel et al.).
+ * The hash holds every forwarding prefix plus a marker at each shorter
+ * length the search visits on its way to that prefix. A marker
+ * records the length of its own best matching prefix, so a search
+ * that follows a marker and then fails needs at most one more probe.
+ * A lookup costs log2 of the number of distinct prefix lengths probes.
+ */
+typedef struct ip6_fib_bsl_t_ {
+  /* prefixes and markers */
+  BVT(clib_bihash) hash;
+
+  /* distinct prefix lengths in ascending order */
+  u8 * lengths;
+  u32 prefix_counts[129];
+  u32 n_markers;
+
+  /* pool of trie nodes and the trie root of each FIB */
+  ip6_fib_bsl_node_t * nodes;
+  u32 * root_by_fib_index;
+} ip6_fib_bsl_t;
+
 typedef struct ip6_main_t {
   /**
    * The two FIB tables; fwding and non-fwding
    */
   ip6_fib_table_instance_t ip6_table[IP6_FIB_NUM_TABLES];
 
+  /** forwarding lookup algorithm, see ip6 startup config */
+  ip6_fib_fwding_lookup_algo_t fwding_lookup_algo;
+
+  /** binary search on lengths view of the forwarding table */
+  ip6_fib_bsl_t fwding_bsl;
+
   ip_lookup_main_t lookup_main;
 
   /* Pool of FIBs. */
@@ -2694,6 +2694,9 @@ ip6_lookup_init (vlib_main_t * vm)
                         im->lookup_table_nbuckets,
                         im->lookup_table_size);
 
+  if (IP6_FIB_FWDING_LOOKUP_BINARY == im->fwding_lookup_algo)
+    ip6_fib_table_fwding_lookup_algo_set (im->fwding_lookup_algo);
+
   /* Create FIB with index 0 and table id of 0. */
   fib_table_find_or_create_and_lock(FIB_PROTOCOL_IP6, 0);
 
@@ -3197,6 +3200,10 @@ ip6_config (vlib_main_t * vm, unformat_input_t * input)
       heapsize = ((u64)tmp) << 30;
     else if (unformat (input, "heap-size %dG", &tmp))
       heapsize = ((u64)tmp) << 30;
+    else if (unformat (input, "fib-lookup linear"))
+      im->fwding_lookup_algo = IP6_FIB_FWDING_LOOKUP_LINEAR;
+    else if (unformat (input, "fib-lookup binary"))
+      im->fwding_lookup_algo = IP6_FIB_FWDING_LOOKUP_BINARY;
     else
       return clib_error_return (0, "unknown input '%U'",
                                 format_unformat_error, input);
@@ -42,7 +42,8 @@ typedef enum
  _(RX_PKTS, "ESP pkts received")                    \
  _(NO_BUFFER, "No buffer (packet dropped)")         \
  _(DECRYPTION_FAILED, "ESP encryption failed")      \
- _(SEQ_CYCLED, "sequence number cycled")
+ _(SEQ_CYCLED, "sequence number cycled")            \
+ _(CHAINED_BUFFER, "chained packet too long to encrypt")
 
 
 typedef enum
@@ -194,6 +195,16 @@ esp_encrypt_node_fn (vlib_main_t * vm,
 	  sa_index0 = vnet_buffer (i_b0)->output_features.ipsec_sad_index;
 	  sa0 = pool_elt_at_index (im->sad, sa_index0);
 
+	  /* Encryption works on contiguous packets; error-drop counts it */
+	  if (PREDICT_FALSE (vlib_buffer_chain_linearize (vm, i_b0)))
+	    {
+	      i_b0->error = node->errors[ESP_ENCRYPT_ERROR_CHAINED_BUFFER];
+	      o_bi0 = i_bi0;
+	      to_next[0] = o_bi0;
+	      to_next += 1;
+	      goto trace;
+	    }
+
 	  if (PREDICT_FALSE (esp_seq_advance (sa0)))
 	    {
 	      clib_warning ("sequence number counter has cycled SPI %u",
@@ -21,6 +21,7 @@
  * @brief  dynamic tap interface hookup
  */
 
+#define _GNU_SOURCE		/* for sendmmsg */
 #include <fcntl.h>		/* for open */
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -31,6 +32,8 @@
 
 #include <linux/if_arp.h>
 #include <linux/if_tun.h>
+#include <linux/if_packet.h>
+#include <linux/virtio_net.h>
 
 #include <vlib/vlib.h>
 #include <vlib/unix/unix.h>
@@ -53,11 +56,27 @@ static void tapcli_nopunt_frame (vlib_main_t * vm,
                                  vlib_node_runtime_t * node,
                                  vlib_frame_t * frame);
 /**
- * @brief Struct for the tapcli interface
+ * @brief One /dev/net/tun file descriptor of a tapcli interface
  */
 typedef struct {
-  u32 unix_fd;
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  /** Serializes tx when there are more threads than queues */
+  volatile u32 * lockp;
+  int unix_fd;
   u32 unix_file_index;
+  /** Thread which reads this queue */
+  u32 input_cpu_index;
+  u64 n_rx_packets;
+} tapcli_queue_t;
+
+/**
+ * @brief Struct for the tapcli interface
+ */
+typedef struct {
+  /** One per IFF_MULTI_QUEUE fd, or just one */
+  tapcli_queue_t * queues;
+  /** Packets are preceded by a struct virtio_net_hdr (IFF_VNET_HDR) */
+  u8 vnet_hdr;
   u32 provision_fd;
   /** For counters */
   u32 sw_if_index;
@@ -74,6 +93,9 @@ typedef struct {
  */
 typedef struct {
   u16 sw_if_index;
+  u16 queue_id;
+  u8 has_vnet_hdr;
+  struct virtio_net_hdr vnet_hdr;
 } tapcli_rx_trace_t;
 
 /**
@@ -91,15 +113,22 @@ u8 * format_tapcli_rx_trace (u8 * s, va_list * va)
   CLIB_UNUSED (vlib_node_t * node) = va_arg (*va, vlib_node_t *);
   vnet_main_t * vnm = vnet_get_main();
   tapcli_rx_trace_t * t = va_arg (*va, tapcli_rx_trace_t *);
-  s = format (s, "%U", format_vnet_sw_if_index_name,
-                vnm, t->sw_if_index);
+  s = format (s, "%U queue %d", format_vnet_sw_if_index_name,
+                vnm, t->sw_if_index, t->queue_id);
+  if (t->has_vnet_hdr)
+    s = format (s, "\n  vnet_hdr flags 0x%x gso_type %d hdr_len %d "
+                "gso_size %d csum_start %d csum_offset %d",
+                t->vnet_hdr.flags, t->vnet_hdr.gso_type,
+                t->vnet_hdr.hdr_len, t->vnet_hdr.gso_size,
+                t->vnet_hdr.csum_start, t->vnet_hdr.csum_offset);
   return s;
 }
 
 /**
- * @brief TAPCLI main state struct
+ * @brief TAPCLI per thread state
  */
 typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
   /** Vector of iovecs for readv/writev calls. */
   struct iovec * iovecs;
 
@@ -107,6 +136,21 @@ typedef struct {
      of VLIB_FRAME_SIZE (256). */
   u32 * rx_buffers;
 
+  /** Interfaces to read in this dispatch */
+  u32 * ready_interface_indices;
+} tapcli_per_thread_t;
+
+/**
+ * @brief TAPCLI main state struct
+ */
+typedef struct {
+  /** Per thread rx buffers and iovecs */
+  tapcli_per_thread_t * threads;
+
+  /** Threads which poll tap queues, the main thread alone uses epoll */
+  u32 input_cpu_first_index;
+  u32 input_cpu_count;
+
   /** tap device destination MAC address. Required, or Linux drops pkts */
   u8 ether_dst_mac[6];
 
@@ -166,7 +210,11 @@ tapcli_tx (vlib_main_t * vm,
   u32 * buffers = vlib_frame_args (frame);
   uword n_packets = frame->n_vectors;
   tapcli_main_t * tm = &tapcli_main;
-  tapcli_interface_t * ti;
+  tapcli_per_thread_t * pt = vec_elt_at_index (tm->threads, vm->cpu_index);
+  tapcli_interface_t * ti = 0;
+  tapcli_queue_t * q = 0;
+  struct virtio_net_hdr vnet_hdr = { 0 };
+  u32 last_sw_if_index = ~0;
   int i;
 
   for (i = 0; i < n_packets; i++)
@@ -190,23 +238,45 @@ tapcli_tx (vlib_main_t * vm,
       hw = vnet_get_sup_hw_interface (tm->vnet_main, tx_sw_if_index);
       tx_sw_if_index = hw->sw_if_index;
 
-      p = hash_get (tm->tapcli_interface_index_by_sw_if_index, 
-                    tx_sw_if_index);
-      if (p == 0)
+      /* Frames almost always go to one interface, look it up once */
+      if (tx_sw_if_index != last_sw_if_index)
         {
-          clib_warning ("sw_if_index %d unknown", tx_sw_if_index);
-          /* $$$ leak, but this should never happen... */
-          continue;
+          if (q && q->lockp)
+            *q->lockp = 0;
+          q = 0;
+          last_sw_if_index = ~0;
+
+          p = hash_get (tm->tapcli_interface_index_by_sw_if_index, 
+                        tx_sw_if_index);
+          if (p == 0)
+            {
+              clib_warning ("sw_if_index %d unknown", tx_sw_if_index);
+              /* $$$ leak, but this should never happen... */
+              continue;
+            }
+          ti = vec_elt_at_index (tm->tapcli_interfaces, p[0]);
+          q = vec_elt_at_index (ti->queues,
+                                vm->cpu_index % vec_len (ti->queues));
+          if (q->lockp)
+            while (__sync_lock_test_and_set (q->lockp, 1))
+              ;
+          last_sw_if_index = tx_sw_if_index;
         }
-      else
-        ti = vec_elt_at_index (tm->tapcli_interfaces, p[0]);
 
       /* Re-set iovecs if present. */
-      if (tm->iovecs)
-	_vec_len (tm->iovecs) = 0;
+      if (pt->iovecs)
+	_vec_len (pt->iovecs) = 0;
+
+      /* No offloads asked for, vlib computes every checksum */
+      if (ti->vnet_hdr)
+        {
+          vec_add2 (pt->iovecs, iov, 1);
+          iov->iov_base = &vnet_hdr;
+          iov->iov_len = sizeof (vnet_hdr);
+        }
 
       /* VLIB buffer chain -> Unix iovec(s). */
-      vec_add2 (tm->iovecs, iov, 1);
+      vec_add2 (pt->iovecs, iov, 1);
       iov->iov_base = b->data + b->current_data;
       iov->iov_len = l = b->current_length;
 
@@ -215,7 +285,7 @@ tapcli_tx (vlib_main_t * vm,
 	  do {
 	    b = vlib_get_buffer (vm, b->next_buffer);
 
-	    vec_add2 (tm->iovecs, iov, 1);
+	    vec_add2 (pt->iovecs, iov, 1);
 
 	    iov->iov_base = b->data + b->current_data;
 	    iov->iov_len = b->current_length;
@@ -223,10 +293,15 @@ tapcli_tx (vlib_main_t * vm,
 	  } while (b->flags & VLIB_BUFFER_NEXT_PRESENT);
 	}
 
-      if (writev (ti->unix_fd, tm->iovecs, vec_len (tm->iovecs)) < l)
+      /* Still one syscall per packet: tun fds have no sendmmsg, and
+         batching needs a vhost-net virtio ring, which is not done here */
+      if (writev (q->unix_fd, pt->iovecs, vec_len (pt->iovecs)) < l)
 	clib_unix_warning ("writev");
     }
 
+  if (q && q->lockp)
+    *q->lockp = 0;
+
   vlib_buffer_free(vm, vlib_frame_vector_args(frame), frame->n_vectors);
 
   return n_packets;
@@ -249,6 +324,55 @@ enum {
 
 
 
+/**
+ * @brief Act on the virtio-net header in front of a received packet
+ *
+ * Only TUN_F_CSUM is offered to the kernel, so it may leave the L4
+ * checksum to us but never sends GSO packets. A partial checksum is
+ * completed here, so the packet can be forwarded as is.
+ *
+ * @param *vm - vlib_main_t
+ * @param *b - vlib_buffer_t, first buffer of the packet
+ * @param *h - struct virtio_net_hdr
+ * @param n_bytes - u32, packet length
+ *
+ * @return error - tapcli_error_t, TAPCLI_ERROR_NONE if the packet is good
+ *
+ */
+static u32
+tapcli_rx_vnet_hdr (vlib_main_t * vm, vlib_buffer_t * b,
+                    struct virtio_net_hdr * h, u32 n_bytes)
+{
+  if (PREDICT_FALSE (h->gso_type != VIRTIO_NET_HDR_GSO_NONE))
+    return TAPCLI_ERROR_GSO;
+
+  if (h->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+    {
+      u16 * csum;
+      ip_csum_t sum;
+
+      if (PREDICT_FALSE (h->csum_start + h->csum_offset + sizeof (*csum)
+                         > b->current_length))
+        return TAPCLI_ERROR_CSUM_OFFSET;
+
+      /* The checksum field holds the pseudo header sum already */
+      sum = ip_incremental_checksum_buffer (vm, b, h->csum_start,
+                                            n_bytes - h->csum_start, 0);
+      csum = vlib_buffer_get_current (b) + h->csum_start + h->csum_offset;
+      csum[0] = ~ip_csum_fold (sum);
+      /* like the kernel, never turn a udp checksum into "none" */
+      if (csum[0] == 0)
+        csum[0] = 0xffff;
+      b->flags |= IP_BUFFER_L4_CHECKSUM_COMPUTED
+        | IP_BUFFER_L4_CHECKSUM_CORRECT;
+    }
+  else if (h->flags & VIRTIO_NET_HDR_F_DATA_VALID)
+    b->flags |= IP_BUFFER_L4_CHECKSUM_COMPUTED
+      | IP_BUFFER_L4_CHECKSUM_CORRECT;
+
+  return TAPCLI_ERROR_NONE;
+}
+
 /**
  * @brief Dispatch tapcli RX node function for node tap_cli_rx
  *
@@ -256,16 +380,21 @@ enum {
  * @param *vm - vlib_main_t
  * @param *node - vlib_node_runtime_t
  * @param *ti - tapcli_interface_t
+ * @param *q - tapcli_queue_t
  *
  * @return n_packets - uword
  *
  */
 static uword tapcli_rx_iface(vlib_main_t * vm,
                             vlib_node_runtime_t * node,
-                            tapcli_interface_t * ti)
+                            tapcli_interface_t * ti,
+                            tapcli_queue_t * q)
 {
   tapcli_main_t * tm = &tapcli_main;
+  tapcli_per_thread_t * pt = vec_elt_at_index (tm->threads, vm->cpu_index);
   const uword buffer_size = VLIB_BUFFER_DATA_SIZE;
+  struct virtio_net_hdr vnet_hdr;
+  u32 n_hdr_iovecs = ti->vnet_hdr ? 1 : 0;
   u32 n_trace = vlib_get_trace_count (vm, node);
   u8 set_trace = 0;
 
@@ -275,6 +404,7 @@ static uword tapcli_rx_iface(vlib_main_t * vm,
   u32 next = node->cached_next_index;
   u32 n_left_to_next, next_index;
   u32 *to_next;
+  u32 n_rx_packets = 0;
 
   vnm = vnet_get_main();
   si = vnet_get_sw_interface (vnm, ti->sw_if_index);
@@ -287,33 +417,39 @@ static uword tapcli_rx_iface(vlib_main_t * vm,
     u32 bi_first, bi;
     word n_bytes_in_packet;
     int j, n_bytes_left;
+    u32 error;
 
-    if (PREDICT_FALSE(vec_len(tm->rx_buffers) < tm->mtu_buffers)) {
-      uword len = vec_len(tm->rx_buffers);
-      _vec_len(tm->rx_buffers) +=
-          vlib_buffer_alloc_from_free_list(vm, &tm->rx_buffers[len],
+    if (PREDICT_FALSE(vec_len(pt->rx_buffers) < tm->mtu_buffers)) {
+      uword len = vec_len(pt->rx_buffers);
+      _vec_len(pt->rx_buffers) +=
+          vlib_buffer_alloc_from_free_list(vm, &pt->rx_buffers[len],
                             VLIB_FRAME_SIZE - len, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
-      if (PREDICT_FALSE(vec_len(tm->rx_buffers) < tm->mtu_buffers)) {
+      if (PREDICT_FALSE(vec_len(pt->rx_buffers) < tm->mtu_buffers)) {
           vlib_node_increment_counter(vm, tapcli_rx_node.index,
                                       TAPCLI_ERROR_BUFFER_ALLOC,
-                                      tm->mtu_buffers - vec_len(tm->rx_buffers));
+                                      tm->mtu_buffers - vec_len(pt->rx_buffers));
         break;
       }
     }
 
-    uword i_rx = vec_len (tm->rx_buffers) - 1;
+    uword i_rx = vec_len (pt->rx_buffers) - 1;
 
     /* Allocate RX buffers from end of rx_buffers.
            Turn them into iovecs to pass to readv. */
-    vec_validate (tm->iovecs, tm->mtu_buffers - 1);
+    vec_validate (pt->iovecs, n_hdr_iovecs + tm->mtu_buffers - 1);
+    if (n_hdr_iovecs) {
+      pt->iovecs[0].iov_base = &vnet_hdr;
+      pt->iovecs[0].iov_len = sizeof (vnet_hdr);
+    }
     for (j = 0; j < tm->mtu_buffers; j++) {
-      b = vlib_get_buffer (vm, tm->rx_buffers[i_rx - j]);
-      tm->iovecs[j].iov_base = b->data;
-      tm->iovecs[j].iov_len = buffer_size;
+      b = vlib_get_buffer (vm, pt->rx_buffers[i_rx - j]);
+      pt->iovecs[n_hdr_iovecs + j].iov_base = b->data;
+      pt->iovecs[n_hdr_iovecs + j].iov_len = buffer_size;
     }
 
-    n_bytes_left = readv (ti->unix_fd, tm->iovecs, tm->mtu_buffers);
-    n_bytes_in_packet = n_bytes_left;
+    /* One readv per packet, see the writev in tapcli_tx */
+    n_bytes_left = readv (q->unix_fd, pt->iovecs,
+                          n_hdr_iovecs + tm->mtu_buffers);
     if (n_bytes_left <= 0) {
       if (errno != EAGAIN) {
         vlib_node_increment_counter(vm, tapcli_rx_node.index,
@@ -321,9 +457,12 @@ static uword tapcli_rx_iface(vlib_main_t * vm,
       }
       break;
     }
+    if (n_hdr_iovecs)
+      n_bytes_left -= sizeof (vnet_hdr);
+    n_bytes_in_packet = n_bytes_left;
 
-    bi_first = tm->rx_buffers[i_rx];
-    b = b_first = vlib_get_buffer (vm, tm->rx_buffers[i_rx]);
+    bi_first = pt->rx_buffers[i_rx];
+    b = b_first = vlib_get_buffer (vm, pt->rx_buffers[i_rx]);
     prev = NULL;
 
     while (1) {
@@ -341,11 +480,11 @@ static uword tapcli_rx_iface(vlib_main_t * vm,
         break;
 
       i_rx--;
-      bi = tm->rx_buffers[i_rx];
+      bi = pt->rx_buffers[i_rx];
       b = vlib_get_buffer (vm, bi);
     }
 
-    _vec_len (tm->rx_buffers) = i_rx;
+    _vec_len (pt->rx_buffers) = i_rx;
 
     b_first->total_length_not_including_first_buffer =
         (n_bytes_in_packet > buffer_size) ? n_bytes_in_packet - buffer_size : 0;
@@ -359,15 +498,21 @@ static uword tapcli_rx_iface(vlib_main_t * vm,
     vnet_buffer (b_first)->sw_if_index[VLIB_RX] = ti->sw_if_index;
     vnet_buffer (b_first)->sw_if_index[VLIB_TX] = (u32)~0;
 
-    b_first->error = node->errors[TAPCLI_ERROR_NONE];
+    error = TAPCLI_ERROR_NONE;
+    if (n_hdr_iovecs)
+      error = tapcli_rx_vnet_hdr (vm, b_first, &vnet_hdr, n_bytes_in_packet);
+
+    b_first->error = node->errors[error];
     next_index = TAPCLI_RX_NEXT_ETHERNET_INPUT;
     next_index = (ti->per_interface_next_index != ~0) ?
         ti->per_interface_next_index : next_index;
-    next_index = admin_down ? TAPCLI_RX_NEXT_DROP : next_index;
+    next_index = (admin_down || error != TAPCLI_ERROR_NONE) ?
+        TAPCLI_RX_NEXT_DROP : next_index;
 
     to_next[0] = bi_first;
     to_next++;
     n_left_to_next--;
+    n_rx_packets++;
 
     vlib_validate_buffer_enqueue_x1 (vm, node, next,
                                      to_next, n_left_to_next,
@@ -388,13 +533,18 @@ static uword tapcli_rx_iface(vlib_main_t * vm,
         set_trace = 1;
         tapcli_rx_trace_t *t0 = vlib_add_trace (vm, node, b_first, sizeof (*t0));
         t0->sw_if_index = si->sw_if_index;
+        t0->queue_id = q - ti->queues;
+        t0->has_vnet_hdr = n_hdr_iovecs;
+        if (n_hdr_iovecs)
+          clib_memcpy (&t0->vnet_hdr, &vnet_hdr, sizeof (vnet_hdr));
       }
     }
   }
   vlib_put_next_frame (vm, node, next, n_left_to_next);
   if (set_trace)
     vlib_set_trace_count (vm, node, n_trace);
-  return VLIB_FRAME_SIZE - n_left_to_next;
+  q->n_rx_packets += n_rx_packets;
+  return n_rx_packets;
 }
 
 /**
@@ -416,28 +566,46 @@ tapcli_rx (vlib_main_t * vm,
 	   vlib_frame_t * frame)
 {
   tapcli_main_t * tm = &tapcli_main;
-  static u32 * ready_interface_indices;
+  tapcli_per_thread_t * pt = vec_elt_at_index (tm->threads, vm->cpu_index);
+  u32 * ready_interface_indices = pt->ready_interface_indices;
   tapcli_interface_t * ti;
+  tapcli_queue_t * q;
   int i;
   u32 total_count = 0;
 
   vec_reset_length (ready_interface_indices);
-  clib_bitmap_foreach (i, tm->pending_read_bitmap,
-  ({
-    vec_add1 (ready_interface_indices, i);
-  }));
+
+  /* In polling mode (see adaptive mode, or workers) read every active
+     interface */
+  if (node->state == VLIB_NODE_STATE_POLLING)
+    {
+      vec_foreach (ti, tm->tapcli_interfaces)
+        if (ti->active)
+          vec_add1 (ready_interface_indices, ti - tm->tapcli_interfaces);
+    }
+  else
+    clib_bitmap_foreach (i, tm->pending_read_bitmap,
+    ({
+      vec_add1 (ready_interface_indices, i);
+    }));
+
+  pt->ready_interface_indices = ready_interface_indices;
 
   if (vec_len (ready_interface_indices) == 0)
     return 0;
 
   for (i = 0; i < vec_len(ready_interface_indices); i++)
   {
-    tm->pending_read_bitmap =
-        clib_bitmap_set (tm->pending_read_bitmap,
-                         ready_interface_indices[i], 0);
+    /* Only the main thread takes epoll interrupts */
+    if (vm->cpu_index == 0)
+      tm->pending_read_bitmap =
+          clib_bitmap_set (tm->pending_read_bitmap,
+                           ready_interface_indices[i], 0);
 
     ti = vec_elt_at_index (tm->tapcli_interfaces, ready_interface_indices[i]);
-    total_count += tapcli_rx_iface(vm, node, ti);
+    vec_foreach (q, ti->queues)
+      if (q->input_cpu_index == vm->cpu_index)
+        total_count += tapcli_rx_iface(vm, node, ti, q);
   }
   return total_count; //This might return more than 256.
 }
@@ -454,6 +622,7 @@ VLIB_REGISTER_NODE (tapcli_rx_node, static) = {
   .name = "tapcli-rx",
   .type = VLIB_NODE_TYPE_INPUT,
   .state = VLIB_NODE_STATE_INTERRUPT,
+  .flags = VLIB_NODE_FLAG_ADAPTIVE_MODE,
   .vector_size = 4,
   .n_errors = TAPCLI_N_ERROR,
   .error_strings = tapcli_rx_error_strings,
@@ -613,6 +782,34 @@ static u8 * format_tapcli_interface_name (u8 * s, va_list * args)
   return s;
 }
 
+/**
+ * @brief Formatter for TAPCLI device, queues and vnet_hdr mode
+ *
+ * @param *s - formatter string
+ * @param *args - va_list
+ *
+ * @return *s - formatted string
+ *
+ */
+static u8 * format_tapcli_device (u8 * s, va_list * args)
+{
+  u32 i = va_arg (*args, u32);
+  CLIB_UNUSED (int verbose) = va_arg (*args, int);
+  tapcli_main_t * tm = &tapcli_main;
+  tapcli_interface_t * ti = vec_elt_at_index (tm->tapcli_interfaces, i);
+  uword indent = format_get_indent (s);
+  tapcli_queue_t * q;
+
+  s = format (s, "Linux tap %s, %d queue%s%s", ti->ifr.ifr_name,
+              vec_len (ti->queues), vec_len (ti->queues) == 1 ? "" : "s",
+              ti->vnet_hdr ? ", vnet_hdr" : "");
+  vec_foreach (q, ti->queues)
+    s = format (s, "\n%Uqueue %d: fd %d thread %d rx packets %llu",
+                format_white_space, indent + 2, q - ti->queues, q->unix_fd,
+                q->input_cpu_index, q->n_rx_packets);
+  return s;
+}
+
 /**
  * @brief Modify interface flags for TAPCLI interface
  *
@@ -734,6 +931,7 @@ VNET_DEVICE_CLASS (tapcli_dev_class,static) = {
   .name = "tapcli",
   .tx_function = tapcli_tx,
   .format_device_name = format_tapcli_interface_name,
+  .format_device = format_tapcli_device,
   .rx_redirect_to_node = tapcli_set_interface_next_node,
   .name_renumber = tap_name_renumber,
   .admin_up_down_function = tapcli_interface_admin_up_down,
@@ -801,45 +999,116 @@ static tapcli_interface_t *tapcli_get_new_tapif()
 }
 
 /**
- * @brief Connect a TAP interface
+ * @brief Poll tap queues on the workers while any tap interface exists
+ *
+ * Workers have no epoll, so they never put tapcli-rx in adaptive mode.
+ *
+ * @param state - vlib_node_state_t
+ *
+ */
+static void tapcli_set_input_node_state (vlib_node_state_t state)
+{
+  tapcli_main_t * tm = &tapcli_main;
+  u32 i;
+
+  if (tm->input_cpu_first_index == 0)
+    return;
+
+  for (i = tm->input_cpu_first_index;
+       i < tm->input_cpu_first_index + tm->input_cpu_count; i++)
+    {
+      vlib_node_set_adaptive_mode (vlib_mains[i], tapcli_rx_node.index,
+                                   /* enable */ 0, 0, 0);
+      vlib_node_set_state (vlib_mains[i], tapcli_rx_node.index, state);
+    }
+}
+
+/**
+ * @brief Connect a TAP interface with one or more queues
+ *
+ * With more than one queue the tap is opened IFF_MULTI_QUEUE, once per
+ * queue, and the kernel spreads flows over the fds. Queues are read by
+ * the workers if there are any, otherwise by the main thread on epoll.
+ * With vnet_hdr every packet carries a struct virtio_net_hdr and the
+ * kernel may hand over packets whose L4 checksum is still to be done.
  *
  * @param vm - vlib_main_t
  * @param intfc_name - u8
  * @param hwaddr_arg - u8
+ * @param n_queues - u32
+ * @param vnet_hdr - u8
  * @param sw_if_indexp - u32
  *
  * @return rc - int
  *
  */
-int vnet_tap_connect (vlib_main_t * vm, u8 * intfc_name, u8 *hwaddr_arg,
-                      u32 * sw_if_indexp)
+int vnet_tap_connect_queues (vlib_main_t * vm, u8 * intfc_name,
+                             u8 *hwaddr_arg, u32 n_queues, u8 vnet_hdr,
+                             u32 * sw_if_indexp)
 {
   tapcli_main_t * tm = &tapcli_main;
+  vlib_thread_main_t * vtm = vlib_get_thread_main ();
   tapcli_interface_t * ti = NULL;
+  tapcli_queue_t * q;
   struct ifreq ifr;
   int flags;
+  int * fds = 0, * fd;
   int dev_net_tun_fd;
   int dev_tap_fd = -1;
   clib_error_t * error;
   u8 hwaddr [6];
   int rv = 0;
+  u32 qid;
 
   if (tm->is_disabled)
     {
       return VNET_API_ERROR_FEATURE_DISABLED;
     }
 
-  flags = IFF_TAP | IFF_NO_PI;
+  if (n_queues < 1 || n_queues > TAP_MAX_QUEUES)
+    return VNET_API_ERROR_INVALID_VALUE;
 
-  if ((dev_net_tun_fd = open ("/dev/net/tun", O_RDWR)) < 0)
-    return VNET_API_ERROR_SYSCALL_ERROR_1;
+  flags = IFF_TAP | IFF_NO_PI;
+  if (n_queues > 1)
+    flags |= IFF_MULTI_QUEUE;
+  if (vnet_hdr)
+    flags |= IFF_VNET_HDR;
 
   memset (&ifr, 0, sizeof (ifr));
   strncpy(ifr.ifr_name, (char *) intfc_name, sizeof (ifr.ifr_name)-1);
-  ifr.ifr_flags = flags;
-  if (ioctl (dev_net_tun_fd, TUNSETIFF, (void *)&ifr) < 0)
+
+  /* One fd per queue, all attached to the same tap */
+  for (qid = 0; qid < n_queues; qid++)
     {
-      rv = VNET_API_ERROR_SYSCALL_ERROR_2;
+      if ((dev_net_tun_fd = open ("/dev/net/tun", O_RDWR)) < 0)
+        {
+          rv = VNET_API_ERROR_SYSCALL_ERROR_1;
+          goto error;
+        }
+      vec_add1 (fds, dev_net_tun_fd);
+
+      ifr.ifr_flags = flags;
+      if (ioctl (dev_net_tun_fd, TUNSETIFF, (void *)&ifr) < 0)
+        {
+          rv = VNET_API_ERROR_SYSCALL_ERROR_2;
+          goto error;
+        }
+
+      /* non-blocking I/O on /dev/tapX */
+      {
+        int one = 1;
+        if (ioctl (dev_net_tun_fd, FIONBIO, &one) < 0)
+          {
+            rv = VNET_API_ERROR_SYSCALL_ERROR_6;
+            goto error;
+          }
+      }
+    }
+
+  /* Partial checksums are fine, GSO is not: vlib can't segment */
+  if (vnet_hdr && ioctl (fds[0], TUNSETOFFLOAD, TUN_F_CSUM) < 0)
+    {
+      rv = VNET_API_ERROR_SYSCALL_ERROR_10;
       goto error;
     }
     
@@ -877,15 +1146,6 @@ int vnet_tap_connect (vlib_main_t * vm, u8 * intfc_name, u8 *hwaddr_arg,
       }
   }
 
-  /* non-blocking I/O on /dev/tapX */
-  {
-    int one = 1;
-    if (ioctl (dev_net_tun_fd, FIONBIO, &one) < 0)
-      {
-        rv = VNET_API_ERROR_SYSCALL_ERROR_6;
-	goto error;
-      }
-  }
   ifr.ifr_mtu = tm->mtu_bytes;
   if (ioctl (dev_tap_fd, SIOCSIFMTU, &ifr) < 0)
     {
@@ -908,9 +1168,6 @@ int vnet_tap_connect (vlib_main_t * vm, u8 * intfc_name, u8 *hwaddr_arg,
       goto error;
     }
 
-  ti = tapcli_get_new_tapif();
-  ti->per_interface_next_index = ~0;
-
   if (hwaddr_arg != 0)
     clib_memcpy(hwaddr, hwaddr_arg, 6);
   else
@@ -925,6 +1182,13 @@ int vnet_tap_connect (vlib_main_t * vm, u8 * intfc_name, u8 *hwaddr_arg,
       hwaddr[1] = 0xfe;
     }
 
+  /* Workers walk tapcli_interfaces, which may move */
+  vlib_worker_thread_barrier_sync (vm);
+
+  ti = tapcli_get_new_tapif();
+  ti->per_interface_next_index = ~0;
+  ti->vnet_hdr = vnet_hdr;
+
   error = ethernet_register_interface
         (tm->vnet_main,
          tapcli_dev_class.index,
@@ -935,20 +1199,44 @@ int vnet_tap_connect (vlib_main_t * vm, u8 * intfc_name, u8 *hwaddr_arg,
 
   if (error)
     {
+      vlib_worker_thread_barrier_release (vm);
       clib_error_report (error);
       rv = VNET_API_ERROR_INVALID_REGISTRATION;
       goto error;
     }
 
-  {
-    unix_file_t template = {0};
-    template.read_function = tapcli_read_ready;
-    template.file_descriptor = dev_net_tun_fd;
-    ti->unix_file_index = unix_file_add (&unix_main, &template);
-    ti->unix_fd = dev_net_tun_fd;
-    ti->provision_fd = dev_tap_fd;
-    clib_memcpy (&ti->ifr, &ifr, sizeof (ifr));
-  }
+  vec_validate_aligned (ti->queues, n_queues - 1, CLIB_CACHE_LINE_BYTES);
+  vec_foreach (q, ti->queues)
+    {
+      qid = q - ti->queues;
+      memset (q, 0, sizeof (*q));
+      q->unix_fd = fds[qid];
+      q->unix_file_index = ~0;
+      q->input_cpu_index = tm->input_cpu_first_index +
+        (ti - tm->tapcli_interfaces + qid) % tm->input_cpu_count;
+
+      /* tx from more threads than there are queues */
+      if (vtm->n_vlib_mains > n_queues)
+        {
+          q->lockp = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
+                                             CLIB_CACHE_LINE_BYTES);
+          memset ((void *) q->lockp, 0, CLIB_CACHE_LINE_BYTES);
+        }
+
+      /* workers poll, the main thread waits for the fd */
+      if (tm->input_cpu_first_index == 0)
+        {
+          unix_file_t template = {0};
+          template.read_function = tapcli_read_ready;
+          template.file_descriptor = q->unix_fd;
+          q->unix_file_index = unix_file_add (&unix_main, &template);
+        }
+
+      hash_set (tm->tapcli_interface_index_by_unix_fd, q->unix_fd,
+                ti - tm->tapcli_interfaces);
+    }
+  ti->provision_fd = dev_tap_fd;
+  clib_memcpy (&ti->ifr, &ifr, sizeof (ifr));
   
   {
     vnet_hw_interface_t * hw;
@@ -965,20 +1253,43 @@ int vnet_tap_connect (vlib_main_t * vm, u8 * intfc_name, u8 *hwaddr_arg,
   
   hash_set (tm->tapcli_interface_index_by_sw_if_index, ti->sw_if_index,
             ti - tm->tapcli_interfaces);
-  
-  hash_set (tm->tapcli_interface_index_by_unix_fd, ti->unix_fd,
-            ti - tm->tapcli_interfaces);
-  
+
+  tapcli_set_input_node_state (VLIB_NODE_STATE_POLLING);
+
+  vlib_worker_thread_barrier_release (vm);
+
+  vec_free (fds);
   return rv;
 
  error:
-  close (dev_net_tun_fd);
+  vec_foreach (fd, fds)
+    close (fd[0]);
+  vec_free (fds);
   if (dev_tap_fd >= 0)
       close (dev_tap_fd);
 
   return rv;
 }
 
+/**
+ * @brief Connect a single queue TAP interface
+ *
+ * @param vm - vlib_main_t
+ * @param intfc_name - u8
+ * @param hwaddr_arg - u8
+ * @param sw_if_indexp - u32
+ *
+ * @return rc - int
+ *
+ */
+int vnet_tap_connect (vlib_main_t * vm, u8 * intfc_name, u8 *hwaddr_arg,
+                      u32 * sw_if_indexp)
+{
+  return vnet_tap_connect_queues (vm, intfc_name, hwaddr_arg,
+                                  /* n_queues */ 1, /* vnet_hdr */ 0,
+                                  sw_if_indexp);
+}
+
 /**
  * @brief Renumber a TAP interface
  *
@@ -1018,21 +1329,24 @@ static int tapcli_tap_disconnect (tapcli_interface_t *ti)
   vnet_main_t * vnm = vnet_get_main();
   tapcli_main_t * tm = &tapcli_main;
   u32 sw_if_index = ti->sw_if_index;
+  tapcli_queue_t * q;
 
   // bring interface down
   vnet_sw_interface_set_flags (vnm, sw_if_index, 0);
 
-  if (ti->unix_file_index != ~0) {
-    unix_file_del (&unix_main, unix_main.file_pool + ti->unix_file_index);
-    ti->unix_file_index = ~0;
+  vec_foreach (q, ti->queues) {
+    hash_unset (tm->tapcli_interface_index_by_unix_fd, q->unix_fd);
+    if (q->unix_file_index != ~0)
+      unix_file_del (&unix_main, unix_main.file_pool + q->unix_file_index);
+    else
+      close(q->unix_fd);
+    if (q->lockp)
+      clib_mem_free ((void *) q->lockp);
   }
-  else
-    close(ti->unix_fd);
+  vec_free (ti->queues);
 
-  hash_unset (tm->tapcli_interface_index_by_unix_fd, ti->unix_fd);
   hash_unset (tm->tapcli_interface_index_by_sw_if_index, ti->sw_if_index);
   close(ti->provision_fd);
-  ti->unix_fd = -1;
   ti->provision_fd = -1;
 
   return rv;
@@ -1062,6 +1376,9 @@ int vnet_tap_delete(vlib_main_t *vm, u32 sw_if_index)
   }
   ti = vec_elt_at_index (tm->tapcli_interfaces, p[0]);
 
+  /* workers may be reading the queues */
+  vlib_worker_thread_barrier_sync (vm);
+
   // inactive
   ti->active = 0;
   tapcli_tap_disconnect(ti);
@@ -1073,6 +1390,12 @@ int vnet_tap_delete(vlib_main_t *vm, u32 sw_if_index)
     tm->show_dev_instance_by_real_dev_instance[p[0]] = ~0;
 
   ethernet_delete_interface (tm->vnet_main, ti->hw_if_index);
+
+  if (vec_len (tm->tapcli_inactive_interfaces)
+      == vec_len (tm->tapcli_interfaces))
+    tapcli_set_input_node_state (VLIB_NODE_STATE_INTERRUPT);
+
+  vlib_worker_thread_barrier_release (vm);
   return rv;
 }
 
@@ -1143,13 +1466,33 @@ int vnet_tap_modify (vlib_main_t * vm, u32 orig_sw_if_index,
                      u32 * sw_if_indexp,
                      u8 renumber, u32 custom_dev_instance)
 {
-    int rv = vnet_tap_delete (vm, orig_sw_if_index);
+    tapcli_main_t * tm = &tapcli_main;
+    tapcli_interface_t * ti;
+    u32 n_queues = 1;
+    u8 vnet_hdr = 0;
+    uword * p;
+    int rv;
+
+    /* the new tap keeps the queues and vnet_hdr mode of the old one */
+    p = hash_get (tm->tapcli_interface_index_by_sw_if_index,
+                  orig_sw_if_index);
+    if (p)
+      {
+        ti = vec_elt_at_index (tm->tapcli_interfaces, p[0]);
+        n_queues = vec_len (ti->queues);
+        vnet_hdr = ti->vnet_hdr;
+      }
+
+    rv = vnet_tap_delete (vm, orig_sw_if_index);
 
     if (rv)
         return rv;
 
-    rv = vnet_tap_connect_renumber(vm, intfc_name, hwaddr_arg, sw_if_indexp,
-            renumber, custom_dev_instance);
+    rv = vnet_tap_connect_queues (vm, intfc_name, hwaddr_arg, n_queues,
+                                  vnet_hdr, sw_if_indexp);
+
+    if (!rv && renumber)
+        vnet_interface_name_renumber (*sw_if_indexp, custom_dev_instance);
 
     return rv;
 }
@@ -1240,6 +1583,8 @@ tap_connect_command_fn (vlib_main_t * vm,
   u8 hwaddr[6];
   u8 *hwaddr_arg = 0;
   u32 sw_if_index;
+  u32 n_queues = 1;
+  u8 vnet_hdr = 0;
 
   if (tm->is_disabled)
     {
@@ -1260,7 +1605,19 @@ tap_connect_command_fn (vlib_main_t * vm,
   if (unformat(input, "hwaddr random"))
     ;
 
-  int rv = vnet_tap_connect(vm, intfc_name, hwaddr_arg, &sw_if_index);
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "queues %d", &n_queues))
+        ;
+      else if (unformat (input, "vnet-hdr"))
+        vnet_hdr = 1;
+      else
+        return clib_error_return (0, "unknown input `%U'",
+                                  format_unformat_error, input);
+    }
+
+  int rv = vnet_tap_connect_queues(vm, intfc_name, hwaddr_arg, n_queues,
+                                   vnet_hdr, &sw_if_index);
   if (rv) {
     switch (rv) {
     case VNET_API_ERROR_SYSCALL_ERROR_1:
@@ -1299,6 +1656,14 @@ tap_connect_command_fn (vlib_main_t * vm,
       vlib_cli_output (0, "Couldn't set intfc admin state up");
       break;
 
+    case VNET_API_ERROR_SYSCALL_ERROR_10:
+      vlib_cli_output (0, "Couldn't set checksum offload");
+      break;
+
+    case VNET_API_ERROR_INVALID_VALUE:
+      vlib_cli_output (0, "queues must be 1 to %d", TAP_MAX_QUEUES);
+      break;
+
     case VNET_API_ERROR_INVALID_REGISTRATION:
       vlib_cli_output (0, "Invalid registration");
       break;
@@ -1315,10 +1680,292 @@ tap_connect_command_fn (vlib_main_t * vm,
 
 VLIB_CLI_COMMAND (tap_connect_command, static) = {
     .path = "tap connect",
-    .short_help = "tap connect <intfc-name> [hwaddr <addr>]",
+    .short_help = "tap connect <intfc-name> [hwaddr <addr>] [queues <n>] "
+    "[vnet-hdr]",
     .function = tap_connect_command_fn,
 };
 
+/** Name of the Linux tap the benchmark creates */
+#define TAPCLI_BENCH_NAME "vpp-bench-tap"
+
+/**
+ * @brief Build the frames the benchmark sends from the Linux side
+ *
+ * UDP in ip4 with the checksum left to the device, as a local socket
+ * with checksum offload would send them. Without vnet_hdr the tap
+ * device has no checksum offload and the kernel completes it.
+ *
+ * @param *template - u8, frame to send
+ * @param frame_size - u32
+ *
+ */
+static void tapcli_bench_template (u8 * template, u32 frame_size)
+{
+  ethernet_header_t * e = (ethernet_header_t *) template;
+  ip4_header_t * ip = (ip4_header_t *) (e + 1);
+  udp_header_t * udp = (udp_header_t *) (ip + 1);
+  u16 udp_len = frame_size - sizeof (*e) - sizeof (*ip);
+  ip_csum_t sum;
+
+  /* a mac nobody has, so the kernel stack leaves the vpp -> linux
+     direction alone */
+  e->dst_address[0] = 0x02;
+  e->dst_address[5] = 0x01;
+  e->src_address[0] = 0x02;
+  e->src_address[5] = 0x02;
+  e->type = clib_host_to_net_u16 (ETHERNET_TYPE_IP4);
+  ip->ip_version_and_header_length = 0x45;
+  ip->ttl = 64;
+  ip->protocol = IP_PROTOCOL_UDP;
+  ip->length = clib_host_to_net_u16 (frame_size - sizeof (*e));
+  ip->src_address.as_u32 = clib_host_to_net_u32 (0x0a000001);
+  ip->dst_address.as_u32 = clib_host_to_net_u32 (0x0a000002);
+  ip->checksum = ip4_header_checksum (ip);
+  udp->dst_port = clib_host_to_net_u16 (4789);
+  udp->length = clib_host_to_net_u16 (udp_len);
+
+  /* pseudo header sum, the device adds the rest */
+  sum = ip->src_address.as_u32;
+  sum = ip_csum_with_carry (sum, ip->dst_address.as_u32);
+  sum = ip_csum_with_carry
+    (sum, clib_host_to_net_u32 (udp_len + (IP_PROTOCOL_UDP << 16)));
+  udp->checksum = ip_csum_fold (sum);
+}
+
+/**
+ * @brief CLI function to benchmark a TAP interface
+ *
+ * Linux to vpp: a packet socket on the Linux side of a new tap sends
+ * UDP flows with sendmmsg, vpp counts what each queue reads and drops
+ * it. vpp to Linux: vpp sends the same frames out of the tap and the
+ * kernel counts them.
+ *
+ * @param *vm - vlib_main_t
+ * @param *input - unformat_input_t
+ * @param *cmd - vlib_cli_command_t
+ *
+ * @return error - clib_error_t
+ *
+ */
+static clib_error_t *
+tapcli_bench_command_fn (vlib_main_t * vm,
+                         unformat_input_t * input,
+                         vlib_cli_command_t * cmd)
+{
+  tapcli_main_t * tm = &tapcli_main;
+  vnet_main_t * vnm = tm->vnet_main;
+  char * stats = "/sys/class/net/" TAPCLI_BENCH_NAME
+    "/statistics/rx_packets";
+  u32 n_queues = 1, frame_size = 64, n_flows = 1024, flow = 0;
+  u8 vnet_hdr = 0;
+  f64 duration = 1.0, t0, t1, rx_time;
+  u32 sw_if_index = ~0, buffers[VLIB_FRAME_SIZE];
+  u64 * rx0 = 0, n_rx = 0, n_tx = 0, k0 = 0, k1 = 0;
+  vnet_hw_interface_t * hi;
+  tapcli_interface_t * ti;
+  tapcli_queue_t * q;
+  vlib_node_t * drop;
+  struct virtio_net_hdr vh = { 0 };
+  struct sockaddr_ll sll;
+  struct ifreq ifr;
+  struct mmsghdr msgs[VLIB_FRAME_SIZE];
+  struct iovec iovs[VLIB_FRAME_SIZE][2];
+  u8 * frames = 0, * template = 0;
+  clib_error_t * error = 0;
+  int fd = -1, one = 1, rv, i;
+
+  if (tm->is_disabled)
+    return clib_error_return (0, "device disabled...");
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "queues %d", &n_queues))
+        ;
+      else if (unformat (input, "vnet-hdr"))
+        vnet_hdr = 1;
+      else if (unformat (input, "size %d", &frame_size))
+        ;
+      else if (unformat (input, "flows %d", &n_flows))
+        ;
+      else if (unformat (input, "time %f", &duration))
+        ;
+      else
+        return clib_error_return (0, "unknown input `%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (frame_size < 60 || frame_size > VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES)
+    return clib_error_return (0, "size must be 60 to %d",
+                              VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES);
+  if (n_flows < 1 || n_flows > 60000)
+    return clib_error_return (0, "flows must be 1 to 60000");
+
+  rv = vnet_tap_connect_queues (vm, (u8 *) TAPCLI_BENCH_NAME, 0, n_queues,
+                                vnet_hdr, &sw_if_index);
+  if (rv)
+    return clib_error_return (0, "tap connect failed (%d)", rv);
+
+  vlib_worker_thread_barrier_sync (vm);
+  hi = vnet_get_sup_hw_interface (vnm, sw_if_index);
+  ti = vec_elt_at_index (tm->tapcli_interfaces, hi->dev_instance);
+  vnet_sw_interface_set_flags (vnm, sw_if_index,
+                               VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+  /* count what arrives and drop it right away */
+  drop = vlib_get_node_by_name (vm, (u8 *) "error-drop");
+  vnet_hw_interface_rx_redirect_to_node (vnm, hi->hw_if_index, drop->index);
+  vec_foreach (q, ti->queues)
+    vec_add1 (rx0, q->n_rx_packets);
+  vlib_worker_thread_barrier_release (vm);
+
+  /* the Linux side: a packet socket which hands checksums to the tap */
+  clib_memcpy (&ifr, &ti->ifr, sizeof (ifr));
+  if ((fd = socket (PF_PACKET, SOCK_RAW, 0)) < 0
+      || setsockopt (fd, SOL_PACKET, PACKET_VNET_HDR, &one, sizeof (one)) < 0
+      || ioctl (fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+      error = clib_error_return_unix (0, "packet socket");
+      goto done;
+    }
+  memset (&sll, 0, sizeof (sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = clib_host_to_net_u16 (ETHERNET_TYPE_IP4);
+  sll.sll_ifindex = ifr.ifr_ifindex;
+
+  vh.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+  vh.csum_start = sizeof (ethernet_header_t) + sizeof (ip4_header_t);
+  vh.csum_offset = STRUCT_OFFSET_OF (udp_header_t, checksum);
+  vec_validate (template, frame_size - 1);
+  tapcli_bench_template (template, frame_size);
+  vec_validate (frames, VLIB_FRAME_SIZE * frame_size - 1);
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < VLIB_FRAME_SIZE; i++)
+    {
+      clib_memcpy (frames + i * frame_size, template, frame_size);
+      iovs[i][0].iov_base = &vh;
+      iovs[i][0].iov_len = sizeof (vh);
+      iovs[i][1].iov_base = frames + i * frame_size;
+      iovs[i][1].iov_len = frame_size;
+      msgs[i].msg_hdr.msg_name = &sll;
+      msgs[i].msg_hdr.msg_namelen = sizeof (sll);
+      msgs[i].msg_hdr.msg_iov = iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+  t0 = vlib_time_now (vm);
+  do
+    {
+      for (i = 0; i < VLIB_FRAME_SIZE; i++)
+        {
+          udp_header_t * udp = (udp_header_t *)
+            (frames + i * frame_size + vh.csum_start);
+          udp->src_port = clib_host_to_net_u16 (1024 + flow);
+          if (++flow >= n_flows)
+            flow = 0;
+        }
+      rv = sendmmsg (fd, msgs, VLIB_FRAME_SIZE, MSG_DONTWAIT);
+      if (rv > 0)
+        n_tx += rv;
+
+      vlib_process_suspend (vm, 10e-6);
+      t1 = vlib_time_now (vm);
+    }
+  while (t1 - t0 < duration);
+
+  /* let the readers drain the tap */
+  vlib_process_suspend (vm, 10e-3);
+
+  vlib_worker_thread_barrier_sync (vm);
+  rx_time = vlib_time_now (vm) - t0;
+  vlib_cli_output (vm, "%s, %d queue%s%s, %d byte frames, %d flows, "
+                   "%.2f sec", TAPCLI_BENCH_NAME, n_queues,
+                   n_queues > 1 ? "s" : "", vnet_hdr ? ", vnet_hdr" : "",
+                   frame_size, n_flows, rx_time);
+  vlib_cli_output (vm, "linux -> vpp");
+  vlib_cli_output (vm, "%5s %7s %12s %9s", "queue", "thread", "rx",
+                   "rx Mpps");
+  vec_foreach (q, ti->queues)
+    {
+      u64 n = q->n_rx_packets - rx0[q - ti->queues];
+      vlib_cli_output (vm, "%5d %7d %12llu %9.2f", q - ti->queues,
+                       q->input_cpu_index, n, n / rx_time * 1e-6);
+      n_rx += n;
+    }
+  vlib_cli_output (vm, "%5s %7s %12llu %9.2f", "total", "", n_rx,
+                   n_rx / rx_time * 1e-6);
+  vlib_cli_output (vm, "sent %llu (%.2f Mpps), received %.1f%%", n_tx,
+                   n_tx / rx_time * 1e-6,
+                   n_tx ? 100.0 * n_rx / n_tx : 0.0);
+  vlib_worker_thread_barrier_release (vm);
+
+  /* vpp -> linux, the stack drops it at once, not for its mac */
+  vlib_sysfs_read (stats, "%lld", &k0);
+  n_tx = 0;
+  t0 = vlib_time_now (vm);
+  do
+    {
+      vlib_frame_t * f;
+      u32 n = vlib_buffer_alloc (vm, buffers, VLIB_FRAME_SIZE);
+
+      for (i = 0; i < n; i++)
+        {
+          vlib_buffer_t * b = vlib_get_buffer (vm, buffers[i]);
+          udp_header_t * udp;
+
+          clib_memcpy (b->data, template, frame_size);
+          b->current_data = 0;
+          b->current_length = frame_size;
+          b->flags = 0;
+          vnet_buffer (b)->sw_if_index[VLIB_RX] = sw_if_index;
+          vnet_buffer (b)->sw_if_index[VLIB_TX] = sw_if_index;
+          udp = (udp_header_t *) (b->data + vh.csum_start);
+          udp->src_port = clib_host_to_net_u16 (1024 + flow);
+          if (++flow >= n_flows)
+            flow = 0;
+        }
+      if (n)
+        {
+          f = vlib_get_frame_to_node (vm, hi->output_node_index);
+          clib_memcpy (vlib_frame_vector_args (f), buffers, n * sizeof (u32));
+          f->n_vectors = n;
+          vlib_put_frame_to_node (vm, hi->output_node_index, f);
+          n_tx += n;
+        }
+
+      vlib_process_suspend (vm, 10e-6);
+      t1 = vlib_time_now (vm);
+    }
+  while (t1 - t0 < duration);
+
+  vlib_process_suspend (vm, 10e-3);
+  vlib_sysfs_read (stats, "%lld", &k1);
+  t1 -= t0;
+  vlib_cli_output (vm, "vpp -> linux");
+  vlib_cli_output (vm, "sent %llu (%.2f Mpps), linux received %llu "
+                   "(%.2f Mpps, %.1f%%)", n_tx, n_tx / t1 * 1e-6,
+                   k1 - k0, (k1 - k0) / t1 * 1e-6,
+                   n_tx ? 100.0 * (k1 - k0) / n_tx : 0.0);
+
+done:
+  if (fd >= 0)
+    close (fd);
+  vlib_worker_thread_barrier_sync (vm);
+  vnet_hw_interface_rx_redirect_to_node (vnm, hi->hw_if_index, ~0);
+  vlib_worker_thread_barrier_release (vm);
+  vnet_tap_delete (vm, sw_if_index);
+  vec_free (rx0);
+  vec_free (frames);
+  vec_free (template);
+  return error;
+}
+
+VLIB_CLI_COMMAND (tapcli_bench_command, static) = {
+    .path = "test tap",
+    .short_help = "test tap [queues <n>] [vnet-hdr] [size <bytes>] "
+    "[flows <n>] [time <sec>]",
+    .function = tapcli_bench_command_fn,
+    .is_mp_safe = 1,
+};
+
 /**
  * @brief TAPCLI main init
  *
@@ -1331,6 +1978,10 @@ clib_error_t *
 tapcli_init (vlib_main_t * vm)
 {
   tapcli_main_t * tm = &tapcli_main;
+  vlib_thread_main_t * vtm = vlib_get_thread_main ();
+  vlib_thread_registration_t * tr;
+  tapcli_per_thread_t * pt;
+  uword * p;
 
   tm->vlib_main = vm;
   tm->vnet_main = vnet_get_main();
@@ -1338,9 +1989,26 @@ tapcli_init (vlib_main_t * vm)
   tm->mtu_bytes = TAP_MTU_DEFAULT;
   tm->tapcli_interface_index_by_sw_if_index = hash_create (0, sizeof(uword));
   tm->tapcli_interface_index_by_unix_fd = hash_create (0, sizeof (uword));
-  tm->rx_buffers = 0;
-  vec_alloc(tm->rx_buffers, VLIB_FRAME_SIZE);
-  vec_reset_length(tm->rx_buffers);
+  tm->input_cpu_first_index = 0;
+  tm->input_cpu_count = 1;
+
+  /* find out which cpus will be used for input */
+  p = hash_get_mem (vtm->thread_registrations_by_name, "workers");
+  tr = p ? (vlib_thread_registration_t *) p[0] : 0;
+
+  if (tr && tr->count > 0)
+    {
+      tm->input_cpu_first_index = tr->first_index;
+      tm->input_cpu_count = tr->count;
+    }
+
+  vec_validate_aligned (tm->threads, vtm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_foreach (pt, tm->threads)
+    {
+      vec_alloc(pt->rx_buffers, VLIB_FRAME_SIZE);
+      vec_reset_length(pt->rx_buffers);
+    }
   vm->os_punt_frame = tapcli_nopunt_frame;
   return 0;
 }
@@ -28,6 +28,8 @@
  _(NONE, "no error")                                    \
  _(READ, "read error")                                  \
  _(BUFFER_ALLOC, "buffer allocation error")             \
+ _(GSO, "gso packet not offered to kernel")             \
+ _(CSUM_OFFSET, "bad vnet_hdr checksum offset")         \
  _(UNKNOWN, "unknown error")
 
 typedef enum {
@@ -49,4 +51,7 @@ int vnet_tap_dump_ifs (tapcli_interface_details_t **out_tapids);
 #define TAP_MTU_MAX 65535
 #define TAP_MTU_DEFAULT 1500
 
+/** Most IFF_MULTI_QUEUE fds a tap interface opens */
+#define TAP_MAX_QUEUES 16
+
 #endif /* __included_tapcli_h__ */
@@ -24,6 +24,9 @@ void register_tuntap_inject_node_name (char *name);
 
 int vnet_tap_connect (vlib_main_t * vm, u8 * intfc_name,
                       u8 *hwaddr_arg, u32 * sw_if_indexp);
+int vnet_tap_connect_queues (vlib_main_t * vm, u8 * intfc_name,
+                             u8 *hwaddr_arg, u32 n_queues, u8 vnet_hdr,
+                             u32 * sw_if_indexp);
 int vnet_tap_connect_renumber (vlib_main_t * vm, u8 * intfc_name,
                       u8 *hwaddr_arg, u32 * sw_if_indexp,
                       u8 renumber, u32 custom_dev_instance);
@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * stat_segment.c: publish counters in the shared memory stats segment
+ *
+ * Enabled by a "stats-segment" startup config section:
+ *
+ *   stats-segment { name vpp-stats size 32m interval 1 }
+ *
+ * The counters themselves stay where they are. Once per interval the
+ * "stat-segment-process" copies the interface, error and node runtime
+ * counters into the segment, without the data structure lock and
+ * without stopping the workers. Readers (see svm/stat_segment.h and
+ * svmstattool) then map the segment and copy vectors out of it at
+ * their own pace, without sending a single API message.
+ */
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <stat_segment.h>
+
+typedef struct
+{
+  /* Config */
+  int enabled;
+  u8 *name;
+  u64 size;
+  f64 interval;
+
+  stat_segment_t segment;
+
+  /* Directory indices */
+  u32 if_names;
+  u32 *if_simple;
+  u32 *if_combined;
+  u32 err_names;
+  u32 err_counters;
+  u32 node_names;
+  u32 node_runtime;
+
+  /* Shape of the name tables last published */
+  u32 n_sw_interfaces;
+  u32 n_free_sw_interfaces;
+  u32 n_errors;
+  u32 n_nodes;
+
+  /* Counter snapshots, copied into the segment in one go */
+  u64 *simple_values;
+  vlib_counter_t *combined_values;
+
+  /* Stats */
+  u64 n_updates;
+  f64 last_update_time;
+  f64 max_update_time;
+} stat_segment_main_t;
+
+stat_segment_main_t stat_segment_main;
+
+static void
+stat_segment_set_name (u8 * elt, u8 * name)
+{
+  u32 n = clib_min (vec_len (name), STAT_SEGMENT_NAME_BYTES - 1);
+
+  clib_memcpy (elt, name, n);
+  memset (elt + n, 0, STAT_SEGMENT_NAME_BYTES - n);
+}
+
+static int
+stat_segment_add (stat_segment_main_t * ssm, u32 * index,
+		  stat_segment_type_t type, char *fmt, ...)
+{
+  va_list va;
+  u8 *name;
+  int rv;
+
+  va_start (va, fmt);
+  name = va_format (0, fmt, &va);
+  va_end (va);
+  vec_add1 (name, 0);
+
+  rv = stat_segment_vector_add (&ssm->segment, (char *) name, type);
+  vec_free (name);
+  if (rv >= 0)
+    *index = rv;
+  return rv;
+}
+
+static clib_error_t *
+stat_segment_add_vectors (stat_segment_main_t * ssm)
+{
+  vnet_interface_main_t *im = &vnet_get_main ()->interface_main;
+  u32 i;
+  int rv;
+
+#define _(i,t,f,...)                                            \
+  if ((rv = stat_segment_add (ssm, i, t, f, ##__VA_ARGS__)) < 0)  \
+    goto error;
+
+  _(&ssm->if_names, STAT_SEGMENT_TYPE_NAME, "/if/names");
+
+  vec_validate (ssm->if_simple, vec_len (im->sw_if_counters) - 1);
+  for (i = 0; i < vec_len (im->sw_if_counters); i++)
+    _(ssm->if_simple + i, STAT_SEGMENT_TYPE_COUNTER, "/if/%s",
+      im->sw_if_counters[i].name);
+
+  vec_validate (ssm->if_combined, vec_len (im->combined_sw_if_counters) - 1);
+  for (i = 0; i < vec_len (im->combined_sw_if_counters); i++)
+    _(ssm->if_combined + i, STAT_SEGMENT_TYPE_COMBINED_COUNTER, "/if/%s",
+      im->combined_sw_if_counters[i].name);
+
+  _(&ssm->err_names, STAT_SEGMENT_TYPE_NAME, "/err/names");
+  _(&ssm->err_counters, STAT_SEGMENT_TYPE_COUNTER, "/err/counters");
+  _(&ssm->node_names, STAT_SEGMENT_TYPE_NAME, "/node/names");
+  _(&ssm->node_runtime, STAT_SEGMENT_TYPE_NODE_RUNTIME, "/node/runtime");
+#undef _
+
+  return 0;
+
+error:
+  return clib_error_return (0, "stats segment %s: %U", ssm->name,
+			    format_stat_segment_error, rv);
+}
+
+static void
+update_interface_names (stat_segment_main_t * ssm)
+{
+  vnet_main_t *vnm = vnet_get_main ();
+  vnet_interface_main_t *im = &vnm->interface_main;
+  u32 n = pool_len (im->sw_interfaces);
+  u32 n_free = n - pool_elts (im->sw_interfaces);
+  vnet_sw_interface_t *si;
+  u8 *names, *name = 0;
+  u32 i;
+
+  /* Interfaces come and go rarely, don't reformat every name each time */
+  if (n == ssm->n_sw_interfaces && n_free == ssm->n_free_sw_interfaces)
+    return;
+
+  names = stat_segment_vector_begin (&ssm->segment, ssm->if_names, n);
+  if (!names)
+    return;
+
+  for (i = 0; i < n; i++)
+    {
+      vec_reset_length (name);
+      if (!pool_is_free_index (im->sw_interfaces, i))
+	{
+	  si = pool_elt_at_index (im->sw_interfaces, i);
+	  name = format (name, "%U", format_vnet_sw_interface_name, vnm, si);
+	}
+      stat_segment_set_name (names + i * STAT_SEGMENT_NAME_BYTES, name);
+    }
+
+  stat_segment_vector_end (&ssm->segment, ssm->if_names);
+  vec_free (name);
+
+  ssm->n_sw_interfaces = n;
+  ssm->n_free_sw_interfaces = n_free;
+}
+
+static void
+update_interface_counters (stat_segment_main_t * ssm)
+{
+  vnet_interface_main_t *im = &vnet_get_main ()->interface_main;
+  void *data;
+  u32 i, n;
+
+  STATIC_ASSERT (sizeof (vlib_counter_t) ==
+		 sizeof (stat_segment_combined_counter_t),
+		 "combined counter layout mismatch");
+
+  /* Keep interface creation from moving the counters under us */
+  vnet_interface_counter_lock (im);
+
+  for (i = 0; i < vec_len (im->sw_if_counters); i++)
+    {
+      vlib_get_simple_counters (im->sw_if_counters + i, &ssm->simple_values);
+      n = vec_len (ssm->simple_values);
+      data = stat_segment_vector_begin (&ssm->segment, ssm->if_simple[i], n);
+      if (!data)
+	continue;
+      clib_memcpy (data, ssm->simple_values, n * sizeof (u64));
+      stat_segment_vector_end (&ssm->segment, ssm->if_simple[i]);
+    }
+
+  for (i = 0; i < vec_len (im->combined_sw_if_counters); i++)
+    {
+      vlib_get_combined_counters (im->combined_sw_if_counters + i,
+				  &ssm->combined_values);
+      n = vec_len (ssm->combined_values);
+      data = stat_segment_vector_begin (&ssm->segment, ssm->if_combined[i], n);
+      if (!data)
+	continue;
+      clib_memcpy (data, ssm->combined_values, n * sizeof (vlib_counter_t));
+      stat_segment_vector_end (&ssm->segment, ssm->if_combined[i]);
+    }
+
+  vnet_interface_counter_unlock (im);
+}
+
+/*
+ * Error counters are indexed the same way on every thread, names are
+ * "<node>/<error string>".
+ */
+static void
+update_error_counters (stat_segment_main_t * ssm)
+{
+  vlib_main_t *vm = vlib_get_main ();
+  vlib_node_main_t *nm = &vm->node_main;
+  vlib_error_main_t *em;
+  vlib_main_t *this_vm;
+  vlib_node_t *n;
+  u8 *names, *name = 0;
+  u64 *c;
+  u32 n_errors = vec_len (vm->error_main.counters);
+  u32 i, j, n_threads;
+
+  if (n_errors != ssm->n_errors
+      && (names = stat_segment_vector_begin (&ssm->segment, ssm->err_names,
+					     n_errors)))
+    {
+      for (i = 0; i < vec_len (nm->nodes); i++)
+	{
+	  n = nm->nodes[i];
+	  for (j = 0; j < n->n_errors; j++)
+	    {
+	      if (n->error_heap_index + j >= n_errors)
+		continue;
+	      vec_reset_length (name);
+	      name = format (name, "%v/%s", n->name, n->error_strings[j]);
+	      stat_segment_set_name (names + (n->error_heap_index + j) *
+				     STAT_SEGMENT_NAME_BYTES, name);
+	    }
+	}
+      stat_segment_vector_end (&ssm->segment, ssm->err_names);
+      vec_free (name);
+      ssm->n_errors = n_errors;
+    }
+
+  c = stat_segment_vector_begin (&ssm->segment, ssm->err_counters, n_errors);
+  if (!c)
+    return;
+
+  memset (c, 0, n_errors * sizeof (c[0]));
+  n_threads = vec_len (vlib_mains) ? vec_len (vlib_mains) : 1;
+  for (i = 0; i < n_threads; i++)
+    {
+      this_vm = vec_len (vlib_mains) ? vlib_mains[i] : vm;
+      if (!this_vm)
+	continue;
+      em = &this_vm->error_main;
+      for (j = 0; j < n_errors && j < vec_len (em->counters); j++)
+	{
+	  c[j] += em->counters[j];
+	  if (j < vec_len (em->counters_last_clear))
+	    c[j] -= em->counters_last_clear[j];
+	}
+    }
+
+  stat_segment_vector_end (&ssm->segment, ssm->err_counters);
+}
+
+/*
+ * Node runtime stats summed over the threads. Like "show runtime" the
+ * totals are stats_total plus whatever the runtime collected since it
+ * last folded into stats_total; unlike "show runtime" we don't fold
+ * them ourselves, since that would need the barrier. A node which
+ * folds while we read may be off by one overflow period until the
+ * next update.
+ */
+static void
+update_node_runtime (stat_segment_main_t * ssm)
+{
+  vlib_main_t *vm = vlib_get_main ();
+  vlib_node_main_t *nm = &vm->node_main;
+  stat_segment_node_runtime_t *r;
+  vlib_node_runtime_t *rt;
+  vlib_main_t *this_vm;
+  vlib_process_t *p;
+  vlib_node_t *n;
+  u8 *names, *name = 0;
+  u32 n_nodes = vec_len (nm->nodes);
+  u32 i, j, n_threads;
+
+  if (n_nodes != ssm->n_nodes
+      && (names = stat_segment_vector_begin (&ssm->segment, ssm->node_names,
+					     n_nodes)))
+    {
+      for (i = 0; i < n_nodes; i++)
+	{
+	  vec_reset_length (name);
+	  name = format (name, "%v", nm->nodes[i]->name);
+	  stat_segment_set_name (names + i * STAT_SEGMENT_NAME_BYTES, name);
+	}
+      stat_segment_vector_end (&ssm->segment, ssm->node_names);
+      vec_free (name);
+      ssm->n_nodes = n_nodes;
+    }
+
+  r = stat_segment_vector_begin (&ssm->segment, ssm->node_runtime, n_nodes);
+  if (!r)
+    return;
+
+  memset (r, 0, n_nodes * sizeof (r[0]));
+  n_threads = vec_len (vlib_mains) ? vec_len (vlib_mains) : 1;
+  for (i = 0; i < n_threads; i++)
+    {
+      this_vm = vec_len (vlib_mains) ? vlib_mains[i] : vm;
+      if (!this_vm)
+	continue;
+
+      for (j = 0; j < n_nodes && j < vec_len (this_vm->node_main.nodes); j++)
+	{
+	  n = this_vm->node_main.nodes[j];
+
+	  r[j].calls += n->stats_total.calls - n->stats_last_clear.calls;
+	  r[j].vectors += n->stats_total.vectors - n->stats_last_clear.vectors;
+	  r[j].clocks += n->stats_total.clocks - n->stats_last_clear.clocks;
+	  r[j].suspends +=
+	    n->stats_total.suspends - n->stats_last_clear.suspends;
+
+	  if (n->type == VLIB_NODE_TYPE_PROCESS)
+	    {
+	      /* Processes only run on the main thread */
+	      if (this_vm != vm)
+		continue;
+	      p = vlib_get_process_from_node (this_vm, n);
+	      r[j].suspends += p->n_suspends;
+	      rt = &p->node_runtime;
+	    }
+	  else
+	    rt = vec_elt_at_index (this_vm->node_main.nodes_by_type[n->type],
+				   n->runtime_index);
+
+	  r[j].calls += rt->calls_since_last_overflow;
+	  r[j].vectors += rt->vectors_since_last_overflow;
+	  r[j].clocks += rt->clocks_since_last_overflow;
+	}
+    }
+
+  stat_segment_vector_end (&ssm->segment, ssm->node_runtime);
+}
+
+static uword
+stat_segment_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+		      vlib_frame_t * f)
+{
+  stat_segment_main_t *ssm = &stat_segment_main;
+  clib_error_t *error;
+  f64 start, dt;
+  int rv;
+
+  if (!ssm->enabled)
+    return 0;
+
+  rv = stat_segment_create (&ssm->segment, (char *) ssm->name, ssm->size);
+  if (rv)
+    {
+      clib_warning ("stats segment %s: %U", ssm->name,
+		    format_stat_segment_error, rv);
+      return 0;
+    }
+
+  error = stat_segment_add_vectors (ssm);
+  if (error)
+    {
+      clib_error_report (error);
+      return 0;
+    }
+
+  while (1)
+    {
+      start = vlib_time_now (vm);
+
+      update_interface_names (ssm);
+      update_interface_counters (ssm);
+      update_error_counters (ssm);
+      update_node_runtime (ssm);
+      stat_segment_update_done (&ssm->segment);
+
+      dt = vlib_time_now (vm) - start;
+      ssm->n_updates++;
+      ssm->last_update_time = dt;
+      ssm->max_update_time = clib_max (ssm->max_update_time, dt);
+
+      vlib_process_suspend (vm, ssm->interval);
+    }
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (stat_segment_process_node, static) = {
+  .function = stat_segment_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "stat-segment-process",
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+show_stat_segment_command_fn (vlib_main_t * vm, unformat_input_t * input,
+			      vlib_cli_command_t * cmd)
+{
+  stat_segment_main_t *ssm = &stat_segment_main;
+  stat_segment_directory_t *d = ssm->segment.directory;
+
+  if (!d)
+    {
+      vlib_cli_output (vm, "stats segment not enabled");
+      return 0;
+    }
+
+  vlib_cli_output (vm, "segment %s, %lld bytes, %d vectors, every %.2f sec",
+		   ssm->name, ssm->size, d->n_vectors, ssm->interval);
+  vlib_cli_output (vm, "%lld updates, last took %.2f us, max %.2f us",
+		   ssm->n_updates, ssm->last_update_time * 1e6,
+		   ssm->max_update_time * 1e6);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_stat_segment_command, static) = {
+  .path = "show stats segment",
+  .short_help = "show stats segment",
+  .function = show_stat_segment_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+stat_segment_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  stat_segment_main_t *ssm = &stat_segment_main;
+  uword size;
+
+  ssm->enabled = 1;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "name %s", &ssm->name))
+	vec_add1 (ssm->name, 0);
+      else if (unformat (input, "size %U", unformat_memory_size, &size))
+	ssm->size = size;
+      else if (unformat (input, "interval %f", &ssm->interval))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (ssm->interval <= 0)
+    return clib_error_return (0, "stats segment interval must be positive");
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (stat_segment_config, "stats-segment");
+
+static clib_error_t *
+stat_segment_init (vlib_main_t * vm)
+{
+  stat_segment_main_t *ssm = &stat_segment_main;
+
+  ssm->name = format (0, "%s%c", STAT_SEGMENT_DEFAULT_NAME, 0);
+  ssm->size = 32 << 20;
+  ssm->interval = 1.0;
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (stat_segment_init);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
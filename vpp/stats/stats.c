@@ -130,12 +130,12 @@ do_simple_interface_counters (stats_main_t * sm)
   vec_foreach (cm, im->sw_if_counters)
   {
 
-    for (i = 0; i < vec_len (cm->maxi); i++)
+    for (i = 0; i < vlib_counter_len (cm); i++)
       {
 	if (mp == 0)
 	  {
 	    items_this_message = clib_min (SIMPLE_COUNTER_BATCH_SIZE,
-					   vec_len (cm->maxi) - i);
+					   vlib_counter_len (cm) - i);
 
 	    mp = vl_msg_api_alloc_as_if_client
 	      (sizeof (*mp) + items_this_message * sizeof (v));
@@ -181,12 +181,12 @@ do_combined_interface_counters (stats_main_t * sm)
   vec_foreach (cm, im->combined_sw_if_counters)
   {
 
-    for (i = 0; i < vec_len (cm->maxi); i++)
+    for (i = 0; i < vlib_counter_len (cm); i++)
       {
 	if (mp == 0)
 	  {
 	    items_this_message = clib_min (COMBINED_COUNTER_BATCH_SIZE,
-					   vec_len (cm->maxi) - i);
+					   vlib_counter_len (cm) - i);
 
 	    mp = vl_msg_api_alloc_as_if_client
 	      (sizeof (*mp) + items_this_message * sizeof (v));
@@ -586,6 +586,114 @@ again:
     vl_msg_api_free (mp);
 }
 
+static void
+node_profile_counters_fill (vl_api_vnet_node_profile_counters_t * mp,
+			    vlib_main_t * stat_vm, vlib_node_t * n,
+			    vlib_node_profile_t * p)
+{
+  int i;
+
+  STATIC_ASSERT (ARRAY_LEN (mp->clocks_per_call)
+		 == VLIB_NODE_PROFILE_N_CLOCK_BUCKETS,
+		 "vpe.api node profile size mismatch");
+  STATIC_ASSERT (ARRAY_LEN (mp->vectors_per_call)
+		 == VLIB_NODE_PROFILE_N_VECTOR_BUCKETS,
+		 "vpe.api node profile size mismatch");
+
+  memset (mp, 0, sizeof (*mp));
+  mp->_vl_msg_id = ntohs (VL_API_VNET_NODE_PROFILE_COUNTERS);
+  mp->thread_index = htonl (stat_vm->cpu_index);
+  mp->node_index = htonl (n->index);
+  strncpy ((char *) mp->node_name, (char *) n->name,
+	   clib_min (vec_len (n->name), ARRAY_LEN (mp->node_name) - 1));
+  mp->max_clocks = clib_host_to_net_u64 (p->max_clocks);
+  for (i = 0; i < VLIB_NODE_PROFILE_N_CLOCK_BUCKETS; i++)
+    {
+      mp->clocks_per_call[i] = clib_host_to_net_u64 (p->clocks_per_call[i]);
+      mp->clocks_per_vector[i] =
+	clib_host_to_net_u64 (p->clocks_per_vector[i]);
+    }
+  for (i = 0; i < VLIB_NODE_PROFILE_N_VECTOR_BUCKETS; i++)
+    mp->vectors_per_call[i] = clib_host_to_net_u64 (p->vectors_per_call[i]);
+}
+
+/*
+ * Send the node cycle profile of every node which ran to the stats
+ * clients. Runs on the main thread rather than the stats thread, since
+ * the main thread frees the profiles when the profiler is turned off.
+ */
+static void
+do_node_profiles (stats_main_t * sm)
+{
+  vlib_main_t *vm = sm->vlib_main;
+  vl_api_vnet_node_profile_counters_t *mp;
+  vpe_client_registration_t *reg;
+  unix_shared_memory_queue_t *q;
+  vlib_main_t *stat_vm;
+  vlib_node_profile_t *p;
+  u32 n_threads;
+  u64 calls;
+  int i, j, k;
+
+  n_threads = vec_len (vlib_mains) ? vec_len (vlib_mains) : 1;
+
+  for (j = 0; j < n_threads; j++)
+    {
+      stat_vm = vec_len (vlib_mains) ? vlib_mains[j] : vm;
+      if (!stat_vm)
+	continue;
+
+      for (i = 0; i < vec_len (stat_vm->node_main.node_profiles); i++)
+	{
+	  p = stat_vm->node_main.node_profiles + i;
+	  calls = 0;
+	  for (k = 0; k < VLIB_NODE_PROFILE_N_VECTOR_BUCKETS; k++)
+	    calls += p->vectors_per_call[k];
+	  if (calls == 0)
+	    continue;
+
+          /* *INDENT-OFF* */
+          pool_foreach (reg, sm->stats_registrations,
+          ({
+            q = vl_api_client_index_to_input_queue (reg->client_index);
+            if (q && q->cursize < q->maxsize)
+              {
+                mp = vl_msg_api_alloc (sizeof (*mp));
+                node_profile_counters_fill (mp, stat_vm,
+                                            vlib_get_node (stat_vm, i), p);
+                vl_msg_api_send_shmem (q, (u8 *) & mp);
+              }
+          }));
+          /* *INDENT-ON* */
+	}
+    }
+}
+
+static uword
+node_profile_stats_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+			    vlib_frame_t * f)
+{
+  stats_main_t *sm = &stats_main;
+
+  while (1)
+    {
+      vlib_process_suspend (vm, sm->stats_poll_interval_in_seconds);
+
+      if (sm->enable_poller)
+	do_node_profiles (sm);
+    }
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (node_profile_stats_process_node, static) = {
+  .function = node_profile_stats_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "node-profile-stats-process",
+};
+/* *INDENT-ON* */
+
 static void
 stats_thread_fn (void *arg)
 {
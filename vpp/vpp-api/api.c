@@ -3094,7 +3094,7 @@ vl_api_vnet_get_summary_stats_t_handler (vl_api_vnet_get_summary_stats_t * mp)
   {
     which = cm - im->combined_sw_if_counters;
 
-    for (i = 0; i < vec_len (cm->maxi); i++)
+    for (i = 0; i < vlib_counter_len (cm); i++)
       {
 	vlib_get_combined_counter (cm, i, &v);
 	total_pkts[which] += v.packets;
@@ -7093,7 +7093,7 @@ vl_api_map_summary_stats_t_handler (vl_api_map_summary_stats_t * mp)
   {
     which = cm - mm->domain_counters;
 
-    for (i = 0; i < vec_len (cm->maxi); i++)
+    for (i = 0; i < vlib_counter_len (cm); i++)
       {
 	vlib_get_combined_counter (cm, i, &v);
 	total_pkts[which] += v.packets;
@@ -7273,7 +7273,7 @@ vl_api_af_packet_create_t_handler (vl_api_af_packet_create_t * mp)
   vec_add1 (host_if_name, 0);
 
   rv = af_packet_create_if (vm, host_if_name,
-			    mp->use_random_hw_addr ? 0 : mp->hw_addr,
+			    mp->use_random_hw_addr ? 0 : mp->hw_addr, 1,
 			    &sw_if_index);
 
   vec_free (host_if_name);
@@ -8836,6 +8836,7 @@ vpe_api_hookup (vlib_main_t * vm)
    */
   am->is_mp_safe[VL_API_IP_ADD_DEL_ROUTE] = 1;
   am->is_mp_safe[VL_API_GET_NODE_GRAPH] = 1;
+  am->is_mp_safe[VL_API_CLASSIFY_ADD_DEL_SESSION] = 1;
 
   return 0;
 }
@@ -58,8 +58,9 @@ typedef struct clib_bihash_value
     struct
     {
       u32 offset;  /**< backing page offset in the clib memory heap */
-      u8 pad[3];   /**< log2 (size of the packing page block) */
-      u8 log2_pages;
+      u8 lock;     /**< per-bucket writer lock */
+      u8 pad[2];
+      u8 log2_pages; /**< log2 (size of the packing page block) */
     };
     u64 as_u64;
   };
@@ -69,15 +70,14 @@ typedef struct clib_bihash_value
 typedef struct
 {
   clib_bihash_bucket_t *buckets;  /**< Hash bucket vector, power-of-two in size */
-  volatile u32 *writer_lock;  /**< Writer lock, in its own cache line */
+  volatile u32 *alloc_lock;  /**< Page allocator lock, in its own cache line */
     BVT (clib_bihash_value) ** working_copies;
 					    /**< Working copies (various sizes), to avoid locking against readers */
-  clib_bihash_bucket_t saved_bucket; /**< Saved bucket pointer */
   u32 nbuckets;			     /**< Number of hash buckets */
   u32 log2_nbuckets;		     /**< lg(nbuckets) */
   u8 *name;			     /**< hash table name */
-    BVT (clib_bihash_value) ** freelists;
-				      /**< power of two freelist vector */
+    BVT (clib_bihash_value) *** freelists;
+				      /**< per-thread power of two freelist vectors */
   void *mheap;	/**< clib memory heap */
 } clib_bihash_t;
 
@@ -127,6 +127,20 @@ int clib_bihash_add_del (clib_bihash * h, clib_bihash_kv * add_v, int is_add);
 int clib_bihash_search (clib_bihash * h,
 			clib_bihash_kv * search_v, clib_bihash_kv * return_v);
 
+/** Search a bi-hash table for a batch of keys
+
+    @param h - the bi-hash table to search
+    @param kvp - vector of n_keys (key,value) pairs; found pairs are
+    returned in place
+    @param n_keys - number of keys to look up
+    @param found - set to 1 for each key found, 0 otherwise
+    @returns the number of keys found
+    @note Keys are processed in strides of BIHASH_SEARCH_BATCH_STRIDE
+    (32 by default). Within a stride, hashes, bucket prefetches and page
+    prefetches are all done before any key comparison
+*/
+u32 clib_bihash_search_batch (clib_bihash * h, clib_bihash_kv * kvp,
+			      u32 n_keys, u8 * found);
 
 /** Visit active (key,value) pairs in a bi-hash table
 
@@ -30,8 +30,13 @@ void BV (clib_bihash_init)
 
   oldheap = clib_mem_set_heap (h->mheap);
   vec_validate_aligned (h->buckets, nbuckets - 1, CLIB_CACHE_LINE_BYTES);
-  h->writer_lock = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
-					   CLIB_CACHE_LINE_BYTES);
+  h->alloc_lock = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
+					  CLIB_CACHE_LINE_BYTES);
+  h->alloc_lock[0] = 0;
+
+  /* Sized once, so writers index them without the allocator lock */
+  vec_validate (h->working_copies, os_get_ncpus () - 1);
+  vec_validate (h->freelists, os_get_ncpus () - 1);
 
   clib_mem_set_heap (oldheap);
 }
@@ -42,25 +47,50 @@ void BV (clib_bihash_free) (BVT (clib_bihash) * h)
   memset (h, 0, sizeof (*h));
 }
 
+static inline void
+BV (clib_bihash_alloc_lock) (BVT (clib_bihash) * h)
+{
+  while (__sync_lock_test_and_set (h->alloc_lock, 1))
+    ;
+}
+
+static inline void
+BV (clib_bihash_alloc_unlock) (BVT (clib_bihash) * h)
+{
+  CLIB_MEMORY_BARRIER ();
+  h->alloc_lock[0] = 0;
+}
+
+/*
+ * Each thread recycles pages through its own freelists. The allocator
+ * lock is only taken to carve new pages out of the shared mheap, or to
+ * grow a thread's freelist vector.
+ */
 static
 BVT (clib_bihash_value) *
 BV (value_alloc) (BVT (clib_bihash) * h, u32 log2_pages)
 {
   BVT (clib_bihash_value) * rv = 0;
+  BVT (clib_bihash_value) ** freelists;
+  u32 cpu_number = os_get_cpu_number ();
   void *oldheap;
 
-  ASSERT (h->writer_lock[0]);
-  if (log2_pages >= vec_len (h->freelists) || h->freelists[log2_pages] == 0)
+  ASSERT (cpu_number < vec_len (h->freelists));
+  freelists = h->freelists[cpu_number];
+
+  if (log2_pages >= vec_len (freelists) || freelists[log2_pages] == 0)
     {
+      BV (clib_bihash_alloc_lock) (h);
       oldheap = clib_mem_set_heap (h->mheap);
 
-      vec_validate (h->freelists, log2_pages);
+      vec_validate (h->freelists[cpu_number], log2_pages);
       vec_validate_aligned (rv, (1 << log2_pages) - 1, CLIB_CACHE_LINE_BYTES);
       clib_mem_set_heap (oldheap);
+      BV (clib_bihash_alloc_unlock) (h);
       goto initialize;
     }
-  rv = h->freelists[log2_pages];
-  h->freelists[log2_pages] = rv->next_free;
+  rv = freelists[log2_pages];
+  freelists[log2_pages] = rv->next_free;
 
 initialize:
   ASSERT (rv);
@@ -78,19 +108,30 @@ static void
 BV (value_free) (BVT (clib_bihash) * h, BVT (clib_bihash_value) * v)
 {
   u32 log2_pages;
-
-  ASSERT (h->writer_lock[0]);
+  u32 cpu_number = os_get_cpu_number ();
+  void *oldheap;
 
   log2_pages = min_log2 (vec_len (v));
 
-  ASSERT (vec_len (h->freelists) > log2_pages);
+  ASSERT (cpu_number < vec_len (h->freelists));
 
-  v->next_free = h->freelists[log2_pages];
-  h->freelists[log2_pages] = v;
+  /* pages allocated by another thread may be larger than any seen here */
+  if (log2_pages >= vec_len (h->freelists[cpu_number]))
+    {
+      BV (clib_bihash_alloc_lock) (h);
+      oldheap = clib_mem_set_heap (h->mheap);
+      vec_validate (h->freelists[cpu_number], log2_pages);
+      clib_mem_set_heap (oldheap);
+      BV (clib_bihash_alloc_unlock) (h);
+    }
+
+  v->next_free = h->freelists[cpu_number][log2_pages];
+  h->freelists[cpu_number][log2_pages] = v;
 }
 
-static inline void
-BV (make_working_copy) (BVT (clib_bihash) * h, clib_bihash_bucket_t * b)
+static inline BVT (clib_bihash_value) *
+BV (make_working_copy) (BVT (clib_bihash) * h, clib_bihash_bucket_t * b,
+			clib_bihash_bucket_t * saved_bucket)
 {
   BVT (clib_bihash_value) * v;
   clib_bihash_bucket_t working_bucket __attribute__ ((aligned (8)));
@@ -98,12 +139,7 @@ BV (make_working_copy) (BVT (clib_bihash) * h, clib_bihash_bucket_t * b)
   BVT (clib_bihash_value) * working_copy;
   u32 cpu_number = os_get_cpu_number ();
 
-  if (cpu_number >= vec_len (h->working_copies))
-    {
-      oldheap = clib_mem_set_heap (h->mheap);
-      vec_validate (h->working_copies, cpu_number);
-      clib_mem_set_heap (oldheap);
-    }
+  ASSERT (cpu_number < vec_len (h->working_copies));
 
   /*
    * working_copies are per-cpu so that near-simultaneous
@@ -112,18 +148,20 @@ BV (make_working_copy) (BVT (clib_bihash) * h, clib_bihash_bucket_t * b)
    */
   working_copy = h->working_copies[cpu_number];
 
-  h->saved_bucket.as_u64 = b->as_u64;
-  oldheap = clib_mem_set_heap (h->mheap);
+  saved_bucket->as_u64 = b->as_u64;
 
   if ((1 << b->log2_pages) > vec_len (working_copy))
     {
+      BV (clib_bihash_alloc_lock) (h);
+      oldheap = clib_mem_set_heap (h->mheap);
       vec_validate_aligned (working_copy, (1 << b->log2_pages) - 1,
 			    sizeof (u64));
+      clib_mem_set_heap (oldheap);
+      BV (clib_bihash_alloc_unlock) (h);
       h->working_copies[cpu_number] = working_copy;
     }
 
   _vec_len (working_copy) = 1 << b->log2_pages;
-  clib_mem_set_heap (oldheap);
 
   v = BV (clib_bihash_get_value) (h, b->offset);
 
@@ -132,7 +170,7 @@ BV (make_working_copy) (BVT (clib_bihash) * h, clib_bihash_bucket_t * b)
   working_bucket.offset = BV (clib_bihash_get_offset) (h, working_copy);
   CLIB_MEMORY_BARRIER ();
   b->as_u64 = working_bucket.as_u64;
-  h->working_copies[cpu_number] = working_copy;
+  return working_copy;
 }
 
 static
@@ -186,14 +224,13 @@ int BV (clib_bihash_add_del)
   (BVT (clib_bihash) * h, BVT (clib_bihash_kv) * add_v, int is_add)
 {
   u32 bucket_index;
-  clib_bihash_bucket_t *b, tmp_b;
+  clib_bihash_bucket_t *b, tmp_b, saved_bucket;
   BVT (clib_bihash_value) * v, *new_v, *save_new_v, *working_copy;
   u32 value_index;
   int rv = 0;
   int i;
   u64 hash, new_hash;
   u32 new_log2_pages;
-  u32 cpu_number = os_get_cpu_number ();
 
   hash = BV (clib_bihash_hash) (add_v);
 
@@ -202,8 +239,7 @@ int BV (clib_bihash_add_del)
 
   hash >>= h->log2_nbuckets;
 
-  while (__sync_lock_test_and_set (h->writer_lock, 1))
-    ;
+  clib_bihash_lock_bucket (b);
 
   /* First elt in the bucket? */
   if (b->offset == 0)
@@ -218,15 +254,16 @@ int BV (clib_bihash_add_del)
       *v->kvp = *add_v;
       tmp_b.as_u64 = 0;
       tmp_b.offset = BV (clib_bihash_get_offset) (h, v);
+      tmp_b.lock = 1;
 
       b->as_u64 = tmp_b.as_u64;
       goto unlock;
     }
 
-  BV (make_working_copy) (h, b);
+  working_copy = BV (make_working_copy) (h, b, &saved_bucket);
 
-  v = BV (clib_bihash_get_value) (h, h->saved_bucket.offset);
-  value_index = hash & ((1 << h->saved_bucket.log2_pages) - 1);
+  v = BV (clib_bihash_get_value) (h, saved_bucket.offset);
+  value_index = hash & ((1 << saved_bucket.log2_pages) - 1);
   v += value_index;
 
   if (is_add)
@@ -242,7 +279,7 @@ int BV (clib_bihash_add_del)
 	      clib_memcpy (&(v->kvp[i]), add_v, sizeof (*add_v));
 	      CLIB_MEMORY_BARRIER ();
 	      /* Restore the previous (k,v) pairs */
-	      b->as_u64 = h->saved_bucket.as_u64;
+	      b->as_u64 = saved_bucket.as_u64;
 	      goto unlock;
 	    }
 	}
@@ -252,7 +289,7 @@ int BV (clib_bihash_add_del)
 	    {
 	      clib_memcpy (&(v->kvp[i]), add_v, sizeof (*add_v));
 	      CLIB_MEMORY_BARRIER ();
-	      b->as_u64 = h->saved_bucket.as_u64;
+	      b->as_u64 = saved_bucket.as_u64;
 	      goto unlock;
 	    }
 	}
@@ -266,19 +303,18 @@ int BV (clib_bihash_add_del)
 	    {
 	      memset (&(v->kvp[i]), 0xff, sizeof (*(add_v)));
 	      CLIB_MEMORY_BARRIER ();
-	      b->as_u64 = h->saved_bucket.as_u64;
+	      b->as_u64 = saved_bucket.as_u64;
 	      goto unlock;
 	    }
 	}
       rv = -3;
-      b->as_u64 = h->saved_bucket.as_u64;
+      b->as_u64 = saved_bucket.as_u64;
       goto unlock;
     }
 
-  new_log2_pages = h->saved_bucket.log2_pages + 1;
+  new_log2_pages = saved_bucket.log2_pages + 1;
 
 expand_again:
-  working_copy = h->working_copies[cpu_number];
   new_v = BV (split_and_rehash) (h, working_copy, new_log2_pages);
   if (new_v == 0)
     {
@@ -307,16 +343,17 @@ expand_again:
   goto expand_again;
 
 expand_ok:
+  tmp_b.as_u64 = 0;
+  tmp_b.lock = 1;
   tmp_b.log2_pages = min_log2 (vec_len (save_new_v));
   tmp_b.offset = BV (clib_bihash_get_offset) (h, save_new_v);
   CLIB_MEMORY_BARRIER ();
   b->as_u64 = tmp_b.as_u64;
-  v = BV (clib_bihash_get_value) (h, h->saved_bucket.offset);
+  v = BV (clib_bihash_get_value) (h, saved_bucket.offset);
   BV (value_free) (h, v);
 
 unlock:
-  CLIB_MEMORY_BARRIER ();
-  h->writer_lock[0] = 0;
+  clib_bihash_unlock_bucket (b);
   return rv;
 }
 
@@ -366,6 +403,7 @@ u8 *BV (format_bihash) (u8 * s, va_list * args)
   BVT (clib_bihash_value) * v;
   int i, j, k;
   u64 active_elements = 0;
+  uword n_freelists = 0;
 
   s = format (s, "Hash table %s\n", h->name ? h->name : (u8 *) "(unnamed)");
 
@@ -410,7 +448,9 @@ u8 *BV (format_bihash) (u8 * s, va_list * args)
     }
 
   s = format (s, "    %lld active elements\n", active_elements);
-  s = format (s, "    %d free lists\n", vec_len (h->freelists));
+  for (i = 0; i < vec_len (h->freelists); i++)
+    n_freelists = clib_max (n_freelists, vec_len (h->freelists[i]));
+  s = format (s, "    %d free lists\n", n_freelists);
 
   return s;
 }
@@ -61,28 +61,59 @@ typedef struct
     struct
     {
       u32 offset;
-      u8 pad[3];
+      u8 lock;
+      u8 pad[2];
       u8 log2_pages;
     };
     u64 as_u64;
   };
 } clib_bihash_bucket_t;
+
+/*
+ * Writers serialize per bucket: the lock bit lives in the bucket itself,
+ * so writers which touch different buckets don't contend. Readers ignore
+ * the lock bit, and never see a bucket which isn't self-consistent.
+ */
+static inline void
+clib_bihash_lock_bucket (clib_bihash_bucket_t * b)
+{
+  clib_bihash_bucket_t unlocked, locked;
+
+  while (1)
+    {
+      unlocked.as_u64 = *(volatile u64 *) &b->as_u64;
+      if (unlocked.lock)
+	continue;
+      locked.as_u64 = unlocked.as_u64;
+      locked.lock = 1;
+      if (__sync_bool_compare_and_swap (&b->as_u64, unlocked.as_u64,
+					locked.as_u64))
+	return;
+    }
+}
+
+static inline void
+clib_bihash_unlock_bucket (clib_bihash_bucket_t * b)
+{
+  CLIB_MEMORY_BARRIER ();
+  b->lock = 0;
+}
 #endif /* __defined_clib_bihash_bucket_t__ */
 
 typedef struct
 {
   BVT (clib_bihash_value) * values;
   clib_bihash_bucket_t *buckets;
-  volatile u32 *writer_lock;
+  volatile u32 *alloc_lock;
 
     BVT (clib_bihash_value) ** working_copies;
-  clib_bihash_bucket_t saved_bucket;
 
   u32 nbuckets;
   u32 log2_nbuckets;
   u8 *name;
 
-    BVT (clib_bihash_value) ** freelists;
+  /* per-thread vectors of power of two freelists */
+    BVT (clib_bihash_value) *** freelists;
   void *mheap;
 
 } BVT (clib_bihash);
@@ -201,6 +232,88 @@ static inline int BV (clib_bihash_search_inline_2)
 }
 
 
+#ifndef BIHASH_SEARCH_BATCH_STRIDE
+#define BIHASH_SEARCH_BATCH_STRIDE 32
+#endif
+
+/*
+ * Search for n_keys keys at once, BIHASH_SEARCH_BATCH_STRIDE keys at
+ * a time. Within a stride, hashes are computed first, then all bucket
+ * headers are prefetched, then all (key,value) pages, and only then
+ * are keys compared; DRAM latency is overlapped across the stride
+ * instead of being paid once per key.
+ * Found (key,value) pairs are returned in place, and found[i]
+ * is set to 1 / 0. Returns the number of hits.
+ */
+static inline u32 BV (clib_bihash_search_batch)
+  (const BVT (clib_bihash) * h, BVT (clib_bihash_kv) * kvp, u32 n_keys,
+   u8 * found)
+{
+  u64 hashes[BIHASH_SEARCH_BATCH_STRIDE];
+  BVT (clib_bihash_value) * values[BIHASH_SEARCH_BATCH_STRIDE];
+  clib_bihash_bucket_t *b;
+  u32 n_hits = 0;
+  u32 n_this_stride;
+  int i, j;
+
+  while (n_keys > 0)
+    {
+      n_this_stride = n_keys < BIHASH_SEARCH_BATCH_STRIDE ?
+	n_keys : BIHASH_SEARCH_BATCH_STRIDE;
+
+      /* Stage 1: hash, prefetch buckets */
+      for (i = 0; i < n_this_stride; i++)
+	{
+	  hashes[i] = BV (clib_bihash_hash) (&kvp[i]);
+	  b = &h->buckets[hashes[i] & (h->nbuckets - 1)];
+	  CLIB_PREFETCH (b, sizeof (*b), LOAD);
+	}
+
+      /* Stage 2: locate (key,value) pages, prefetch them */
+      for (i = 0; i < n_this_stride; i++)
+	{
+	  u64 hash = hashes[i];
+	  b = &h->buckets[hash & (h->nbuckets - 1)];
+
+	  if (b->offset == 0)
+	    {
+	      values[i] = 0;
+	      continue;
+	    }
+	  hash >>= h->log2_nbuckets;
+	  values[i] = BV (clib_bihash_get_value) (h, b->offset);
+	  values[i] += hash & ((1 << b->log2_pages) - 1);
+	  CLIB_PREFETCH (values[i], sizeof (values[i][0]), LOAD);
+	}
+
+      /* Stage 3: compare */
+      for (i = 0; i < n_this_stride; i++)
+	{
+	  found[i] = 0;
+	  if (values[i] == 0)
+	    continue;
+
+	  for (j = 0; j < BIHASH_KVP_PER_PAGE; j++)
+	    {
+	      if (BV (clib_bihash_key_compare)
+		  (values[i]->kvp[j].key, kvp[i].key))
+		{
+		  kvp[i] = values[i]->kvp[j];
+		  found[i] = 1;
+		  n_hits++;
+		  break;
+		}
+	    }
+	}
+
+      kvp += n_this_stride;
+      found += n_this_stride;
+      n_keys -= n_this_stride;
+    }
+  return n_hits;
+}
+
+
 #endif /* __included_bihash_template_h__ */
 
 /** @endcond */
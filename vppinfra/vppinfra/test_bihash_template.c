@@ -15,6 +15,7 @@
 #include <vppinfra/time.h>
 #include <vppinfra/cache.h>
 #include <vppinfra/error.h>
+#include <pthread.h>
 
 #include <vppinfra/bihash_8_8.h>
 #include <vppinfra/bihash_template.h>
@@ -30,23 +31,126 @@ typedef struct
   int careful_delete_tests;
   int verbose;
   int non_random_keys;
+  int batch;
+  u32 nthreads;
   uword *key_hash;
   u64 *keys;
     BVT (clib_bihash) hash;
   clib_time_t clib_time;
 
+  /* multi-threaded benchmark state */
+  u32 n_active_threads;
+  volatile u32 threads_ready;
+  volatile u32 threads_go;
+  u32 n_failures;
+
   unformat_input_t *input;
 
 } test_main_t;
 
 test_main_t test_main;
 
+/* Give each benchmark thread its own working copy / heap slot */
+static __thread uword test_cpu_index;
+
+uword
+os_get_cpu_number (void)
+{
+  return test_cpu_index;
+}
+
+uword
+os_get_ncpus (void)
+{
+  return test_main.nthreads + 1;
+}
+
 uword
 vl (void *v)
 {
   return vec_len (v);
 }
 
+#define TEST_BATCH_FRAME_SIZE 256
+
+/*
+ * Compare one-at-a-time lookups with clib_bihash_search_batch, in
+ * frame-sized batches. Use a table much larger than the LLC to see
+ * the effect of overlapping the bucket and page misses.
+ */
+static clib_error_t *
+test_bihash_batch (test_main_t * tm)
+{
+  BVT (clib_bihash) * h = &tm->hash;
+  BVT (clib_bihash_kv) kvs[TEST_BATCH_FRAME_SIZE];
+  u8 found[TEST_BATCH_FRAME_SIZE];
+  uword total_searches;
+  f64 before, delta;
+  u32 n_this_frame;
+  int i, j, k;
+
+  total_searches = (uword) tm->search_iter * (uword) tm->nitems;
+
+  fformat (stdout, "Scalar inline search for items %d times...\n",
+	   tm->search_iter);
+
+  before = clib_time_now (&tm->clib_time);
+
+  for (j = 0; j < tm->search_iter; j++)
+    {
+      for (i = 0; i < tm->nitems; i++)
+	{
+	  kvs[0].key = tm->keys[i];
+	  if (BV (clib_bihash_search_inline) (h, &kvs[0]) < 0
+	      || kvs[0].value != (u64) (i + 1))
+	    return clib_error_return (0, "scalar search for key %lld failed",
+				      tm->keys[i]);
+	}
+    }
+
+  delta = clib_time_now (&tm->clib_time) - before;
+
+  fformat (stdout, "%lld searches in %.6f seconds\n", total_searches, delta);
+  if (delta > 0)
+    fformat (stdout, "%.f searches per second\n",
+	     ((f64) total_searches) / delta);
+
+  fformat (stdout, "Batch search for items %d times, %d keys per batch...\n",
+	   tm->search_iter, TEST_BATCH_FRAME_SIZE);
+
+  before = clib_time_now (&tm->clib_time);
+
+  for (j = 0; j < tm->search_iter; j++)
+    {
+      for (i = 0; i < tm->nitems; i += n_this_frame)
+	{
+	  n_this_frame = clib_min (TEST_BATCH_FRAME_SIZE, tm->nitems - i);
+
+	  for (k = 0; k < n_this_frame; k++)
+	    kvs[k].key = tm->keys[i + k];
+
+	  if (BV (clib_bihash_search_batch) (h, kvs, n_this_frame, found)
+	      != n_this_frame)
+	    return clib_error_return (0, "batch search at item %d failed", i);
+
+	  for (k = 0; k < n_this_frame; k++)
+	    if (kvs[k].value != (u64) (i + k + 1))
+	      return clib_error_return (0, "batch search for key %lld "
+					"returned %lld", tm->keys[i + k],
+					kvs[k].value);
+	}
+    }
+
+  delta = clib_time_now (&tm->clib_time) - before;
+
+  fformat (stdout, "%lld searches in %.6f seconds\n", total_searches, delta);
+  if (delta > 0)
+    fformat (stdout, "%.f searches per second\n",
+	     ((f64) total_searches) / delta);
+
+  return 0;
+}
+
 static clib_error_t *
 test_bihash (test_main_t * tm)
 {
@@ -56,6 +160,7 @@ test_bihash (test_main_t * tm)
   f64 before, delta;
   BVT (clib_bihash) * h;
   BVT (clib_bihash_kv) kv;
+  clib_error_t *error;
 
   h = &tm->hash;
 
@@ -154,6 +259,13 @@ test_bihash (test_main_t * tm)
 
   fformat (stdout, "%lld searches in %.6f seconds\n", total_searches, delta);
 
+  if (tm->batch)
+    {
+      error = test_bihash_batch (tm);
+      if (error)
+	return error;
+    }
+
   fformat (stdout, "Standard E-hash search for items %d times...\n",
 	   tm->search_iter);
 
@@ -219,6 +331,145 @@ test_bihash (test_main_t * tm)
   return 0;
 }
 
+typedef struct
+{
+  test_main_t *tm;
+  u32 thread_index;
+} test_thread_args_t;
+
+static void *
+test_bihash_thread_fn (void *arg)
+{
+  test_thread_args_t *a = arg;
+  test_main_t *tm = a->tm;
+  BVT (clib_bihash) * h = &tm->hash;
+  BVT (clib_bihash_kv) kv;
+  u32 first, last;
+  int i, j;
+
+  test_cpu_index = a->thread_index + 1;
+  clib_per_cpu_mheaps[test_cpu_index] = clib_per_cpu_mheaps[0];
+
+  /* Each thread owns a disjoint slice of the keys */
+  first = (tm->nitems / tm->n_active_threads) * a->thread_index;
+  last = (tm->nitems / tm->n_active_threads) * (a->thread_index + 1);
+
+  __sync_fetch_and_add (&tm->threads_ready, 1);
+  while (tm->threads_go == 0)
+    ;
+
+  for (i = first; i < last; i++)
+    {
+      kv.key = tm->keys[i];
+      kv.value = i + 1;
+      BV (clib_bihash_add_del) (h, &kv, 1 /* is_add */ );
+    }
+
+  for (j = 0; j < tm->search_iter; j++)
+    {
+      for (i = first; i < last; i++)
+	{
+	  kv.key = tm->keys[i];
+	  if (BV (clib_bihash_search) (h, &kv, &kv) < 0
+	      || kv.value != (u64) (i + 1))
+	    __sync_fetch_and_add (&tm->n_failures, 1);
+	}
+    }
+  return 0;
+}
+
+static clib_error_t *
+test_bihash_threads (test_main_t * tm)
+{
+  BVT (clib_bihash) * h = &tm->hash;
+  BVT (clib_bihash_kv) kv;
+  test_thread_args_t *args = 0;
+  pthread_t *threads = 0;
+  f64 before, delta;
+  u64 total_ops;
+  u32 n, i, n_lost;
+  int rv;
+
+  fformat (stdout, "Pick %lld unique random keys...\n", tm->nitems);
+
+  for (i = 0; i < tm->nitems; i++)
+    {
+      u64 rndkey;
+
+    again:
+      rndkey = random_u64 (&tm->seed);
+      if (hash_get (tm->key_hash, rndkey))
+	goto again;
+      hash_set (tm->key_hash, rndkey, i + 1);
+      vec_add1 (tm->keys, rndkey);
+    }
+
+  vec_validate (args, tm->nthreads - 1);
+  vec_validate (threads, tm->nthreads - 1);
+
+  for (n = 1; n <= tm->nthreads; n <<= 1)
+    {
+      BV (clib_bihash_init) (h, "test", tm->nbuckets, 3ULL << 30);
+
+      tm->n_active_threads = n;
+      tm->threads_ready = 0;
+      tm->threads_go = 0;
+      tm->n_failures = 0;
+
+      for (i = 0; i < n; i++)
+	{
+	  args[i].tm = tm;
+	  args[i].thread_index = i;
+	  rv = pthread_create (&threads[i], 0, test_bihash_thread_fn,
+			       &args[i]);
+	  if (rv)
+	    return clib_error_return_code (0, rv, 0,
+					   "pthread_create returned %d", rv);
+	}
+
+      while (tm->threads_ready < n)
+	;
+
+      before = clib_time_now (&tm->clib_time);
+      CLIB_MEMORY_BARRIER ();
+      tm->threads_go = 1;
+
+      for (i = 0; i < n; i++)
+	pthread_join (threads[i], 0);
+
+      delta = clib_time_now (&tm->clib_time) - before;
+      total_ops = (u64) (tm->nitems / n) * n * (1 + tm->search_iter);
+
+      /*
+       * Lockless readers may transiently miss a key whose bucket is
+       * being rewritten by another writer; nothing may be lost, though.
+       */
+      n_lost = 0;
+      for (i = 0; i < (tm->nitems / n) * n; i++)
+	{
+	  kv.key = tm->keys[i];
+	  if (BV (clib_bihash_search) (h, &kv, &kv) < 0
+	      || kv.value != (u64) (i + 1))
+	    n_lost++;
+	}
+
+      fformat (stdout, "%2d threads: %lld add+search ops in %.6f seconds, "
+	       "%.2f Mops/s, %d transient misses\n", n, total_ops, delta,
+	       delta > 0 ? ((f64) total_ops) / delta / 1e6 : 0.0,
+	       tm->n_failures);
+
+      BV (clib_bihash_free) (h);
+
+      if (n_lost)
+	return clib_error_return (0, "%d keys lost with %d threads",
+				  n_lost, n);
+    }
+
+  vec_free (args);
+  vec_free (threads);
+  return 0;
+}
+
 clib_error_t *
 test_bihash_main (test_main_t * tm)
 {
@@ -242,6 +493,10 @@ test_bihash_main (test_main_t * tm)
 	;
       else if (unformat (i, "search %d", &tm->search_iter))
 	;
+      else if (unformat (i, "threads %d", &tm->nthreads))
+	;
+      else if (unformat (i, "batch"))
+	tm->batch = 1;
       else if (unformat (i, "verbose"))
 	tm->verbose = 1;
       else
@@ -249,7 +504,10 @@ test_bihash_main (test_main_t * tm)
 				  format_unformat_error, i);
     }
 
-  error = test_bihash (tm);
+  if (tm->nthreads)
+    error = test_bihash_threads (tm);
+  else
+    error = test_bihash (tm);
 
   return error;
 }